@@ -182,6 +182,7 @@ CONFIG += harfbuzz
 CONFIG += freetype
 CONFIG += fontconfig
 CONFIG += gettext
+CONFIG += zlib
 
 #Uncomment the following line to enable the QScintilla editor
 !nogui {
@@ -197,6 +198,19 @@ nogui {
   DEFINES += OPENSCAD_NOGUI
 }
 
+# shm_open(), used to export meshes to shared memory
+linux*: LIBS += -lrt
+
+# Attribute heap usage to subsystems, reported by --timing
+memory-accounting {
+  DEFINES += ENABLE_MEMORY_ACCOUNTING
+}
+
+# Count cycles, cache and branch misses of hot code, printed by --timing
+perf-counters {
+  DEFINES += ENABLE_PERF_COUNTERS
+}
+
 mdi {
   DEFINES += ENABLE_MDI
 }
@@ -257,11 +271,11 @@ HEADERS += src/version_check.h \
            src/rendersettings.h \
            src/colormap.h \
            src/ThrownTogetherRenderer.h \
-           src/CGAL_OGL_Polyhedron.h \
-           src/OGL_helper.h \
            src/QGLView.h \
            src/GLView.h \
            src/MainWindow.h \
+           src/csgworker.h \
+           src/FramePrefetcher.h \
            src/OpenSCADApp.h \
            src/WindowManager.h \
            src/Preferences.h \
@@ -271,17 +285,22 @@ HEADERS += src/version_check.h \
            src/FontListTableView.h \
            src/GroupModule.h \
            src/FileModule.h \
+           src/InstantiationCache.h \
+           src/CSGLoader.h \
            src/builtin.h \
            src/calc.h \
            src/context.h \
+           src/Identifier.h \
            src/modcontext.h \
            src/evalcontext.h \
            src/csgops.h \
            src/CSGTreeNormalizer.h \
            src/CSGTreeEvaluator.h \
+           src/PreviewCache.h \
            src/dxfdata.h \
            src/dxfdim.h \
            src/export.h \
+           src/SharedMesh.h \
            src/stackcheck.h \
            src/exceptions.h \
            src/grid.h \
@@ -300,6 +319,8 @@ HEADERS += src/version_check.h \
            src/transformnode.h \
            src/colornode.h \
            src/rendernode.h \
+           src/simplifynode.h \
+           src/reducednode.h \
            src/textnode.h \
            src/openscad.h \
            src/handle_dep.h \
@@ -309,7 +330,10 @@ HEADERS += src/version_check.h \
            src/GeometryUtils.h \
            src/polyset-utils.h \
            src/polyset.h \
+           src/PolySetBVH.h \
+           src/MeshValidator.h \
            src/printutils.h \
+           src/NumberFormat.h \
            src/fileutils.h \
            src/value.h \
            src/progress.h \
@@ -320,6 +344,26 @@ HEADERS += src/version_check.h \
            src/nodedumper.h \
            src/ModuleCache.h \
            src/GeometryCache.h \
+           src/GeometrySerializer.h \
+           src/GeometryBundle.h \
+           src/PersistentCache.h \
+           src/RemoteCache.h \
+           src/CacheStats.h \
+           src/ImportCache.h \
+           src/FunctionCache.h \
+           src/TableIndex.h \
+           src/ASTCache.h \
+           src/FileWatcher.h \
+           src/LibraryIndex.h \
+           src/Session.h \
+           src/ThreadPool.h \
+           src/MemoryAccounting.h \
+           src/EvaluationBudget.h \
+           src/Profiler.h \
+           src/Timing.h \
+           src/PerfCounters.h \
+           src/OperationCounters.h \
+           src/EvaluationTrace.h \
            src/GeometryEvaluator.h \
            src/Tree.h \
            src/DrawingCallback.h \
@@ -344,6 +388,7 @@ HEADERS += src/version_check.h \
            src/CsgInfo.h \
            \
            src/Dock.h \
+           src/CachePanel.h \
            src/AutoUpdater.h \
            src/launchingscreen.h \
            src/legacyeditor.h \
@@ -355,6 +400,7 @@ SOURCES += src/version_check.cc \
            src/Camera.cc \
            src/handle_dep.cc \
            src/value.cc \
+           src/NumberFormat.cc \
            src/stackcheck.cc \
            src/func.cc \
            src/localscope.cc \
@@ -366,12 +412,15 @@ SOURCES += src/version_check.cc \
            src/csgnode.cc \
            src/CSGTreeNormalizer.cc \
            src/CSGTreeEvaluator.cc \
+           src/PreviewCache.cc \
            src/Geometry.cc \
            src/Polygon2d.cc \
            src/clipper-utils.cc \
            src/polyset-utils.cc \
            src/GeometryUtils.cc \
            src/polyset.cc \
+           src/PolySetBVH.cc \
+           src/MeshValidator.cc \
            src/polyset-gl.cc \
            src/csgops.cc \
            src/transform.cc \
@@ -382,6 +431,8 @@ SOURCES += src/version_check.cc \
            src/surface.cc \
            src/control.cc \
            src/render.cc \
+           src/simplify.cc \
+           src/reducednode.cc \
            src/text.cc \
            src/dxfdata.cc \
            src/dxfdim.cc \
@@ -402,6 +453,18 @@ SOURCES += src/version_check.cc \
            src/GeometryEvaluator.cc \
            src/ModuleCache.cc \
            src/GeometryCache.cc \
+           src/GeometrySerializer.cc \
+           src/GeometryBundle.cc \
+           src/PersistentCache.cc \
+           src/RemoteCache.cc \
+           src/CacheStats.cc \
+           src/ImportCache.cc \
+           src/FunctionCache.cc \
+           src/TableIndex.cc \
+           src/ASTCache.cc \
+           src/FileWatcher.cc \
+           src/LibraryIndex.cc \
+           src/Session.cc \
            src/Tree.cc \
 	   src/DrawingCallback.cc \
 	   src/FreetypeRenderer.cc \
@@ -419,17 +482,30 @@ SOURCES += src/version_check.cc \
            \
            src/grid.cc \
            src/hash.cc \
+           src/ThreadPool.cc \
+           src/MemoryAccounting.cc \
+           src/EvaluationBudget.cc \
+           src/Profiler.cc \
+           src/Timing.cc \
+           src/PerfCounters.cc \
+           src/OperationCounters.cc \
+           src/EvaluationTrace.cc \
            src/GroupModule.cc \
            src/FileModule.cc \
+           src/InstantiationCache.cc \
+           src/CSGLoader.cc \
            src/builtin.cc \
            src/calc.cc \
            src/export.cc \
            src/export_stl.cc \
            src/export_amf.cc \
+           src/export_3mf.cc \
            src/export_off.cc \
            src/export_dxf.cc \
            src/export_svg.cc \
            src/export_nef.cc \
+           src/export_scadgeom.cc \
+           src/export_shm.cc \
            src/export_png.cc \
            src/import.cc \
            src/renderer.cc \
@@ -444,10 +520,13 @@ SOURCES += src/version_check.cc \
            \
            src/openscad.cc \
            src/mainwin.cc \
+           src/csgworker.cc \
+           src/FramePrefetcher.cc \
            src/OpenSCADApp.cc \
            src/WindowManager.cc \
            src/UIUtils.cc \
            src/Dock.cc \
+           src/CachePanel.cc \
            src/FontListDialog.cc \
            src/FontListTableView.cc \
            src/launchingscreen.cc \
@@ -479,6 +558,12 @@ HEADERS += src/libtess2/Include/tesselator.h \
 unix:!macx {
   SOURCES += src/imageutils-lodepng.cc
   SOURCES += src/OffscreenContextGLX.cc
+  # Offscreen contexts without an X server, if EGL is available
+  # To disable: qmake CONFIG+=noegl
+  !noegl:system("pkg-config --exists egl") {
+    DEFINES += ENABLE_EGL
+    LIBS += $$system("pkg-config --libs egl")
+  }
 }
 macx {
   SOURCES += src/imageutils-macosx.cc
@@ -499,23 +584,26 @@ HEADERS += src/cgal.h \
            src/cgalfwd.h \
            src/cgalutils.h \
            src/Reindexer.h \
-           src/CGALCache.h \
            src/CGALRenderer.h \
            src/CGAL_Nef_polyhedron.h \
            src/CGAL_Nef3_workaround.h \
            src/convex_hull_3_bugfix.h \
            src/cgalworker.h \
+           src/exportworker.h \
            src/Polygon2d-CGAL.h
 
 SOURCES += src/cgalutils.cc \
            src/cgalutils-applyops.cc \
+           src/cgalutils-corefine.cc \
            src/cgalutils-project.cc \
            src/cgalutils-tess.cc \
            src/cgalutils-polyhedron.cc \
-           src/CGALCache.cc \
+           src/GeometryCache-CGAL.cc \
+           src/GeometrySerializer-CGAL.cc \
            src/CGALRenderer.cc \
            src/CGAL_Nef_polyhedron.cc \
            src/cgalworker.cc \
+           src/exportworker.cc \
            src/Polygon2d-CGAL.cc
 }
 
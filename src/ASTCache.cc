@@ -0,0 +1,667 @@
+#include "ASTCache.h"
+#include "FileModule.h"
+#include "UserModule.h"
+#include "ModuleInstantiation.h"
+#include "expression.h"
+#include "function.h"
+#include "FontCache.h"
+#include "PlatformUtils.h"
+#include "handle_dep.h"
+#include "printutils.h"
+
+#include <cstdint>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <boost/filesystem.hpp>
+namespace fs = boost::filesystem;
+
+extern std::vector<std::string> librarypath;
+
+#define QUOTE(x__) # x__
+#define QUOTED(x__) QUOTE(x__)
+
+// Increase whenever the AST or the format below changes
+static const uint32_t AST_CACHE_VERSION = 1;
+static const char AST_CACHE_MAGIC[] = "OpenSCAD AST cache";
+
+namespace {
+	enum {
+		EXPR_NONE,
+		EXPR_UNARYOP,
+		EXPR_BINARYOP,
+		EXPR_TERNARYOP,
+		EXPR_ARRAYLOOKUP,
+		EXPR_LITERAL,
+		EXPR_RANGE,
+		EXPR_VECTOR,
+		EXPR_LOOKUP,
+		EXPR_MEMBERLOOKUP,
+		EXPR_FUNCTIONCALL,
+		EXPR_LET,
+		EXPR_LCIF,
+		EXPR_LCFOR,
+		EXPR_LCFORC,
+		EXPR_LCEACH,
+		EXPR_LCLET
+	};
+
+	enum {
+		INST_MODULE,
+		INST_IFELSE
+	};
+
+	bool read_file(const std::string &filename, std::string &contents)
+	{
+		std::ifstream ifs(filename.c_str(), std::ios::binary);
+		if (!ifs.is_open()) return false;
+		std::stringstream buf;
+		buf << ifs.rdbuf();
+		contents = buf.str();
+		return true;
+	}
+
+	fs::path entry_path(const std::string &dir, const std::string &filename, const std::string &text)
+	{
+		std::stringstream name;
+		name << std::hex << std::hash<std::string>()(filename + '\0' + text) << ".ast";
+		return fs::path(dir) / name.str();
+	}
+}
+
+/*!
+	Writes the AST in a compact binary form. CommonSubexpression nodes
+	aren't written; functions are shared again when they are read.
+*/
+class ASTWriter
+{
+public:
+	ASTWriter(std::ostream &stream) : stream(stream) {}
+
+	void writeInt(uint32_t v) { this->stream.write(reinterpret_cast<const char *>(&v), sizeof(v)); }
+	void writeDouble(double v) { this->stream.write(reinterpret_cast<const char *>(&v), sizeof(v)); }
+	void writeString(const std::string &s) {
+		writeInt(s.size());
+		this->stream.write(s.data(), s.size());
+	}
+
+	void writeLocation(const Location &loc) {
+		writeInt(loc.firstLine());
+		writeInt(loc.firstColumn());
+		writeInt(loc.lastLine());
+		writeInt(loc.lastColumn());
+	}
+
+	void writeValue(const Value &value) {
+		writeInt(value.type());
+		switch (value.type()) {
+		case Value::BOOL:
+			writeInt(value.toBool());
+			break;
+		case Value::NUMBER:
+			writeDouble(value.toDouble());
+			break;
+		case Value::STRING:
+			writeString(value.toString());
+			break;
+		case Value::VECTOR:
+			writeInt(value.toVector().size());
+			for(const auto &v : value.toVector()) writeValue(*v);
+			break;
+		case Value::RANGE: {
+			RangeType range = value.toRange();
+			writeDouble(range.begin_value());
+			writeDouble(range.step_value());
+			writeDouble(range.end_value());
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	void writeAssignments(const AssignmentList &args) {
+		writeInt(args.size());
+		for(const auto &arg : args) {
+			writeString(arg.name);
+			writeLocation(arg.location());
+			writeExpression(arg.expr.get());
+		}
+	}
+
+	void writeExpression(const Expression *expr) {
+		if (!expr) {
+			writeInt(EXPR_NONE);
+		}
+		else if (const CommonSubexpression *e = dynamic_cast<const CommonSubexpression *>(expr)) {
+			writeExpression(e->expr.get());
+		}
+		else if (const UnaryOp *e = dynamic_cast<const UnaryOp *>(expr)) {
+			writeHeader(EXPR_UNARYOP, *e);
+			writeInt(uint32_t(e->op));
+			writeExpression(e->expr.get());
+		}
+		else if (const BinaryOp *e = dynamic_cast<const BinaryOp *>(expr)) {
+			writeHeader(EXPR_BINARYOP, *e);
+			writeInt(uint32_t(e->op));
+			writeExpression(e->left.get());
+			writeExpression(e->right.get());
+		}
+		else if (const TernaryOp *e = dynamic_cast<const TernaryOp *>(expr)) {
+			writeHeader(EXPR_TERNARYOP, *e);
+			writeExpression(e->cond.get());
+			writeExpression(e->ifexpr.get());
+			writeExpression(e->elseexpr.get());
+		}
+		else if (const ArrayLookup *e = dynamic_cast<const ArrayLookup *>(expr)) {
+			writeHeader(EXPR_ARRAYLOOKUP, *e);
+			writeExpression(e->array.get());
+			writeExpression(e->index.get());
+		}
+		else if (const Literal *e = dynamic_cast<const Literal *>(expr)) {
+			writeHeader(EXPR_LITERAL, *e);
+			writeValue(*e->value);
+			writeExpression(e->source.get());
+		}
+		else if (const Range *e = dynamic_cast<const Range *>(expr)) {
+			writeHeader(EXPR_RANGE, *e);
+			writeExpression(e->begin.get());
+			writeExpression(e->step.get());
+			writeExpression(e->end.get());
+		}
+		else if (const Vector *e = dynamic_cast<const Vector *>(expr)) {
+			writeHeader(EXPR_VECTOR, *e);
+			writeInt(e->children.size());
+			for(const auto &child : e->children) writeExpression(child.get());
+		}
+		else if (const Lookup *e = dynamic_cast<const Lookup *>(expr)) {
+			writeHeader(EXPR_LOOKUP, *e);
+			writeString(e->name.str());
+		}
+		else if (const MemberLookup *e = dynamic_cast<const MemberLookup *>(expr)) {
+			writeHeader(EXPR_MEMBERLOOKUP, *e);
+			writeExpression(e->expr.get());
+			writeString(e->member);
+		}
+		else if (const FunctionCall *e = dynamic_cast<const FunctionCall *>(expr)) {
+			writeHeader(EXPR_FUNCTIONCALL, *e);
+			writeString(e->name);
+			writeAssignments(e->arguments);
+		}
+		else if (const Let *e = dynamic_cast<const Let *>(expr)) {
+			writeHeader(EXPR_LET, *e);
+			writeAssignments(e->arguments);
+			writeExpression(e->expr.get());
+		}
+		else if (const LcIf *e = dynamic_cast<const LcIf *>(expr)) {
+			writeHeader(EXPR_LCIF, *e);
+			writeExpression(e->cond.get());
+			writeExpression(e->ifexpr.get());
+			writeExpression(e->elseexpr.get());
+		}
+		else if (const LcFor *e = dynamic_cast<const LcFor *>(expr)) {
+			writeHeader(EXPR_LCFOR, *e);
+			writeAssignments(e->arguments);
+			writeExpression(e->expr.get());
+		}
+		else if (const LcForC *e = dynamic_cast<const LcForC *>(expr)) {
+			writeHeader(EXPR_LCFORC, *e);
+			writeAssignments(e->arguments);
+			writeAssignments(e->incr_arguments);
+			writeExpression(e->cond.get());
+			writeExpression(e->expr.get());
+		}
+		else if (const LcEach *e = dynamic_cast<const LcEach *>(expr)) {
+			writeHeader(EXPR_LCEACH, *e);
+			writeExpression(e->expr.get());
+		}
+		else if (const LcLet *e = dynamic_cast<const LcLet *>(expr)) {
+			writeHeader(EXPR_LCLET, *e);
+			writeAssignments(e->arguments);
+			writeExpression(e->expr.get());
+		}
+		else {
+			throw std::runtime_error("unknown expression type");
+		}
+	}
+
+	void writeScope(const LocalScope &scope) {
+		writeAssignments(scope.assignments);
+		writeInt(scope.children.size());
+		for(const auto &inst : scope.children) writeInstantiation(*inst);
+		writeInt(scope.functions.size());
+		for(const auto &f : scope.functions) {
+			const UserFunction *func = dynamic_cast<const UserFunction *>(f.second);
+			if (!func) throw std::runtime_error("builtin function in file scope");
+			writeString(f.first);
+			writeString(func->name);
+			writeLocation(func->location());
+			writeAssignments(func->definition_arguments);
+			writeExpression(func->expr.get());
+		}
+		writeInt(scope.modules.size());
+		for(const auto &m : scope.modules) {
+			const UserModule *module = dynamic_cast<const UserModule *>(m.second);
+			if (!module) throw std::runtime_error("builtin module in file scope");
+			writeString(m.first);
+			writeLocation(module->location());
+			writeAssignments(module->definition_arguments);
+			writeScope(module->scope);
+		}
+	}
+
+	void writeInstantiation(const ModuleInstantiation &inst) {
+		const IfElseModuleInstantiation *ifelse = dynamic_cast<const IfElseModuleInstantiation *>(&inst);
+		writeInt(ifelse ? INST_IFELSE : INST_MODULE);
+		writeString(inst.name());
+		writeString(inst.path());
+		writeLocation(inst.location());
+		writeAssignments(inst.arguments);
+		writeInt(inst.tag_root);
+		writeInt(inst.tag_highlight);
+		writeInt(inst.tag_background);
+		writeScope(inst.scope);
+		if (ifelse) writeScope(ifelse->else_scope);
+	}
+
+private:
+	void writeHeader(uint32_t type, const Expression &expr) {
+		writeInt(type);
+		writeLocation(expr.location());
+	}
+
+	std::ostream &stream;
+};
+
+/*!
+	Reads what ASTWriter wrote, throwing std::runtime_error if the data is
+	truncated or invalid.
+*/
+class ASTReader
+{
+public:
+	ASTReader(std::istream &stream) : stream(stream) {}
+
+	uint32_t readInt() {
+		uint32_t v;
+		read(&v, sizeof(v));
+		return v;
+	}
+	double readDouble() {
+		double v;
+		read(&v, sizeof(v));
+		return v;
+	}
+	std::string readString() {
+		std::string s(readInt(), '\0');
+		if (!s.empty()) read(&s[0], s.size());
+		return s;
+	}
+
+	Location readLocation() {
+		const int firstLine = readInt();
+		const int firstCol = readInt();
+		const int lastLine = readInt();
+		const int lastCol = readInt();
+		return Location(firstLine, firstCol, lastLine, lastCol);
+	}
+
+	ValuePtr readValue() {
+		switch (readInt()) {
+		case Value::UNDEFINED:
+			return ValuePtr::undefined;
+		case Value::BOOL:
+			return ValuePtr(readInt() != 0);
+		case Value::NUMBER:
+			return ValuePtr(readDouble());
+		case Value::STRING:
+			return ValuePtr(readString());
+		case Value::VECTOR: {
+			Value::VectorType vec(readInt());
+			for (size_t i = 0; i < vec.size(); i++) vec[i] = readValue();
+			return ValuePtr(std::move(vec));
+		}
+		case Value::RANGE: {
+			const double begin = readDouble();
+			const double step = readDouble();
+			const double end = readDouble();
+			return ValuePtr(RangeType(begin, step, end));
+		}
+		default:
+			throw std::runtime_error("invalid value type");
+		}
+	}
+
+	AssignmentList readAssignments() {
+		AssignmentList args;
+		const uint32_t n = readInt();
+		for (uint32_t i = 0; i < n; i++) {
+			const std::string name = readString();
+			const Location loc = readLocation();
+			args.push_back(Assignment(name, shared_ptr<Expression>(readExpression()), loc));
+		}
+		return args;
+	}
+
+	Expression *readExpression() {
+		const uint32_t type = readInt();
+		if (type == EXPR_NONE) return NULL;
+		const Location loc = readLocation();
+		switch (type) {
+		case EXPR_UNARYOP: {
+			const UnaryOp::Op op = UnaryOp::Op(readInt());
+			std::unique_ptr<Expression> expr(readExpression());
+			return new UnaryOp(op, expr.release(), loc);
+		}
+		case EXPR_BINARYOP: {
+			const BinaryOp::Op op = BinaryOp::Op(readInt());
+			std::unique_ptr<Expression> left(readExpression());
+			std::unique_ptr<Expression> right(readExpression());
+			return new BinaryOp(left.release(), op, right.release(), loc);
+		}
+		case EXPR_TERNARYOP: {
+			std::unique_ptr<Expression> cond(readExpression());
+			std::unique_ptr<Expression> ifexpr(readExpression());
+			std::unique_ptr<Expression> elseexpr(readExpression());
+			return new TernaryOp(cond.release(), ifexpr.release(), elseexpr.release(), loc);
+		}
+		case EXPR_ARRAYLOOKUP: {
+			std::unique_ptr<Expression> array(readExpression());
+			std::unique_ptr<Expression> index(readExpression());
+			return new ArrayLookup(array.release(), index.release(), loc);
+		}
+		case EXPR_LITERAL: {
+			ValuePtr value = readValue();
+			std::unique_ptr<Expression> source(readExpression());
+			if (source) return new Literal(value, source.release());
+			return new Literal(value, loc);
+		}
+		case EXPR_RANGE: {
+			std::unique_ptr<Expression> begin(readExpression());
+			std::unique_ptr<Expression> step(readExpression());
+			std::unique_ptr<Expression> end(readExpression());
+			if (!step) return new Range(begin.release(), end.release(), loc);
+			return new Range(begin.release(), step.release(), end.release(), loc);
+		}
+		case EXPR_VECTOR: {
+			std::unique_ptr<Vector> vec(new Vector(loc));
+			const uint32_t n = readInt();
+			for (uint32_t i = 0; i < n; i++) vec->push_back(readExpression());
+			return vec.release();
+		}
+		case EXPR_LOOKUP:
+			return new Lookup(readString(), loc);
+		case EXPR_MEMBERLOOKUP: {
+			std::unique_ptr<Expression> expr(readExpression());
+			const std::string member = readString();
+			return new MemberLookup(expr.release(), member, loc);
+		}
+		case EXPR_FUNCTIONCALL: {
+			const std::string name = readString();
+			return new FunctionCall(name, readAssignments(), loc);
+		}
+		case EXPR_LET: {
+			const AssignmentList args = readAssignments();
+			return new Let(args, readExpression(), loc);
+		}
+		case EXPR_LCIF: {
+			std::unique_ptr<Expression> cond(readExpression());
+			std::unique_ptr<Expression> ifexpr(readExpression());
+			std::unique_ptr<Expression> elseexpr(readExpression());
+			return new LcIf(cond.release(), ifexpr.release(), elseexpr.release(), loc);
+		}
+		case EXPR_LCFOR: {
+			const AssignmentList args = readAssignments();
+			return new LcFor(args, readExpression(), loc);
+		}
+		case EXPR_LCFORC: {
+			const AssignmentList args = readAssignments();
+			const AssignmentList incrargs = readAssignments();
+			std::unique_ptr<Expression> cond(readExpression());
+			std::unique_ptr<Expression> expr(readExpression());
+			return new LcForC(args, incrargs, cond.release(), expr.release(), loc);
+		}
+		case EXPR_LCEACH:
+			return new LcEach(readExpression(), loc);
+		case EXPR_LCLET: {
+			const AssignmentList args = readAssignments();
+			return new LcLet(args, readExpression(), loc);
+		}
+		default:
+			throw std::runtime_error("invalid expression type");
+		}
+	}
+
+	// Everything read is owned by scope as soon as it's created, so nothing
+	// leaks if reading fails halfway
+	void readScope(LocalScope &scope) {
+		scope.assignments = readAssignments();
+		uint32_t n = readInt();
+		for (uint32_t i = 0; i < n; i++) readInstantiation(scope);
+		n = readInt();
+		for (uint32_t i = 0; i < n; i++) {
+			const std::string key = readString();
+			const std::string name = readString();
+			const Location loc = readLocation();
+			AssignmentList args = readAssignments();
+			shared_ptr<Expression> expr(readExpression());
+			delete scope.functions[key];
+			scope.functions[key] = UserFunction::create(name.c_str(), args, expr, loc);
+		}
+		n = readInt();
+		for (uint32_t i = 0; i < n; i++) {
+			const std::string key = readString();
+			UserModule *module = new UserModule(readLocation());
+			delete scope.modules[key];
+			scope.modules[key] = module;
+			module->definition_arguments = readAssignments();
+			readScope(module->scope);
+		}
+	}
+
+	void readInstantiation(LocalScope &scope) {
+		const uint32_t type = readInt();
+		if (type != INST_MODULE && type != INST_IFELSE) throw std::runtime_error("invalid instantiation type");
+		const std::string name = readString();
+		const std::string path = readString();
+		const Location loc = readLocation();
+		const AssignmentList args = readAssignments();
+
+		ModuleInstantiation *inst;
+		IfElseModuleInstantiation *ifelse = NULL;
+		if (type == INST_IFELSE) {
+			if (args.size() != 1) throw std::runtime_error("invalid if statement");
+			inst = ifelse = new IfElseModuleInstantiation(args[0].expr, path, loc);
+		}
+		else {
+			inst = new ModuleInstantiation(name, args, path, loc);
+		}
+		scope.addChild(inst);
+		inst->tag_root = readInt() != 0;
+		inst->tag_highlight = readInt() != 0;
+		inst->tag_background = readInt() != 0;
+		readScope(inst->scope);
+		if (ifelse) readScope(ifelse->else_scope);
+	}
+
+private:
+	void read(void *data, size_t size) {
+		this->stream.read(static_cast<char *>(data), size);
+		if (!this->stream) throw std::runtime_error("truncated AST cache entry");
+	}
+
+	std::istream &stream;
+};
+
+/*!
+	The cache directory: $OPENSCAD_AST_CACHE, or ast-cache in the user
+	config folder. Empty if there is none.
+*/
+std::string ASTCache::cachePath()
+{
+	const char *env = getenv("OPENSCAD_AST_CACHE");
+	if (env && *env) return env;
+	const std::string config = PlatformUtils::userConfigPath();
+	if (config.empty()) return "";
+	return (fs::path(config) / "ast-cache").generic_string();
+}
+
+/*!
+	Reads the cached module parsed from \a text, the contents of
+	\a filename, into \a entry. Returns false if there is no valid entry.
+	Has no other side effects, so files can be read concurrently; see
+	finish().
+*/
+bool ASTCache::read(const std::string &filename, const std::string &text, Entry &entry)
+{
+	entry.module = NULL;
+	const std::string dir = cachePath();
+	if (dir.empty()) return false;
+	std::ifstream ifs(entry_path(dir, filename, text).generic_string().c_str(), std::ios::binary);
+	if (!ifs.is_open()) return false;
+
+	std::unique_ptr<FileModule> module(new FileModule());
+	try {
+		ASTReader reader(ifs);
+		if (reader.readString() != AST_CACHE_MAGIC ||
+				reader.readInt() != AST_CACHE_VERSION ||
+				reader.readString() != QUOTED(OPENSCAD_VERSION) ||
+				reader.readString() != filename ||
+				reader.readString() != text) {
+			return false;
+		}
+		// Library paths affect which files include<> finds
+		const uint32_t npaths = reader.readInt();
+		std::vector<std::string> paths;
+		for (uint32_t i = 0; i < npaths; i++) paths.push_back(reader.readString());
+		if (paths != librarypath) return false;
+
+		module->setModulePath(fs::path(filename).parent_path().generic_string());
+		const uint32_t nincludes = reader.readInt();
+		for (uint32_t i = 0; i < nincludes; i++) {
+			const std::string localpath = reader.readString();
+			const std::string fullpath = reader.readString();
+			const bool found = reader.readInt() != 0;
+			const std::string contents = reader.readString();
+			std::string current;
+			if (read_file(fullpath, current) != found || (found && current != contents)) return false;
+			module->registerInclude(localpath, fullpath);
+			if (found) entry.dependencies.push_back(fullpath);
+		}
+
+		const uint32_t nfonts = reader.readInt();
+		for (uint32_t i = 0; i < nfonts; i++) module->usedfonts.push_back(reader.readString());
+		const uint32_t nlibs = reader.readInt();
+		for (uint32_t i = 0; i < nlibs; i++) {
+			const std::string lib = reader.readString();
+			const bool found = reader.readInt() != 0;
+			// use<> resolves library paths while parsing
+			if (fs::is_regular(lib) != found) return false;
+			module->usedlibs.insert(lib);
+			if (found) entry.dependencies.push_back(lib);
+		}
+		const uint32_t nmessages = reader.readInt();
+		for (uint32_t i = 0; i < nmessages; i++) entry.messages.push_back(reader.readString());
+
+		reader.readScope(module->scope);
+	}
+	catch (const std::exception &e) {
+		entry.error = e.what();
+		return false;
+	}
+
+	entry.module = module.release();
+	return true;
+}
+
+/*!
+	Returns the module of an \a entry read by read(), after registering
+	its dependencies and fonts and printing its messages like the parser
+	would.
+*/
+FileModule *ASTCache::finish(const std::string &filename, Entry &entry)
+{
+	if (!entry.error.empty()) {
+		PRINTDB("Ignoring AST cache entry for %s: %s", filename % entry.error);
+	}
+	if (!entry.module) return NULL;
+	for(const auto &font : entry.module->usedfonts) {
+		if (fs::is_regular(font)) FontCache::instance()->register_font_file(font);
+	}
+	for(const auto &dep : entry.dependencies) handle_dep(dep);
+	for(const auto &msg : entry.messages) PRINT(msg);
+	return entry.module;
+}
+
+/*!
+	Returns the cached module parsed from \a text, the contents of
+	\a filename, or NULL if there is no valid entry.
+*/
+FileModule *ASTCache::load(const std::string &filename, const std::string &text)
+{
+	Entry entry;
+	read(filename, text, entry);
+	return finish(filename, entry);
+}
+
+/*!
+	Stores \a module, parsed from \a text, the contents of \a filename,
+	along with the \a messages printed while parsing it.
+*/
+void ASTCache::save(const std::string &filename, const std::string &text,
+										const FileModule &module, const std::vector<std::string> &messages)
+{
+	const std::string dir = cachePath();
+	if (dir.empty()) return;
+
+	try {
+		fs::create_directories(dir);
+		const fs::path path = entry_path(dir, filename, text);
+		// Write to a temporary file first, so concurrent processes never see
+		// a partial entry
+		const fs::path tmp = path.parent_path() / fs::unique_path("%%%%-%%%%-%%%%.tmp");
+		{
+			std::ofstream ofs(tmp.generic_string().c_str(), std::ios::binary);
+			if (!ofs.is_open()) return;
+			ASTWriter writer(ofs);
+			writer.writeString(AST_CACHE_MAGIC);
+			writer.writeInt(AST_CACHE_VERSION);
+			writer.writeString(QUOTED(OPENSCAD_VERSION));
+			writer.writeString(filename);
+			writer.writeString(text);
+			writer.writeInt(librarypath.size());
+			for(const auto &p : librarypath) writer.writeString(p);
+
+			writer.writeInt(module.includes.size());
+			for(const auto &inc : module.includes) {
+				std::string contents;
+				const bool found = read_file(inc.second.filename, contents);
+				writer.writeString(inc.first);
+				writer.writeString(inc.second.filename);
+				writer.writeInt(found);
+				writer.writeString(contents);
+			}
+			writer.writeInt(module.usedfonts.size());
+			for(const auto &font : module.usedfonts) writer.writeString(font);
+			writer.writeInt(module.usedlibs.size());
+			for(const auto &lib : module.usedlibs) {
+				writer.writeString(lib);
+				writer.writeInt(fs::is_regular(lib));
+			}
+			writer.writeInt(messages.size());
+			for(const auto &msg : messages) writer.writeString(msg);
+
+			writer.writeScope(module.scope);
+			if (!ofs) {
+				ofs.close();
+				fs::remove(tmp);
+				return;
+			}
+		}
+		fs::rename(tmp, path);
+	}
+	catch (const std::exception &e) {
+		PRINTDB("Can't write AST cache entry for %s: %s", filename % e.what());
+	}
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/*!
+	On-disk cache of parsed library files, so fresh processes don't parse
+	unchanged use<>/include<> libraries again. Only used with the
+	ast-cache feature enabled.
+
+	Entries are keyed by the file name and the exact text parsed, and
+	hold the contents of included files to detect changes to those. The
+	messages printed while parsing are stored and printed again on load.
+*/
+class ASTCache
+{
+public:
+	/*! A module read from the cache, and what finish() does with it */
+	struct Entry {
+		Entry() : module(NULL) {}
+		class FileModule *module;
+		std::vector<std::string> dependencies;
+		std::vector<std::string> messages;
+		std::string error;
+	};
+	static bool read(const std::string &filename, const std::string &text, Entry &entry);
+	static class FileModule *finish(const std::string &filename, Entry &entry);
+	static class FileModule *load(const std::string &filename, const std::string &text);
+	static void save(const std::string &filename, const std::string &text,
+									 const class FileModule &module, const std::vector<std::string> &messages);
+	static std::string cachePath();
+};
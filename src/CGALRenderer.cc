@@ -36,13 +36,20 @@
 #include "printutils.h"
 
 #include "CGALRenderer.h"
-#include "CGAL_OGL_Polyhedron.h"
 #include "CGAL_Nef_polyhedron.h"
 #include "cgal.h"
+#include "cgalutils.h"
+#include "colormap.h"
+#include "ThreadPool.h"
 
 //#include "Preferences.h"
 
+// Meshes with more triangles get a proxy of at most PROXY_FACETS triangles
+static const size_t PROXY_MIN_FACETS = 200000;
+static const size_t PROXY_FACETS = 50000;
+
 CGALRenderer::CGALRenderer(shared_ptr<const class Geometry> geom)
+	: proxyready(false), cancelled(false)
 {
 	if (shared_ptr<const PolySet> ps = dynamic_pointer_cast<const PolySet>(geom)) {
 		assert(ps->getDimension() == 3);
@@ -58,40 +65,86 @@ CGALRenderer::CGALRenderer(shared_ptr<const class Geometry> geom)
 	}
 	else if (shared_ptr<const CGAL_Nef_polyhedron> new_N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(geom)) {
 		assert(new_N->getDimension() == 3);
-		if (!new_N->isEmpty()) {
-			this->N = new_N;
-		}
+		if (!new_N->isEmpty()) buildNefMesh(*new_N);
+	}
+
+	shared_ptr<const PolySet> mesh = this->nef_facets;
+	if (this->polyset && this->polyset->getDimension() == 3) mesh = this->polyset;
+	if (mesh && mesh->numPolygons() > PROXY_MIN_FACETS) {
+		// Only reads the vertices and faces, which drawing doesn't change
+		ThreadPool::instance()->run(this->proxygroup, [this, mesh]() {
+				this->proxy.reset(PolysetUtils::decimate(*mesh, PROXY_FACETS, &this->cancelled));
+				if (this->proxy) this->proxyready = true;
+			});
 	}
 }
 
 CGALRenderer::~CGALRenderer()
 {
+	this->cancelled = true;
+	if (!this->proxygroup.isDone()) ThreadPool::instance()->wait(this->proxygroup);
+}
+
+// The proxy of \a mesh while the view is interactive and it's ready
+const shared_ptr<const PolySet> &CGALRenderer::drawnMesh(const shared_ptr<const PolySet> &mesh) const
+{
+	return this->interactive && this->proxyready ? this->proxy : mesh;
 }
 
-shared_ptr<class CGAL_OGL_Polyhedron> CGALRenderer::getPolyhedron() const
+static void add_point(std::vector<float> &points, const CGAL_Point_3 &p)
 {
-	if (this->N && !this->polyhedron) buildPolyhedron();
-	return this->polyhedron;
+	for (int i = 0; i < 3; i++) points.push_back(CGAL::to_double(p[i]));
 }
 
-void CGALRenderer::buildPolyhedron() const
+/*!
+	Converts the Nef polyhedron into the triangles, edges and vertices
+	drawn by draw(). Only the facets bounding the solid are tessellated.
+*/
+void CGALRenderer::buildNefMesh(const CGAL_Nef_polyhedron &N)
 {
-	PRINTD("buildPolyhedron");
-	this->polyhedron.reset(new CGAL_OGL_Polyhedron(*this->colorscheme));
-	CGAL::OGL::Nef3_Converter<CGAL_Nef_polyhedron3>::convert_to_OGLPolyhedron(*this->N->p3, this->polyhedron.get());
-	// CGAL_NEF3_MARKED_FACET_COLOR <- CGAL_FACE_BACK_COLOR
-	// CGAL_NEF3_UNMARKED_FACET_COLOR <- CGAL_FACE_FRONT_COLOR
-	this->polyhedron->init();
-	PRINTD("buildPolyhedron() end");
+	PRINTD("buildNefMesh");
+	PolySet *ps = new PolySet(3);
+	CGALUtils::tessellateNefPolyhedron3(*N.p3, [ps](const Vector3d &p0, const Vector3d &p1, const Vector3d &p2) {
+			ps->append_poly();
+			ps->append_vertex(p0);
+			ps->append_vertex(p1);
+			ps->append_vertex(p2);
+		});
+	this->nef_facets.reset(ps);
+
+	CGAL_Nef_polyhedron3::Vertex_const_iterator v;
+	CGAL_forall_vertices(v, *N.p3) add_point(this->nef_vertices[v->mark()], v->point());
+	CGAL_Nef_polyhedron3::Halfedge_const_iterator e;
+	CGAL_forall_edges(e, *N.p3) {
+		std::vector<float> &edges = this->nef_edges[e->mark()];
+		add_point(edges, e->source()->point());
+		add_point(edges, e->twin()->source()->point());
+	}
+	this->nef_bbox = N.getBoundingBox();
+	PRINTD("buildNefMesh() end");
 }
 
-// Overridden from Renderer
-void CGALRenderer::setColorScheme(const ColorScheme &cs)
+static void draw_array(GLenum mode, const std::vector<float> &coords, const Color4f &color)
 {
-	PRINTD("setColorScheme");
-	Renderer::setColorScheme(cs);
-	this->polyhedron.reset(); // Mark as dirty
-	PRINTD("setColorScheme done");
+	if (coords.empty()) return;
+	glColor3f(color[0], color[1], color[2]);
+	glVertexPointer(3, GL_FLOAT, 0, &coords[0]);
+	glDrawArrays(mode, 0, coords.size() / 3);
+}
+
+// Draws the edges and vertices of the Nef polyhedron, marked ones in the
+// front colors
+void CGALRenderer::drawNefSkeleton() const
+{
+	glDisable(GL_LIGHTING);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glLineWidth(5);
+	draw_array(GL_LINES, this->nef_edges[1], ColorMap::getColor(*this->colorscheme, CGAL_EDGE_FRONT_COLOR));
+	draw_array(GL_LINES, this->nef_edges[0], ColorMap::getColor(*this->colorscheme, CGAL_EDGE_BACK_COLOR));
+	glPointSize(10);
+	draw_array(GL_POINTS, this->nef_vertices[1], Color4f(0xff / 255.0f, 0xf6 / 255.0f, 0x7c / 255.0f, 1.0f));
+	draw_array(GL_POINTS, this->nef_vertices[0], Color4f(0xb7 / 255.0f, 0xe8 / 255.0f, 0x5c / 255.0f, 1.0f));
+	glDisableClientState(GL_VERTEX_ARRAY);
 }
 
 void CGALRenderer::draw(bool showfaces, bool showedges) const
@@ -105,10 +158,9 @@ void CGALRenderer::draw(bool showfaces, bool showedges) const
 // FIXME:		const QColor &col = Preferences::inst()->color(Preferences::CGAL_FACE_2D_COLOR);
 			glColor3f(0.0f, 0.75f, 0.60f);
 
-			for (size_t i=0; i < this->polyset->polygons.size(); i++) {
+			for(const auto &poly : this->polyset->faces()) {
 				glBegin(GL_POLYGON);
-				for (size_t j=0; j < this->polyset->polygons[i].size(); j++) {
-					const Vector3d &p = this->polyset->polygons[i][j];
+				for(const auto &p : poly) {
 					glVertex3d(p[0], p[1], 0);
 				}
 				glEnd();
@@ -127,17 +179,18 @@ void CGALRenderer::draw(bool showfaces, bool showedges) const
 			// Draw 3D polygons
 			const Color4f c(-1,-1,-1,-1);	
 			setColor(COLORMODE_MATERIAL, c.data(), NULL);
-			this->polyset->render_surface(CSGMODE_NORMAL, Transform3d::Identity(), NULL);
+			drawnMesh(this->polyset)->render_surface(CSGMODE_NORMAL, Transform3d::Identity(), NULL);
 		}
 	}
-	else {
-		shared_ptr<class CGAL_OGL_Polyhedron> polyhedron = getPolyhedron();
-        if (polyhedron) {
-            PRINTD("draw() polyhedron");
-            if (showfaces) polyhedron->set_style(SNC_BOUNDARY);
-            else polyhedron->set_style(SNC_SKELETON);
-            polyhedron->draw(showfaces && showedges);
-        }
+	else if (this->nef_facets) {
+		PRINTD("draw() polyhedron");
+		if (showfaces) {
+			setColor(ColorMap::getColor(*this->colorscheme, CGAL_FACE_FRONT_COLOR).data());
+			drawnMesh(this->nef_facets)->render_surface(CSGMODE_NORMAL, Transform3d::Identity(), NULL);
+		}
+		// The skeleton is as large as the mesh, so it's left out of the
+		// proxy's frames unless it's all that's drawn
+		if (!showfaces || (showedges && drawnMesh(this->nef_facets) == this->nef_facets)) drawNefSkeleton();
 	}
 	PRINTD("draw() end");
 }
@@ -149,14 +202,8 @@ BoundingBox CGALRenderer::getBoundingBox() const
 	if (this->polyset) {
 		bbox = this->polyset->getBoundingBox();
 	}
-	else {
-		shared_ptr<class CGAL_OGL_Polyhedron> polyhedron = getPolyhedron();
-		if (polyhedron) {
-			CGAL::Bbox_3 cgalbbox = polyhedron->bbox();
-			bbox = BoundingBox(
-				Vector3d(cgalbbox.xmin(), cgalbbox.ymin(), cgalbbox.zmin()),
-				Vector3d(cgalbbox.xmax(), cgalbbox.ymax(), cgalbbox.zmax()));
-		}
+	else if (this->nef_facets) {
+		bbox = this->nef_bbox;
 	}
 	return bbox;
 }
@@ -2,21 +2,40 @@
 
 #include "renderer.h"
 #include "CGAL_Nef_polyhedron.h"
+#include <atomic>
+#include "ThreadPool.h"
 
+/*!
+	Draws the result of a full render. All meshes are prepared by the
+	constructor, which doesn't touch OpenGL and may run on a worker thread.
+	Nef polyhedra are drawn from their tessellated boundary and from
+	arrays of their edges and vertices, split by mark to pick the color.
+
+	For large 3D results, a decimated proxy of the mesh is built in the
+	background once the constructor is done. It's drawn while the view is
+	interactive, until the camera stops and the full mesh is drawn again.
+*/
 class CGALRenderer : public Renderer
 {
 public:
 	CGALRenderer(shared_ptr<const class Geometry> geom);
 	~CGALRenderer();
 	virtual void draw(bool showfaces, bool showedges) const;
-	virtual void setColorScheme(const ColorScheme &cs);
 	virtual BoundingBox getBoundingBox() const;
 
 private:
-	shared_ptr<class CGAL_OGL_Polyhedron> getPolyhedron() const;
-	void buildPolyhedron() const;
+	void buildNefMesh(const CGAL_Nef_polyhedron &N);
+	void drawNefSkeleton() const;
+	const shared_ptr<const PolySet> &drawnMesh(const shared_ptr<const PolySet> &mesh) const;
 
-	mutable shared_ptr<class CGAL_OGL_Polyhedron> polyhedron;
-	shared_ptr<const CGAL_Nef_polyhedron> N;
 	shared_ptr<const class PolySet> polyset;
+	shared_ptr<const PolySet> nef_facets;
+	std::vector<float> nef_edges[2];
+	std::vector<float> nef_vertices[2];
+	BoundingBox nef_bbox;
+
+	shared_ptr<const PolySet> proxy;
+	std::atomic<bool> proxyready; // Set once the proxy is built
+	std::atomic<bool> cancelled;
+	ThreadPool::TaskGroup proxygroup;
 };
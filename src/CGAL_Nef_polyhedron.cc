@@ -2,9 +2,12 @@
 #include "cgal.h"
 #include "cgalutils.h"
 #include "printutils.h"
+#include "OperationCounters.h"
 #include "polyset.h"
 #include "svg.h"
 
+#include <cmath>
+
 CGAL_Nef_polyhedron::CGAL_Nef_polyhedron(CGAL_Nef_polyhedron3 *p)
 {
 	if (p) p3.reset(p);
@@ -18,34 +21,75 @@ CGAL_Nef_polyhedron::CGAL_Nef_polyhedron(const CGAL_Nef_polyhedron &src)
 
 CGAL_Nef_polyhedron& CGAL_Nef_polyhedron::operator+=(const CGAL_Nef_polyhedron &other)
 {
+	OperationCounters::count(OperationCounters::NEF_UNION);
 	(*this->p3) += (*other.p3);
 	return *this;
 }
 
 CGAL_Nef_polyhedron& CGAL_Nef_polyhedron::operator*=(const CGAL_Nef_polyhedron &other)
 {
+	OperationCounters::count(OperationCounters::NEF_INTERSECTION);
 	(*this->p3) *= (*other.p3);
 	return *this;
 }
 
 CGAL_Nef_polyhedron& CGAL_Nef_polyhedron::operator-=(const CGAL_Nef_polyhedron &other)
 {
+	OperationCounters::count(OperationCounters::NEF_DIFFERENCE);
 	(*this->p3) -= (*other.p3);
 	return *this;
 }
 
 CGAL_Nef_polyhedron &CGAL_Nef_polyhedron::minkowski(const CGAL_Nef_polyhedron &other)
 {
+	OperationCounters::count(OperationCounters::NEF_MINKOWSKI);
 	(*this->p3) = CGAL::minkowski_sum_3(*this->p3, *other.p3);
 	return *this;
 }
 
+static size_t gmpq_memsize(const CGAL::Gmpq &q)
+{
+	mpq_srcptr mpq = q.mpq();
+	return sizeof(__mpq_struct) + sizeof(int) +
+		(mpq_numref(mpq)->_mp_alloc + mpq_denref(mpq)->_mp_alloc) * sizeof(mp_limb_t);
+}
+
+/*!
+	Estimates the resident memory used by this polyhedron.
+
+	CGAL's bytes() only counts the SNC structure itself. The exact numbers
+	in points, planes and sphere maps are reference counted GMP rationals
+	whose limbs live on the heap and usually dominate the footprint, so we
+	add those as well. Numbers shared between handles are counted for each
+	use, so the estimate errs on the high side.
+*/
 size_t CGAL_Nef_polyhedron::memsize() const
 {
 	if (this->isEmpty()) return 0;
 
 	size_t memsize = sizeof(CGAL_Nef_polyhedron);
 	memsize += this->p3->bytes();
+
+	CGAL_Nef_polyhedron3::Vertex_const_iterator vi;
+	for (vi = this->p3->vertices_begin(); vi != this->p3->vertices_end(); ++vi) {
+		const CGAL_Nef_polyhedron3::Point_3 &p = vi->point();
+		memsize += gmpq_memsize(p.x()) + gmpq_memsize(p.y()) + gmpq_memsize(p.z());
+	}
+	CGAL_Nef_polyhedron3::Halfedge_const_iterator ei;
+	for (ei = this->p3->halfedges_begin(); ei != this->p3->halfedges_end(); ++ei) {
+		const CGAL_Nef_polyhedron3::Sphere_point &p = ei->point();
+		memsize += gmpq_memsize(p.x()) + gmpq_memsize(p.y()) + gmpq_memsize(p.z());
+	}
+	CGAL_Nef_polyhedron3::Halffacet_const_iterator fi;
+	for (fi = this->p3->halffacets_begin(); fi != this->p3->halffacets_end(); ++fi) {
+		const CGAL_Nef_polyhedron3::Plane_3 &pl = fi->plane();
+		memsize += gmpq_memsize(pl.a()) + gmpq_memsize(pl.b()) + gmpq_memsize(pl.c()) + gmpq_memsize(pl.d());
+	}
+	CGAL_Nef_polyhedron3::SHalfedge_const_iterator si;
+	for (si = this->p3->shalfedges_begin(); si != this->p3->shalfedges_end(); ++si) {
+		const CGAL_Nef_polyhedron3::Sphere_circle &c = si->circle();
+		memsize += gmpq_memsize(c.a()) + gmpq_memsize(c.b()) + gmpq_memsize(c.c()) + gmpq_memsize(c.d());
+	}
 	return memsize;
 }
 
@@ -54,6 +98,31 @@ bool CGAL_Nef_polyhedron::isEmpty() const
 	return !this->p3 || this->p3->is_empty();
 }
 
+/*!
+	Returns a bounding box which is guaranteed to contain all exact vertices,
+	i.e. it may be slightly larger than the polyhedron.
+	Use CGALUtils::boundingBox() for the exact box.
+*/
+BoundingBox CGAL_Nef_polyhedron::getBoundingBox() const
+{
+	BoundingBox result;
+	if (this->isEmpty()) return result;
+
+	CGAL_Nef_polyhedron3::Vertex_const_iterator vi;
+	for (vi = this->p3->vertices_begin(); vi != this->p3->vertices_end(); ++vi) {
+		const CGAL_Nef_polyhedron3::Point_3 &p = vi->point();
+		Vector3d lo, hi;
+		for (int i=0;i<3;i++) {
+			std::pair<double, double> interval = CGAL::to_interval(p[i]);
+			lo[i] = interval.first;
+			hi[i] = interval.second;
+		}
+		result.extend(lo);
+		result.extend(hi);
+	}
+	return result;
+}
+
 /*!
 	Creates a new PolySet and initializes it with the data from this polyhedron
 
@@ -143,6 +212,19 @@ std::string CGAL_Nef_polyhedron::dump() const
 }
 
 
+/*!
+	Rounds \a x to 32 significant bits. The exact numbers of a transformed
+	Nef polyhedron grow by the bits of the matrix entries, so rounding them
+	keeps repeated transforms from piling up full double mantissas.
+*/
+static double round_entry(double x)
+{
+	if (x == 0 || !std::isfinite(x)) return x;
+	int exponent;
+	const double mantissa = std::frexp(x, &exponent);
+	return std::ldexp(std::round(std::ldexp(mantissa, 32)), exponent - 32);
+}
+
 void CGAL_Nef_polyhedron::transform( const Transform3d &matrix )
 {
 	if (!this->isEmpty()) {
@@ -151,10 +233,12 @@ void CGAL_Nef_polyhedron::transform( const Transform3d &matrix )
 			this->reset();
 		}
 		else {
+			// Translations are kept exact, so translated objects still meet
+			// objects placed at the same coordinates
 			CGAL_Aff_transformation t(
-				matrix(0,0), matrix(0,1), matrix(0,2), matrix(0,3),
-				matrix(1,0), matrix(1,1), matrix(1,2), matrix(1,3),
-				matrix(2,0), matrix(2,1), matrix(2,2), matrix(2,3), matrix(3,3));
+				round_entry(matrix(0,0)), round_entry(matrix(0,1)), round_entry(matrix(0,2)), matrix(0,3),
+				round_entry(matrix(1,0)), round_entry(matrix(1,1)), round_entry(matrix(1,2)), matrix(1,3),
+				round_entry(matrix(2,0)), round_entry(matrix(2,1)), round_entry(matrix(2,2)), matrix(2,3), matrix(3,3));
 			this->p3->transform(t);
 		}
 	}
@@ -0,0 +1,329 @@
+#include "CSGLoader.h"
+#include "FileModule.h"
+#include "ModuleInstantiation.h"
+#include "expression.h"
+#include "value.h"
+#include "node.h"
+#include "reducednode.h"
+#include "Tree.h"
+#include "GeometryCache.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+// Written by NodeDumper in front of each node, with the id of its subtree
+static const char IDCOMMENT[] = "/*id:";
+
+/*!
+	Reads the statements and literals of a .csg file. Comments are skipped,
+	remembering the id of the last id comment.
+*/
+struct CSGLoader::Parser
+{
+	Parser(const std::string &text) : text(text), pos(0) {}
+
+	void skipSpace() {
+		while (this->pos < this->text.size()) {
+			if (isspace((unsigned char)this->text[this->pos])) {
+				this->pos++;
+			}
+			else if (this->text.compare(this->pos, 2, "//") == 0) {
+				this->pos = std::min(this->text.find('\n', this->pos), this->text.size());
+			}
+			else if (this->text.compare(this->pos, 2, "/*") == 0) {
+				const size_t end = this->text.find("*/", this->pos + 2);
+				if (end == std::string::npos) {
+					this->pos = this->text.size();
+					return;
+				}
+				const size_t len = sizeof(IDCOMMENT) - 1;
+				if (this->text.compare(this->pos, len, IDCOMMENT) == 0) {
+					this->id = this->text.substr(this->pos + len, end - this->pos - len);
+				}
+				this->pos = end + 2;
+			}
+			else break;
+		}
+	}
+
+	bool atEnd() {
+		skipSpace();
+		return this->pos >= this->text.size();
+	}
+
+	char peek() {
+		skipSpace();
+		return this->pos < this->text.size() ? this->text[this->pos] : '\0';
+	}
+
+	bool accept(char c) {
+		if (peek() != c) return false;
+		this->pos++;
+		return true;
+	}
+
+	bool identifier(std::string &name) {
+		skipSpace();
+		const size_t start = this->pos;
+		while (this->pos < this->text.size()) {
+			const char c = this->text[this->pos];
+			if (!isalnum((unsigned char)c) && c != '_' && c != '$') break;
+			this->pos++;
+		}
+		if (this->pos == start || isdigit((unsigned char)this->text[start])) {
+			this->pos = start;
+			return false;
+		}
+		name = this->text.substr(start, this->pos - start);
+		return true;
+	}
+
+	bool number(ValuePtr &v) {
+		const char *start = this->text.c_str() + this->pos;
+		char *end;
+		const double d = strtod(start, &end);
+		if (end == start) return false;
+		// strtod() also reads e.g. inf and hex numbers, which aren't literals
+		for (const char *p = start; p < end; p++) {
+			if (!isdigit((unsigned char)*p) && !strchr(".eE+-", *p)) return false;
+		}
+		this->pos += end - start;
+		v = ValuePtr(d);
+		return true;
+	}
+
+	bool string(ValuePtr &v) {
+		std::string s;
+		this->pos++;
+		while (this->pos < this->text.size() && this->text[this->pos] != '"') {
+			char c = this->text[this->pos++];
+			if (c == '\n') return false;
+			if (c == '\\') {
+				if (this->pos >= this->text.size()) return false;
+				switch (this->text[this->pos++]) {
+				case 'n': c = '\n'; break;
+				case 't': c = '\t'; break;
+				case 'r': c = '\r'; break;
+				case '\\': c = '\\'; break;
+				case '"': c = '"'; break;
+				default: return false;
+				}
+			}
+			s += c;
+		}
+		if (this->pos >= this->text.size()) return false;
+		this->pos++;
+		v = ValuePtr(s);
+		return true;
+	}
+
+	bool value(ValuePtr &v) {
+		const char c = peek();
+		if (c == '"') return string(v);
+		if (c == '[') {
+			this->pos++;
+			Value::VectorType vec;
+			if (!accept(']')) {
+				do {
+					ValuePtr item;
+					if (!value(item)) return false;
+					vec.push_back(item);
+				} while (accept(','));
+				if (!accept(']')) return false;
+			}
+			v = ValuePtr(std::move(vec));
+			return true;
+		}
+		if (c == '-' || c == '+' || c == '.' || isdigit((unsigned char)c)) return number(v);
+
+		std::string name;
+		if (!identifier(name)) return false;
+		if (name == "true") v = ValuePtr(true);
+		else if (name == "false") v = ValuePtr(false);
+		else if (name == "undef") v = ValuePtr::undefined;
+		else return false;
+		return true;
+	}
+
+	bool arguments(AssignmentList &args) {
+		if (!accept('(')) return false;
+		if (accept(')')) return true;
+		do {
+			const size_t start = this->pos;
+			std::string name;
+			if (!identifier(name) || !accept('=')) {
+				name.clear();
+				this->pos = start;
+			}
+			ValuePtr v;
+			if (!value(v)) return false;
+			args.push_back(Assignment(name, shared_ptr<Expression>(new Literal(v))));
+		} while (accept(','));
+		return accept(')');
+	}
+
+	const std::string &text;
+	size_t pos;
+	std::string id;
+};
+
+/*!
+	Reads \a text, the contents of the .csg file \a filename, into a new
+	module. Returns NULL if it isn't a plain .csg file.
+*/
+FileModule *CSGLoader::load(const std::string &text, const boost::filesystem::path &filename)
+{
+	this->ids.clear();
+	this->cached.clear();
+	FileModule *module = new FileModule();
+	const std::string path = filename.parent_path().generic_string();
+	module->setModulePath(path);
+
+	// The instantiations whose children are being read. They are added to
+	// their parent once they are complete.
+	struct Frame {
+		Frame(ModuleInstantiation *inst, LocalScope *scope, bool disabled)
+			: inst(inst), scope(scope), disabled(disabled), modifiers(false) {}
+		ModuleInstantiation *inst;
+		LocalScope *scope;
+		bool disabled;
+		bool modifiers; // Of the children
+	};
+	std::vector<Frame> stack(1, Frame(NULL, &module->scope, false));
+	auto finish = [this, &stack](const Frame &frame) {
+		ModuleInstantiation *inst = frame.inst;
+		if (frame.disabled) {
+			forget(inst);
+			delete inst;
+			return;
+		}
+		Frame &parent = stack.back();
+		parent.scope->addChild(inst);
+		parent.modifiers |= frame.modifiers || inst->isRoot() || inst->isHighlight() || inst->isBackground();
+
+		const auto id = this->ids.find(inst);
+		if (!this->reduce || frame.modifiers || id == this->ids.end() || inst->scope.children.empty()) return;
+		GeometryCache *cache = GeometryCache::instance();
+		shared_ptr<const Geometry> geom;
+		if (cache->contains(id->second)) geom = cache->get(id->second);
+#ifdef ENABLE_CGAL
+		else if (cache->containsNef(id->second)) geom = cache->getNef(id->second);
+#endif
+		if (!geom) return;
+		for(const auto child : inst->scope.children) {
+			forget(child);
+			delete child;
+		}
+		inst->scope.children.clear();
+		this->cached[inst] = geom;
+	};
+
+	Parser parser(text);
+	bool ok = true;
+	while (ok) {
+		parser.id.clear();
+		if (parser.atEnd()) {
+			ok = stack.size() == 1;
+			break;
+		}
+		if (parser.accept('}')) {
+			if (stack.size() == 1) {
+				ok = false;
+				break;
+			}
+			const Frame frame = stack.back();
+			stack.pop_back();
+			finish(frame);
+			continue;
+		}
+		if (parser.accept(';')) continue;
+
+		bool root = false, highlight = false, background = false, disabled = false;
+		for (;;) {
+			if (parser.accept('!')) root = true;
+			else if (parser.accept('#')) highlight = true;
+			else if (parser.accept('%')) background = true;
+			else if (parser.accept('*')) disabled = true;
+			else break;
+		}
+		std::string name;
+		AssignmentList args;
+		if (!parser.identifier(name)) {
+			ok = false;
+			break;
+		}
+		const std::string id = parser.id;
+		if (!parser.arguments(args)) {
+			ok = false;
+			break;
+		}
+
+		ModuleInstantiation *inst = new ModuleInstantiation(name, args, path);
+		inst->tag_root = root;
+		inst->tag_highlight = highlight;
+		inst->tag_background = background;
+		if (!id.empty()) this->ids[inst] = id;
+		const Frame frame(inst, &inst->scope, disabled);
+		if (parser.accept('{')) {
+			stack.push_back(frame);
+		}
+		else if (parser.accept(';')) {
+			finish(frame);
+		}
+		else {
+			delete inst;
+			ok = false;
+		}
+	}
+
+	if (!ok) {
+		// Unfinished instantiations aren't in the module yet
+		for (size_t i = 1; i < stack.size(); i++) delete stack[i].inst;
+		delete module;
+		this->ids.clear();
+		this->cached.clear();
+		return NULL;
+	}
+	return module;
+}
+
+// Drops what's known about \a inst and its children, before they're deleted
+void CSGLoader::forget(const ModuleInstantiation *inst)
+{
+	std::vector<const ModuleInstantiation *> pending(1, inst);
+	while (!pending.empty()) {
+		const ModuleInstantiation *i = pending.back();
+		pending.pop_back();
+		this->ids.erase(i);
+		this->cached.erase(i);
+		pending.insert(pending.end(), i->scope.children.begin(), i->scope.children.end());
+	}
+}
+
+/*!
+	Gives the nodes below \a root, instantiated from the loaded module, the
+	ids read from the file, replacing the nodes of cached subtrees by their
+	geometry. Call after setting the root of \a tree.
+*/
+void CSGLoader::applyIds(AbstractNode &root, Tree &tree) const
+{
+	std::vector<AbstractNode *> pending(1, &root);
+	while (!pending.empty()) {
+		AbstractNode *node = pending.back();
+		pending.pop_back();
+		for(auto &child : node->children) {
+			const auto geom = this->cached.find(child->modinst);
+			if (geom != this->cached.end() && !dynamic_cast<ReducedNode *>(child)) {
+				AbstractNode *reduced = new ReducedNode(child->modinst, geom->second, this->ids.at(child->modinst));
+				if (--child->refcount == 0) delete child;
+				child = reduced;
+			}
+			pending.push_back(child);
+		}
+		const auto id = this->ids.find(node->modinst);
+		if (id != this->ids.end()) tree.setIdString(*node, id->second);
+	}
+}
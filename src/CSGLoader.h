@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include "memory.h"
+#include <boost/filesystem.hpp>
+
+/*!
+	Loads .csg files, as written by the CSG export, without the general
+	parser. A .csg file only instantiates builtin modules with literal
+	arguments, so it's read in one pass into a FileModule, each argument
+	being a Literal.
+
+	With --csg-ids, the export writes the id of each subtree in a comment
+	in front of it. applyIds() gives these ids to the instantiated nodes, so
+	the geometry caches are looked up without hashing the tree. Subtrees
+	whose geometry is cached, and which have no modifiers, are instantiated
+	as ReducedNodes of the cached geometry instead of their children.
+
+	load() returns NULL for files which need the general parser, e.g. ones
+	edited to use variables or expressions.
+
+	Set reduce to false to load all subtrees, e.g. to record the files
+	they depend on.
+*/
+class CSGLoader
+{
+public:
+	CSGLoader(bool reduce = true) : reduce(reduce) {}
+
+	class FileModule *load(const std::string &text, const boost::filesystem::path &filename);
+	void applyIds(class AbstractNode &root, class Tree &tree) const;
+
+private:
+	struct Parser;
+	void forget(const class ModuleInstantiation *inst);
+
+	bool reduce;
+	std::unordered_map<const ModuleInstantiation *, std::string> ids;
+	std::unordered_map<const ModuleInstantiation *, shared_ptr<const class Geometry>> cached;
+};
@@ -8,14 +8,17 @@
 #include "colornode.h"
 #include "rendernode.h"
 #include "cgaladvnode.h"
+#include "simplifynode.h"
 #include "printutils.h"
 #include "GeometryEvaluator.h"
 #include "polyset.h"
 #include "polyset-utils.h"
+#include "PreviewCache.h"
+#include "GeometryCache.h"
+#include "Tree.h"
 
 #include <string>
-#include <map>
-#include <list>
+#include <algorithm>
 #include <sstream>
 #include <iostream>
 #include <assert.h>
@@ -28,11 +31,28 @@
 	with OpenCSG.
 */
 
+// Nodes are numbered in instantiation order, so a tree's indices are mostly contiguous
+static void index_range(const AbstractNode &node, size_t &first, size_t &last)
+{
+	first = std::min(first, node.index());
+	last = std::max(last, node.index());
+	for(const auto &child : node.children) index_range(*child, first, last);
+}
+
 shared_ptr<CSGNode> CSGTreeEvaluator::buildCSGTree(const AbstractNode &node)
 {
+	size_t first = node.index(), last = node.index();
+	index_range(node, first, last);
+	this->firstindex = first;
+	this->visitedchildren.assign(last - first + 1, ChildList());
+	this->stored_term.assign(last - first + 1, shared_ptr<CSGNode>());
 	this->traverse(node);
+	// Placeholder previews are followed by a full one
+	if (this->geomevaluator && !this->placeholders) PreviewCache::instance()->finishPreview();
 	
-	shared_ptr<CSGNode> t(this->stored_term[node.index()]);
+	shared_ptr<CSGNode> t(termOf(node));
+	std::vector<ChildList>().swap(this->visitedchildren);
+	std::vector<shared_ptr<CSGNode>>().swap(this->stored_term);
 	if (t) {
             if (t->isHighlight()) this->highlightNodes.push_back(t);
 		if (t->isBackground()) {
@@ -46,9 +66,9 @@ shared_ptr<CSGNode> CSGTreeEvaluator::buildCSGTree(const AbstractNode &node)
 
 void CSGTreeEvaluator::applyBackgroundAndHighlight(State &state, const AbstractNode &node)
 {
-	for(const auto &chnode : this->visitedchildren[node.index()]) {
-		shared_ptr<CSGNode> t(this->stored_term[chnode->index()]);
-		this->stored_term.erase(chnode->index());
+	for(const auto &chnode : childrenOf(node)) {
+		shared_ptr<CSGNode> t;
+		t.swap(termOf(*chnode));
 		if (t) {
 			if (t->isBackground()) this->backgroundNodes.push_back(t);
 			if (t->isHighlight()) this->highlightNodes.push_back(t);
@@ -60,10 +80,10 @@ void CSGTreeEvaluator::applyToChildren(State &state, const AbstractNode &node, O
 {
 	shared_ptr<CSGNode> t1;
 	const ModuleInstantiation *t1_modinst;
-	for(const auto &chnode : this->visitedchildren[node.index()]) {
-		shared_ptr<CSGNode> t2(this->stored_term[chnode->index()]);
+	for(const auto &chnode : childrenOf(node)) {
+		shared_ptr<CSGNode> t2;
+		t2.swap(termOf(*chnode));
 		const ModuleInstantiation *t2_modinst = chnode->modinst;
-		this->stored_term.erase(chnode->index());
 		if (t2 && !t1) {
 			t1 = t2;
 			t1_modinst = t2_modinst;
@@ -133,7 +153,7 @@ void CSGTreeEvaluator::applyToChildren(State &state, const AbstractNode &node, O
 		if (node.modinst->isBackground()) t1->setBackground(true);
 		if (node.modinst->isHighlight()) t1->setHighlight(true);
 	}
-	this->stored_term[node.index()] = t1;
+	termOf(node) = t1;
 }
 
 Response CSGTreeEvaluator::visit(State &state, const AbstractNode &node)
@@ -164,23 +184,33 @@ shared_ptr<CSGNode> CSGTreeEvaluator::evaluateCSGNodeFromGeometry(
 	// We cannot render Polygon2d directly, so we preprocess (tessellate) it here
 	shared_ptr<const Geometry> g = geom;
 	if (!g->isEmpty()) {
-		shared_ptr<const Polygon2d> p2d = dynamic_pointer_cast<const Polygon2d>(geom);
-		if (p2d) {
-			g.reset(p2d->tessellate());
+		// Unchanged subtrees get the geometry prepared by the last preview
+		const std::string &key = this->tree.getIdString(node);
+		PreviewCache *cache = PreviewCache::instance();
+		shared_ptr<const Geometry> cached = cache->get(key, geom);
+		if (cached) {
+			g = cached;
 		}
 		else {
-			// We cannot render concave polygons, so tessellate any 3D PolySets
-			shared_ptr<const PolySet> ps = dynamic_pointer_cast<const PolySet>(geom);
-			// Since is_convex() doesn't handle non-planar faces, we need to tessellate
-			// also in the indeterminate state so we cannot just use a boolean comparison. See #1061
-			bool convex = ps->convexValue();
-			if (ps && !convex) {
-				assert(ps->getDimension() == 3);
-				PolySet *ps_tri = new PolySet(3, ps->convexValue());
-				ps_tri->setConvexity(ps->getConvexity());
-				PolysetUtils::tessellate_faces(*ps, *ps_tri);
-				g.reset(ps_tri);
+			shared_ptr<const Polygon2d> p2d = dynamic_pointer_cast<const Polygon2d>(geom);
+			if (p2d) {
+				g.reset(p2d->tessellate());
+			}
+			else {
+				// We cannot render concave polygons, so tessellate any 3D PolySets
+				shared_ptr<const PolySet> ps = dynamic_pointer_cast<const PolySet>(geom);
+				// Since is_convex() doesn't handle non-planar faces, we need to tessellate
+				// also in the indeterminate state so we cannot just use a boolean comparison. See #1061
+				bool convex = ps->convexValue();
+				if (ps && !convex) {
+					assert(ps->getDimension() == 3);
+					PolySet *ps_tri = new PolySet(3, ps->convexValue());
+					ps_tri->setConvexity(ps->getConvexity());
+					PolysetUtils::tessellate_faces(*ps, *ps_tri);
+					g.reset(ps_tri);
+				}
 			}
+			cache->insert(key, geom, g);
 		}
 	}
 
@@ -201,7 +231,7 @@ Response CSGTreeEvaluator::visit(State &state, const AbstractPolyNode &node)
 			}
 			node.progress_report();
 		}
-		this->stored_term[node.index()] = t1;
+		termOf(node) = t1;
 		addToParent(state, node);
 	}
 	return ContinueTraversal;
@@ -240,10 +270,53 @@ Response CSGTreeEvaluator::visit(State &state, const ColorNode &node)
 	return ContinueTraversal;
 }
 
+// A box around the CSG term stored for \a node, marked as background
+void CSGTreeEvaluator::storePlaceholder(State &state, const AbstractNode &node)
+{
+	shared_ptr<CSGNode> t = termOf(node);
+	if (!t || t->getBoundingBox().isEmpty()) return;
+	const BoundingBox &bbox = t->getBoundingBox();
+	const Vector3d &a = bbox.min(), &b = bbox.max();
+	PolySet *p = new PolySet(3, true);
+	const Vector3d faces[6][4] = {
+		{ Vector3d(a[0], a[1], b[2]), Vector3d(b[0], a[1], b[2]), Vector3d(b[0], b[1], b[2]), Vector3d(a[0], b[1], b[2]) },
+		{ Vector3d(a[0], b[1], a[2]), Vector3d(b[0], b[1], a[2]), Vector3d(b[0], a[1], a[2]), Vector3d(a[0], a[1], a[2]) },
+		{ Vector3d(a[0], a[1], a[2]), Vector3d(b[0], a[1], a[2]), Vector3d(b[0], a[1], b[2]), Vector3d(a[0], a[1], b[2]) },
+		{ Vector3d(b[0], a[1], a[2]), Vector3d(b[0], b[1], a[2]), Vector3d(b[0], b[1], b[2]), Vector3d(b[0], a[1], b[2]) },
+		{ Vector3d(b[0], b[1], a[2]), Vector3d(a[0], b[1], a[2]), Vector3d(a[0], b[1], b[2]), Vector3d(b[0], b[1], b[2]) },
+		{ Vector3d(a[0], b[1], a[2]), Vector3d(a[0], a[1], a[2]), Vector3d(a[0], a[1], b[2]), Vector3d(a[0], b[1], b[2]) }
+	};
+	for (const auto &face : faces) {
+		p->append_poly();
+		for (const auto &v : face) p->append_vertex(v);
+	}
+
+	std::stringstream stream;
+	stream << node.name() << node.index() << "_placeholder";
+	t.reset(new CSGLeaf(shared_ptr<const Geometry>(p), Transform3d::Identity(), state.color(), stream.str()));
+	t->setBackground(true);
+	termOf(node) = t;
+}
+
+/*!
+	With placeholders, render() nodes which aren't cached yet, e.g. because
+	they're being evaluated in the background, are shown as the box around
+	their children, without evaluating nested render() nodes.
+*/
 // FIXME: If we've got CGAL support, render this node as a CGAL union into a PolySet
 Response CSGTreeEvaluator::visit(State &state, const RenderNode &node)
 {
-	if (state.isPostfix()) {
+	if (state.isPrefix() && this->placeholders && this->geomevaluator &&
+			!GeometryCache::instance()->contains(this->tree.getIdString(node))) {
+		this->pending.insert(node.index());
+		this->pendingdepth++;
+	}
+	if (state.isPostfix() && this->pending.erase(node.index())) {
+		applyToChildren(state, node, OPENSCAD_UNION);
+		if (--this->pendingdepth == 0) storePlaceholder(state, node);
+		addToParent(state, node);
+	}
+	else if (state.isPostfix()) {
 		shared_ptr<CSGNode> t1;
 		shared_ptr<const Geometry> geom;
 		if (this->geomevaluator) {
@@ -253,7 +326,7 @@ Response CSGTreeEvaluator::visit(State &state, const RenderNode &node)
 			}
 			node.progress_report();
 		}
-		this->stored_term[node.index()] = t1;
+		termOf(node) = t1;
 		addToParent(state, node);
 	}
 	return ContinueTraversal;
@@ -261,7 +334,12 @@ Response CSGTreeEvaluator::visit(State &state, const RenderNode &node)
 
 Response CSGTreeEvaluator::visit(State &state, const CgaladvNode &node)
 {
-	if (state.isPostfix()) {
+	if (state.isPostfix() && this->pendingdepth > 0) {
+		// Only the extent matters below a placeholder
+		applyToChildren(state, node, OPENSCAD_UNION);
+		addToParent(state, node);
+	}
+	else if (state.isPostfix()) {
 		shared_ptr<CSGNode> t1;
     // FIXME: Calling evaluator directly since we're not a PolyNode. Generalize this.
 		shared_ptr<const Geometry> geom;
@@ -272,7 +350,30 @@ Response CSGTreeEvaluator::visit(State &state, const CgaladvNode &node)
 			}
 			node.progress_report();
 		}
-		this->stored_term[node.index()] = t1;
+		termOf(node) = t1;
+		applyBackgroundAndHighlight(state, node);
+		addToParent(state, node);
+	}
+	return ContinueTraversal;
+}
+
+/*!
+	Simplified meshes are previewed as they are rendered, like render().
+*/
+Response CSGTreeEvaluator::visit(State &state, const SimplifyNode &node)
+{
+	if (state.isPostfix() && this->pendingdepth > 0) {
+		applyToChildren(state, node, OPENSCAD_UNION);
+		addToParent(state, node);
+	}
+	else if (state.isPostfix()) {
+		shared_ptr<CSGNode> t1;
+		if (this->geomevaluator) {
+			shared_ptr<const Geometry> geom = this->geomevaluator->evaluateGeometry(node, false);
+			if (geom) t1 = evaluateCSGNodeFromGeometry(state, geom, node.modinst, node);
+			node.progress_report();
+		}
+		termOf(node) = t1;
 		applyBackgroundAndHighlight(state, node);
 		addToParent(state, node);
 	}
@@ -286,8 +387,8 @@ Response CSGTreeEvaluator::visit(State &state, const CgaladvNode &node)
 */
 void CSGTreeEvaluator::addToParent(const State &state, const AbstractNode &node)
 {
-	this->visitedchildren.erase(node.index());
+	ChildList().swap(childrenOf(node));
 	if (state.parent()) {
-		this->visitedchildren[state.parent()->index()].push_back(&node);
+		childrenOf(*state.parent()).push_back(&node);
 	}
 }
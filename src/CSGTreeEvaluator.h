@@ -1,8 +1,7 @@
 #pragma once
 
-#include <map>
-#include <list>
 #include <vector>
+#include <unordered_set>
 #include <cstddef>
 #include "NodeVisitor.h"
 #include "memory.h"
@@ -12,7 +11,7 @@ class CSGTreeEvaluator : public NodeVisitor
 {
 public:
 	CSGTreeEvaluator(const class Tree &tree, class GeometryEvaluator *geomevaluator = NULL)
-		: tree(tree), geomevaluator(geomevaluator) {
+		: firstindex(0), tree(tree), geomevaluator(geomevaluator), placeholders(false), pendingdepth(0) {
 	}
   virtual ~CSGTreeEvaluator() {}
 
@@ -24,8 +23,10 @@ public:
 	virtual Response visit(State &state, const class ColorNode &node);
  	virtual Response visit(State &state, const class RenderNode &node);
  	virtual Response visit(State &state, const class CgaladvNode &node);
+	virtual Response visit(State &state, const class SimplifyNode &node);
 
 	shared_ptr<class CSGNode> buildCSGTree(const AbstractNode &node);
+	void setPlaceholders(bool on) { this->placeholders = on; }
 
 	const shared_ptr<CSGNode> &getRootNode() const {
 		return this->rootNode;
@@ -45,10 +46,18 @@ private:
 																									const class ModuleInstantiation *modinst, 
 																									const AbstractNode &node);
 	void applyBackgroundAndHighlight(State &state, const AbstractNode &node);
+	void storePlaceholder(State &state, const AbstractNode &node);
+
+	typedef std::vector<const AbstractNode *> ChildList;
+	ChildList &childrenOf(const AbstractNode &node) { return this->visitedchildren[node.index() - this->firstindex]; }
+	shared_ptr<CSGNode> &termOf(const AbstractNode &node) { return this->stored_term[node.index() - this->firstindex]; }
 
   const AbstractNode *root;
-  typedef std::list<const AbstractNode *> ChildList;
-	std::map<int, ChildList> visitedchildren;
+	// The children visited and the term evaluated of each node, indexed by
+	// node index from firstindex. Both are released once folded into the parent.
+	std::vector<ChildList> visitedchildren;
+	std::vector<shared_ptr<CSGNode>> stored_term;
+	size_t firstindex;
 
 protected:
 	const Tree &tree;
@@ -56,5 +65,8 @@ protected:
 	shared_ptr<CSGNode> rootNode;
 	std::vector<shared_ptr<CSGNode>> highlightNodes;
 	std::vector<shared_ptr<CSGNode>> backgroundNodes;
-	std::map<int, shared_ptr<CSGNode>> stored_term; // The term evaluated from each node index
+	// Uncached render() nodes are shown as boxes rather than evaluated
+	bool placeholders;
+	std::unordered_set<size_t> pending; // Indices of the uncached render() nodes
+	int pendingdepth; // Number of uncached render() nodes above the current one
 };
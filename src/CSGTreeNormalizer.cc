@@ -2,6 +2,8 @@
 #include "csgnode.h"
 #include "printutils.h"
 
+#include <algorithm>
+
 // Helper function to debug normalization bugs
 #if 0
 static bool validate_tree(const shared_ptr<CSGNode> &node)
@@ -16,122 +18,86 @@ static bool validate_tree(const shared_ptr<CSGNode> &node)
 
 /*!
 	NB! for e.g. empty intersections, this can normalize a tree to nothing and return NULL.
+
+	The given tree is not modified. Identical subterms, both shared in the
+	given tree and duplicated by the rewrite rules, are normalized once
+	and share one node, so the limit applies to the number of distinct
+	terms created and to the number of leaves in the expanded products.
+	If either is exceeded, the tree is returned as is.
 */
 shared_ptr<CSGNode> CSGTreeNormalizer::normalize(const shared_ptr<CSGNode> &root)
 {
 	this->aborted = false;
-	shared_ptr<CSGNode> temp = root;
-	while (1) {
-		this->rootnode = temp;
-		this->nodecount = 0;
-		shared_ptr<CSGNode> n = normalizePass(temp);
-		if (!n) return n; // If normalized to nothing
-		if (temp == n) break;
-		temp = n;
-
-		if (this->nodecount > this->limit) {
-			PRINTB("WARNING: Normalized tree is growing past %d elements. Aborting normalization.\n", this->limit);
-      // Clean up any partially evaluated nodes
-			shared_ptr<CSGNode> newroot = root, tmproot;
-			while (newroot && newroot != tmproot) {
-				tmproot = newroot;
-				newroot = collapse_null_terms(tmproot);
-			}
-			newroot = cleanup_term(newroot);
-			return newroot;
-		}
-	}
-	this->rootnode.reset();
-	return temp;
-}
+	this->nodecount = 0;
+	shared_ptr<CSGNode> result = normalizePass(root);
+	if (!this->aborted && result && count(result) > this->limit) this->aborted = true;
+	this->normalized.clear();
+	this->operations.clear();
+	this->leafcounts.clear();
 
-/*!
-	After aborting, a subtree might have become invalidated (NULL child node)
-	since terms can be instantiated multiple times.
-	This will search for NULL children an recursively repair the corresponding
-	subtree.
- */
-shared_ptr<CSGNode> CSGTreeNormalizer::cleanup_term(shared_ptr<CSGNode> &t)
-{
-	if (shared_ptr<CSGOperation> op = dynamic_pointer_cast<CSGOperation>(t)) {
-		if (op->left()) op->left() = cleanup_term(op->left());
-		if (op->right()) op->right() = cleanup_term(op->right());
-		return collapse_null_terms(op);
+	if (this->aborted) {
+		PRINTB("WARNING: Normalized tree is growing past %d elements. Aborting normalization.\n", this->limit);
+		return root;
 	}
-	return t;
-}
-
-static bool isUnion(shared_ptr<CSGNode> node) {
-	shared_ptr<CSGOperation> op = dynamic_pointer_cast<CSGOperation>(node);
-	return op && op->getType() == OPENSCAD_UNION;
-}
-
-static bool hasRightLeaf(shared_ptr<CSGNode> node) {
-	shared_ptr<CSGOperation> op = dynamic_pointer_cast<CSGOperation>(node);
-	return op && dynamic_pointer_cast<CSGLeaf>(op->right());
+	return result;
 }
 
-static bool hasLeftUnion(shared_ptr<CSGNode> node) {
-	shared_ptr<CSGOperation> op = dynamic_pointer_cast<CSGOperation>(node);
-	return op && isUnion(op->left());
-}
-
-shared_ptr<CSGNode> CSGTreeNormalizer::normalizePass(shared_ptr<CSGNode> node)
+shared_ptr<CSGNode> CSGTreeNormalizer::normalizePass(const shared_ptr<CSGNode> &term)
 {
 	// This function implements the CSG normalization
-  // Reference:
+	// Reference:
 	// Goldfeather, J., Molnar, S., Turk, G., and Fuchs, H. Near
 	// Realtime CSG Rendering Using Tree Normalization and Geometric
 	// Pruning. IEEE Computer Graphics and Applications, 9(3):20-28,
 	// 1989.
-  // http://www.cc.gatech.edu/~turk/my_papers/pxpl_csg.pdf
-
-	if (dynamic_pointer_cast<CSGLeaf>(node)) return node;
+	// http://www.cc.gatech.edu/~turk/my_papers/pxpl_csg.pdf
+
+	if (!term || dynamic_pointer_cast<CSGLeaf>(term)) return term;
+	auto found = this->normalized.find(term.get());
+	if (found != this->normalized.end()) return found->second.result;
+	if (++this->nodecount > this->limit) {
+		this->aborted = true;
+		return shared_ptr<CSGNode>();
+	}
 
-	do {
+	// Rewrite the top of the term until no rule matches, then normalize its
+	// operands. Every new operation is created through createCSGNode(), so
+	// the bounding boxes stay exact and disjoint terms are pruned.
+	shared_ptr<CSGNode> node = term;
+	while (true) {
 		while (node && match_and_replace(node)) {	}
-		this->nodecount++;
-		if (nodecount > this->limit) {
-			PRINTB("WARNING: Normalized tree is growing past %d elements. Aborting normalization.\n", this->limit);
-			this->aborted = true;
-			return shared_ptr<CSGNode>();
-		}
-		if (!node) return node;
-		if (shared_ptr<CSGOperation> op = dynamic_pointer_cast<CSGOperation>(node)) {
-			op->left() = normalizePass(op->left());
-		}
-	} while (!this->aborted && !isUnion(node) &&
-					 (!hasRightLeaf(node) ||
-						hasLeftUnion(node)));
-	if (!this->aborted) {
 		shared_ptr<CSGOperation> op = dynamic_pointer_cast<CSGOperation>(node);
-		assert(op);
-		op->right() = normalizePass(op->right());
-	}
-
-	// FIXME: Do we need to take into account any transformation of item here?
-	shared_ptr<CSGNode> t = collapse_null_terms(node);
-
-	if (this->aborted) {
-		if (t) t = cleanup_term(t);
+		if (!op) break;
+		shared_ptr<CSGNode> left = normalizePass(op->left());
+		if (this->aborted) return shared_ptr<CSGNode>();
+		if (left != op->left()) {
+			// A normalized left operand may match another rule
+			node = createCSGNode(op->getType(), left, op->right());
+			continue;
+		}
+		shared_ptr<CSGNode> right = normalizePass(op->right());
+		if (this->aborted) return shared_ptr<CSGNode>();
+		if (right != op->right()) node = createCSGNode(op->getType(), left, right);
+		break;
 	}
 
-	return t;
+	this->normalized[term.get()] = Entry{term, shared_ptr<CSGNode>(), node};
+	if (node) this->normalized[node.get()] = Entry{node, shared_ptr<CSGNode>(), node};
+	return node;
 }
 
-shared_ptr<CSGNode> CSGTreeNormalizer::collapse_null_terms(const shared_ptr<CSGNode> &node)
+/*!
+	Creates an operation like CSGOperation::createCSGNode(), but returns
+	the existing node if the same operation on the same operands was
+	created before.
+*/
+shared_ptr<CSGNode> CSGTreeNormalizer::createCSGNode(OpenSCADOperator type, const shared_ptr<CSGNode> &left, const shared_ptr<CSGNode> &right)
 {
-	shared_ptr<CSGOperation> op = dynamic_pointer_cast<CSGOperation>(node);
-	if (op) {
-		if (!op->right()) {
-			if (op->getType() == OPENSCAD_UNION || op->getType() == OPENSCAD_DIFFERENCE) return op->left();
-			else return op->right();
-		}
-		if (!op->left()) {
-			if (op->getType() == OPENSCAD_UNION) return op->right();
-			else return op->left();
-		}
-	}
+	const auto key = std::make_tuple(int(type), left.get(), right.get());
+	auto found = this->operations.find(key);
+	if (found != this->operations.end()) return found->second.result;
+	shared_ptr<CSGNode> node = CSGOperation::createCSGNode(type, left, right);
+	this->operations[key] = Entry{left, right, node};
 	return node;
 }
 
@@ -151,43 +117,43 @@ bool CSGTreeNormalizer::match_and_replace(shared_ptr<CSGNode> &node)
 
 		// 1.  x - (y + z) -> (x - y) - z
 		if (op->getType() == OPENSCAD_DIFFERENCE && rightop->getType() == OPENSCAD_UNION) {
-			node = CSGOperation::createCSGNode(OPENSCAD_DIFFERENCE, 
-																				 CSGOperation::createCSGNode(OPENSCAD_DIFFERENCE, x, y),
+			node = createCSGNode(OPENSCAD_DIFFERENCE, 
+																				 createCSGNode(OPENSCAD_DIFFERENCE, x, y),
 																				 z);
 			return true;
 		}
 		// 2.  x * (y + z) -> (x * y) + (x * z)
 		else if (op->getType() == OPENSCAD_INTERSECTION && rightop->getType() == OPENSCAD_UNION) {
-			node = CSGOperation::createCSGNode(OPENSCAD_UNION, 
-																		CSGOperation::createCSGNode(OPENSCAD_INTERSECTION, x, y), 
-																		CSGOperation::createCSGNode(OPENSCAD_INTERSECTION, x, z));
+			node = createCSGNode(OPENSCAD_UNION, 
+																		createCSGNode(OPENSCAD_INTERSECTION, x, y), 
+																		createCSGNode(OPENSCAD_INTERSECTION, x, z));
 			return true;
 		}
 		// 3.  x - (y * z) -> (x - y) + (x - z)
 		else if (op->getType() == OPENSCAD_DIFFERENCE && rightop->getType() == OPENSCAD_INTERSECTION) {
-			node = CSGOperation::createCSGNode(OPENSCAD_UNION, 
-																		CSGOperation::createCSGNode(OPENSCAD_DIFFERENCE, x, y), 
-																		CSGOperation::createCSGNode(OPENSCAD_DIFFERENCE, x, z));
+			node = createCSGNode(OPENSCAD_UNION, 
+																		createCSGNode(OPENSCAD_DIFFERENCE, x, y), 
+																		createCSGNode(OPENSCAD_DIFFERENCE, x, z));
 			return true;
 		}
 		// 4.  x * (y * z) -> (x * y) * z
 		else if (op->getType() == OPENSCAD_INTERSECTION && rightop->getType() == OPENSCAD_INTERSECTION) {
-			node = CSGOperation::createCSGNode(OPENSCAD_INTERSECTION, 
-																		CSGOperation::createCSGNode(OPENSCAD_INTERSECTION, x, y),
+			node = createCSGNode(OPENSCAD_INTERSECTION, 
+																		createCSGNode(OPENSCAD_INTERSECTION, x, y),
 																		z);
 			return true;
 		}
 		// 5.  x - (y - z) -> (x - y) + (x * z)
 		else if (op->getType() == OPENSCAD_DIFFERENCE && rightop->getType() == OPENSCAD_DIFFERENCE) {
-			node = CSGOperation::createCSGNode(OPENSCAD_UNION, 
-																		CSGOperation::createCSGNode(OPENSCAD_DIFFERENCE, x, y), 
-																		CSGOperation::createCSGNode(OPENSCAD_INTERSECTION, x, z));
+			node = createCSGNode(OPENSCAD_UNION, 
+																		createCSGNode(OPENSCAD_DIFFERENCE, x, y), 
+																		createCSGNode(OPENSCAD_INTERSECTION, x, z));
 			return true;
 		}
 		// 6.  x * (y - z) -> (x * y) - z
 		else if (op->getType() == OPENSCAD_INTERSECTION && rightop->getType() == OPENSCAD_DIFFERENCE) {
-			node = CSGOperation::createCSGNode(OPENSCAD_DIFFERENCE, 
-																		CSGOperation::createCSGNode(OPENSCAD_INTERSECTION, x, y),
+			node = createCSGNode(OPENSCAD_DIFFERENCE, 
+																		createCSGNode(OPENSCAD_INTERSECTION, x, y),
 																		z);
 			return true;
 		}
@@ -202,34 +168,41 @@ bool CSGTreeNormalizer::match_and_replace(shared_ptr<CSGNode> &node)
 		
 		// 7. (x - y) * z  -> (x * z) - y
 		if (leftop->getType() == OPENSCAD_DIFFERENCE && op->getType() == OPENSCAD_INTERSECTION) {
-			node = CSGOperation::createCSGNode(OPENSCAD_DIFFERENCE, 
-																		CSGOperation::createCSGNode(OPENSCAD_INTERSECTION, x, z), 
+			node = createCSGNode(OPENSCAD_DIFFERENCE, 
+																		createCSGNode(OPENSCAD_INTERSECTION, x, z), 
 																		y);
 			return true;
 		}
 		// 8. (x + y) - z  -> (x - z) + (y - z)
 		else if (leftop->getType() == OPENSCAD_UNION && op->getType() == OPENSCAD_DIFFERENCE) {
-			node = CSGOperation::createCSGNode(OPENSCAD_UNION, 
-																		CSGOperation::createCSGNode(OPENSCAD_DIFFERENCE, x, z), 
-																		CSGOperation::createCSGNode(OPENSCAD_DIFFERENCE, y, z));
+			node = createCSGNode(OPENSCAD_UNION, 
+																		createCSGNode(OPENSCAD_DIFFERENCE, x, z), 
+																		createCSGNode(OPENSCAD_DIFFERENCE, y, z));
 			return true;
 		}
 		// 9. (x + y) * z  -> (x * z) + (y * z)
 		else if (leftop->getType() == OPENSCAD_UNION && op->getType() == OPENSCAD_INTERSECTION) {
-			node = CSGOperation::createCSGNode(OPENSCAD_UNION, 
-																		CSGOperation::createCSGNode(OPENSCAD_INTERSECTION, x, z), 
-																		CSGOperation::createCSGNode(OPENSCAD_INTERSECTION, y, z));
+			node = createCSGNode(OPENSCAD_UNION, 
+																		createCSGNode(OPENSCAD_INTERSECTION, x, z), 
+																		createCSGNode(OPENSCAD_INTERSECTION, y, z));
 			return true;
 		}
 	}
 	return false;
 }
 
-// Counts all non-leaf nodes
-unsigned int CSGTreeNormalizer::count(const shared_ptr<CSGNode> &node) const
+/*!
+	Counts the leaves of the term as it will be expanded into products,
+	where shared subterms are counted for each use. Stops counting just
+	above the limit.
+*/
+size_t CSGTreeNormalizer::count(const shared_ptr<CSGNode> &term)
 {
-	if (shared_ptr<CSGOperation> op = dynamic_pointer_cast<CSGOperation>(node)) {
-		return 1 + count(op->left()) + count(op->right());
-	}
-	return 0;
+	shared_ptr<CSGOperation> op = dynamic_pointer_cast<CSGOperation>(term);
+	if (!op) return 1;
+	auto found = this->leafcounts.find(op.get());
+	if (found != this->leafcounts.end()) return found->second;
+	const size_t leaves = std::min(count(op->left()) + count(op->right()), this->limit + 1);
+	this->leafcounts[op.get()] = leaves;
+	return leaves;
 }
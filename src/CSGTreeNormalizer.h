@@ -1,6 +1,10 @@
 #pragma once
 
 #include "memory.h"
+#include "enums.h"
+#include <map>
+#include <tuple>
+#include <unordered_map>
 
 class CSGTreeNormalizer
 {
@@ -11,14 +15,24 @@ public:
 	shared_ptr<class CSGNode> normalize(const shared_ptr<CSGNode> &term);
 
 private:
-	shared_ptr<CSGNode> normalizePass(shared_ptr<CSGNode> term) ;
+	// A term with its normalized form, or an operation with its operands. The
+	// operands are held so their addresses stay valid as keys.
+	struct Entry {
+		shared_ptr<CSGNode> left, right, result;
+	};
+
+	shared_ptr<CSGNode> normalizePass(const shared_ptr<CSGNode> &term);
 	bool match_and_replace(shared_ptr<class CSGNode> &term);
-	shared_ptr<CSGNode> collapse_null_terms(const shared_ptr<CSGNode> &term);
-	shared_ptr<CSGNode> cleanup_term(shared_ptr<CSGNode> &t);
-	unsigned int count(const shared_ptr<CSGNode> &term) const;
+	shared_ptr<CSGNode> createCSGNode(OpenSCADOperator type, const shared_ptr<CSGNode> &left, const shared_ptr<CSGNode> &right);
+	size_t count(const shared_ptr<CSGNode> &term);
 
 	bool aborted;
 	size_t limit;
 	size_t nodecount;
-	shared_ptr<class CSGNode> rootnode;
+	// Terms already normalized, so shared subterms are only normalized once
+	std::unordered_map<const CSGNode *, Entry> normalized;
+	// Operations already created, so identical terms share one node
+	std::map<std::tuple<int, const CSGNode *, const CSGNode *>, Entry> operations;
+	// Number of leaves of each term once expanded into products
+	std::unordered_map<const CSGNode *, size_t> leafcounts;
 };
@@ -0,0 +1,240 @@
+#include "CachePanel.h"
+#include "GeometryCache.h"
+
+#include <QLabel>
+#include <QTreeWidget>
+#include <QHeaderView>
+#include <QPushButton>
+#include <QHBoxLayout>
+#include <QVBoxLayout>
+#include <QTimer>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+static const int REFRESH_INTERVAL_MS = 1000;
+// Entries listed per module, the largest first
+static const size_t MAX_MODULE_ENTRIES = 100;
+static const int ID_DISPLAY_LENGTH = 80;
+
+static QString format_bytes(size_t bytes)
+{
+	if (bytes < 1024) return QString("%1 B").arg(bytes);
+	if (bytes < 1024*1024) return QString("%1 KB").arg(bytes / 1024.0, 0, 'f', 1);
+	return QString("%1 MB").arg(bytes / (1024.0*1024.0), 0, 'f', 1);
+}
+
+// The module which made an entry, e.g. "cube" for "cube(size = [1, 1, 1], center = false)"
+static std::string module_name(const std::string &id)
+{
+	const size_t paren = id.find('(');
+	return paren == std::string::npos ? id : id.substr(0, paren);
+}
+
+CachePanel::CachePanel(QWidget *parent)
+	: QWidget(parent), lastpinned(0)
+{
+	this->summary = new QLabel(this);
+	this->summary->setWordWrap(true);
+	this->summary->setTextInteractionFlags(Qt::TextSelectableByMouse);
+
+	this->entries = new QTreeWidget(this);
+	this->entries->setColumnCount(5);
+	this->entries->setHeaderLabels(QStringList() << _("Entry") << _("Size") << _("Representations")
+																 << _("Compute time") << _("Pinned"));
+	this->entries->setSelectionMode(QAbstractItemView::ExtendedSelection);
+	this->entries->setUniformRowHeights(true);
+	this->entries->setSortingEnabled(false);
+
+	QPushButton *pin = new QPushButton(_("Pin"), this);
+	pin->setToolTip(_("Keep the selected entries in memory"));
+	QPushButton *unpin = new QPushButton(_("Unpin"), this);
+	QPushButton *flush = new QPushButton(_("Flush"), this);
+	flush->setToolTip(_("Remove the selected entries from the cache"));
+	QPushButton *flushall = new QPushButton(_("Flush all"), this);
+	connect(pin, SIGNAL(clicked()), this, SLOT(pinSelected()));
+	connect(unpin, SIGNAL(clicked()), this, SLOT(unpinSelected()));
+	connect(flush, SIGNAL(clicked()), this, SLOT(flushSelected()));
+	connect(flushall, SIGNAL(clicked()), this, SLOT(flushAll()));
+
+	QHBoxLayout *buttons = new QHBoxLayout();
+	buttons->addWidget(pin);
+	buttons->addWidget(unpin);
+	buttons->addWidget(flush);
+	buttons->addStretch();
+	buttons->addWidget(flushall);
+
+	QVBoxLayout *layout = new QVBoxLayout(this);
+	layout->setContentsMargins(0, 0, 0, 0);
+	layout->addWidget(this->summary);
+	layout->addWidget(this->entries);
+	layout->addLayout(buttons);
+
+	this->timer = new QTimer(this);
+	this->timer->setInterval(REFRESH_INTERVAL_MS);
+	connect(this->timer, SIGNAL(timeout()), this, SLOT(refresh()));
+}
+
+void CachePanel::showEvent(QShowEvent *event)
+{
+	QWidget::showEvent(event);
+	updateEntries();
+	refresh();
+	this->timer->start();
+}
+
+void CachePanel::hideEvent(QHideEvent *event)
+{
+	this->timer->stop();
+	QWidget::hideEvent(event);
+}
+
+/*!
+	Updates the statistics, and the entries if the cache has changed since
+	they were listed.
+*/
+void CachePanel::refresh()
+{
+	const CacheStats st = GeometryCache::instance()->stats();
+	if (st.entries != this->laststats.entries || st.cost != this->laststats.cost ||
+			st.insertions != this->laststats.insertions || st.evictions != this->laststats.evictions) {
+		updateEntries();
+	}
+
+	this->summary->setText(QString(_("%1 entries, %2 of %3 (%4%), %5 pinned\n"
+																	 "Hit rate %6% (%7 hits, %8 misses), %9 evictions (%10)"))
+												 .arg(st.entries)
+												 .arg(format_bytes(st.cost))
+												 .arg(format_bytes(st.maxcost))
+												 .arg(st.maxcost ? 100.0 * st.cost / st.maxcost : 0, 0, 'f', 1)
+												 .arg(this->lastpinned)
+												 .arg(100.0 * st.hitRate(), 0, 'f', 1)
+												 .arg(st.hits)
+												 .arg(st.misses)
+												 .arg(st.evictions)
+												 .arg(format_bytes(st.evictedcost)));
+}
+
+/*!
+	Lists the entries grouped by module, the modules with the largest
+	entries in total first, keeping the selection and expanded modules.
+*/
+void CachePanel::updateEntries()
+{
+	this->laststats = GeometryCache::instance()->stats();
+	std::vector<GeometryCache::EntryInfo> infos = GeometryCache::instance()->entries();
+
+	const QSet<QString> selected = selectedIds();
+	QSet<QString> expanded;
+	for (int i = 0; i < this->entries->topLevelItemCount(); i++) {
+		QTreeWidgetItem *item = this->entries->topLevelItem(i);
+		if (item->isExpanded()) expanded.insert(item->data(0, Qt::UserRole + 1).toString());
+	}
+
+	struct Group {
+		Group() : bytes(0), computetime(0), pinned(0) {}
+		size_t bytes;
+		double computetime;
+		size_t pinned;
+		std::vector<const GeometryCache::EntryInfo *> entries;
+	};
+	std::map<std::string, Group> groups;
+	this->lastpinned = 0;
+	for (const auto &info : infos) {
+		Group &group = groups[module_name(info.id)];
+		group.bytes += info.bytes;
+		group.computetime += info.computetime;
+		if (info.pinned) {
+			group.pinned++;
+			this->lastpinned++;
+		}
+		group.entries.push_back(&info);
+	}
+
+	std::vector<std::pair<std::string, Group *>> sorted;
+	for (auto &group : groups) sorted.push_back(std::make_pair(group.first, &group.second));
+	std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, Group *> &a, const std::pair<std::string, Group *> &b) {
+			return a.second->bytes > b.second->bytes;
+		});
+
+	this->entries->clear();
+	for (const auto &group : sorted) {
+		const QString name = QString::fromStdString(group.first);
+		QTreeWidgetItem *moduleitem = new QTreeWidgetItem(this->entries);
+		moduleitem->setText(0, QString("%1 (%2)").arg(name).arg(group.second->entries.size()));
+		moduleitem->setText(1, format_bytes(group.second->bytes));
+		moduleitem->setText(3, QString("%1 s").arg(group.second->computetime, 0, 'f', 2));
+		if (group.second->pinned) moduleitem->setText(4, QString::number(group.second->pinned));
+		moduleitem->setData(0, Qt::UserRole + 1, name);
+		moduleitem->setFlags(moduleitem->flags() & ~Qt::ItemIsSelectable);
+
+		std::vector<const GeometryCache::EntryInfo *> &members = group.second->entries;
+		const size_t shown = std::min(members.size(), MAX_MODULE_ENTRIES);
+		std::partial_sort(members.begin(), members.begin() + shown, members.end(),
+											[](const GeometryCache::EntryInfo *a, const GeometryCache::EntryInfo *b) {
+												return a->bytes > b->bytes;
+											});
+		for (size_t i = 0; i < shown; i++) {
+			const GeometryCache::EntryInfo &info = *members[i];
+			const QString id = QString::fromStdString(info.id);
+			QStringList representations;
+			if (info.hasgeom) representations << _("Mesh");
+			if (info.hasnef) representations << _("Nef polyhedron");
+
+			QTreeWidgetItem *item = new QTreeWidgetItem(moduleitem);
+			item->setText(0, id.length() > ID_DISPLAY_LENGTH ? id.left(ID_DISPLAY_LENGTH) + "..." : id);
+			item->setToolTip(0, id.left(1000));
+			item->setText(1, format_bytes(info.bytes));
+			item->setText(2, representations.join(", "));
+			item->setText(3, QString("%1 s").arg(info.computetime, 0, 'f', 2));
+			if (info.pinned) item->setText(4, _("Yes"));
+			item->setData(0, Qt::UserRole, id);
+			if (selected.contains(id)) item->setSelected(true);
+		}
+		if (members.size() > shown) {
+			QTreeWidgetItem *more = new QTreeWidgetItem(moduleitem);
+			more->setText(0, QString(_("%1 smaller entries")).arg(members.size() - shown));
+			more->setFlags(more->flags() & ~Qt::ItemIsSelectable);
+		}
+		if (expanded.contains(name)) moduleitem->setExpanded(true);
+	}
+	this->entries->resizeColumnToContents(1);
+}
+
+QSet<QString> CachePanel::selectedIds() const
+{
+	QSet<QString> ids;
+	for (const auto item : this->entries->selectedItems()) {
+		const QVariant id = item->data(0, Qt::UserRole);
+		if (id.isValid()) ids.insert(id.toString());
+	}
+	return ids;
+}
+
+void CachePanel::pinSelected()
+{
+	for (const auto &id : selectedIds()) GeometryCache::instance()->setPinned(id.toStdString(), true);
+	updateEntries();
+	refresh();
+}
+
+void CachePanel::unpinSelected()
+{
+	for (const auto &id : selectedIds()) GeometryCache::instance()->setPinned(id.toStdString(), false);
+	updateEntries();
+	refresh();
+}
+
+void CachePanel::flushSelected()
+{
+	for (const auto &id : selectedIds()) GeometryCache::instance()->remove(id.toStdString());
+	updateEntries();
+	refresh();
+}
+
+void CachePanel::flushAll()
+{
+	GeometryCache::instance()->clear();
+	updateEntries();
+	refresh();
+}
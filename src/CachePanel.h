@@ -0,0 +1,45 @@
+#pragma once
+
+#include "qtgettext.h"
+#include <QWidget>
+#include <QSet>
+#include <QString>
+#include "CacheStats.h"
+
+/*!
+	Shows what's in the geometry cache: its utilization and hit rate, and
+	the largest entries grouped by the module which made them. Selected
+	entries can be pinned, so they're kept in memory, or flushed.
+
+	The statistics are refreshed periodically while the panel is visible.
+*/
+class CachePanel : public QWidget
+{
+	Q_OBJECT;
+
+public:
+	CachePanel(QWidget *parent = NULL);
+
+public slots:
+	void refresh();
+
+protected:
+	virtual void showEvent(class QShowEvent *event);
+	virtual void hideEvent(class QHideEvent *event);
+
+private slots:
+	void pinSelected();
+	void unpinSelected();
+	void flushSelected();
+	void flushAll();
+
+private:
+	QSet<QString> selectedIds() const;
+	void updateEntries();
+
+	class QLabel *summary;
+	class QTreeWidget *entries;
+	class QTimer *timer;
+	CacheStats laststats; // When the entries were listed
+	size_t lastpinned;
+};
@@ -0,0 +1,49 @@
+#include "CacheStats.h"
+#include "GeometryCache.h"
+#include "PersistentCache.h"
+#include "ImportCache.h"
+#include "feature.h"
+#include "OperationCounters.h"
+
+#include <boost/format.hpp>
+
+std::string CacheStats::toString() const
+{
+	return str(boost::format("%d hits, %d misses, %d insertions, %d rejected, %d evictions (%d bytes)")
+						 % this->hits % this->misses % this->insertions % this->rejections
+						 % this->evictions % this->evictedcost);
+}
+
+void CacheStats::writeJSON(std::ostream &out, const std::string &indent) const
+{
+	out << "{\n"
+			<< indent << "  \"hits\": " << this->hits << ",\n"
+			<< indent << "  \"misses\": " << this->misses << ",\n"
+			<< indent << "  \"insertions\": " << this->insertions << ",\n"
+			<< indent << "  \"rejections\": " << this->rejections << ",\n"
+			<< indent << "  \"evictions\": " << this->evictions << ",\n"
+			<< indent << "  \"bytes_evicted\": " << this->evictedcost << ",\n"
+			<< indent << "  \"entries\": " << this->entries << ",\n"
+			<< indent << "  \"bytes\": " << this->cost << ",\n"
+			<< indent << "  \"max_bytes\": " << this->maxcost << "\n"
+			<< indent << "}";
+}
+
+/*!
+	Writes the statistics of all geometry caches as a JSON object, with the
+	experimental features they were gathered with.
+*/
+void write_cache_stats(std::ostream &out)
+{
+	out << "{\n  \"geometry\": ";
+	GeometryCache::instance()->stats().writeJSON(out, "  ");
+	out << ",\n  \"import\": ";
+	ImportCache::instance()->stats().writeJSON(out, "  ");
+	out << ",\n  \"persistent\": ";
+	PersistentCache::instance()->stats().writeJSON(out, "  ");
+	out << ",\n  \"operations\": ";
+	OperationCounters::writeJSON(out, "  ");
+	out << ",\n  \"features\": ";
+	Feature::writeJSON(out, "  ");
+	out << "\n}\n";
+}
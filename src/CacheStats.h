@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <ostream>
+#include <stddef.h>
+
+/*!
+	Snapshot of the activity counters of a cache. Costs are in bytes for
+	the geometry caches.
+*/
+struct CacheStats
+{
+	CacheStats() : hits(0), misses(0), insertions(0), rejections(0),
+		evictions(0), evictedcost(0), entries(0), cost(0), maxcost(0) {}
+
+	size_t hits;
+	size_t misses;
+	size_t insertions;
+	size_t rejections;  // Insertions refused because the entry didn't fit
+	size_t evictions;
+	size_t evictedcost;
+	size_t entries;
+	size_t cost;
+	size_t maxcost;
+
+	double hitRate() const { return (hits + misses) ? double(hits) / (hits + misses) : 0; }
+	std::string toString() const;
+	void writeJSON(std::ostream &out, const std::string &indent = "") const;
+};
+
+void write_cache_stats(std::ostream &out);
@@ -74,6 +74,19 @@ void DrawingCallback::add_glyph_advance(double advance_x, double advance_y)
 	advance += Vector2d(advance_x, advance_y);
 }
 
+/*!
+	Adds outlines in glyph coordinates, as previously decomposed, to the
+	current glyph.
+*/
+void DrawingCallback::add_outlines(const std::vector<Outline2d> &outlines)
+{
+	for(const auto &o : outlines) {
+		Outline2d outline = o;
+		for(auto &v : outline.vertices) v = v + offset + advance;
+		this->polygon->addOutline(outline);
+	}
+}
+
 void DrawingCallback::add_vertex(const Vector2d &v)
 {
 	this->outline.vertices.push_back(v + offset + advance);
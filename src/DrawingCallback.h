@@ -39,6 +39,7 @@ public:
     void finish_glyph();
     void set_glyph_offset(double offset_x, double offset_y);
     void add_glyph_advance(double advance_x, double advance_y);
+    void add_outlines(const std::vector<Outline2d> &outlines);
 	std::vector<const Geometry *> get_result();
 
     void move_to(const Vector2d &to);
@@ -0,0 +1,142 @@
+#include "EvaluationBudget.h"
+#include "node.h"
+#include "ModuleInstantiation.h"
+#include "progress.h"
+#include "printutils.h"
+#include "GeometryCache.h"
+
+#include <thread>
+#include <cstdlib>
+#include <fstream>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+// Reading the memory use is a system call, so it isn't done for every node
+static const std::chrono::milliseconds memory_check_interval(100);
+
+/*!
+	Starts measuring the time budget of an evaluation.
+*/
+void EvaluationBudget::start()
+{
+	this->starttime = Clock::now();
+	this->lastmemorycheck = Clock::time_point();
+	this->current = NULL;
+}
+
+/*!
+	Ends the process if evaluation takes \a graceseconds longer than the time
+	limit, e.g. because a single CGAL operation doesn't return. Call after
+	start().
+*/
+void EvaluationBudget::startWatchdog(double graceseconds)
+{
+	if (this->timelimit <= 0) return;
+	const double seconds = this->timelimit + graceseconds;
+	std::thread([this, seconds]() {
+			std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+			const AbstractNode *node = this->current;
+			PRINTB("ERROR: Time limit of %g seconds exceeded%s, aborting", this->timelimit %
+						 (node ? " while evaluating " + describe(*node) : std::string()));
+			std::_Exit(EXIT_FAILURE);
+		}).detach();
+}
+
+/*!
+	Sets \a deadline to the time after which Boolean operations fall back
+	to approximate results. Returns false if there's no fallback time, or
+	start() wasn't called.
+*/
+bool EvaluationBudget::fallbackDeadline(Clock::time_point &deadline) const
+{
+	if (this->fallbacktime <= 0 || this->starttime == Clock::time_point()) return false;
+	deadline = this->starttime + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(this->fallbacktime));
+	return true;
+}
+
+/*!
+	Throws ProgressCancelException if evaluation is over budget.
+	\a nodeseconds is the time spent on \a node so far.
+*/
+void EvaluationBudget::check(const AbstractNode &node, double nodeseconds)
+{
+	if (!this->enabled) return;
+	this->current = &node;
+
+	const Clock::time_point now = Clock::now();
+	if (this->nodetimelimit > 0 && nodeseconds > this->nodetimelimit) {
+		exceeded(node, str(boost::format("Time limit of %g seconds per object") % this->nodetimelimit));
+	}
+	if (this->timelimit > 0 && std::chrono::duration<double>(now - this->starttime).count() > this->timelimit) {
+		exceeded(node, str(boost::format("Time limit of %g seconds") % this->timelimit));
+	}
+	if (this->memorylimit > 0 || this->highwater > 0) {
+		std::unique_lock<std::mutex> lock(this->memorymutex);
+		if (now - this->lastmemorycheck < memory_check_interval) return;
+		this->lastmemorycheck = now;
+		lock.unlock();
+		size_t memory = residentMemory();
+		if (this->highwater > 0 && memory > this->highwater) {
+			relieve(memory);
+			memory = residentMemory();
+		}
+		if (this->memorylimit > 0 && memory > this->memorylimit) {
+			exceeded(node, str(boost::format("Memory limit of %d MB") % (this->memorylimit / (1024*1024))));
+		}
+	}
+}
+
+/*!
+	Spills cached geometry to disk until the \a memory in use would be back
+	below 90% of the high-water mark, as far as the cache holds that much.
+*/
+void EvaluationBudget::relieve(size_t memory)
+{
+	// Other threads go on evaluating meanwhile
+	std::unique_lock<std::mutex> lock(this->spillmutex, std::try_to_lock);
+	if (!lock.owns_lock()) return;
+	if (!this->spilling) {
+		this->spilling = true;
+		PRINTB("Memory use of %d MB reached the high-water mark, moving cached geometry to disk", (memory / (1024*1024)));
+	}
+	const size_t target = this->highwater / 10 * 9;
+	const size_t freed = GeometryCache::instance()->spill(memory - target);
+#ifdef __GLIBC__
+	// Else the freed memory stays with the process
+	if (freed > 0) malloc_trim(0);
+#endif
+	PRINTDB("Spilled %d bytes of cached geometry to disk", freed);
+}
+
+void EvaluationBudget::exceeded(const AbstractNode &node, const std::string &what)
+{
+	PRINTB("ERROR: %s exceeded while evaluating %s", what % describe(node));
+	throw ProgressCancelException();
+}
+
+std::string EvaluationBudget::describe(const AbstractNode &node)
+{
+	std::string desc = node.name();
+	if (node.modinst && node.modinst->location().firstLine() > 0) {
+		desc += str(boost::format(" (line %d)") % node.modinst->location().firstLine());
+	}
+	return desc;
+}
+
+/*!
+	Returns the resident memory of the process in bytes, or 0 if it can't be
+	determined on this platform.
+*/
+size_t EvaluationBudget::residentMemory()
+{
+#ifdef __linux__
+	std::ifstream statm("/proc/self/statm");
+	size_t size = 0, resident = 0;
+	if (statm >> size >> resident) return resident * sysconf(_SC_PAGESIZE);
+#endif
+	return 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <atomic>
+#include <mutex>
+
+/*!
+	Time and memory limits for geometry evaluation, e.g. for servers
+	rendering untrusted designs.
+
+	check() is called when nodes are entered and finished and from progress
+	reports. Once a limit is exceeded, it prints which node blew the budget
+	and throws ProgressCancelException, which aborts evaluation like a
+	user cancel. A single CGAL operation can't be interrupted, so a limit is
+	only noticed after it returns; the optional watchdog ends the process if
+	the time limit is exceeded by more than a grace period.
+
+	Below the memory limit, a high-water mark can be set at which cached
+	geometry is spilled to disk instead, so a big job can still finish.
+
+	With a fallback time, Boolean operations which aren't done that long
+	after start() get an approximate result instead, and finish in the
+	background for the cache, see GeometryEvaluator::applyWithFallback().
+*/
+class EvaluationBudget
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	EvaluationBudget() : timelimit(0), nodetimelimit(0), memorylimit(0), highwater(0), fallbacktime(0), enabled(false), spilling(false), current(NULL) {}
+	static EvaluationBudget *instance() { static EvaluationBudget *inst = new EvaluationBudget; return inst; }
+
+	void setTimeLimit(double seconds) { this->timelimit = seconds; update(); }
+	void setNodeTimeLimit(double seconds) { this->nodetimelimit = seconds; update(); }
+	void setMemoryLimit(size_t bytes) { this->memorylimit = bytes; update(); }
+	void setHighWaterMark(size_t bytes) { this->highwater = bytes; update(); }
+	void setFallbackTime(double seconds) { this->fallbacktime = seconds; }
+	bool fallbackDeadline(Clock::time_point &deadline) const;
+	bool isEnabled() const { return this->enabled; }
+
+	void start();
+	void startWatchdog(double graceseconds);
+	void check(const class AbstractNode &node, double nodeseconds = 0);
+
+	static size_t residentMemory();
+
+private:
+	void update() { this->enabled = this->timelimit > 0 || this->nodetimelimit > 0 || this->memorylimit > 0 || this->highwater > 0; }
+	void relieve(size_t memory);
+	void exceeded(const AbstractNode &node, const std::string &what);
+	static std::string describe(const AbstractNode &node);
+
+	double timelimit;
+	double nodetimelimit;
+	size_t memorylimit;
+	size_t highwater;
+	double fallbacktime;
+	bool enabled;
+	bool spilling;
+	Clock::time_point starttime;
+	Clock::time_point lastmemorycheck;
+	std::mutex memorymutex;
+	std::mutex spillmutex;
+	// Last node checked, reported by the watchdog
+	std::atomic<const AbstractNode *> current;
+};
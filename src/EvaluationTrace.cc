@@ -0,0 +1,72 @@
+#include "EvaluationTrace.h"
+
+#include <ostream>
+#include <boost/format.hpp>
+
+static std::string json_string(const std::string &s)
+{
+	std::string result = "\"";
+	for(const auto c : s) {
+		if (c == '"' || c == '\\') result += '\\';
+		result += c;
+	}
+	return result + "\"";
+}
+
+void EvaluationTrace::enable(bool enabled)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->enabled = enabled;
+	this->epoch = Clock::now();
+}
+
+/*!
+	Adds \a event on the calling thread. Can be called from any thread.
+*/
+void EvaluationTrace::add(const Event &event)
+{
+	const std::thread::id id = std::this_thread::get_id();
+	std::lock_guard<std::mutex> lock(this->mutex);
+	auto thread = this->threads.find(id);
+	if (thread == this->threads.end()) thread = this->threads.insert(std::make_pair(id, int(this->threads.size()) + 1)).first;
+	Record record;
+	record.event = event;
+	record.thread = thread->second;
+	this->records.push_back(record);
+}
+
+void EvaluationTrace::clear()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->records.clear();
+	this->threads.clear();
+	this->epoch = Clock::now();
+}
+
+/*!
+	Writes the events as a JSON trace, with times in microseconds since
+	the trace was enabled.
+*/
+void EvaluationTrace::write(std::ostream &stream) const
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	stream << "{\"traceEvents\": [";
+	for (size_t i = 0; i < this->records.size(); i++) {
+		const Event &e = this->records[i].event;
+		const double ts = std::chrono::duration<double, std::micro>(e.start - this->epoch).count();
+		stream << (i > 0 ? ",\n" : "\n")
+					 << "{\"name\": " << json_string(e.name)
+					 << ", \"cat\": \"" << (e.cached ? "cached" : "evaluated") << "\""
+					 << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << this->records[i].thread
+					 << str(boost::format(", \"ts\": %.3f, \"dur\": %.3f") % ts % (e.seconds * 1e6))
+					 << ", \"args\": {\"operation\": " << json_string(e.operation)
+					 << str(boost::format(", \"key\": \"%016x\"") % e.keyhash)
+					 << ", \"cached\": " << (e.cached ? "true" : "false")
+					 << ", \"representation\": " << json_string(e.representation)
+					 << ", \"input_vertices\": " << e.inputvertices
+					 << ", \"input_facets\": " << e.inputfacets
+					 << ", \"output_vertices\": " << e.outputvertices
+					 << ", \"output_facets\": " << e.outputfacets << "}}";
+	}
+	stream << "\n], \"displayTimeUnit\": \"ms\"}\n";
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <map>
+#include <iosfwd>
+#include <stddef.h>
+
+/*!
+	Trace of the geometry evaluation, enabled with --trace. For each
+	visited node the GeometryEvaluator adds an Event with its operation,
+	cache key hash, whether it came from the cache, the representation and
+	size of its input and output, and when and on which thread it was
+	evaluated.
+
+	write() outputs the events in the JSON trace event format read by
+	chrome://tracing and similar viewers, with nested nodes stacked on
+	their thread.
+*/
+class EvaluationTrace
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	static EvaluationTrace *instance() { static EvaluationTrace *inst = new EvaluationTrace; return inst; }
+
+	void enable(bool enabled);
+	bool isEnabled() const { return this->enabled; }
+
+	struct Event {
+		Event() : keyhash(0), cached(false), inputvertices(0), inputfacets(0),
+			outputvertices(0), outputfacets(0), seconds(0) {}
+
+		std::string name;
+		std::string operation;
+		size_t keyhash;
+		bool cached;
+		std::string representation;
+		size_t inputvertices;
+		size_t inputfacets;
+		size_t outputvertices;
+		size_t outputfacets;
+		Clock::time_point start;
+		double seconds;
+	};
+
+	void add(const Event &event);
+
+	void clear();
+	void write(std::ostream &stream) const;
+
+private:
+	EvaluationTrace() : enabled(false) {}
+
+	struct Record {
+		Event event;
+		int thread;
+	};
+
+	bool enabled;
+	Clock::time_point epoch;
+	mutable std::mutex mutex;
+	std::vector<Record> records;
+	// Small numbers for the threads, in the order they were seen
+	std::map<std::thread::id, int> threads;
+};
@@ -31,6 +31,13 @@
 #include "exceptions.h"
 #include "modcontext.h"
 #include "parsersettings.h"
+#include "InstantiationCache.h"
+#include "FunctionCache.h"
+#include "ModuleInstantiation.h"
+#include "FileWatcher.h"
+#include "LibraryIndex.h"
+#include "feature.h"
+#include "MemoryAccounting.h"
 
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
@@ -53,6 +60,7 @@ void FileModule::registerUse(const std::string path) {
 	std::string ext = boost::algorithm::to_lower_copy(extraw);
 	
 	if ((ext == ".otf") || (ext == ".ttf")) {
+		this->usedfonts.push_back(path);
 		if (fs::is_regular(path)) {
 			FontCache::instance()->register_font_file(path);
 		} else {
@@ -67,9 +75,9 @@ void FileModule::registerInclude(const std::string &localpath,
 																 const std::string &fullpath)
 {
 	struct stat st;
-	memset(&st, 0, sizeof(struct stat));
-	bool valid = stat(fullpath.c_str(), &st) == 0;
-	IncludeFile inc = {fullpath, valid, st.st_mtime};
+	bool valid = FileWatcher::instance()->stat(fullpath, st);
+	IncludeFile inc = {fullpath, valid, st.st_mtime, ""};
+	if (valid) FileWatcher::instance()->contentHash(fullpath, inc.hash);
 	this->includes[localpath] = inc;
 }
 
@@ -84,13 +92,22 @@ bool FileModule::includesChanged() const
 bool FileModule::include_modified(const IncludeFile &inc) const
 {
 	struct stat st;
-	memset(&st, 0, sizeof(struct stat));
+
+	// Files found before are usually unchanged, so check those cheaply first
+	if (fs::path(inc.filename).is_absolute()) {
+		bool valid = FileWatcher::instance()->stat(inc.filename, st);
+		if (valid == inc.valid && (!valid || st.st_mtime == inc.mtime)) return false;
+	}
 
 	fs::path fullpath = find_valid_path(this->path, inc.filename);
-	bool valid = !fullpath.empty() ? (stat(fullpath.generic_string().c_str(), &st) == 0) : false;
+	bool valid = !fullpath.empty() ? FileWatcher::instance()->stat(fullpath.generic_string(), st) : false;
 	
 	if (valid && !inc.valid) return true; // Detect appearance of file but not removal
-	if (valid && st.st_mtime > inc.mtime) return true;
+	if (valid && st.st_mtime > inc.mtime) {
+		// Files rewritten with the same contents, e.g. by editors on save, are unchanged
+		std::string hash;
+		return inc.hash.empty() || !FileWatcher::instance()->contentHash(fullpath.generic_string(), hash) || hash != inc.hash;
+	}
 	
 	return false;
 }
@@ -106,6 +123,16 @@ bool FileModule::handleDependencies()
 
 	bool somethingchanged = false;
 	std::vector<std::pair<std::string,std::string>> updates;
+	const bool lazy = Feature::ExperimentalLazyUse.is_enabled();
+
+	// Read the libraries to compile in parallel first
+	std::vector<std::string> prefetch;
+	for(const auto &filename : this->usedlibs) {
+		if (!fs::path(filename).is_absolute()) continue;
+		if (lazy && !ModuleCache::instance()->isCached(filename)) continue;
+		prefetch.push_back(filename);
+	}
+	ModuleCache::instance()->prefetch(prefetch);
 
 	// If a lib in usedlibs was previously missing, we need to relocate it
 	// by searching the applicable paths. We can identify a previously missing module
@@ -128,7 +155,14 @@ bool FileModule::handleDependencies()
 			}
 		}
 
-		if (found) {
+		if (found && lazy && !ModuleCache::instance()->isCached(filename)) {
+			// Parsed once something in it is used, see FileContext. Until
+			// then, only changes to what it defines matter.
+			bool changed;
+			LibraryIndex::instance()->symbols(filename, &changed);
+			somethingchanged |= changed || wasmissing;
+		}
+		else if (found) {
 			bool wascached = ModuleCache::instance()->isCached(filename);
 			FileModule *oldmodule = ModuleCache::instance()->lookup(filename);
 			FileModule *newmodule;
@@ -152,6 +186,9 @@ bool FileModule::handleDependencies()
 		this->usedlibs.erase(files.first);
 		this->usedlibs.insert(files.second);
 	}
+	ModuleCache::instance()->discardPrefetched(prefetch);
+	// The assignments may call functions of the libraries which changed
+	if (somethingchanged) memoizeAssignments(AssignmentValues());
 	this->is_handling_dependencies = false;
 	return somethingchanged;
 }
@@ -159,9 +196,11 @@ bool FileModule::handleDependencies()
 AbstractNode *FileModule::instantiate(const Context *ctx, const ModuleInstantiation *inst, EvalContext *evalctx) const
 {
 	assert(evalctx == NULL);
+	MemoryAccounting::Scope memoryscope(MemoryAccounting::INSTANTIATION);
 	
 	delete this->context;
 	this->context = new FileContext(*this, ctx);
+	FunctionCache::instance()->clear();
 	AbstractNode *node = new RootNode(inst);
 
 	try {
@@ -175,6 +214,52 @@ AbstractNode *FileModule::instantiate(const Context *ctx, const ModuleInstantiat
 		PRINT(e.what());
 	}
 
+	SharedNodeMap nodes;
+	share_identical_subtrees(node, nodes);
+	return node;
+}
+
+/*!
+	Like instantiate(), but reuses subtrees from the previous instantiation
+	for top-level statements which are unchanged, see InstantiationCache.
+*/
+AbstractNode *FileModule::instantiate(const Context *ctx, const ModuleInstantiation *inst, InstantiationCache &cache) const
+{
+	MemoryAccounting::Scope memoryscope(MemoryAccounting::INSTANTIATION);
+	delete this->context;
+	this->context = new FileContext(*this, ctx);
+	FunctionCache::instance()->clear();
+	AbstractNode *node = new RootNode(inst);
+
+	try {
+		context->initializeModule(*this);
+
+		cache.begin(*this, ctx);
+		// Reused subtrees aren't shared, since the cache refers to their nodes
+		SharedNodeMap nodes;
+		for (size_t i=0;i<this->scope.children.size();i++) {
+			const ModuleInstantiation *modinst = this->scope.children[i];
+			AbstractNode *child = cache.take(modinst, i);
+			bool printed = false;
+			if (!child) {
+				// Statements printing messages are instantiated every time
+				print_messages_push();
+				child = modinst->evaluate(context);
+				printed = !print_messages_top().empty();
+				print_messages_pop();
+				if (child) share_identical_subtrees(child, nodes);
+			}
+			if (!child) continue;
+			node->children.push_back(child);
+			if (!printed) cache.store(modinst, i, child);
+		}
+		cache.end();
+	}
+	catch (EvaluationException &e) {
+		PRINT(e.what());
+		cache.end();
+	}
+
 	return node;
 }
 
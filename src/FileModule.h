@@ -4,6 +4,8 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <time.h>
+#include <vector>
+#include <mutex>
 
 #include "module.h"
 #include "value.h"
@@ -16,6 +18,7 @@ public:
 	virtual ~FileModule();
 
 	virtual AbstractNode *instantiate(const Context *ctx, const ModuleInstantiation *inst, EvalContext *evalctx = NULL) const;
+	AbstractNode *instantiate(const Context *ctx, const ModuleInstantiation *inst, class InstantiationCache &cache) const;
 	virtual std::string dump(const std::string &indent, const std::string &name) const;
 	void setModulePath(const std::string &path) { this->path = path; }
 	const std::string &modulePath() const { return this->path; }
@@ -28,16 +31,29 @@ public:
 	bool isHandlingDependencies() const { return this->is_handling_dependencies; }
 	ValuePtr lookup_variable(const std::string &name) const;
 
+	typedef shared_ptr<const std::vector<ValuePtr>> AssignmentValues;
+	// The values of scope.assignments, if memoized, see FileContext::initializeLibrary()
+	AssignmentValues memoizedAssignments() const {
+		std::lock_guard<std::mutex> lock(this->memomutex);
+		return this->memoizedvalues;
+	}
+	void memoizeAssignments(const AssignmentValues &values) const {
+		std::lock_guard<std::mutex> lock(this->memomutex);
+		this->memoizedvalues = values;
+	}
+
 	LocalScope scope;
 	typedef std::unordered_set<std::string> ModuleContainer;
 	ModuleContainer usedlibs;
 private:
+	friend class ASTCache;
 	// Reference to retain the context that was used in the last evaluation
 	mutable class FileContext *context;
 	struct IncludeFile {
 		std::string filename;
 		bool valid;
 		time_t mtime;
+		std::string hash; // Of the contents, empty if unknown
 	};
 
 	bool include_modified(const IncludeFile &inc) const;
@@ -46,4 +62,9 @@ private:
 	IncludeContainer includes;
 	bool is_handling_dependencies;
 	std::string path;
+	// Font files registered by use<>, which aren't in usedlibs
+	std::vector<std::string> usedfonts;
+	// Kept while the file and its used libraries are unchanged
+	mutable AssignmentValues memoizedvalues;
+	mutable std::mutex memomutex;
 };
@@ -0,0 +1,185 @@
+#include "FileWatcher.h"
+#include "printutils.h"
+#include "hash.h"
+
+#include <string.h>
+#include <time.h>
+#include <fstream>
+#include <boost/filesystem.hpp>
+namespace fs = boost::filesystem;
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#endif
+
+// Cached results older than this are checked again
+static const std::chrono::seconds MAX_AGE(5);
+
+FileWatcher::FileWatcher() : fd(-1)
+{
+#ifdef __linux__
+	this->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (this->fd < 0) PRINTD("inotify not available, polling for file changes");
+#endif
+}
+
+FileWatcher::~FileWatcher()
+{
+#ifdef __linux__
+	if (this->fd >= 0) close(this->fd);
+#endif
+}
+
+/*!
+	Like ::stat(), but returns a cached result if \a filename hasn't
+	changed since it was last stat()'ed. Returns false if the file doesn't
+	exist.
+*/
+bool FileWatcher::stat(const std::string &filename, struct stat &st)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	processEvents();
+
+	const auto now = std::chrono::steady_clock::now();
+	auto it = this->files.find(filename);
+	if (it != this->files.end() && now - it->second.checked < MAX_AGE) {
+		st = it->second.st;
+		return it->second.valid;
+	}
+
+	memset(&st, 0, sizeof(struct stat));
+	const bool valid = ::stat(filename.c_str(), &st) == 0;
+
+	// Relative paths depend on the working directory, so aren't cached
+	const fs::path path(filename);
+	if (path.is_absolute()) {
+		const std::string dir = path.parent_path().generic_string();
+		if (watch(dir)) {
+			Entry &entry = this->files[filename];
+			entry.valid = valid;
+			entry.st = st;
+			entry.checked = now;
+			this->dirs[dir].files.insert(filename);
+		}
+	}
+	return valid;
+}
+
+/*!
+	Returns the hash of the contents of \a filename in \a hash, reusing
+	the last one while the size and modification time match. Files
+	modified right before they were hashed are always hashed again, since
+	a later change within the timestamp resolution would go unnoticed.
+	Returns false if the file can't be read.
+*/
+bool FileWatcher::contentHash(const std::string &filename, std::string &hash)
+{
+	struct stat st;
+	if (!stat(filename, st)) return false;
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		auto it = this->hashes.find(filename);
+		if (it != this->hashes.end() && it->second.mtime == st.st_mtime && it->second.size == st.st_size &&
+				st.st_mtime < it->second.hashtime - 1) {
+			hash = it->second.hash;
+			return true;
+		}
+	}
+
+	// The file isn't read with the lock held
+	const time_t hashtime = time(NULL);
+	std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+	if (!in.is_open()) return false;
+	const std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	if (in.bad()) return false;
+	hash = hash128(data).toString();
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+	Hash &entry = this->hashes[filename];
+	entry.mtime = st.st_mtime;
+	entry.size = st.st_size;
+	entry.hashtime = hashtime;
+	entry.hash = hash;
+	return true;
+}
+
+void FileWatcher::clear()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->files.clear();
+	this->hashes.clear();
+	for(auto &dir : this->dirs) dir.second.files.clear();
+}
+
+/*!
+	Makes sure changes in \a dir are reported. Returns false if they
+	can't be.
+*/
+bool FileWatcher::watch(const std::string &dir)
+{
+	if (this->dirs.find(dir) != this->dirs.end()) return true;
+#ifdef __linux__
+	if (this->fd < 0) return false;
+	// Watch the directory rather than the file, to see files replaced by
+	// a rename, and files which don't exist yet
+	const int wd = inotify_add_watch(this->fd, dir.c_str(),
+		IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+		IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+	if (wd < 0) return false;
+	this->dirs[dir].wd = wd;
+	this->watches[wd] = dir;
+	return true;
+#else
+	return false;
+#endif
+}
+
+void FileWatcher::invalidate(const std::string &dir)
+{
+	auto it = this->dirs.find(dir);
+	if (it == this->dirs.end()) return;
+	for(const auto &filename : it->second.files) this->files.erase(filename);
+	it->second.files.clear();
+}
+
+/*!
+	Drops the cached results of files in directories with reported
+	changes.
+*/
+void FileWatcher::processEvents()
+{
+#ifdef __linux__
+	if (this->fd < 0) return;
+	char buf[4096 + sizeof(struct inotify_event) + NAME_MAX + 1]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	while ((len = read(this->fd, buf, sizeof(buf))) > 0) {
+		for (char *ptr = buf; ptr < buf + len; ) {
+			const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(ptr);
+			ptr += sizeof(struct inotify_event) + event->len;
+			if (event->mask & IN_Q_OVERFLOW) {
+				this->files.clear();
+				for(auto &dir : this->dirs) dir.second.files.clear();
+				continue;
+			}
+			auto it = this->watches.find(event->wd);
+			if (it == this->watches.end()) continue;
+			const std::string dir = it->second;
+			invalidate(dir);
+			// The watch is gone if the directory was removed
+			if (event->mask & IN_IGNORED) {
+				this->watches.erase(it);
+				this->dirs.erase(dir);
+			}
+			else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+				inotify_rm_watch(this->fd, event->wd);
+				this->watches.erase(it);
+				this->dirs.erase(dir);
+			}
+		}
+	}
+#endif
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <unordered_map>
+#include <unordered_set>
+#include <sys/stat.h>
+
+/*!
+	Caches stat() results of files, so checking many unchanged files for
+	modifications doesn't touch the filesystem each time.
+
+	A cached result is dropped when the OS reports a change in the file's
+	directory (inotify on Linux). Without change notification, files are
+	stat()'ed on each request. Since notifications aren't reliable on all
+	filesystems, e.g. for remote changes on network filesystems, cached
+	results are also checked again once they are a few seconds old.
+
+	contentHash() tells whether a file whose timestamp changed really has
+	new contents, e.g. after an editor rewrote it unchanged. The hash is
+	remembered along with the size and modification time of the file.
+*/
+class FileWatcher
+{
+public:
+	static FileWatcher *instance() { static FileWatcher *inst = new FileWatcher; return inst; }
+
+	bool stat(const std::string &filename, struct stat &st);
+	bool contentHash(const std::string &filename, std::string &hash);
+	void clear();
+
+private:
+	FileWatcher();
+	~FileWatcher();
+
+	void processEvents();
+	bool watch(const std::string &dir);
+	void invalidate(const std::string &dir);
+
+	struct Entry {
+		bool valid;
+		struct stat st;
+		std::chrono::steady_clock::time_point checked;
+	};
+	struct Directory {
+		int wd;
+		std::unordered_set<std::string> files;
+	};
+	std::mutex mutex;
+	std::unordered_map<std::string, Entry> files;
+	struct Hash {
+		time_t mtime;
+		off_t size;
+		time_t hashtime;
+		std::string hash;
+	};
+	std::unordered_map<std::string, Hash> hashes;
+	std::unordered_map<std::string, Directory> dirs;
+	std::unordered_map<int, std::string> watches;
+	int fd;
+};
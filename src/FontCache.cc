@@ -33,6 +33,7 @@
 #include "FontCache.h"
 #include "PlatformUtils.h"
 #include "parsersettings.h"
+#include "PersistentCache.h"
 
 extern std::vector<std::string> librarypath;
 
@@ -40,6 +41,23 @@ std::vector<std::string> fontpath;
 
 namespace fs = boost::filesystem;
 
+/*!
+	Returns the modification times of \a dir and the directories below it,
+	which change when fonts are added or removed.
+*/
+static std::string font_dir_state(const fs::path &dir)
+{
+	std::string state;
+	boost::system::error_code ec;
+	if (!fs::is_directory(dir, ec)) return state;
+	state += dir.generic_string() + " " + std::to_string(fs::last_write_time(dir, ec)) + "\n";
+	for (fs::recursive_directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+		if (!fs::is_directory(it->status())) continue;
+		state += it->path().generic_string() + " " + std::to_string(fs::last_write_time(it->path(), ec)) + "\n";
+	}
+	return state;
+}
+
 static bool FontInfoSortPredicate(const FontInfo& fi1, const FontInfo& fi2)
 {
 	return (fi1 < fi2);
@@ -97,6 +115,8 @@ void FontCache::defaultInitHandler(FontCacheInitializer *initializer, void *)
 FontCache::FontCache()
 {
 	this->init_ok = false;
+	this->fonts_built = false;
+	this->fontstate = "fontconfig " + std::to_string(FcGetVersion()) + "\n";
 
 	// If we've got a bundled fonts.conf, initialize fontconfig with our own config
 	// by overriding the built-in fontconfig path.
@@ -142,13 +162,13 @@ FontCache::FontCache()
 		}
 	}
 
-	FontCacheInitializer initializer(this->config);
-	cb_handler(&initializer, cb_userdata);
-
-	// For use by LibraryInfo
+	// The configured font directories, for use by LibraryInfo. Building the
+	// fonts of all of them can take long, so it's deferred to the first
+	// lookup of a font which isn't in the index of earlier lookups.
 	FcStrList *dirs = FcConfigGetFontDirs(this->config);
 	while (FcChar8 *dir = FcStrListNext(dirs)) {
 		fontpath.push_back(std::string((const char *)dir));
+		this->fontstate += font_dir_state(fontpath.back());
 	}
 	FcStrListDone(dirs);
 
@@ -183,7 +203,10 @@ void FontCache::register_font_file(const std::string &path)
 {
 	if (!FcConfigAppFontAddFile(this->config, reinterpret_cast<const FcChar8 *> (path.c_str()))) {
 		PRINTB("Can't register font '%s'", path);
+		return;
 	}
+	boost::system::error_code ec;
+	this->fontstate += path + " " + std::to_string(fs::last_write_time(path, ec)) + "\n";
 }
 
 void FontCache::add_font_dir(const std::string &path)
@@ -193,11 +216,45 @@ void FontCache::add_font_dir(const std::string &path)
 	}
 	if (!FcConfigAppFontAddDir(this->config, reinterpret_cast<const FcChar8 *> (path.c_str()))) {
 		PRINTB("Can't register font directory '%s'", path);
+		return;
+	}
+	this->fontstate += font_dir_state(path);
+}
+
+/*!
+	Builds the fonts of all font directories, once.
+*/
+void FontCache::build_fonts() const
+{
+	if (this->fonts_built) return;
+	this->fonts_built = true;
+	FontCacheInitializer initializer(this->config);
+	cb_handler(&initializer, cb_userdata);
+}
+
+/*!
+	Loads the index of font lookups made with the current font directories
+	and files from the persistent cache, if it's enabled.
+*/
+void FontCache::load_index()
+{
+	if (this->indexkey == this->fontstate) return;
+	this->indexkey = this->fontstate;
+	this->index.clear();
+	std::string data;
+	if (!PersistentCache::instance()->read(this->indexkey, "fonts", data)) return;
+	std::vector<std::string> lines;
+	boost::split(lines, data, boost::is_any_of("\n"));
+	for(const auto &line : lines) {
+		std::vector<std::string> fields;
+		boost::split(fields, line, boost::is_any_of("\t"));
+		if (fields.size() == 3) this->index[fields[0]] = std::make_pair(fields[1], atoi(fields[2].c_str()));
 	}
 }
 
 FontInfoList *FontCache::list_fonts() const
 {
+	build_fonts();
 	FcObjectSet *object_set = FcObjectSetBuild(FC_FAMILY, FC_STYLE, FC_FILE, (char *) 0);
 	FcPattern *pattern = FcPatternCreate();
 	init_pattern(pattern);
@@ -279,15 +336,34 @@ FT_Face FontCache::get_font(const std::string &font)
 	return face;
 }
 
-FT_Face FontCache::find_face(const std::string &font) const
+/*!
+	Looks up \a font in the index of earlier lookups, and only asks
+	fontconfig if it's not there, recording the result in the index.
+*/
+FT_Face FontCache::find_face(const std::string &font)
 {
 	std::string trimmed(font);
 	boost::algorithm::trim(trimmed);
 
 	const std::string lookup = trimmed.empty() ? DEFAULT_FONT : trimmed;
 	PRINTDB("font = \"%s\", lookup = \"%s\"", font % lookup);
-	FT_Face face = find_face_fontconfig(lookup);
-	PRINTDB("result = \"%s\", style = \"%s\"", face->family_name % face->style_name);
+	load_index();
+	font_index_t::const_iterator it = this->index.find(lookup);
+	if (it != this->index.end() && fs::is_regular_file(it->second.first)) {
+		if (FT_Face face = open_face(it->second.first, it->second.second)) return face;
+	}
+
+	std::string file;
+	int faceindex;
+	if (!find_file_fontconfig(lookup, file, faceindex)) return NULL;
+	FT_Face face = open_face(file, faceindex);
+	if (!face) return NULL;
+	this->index[lookup] = std::make_pair(file, faceindex);
+	std::string data;
+	for(const auto &entry : this->index) {
+		data += entry.first + "\t" + entry.second.first + "\t" + std::to_string(entry.second.second) + "\n";
+	}
+	PersistentCache::instance()->write(this->indexkey, "fonts", data);
 	return face;
 }
 
@@ -301,8 +377,10 @@ void FontCache::init_pattern(FcPattern *pattern) const
 	FcPatternAdd(pattern, FC_SCALABLE, true_value, true);
 }
 
-FT_Face FontCache::find_face_fontconfig(const std::string &font) const
+bool FontCache::find_file_fontconfig(const std::string &font, std::string &file, int &faceindex) const
 {
+	build_fonts();
+
 	FcResult result;
 
 	FcPattern *pattern = FcNameParse((unsigned char *)font.c_str());
@@ -312,22 +390,31 @@ FT_Face FontCache::find_face_fontconfig(const std::string &font) const
 	FcDefaultSubstitute(pattern);
 
 	FcPattern *match = FcFontMatch(this->config, pattern, &result);
+	FcPatternDestroy(pattern);
+	if (!match) {
+		return false;
+	}
 
 	FcValue file_value;
-	if (FcPatternGet(match, FC_FILE, 0, &file_value) != FcResultMatch) {
-		return NULL;
+	FcValue font_index;
+	const bool found = FcPatternGet(match, FC_FILE, 0, &file_value) == FcResultMatch &&
+		FcPatternGet(match, FC_INDEX, 0, &font_index) == FcResultMatch;
+	if (found) {
+		file = (const char *) file_value.u.s;
+		faceindex = font_index.u.i;
 	}
+	FcPatternDestroy(match);
+	return found;
+}
 
-	FcValue font_index;
-	if (FcPatternGet(match, FC_INDEX, 0, &font_index)) {
+FT_Face FontCache::open_face(const std::string &file, int faceindex) const
+{
+	FT_Face face;
+	FT_Error error = FT_New_Face(this->library, file.c_str(), faceindex, &face);
+	if (error) {
 		return NULL;
 	}
-	
-	FT_Face face;
-	FT_Error error = FT_New_Face(this->library, (const char *) file_value.u.s, font_index.u.i, &face);
-
-	FcPatternDestroy(pattern);
-	FcPatternDestroy(match);
+	PRINTDB("result = \"%s\", style = \"%s\"", face->family_name % face->style_name);
 
 	for (int a = 0; a < face->num_charmaps; a++) {
 		FT_CharMap charmap = face->charmaps[a];
@@ -356,7 +443,7 @@ FT_Face FontCache::find_face_fontconfig(const std::string &font) const
 			PRINTB("Warning: Could not select a char map for font %s/%s", face->family_name % face->style_name);
 	}
 	
-	return error ? NULL : face;
+	return face;
 }
 
 bool FontCache::try_charmap(FT_Face face, int platform_id, int encoding_id) const
@@ -95,6 +95,8 @@ public:
 private:
     typedef std::pair<FT_Face, time_t> cache_entry_t;
     typedef std::map<std::string, cache_entry_t> cache_t;
+    // The file and face index which fontconfig matched for a font name
+    typedef std::map<std::string, std::pair<std::string, int>> font_index_t;
 
     static FontCache *self;
     static InitHandlerFunc *cb_handler;
@@ -103,18 +105,26 @@ private:
     static void defaultInitHandler(FontCacheInitializer *delegate, void *userdata);
 
     bool init_ok;
+    mutable bool fonts_built;
     cache_t cache;
     FcConfig *config;
     FT_Library library;
+    // Font directories and files given to fontconfig, with their modification times
+    std::string fontstate;
+    font_index_t index;
+    std::string indexkey;
 
     void check_cleanup();
     void dump_cache(const std::string &info);
     
     void add_font_dir(const std::string &path);
     void init_pattern(FcPattern *pattern) const;
+    void build_fonts() const;
+    void load_index();
     
-    FT_Face find_face(const std::string &font) const;
-    FT_Face find_face_fontconfig(const std::string &font) const;
+    FT_Face find_face(const std::string &font);
+    bool find_file_fontconfig(const std::string &font, std::string &file, int &faceindex) const;
+    FT_Face open_face(const std::string &file, int faceindex) const;
     bool try_charmap(FT_Face face, int platform_id, int encoding_id) const;
 };
 
@@ -0,0 +1,235 @@
+#include "FramePrefetcher.h"
+#include <QThread>
+
+#include "openscad.h"
+#include "FileModule.h"
+#include "ModuleInstantiation.h"
+#include "InstantiationCache.h"
+#include "modcontext.h"
+#include "node.h"
+#include "Tree.h"
+#include "csgnode.h"
+#include "Geometry.h"
+#include "Session.h"
+#include "progress.h"
+#include "printutils.h"
+#include "stackcheck.h"
+#include "PlatformUtils.h"
+
+#include <initializer_list>
+#include <unordered_set>
+#include <boost/filesystem.hpp>
+
+/*!
+	Frames of the same document and steps can be reused. The camera isn't
+	compared, as the design may change it during playback.
+*/
+bool FramePrefetcher::Job::operator==(const Job &other) const
+{
+	return this->fulltext == other.fulltext && this->filename == other.filename &&
+		this->documentpath == other.documentpath && this->numsteps == other.numsteps &&
+		this->fragmentlimit == other.fragmentlimit && this->normalizelimit == other.normalizelimit;
+}
+
+/*!
+	Frames are prefetched while those waiting take at most \a budget bytes.
+*/
+FramePrefetcher::FramePrefetcher(size_t budget)
+	: firststep(0), budget(budget), cancelled(false), memsize(0)
+{
+	this->thread = new QThread();
+	// Instantiating a design recurses like on the main thread
+	this->thread->setStackSize(PlatformUtils::stackLimit() + STACK_BUFFER_SIZE);
+	connect(this->thread, SIGNAL(started()), this, SLOT(work()));
+	moveToThread(this->thread);
+}
+
+FramePrefetcher::~FramePrefetcher()
+{
+	stop();
+	delete this->thread;
+}
+
+bool FramePrefetcher::isRunning() const
+{
+	return this->thread->isRunning();
+}
+
+/*!
+	Starts prefetching the frames of \a job from \a step on, dropping the
+	frames of the previous job.
+*/
+void FramePrefetcher::start(const Job &job, int step)
+{
+	stop();
+	this->job = job;
+	this->firststep = step;
+	this->cancelled = false;
+	this->thread->start();
+}
+
+/*!
+	Stops prefetching and drops the frames not taken yet. Waits for the
+	frame being evaluated, which can't be interrupted.
+*/
+void FramePrefetcher::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->cancelled = true;
+	}
+	this->taken.notify_all();
+	this->thread->wait();
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->frames.clear();
+	this->memsize = 0;
+}
+
+/*!
+	Takes the frame of \a step if it's the next one and has been evaluated.
+*/
+bool FramePrefetcher::take(int step, Frame &frame)
+{
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (this->frames.empty() || this->frames.front().step != step) return false;
+		frame = this->frames.front();
+		this->frames.pop_front();
+		this->memsize -= frame.memsize;
+	}
+	this->taken.notify_all();
+	return true;
+}
+
+void FramePrefetcher::collect(const std::string &msg, void *userdata)
+{
+	// Called with the session's output locked
+	static_cast<FramePrefetcher *>(userdata)->messages.push_back(msg);
+}
+
+// The bytes kept by the geometry of the products, counting each geometry once
+static size_t products_memsize(const shared_ptr<CSGProducts> &products, std::unordered_set<const Geometry *> &counted)
+{
+	if (!products) return 0;
+	size_t memsize = sizeof(CSGProducts);
+	for(const auto &product : products->products) {
+		for(const auto &objects : { &product.intersections, &product.subtractions }) {
+			for(const auto &object : *objects) {
+				memsize += sizeof(CSGChainObject) + sizeof(CSGLeaf);
+				const Geometry *geom = object.leaf->geom.get();
+				if (geom && counted.insert(geom).second) memsize += geom->memsize();
+			}
+		}
+	}
+	return memsize;
+}
+
+/*!
+	Evaluates \a frame.step like the GUI evaluates a preview, but in its
+	own context \a top_ctx.
+*/
+void FramePrefetcher::evaluate(ModuleContext &top_ctx, FileModule *module, InstantiationCache &instcache,
+															 Tree &tree, AbstractNode *&absolute_root_node, Frame &frame)
+{
+	top_ctx.set_variable("$t", ValuePtr(double(frame.step) / this->job.numsteps));
+	if (absolute_root_node) instcache.detach(*absolute_root_node);
+	delete absolute_root_node;
+	absolute_root_node = NULL;
+	tree.setRoot(NULL);
+	if (!module) {
+		PRINT("ERROR: Compilation failed!");
+		return;
+	}
+
+	PRINT("Compiling design (CSG Tree generation)...");
+	AbstractNode::resetIndexCounter();
+	ModuleInstantiation root_inst("group");
+	absolute_root_node = module->instantiate(&top_ctx, &root_inst, instcache);
+	frame.vpt = module->lookup_variable("$vpt");
+	frame.vpr = module->lookup_variable("$vpr");
+	frame.vpd = module->lookup_variable("$vpd");
+	if (!absolute_root_node) {
+		PRINT("ERROR: Compilation failed! (no top level object found)");
+		return;
+	}
+
+	AbstractNode *root_node = find_root_tag(absolute_root_node);
+	if (!root_node) root_node = absolute_root_node;
+	tree.setRoot(root_node);
+	instcache.restoreIds(tree);
+	tree.getIdString(*root_node);
+	instcache.saveIds(tree);
+	frame.compiled = true;
+
+	PRINT("Compiling design (CSG Products generation)...");
+	frame.result = CSGWorker::build(tree, this->job.fragmentlimit, this->job.normalizelimit, this->cancelled);
+
+	std::unordered_set<const Geometry *> counted;
+	frame.memsize = sizeof(Frame) +
+		products_memsize(frame.result.root_products, counted) +
+		products_memsize(frame.result.highlights_products, counted) +
+		products_memsize(frame.result.background_products, counted);
+}
+
+void FramePrefetcher::work()
+{
+	StackCheck::inst()->init();
+	Session session(&FramePrefetcher::collect, this);
+	Session::Scope scope(&session);
+
+	// Outlives the module, which keeps a context below it
+	ModuleContext top_ctx;
+	top_ctx.registerBuiltin();
+	top_ctx.setDocumentPath(this->job.documentpath);
+	top_ctx.set_variable("$vpt", this->job.vpt);
+	top_ctx.set_variable("$vpr", this->job.vpr);
+	top_ctx.set_variable("$vpd", this->job.vpd);
+
+	PRINT("Parsing design (AST generation)...");
+	FileModule *module = parse(this->job.fulltext.c_str(), boost::filesystem::path(this->job.filename), false);
+	if (module) module->handleDependencies();
+	std::vector<std::string> parsemessages;
+	parsemessages.swap(this->messages);
+
+	InstantiationCache instcache;
+	Tree tree;
+	AbstractNode *absolute_root_node = NULL;
+	// At most one frame of each step waits, so the window stays bounded
+	// for designs without geometry too
+	for (int i = 0; !this->cancelled; i++) {
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->taken.wait(lock, [this]() {
+					return this->cancelled || this->frames.empty() ||
+						(this->memsize <= this->budget && int(this->frames.size()) < this->job.numsteps);
+				});
+			if (this->cancelled) break;
+		}
+
+		Frame frame;
+		frame.step = (this->firststep + i) % this->job.numsteps;
+		frame.messages = parsemessages;
+		try {
+			evaluate(top_ctx, module, instcache, tree, absolute_root_node, frame);
+		}
+		catch (const ProgressCancelException &e) {
+			this->cancelled = true;
+		}
+		frame.messages.insert(frame.messages.end(), this->messages.begin(), this->messages.end());
+		this->messages.clear();
+		if (this->cancelled) break;
+
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->memsize += frame.memsize;
+		this->frames.push_back(frame);
+	}
+
+	tree.setRoot(NULL);
+	if (absolute_root_node) instcache.detach(*absolute_root_node);
+	delete absolute_root_node;
+	instcache.clear();
+	delete module;
+	this->messages.clear();
+	thread->quit();
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <QObject>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "csgworker.h"
+#include "value.h"
+
+/*!
+	Evaluates the frames of an animation ahead of playback in a separate
+	thread, so frames which take longer than the frame interval don't make
+	the playback stutter.
+
+	From the step it's started at, the frames are prefetched in playback
+	order, each with its CSG products, the camera set by the design and
+	the messages printed while evaluating it. Prefetching pauses while the
+	frames waiting to be shown take more than the memory budget, and
+	resumes as the GUI takes them with take().
+
+	The document is parsed once in the thread, in a Session of its own, and
+	subtrees which don't depend on $t are reused between frames. Like the
+	CSG worker, nothing else may evaluate geometry while it's running.
+*/
+class FramePrefetcher : public QObject
+{
+	Q_OBJECT;
+public:
+	// What's read from the GUI for evaluating the frames
+	struct Job {
+		Job() : numsteps(0), fragmentlimit(0), normalizelimit(0) {}
+		bool operator==(const Job &other) const;
+		bool operator!=(const Job &other) const { return !(*this == other); }
+
+		std::string fulltext;
+		std::string filename;
+		std::string documentpath;
+		ValuePtr vpt, vpr, vpd; // The camera when playback started
+		int numsteps;
+		int fragmentlimit;
+		size_t normalizelimit;
+	};
+
+	struct Frame {
+		Frame() : step(-1), compiled(false), memsize(0) {}
+
+		int step;
+		CSGWorker::Result result;
+		bool compiled; // The design had a top level object
+		ValuePtr vpt, vpr, vpd; // The camera set by the design
+		std::vector<std::string> messages;
+		size_t memsize; // Estimated bytes kept by the products
+	};
+
+	FramePrefetcher(size_t budget);
+	virtual ~FramePrefetcher();
+
+	void start(const Job &job, int step);
+	void stop();
+	bool isRunning() const;
+	const Job &currentJob() const { return this->job; }
+	bool take(int step, Frame &frame);
+
+protected slots:
+	void work();
+
+private:
+	static void collect(const std::string &msg, void *userdata);
+	void evaluate(class ModuleContext &top_ctx, class FileModule *module, class InstantiationCache &instcache,
+								class Tree &tree, class AbstractNode *&absolute_root_node, Frame &frame);
+
+	class QThread *thread;
+	Job job;
+	int firststep;
+	size_t budget;
+	std::atomic<bool> cancelled;
+
+	// Guards the frames, which the thread fills and the GUI takes
+	std::mutex mutex;
+	std::condition_variable taken;
+	std::deque<Frame> frames;
+	size_t memsize;
+	std::vector<std::string> messages; // Of the frame being evaluated
+};
@@ -37,9 +37,15 @@
 #include "FontCache.h"
 #include "DrawingCallback.h"
 #include "FreetypeRenderer.h"
+#include "cache.h"
 
 #include FT_OUTLINE_H
 
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <tuple>
+
 #define SCRIPT_UNTAG(tag)   ((uint8_t)((tag)>>24)) % ((uint8_t)((tag)>>16)) % ((uint8_t)((tag)>>8)) % ((uint8_t)(tag))
 
 static inline Vector2d get_scaled_vector(const FT_Vector *ft_vector, double scale) {
@@ -193,28 +199,71 @@ void FreetypeRenderer::detect_properties(FreetypeRenderer::Params &params) const
 	params.set_direction(hb_direction_to_string(direction));
 }
 
-std::vector<const Geometry *> FreetypeRenderer::render(const FreetypeRenderer::Params &params) const
+/*!
+	Returns the outlines of the given glyph of the current font face, which
+	must already be set to the size in params. Outlines are decomposed once
+	per font, glyph, size and number of segments, and shared by all text
+	using them. Returns NULL if the glyph can't be loaded.
+*/
+shared_ptr<const FreetypeRenderer::GlyphOutlines> FreetypeRenderer::get_glyph(FT_Face face, const FreetypeRenderer::Params &params, FT_UInt glyph_index) const
 {
-	FT_Face face;
-	FT_Error error;
-	DrawingCallback callback(params.segments);
-	
-	FontCache *cache = FontCache::instance();
-	if (!cache->is_init_ok()) {
-		return std::vector<const Geometry *>();
+	typedef std::tuple<std::string, FT_UInt, double, double> GlyphKey;
+	static std::mutex mutex;
+	static std::map<GlyphKey, shared_ptr<const GlyphOutlines>> glyphs;
+
+	const GlyphKey key(params.font, glyph_index, params.size, params.segments);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = glyphs.find(key);
+		if (it != glyphs.end()) return it->second;
 	}
 
-	face = cache->get_font(params.font);
-	if (face == NULL) {
-		return std::vector<const Geometry *>();
+	if (FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT)) return shared_ptr<const GlyphOutlines>();
+	FT_Glyph ft_glyph;
+	if (FT_Get_Glyph(face->glyph, &ft_glyph)) return shared_ptr<const GlyphOutlines>();
+
+	GlyphOutlines *glyph = new GlyphOutlines;
+	FT_Glyph_Get_CBox(ft_glyph, FT_GLYPH_BBOX_GRIDFIT, &glyph->bbox);
+
+	DrawingCallback callback(params.segments);
+	callback.start_glyph();
+	FT_Outline outline = reinterpret_cast<FT_OutlineGlyph>(ft_glyph)->outline;
+	FT_Outline_Decompose(&outline, &funcs, &callback);
+	callback.finish_glyph();
+	for(const auto &g : callback.get_result()) {
+		const Polygon2d *polygon = static_cast<const Polygon2d *>(g);
+		glyph->outlines.insert(glyph->outlines.end(), polygon->outlines().begin(), polygon->outlines().end());
+		delete polygon;
 	}
-	
-	error = FT_Set_Char_Size(face, 0, params.size * scale, 100, 100);
-	if (error) {
-		PRINTB("Can't set font size for font %s", params.font);
-		return std::vector<const Geometry *>();
+	FT_Done_Glyph(ft_glyph);
+
+	shared_ptr<const GlyphOutlines> result(glyph);
+	std::lock_guard<std::mutex> lock(mutex);
+	glyphs.insert(std::make_pair(key, result));
+	return result;
+}
+
+/*!
+	Shapes the text in params using the current font face, which must
+	already be set to the size in params. Shaped runs are cached by text,
+	font, size, direction, script and language under a small memory budget,
+	so repeated strings are only shaped once.
+*/
+shared_ptr<const FreetypeRenderer::ShapedRun> FreetypeRenderer::shape(FT_Face face, const FreetypeRenderer::Params &params) const
+{
+	static std::mutex mutex;
+	static Cache<std::string, shared_ptr<const ShapedRun>> runs(4*1024*1024);
+
+	std::ostringstream stream;
+	stream.precision(17);
+	stream << params.size << '\0' << params.font << '\0' << params.direction << '\0'
+		<< params.script << '\0' << params.language << '\0' << params.text;
+	const std::string key = stream.str();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (shared_ptr<const ShapedRun> *run = runs[key]) return *run;
 	}
-	
+
 	hb_font_t *hb_ft_font = hb_ft_font_create(face, NULL);
 
 	hb_buffer_t *hb_buf = hb_buffer_create();
@@ -248,26 +297,60 @@ std::vector<const Geometry *> FreetypeRenderer::render(const FreetypeRenderer::P
 		hb_buffer_add_utf8(hb_buf, params.text.c_str(), strlen(params.text.c_str()), 0, strlen(params.text.c_str()));
 	}
 	hb_shape(hb_ft_font, hb_buf, NULL, 0);
-	
+
 	unsigned int glyph_count;
-        hb_glyph_info_t *glyph_info = hb_buffer_get_glyph_infos(hb_buf, &glyph_count);
-        hb_glyph_position_t *glyph_pos = hb_buffer_get_glyph_positions(hb_buf, &glyph_count);
+	hb_glyph_info_t *glyph_info = hb_buffer_get_glyph_infos(hb_buf, &glyph_count);
+	hb_glyph_position_t *glyph_pos = hb_buffer_get_glyph_positions(hb_buf, &glyph_count);
+	ShapedRun *run = new ShapedRun;
+	run->direction = hb_buffer_get_direction(hb_buf);
+	run->info.assign(glyph_info, glyph_info + glyph_count);
+	run->pos.assign(glyph_pos, glyph_pos + glyph_count);
+
+	hb_buffer_destroy(hb_buf);
+	hb_font_destroy(hb_ft_font);
+
+	const size_t cost = key.size() + sizeof(ShapedRun) + glyph_count * (sizeof(hb_glyph_info_t) + sizeof(hb_glyph_position_t));
+	shared_ptr<const ShapedRun> result(run);
+	std::lock_guard<std::mutex> lock(mutex);
+	runs.insert(key, new shared_ptr<const ShapedRun>(result), cost);
+	return result;
+}
+
+std::vector<const Geometry *> FreetypeRenderer::render(const FreetypeRenderer::Params &params) const
+{
+	FT_Face face;
+	FT_Error error;
+	DrawingCallback callback(params.segments);
+	
+	FontCache *cache = FontCache::instance();
+	if (!cache->is_init_ok()) {
+		return std::vector<const Geometry *>();
+	}
+
+	face = cache->get_font(params.font);
+	if (face == NULL) {
+		return std::vector<const Geometry *>();
+	}
+	
+	error = FT_Set_Char_Size(face, 0, params.size * scale, 100, 100);
+	if (error) {
+		PRINTB("Can't set font size for font %s", params.font);
+		return std::vector<const Geometry *>();
+	}
+	
+	shared_ptr<const ShapedRun> run = shape(face, params);
+	const unsigned int glyph_count = run->info.size();
+	const hb_glyph_info_t *glyph_info = run->info.data();
+	hb_glyph_position_t *glyph_pos = const_cast<hb_glyph_position_t *>(run->pos.data());
 
 	GlyphArray glyph_array;
 	for (unsigned int idx = 0;idx < glyph_count;idx++) {
 		FT_UInt glyph_index = glyph_info[idx].codepoint;
-		error = FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT);
-		if (error) {
+		shared_ptr<const GlyphOutlines> glyph = get_glyph(face, params, glyph_index);
+		if (!glyph) {
 			PRINTB("Could not load glyph %u for char at index %u in text '%s'", glyph_index % idx % params.text);
 			continue;
 		}
-
-		FT_Glyph glyph;
-		error = FT_Get_Glyph(face->glyph, &glyph);
-		if (error) {
-			PRINTB("Could not get glyph %u for char at index %u in text '%s'", glyph_index % idx % params.text);
-			continue;
-		}
 		const GlyphData *glyph_data = new GlyphData(glyph, idx, &glyph_pos[idx]);
 		glyph_array.push_back(glyph_data);
 	}
@@ -276,10 +359,9 @@ std::vector<const Geometry *> FreetypeRenderer::render(const FreetypeRenderer::P
 	for (GlyphArray::iterator it = glyph_array.begin();it != glyph_array.end();it++) {
 		const GlyphData *glyph = (*it);
 		
-		FT_BBox bbox;
-		FT_Glyph_Get_CBox(glyph->get_glyph(), FT_GLYPH_BBOX_GRIDFIT, &bbox);
+		const FT_BBox &bbox = glyph->get_glyph().bbox;
 		
-		if (HB_DIRECTION_IS_HORIZONTAL(hb_buffer_get_direction(hb_buf))) {
+		if (HB_DIRECTION_IS_HORIZONTAL(run->direction)) {
 			double asc = std::max(0.0, bbox.yMax / 64.0 / 16.0);
 			double desc = std::max(0.0, -bbox.yMin / 64.0 / 16.0);
 			width += glyph->get_x_advance() * params.spacing;
@@ -300,8 +382,7 @@ std::vector<const Geometry *> FreetypeRenderer::render(const FreetypeRenderer::P
 		
 		callback.start_glyph();
 		callback.set_glyph_offset(x_offset + glyph->get_x_offset(), y_offset + glyph->get_y_offset());
-		FT_Outline outline = reinterpret_cast<FT_OutlineGlyph>(glyph->get_glyph())->outline;
-		FT_Outline_Decompose(&outline, &funcs, &callback);
+		callback.add_outlines(glyph->get_glyph().outlines);
 
 		double adv_x  = glyph->get_x_advance() * params.spacing;
 		double adv_y  = glyph->get_y_advance() * params.spacing;
@@ -309,8 +390,5 @@ std::vector<const Geometry *> FreetypeRenderer::render(const FreetypeRenderer::P
 		callback.finish_glyph();
 	}
 
-	hb_buffer_destroy(hb_buf);
-        hb_font_destroy(hb_ft_font);
-	
 	return callback.get_result();
 }
@@ -29,6 +29,9 @@
 #include <vector>
 #include <ostream>
 
+#include "memory.h"
+#include "Polygon2d.h"
+
 #include <hb.h>
 #include <ft2build.h>
 #include FT_FREETYPE_H
@@ -108,24 +111,37 @@ private:
 	  const static double scale;
     FT_Outline_Funcs funcs;
     
+    // A glyph's outlines in glyph coordinates and its grid fitted bounding box.
+    // These only depend on font, glyph, size and segments, and are cached.
+    struct GlyphOutlines {
+        FT_BBox bbox;
+        std::vector<Outline2d> outlines;
+    };
+
+    // The result of shaping a text with HarfBuzz
+    struct ShapedRun {
+        hb_direction_t direction;
+        std::vector<hb_glyph_info_t> info;
+        std::vector<hb_glyph_position_t> pos;
+    };
+
     class GlyphData {
     public:
-        GlyphData(FT_Glyph glyph, unsigned int idx, hb_glyph_position_t *glyph_pos) : glyph(glyph), idx(idx), glyph_pos(glyph_pos) {}
+        GlyphData(const shared_ptr<const GlyphOutlines> &glyph, unsigned int idx, hb_glyph_position_t *glyph_pos) : glyph(glyph), idx(idx), glyph_pos(glyph_pos) {}
         unsigned int get_idx() const { return idx; };
-        FT_Glyph get_glyph() const { return glyph; };
+        const GlyphOutlines &get_glyph() const { return *glyph; };
         double get_x_offset() const { return glyph_pos->x_offset / 64.0 / 16.0; };
         double get_y_offset() const { return glyph_pos->y_offset / 64.0 / 16.0; };
         double get_x_advance() const { return glyph_pos->x_advance / 64.0 / 16.0; };
         double get_y_advance() const { return glyph_pos->y_advance / 64.0 / 16.0; };
     private:
-        FT_Glyph glyph;
+        shared_ptr<const GlyphOutlines> glyph;
         unsigned int idx;
         hb_glyph_position_t *glyph_pos;
     };
 
     struct done_glyph : public std::unary_function<const GlyphData *, void> {
         void operator() (const GlyphData *glyph_data) {
-            FT_Done_Glyph(glyph_data->get_glyph());
             delete glyph_data;
         }
     };
@@ -137,6 +153,8 @@ private:
         }
     };
 
+    shared_ptr<const ShapedRun> shape(FT_Face face, const FreetypeRenderer::Params &params) const;
+    shared_ptr<const GlyphOutlines> get_glyph(FT_Face face, const FreetypeRenderer::Params &params, FT_UInt glyph_index) const;
     bool is_ignored_script(const hb_script_t script) const;
     hb_script_t get_script(const FreetypeRenderer::Params &params, hb_glyph_info_t *glyph_info, unsigned int glyph_count) const;
     hb_direction_t get_direction(const FreetypeRenderer::Params &params, const hb_script_t script) const;
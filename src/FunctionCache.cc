@@ -0,0 +1,140 @@
+#include "FunctionCache.h"
+#include "context.h"
+#include "printutils.h"
+#include "Session.h"
+
+#include <map>
+#include <cstring>
+
+// Number of volatile builtin calls made by this thread
+static thread_local unsigned int volatile_calls = 0;
+
+void FunctionCache::markVolatile()
+{
+	volatile_calls++;
+}
+
+unsigned int FunctionCache::volatileCalls()
+{
+	return volatile_calls;
+}
+
+/*!
+	Appends an exact binary encoding of \a value to \a out. Numbers are
+	compared bitwise, so e.g. 0 and -0 get different keys.
+*/
+static void serialize(const Value &value, std::string &out)
+{
+	out.push_back(char(value.type()));
+	switch (value.type()) {
+	case Value::BOOL:
+		out.push_back(value.toBool() ? 1 : 0);
+		break;
+	case Value::NUMBER: {
+		double d = value.toDouble();
+		out.append(reinterpret_cast<const char *>(&d), sizeof(d));
+		break;
+	}
+	case Value::STRING: {
+		const std::string s = value.toString();
+		size_t n = s.size();
+		out.append(reinterpret_cast<const char *>(&n), sizeof(n));
+		out.append(s);
+		break;
+	}
+	case Value::VECTOR: {
+		const Value::VectorType &vec = value.toVector();
+		size_t n = vec.size();
+		out.append(reinterpret_cast<const char *>(&n), sizeof(n));
+		for(const auto &v : vec) serialize(*v, out);
+		break;
+	}
+	case Value::RANGE: {
+		RangeType range = value.toRange();
+		double d[3] = { range.begin_value(), range.step_value(), range.end_value() };
+		out.append(reinterpret_cast<const char *>(d), sizeof(d));
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+/*!
+	Returns the cache of the current Session, or the process-wide cache.
+*/
+FunctionCache *FunctionCache::instance()
+{
+	Session *session = Session::current();
+	if (session) return &session->functionCache();
+	static FunctionCache *inst = new FunctionCache;
+	return inst;
+}
+
+/*!
+	Returns the result of \a function evaluated in \a ctx, calling
+	\a evaluate if it isn't cached. \a function is a unique id of the
+	function definition.
+*/
+ValuePtr FunctionCache::evaluate(size_t function, const Context &ctx, const Evaluator &evaluate)
+{
+	std::map<std::string, ValuePtr> bindings;
+	ctx.getBindings(bindings);
+
+	std::string key(reinterpret_cast<const char *>(&function), sizeof(function));
+	for(const auto &binding : bindings) {
+		key.append(binding.first);
+		key.push_back('\0');
+		serialize(*binding.second, key);
+	}
+
+	ValuePtr result;
+	bool readsconfig = false;
+	if (this->cache.access(key, [&result, &readsconfig](const Result &cached) {
+				result = cached.value;
+				readsconfig = cached.readsconfig;
+			})) {
+		this->hits++;
+		// The result still depends on the config variables for the caller
+		if (readsconfig) Context::countConfigLookup();
+		return result;
+	}
+
+	this->misses++;
+	const unsigned int calls = volatile_calls;
+	const unsigned int lookups = Context::configLookups();
+	// Evaluations printing messages aren't stored, so the messages repeat
+	print_messages_push();
+	try {
+		result = evaluate();
+	}
+	catch (...) {
+		print_messages_pop();
+		throw;
+	}
+	const bool printed = !print_messages_top().empty();
+	print_messages_pop();
+	if (!printed && volatile_calls == calls) {
+		std::string value;
+		serialize(*result, value);
+		Result *cached = new Result;
+		cached->value = result;
+		cached->readsconfig = Context::configLookups() != lookups;
+		this->cache.insert(key, cached, key.size() + value.size());
+	}
+	return result;
+}
+
+CacheStats FunctionCache::stats() const
+{
+	CacheStats st = this->cache.stats();
+	st.hits = this->hits;
+	st.misses = this->misses;
+	return st;
+}
+
+void FunctionCache::print()
+{
+	PRINTB("Function results in cache: %d", this->cache.size());
+	PRINTB("Function cache size in bytes: %d", this->cache.totalCost());
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <functional>
+#include "cache.h"
+#include "value.h"
+
+/*!
+	Cache of user-defined function results, keyed by the function and the
+	exact values of everything its body can see: its local variables and
+	the config variables ($fn etc.) visible through the call stack.
+
+	Only used with the function-memo feature enabled. Results which
+	depend on more than the arguments, i.e. evaluations which reach an
+	unseeded rands() or similar builtin, are never stored, and neither are
+	evaluations which print messages. The cache is cleared whenever a
+	design is instantiated.
+*/
+class FunctionCache
+{
+public:
+	FunctionCache(size_t memorylimit = 16*1024*1024) : cache(memorylimit), hits(0), misses(0) {}
+
+	static FunctionCache *instance();
+
+	typedef std::function<ValuePtr()> Evaluator;
+	ValuePtr evaluate(size_t function, const class Context &ctx, const Evaluator &evaluate);
+
+	// Called by builtins whose results don't only depend on their arguments
+	static void markVolatile();
+	// Number of such calls made by this thread so far
+	static unsigned int volatileCalls();
+
+	size_t maxSize() const { return this->cache.maxCost(); }
+	void setMaxSize(size_t limit) { this->cache.setMaxCost(limit); }
+	void clear() { this->cache.clear(); }
+	CacheStats stats() const;
+	void print();
+
+private:
+	struct Result {
+		ValuePtr value;
+		bool readsconfig; // Looked up config variables
+	};
+	ShardedCache<std::string, Result> cache;
+	std::atomic<size_t> hits;
+	std::atomic<size_t> misses;
+};
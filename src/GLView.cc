@@ -26,6 +26,11 @@ GLView::GLView()
   showaxes = false;
   showcrosshairs = false;
   showscale = false;
+  interactive = false;
+  axeslist = 0;
+  axeszoom = 0;
+  axesdpi = 0;
+  axesscale = false;
   renderer = NULL;
   colorscheme = &ColorMap::inst()->defaultColorScheme();
   cam = Camera();
@@ -169,9 +174,7 @@ void GLView::paintGL()
     if (showcrosshairs) GLView::showCrosshairs();
     glTranslated(cam.object_trans.x(), cam.object_trans.y(), cam.object_trans.z());
     // ...the axis lines need to follow the object translation.
-    if (showaxes) GLView::showAxes(axescolor);
-    // mark the scale along the axis lines
-    if (showaxes && showscale) GLView::showScalemarkers(axescolor);
+    if (showaxes) GLView::showCachedAxes(axescolor);
   }
 
   glEnable(GL_LIGHTING);
@@ -186,6 +189,7 @@ void GLView::paintGL()
     // FIXME: This belongs in the OpenCSG renderer, but it doesn't know about this ID yet
     OpenCSG::setContext(this->opencsg_id);
 #endif
+    this->renderer->setInteractive(this->interactive);
     this->renderer->draw(showfaces, showedges);
   }
 
@@ -344,6 +348,8 @@ void GLView::enable_opencsg_shaders()
 
 void GLView::initializeGL()
 {
+  // Display lists belong to the context, which is new
+  axeslist = 0;
   glEnable(GL_DEPTH_TEST);
   glDepthRange(-far_far_away, +far_far_away);
 
@@ -456,6 +462,30 @@ void GLView::showSmallaxes(const Color4f &col)
   glEnd();
 }
 
+/*!
+	Draws the axes, and the scale markers if enabled, from a display list.
+	They only depend on the zoom, so the list is reused while the view is
+	rotated or panned.
+*/
+void GLView::showCachedAxes(const Color4f &col)
+{
+  const double l = cam.zoomValue();
+  const float dpi = this->getDPI();
+  if (!axeslist || l != axeszoom || col != axeslistcolor || dpi != axesdpi || showscale != axesscale) {
+    if (!axeslist) axeslist = glGenLists(1);
+    glNewList(axeslist, GL_COMPILE);
+    showAxes(col);
+    // mark the scale along the axis lines
+    if (showscale) showScalemarkers(col);
+    glEndList();
+    axeszoom = l;
+    axeslistcolor = col;
+    axesdpi = dpi;
+    axesscale = showscale;
+  }
+  glCallList(axeslist);
+}
+
 void GLView::showAxes(const Color4f &col)
 {
   double l = cam.zoomValue();
@@ -60,6 +60,7 @@ public:
 	bool showedges;
 	bool showcrosshairs;
 	bool showscale;
+	bool interactive; // Set while the camera moves
 
 #ifdef ENABLE_OPENCSG
 	GLint shaderinfo[11];
@@ -72,8 +73,16 @@ public:
 #endif
 private:
 	void showCrosshairs();
+	void showCachedAxes(const Color4f &col);
 	void showAxes(const Color4f &col);
 	void showSmallaxes(const Color4f &col);
 	void showScalemarkers(const Color4f &col);
 	void decodeMarkerValue(double i, double l, int size_div_sm);
+
+	// Display list of the axes and scale markers, and what it was made for
+	GLuint axeslist;
+	double axeszoom;
+	Color4f axeslistcolor;
+	float axesdpi;
+	bool axesscale;
 };
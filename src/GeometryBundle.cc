@@ -0,0 +1,186 @@
+#include "GeometryBundle.h"
+#include "GeometrySerializer.h"
+#include "Geometry.h"
+#include "polyset.h"
+#include "Polygon2d.h"
+#include "printutils.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+using GeometrySerializer::Writer;
+using GeometrySerializer::Reader;
+
+/*
+	A bundle is "SCADBNDL", its version and the number of objects, then the
+	index of the objects sorted by key, then the objects. Each object is
+	its id followed by the serialized geometry.
+*/
+static const char MAGIC[8] = { 'S', 'C', 'A', 'D', 'B', 'N', 'D', 'L' };
+static const uint32_t VERSION = 1;
+static const size_t HEADER_SIZE = 8 + 4 + 8;
+static const size_t INDEX_ENTRY_SIZE = 8 + 8 + 4 + 8 + 8;
+
+/*!
+	Reads the index of the bundle. Returns false if it isn't a bundle.
+*/
+bool GeometryBundle::open()
+{
+	std::ifstream in(this->filename.c_str(), std::ios::in | std::ios::binary);
+	if (!in) return false;
+	in.seekg(0, std::ios::end);
+	const uint64_t filesize = uint64_t(in.tellg());
+	in.seekg(0);
+
+	char header[HEADER_SIZE];
+	if (!in.read(header, HEADER_SIZE) || memcmp(header, MAGIC, sizeof(MAGIC)) != 0) return false;
+	Reader h(header + sizeof(MAGIC), HEADER_SIZE - sizeof(MAGIC));
+	if (h.u32() != VERSION) return false;
+	const uint64_t count = h.u64();
+	if (count > (filesize - HEADER_SIZE) / INDEX_ENTRY_SIZE) return false;
+
+	std::string data(count * INDEX_ENTRY_SIZE, '\0');
+	if (count > 0 && !in.read(&data[0], data.size())) return false;
+	Reader r(data.data(), data.size());
+	this->index.resize(count);
+	for (auto &entry : this->index) {
+		entry.h1 = r.u64();
+		entry.h2 = r.u64();
+		entry.nef = r.u32();
+		entry.offset = r.u64();
+		entry.size = r.u64();
+		if (entry.offset > filesize || entry.size > filesize - entry.offset) return false;
+	}
+	std::sort(this->index.begin(), this->index.end());
+	return r.good();
+}
+
+/*!
+	Reads the serialized geometry of the subtree \a id, the Nef polyhedron
+	if \a nef, from the bundle.
+*/
+bool GeometryBundle::read(const std::string &id, bool nef, std::string &data) const
+{
+	const Hash128 hash = hash128(id);
+	IndexEntry key;
+	key.h1 = hash.h1;
+	key.h2 = hash.h2;
+	key.nef = nef;
+	const auto range = std::equal_range(this->index.begin(), this->index.end(), key);
+	for (auto it = range.first; it != range.second; ++it) {
+		std::ifstream in(this->filename.c_str(), std::ios::in | std::ios::binary);
+		std::string object(it->size, '\0');
+		if (!in.seekg(it->offset) || (it->size > 0 && !in.read(&object[0], object.size()))) return false;
+		Reader r(object.data(), object.size());
+		const uint64_t idsize = r.u64();
+		if (!r.has(idsize, 1) || object.compare(8, idsize, id) != 0 || idsize != id.size()) continue;
+		data = object.substr(8 + idsize);
+		return true;
+	}
+	return false;
+}
+
+/*!
+	Writes the \a objects to the bundle \a filename. Objects which can't be
+	serialized are left out.
+*/
+bool GeometryBundle::write(const std::string &filename, const std::vector<Object> &objects)
+{
+	std::vector<IndexEntry> index;
+	std::vector<std::string> blobs;
+	for (const auto &object : objects) {
+		std::string geometry;
+		if (!object.geom || !GeometrySerializer::write(*object.geom, geometry)) continue;
+		std::string blob;
+		Writer w(blob);
+		w.u64(object.id.size());
+		w.bytes(object.id.data(), object.id.size());
+		w.bytes(geometry.data(), geometry.size());
+		const Hash128 hash = hash128(object.id);
+		IndexEntry entry;
+		entry.h1 = hash.h1;
+		entry.h2 = hash.h2;
+		entry.nef = !dynamic_cast<const PolySet *>(object.geom.get()) && !dynamic_cast<const Polygon2d *>(object.geom.get());
+		entry.size = blob.size();
+		entry.offset = 0;
+		index.push_back(entry);
+		blobs.push_back(std::move(blob));
+	}
+
+	std::string head(MAGIC, sizeof(MAGIC));
+	Writer w(head);
+	w.u32(VERSION);
+	w.u64(index.size());
+	uint64_t offset = HEADER_SIZE + index.size() * INDEX_ENTRY_SIZE;
+	for (auto &entry : index) {
+		entry.offset = offset;
+		offset += entry.size;
+		w.u64(entry.h1);
+		w.u64(entry.h2);
+		w.u32(entry.nef);
+		w.u64(entry.offset);
+		w.u64(entry.size);
+	}
+
+	std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary);
+	out.write(head.data(), head.size());
+	for (const auto &blob : blobs) out.write(blob.data(), blob.size());
+	out.close();
+	if (!out) {
+		PRINTB("ERROR: Can't write geometry bundle \"%s\"", filename);
+		return false;
+	}
+	PRINTB("Wrote %d objects to geometry bundle \"%s\"", index.size() % filename);
+	return true;
+}
+
+/*!
+	Loads the bundle next to \a libraryfile, if there is one, and keeps it
+	for lookups. A bundle which changed is loaded again.
+*/
+void GeometryBundles::loadForLibrary(const std::string &libraryfile)
+{
+	const std::string filename = fs::path(libraryfile).replace_extension(".scadbundle").string();
+	boost::system::error_code ec;
+	const time_t mtime = fs::last_write_time(filename, ec);
+	std::lock_guard<std::mutex> lock(this->mutex);
+	if (ec) {
+		this->bundles.erase(filename);
+		return;
+	}
+	auto it = this->bundles.find(filename);
+	if (it != this->bundles.end() && it->second.mtime == mtime) return;
+
+	shared_ptr<GeometryBundle> bundle(new GeometryBundle(filename));
+	if (!bundle->open()) {
+		PRINTB("WARNING: Ignoring invalid geometry bundle \"%s\"", filename);
+		this->bundles.erase(filename);
+		return;
+	}
+	PRINTDB("Loaded geometry bundle %s with %d objects", filename % bundle->size());
+	Loaded &loaded = this->bundles[filename];
+	loaded.mtime = mtime;
+	loaded.bundle = bundle;
+}
+
+/*!
+	Reads the serialized geometry of the subtree \a id from any loaded
+	bundle.
+*/
+bool GeometryBundles::read(const std::string &id, bool nef, std::string &data) const
+{
+	std::vector<shared_ptr<const GeometryBundle>> current;
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (this->bundles.empty()) return false;
+		for (const auto &loaded : this->bundles) current.push_back(loaded.second.bundle);
+	}
+	for (const auto &bundle : current) {
+		if (bundle->read(id, nef, data)) return true;
+	}
+	return false;
+}
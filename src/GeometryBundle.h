@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <ctime>
+#include <stdint.h>
+#include "memory.h"
+
+class Geometry;
+
+/*!
+	Prebuilt geometry shipped with a library, so its users get the objects
+	of common parameters, e.g. the usual sizes of bolts, without
+	evaluating them.
+
+	A bundle is one .scadbundle file next to the library file, e.g.
+	bolts.scadbundle for bolts.scad, and is made by exporting a design
+	which instantiates the objects to it. It holds the geometry of each
+	subtree with children, in the format of GeometrySerializer, keyed by a
+	hash of the subtree id. Since the id describes the whole subtree, a
+	module instantiated with the same arguments gives the same id in any
+	design. The full id is stored with each object and compared on reads,
+	so hash collisions are misses.
+*/
+class GeometryBundle
+{
+public:
+	GeometryBundle(const std::string &filename) : filename(filename) {}
+
+	bool open();
+	bool read(const std::string &id, bool nef, std::string &data) const;
+	size_t size() const { return this->index.size(); }
+
+	struct Object {
+		std::string id;
+		shared_ptr<const Geometry> geom;
+	};
+	static bool write(const std::string &filename, const std::vector<Object> &objects);
+
+private:
+	struct IndexEntry {
+		uint64_t h1, h2;
+		uint32_t nef;
+		uint64_t offset, size;
+		bool operator<(const IndexEntry &other) const {
+			if (this->h1 != other.h1) return this->h1 < other.h1;
+			if (this->h2 != other.h2) return this->h2 < other.h2;
+			return this->nef < other.nef;
+		}
+	};
+
+	std::string filename;
+	std::vector<IndexEntry> index; // Sorted
+};
+
+/*!
+	The bundles of the libraries loaded with use<>, which GeometryCache
+	looks objects up in on misses, like in its persistent tier. Bundles are
+	loaded again when their file changes. All methods are thread-safe.
+*/
+class GeometryBundles
+{
+public:
+	static GeometryBundles *instance() { static GeometryBundles *inst = new GeometryBundles; return inst; }
+
+	void loadForLibrary(const std::string &libraryfile);
+	bool read(const std::string &id, bool nef, std::string &data) const;
+	bool isEmpty() const { std::lock_guard<std::mutex> lock(this->mutex); return this->bundles.empty(); }
+
+private:
+	struct Loaded {
+		time_t mtime;
+		shared_ptr<const GeometryBundle> bundle;
+	};
+	std::map<std::string, Loaded> bundles; // By filename
+	mutable std::mutex mutex;
+};
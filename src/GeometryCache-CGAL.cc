@@ -0,0 +1,171 @@
+#include "GeometryCache.h"
+#include "printutils.h"
+#include "CGAL_Nef_polyhedron.h"
+#include "PersistentCache.h"
+#include "GeometrySerializer.h"
+#include "GeometryBundle.h"
+#include "CGAL_Nef3_workaround.h"
+#include <CGAL/IO/Nef_polyhedron_iostream_3.h>
+#include <CGAL/Polygon_mesh_processing/self_intersections.h>
+#include <cmath>
+#include <sstream>
+
+/*
+	Nef polyhedron representations of GeometryCache entries. These live in a
+	separate file since GeometryCache itself is also built without CGAL.
+*/
+
+/*!
+	Returns true if a Nef polyhedron representation of the given subtree is cached.
+*/
+bool GeometryCache::containsNef(const std::string &id)
+{
+	bool hasnef = false;
+	this->cache.access(id, [&hasnef](const cache_entry &entry) { hasnef = entry.hasnef; });
+	if (hasnef) return true;
+	return fetchPersistentNef(id);
+}
+
+// The text format written before Nef polyhedra were serialized in binary
+static shared_ptr<const CGAL_Nef_polyhedron> read_nef_text(const std::string &data)
+{
+	std::istringstream in(data);
+	std::string type;
+	int convexity;
+	in >> type >> convexity;
+	shared_ptr<CGAL_Nef_polyhedron> N(new CGAL_Nef_polyhedron);
+	if (type == "nef3") {
+		CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
+		try {
+			CGAL_Nef_polyhedron3 *p3 = new CGAL_Nef_polyhedron3;
+			N->p3.reset(p3);
+			in >> *p3;
+		}
+		catch (const CGAL::Failure_exception &e) {
+			PRINTB("WARNING: Ignoring corrupt persistent cache entry: %s", e.what());
+			CGAL::set_error_behaviour(old_behaviour);
+			return shared_ptr<const CGAL_Nef_polyhedron>();
+		}
+		CGAL::set_error_behaviour(old_behaviour);
+		if (in.fail()) return shared_ptr<const CGAL_Nef_polyhedron>();
+	}
+	else if (type != "empty") {
+		return shared_ptr<const CGAL_Nef_polyhedron>();
+	}
+	N->setConvexity(convexity);
+	return N;
+}
+
+/*!
+	Reads a Nef polyhedron written by GeometryCache::writePersistentNef().
+*/
+static shared_ptr<const CGAL_Nef_polyhedron> read_nef(const std::string &data)
+{
+	if (!GeometrySerializer::isSerialized(data.data(), data.size())) return read_nef_text(data);
+	shared_ptr<const Geometry> geom;
+	if (!GeometrySerializer::read(data, geom)) return shared_ptr<const CGAL_Nef_polyhedron>();
+	return dynamic_pointer_cast<const CGAL_Nef_polyhedron>(geom);
+}
+
+/*!
+	Tries to load the given Nef polyhedron from the persistent cache tier,
+	the spilled entries or the geometry bundles of libraries into memory.
+	Nef polyhedra are stored exactly, so no precision is lost in the
+	round-trip.
+*/
+bool GeometryCache::fetchPersistentNef(const std::string &id)
+{
+	PersistentCache *stores[] = { PersistentCache::instance(), this->spillstore };
+	std::string data;
+	for(auto store : stores) {
+		if (!store || !store->isEnabled()) continue;
+		if (!store->read(id, "nef3", data)) continue;
+		shared_ptr<const CGAL_Nef_polyhedron> N = read_nef(data);
+		if (N) return attach(id, N, true, 0);
+	}
+	if (GeometryBundles::instance()->read(id, true, data)) {
+		shared_ptr<const CGAL_Nef_polyhedron> N = read_nef(data);
+		if (N) return attach(id, N, true, 0);
+	}
+	return false;
+}
+
+void GeometryCache::writePersistentNef(PersistentCache &store, const std::string &id, const CGAL_Nef_polyhedron &N)
+{
+	std::string data;
+	if (GeometrySerializer::write(N, data)) store.write(id, "nef3", data);
+}
+
+shared_ptr<const CGAL_Nef_polyhedron> GeometryCache::getNef(const std::string &id) const
+{
+	shared_ptr<const Geometry> geom;
+	this->cache.access(id, [&geom](const cache_entry &entry) { geom = entry.nef; });
+	shared_ptr<const CGAL_Nef_polyhedron> N = static_pointer_cast<const CGAL_Nef_polyhedron>(geom);
+#ifdef DEBUG
+	PRINTB("CGAL Cache hit: %s (%d bytes)", id.substr(0, 40) % (N ? N->memsize() : 0));
+#endif
+	return N;
+}
+
+static NT3 snap(const NT3 &x, double grid)
+{
+	return NT3(std::floor(CGAL::to_double(x) / grid + 0.5)) * NT3(grid);
+}
+
+/*!
+	Returns \a N rebuilt with its vertices snapped to \a grid, or NULL if it
+	isn't a manifold or snapping would make facets degenerate or intersect.
+	This replaces the long exact numbers left by earlier operations by ones
+	with the grid as their denominator.
+*/
+static shared_ptr<const CGAL_Nef_polyhedron> snap_nef(const CGAL_Nef_polyhedron &N, double grid)
+{
+	shared_ptr<CGAL_Nef_polyhedron> snapped;
+	if (N.isEmpty() || !N.p3->is_simple()) return snapped;
+	CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
+	try {
+		CGAL_Polyhedron P;
+		if (!nefworkaround::convert_to_Polyhedron<CGAL_Kernel3>(*N.p3, P) && P.is_pure_triangle()) {
+			for (auto v = P.vertices_begin(); v != P.vertices_end(); ++v) {
+				const CGAL_Point_3 p = v->point();
+				v->point() = CGAL_Point_3(snap(p.x(), grid), snap(p.y(), grid), snap(p.z(), grid));
+			}
+			bool degenerate = false;
+			for (auto f = P.facets_begin(); f != P.facets_end() && !degenerate; ++f) {
+				const auto h = f->halfedge();
+				degenerate = CGAL::collinear(h->vertex()->point(), h->next()->vertex()->point(), h->prev()->vertex()->point());
+			}
+			if (!degenerate && !CGAL::Polygon_mesh_processing::does_self_intersect(P)) {
+				snapped.reset(new CGAL_Nef_polyhedron(new CGAL_Nef_polyhedron3(P)));
+				snapped->setConvexity(N.getConvexity());
+			}
+		}
+	}
+	catch (const CGAL::Failure_exception &e) {
+		PRINTDB("Snapping cached Nef polyhedron failed: %s", e.what());
+		snapped.reset();
+	}
+	CGAL::set_error_behaviour(old_behaviour);
+	return snapped;
+}
+
+/*!
+	Caches \a N as the Nef polyhedron representation of the given subtree.
+	With a Nef grid set, the snapped polyhedron is cached instead if
+	snapping succeeds.
+*/
+bool GeometryCache::insertNef(const std::string &id, const shared_ptr<const CGAL_Nef_polyhedron> &nef, double computetime)
+{
+	shared_ptr<const CGAL_Nef_polyhedron> N = nef;
+	if (N && this->nefgrid > 0) {
+		if (shared_ptr<const CGAL_Nef_polyhedron> snapped = snap_nef(*N, this->nefgrid)) N = snapped;
+	}
+	bool inserted = attach(id, N, true, computetime);
+	PersistentCache *store = PersistentCache::instance();
+	if (N && store->isEnabled()) writePersistentNef(*store, id, *N);
+#ifdef DEBUG
+	if (inserted) PRINTB("CGAL Cache insert: %s (%d bytes)", id.substr(0, 40) % (N ? N->memsize() : 0));
+	else PRINTB("CGAL Cache insert failed: %s (%d bytes)", id.substr(0, 40) % (N ? N->memsize() : 0));
+#endif
+	return inserted;
+}
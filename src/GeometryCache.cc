@@ -1,6 +1,15 @@
 #include "GeometryCache.h"
 #include "printutils.h"
 #include "Geometry.h"
+#include "PersistentCache.h"
+#include "GeometrySerializer.h"
+#include "GeometryBundle.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#ifdef ENABLE_CGAL
+  #include "cgalutils.h"
+#endif
 #ifdef DEBUG
   #ifndef ENABLE_CGAL
   #define ENABLE_CGAL
@@ -8,22 +17,63 @@
   #include "CGAL_Nef_polyhedron.h"
 #endif
 
-GeometryCache *GeometryCache::inst = NULL;
+/*!
+	Returns true if any representation of the given subtree is cached.
+*/
+bool GeometryCache::contains(const std::string &id)
+{
+	bool found = this->cache.contains(id) || fetchPersistent(id);
+#ifdef ENABLE_CGAL
+	if (!found) found = fetchPersistentNef(id);
+#endif
+	if (found) this->hits++;
+	else this->misses++;
+	return found;
+}
+
+/*!
+	Tries to load the given entry from the persistent cache tier, the
+	spilled entries or the geometry bundles of libraries into memory.
+*/
+bool GeometryCache::fetchPersistent(const std::string &id)
+{
+	PersistentCache *stores[] = { PersistentCache::instance(), this->spillstore };
+	std::string data;
+	shared_ptr<const Geometry> geom;
+	for(auto store : stores) {
+		if (!store || !store->isEnabled()) continue;
+		if (store->read(id, "geom", data) && GeometrySerializer::read(data, geom)) return attach(id, geom, false, 0);
+	}
+	if (GeometryBundles::instance()->read(id, false, data) && GeometrySerializer::read(data, geom)) return attach(id, geom, false, 0);
+	return false;
+}
 
+/*!
+	Returns the PolySet or Polygon2d representation if cached, otherwise
+	the Nef polyhedron representation.
+*/
 shared_ptr<const Geometry> GeometryCache::get(const std::string &id) const
 {
-	const shared_ptr<const Geometry> &geom = this->cache[id]->geom;
+	shared_ptr<const Geometry> geom;
+	this->cache.access(id, [&geom](const cache_entry &entry) { geom = entry.hasgeom ? entry.geom : entry.nef; });
 #ifdef DEBUG
 	PRINTDB("Geometry Cache hit: %s (%d bytes)", id.substr(0, 40) % (geom ? geom->memsize() : 0));
 #endif
 	return geom;
 }
 
-bool GeometryCache::insert(const std::string &id, const shared_ptr<const Geometry> &geom)
+bool GeometryCache::insert(const std::string &id, const shared_ptr<const Geometry> &geom, double computetime)
 {
-	bool inserted = this->cache.insert(id, new cache_entry(geom), geom ? geom->memsize() : 0);
 #ifdef DEBUG
 	assert(!dynamic_cast<const CGAL_Nef_polyhedron*>(geom.get()));
+#endif
+	bool inserted = attach(id, geom, false, computetime);
+	PersistentCache *store = PersistentCache::instance();
+	if (store->isEnabled()) {
+		std::string data;
+		if (GeometrySerializer::write(geom, data)) store->write(id, "geom", data);
+	}
+#ifdef DEBUG
 	if (inserted) PRINTDB("Geometry Cache insert: %s (%d bytes)", 
                          id.substr(0, 40) % (geom ? geom->memsize() : 0));
 	else PRINTDB("Geometry Cache insert failed: %s (%d bytes)",
@@ -32,6 +82,122 @@ bool GeometryCache::insert(const std::string &id, const shared_ptr<const Geometr
 	return inserted;
 }
 
+/*!
+	Adds a representation to the entry for the given id, keeping any other
+	representation already cached. The entry is charged for all of its
+	representations. If the combined entry doesn't fit, the existing entry
+	is left untouched.
+*/
+bool GeometryCache::attach(const std::string &id, const shared_ptr<const Geometry> &geom, bool nef, double computetime)
+{
+	cache_entry *entry = new cache_entry;
+	this->cache.access(id, [entry](const cache_entry &old) { *entry = old; });
+	if (nef) {
+		entry->nef = geom;
+		entry->hasnef = true;
+	}
+	else {
+		entry->geom = geom;
+		entry->hasgeom = true;
+	}
+	entry->computetime = std::max(entry->computetime, computetime);
+
+	size_t cost = entry->memsize();
+	if (cost > this->cache.maxCost() && (entry->hasgeom && entry->hasnef)) {
+		delete entry;
+		return false;
+	}
+	return this->cache.insert(id, entry, cost, entry->computetime);
+}
+
+/*!
+	Writes all representations of \a entry to \a store.
+*/
+void GeometryCache::writePersistent(PersistentCache &store, const std::string &id, const cache_entry &entry)
+{
+	std::string data;
+	if (entry.hasgeom && GeometrySerializer::write(entry.geom, data)) store.write(id, "geom", data);
+#ifdef ENABLE_CGAL
+	if (entry.hasnef && entry.nef) writePersistentNef(store, id, static_cast<const CGAL_Nef_polyhedron &>(*entry.nef));
+#endif
+}
+
+/*!
+	Keeps spilled entries in \a path, e.g. a temporary directory, if there
+	is no persistent tier to load them from.
+*/
+void GeometryCache::setSpillDirectory(const std::string &path)
+{
+	if (!this->spillstore) this->spillstore = new PersistentCache(std::numeric_limits<size_t>::max());
+	this->spillstore->setDirectory(path);
+}
+
+/*!
+	Moves entries worth about \a bytes out of memory, the least valuable
+	first, and returns the bytes freed. Entries are written to the spill
+	directory, unless the persistent tier already has them, and are loaded
+	again when they are needed. Without either, they are evaluated again.
+*/
+size_t GeometryCache::spill(size_t bytes)
+{
+	PersistentCache *store = PersistentCache::instance()->isEnabled() ? NULL : this->spillstore;
+	size_t count = 0;
+	const size_t freed = this->cache.evict(bytes, [&](const std::string &id, const cache_entry &entry) {
+			if (store) writePersistent(*store, id, entry);
+			count++;
+		});
+	this->spilled += count;
+	this->spilledcost += freed;
+	return freed;
+}
+
+/*!
+	Snaps Nef polyhedra inserted from now on to \a grid, rounded down to a
+	power of two so the snapped coordinates have small denominators. A grid
+	of 0 keeps them exact.
+*/
+void GeometryCache::setNefGrid(double grid)
+{
+	this->nefgrid = grid > 0 ? std::ldexp(1.0, std::ilogb(grid)) : 0;
+}
+
+/*!
+	Returns the entries in memory, in no particular order.
+*/
+std::vector<GeometryCache::EntryInfo> GeometryCache::entries() const
+{
+	std::vector<EntryInfo> result;
+	this->cache.forEach([&result](const std::string &id, const cache_entry &entry, size_t cost, bool pinned) {
+			EntryInfo info;
+			info.id = id;
+			info.bytes = cost;
+			info.hasgeom = entry.hasgeom;
+			info.hasnef = entry.hasnef;
+			info.pinned = pinned;
+			info.computetime = entry.computetime;
+			result.push_back(info);
+		});
+	return result;
+}
+
+/*!
+	Keeps the entry for \a id in memory until it's unpinned, removed or the
+	cache is cleared. Returns false if it's not in memory.
+*/
+bool GeometryCache::setPinned(const std::string &id, bool pinned)
+{
+	return this->cache.setPinned(id, pinned);
+}
+
+/*!
+	Drops the entry for \a id from memory, pinned or not. The persistent
+	tier keeps its copy, if any.
+*/
+bool GeometryCache::remove(const std::string &id)
+{
+	return this->cache.remove(id);
+}
+
 size_t GeometryCache::maxSize() const
 {
 	return this->cache.maxCost();
@@ -42,14 +208,42 @@ void GeometryCache::setMaxSize(size_t limit)
 	this->cache.setMaxCost(limit);
 }
 
+CacheStats GeometryCache::stats() const
+{
+	CacheStats st = this->cache.stats();
+	st.hits = this->hits;
+	st.misses = this->misses;
+	return st;
+}
+
+void GeometryCache::resetStats()
+{
+	this->cache.resetStats();
+	this->hits = this->misses = 0;
+}
+
 void GeometryCache::print()
 {
 	PRINTB("Geometries in cache: %d", this->cache.size());
 	PRINTB("Geometry cache size in bytes: %d", this->cache.totalCost());
+	PRINTB("Geometry cache: %s", stats().toString());
+	if (this->spilled > 0) PRINTB("Geometry cache spilled to disk: %d entries (%d bytes)", this->spilled % this->spilledcost);
+#ifdef ENABLE_CGAL
+	size_t measured = CGALUtils::gmpMemoryInUse();
+	if (measured > 0) PRINTB("Exact number heap in use: %d bytes (measured, includes uncached objects)", measured);
+#endif
+}
+
+GeometryCache::cache_entry::cache_entry()
+	: hasgeom(false), hasnef(false), computetime(0)
+{
+	this->msg = print_messages_top();
 }
 
-GeometryCache::cache_entry::cache_entry(const shared_ptr<const Geometry> &geom)
-	: geom(geom)
+size_t GeometryCache::cache_entry::memsize() const
 {
-	if (print_messages_stack.size() > 0) this->msg = print_messages_stack.back();
+	size_t size = 0;
+	if (this->geom) size += this->geom->memsize();
+	if (this->nef) size += this->nef->memsize();
+	return size;
 }
@@ -1,33 +1,98 @@
 #pragma once
 
 #include "cache.h"
+#include <string>
+#include <vector>
 #include "memory.h"
 #include "Geometry.h"
 
+/*!
+	Cache of evaluated geometry, keyed by subtree id.
+
+	Each entry can hold several representations of the same subtree: a
+	PolySet or Polygon2d, and a CGAL Nef polyhedron. Representations are
+	attached to existing entries as they become available (e.g. when a Nef
+	result is converted to a PolySet for export or display), and all of
+	them are accounted against one memory budget.
+
+	Under memory pressure, spill() moves entries out of memory to disk,
+	from where they are loaded again like entries of the persistent tier.
+	Pinned entries are neither evicted nor spilled.
+
+	With setNefGrid(), Nef polyhedra are snapped to a grid when they are
+	inserted, so cached results have small exact numbers and are cheap to
+	reuse in later operations.
+*/
 class GeometryCache
 {
 public:	
-	GeometryCache(size_t memorylimit = 100*1024*1024) : cache(memorylimit) {}
+	GeometryCache(size_t memorylimit = 100*1024*1024)
+		: cache(memorylimit), hits(0), misses(0), spillstore(NULL), spilled(0), spilledcost(0), nefgrid(0) {}
 
-	static GeometryCache *instance() { if (!inst) inst = new GeometryCache; return inst; }
+	static GeometryCache *instance() { static GeometryCache *inst = new GeometryCache; return inst; }
 
-	bool contains(const std::string &id) const { return this->cache.contains(id); }
+	// Lookups through contains() are counted in stats()
+	bool contains(const std::string &id);
 	shared_ptr<const class Geometry> get(const std::string &id) const;
-	bool insert(const std::string &id, const shared_ptr<const Geometry> &geom);
+	bool insert(const std::string &id, const shared_ptr<const Geometry> &geom, double computetime = 0);
+#ifdef ENABLE_CGAL
+	bool containsNef(const std::string &id);
+	shared_ptr<const class CGAL_Nef_polyhedron> getNef(const std::string &id) const;
+	bool insertNef(const std::string &id, const shared_ptr<const CGAL_Nef_polyhedron> &N, double computetime = 0);
+#endif
 	size_t maxSize() const;
 	void setMaxSize(size_t limit);
 	void clear() { cache.clear(); }
+	void setSpillDirectory(const std::string &path);
+	void setNefGrid(double grid);
+	double nefGrid() const { return this->nefgrid; }
+	size_t spill(size_t bytes);
+
+	// What's known about a cached entry, without its geometry
+	struct EntryInfo {
+		std::string id;
+		size_t bytes;
+		bool hasgeom;
+		bool hasnef;
+		bool pinned;
+		double computetime;
+	};
+	std::vector<EntryInfo> entries() const;
+	bool setPinned(const std::string &id, bool pinned);
+	bool remove(const std::string &id);
+	CacheStats stats() const;
+	void resetStats();
 	void print();
 
 private:
-	static GeometryCache *inst;
+	bool fetchPersistent(const std::string &id);
+	bool fetchPersistentNef(const std::string &id);
+	bool attach(const std::string &id, const shared_ptr<const Geometry> &geom, bool nef, double computetime);
 
 	struct cache_entry {
 		shared_ptr<const class Geometry> geom;
+		shared_ptr<const class Geometry> nef;
+		bool hasgeom;
+		bool hasnef;
+		double computetime;
 		std::string msg;
-		cache_entry(const shared_ptr<const Geometry> &geom);
+		cache_entry();
 		~cache_entry() { }
+		size_t memsize() const;
 	};
 
-	Cache<std::string, cache_entry> cache;
+	static void writePersistent(class PersistentCache &store, const std::string &id, const cache_entry &entry);
+#ifdef ENABLE_CGAL
+	static void writePersistentNef(class PersistentCache &store, const std::string &id, const class CGAL_Nef_polyhedron &N);
+#endif
+
+	mutable ShardedCache<std::string, cache_entry> cache;
+	std::atomic<size_t> hits;
+	std::atomic<size_t> misses;
+	// Holds spilled entries if there is no persistent tier
+	class PersistentCache *spillstore;
+	std::atomic<size_t> spilled;
+	std::atomic<size_t> spilledcost;
+	// Grid which cached Nef polyhedra are snapped to, 0 if they are kept as they are
+	double nefgrid;
 };
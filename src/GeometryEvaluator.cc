@@ -1,7 +1,7 @@
 #include "GeometryEvaluator.h"
 #include "Tree.h"
 #include "GeometryCache.h"
-#include "CGALCache.h"
+#include "PersistentCache.h"
 #include "Polygon2d.h"
 #include "module.h"
 #include "ModuleInstantiation.h"
@@ -14,26 +14,60 @@
 #include "cgaladvnode.h"
 #include "projectionnode.h"
 #include "csgops.h"
+#include "colornode.h"
 #include "textnode.h"
+#include "importnode.h"
+#include "ImportCache.h"
 #include "CGAL_Nef_polyhedron.h"
 #include "cgalutils.h"
 #include "rendernode.h"
+#include "simplifynode.h"
+#include "reducednode.h"
 #include "clipper-utils.h"
 #include "polyset-utils.h"
 #include "polyset.h"
 #include "calc.h"
+#include "Profiler.h"
+#include "Timing.h"
+#include "EvaluationTrace.h"
 #include "printutils.h"
+#include "OperationCounters.h"
 #include "svg.h"
 #include "calc.h"
 #include "dxfdata.h"
+#include "feature.h"
+#include "ThreadPool.h"
+#include "EvaluationBudget.h"
+#include "MemoryAccounting.h"
+#include "progress.h"
+#include "hash.h"
+#include "Session.h"
 
 #include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <condition_variable>
 
-#include <CGAL/convex_hull_2.h>
-#include <CGAL/Point_2.h>
+// Reduces loops being instantiated, identifying the result by the nodes it was made from
+static shared_ptr<const Geometry> reduce_nodes(const AbstractNode &node, std::string &id)
+{
+	Tree tree(&node);
+	id = hash128(tree.getIdString(node)).toString();
+	GeometryEvaluator evaluator(tree);
+	// The result is kept with the node
+	evaluator.requireExact();
+	return evaluator.evaluateGeometry(node, false);
+}
+
+namespace {
+	struct RegisterReducer {
+		RegisterReducer() { ReducedNode::evaluator = reduce_nodes; }
+	} register_reducer;
+}
 
 GeometryEvaluator::GeometryEvaluator(const class Tree &tree):
-	tree(tree)
+	firstindex(0), exactonly(false), tree(tree)
 {
 }
 
@@ -43,43 +77,167 @@ GeometryEvaluator::GeometryEvaluator(const class Tree &tree):
 shared_ptr<const Geometry> GeometryEvaluator::evaluateGeometry(const AbstractNode &node, 
 																															 bool allownef)
 {
-	if (!GeometryCache::instance()->contains(this->tree.getIdString(node))) {
-		shared_ptr<const CGAL_Nef_polyhedron> N;
-		if (CGALCache::instance()->contains(this->tree.getIdString(node))) {
-			N = CGALCache::instance()->get(this->tree.getIdString(node));
-		}
+	MemoryAccounting::Scope memoryscope(MemoryAccounting::GEOMETRY);
+	const std::string &key = this->tree.getIdString(node);
+	GeometryCache *cache = GeometryCache::instance();
+	if (cache->contains(key)) {
+		this->root = cache->get(key);
+	}
+	else {
+		// If not found in the cache, we need to evaluate the geometry
+		this->evaltimes.clear();
+		this->evaluated.clear();
+		this->repeated.clear();
+		std::unordered_set<std::string> seen;
+		findRepeatedSubtrees(node, seen);
+		// Nodes are numbered in instantiation order, so a subtree's indices
+		// are mostly contiguous
+		size_t first = node.index(), last = node.index();
+		indexRange(node, first, last);
+		this->firstindex = first;
+		this->visitedchildren.assign(last - first + 1, Geometry::Geometries());
+		if (Feature::ExperimentalParallelEvaluation.is_enabled()) evaluateParallel(node);
+		this->traverse(node);
+		std::vector<Geometry::Geometries>().swap(this->visitedchildren);
+		this->evaluated.clear();
+		smartCacheInsert(node, this->root);
+	}
 
-		// If not found in any caches, we need to evaluate the geometry
-		if (N) {
-			this->root = N;
-		}	
-    else {
-			this->traverse(node);
+	if (!allownef) {
+		if (shared_ptr<const CGAL_Nef_polyhedron> N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(this->root)) {
+			PolySet *ps = new PolySet(3);
+			ps->setConvexity(N->getConvexity());
+			this->root.reset(ps);
+			if (!N->isEmpty()) {
+				bool err = CGALUtils::createPolySetFromNefPolyhedron3(*N->p3, *ps);
+				if (err) {
+					PRINT("ERROR: Nef->PolySet failed");
+				}
+			}
+			// Keep the converted result next to the Nef polyhedron
+			if (!this->approximate.count(key)) cache->insert(key, this->root);
 		}
+	}
+	return this->root;
+}
 
-		if (!allownef) {
-			if (shared_ptr<const CGAL_Nef_polyhedron> N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(this->root)) {
-				PolySet *ps = new PolySet(3);
-				ps->setConvexity(N->getConvexity());
-				this->root.reset(ps);
-				if (!N->isEmpty()) {
-					bool err = CGALUtils::createPolySetFromNefPolyhedron3(*N->p3, *ps);
-					if (err) {
-						PRINT("ERROR: Nef->PolySet failed");
-					}
-				}
+/*!
+	Finds the subtrees of \a node which occur more than once. Their geometry
+	is kept for the rest of the evaluation, so they are evaluated only once
+	even before they reach the cache.
+*/
+void GeometryEvaluator::findRepeatedSubtrees(const AbstractNode &node, std::unordered_set<std::string> &seen)
+{
+	const std::string &key = this->tree.getIdString(node);
+	if (!seen.insert(key).second) {
+		this->repeated.insert(key);
+		return;
+	}
+	for(const auto &child : node.children) findRepeatedSubtrees(*child, seen);
+}
+
+static void indexRange(const AbstractNode &node, size_t &first, size_t &last)
+{
+	first = std::min(first, node.index());
+	last = std::max(last, node.index());
+	for(const auto &child : node.children) indexRange(*child, first, last);
+}
+
+// Text rendering goes through the FontCache, which isn't thread-safe
+static bool containsText(const AbstractNode &node)
+{
+	if (dynamic_cast<const TextNode *>(&node)) return true;
+	for(const auto &child : node.children) {
+		if (containsText(*child)) return true;
+	}
+	return false;
+}
+
+/*!
+	Returns true if \a node can be evaluated in parallel with other subtrees.
+*/
+bool GeometryEvaluator::isThreadSafe(const AbstractNode &node)
+{
+	return !containsText(node);
+}
+
+static size_t subtreeSize(const AbstractNode &node)
+{
+	size_t size = 1;
+	for(const auto &child : node.children) size += subtreeSize(*child);
+	return size;
+}
+
+/*!
+	Evaluates independent subtrees below \a node in parallel. Chains of
+	nodes with a single uncached child are followed down to the first node
+	with several uncached children, each of which becomes a task. The
+	results are picked up by the following traversal as if they were cached,
+	so joining them happens in the usual order.
+
+	Identical subtrees get a single task. Tasks are submitted largest first,
+	using the number of nodes as an estimate of their cost, so the longest
+	computations start early.
+
+	Each task uses its own GeometryEvaluator and may split its subtree
+	further. The id strings of the tree must be complete before.
+*/
+void GeometryEvaluator::evaluateParallel(const AbstractNode &node)
+{
+	std::vector<const AbstractNode *> tasks;
+	const AbstractNode *parent = &node;
+	while (true) {
+		tasks.clear();
+		std::unordered_set<std::string> keys;
+		for(const auto &child : parent->children) {
+			if (!isSmartCached(*child) && keys.insert(this->tree.getIdString(*child)).second) {
+				tasks.push_back(child);
 			}
 		}
-		smartCacheInsert(node, this->root);
-		return this->root;
+		if (tasks.size() != 1) break;
+		parent = tasks.front();
+	}
+	tasks.erase(std::remove_if(tasks.begin(), tasks.end(),
+														 [](const AbstractNode *n) { return !isThreadSafe(*n); }), tasks.end());
+	if (tasks.size() < 2) return;
+
+	std::vector<std::pair<size_t, const AbstractNode *>> order;
+	for(const auto &task : tasks) order.push_back(std::make_pair(subtreeSize(*task), task));
+	std::stable_sort(order.begin(), order.end(),
+									 [](const std::pair<size_t, const AbstractNode *> &a, const std::pair<size_t, const AbstractNode *> &b) {
+										 return a.first > b.first;
+									 });
+	for (size_t i=0;i<order.size();i++) tasks[i] = order[i].second;
+
+	ThreadPool *pool = ThreadPool::instance();
+	ThreadPool::TaskGroup group;
+	std::vector<shared_ptr<const Geometry>> results(tasks.size());
+	std::vector<char> approximate(tasks.size(), false);
+	for (size_t i=0;i<tasks.size();i++) {
+		pool->run(group, [this, &tasks, &results, &approximate, i]() {
+				GeometryEvaluator evaluator(this->tree);
+				evaluator.exactonly = this->exactonly;
+				results[i] = evaluator.evaluateGeometry(*tasks[i], true);
+				approximate[i] = evaluator.isApproximate(*tasks[i]);
+			});
+	}
+	pool->wait(group);
+	for (size_t i=0;i<tasks.size();i++) {
+		const std::string &key = this->tree.getIdString(*tasks[i]);
+		this->evaluated[key] = results[i];
+		if (approximate[i]) this->approximate.insert(key);
 	}
-	return GeometryCache::instance()->get(this->tree.getIdString(node));
 }
 
-GeometryEvaluator::ResultObject GeometryEvaluator::applyToChildren(const AbstractNode &node, OpenSCADOperator op)
+/*!
+	Applies the operator to the children of \a node. Set \a fallback if
+	the result is the node's geometry, so a Boolean operation may fall back
+	to an approximate result, see applyWithFallback().
+*/
+GeometryEvaluator::ResultObject GeometryEvaluator::applyToChildren(const AbstractNode &node, OpenSCADOperator op, bool fallback)
 {
 	unsigned int dim = 0;
-	for(const auto &item : this->visitedchildren[node.index()]) {
+	for(const auto &item : childrenOf(node)) {
 		if (!item.first->modinst->isBackground() && item.second) {
 			if (!dim) dim = item.second->getDimension();
 			else if (dim != item.second->getDimension()) {
@@ -89,25 +247,396 @@ GeometryEvaluator::ResultObject GeometryEvaluator::applyToChildren(const Abstrac
 		}
 	}
     if (dim == 2) {
-        Polygon2d *p2d = applyToChildren2D(node, op);
-        assert(p2d);
-        return ResultObject(p2d);
+        ResultObject res = applyToChildren2D(node, op);
+        assert(res.constptr());
+        return res;
     }
-    else if (dim == 3) return applyToChildren3D(node, op);
+    else if (dim == 3) return applyToChildren3D(node, op, fallback);
 	return ResultObject();
 }
 
+/*!
+	Returns the result \a res of the children of \a node, to be modified
+	in place by the node. A const result, e.g. a single child passed on, is
+	only copied if something else still refers to it, like the cache, so
+	chains of transformations of uncached objects don't copy them at each
+	level. The node's references to its children's results are dropped,
+	since it's done with them.
+*/
+shared_ptr<Geometry> GeometryEvaluator::editableResult(const AbstractNode &node, ResultObject &res)
+{
+	if (!res.isConst()) return res.ptr();
+	shared_ptr<const Geometry> geom = res.constptr();
+	res = ResultObject();
+	childrenOf(node).clear();
+	// Geometries are never created const, so the sole owner may modify it
+	if (!geom || geom.use_count() == 1) return std::const_pointer_cast<Geometry>(geom);
+	return shared_ptr<Geometry>(geom->copy());
+}
+
+/*!
+	Returns true if \a box is known to lie outside of the mesh \a geom, using
+	its bounding volume hierarchy. Only PolySets have one.
+*/
+static bool isOutside(const Geometry &geom, const BoundingBox &box)
+{
+	const PolySet *ps = dynamic_cast<const PolySet *>(&geom);
+	return ps && ps->getDimension() == 3 && ps->getBVH()->isOutside(box);
+}
+
+/*!
+	Drops children which can't affect the result of a difference or
+	intersection: subtracted objects which don't touch the first object's
+	bounding box, or lie outside of its mesh. Returns false if an
+	intersection is known to be empty.
+*/
+bool GeometryEvaluator::cullChildren(Geometry::Geometries &children, OpenSCADOperator op)
+{
+	const Geometry &first = *children.front().second;
+	BoundingBox bbox = first.getBoundingBox();
+	if (op == OPENSCAD_INTERSECTION) {
+		for(const auto &item : children) {
+			bbox = bbox.intersection(item.second->getBoundingBox());
+			if (bbox.isEmpty()) return false;
+		}
+		for(const auto &item : children) {
+			if (item.second.get() != &first && isOutside(first, item.second->getBoundingBox())) return false;
+		}
+		return true;
+	}
+
+	if (bbox.isEmpty()) {
+		// Nothing minus anything is nothing
+		children.resize(1);
+		return true;
+	}
+	auto it = children.begin();
+	for (++it;it != children.end();) {
+		const BoundingBox box = it->second->getBoundingBox();
+		if (bbox.intersection(box).isEmpty() || isOutside(first, box)) it = children.erase(it);
+		else ++it;
+	}
+	return true;
+}
+
+/*!
+	Returns false if \a geom can't touch the plane z=0, so it doesn't add
+	to a projection(cut=true).
+*/
+static bool touchesCutPlane(const Geometry &geom)
+{
+	const double inf = std::numeric_limits<double>::infinity();
+	const BoundingBox plane(Vector3d(-inf, -inf, 0), Vector3d(inf, inf, 0));
+	if (geom.getBoundingBox().intersection(plane).isEmpty()) return false;
+	const PolySet *ps = dynamic_cast<const PolySet *>(&geom);
+	// A solid crossing the plane has polygons crossing it
+	return !ps || ps->getDimension() != 3 || ps->getBVH()->intersects(plane);
+}
+
+/*!
+	Slices the meshes \a children at z=0 for projection(cut=true), without
+	uniting them or converting them to Nef polyhedra. Returns NULL if any
+	of them isn't a closed PolySet, or all are empty, to cut them the slow
+	way.
+*/
+static Polygon2d *sliceMeshes(const Geometry::Geometries &children)
+{
+	std::vector<Outline2d> outlines;
+	bool sliced = false;
+	for(const auto &item : children) {
+		if (item.second->isEmpty()) continue;
+		const PolySet *ps = dynamic_cast<const PolySet *>(item.second.get());
+		if (!ps || !PolysetUtils::slice(*ps, outlines)) return NULL;
+		sliced = true;
+	}
+	return sliced ? ClipperUtils::uniteNonZero(outlines) : NULL;
+}
+
+/*!
+	Converts the PolySet children to Nef polyhedra, once a Boolean operation
+	on them can't be avoided. Until then geometry stays in its cheaper mesh
+	form. The conversions are attached to the children's cache entries, so
+	each child is converted at most once.
+*/
+void GeometryEvaluator::materializeNefs(Geometry::Geometries &children)
+{
+	GeometryCache *cache = GeometryCache::instance();
+	for(auto &item : children) {
+		if (!dynamic_cast<const PolySet *>(item.second.get())) continue;
+		// Intermediate results have no node and aren't cached
+		const std::string key = item.first ? this->tree.getIdString(*item.first) : std::string();
+		if (!key.empty() && cache->containsNef(key)) {
+			item.second = cache->getNef(key);
+			continue;
+		}
+		Clock::time_point start = Clock::now();
+		shared_ptr<const CGAL_Nef_polyhedron> N(CGALUtils::createNefPolyhedronFromGeometry(*item.second));
+		if (!N) continue;
+		if (!key.empty()) cache->insertNef(key, N, std::chrono::duration<double>(Clock::now() - start).count());
+		item.second = N;
+	}
+}
+
+/*!
+	Unites children with disjoint bounding boxes by concatenating their
+	meshes. Children whose boxes overlap or touch are grouped, and only the
+	groups with more than one member are united by CGAL.
+
+	Returns NULL if the children form a single group.
+*/
+PolySet *GeometryEvaluator::applyUnionDisjoint(const Geometry::Geometries &children)
+{
+	std::vector<Geometry::Geometries> groups = CGALUtils::groupByBoundingBox(children);
+	if (groups.size() < 2) return NULL;
+
+	for(auto &g : groups) {
+		if (g.size() > 1) materializeNefs(g);
+	}
+
+	PolySet *result = new PolySet(3);
+	unsigned int convexity = 1;
+	for(const auto &g : groups) {
+		shared_ptr<const Geometry> geom;
+		if (g.size() == 1) geom = g.front().second;
+		else geom.reset(CGALUtils::applyOperator(g, OPENSCAD_UNION));
+		if (!geom || geom->isEmpty()) continue;
+
+		convexity = std::max(convexity, geom->getConvexity());
+		if (const PolySet *ps = dynamic_cast<const PolySet *>(geom.get())) {
+			result->append(*ps);
+		}
+		else if (const CGAL_Nef_polyhedron *N = dynamic_cast<const CGAL_Nef_polyhedron *>(geom.get())) {
+			PolySet ps(3);
+			if (CGALUtils::createPolySetFromNefPolyhedron3(*N->p3, ps)) {
+				PRINT("ERROR: Nef->PolySet failed");
+			}
+			result->append(ps);
+		}
+	}
+	result->setConvexity(convexity);
+	return result;
+}
+
+/*!
+	Replaces the subtrahends of a difference by their union, so the
+	difference takes a single Boolean against the base instead of one per
+	subtrahend. Disjoint subtrahends are concatenated.
+
+	Returns false if nothing is left to subtract.
+*/
+bool GeometryEvaluator::uniteSubtrahends(Geometry::Geometries &children)
+{
+	Geometry::Geometries subtrahends(++children.begin(), children.end());
+	children.erase(++children.begin(), children.end());
+
+	shared_ptr<const Geometry> united(applyUnionDisjoint(subtrahends));
+	if (!united && Feature::ExperimentalCorefinement.is_enabled()) {
+		united.reset(CGALUtils::applyOperatorCorefine(subtrahends, OPENSCAD_UNION));
+	}
+	if (!united) {
+		materializeNefs(subtrahends);
+		united.reset(CGALUtils::applyOperator(subtrahends, OPENSCAD_UNION));
+	}
+	if (!united || united->isEmpty()) return false;
+
+	children.push_back(std::make_pair((const AbstractNode *)NULL, united));
+	return true;
+}
+
 /*!
 	Applies the operator to all child nodes of the given node.
 	
 	May return NULL or any 3D Geometry object (can be either PolySet or CGAL_Nef_polyhedron)
 */
-GeometryEvaluator::ResultObject GeometryEvaluator::applyToChildren3D(const AbstractNode &node, OpenSCADOperator op)
+GeometryEvaluator::ResultObject GeometryEvaluator::applyToChildren3D(const AbstractNode &node, OpenSCADOperator op, bool fallback)
 {
 	Geometry::Geometries children = collectChildren3D(node);
+	Clock::time_point deadline;
+	if (fallback && !this->exactonly && children.size() > 1 &&
+			(op == OPENSCAD_UNION || op == OPENSCAD_DIFFERENCE || op == OPENSCAD_INTERSECTION) &&
+			EvaluationBudget::instance()->fallbackDeadline(deadline)) {
+		return applyWithFallback(node, children, op, deadline);
+	}
+	return applyToChildren3D(children, op);
+}
+
+namespace {
+	/*
+		The exact operation of applyWithFallback(). Once it's abandoned, its
+		result goes to the cache when it's done.
+	*/
+	struct FallbackTask {
+		FallbackTask() : done(false), abandoned(false) {}
+		ThreadPool::TaskGroup group;
+		std::mutex mutex;
+		bool done;
+		bool abandoned;
+		shared_ptr<const Geometry> result;
+		std::exception_ptr exception;
+		std::vector<std::string> messages;
+	};
+}
+
+// Number of abandoned operations still running, see finishBackgroundTasks()
+static std::mutex background_mutex;
+static std::condition_variable background_done;
+static size_t background_tasks = 0;
+
+/*!
+	Applies the Boolean operation \a op to the \a children of \a node,
+	waiting for it until \a deadline at most. An operation which isn't done
+	by then is abandoned: the node gets an approximate result, see
+	approximateResult(), and the exact operation goes on in the background
+	to cache its result for the next evaluation.
+
+	Approximate results, and the results of their parents, aren't cached.
+	Operations on approximate children fall back right away, as their
+	exact results would be wrong too.
+*/
+GeometryEvaluator::ResultObject GeometryEvaluator::applyWithFallback(const AbstractNode &node, const Geometry::Geometries &children, OpenSCADOperator op, const Clock::time_point &deadline)
+{
+	const std::string &key = this->tree.getIdString(node);
+	if (this->approximate.count(key)) return ResultObject(approximateResult(children, op));
+
+	// The task may outlive the nodes and the session
+	Geometry::Geometries exact;
+	for(const auto &item : children) exact.push_back(std::make_pair((const AbstractNode *)NULL, item.second));
+	shared_ptr<FallbackTask> task(new FallbackTask);
+	const std::string id = key;
+	ThreadPool::instance()->run(task->group, [task, exact, op, id]() {
+			Session::Scope scope(NULL);
+			const Clock::time_point start = Clock::now();
+			std::vector<std::string> messages;
+			shared_ptr<const Geometry> result;
+			std::exception_ptr exception;
+			try {
+				PrintCapture capture(messages);
+				Tree tree;
+				GeometryEvaluator evaluator(tree);
+				evaluator.exactonly = true;
+				result = evaluator.applyToChildren3D(exact, op).constptr();
+			}
+			catch (...) {
+				exception = std::current_exception();
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(task->mutex);
+				if (!task->abandoned) {
+					task->done = true;
+					task->result = result;
+					task->exception = exception;
+					task->messages.swap(messages);
+					return;
+				}
+			}
+			const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+			GeometryCache *cache = GeometryCache::instance();
+			if (shared_ptr<const CGAL_Nef_polyhedron> N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(result)) {
+				if (!cache->containsNef(id)) cache->insertNef(id, N, seconds);
+			}
+			else if (result && !cache->contains(id)) {
+				cache->insert(id, result, seconds);
+			}
+			std::lock_guard<std::mutex> lock(background_mutex);
+			background_tasks--;
+			background_done.notify_all();
+		});
+
+	ThreadPool::instance()->waitUntil(task->group, deadline);
+	{
+		std::lock_guard<std::mutex> lock(task->mutex);
+		if (!task->done) {
+			task->abandoned = true;
+			std::lock_guard<std::mutex> backgroundlock(background_mutex);
+			background_tasks++;
+		}
+	}
+	if (task->done) {
+		for(const auto &msg : task->messages) PRINT(msg);
+		if (task->exception) std::rethrow_exception(task->exception);
+		return ResultObject(task->result);
+	}
+
+	std::string desc = node.name();
+	if (node.modinst && node.modinst->location().firstLine() > 0) {
+		desc += str(boost::format(" (line %d)") % node.modinst->location().firstLine());
+	}
+	PRINTB("WARNING: %s wasn't done in time, using an approximate result", desc);
+	this->approximate.insert(key);
+	return ResultObject(approximateResult(children, op));
+}
+
+/*!
+	Returns a quick approximation of \a op applied to the meshes of the
+	\a children, for previews: a union is their concatenation, the first
+	child stands in for a difference and the smallest child for an
+	intersection.
+*/
+PolySet *GeometryEvaluator::approximateResult(const Geometry::Geometries &children, OpenSCADOperator op)
+{
+	PolySet *result = new PolySet(3);
+	BoundingBox common = children.front().second->getBoundingBox();
+	const Geometry *smallest = NULL;
+	double smallestvolume = std::numeric_limits<double>::infinity();
+	unsigned int convexity = 1;
+	for(const auto &item : children) {
+		const BoundingBox box = item.second->getBoundingBox();
+		common = common.intersection(box);
+		const double volume = box.isEmpty() ? 0 : box.sizes().prod();
+		if (volume < smallestvolume) {
+			smallest = item.second.get();
+			smallestvolume = volume;
+		}
+		convexity = std::max(convexity, item.second->getConvexity());
+	}
+	if (op == OPENSCAD_INTERSECTION && common.isEmpty()) return result;
+
+	for(const auto &item : children) {
+		const Geometry *geom = item.second.get();
+		if (op == OPENSCAD_DIFFERENCE && geom != children.front().second.get()) break;
+		if (op == OPENSCAD_INTERSECTION && geom != smallest) continue;
+		if (const PolySet *ps = dynamic_cast<const PolySet *>(geom)) {
+			result->append(*ps);
+		}
+		else if (const CGAL_Nef_polyhedron *N = dynamic_cast<const CGAL_Nef_polyhedron *>(geom)) {
+			if (N->isEmpty()) continue;
+			PolySet ps(3);
+			if (CGALUtils::createPolySetFromNefPolyhedron3(*N->p3, ps)) {
+				PRINT("ERROR: Nef->PolySet failed");
+			}
+			result->append(ps);
+		}
+	}
+	result->setConvexity(convexity);
+	return result;
+}
+
+/*!
+	Waits for the operations abandoned by applyWithFallback() to finish, so
+	their results reach the persistent cache before the process ends.
+	Returns the number of operations waited for.
+*/
+size_t GeometryEvaluator::finishBackgroundTasks()
+{
+	std::unique_lock<std::mutex> lock(background_mutex);
+	const size_t tasks = background_tasks;
+	if (tasks > 0) PRINTB("Finishing %d approximated operations for the cache", tasks);
+	background_done.wait(lock, []() { return background_tasks == 0; });
+	return tasks;
+}
+
+GeometryEvaluator::ResultObject GeometryEvaluator::applyToChildren3D(Geometry::Geometries children, OpenSCADOperator op)
+{
 	if (children.size() == 0) return ResultObject();
 
 	if (op == OPENSCAD_HULL) {
+		// A convex mesh is its own hull
+		if (children.size() == 1) {
+			const PolySet *child = dynamic_cast<const PolySet *>(children.front().second.get());
+			if (child && child->is_convex()) return ResultObject(children.front().second);
+		}
+
 		PolySet *ps = new PolySet(3, true);
 
 		if (CGALUtils::applyHull(children, *ps)) {
@@ -118,9 +647,21 @@ GeometryEvaluator::ResultObject GeometryEvaluator::applyToChildren3D(const Abstr
 		return ResultObject();
 	}
 	
+	if (op == OPENSCAD_DIFFERENCE || op == OPENSCAD_INTERSECTION) {
+		if (!cullChildren(children, op)) return ResultObject(new CGAL_Nef_polyhedron);
+	}
+
 	// Only one child -> this is a noop
 	if (children.size() == 1) return ResultObject(children.front().second);
 
+	if (op == OPENSCAD_UNION) {
+		if (PolySet *ps = applyUnionDisjoint(children)) return ResultObject(ps);
+	}
+
+	if (op == OPENSCAD_DIFFERENCE && children.size() > 2) {
+		if (!uniteSubtrahends(children)) return ResultObject(children.front().second);
+	}
+
 	if (op == OPENSCAD_MINKOWSKI) {
 		Geometry::Geometries actualchildren;
 		for(const auto &item : children) {
@@ -128,9 +669,14 @@ GeometryEvaluator::ResultObject GeometryEvaluator::applyToChildren3D(const Abstr
 		}
 		if (actualchildren.empty()) return ResultObject();
 		if (actualchildren.size() == 1) return ResultObject(actualchildren.front().second);
-		return ResultObject(CGALUtils::applyMinkowski(actualchildren));
+		return ResultObject(CGALUtils::applyMinkowski(actualchildren, &this->tree));
+	}
+
+	if (Feature::ExperimentalCorefinement.is_enabled()) {
+		if (PolySet *ps = CGALUtils::applyOperatorCorefine(children, op)) return ResultObject(ps);
 	}
 
+	materializeNefs(children);
 	CGAL_Nef_polyhedron *N = CGALUtils::applyOperator(children, op);
 	// FIXME: Clarify when we can return NULL and what that means
 	if (!N) N = new CGAL_Nef_polyhedron;
@@ -144,31 +690,44 @@ GeometryEvaluator::ResultObject GeometryEvaluator::applyToChildren3D(const Abstr
 
 	May return an empty geometry but will not return NULL.
 */
+/*!
+	The hull of the outlines of the children. Large children are reduced to
+	their own hulls in parallel first, as only their hull vertices can be
+	on the hull of all children.
+*/
 Polygon2d *GeometryEvaluator::applyHull2D(const AbstractNode &node)
 {
 	std::vector<const Polygon2d *> children = collectChildren2D(node);
 	Polygon2d *geometry = new Polygon2d();
 
-	typedef CGAL::Point_2<CGAL::Cartesian<double>> CGALPoint2;
-	// Collect point cloud
-	std::list<CGALPoint2> points;
-	for(const auto &p : children) {
-		for(const auto &o : p->outlines()) {
-			for(const auto &v : o.vertices) {
-				points.push_back(CGALPoint2(v[0], v[1]));
-			}
+	std::vector<std::vector<Vector2d>> points(children.size());
+	size_t total = 0;
+	for (size_t i = 0; i < children.size(); i++) {
+		for(const auto &o : children[i]->outlines()) {
+			points[i].insert(points[i].end(), o.vertices.begin(), o.vertices.end());
 		}
+		total += points[i].size();
 	}
-	if (points.size() > 0) {
-		// Apply hull
-		std::list<CGALPoint2> result;
-		CGAL::convex_hull_2(points.begin(), points.end(), std::back_inserter(result));
 
-		// Construct Polygon2d
-		Outline2d outline;
-		for(const auto &p : result) {
-			outline.vertices.push_back(Vector2d(p[0], p[1]));
+	std::vector<Vector2d> cloud;
+	if (children.size() > 1 && total > 10000 && Feature::ExperimentalParallelEvaluation.is_enabled()) {
+		std::vector<std::vector<Vector2d>> hulls(children.size());
+		ThreadPool *pool = ThreadPool::instance();
+		ThreadPool::TaskGroup group;
+		for (size_t i = 0; i < children.size(); i++) {
+			pool->run(group, [&points, &hulls, i]() { GeometryUtils::convexHull2D(points[i], hulls[i]); });
 		}
+		pool->wait(group);
+		for(const auto &hull : hulls) cloud.insert(cloud.end(), hull.begin(), hull.end());
+	}
+	else {
+		cloud.reserve(total);
+		for(const auto &p : points) cloud.insert(cloud.end(), p.begin(), p.end());
+	}
+
+	if (cloud.size() > 0) {
+		Outline2d outline;
+		GeometryUtils::convexHull2D(cloud, outline.vertices);
 		geometry->addOutline(outline);
 	}
 	return geometry;
@@ -202,7 +761,7 @@ Polygon2d *GeometryEvaluator::applyMinkowski2D(const AbstractNode &node)
 std::vector<const class Polygon2d *> GeometryEvaluator::collectChildren2D(const AbstractNode &node)
 {
 	std::vector<const Polygon2d *> children;
-	for(const auto &item : this->visitedchildren[node.index()]) {
+	for(const auto &item : childrenOf(node)) {
 		const AbstractNode *chnode = item.first;
 		const shared_ptr<const Geometry> &chgeom = item.second;
 		if (chnode->modinst->isBackground()) continue;
@@ -228,22 +787,36 @@ std::vector<const class Polygon2d *> GeometryEvaluator::collectChildren2D(const
 }
 
 /*!
-	Since we can generate both Nef and non-Nef geometry, we need to insert it into
-	the appropriate cache.
-	This method inserts the geometry into the appropriate cache if it's not already cached.
+	Starts measuring the evaluation time of the given node. The time is
+	recorded in addToParent() and passed on to the caches, which use it
+	to decide which entries are most expensive to recompute.
+*/
+void GeometryEvaluator::startTimer(const AbstractNode &node)
+{
+	EvaluationBudget::instance()->check(node);
+	this->starttimes[node.index()] = Clock::now();
+}
+
+/*!
+	Inserts the geometry into the cache if no representation of the node is
+	cached yet.
 */
 void GeometryEvaluator::smartCacheInsert(const AbstractNode &node, 
 																				 const shared_ptr<const Geometry> &geom)
 {
 	const std::string &key = this->tree.getIdString(node);
+	if (!this->approximate.empty() && this->approximate.count(key)) return;
+	std::map<int, double>::const_iterator evaltime = this->evaltimes.find(node.index());
+	double seconds = (evaltime == this->evaltimes.end()) ? 0 : evaltime->second;
 
+	GeometryCache *cache = GeometryCache::instance();
 	shared_ptr<const CGAL_Nef_polyhedron> N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(geom);
 	if (N) {
-		if (!CGALCache::instance()->contains(key)) CGALCache::instance()->insert(key, N);
+		if (!cache->containsNef(key)) cache->insertNef(key, N, seconds);
 	}
 	else {
-		if (!GeometryCache::instance()->contains(key)) {
-			if (!GeometryCache::instance()->insert(key, geom)) {
+		if (!cache->contains(key)) {
+			if (!cache->insert(key, geom, seconds)) {
 				PRINT("WARNING: GeometryEvaluator: Node didn't fit into cache");
 			}
 		}
@@ -253,19 +826,23 @@ void GeometryEvaluator::smartCacheInsert(const AbstractNode &node,
 bool GeometryEvaluator::isSmartCached(const AbstractNode &node)
 {
 	const std::string &key = this->tree.getIdString(node);
-	return (GeometryCache::instance()->contains(key) ||
-					CGALCache::instance()->contains(key));
+	if (this->evaluated.find(key) != this->evaluated.end()) return true;
+	return GeometryCache::instance()->contains(key);
 }
 
 shared_ptr<const Geometry> GeometryEvaluator::smartCacheGet(const AbstractNode &node, bool preferNef)
 {
 	const std::string &key = this->tree.getIdString(node);
-	shared_ptr<const Geometry> geom;
-	bool hasgeom = GeometryCache::instance()->contains(key);
-	bool hascgal = CGALCache::instance()->contains(key);
-	if (hascgal && (preferNef || !hasgeom)) geom = CGALCache::instance()->get(key);
-	else if (hasgeom) geom = GeometryCache::instance()->get(key);
-	return geom;
+	auto it = this->evaluated.find(key);
+	if (it != this->evaluated.end()) {
+		const shared_ptr<const Geometry> geom = it->second;
+		// The result of a parallel task is picked up once, unless its subtree is repeated
+		if (!this->repeated.count(key)) this->evaluated.erase(it);
+		return geom;
+	}
+	GeometryCache *cache = GeometryCache::instance();
+	if (preferNef && cache->containsNef(key)) return cache->getNef(key);
+	return cache->get(key);
 }
 
 /*!
@@ -275,7 +852,7 @@ shared_ptr<const Geometry> GeometryEvaluator::smartCacheGet(const AbstractNode &
 Geometry::Geometries GeometryEvaluator::collectChildren3D(const AbstractNode &node)
 {
 	Geometry::Geometries children;
-	for(const auto &item : this->visitedchildren[node.index()]) {
+	for(const auto &item : childrenOf(node)) {
 		const AbstractNode *chnode = item.first;
 		const shared_ptr<const Geometry> &chgeom = item.second;
 		if (chnode->modinst->isBackground()) continue;
@@ -299,9 +876,10 @@ Geometry::Geometries GeometryEvaluator::collectChildren3D(const AbstractNode &no
 }
 
 /*!
-	
+	Applies the operation to the 2D children. A single child is passed on
+	as a const result.
 */
-Polygon2d *GeometryEvaluator::applyToChildren2D(const AbstractNode &node, OpenSCADOperator op)
+GeometryEvaluator::ResultObject GeometryEvaluator::applyToChildren2D(const AbstractNode &node, OpenSCADOperator op)
 {
 	if (op == OPENSCAD_MINKOWSKI) {
 		return applyMinkowski2D(node);
@@ -313,11 +891,13 @@ Polygon2d *GeometryEvaluator::applyToChildren2D(const AbstractNode &node, OpenSC
 	std::vector<const Polygon2d *> children = collectChildren2D(node);
 
 	if (children.empty()) {
-		return NULL;
+		return ResultObject();
 	}
 
 	if (children.size() == 1) {
-		return new Polygon2d(*children[0]); // Copy
+		for (const auto &item : childrenOf(node)) {
+			if (item.second.get() == children[0]) return ResultObject(item.second);
+		}
 	}
 
 	ClipperLib::ClipType clipType;
@@ -333,13 +913,79 @@ Polygon2d *GeometryEvaluator::applyToChildren2D(const AbstractNode &node, OpenSC
 		break;
 	default:
 		PRINTB("Error: Unknown boolean operation %d", int(op));
-		return NULL;
+		return ResultObject();
 		break;
 	}
 
 	return ClipperUtils::apply(children, clipType);
 }
 
+/*!
+	Adds the vertex and facet counts of \a geom to \a vertices and \a facets.
+	The facets of a Polygon2d are its outlines.
+*/
+static void count_geometry(const shared_ptr<const Geometry> &geom, size_t &vertices, size_t &facets)
+{
+	if (const PolySet *ps = dynamic_cast<const PolySet *>(geom.get())) {
+		vertices += ps->numVertices();
+		facets += ps->numPolygons();
+	}
+	else if (const CGAL_Nef_polyhedron *N = dynamic_cast<const CGAL_Nef_polyhedron *>(geom.get())) {
+		if (N->p3) {
+			vertices += N->p3->number_of_vertices();
+			facets += N->p3->number_of_facets();
+		}
+	}
+	else if (const Polygon2d *poly = dynamic_cast<const Polygon2d *>(geom.get())) {
+		for(const auto &o : poly->outlines()) vertices += o.vertices.size();
+		facets += poly->outlines().size();
+	}
+}
+
+static const char *representation(const shared_ptr<const Geometry> &geom)
+{
+	if (!geom) return "none";
+	if (dynamic_cast<const PolySet *>(geom.get())) return "PolySet";
+	if (dynamic_cast<const CGAL_Nef_polyhedron *>(geom.get())) return "Nef";
+	if (dynamic_cast<const Polygon2d *>(geom.get())) return "Polygon2d";
+	return "other";
+}
+
+/*!
+	Adds the evaluation of \a node to the trace. Nodes without a start time
+	came from the cache.
+*/
+void GeometryEvaluator::traceNode(const AbstractNode &node, const shared_ptr<const Geometry> &geom,
+																	const Clock::time_point *start, double seconds)
+{
+	EvaluationTrace::Event event;
+	event.operation = node.name();
+	event.name = event.operation;
+	const int line = node.modinst ? node.modinst->location().firstLine() : 0;
+	if (line > 0) event.name += str(boost::format(" (line %d)") % line);
+	event.keyhash = std::hash<std::string>()(this->tree.getIdString(node));
+	event.cached = !start;
+	event.start = start ? *start : Clock::now();
+	event.seconds = seconds;
+	event.representation = representation(geom);
+	for(const auto &item : childrenOf(node)) {
+		count_geometry(item.second, event.inputvertices, event.inputfacets);
+	}
+	count_geometry(geom, event.outputvertices, event.outputfacets);
+	EvaluationTrace::instance()->add(event);
+}
+
+/*!
+	Reports the evaluation of \a node for cost weighted progress.
+*/
+static void progress_node(const AbstractNode &node, const AbstractNode *parent,
+													const shared_ptr<const Geometry> &geom, double seconds)
+{
+	size_t vertices = 0, facets = 0;
+	count_geometry(geom, vertices, facets);
+	progress_evaluated(node, parent, seconds, facets);
+}
+
 /*!
 	Adds ourself to our parent's list of traversed children.
 	Call this for _every_ node which affects output during traversal.
@@ -353,14 +999,109 @@ void GeometryEvaluator::addToParent(const State &state,
 																		const AbstractNode &node, 
 																		const shared_ptr<const Geometry> &geom)
 {
-	this->visitedchildren.erase(node.index());
+	std::map<int, Clock::time_point>::iterator start = this->starttimes.find(node.index());
+	if (start != this->starttimes.end()) {
+		const Clock::time_point starttime = start->second;
+		const double seconds = std::chrono::duration<double>(Clock::now() - starttime).count();
+		this->evaltimes[node.index()] = seconds;
+		this->starttimes.erase(start);
+		EvaluationBudget::instance()->check(node, seconds);
+		if (Profiler::instance()->isEnabled() || Timing::instance()->isEnabled() || progress_report_f) {
+			double childseconds = 0;
+			for(const auto &child : node.children) {
+				auto evaltime = this->evaltimes.find(child->index());
+				if (evaltime != this->evaltimes.end()) childseconds += evaltime->second;
+			}
+			if (Profiler::instance()->isEnabled()) Profiler::instance()->addNode(node, seconds, childseconds);
+			if (Timing::instance()->isEnabled()) Timing::instance()->addNode(node, seconds, childseconds);
+			if (progress_report_f) progress_node(node, state.parent(), geom, seconds - childseconds);
+		}
+		if (EvaluationTrace::instance()->isEnabled()) traceNode(node, geom, &starttime, seconds);
+	}
+	else {
+		if (EvaluationTrace::instance()->isEnabled()) traceNode(node, geom, NULL, 0);
+		if (progress_report_f) progress_node(node, state.parent(), geom, 0);
+	}
+	childrenOf(node).clear();
+	if (!this->approximate.empty() && state.parent() && this->approximate.count(this->tree.getIdString(node))) {
+		this->approximate.insert(this->tree.getIdString(*state.parent()));
+	}
+	if (!this->repeated.empty()) {
+		const std::string &key = this->tree.getIdString(node);
+		if (this->repeated.find(key) != this->repeated.end()) this->evaluated[key] = geom;
+	}
+	if (this->resultcallback && state.parent() && state.parent() == this->tree.root()) {
+		// Finished top-level subtrees are cached right away, so they survive
+		// a cancelled evaluation
+		smartCacheInsert(node, geom);
+		this->resultcallback(node, geom);
+	}
 	if (state.parent()) {
-		this->visitedchildren[state.parent()->index()].push_back(std::make_pair(&node, geom));
+		childrenOf(*state.parent()).push_back(std::make_pair(&node, geom));
 	}
 	else {
 		// Root node
 		this->root = geom;
-		assert(this->visitedchildren.empty());
+		assert(std::all_of(this->visitedchildren.begin(), this->visitedchildren.end(),
+											 [](const Geometry::Geometries &children) { return children.empty(); }));
+	}
+}
+
+/*!
+	Returns true if the node's geometry is the union of its children's.
+*/
+static bool unitesChildren(const AbstractNode &node)
+{
+	if (const CsgOpNode *csg = dynamic_cast<const CsgOpNode *>(&node)) return csg->type == OPENSCAD_UNION;
+	return dynamic_cast<const GroupNode *>(&node) || dynamic_cast<const ColorNode *>(&node);
+}
+
+/*!
+	Returns true if the children of a 2D union can be passed on to the
+	parent instead of being united, since the parent unites them anyway.
+	Trees of 2D unions, and the subtracted parts of a 2D difference, are
+	then done by a single Clipper execution at the top.
+*/
+bool GeometryEvaluator::canFlatten2D(const State &state, const AbstractNode &node)
+{
+	const AbstractNode *parent = state.parent();
+	if (!parent || node.modinst->isBackground()) return false;
+	// Top-level results are reported and cached individually
+	if (this->resultcallback && parent == this->tree.root()) return false;
+	if (!this->repeated.empty() && this->repeated.count(this->tree.getIdString(node))) return false;
+
+	bool found = false;
+	for(const auto &item : childrenOf(node)) {
+		if (item.first->modinst->isBackground() || !item.second) continue;
+		if (item.second->getDimension() != 2) return false;
+		found = true;
+	}
+	if (!found) return false;
+
+	if (unitesChildren(*parent)) return true;
+	const CsgOpNode *csg = dynamic_cast<const CsgOpNode *>(parent);
+	if (csg && csg->type == OPENSCAD_DIFFERENCE) {
+		// Anything after the first object is subtracted as a union
+		for(const auto &item : childrenOf(*parent)) {
+			if (!item.first->modinst->isBackground() && item.second) return true;
+		}
+	}
+	return false;
+}
+
+/*!
+	Passes the children of the given node on to its parent, in place of
+	the node's own geometry. See canFlatten2D().
+*/
+void GeometryEvaluator::flattenToParent(const State &state, const AbstractNode &node)
+{
+	this->starttimes.erase(node.index());
+	const Geometry::Geometries &children = childrenOf(node);
+	Geometry::Geometries &siblings = childrenOf(*state.parent());
+	siblings.insert(siblings.end(), children.begin(), children.end());
+	childrenOf(node).clear();
+	if (!this->approximate.empty() && this->approximate.count(this->tree.getIdString(node))) {
+		this->approximate.insert(this->tree.getIdString(*state.parent()));
 	}
 }
 
@@ -371,12 +1112,17 @@ Response GeometryEvaluator::visit(State &state, const AbstractNode &node)
 {
 	if (state.isPrefix()) {
 		if (isSmartCached(node)) return PruneTraversal;
+		startTimer(node);
 		state.setPreferNef(true); // Improve quality of CSG by avoiding conversion loss
 	}
 	if (state.isPostfix()) {
 		shared_ptr<const class Geometry> geom;
 		if (!isSmartCached(node)) {
-			geom = applyToChildren(node, OPENSCAD_UNION).constptr();
+			if (canFlatten2D(state, node)) {
+				flattenToParent(state, node);
+				return ContinueTraversal;
+			}
+			geom = applyToChildren(node, OPENSCAD_UNION, true).constptr();
 		}
 		else {
 			geom = smartCacheGet(node, state.preferNef());
@@ -401,21 +1147,19 @@ Response GeometryEvaluator::visit(State &state, const RootNode &node)
 
 Response GeometryEvaluator::visit(State &state, const OffsetNode &node)
 {
-	if (state.isPrefix() && isSmartCached(node)) return PruneTraversal;
+	if (state.isPrefix()) {
+		if (isSmartCached(node)) return PruneTraversal;
+		startTimer(node);
+	}
 	if (state.isPostfix()) {
 		shared_ptr<const Geometry> geom;
 		if (!isSmartCached(node)) {
-			const Geometry *geometry = applyToChildren2D(node, OPENSCAD_UNION);
+			shared_ptr<const Geometry> geometry = applyToChildren2D(node, OPENSCAD_UNION).constptr();
 			if (geometry) {
-				const Polygon2d *polygon = dynamic_cast<const Polygon2d*>(geometry);
-				// ClipperLib documentation: The formula for the number of steps in a full
-				// circular arc is ... Pi / acos(1 - arc_tolerance / abs(delta))
-                double n = Calc::get_fragments_from_r(std::abs(node.delta), node.fn, node.fs, node.fa);
-				double arc_tolerance = std::abs(node.delta) * (1 - cos(M_PI / n));
-				const Polygon2d *result = ClipperUtils::applyOffset(*polygon, node.delta, node.join_type, node.miter_limit, arc_tolerance);
+				const Polygon2d *polygon = dynamic_cast<const Polygon2d*>(geometry.get());
+				const Polygon2d *result = applyOffset(node, *polygon);
 				assert(result);
 				geom.reset(result);
-				delete geometry;
 			}
 		}
 		else {
@@ -427,12 +1171,72 @@ Response GeometryEvaluator::visit(State &state, const OffsetNode &node)
 }
 
 /*!
-   RenderNodes just pass on convexity
+	Offsets each island of \a polygon on its own, in parallel, and unites
+	the results. Islands are cached by their outlines and the offset, so
+	those which are unchanged or repeated elsewhere, e.g. in the other
+	offsets of a rounding chain, are offset once.
+
+	With a tolerance, arcs deviate at most that much from the true outline.
+	Otherwise, like circles, they have the fragments of $fn, $fs and $fa.
+*/
+Polygon2d *GeometryEvaluator::applyOffset(const OffsetNode &node, const Polygon2d &polygon)
+{
+	double arc_tolerance = node.tolerance;
+	if (arc_tolerance <= 0) {
+		// ClipperLib documentation: The formula for the number of steps in a full
+		// circular arc is ... Pi / acos(1 - arc_tolerance / abs(delta))
+		const double n = Calc::get_fragments_from_r(std::abs(node.delta), node.fn, node.fs, node.fa);
+		arc_tolerance = std::abs(node.delta) * (1 - cos(M_PI / n));
+	}
+
+	ClipperLib::Paths paths = ClipperUtils::fromPolygon2d(polygon);
+	if (!polygon.isSanitized()) ClipperLib::PolyTreeToPaths(ClipperUtils::sanitize(paths), paths);
+	const std::vector<ClipperLib::Paths> islands = ClipperUtils::islands(ClipperUtils::sanitize(paths));
+	if (islands.size() < 2) {
+		return ClipperUtils::applyOffset(paths, node.delta, node.join_type, node.miter_limit, arc_tolerance);
+	}
+
+	const std::string params = str(boost::format("offset-island(delta = %.17g, join = %d, miter = %.17g, tolerance = %.17g, ") %
+																 node.delta % node.join_type % node.miter_limit % arc_tolerance);
+	std::vector<shared_ptr<const Polygon2d>> results(islands.size());
+	auto offsetIsland = [&](size_t i) {
+		Hash128 hash;
+		for(const auto &path : islands[i]) hash = hash128(path.data(), path.size() * sizeof(ClipperLib::IntPoint), hash.h1 ^ hash.h2);
+		const std::string key = params + hash.toString() + ")";
+		GeometryCache *cache = GeometryCache::instance();
+		results[i] = dynamic_pointer_cast<const Polygon2d>(cache->get(key));
+		if (results[i]) return;
+		const Clock::time_point start = Clock::now();
+		results[i].reset(ClipperUtils::applyOffset(islands[i], node.delta, node.join_type, node.miter_limit, arc_tolerance));
+		cache->insert(key, results[i], std::chrono::duration<double>(Clock::now() - start).count());
+	};
+	if (Feature::ExperimentalParallelEvaluation.is_enabled()) {
+		ThreadPool *pool = ThreadPool::instance();
+		ThreadPool::TaskGroup group;
+		for (size_t i = 0; i < islands.size(); i++) {
+			pool->run(group, [&offsetIsland, i]() { offsetIsland(i); });
+		}
+		pool->wait(group);
+	}
+	else {
+		for (size_t i = 0; i < islands.size(); i++) offsetIsland(i);
+	}
+
+	// Grown islands may overlap
+	std::vector<ClipperLib::Paths> pathsvector;
+	for(const auto &result : results) pathsvector.push_back(ClipperUtils::fromPolygon2d(*result));
+	return ClipperUtils::apply(pathsvector, ClipperLib::ctUnion);
+}
+
+/*!
+   RenderNodes just pass on convexity. Pinned results are kept cached for
+   the session.
 */
 Response GeometryEvaluator::visit(State &state, const RenderNode &node)
 {
 	if (state.isPrefix()) {
 		if (isSmartCached(node)) return PruneTraversal;
+		startTimer(node);
 		state.setPreferNef(true); // Improve quality of CSG by avoiding conversion loss
 	}
 	if (state.isPostfix()) {
@@ -441,26 +1245,61 @@ Response GeometryEvaluator::visit(State &state, const RenderNode &node)
 			ResultObject res = applyToChildren(node, OPENSCAD_UNION);
 
 			geom = res.constptr();
-			if (shared_ptr<const PolySet> ps = dynamic_pointer_cast<const PolySet>(geom)) {
-				// If we got a const object, make a copy
-				shared_ptr<PolySet> newps;
-				if (res.isConst()) newps.reset(new PolySet(*ps));
-				else newps = dynamic_pointer_cast<PolySet>(res.ptr());
-				newps->setConvexity(node.convexity);
-				geom = newps;
-			}
-			else if (shared_ptr<const CGAL_Nef_polyhedron> N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(geom)) {
-				// If we got a const object, make a copy
-				shared_ptr<CGAL_Nef_polyhedron> newN;
-				if (res.isConst()) newN.reset((CGAL_Nef_polyhedron*)N->copy());
-				else newN = dynamic_pointer_cast<CGAL_Nef_polyhedron>(res.ptr());
-				newN->setConvexity(node.convexity);
-				geom = newN;
+			if (dynamic_cast<const PolySet *>(geom.get()) || dynamic_cast<const CGAL_Nef_polyhedron *>(geom.get())) {
+				geom.reset();
+				shared_ptr<Geometry> editablegeom = editableResult(node, res);
+				editablegeom->setConvexity(node.convexity);
+				geom = editablegeom;
 			}
 		}
 		else {
 			geom = smartCacheGet(node, state.preferNef());
 		}
+		if (node.pin && geom) {
+			const std::string &key = this->tree.getIdString(node);
+			smartCacheInsert(node, geom);
+			GeometryCache::instance()->setPinned(key, true);
+			PersistentCache::instance()->pin(key);
+		}
+		addToParent(state, node, geom);
+	}
+	return ContinueTraversal;
+}
+
+/*!
+	Simplifies the mesh of the union of the children. Nef polyhedra are
+	converted to their mesh first, and 2D results are passed on as they are.
+*/
+Response GeometryEvaluator::visit(State &state, const SimplifyNode &node)
+{
+	if (state.isPrefix()) {
+		if (isSmartCached(node)) return PruneTraversal;
+		startTimer(node);
+	}
+	if (state.isPostfix()) {
+		shared_ptr<const Geometry> geom;
+		if (!isSmartCached(node)) {
+			ResultObject res = applyToChildren(node, OPENSCAD_UNION);
+			geom = res.constptr();
+			shared_ptr<const PolySet> ps = dynamic_pointer_cast<const PolySet>(geom);
+			if (shared_ptr<const CGAL_Nef_polyhedron> N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(geom)) {
+				if (!N->isEmpty()) {
+					shared_ptr<PolySet> mesh(new PolySet(3));
+					mesh->setConvexity(N->getConvexity());
+					if (CGALUtils::createPolySetFromNefPolyhedron3(*N->p3, *mesh)) {
+						PRINT("WARNING: simplify() failed to convert the Nef polyhedron to a mesh");
+					}
+					else ps = mesh;
+				}
+			}
+			if (ps && ps->getDimension() == 3 && !ps->isEmpty()) {
+				geom.reset(PolysetUtils::simplify(*ps, node.error, node.faces));
+				PRINTDB("simplify(): %d to %d faces", ps->numPolygons() % dynamic_pointer_cast<const PolySet>(geom)->numPolygons());
+			}
+		}
+		else {
+			geom = smartCacheGet(node, false);
+		}
 		addToParent(state, node, geom);
 	}
 	return ContinueTraversal;
@@ -472,21 +1311,44 @@ Response GeometryEvaluator::visit(State &state, const RenderNode &node)
 	input: None
 	output: PolySet or Polygon2d
 */
+static shared_ptr<const Geometry> createLeafGeometry(const LeafNode &node)
+{
+	const Geometry *geometry = node.createGeometry();
+	assert(geometry);
+	if (const Polygon2d *polygon = dynamic_cast<const Polygon2d*>(geometry)) {
+		if (!polygon->isSanitized()) {
+			Polygon2d *p = ClipperUtils::sanitize(*polygon);
+			delete geometry;
+			geometry = p;
+		}
+	}
+	return shared_ptr<const Geometry>(geometry);
+}
+
 Response GeometryEvaluator::visit(State &state, const LeafNode &node)
 {
 	if (state.isPrefix()) {
 		shared_ptr<const Geometry> geom;
 		if (!isSmartCached(node)) {
-			const Geometry *geometry = node.createGeometry();
-            assert(geometry);
-			if (const Polygon2d *polygon = dynamic_cast<const Polygon2d*>(geometry)) {
-				if (!polygon->isSanitized()) {
-					Polygon2d *p = ClipperUtils::sanitize(*polygon);
-					delete geometry;
-					geometry = p;
-				}
-			}
-            geom.reset(geometry);
+			startTimer(node);
+			geom = createLeafGeometry(node);
+		}
+		else geom = smartCacheGet(node, state.preferNef());
+		addToParent(state, node, geom);
+	}
+	return PruneTraversal;
+}
+
+/*!
+	Imported files are looked up by content in ImportCache before being read.
+*/
+Response GeometryEvaluator::visit(State &state, const ImportNode &node)
+{
+	if (state.isPrefix()) {
+		shared_ptr<const Geometry> geom;
+		if (!isSmartCached(node)) {
+			startTimer(node);
+			geom = ImportCache::instance()->get(node, [&node]() { return createLeafGeometry(node); });
 		}
 		else geom = smartCacheGet(node, state.preferNef());
 		addToParent(state, node, geom);
@@ -499,6 +1361,7 @@ Response GeometryEvaluator::visit(State &state, const TextNode &node)
 	if (state.isPrefix()) {
 		shared_ptr<const Geometry> geom;
 		if (!isSmartCached(node)) {
+			startTimer(node);
 			std::vector<const Geometry *> geometrylist = node.createGeometryList();
 			std::vector<const Polygon2d *> polygonlist;
 			for(const auto &geometry : geometrylist) {
@@ -525,12 +1388,17 @@ Response GeometryEvaluator::visit(State &state, const CsgOpNode &node)
 {
 	if (state.isPrefix()) {
 		if (isSmartCached(node)) return PruneTraversal;
+		startTimer(node);
 		state.setPreferNef(true); // Improve quality of CSG by avoiding conversion loss
 	}
 	if (state.isPostfix()) {
 		shared_ptr<const Geometry> geom;
 		if (!isSmartCached(node)) {
-			geom = applyToChildren(node, node.type).constptr();
+			if (node.type == OPENSCAD_UNION && canFlatten2D(state, node)) {
+				flattenToParent(state, node);
+				return ContinueTraversal;
+			}
+			geom = applyToChildren(node, node.type, true).constptr();
 		}
 		else {
 			geom = smartCacheGet(node, state.preferNef());
@@ -540,6 +1408,49 @@ Response GeometryEvaluator::visit(State &state, const CsgOpNode &node)
 	return ContinueTraversal;
 }
 
+/*!
+	Returns true if all entries of the linear part of \a matrix have few
+	significant bits, like the 0 and 1 of rotations by multiples of 90
+	degrees, mirrors and scales by small integers or powers of two. Such
+	transforms don't make the exact numbers of a Nef polyhedron grow.
+*/
+static bool hasShortEntries(const Transform3d &matrix)
+{
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 3; j++) {
+			int exponent;
+			const double mantissa = std::frexp(matrix(i, j), &exponent);
+			if (std::ldexp(mantissa, 8) != std::floor(std::ldexp(mantissa, 8)) || std::abs(exponent) > 16) return false;
+		}
+	}
+	return true;
+}
+
+/*!
+	Returns a mesh to transform instead of \a N, the union of the children
+	of \a node, or NULL if \a N should be transformed exactly.
+
+	Transforming exact numbers is expensive, and most transforms make them
+	grow, slowing down all later Boolean operations. If the mesh of a single
+	child is cached, that is used. Otherwise, if \a convert is set, a
+	manifold \a N is converted. The mesh is converted back to a Nef
+	polyhedron only when a Boolean operation needs it.
+*/
+shared_ptr<PolySet> GeometryEvaluator::transformableMesh(const AbstractNode &node, const shared_ptr<const CGAL_Nef_polyhedron> &N, bool convert)
+{
+	const Geometry::Geometries &children = childrenOf(node);
+	if (children.size() == 1 && children.front().second == N) {
+		const std::string &key = this->tree.getIdString(*children.front().first);
+		shared_ptr<const PolySet> mesh = dynamic_pointer_cast<const PolySet>(GeometryCache::instance()->get(key));
+		if (mesh) return shared_ptr<PolySet>(new PolySet(*mesh));
+	}
+	if (!convert || N->isEmpty() || !N->p3->is_simple()) return shared_ptr<PolySet>();
+	shared_ptr<PolySet> ps(new PolySet(3));
+	ps->setConvexity(N->getConvexity());
+	if (CGALUtils::createPolySetFromNefPolyhedron3(*N->p3, *ps)) return shared_ptr<PolySet>();
+	return ps;
+}
+
 /*!
 	input: List of 2D or 3D objects (not mixed)
 	output: Polygon2d or 3D PolySet
@@ -549,7 +1460,10 @@ Response GeometryEvaluator::visit(State &state, const CsgOpNode &node)
  */			
 Response GeometryEvaluator::visit(State &state, const TransformNode &node)
 {
-	if (state.isPrefix() && isSmartCached(node)) return PruneTraversal;
+	if (state.isPrefix()) {
+		if (isSmartCached(node)) return PruneTraversal;
+		startTimer(node);
+	}
 	if (state.isPostfix()) {
 		shared_ptr<const class Geometry> geom;
 		if (!isSmartCached(node)) {
@@ -562,14 +1476,11 @@ Response GeometryEvaluator::visit(State &state, const TransformNode &node)
 				ResultObject res = applyToChildren(node, OPENSCAD_UNION);
 				if ((geom = res.constptr())) {
 					if (geom->getDimension() == 2) {
-						shared_ptr<const Polygon2d> polygons = dynamic_pointer_cast<const Polygon2d>(geom);
-						assert(polygons);
-						
-						// If we got a const object, make a copy
-						shared_ptr<Polygon2d> newpoly;
-						if (res.isConst()) newpoly.reset(new Polygon2d(*polygons));
-						else newpoly = dynamic_pointer_cast<Polygon2d>(res.ptr());
-						
+						assert(dynamic_cast<const Polygon2d *>(geom.get()));
+						geom.reset();
+						shared_ptr<Polygon2d> newpoly = static_pointer_cast<Polygon2d>(editableResult(node, res));
+						geom = newpoly;
+
 						Transform2d mat2;
 						mat2.matrix() << 
 							node.matrix(0,0), node.matrix(0,1), node.matrix(0,3),
@@ -584,24 +1495,28 @@ Response GeometryEvaluator::visit(State &state, const TransformNode &node)
 						}
 					}
 					else if (geom->getDimension() == 3) {
-						shared_ptr<const PolySet> ps = dynamic_pointer_cast<const PolySet>(geom);
-						if (ps) {
-							// If we got a const object, make a copy
-							shared_ptr<PolySet> newps;
-							if (res.isConst()) newps.reset(new PolySet(*ps));
-							else newps = dynamic_pointer_cast<PolySet>(res.ptr());
+						if (dynamic_cast<const PolySet *>(geom.get())) {
+							geom.reset();
+							shared_ptr<PolySet> newps = static_pointer_cast<PolySet>(editableResult(node, res));
 							newps->transform(node.matrix);
 							geom = newps;
 						}
 						else {
 							shared_ptr<const CGAL_Nef_polyhedron> N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(geom);
 							assert(N);
-							// If we got a const object, make a copy
-							shared_ptr<CGAL_Nef_polyhedron> newN;
-							if (res.isConst()) newN.reset((CGAL_Nef_polyhedron*)N->copy());
-							else newN = dynamic_pointer_cast<CGAL_Nef_polyhedron>(res.ptr());
-							newN->transform(node.matrix);
-							geom = newN;
+							// Rotations by arbitrary angles make the exact numbers grow
+							shared_ptr<PolySet> newps = transformableMesh(node, N, !hasShortEntries(node.matrix));
+							if (newps) {
+								newps->transform(node.matrix);
+								geom = newps;
+							}
+							else {
+								N.reset();
+								geom.reset();
+								shared_ptr<CGAL_Nef_polyhedron> newN = static_pointer_cast<CGAL_Nef_polyhedron>(editableResult(node, res));
+								newN->transform(node.matrix);
+								geom = newN;
+							}
 						}
 					}
 				}
@@ -617,64 +1532,101 @@ Response GeometryEvaluator::visit(State &state, const TransformNode &node)
 
 static void translate_PolySet(PolySet &ps, const Vector3d &translation)
 {
-	for(auto &p : ps.polygons) {
-		for(auto &v : p) {
-			v += translation;
-		}
-	}
+	ps.transform(Transform3d(Eigen::Translation3d(translation)));
 }
 
-static void add_slice(PolySet *ps, const Polygon2d &poly, 
-											double rot1, double rot2, 
-											double h1, double h2, 
-											const Vector2d &scale1,
-											const Vector2d &scale2)
+/*!
+	Adds the side walls of a linear extrusion to the PolySet.
+
+	The outline vertices are transformed once per slice boundary, and the
+	walls are built as one indexed triangle mesh. With parallel evaluation
+	enabled, the slice boundaries are computed on the thread pool.
+*/
+static void add_slices(PolySet *ps, const Polygon2d &poly, const LinearExtrudeNode &node,
+											 size_t slices, double h1, double h2)
 {
-	Eigen::Affine2d trans1(Eigen::Scaling(scale1) * Eigen::Rotation2D<double>(-rot1*M_PI/180));
-	Eigen::Affine2d trans2(Eigen::Scaling(scale2) * Eigen::Rotation2D<double>(-rot2*M_PI/180));
-	
-	bool splitfirst = sin((rot1 - rot2)*M_PI/180) > 0.0;
-	for(const auto &o : poly.outlines()) {
-		Vector2d prev1 = trans1 * o.vertices[0];
-		Vector2d prev2 = trans2 * o.vertices[0];
-		for (size_t i=1;i<=o.vertices.size();i++) {
-			Vector2d curr1 = trans1 * o.vertices[i % o.vertices.size()];
-			Vector2d curr2 = trans2 * o.vertices[i % o.vertices.size()];
-			ps->append_poly();
-			
-			// Make sure to split negative outlines correctly
-			if (splitfirst xor !o.positive) {
-				ps->insert_vertex(prev1[0], prev1[1], h1);
-				ps->insert_vertex(curr2[0], curr2[1], h2);
-				ps->insert_vertex(curr1[0], curr1[1], h1);
-				if (scale2[0] > 0 || scale2[1] > 0) {
-					ps->append_poly();
-					ps->insert_vertex(curr2[0], curr2[1], h2);
-					ps->insert_vertex(prev1[0], prev1[1], h1);
-					ps->insert_vertex(prev2[0], prev2[1], h2);
+	size_t ringsize = 0;
+	for(const auto &o : poly.outlines()) ringsize += o.vertices.size();
+	if (slices == 0 || ringsize == 0) return;
+
+	auto rotation = [&node, slices](size_t j) { return node.twist*j / slices; };
+	auto scale = [&node, slices](size_t j) {
+		return Vector2d(1 - (1-node.scale_x)*j / slices, 1 - (1-node.scale_y)*j / slices);
+	};
+
+	// Vertex k of slice boundary j has index j*ringsize + k
+	std::vector<Vector3d> vertices((slices + 1) * ringsize);
+	auto addRings = [&](size_t first, size_t last) {
+		for (size_t j=first;j<last;j++) {
+			const Eigen::Affine2d trans(Eigen::Scaling(scale(j)) * Eigen::Rotation2D<double>(-rotation(j)*M_PI/180));
+			const double height = h1 + (h2-h1)*j / slices;
+			Vector3d *v = &vertices[j * ringsize];
+			for(const auto &o : poly.outlines()) {
+				for(const auto &p : o.vertices) {
+					const Vector2d t = trans * p;
+					*v++ = Vector3d(t[0], t[1], height);
 				}
 			}
-			else {
-				ps->insert_vertex(prev1[0], prev1[1], h1);
-				ps->insert_vertex(prev2[0], prev2[1], h2);
-				ps->insert_vertex(curr1[0], curr1[1], h1);
-				if (scale2[0] > 0 || scale2[1] > 0) {
-					ps->append_poly();
-					ps->insert_vertex(prev2[0], prev2[1], h2);
-					ps->insert_vertex(curr2[0], curr2[1], h2);
-					ps->insert_vertex(curr1[0], curr1[1], h1);
+		}
+	};
+	const size_t batchsize = std::max(size_t(1), size_t(10000) / ringsize);
+	if (slices + 1 > batchsize && Feature::ExperimentalParallelEvaluation.is_enabled()) {
+		ThreadPool *pool = ThreadPool::instance();
+		ThreadPool::TaskGroup group;
+		for (size_t j=0;j<=slices;j+=batchsize) {
+			pool->run(group, [&addRings, j, batchsize, slices]() { addRings(j, std::min(j + batchsize, slices + 1)); });
+		}
+		pool->wait(group);
+	}
+	else {
+		addRings(0, slices + 1);
+	}
+
+	std::vector<IndexedTriangle> triangles;
+	triangles.reserve(2 * slices * ringsize);
+	for (size_t j=0;j<slices;j++) {
+		const bool splitfirst = sin((rotation(j) - rotation(j+1))*M_PI/180) > 0.0;
+		const Vector2d scale2 = scale(j+1);
+		const bool hastop = scale2[0] > 0 || scale2[1] > 0;
+		int base = int(j * ringsize);
+		for(const auto &o : poly.outlines()) {
+			const int n = int(o.vertices.size());
+			for (int i=1;i<=n;i++) {
+				const int prev1 = base + i-1, curr1 = base + i%n;
+				const int prev2 = prev1 + int(ringsize), curr2 = curr1 + int(ringsize);
+				// Make sure to split negative outlines correctly
+				if (splitfirst xor !o.positive) {
+					triangles.push_back(IndexedTriangle(curr1, curr2, prev1));
+					if (hastop) triangles.push_back(IndexedTriangle(prev2, prev1, curr2));
+				}
+				else {
+					triangles.push_back(IndexedTriangle(curr1, prev2, prev1));
+					if (hastop) triangles.push_back(IndexedTriangle(curr1, curr2, prev2));
 				}
 			}
-			prev1 = curr1;
-			prev2 = curr2;
+			base += n;
 		}
 	}
+	ps->append(vertices, triangles);
 }
 
 /*!
-	Input to extrude should be sanitized. This means non-intersecting, correct winding order
-	etc., the input coming from a library like Clipper.
+	Returns the number of slices for a twisted extrusion without a given
+	slice count: as many as needed for the outermost vertex to follow its
+	helix as closely as $fn, $fs and $fa approximate a circle of the same
+	radius. The twist rate is constant, so the slices are evenly spaced.
 */
+static size_t autoSlices(const LinearExtrudeNode &node, const Polygon2d &poly)
+{
+	double r = 0;
+	for(const auto &o : poly.outlines()) {
+		for(const auto &v : o.vertices) r = std::max(r, v.norm());
+	}
+	r *= std::max(1.0, std::max(node.scale_x, node.scale_y));
+	const double fragments = Calc::get_fragments_from_r(r, node.fn, node.fs, node.fa);
+	return std::max(size_t(1), size_t(std::ceil(fragments * std::fabs(node.twist) / 360)));
+}
+
 static Geometry *extrudePolygon(const LinearExtrudeNode &node, const Polygon2d &poly)
 {
 	bool cvx = poly.is_convex();
@@ -695,9 +1647,7 @@ static Geometry *extrudePolygon(const LinearExtrudeNode &node, const Polygon2d &
 	PolySet *ps_bottom = poly.tessellate(); // bottom
 	
 	// Flip vertex ordering for bottom polygon
-	for(auto &p : ps_bottom->polygons) {
-		std::reverse(p.begin(), p.end());
-	}
+	ps_bottom->flipFaces();
 	translate_PolySet(*ps_bottom, Vector3d(0,0,h1));
 
 	ps->append(*ps_bottom);
@@ -712,19 +1662,7 @@ static Geometry *extrudePolygon(const LinearExtrudeNode &node, const Polygon2d &
 		ps->append(*ps_top);
 		delete ps_top;
 	}
-    size_t slices = node.slices;
-
-	for (unsigned int j = 0; j < slices; j++) {
-		double rot1 = node.twist*j / slices;
-		double rot2 = node.twist*(j+1) / slices;
-		double height1 = h1 + (h2-h1)*j / slices;
-		double height2 = h1 + (h2-h1)*(j+1) / slices;
-		Vector2d scale1(1 - (1-node.scale_x)*j / slices,
-										1 - (1-node.scale_y)*j / slices);
-		Vector2d scale2(1 - (1-node.scale_x)*(j+1) / slices,
-										1 - (1-node.scale_y)*(j+1) / slices);
-		add_slice(ps, poly, rot1, rot2, height1, height2, scale1, scale2);
-	}
+	add_slices(ps, poly, node, node.auto_slices ? autoSlices(node, poly) : size_t(node.slices), h1, h2);
 
 	return ps;
 }
@@ -738,27 +1676,29 @@ static Geometry *extrudePolygon(const LinearExtrudeNode &node, const Polygon2d &
  */			
 Response GeometryEvaluator::visit(State &state, const LinearExtrudeNode &node)
 {
-	if (state.isPrefix() && isSmartCached(node)) return PruneTraversal;
+	if (state.isPrefix()) {
+		if (isSmartCached(node)) return PruneTraversal;
+		startTimer(node);
+	}
 	if (state.isPostfix()) {
 		shared_ptr<const Geometry> geom;
 		if (!isSmartCached(node)) {
-			const Geometry *geometry = NULL;
+			shared_ptr<const Geometry> geometry;
 			if (!node.filename.empty()) {
 				DxfData dxf(node.fn, node.fs, node.fa, node.filename, node.layername, node.origin_x, node.origin_y, node.scale_x);
 
 				Polygon2d *p2d = dxf.toPolygon2d();
-				if (p2d) geometry = ClipperUtils::sanitize(*p2d);
+				if (p2d) geometry.reset(ClipperUtils::sanitize(*p2d));
 				delete p2d;
 			}
 			else {
-				geometry = applyToChildren2D(node, OPENSCAD_UNION);
+				geometry = applyToChildren2D(node, OPENSCAD_UNION).constptr();
 			}
 			if (geometry) {
-				const Polygon2d *polygons = dynamic_cast<const Polygon2d*>(geometry);
+				const Polygon2d *polygons = dynamic_cast<const Polygon2d*>(geometry.get());
 				Geometry *extruded = extrudePolygon(node, *polygons);
 				assert(extruded);
 				geom.reset(extruded);
-				delete geometry;
 			}
 		}
 		else {
@@ -769,42 +1709,64 @@ Response GeometryEvaluator::visit(State &state, const LinearExtrudeNode &node)
 	return ContinueTraversal;
 }
 
-static void fill_ring(std::vector<Vector3d> &ring, const Outline2d &o, double a, bool flip)
+/*!
+	Adds the rings of a rotational extrusion to the PolySet. The sine and
+	cosine of each ring's angle are computed once, and the outlines are
+	swept into one indexed triangle mesh.
+*/
+static void add_rings(PolySet *ps, const Polygon2d &poly, const RotateExtrudeNode &node,
+											int fragments, bool flip)
 {
-	if (flip) {
-		unsigned int l = o.vertices.size()-1;
-		for (unsigned int i=0 ;i<o.vertices.size();i++) {
-			ring[i][0] = o.vertices[l-i][0] * sin(a);
-			ring[i][1] = o.vertices[l-i][0] * cos(a);
-			ring[i][2] = o.vertices[l-i][1];
+	// A full revolution ends on its first ring
+	const bool closed = node.angle == 360;
+	const int numrings = closed ? fragments : fragments + 1;
+	std::vector<double> sines(numrings), cosines(numrings);
+	for (int j=0;j<numrings;j++) {
+		double a;
+		if (j == 0)
+			a = closed ? -M_PI/2 : M_PI/2;
+		else if (closed)
+			a = -M_PI/2 + (j%fragments*2*M_PI) / fragments; // start on the -X axis, for legacy support
+		else
+			a = M_PI/2 - j*(node.angle*M_PI/180) / fragments; // start on the X axis
+		sines[j] = sin(a);
+		cosines[j] = cos(a);
+	}
+
+	size_t ringsize = 0;
+	for(const auto &o : poly.outlines()) ringsize += o.vertices.size();
+
+	// Vertex k of ring j has index j*ringsize + k
+	std::vector<Vector3d> vertices(numrings * ringsize);
+	for (int j=0;j<numrings;j++) {
+		Vector3d *v = &vertices[j * ringsize];
+		for(const auto &o : poly.outlines()) {
+			const size_t n = o.vertices.size();
+			for (size_t i=0;i<n;i++) {
+				const Vector2d &p = o.vertices[flip ? n-1-i : i];
+				*v++ = Vector3d(p[0] * sines[j], p[0] * cosines[j], p[1]);
+			}
 		}
-	} else {
-		for (unsigned int i=0 ;i<o.vertices.size();i++) {
-			ring[i][0] = o.vertices[i][0] * sin(a);
-			ring[i][1] = o.vertices[i][0] * cos(a);
-			ring[i][2] = o.vertices[i][1];
+	}
+
+	std::vector<IndexedTriangle> triangles;
+	triangles.reserve(2 * fragments * ringsize);
+	int base = 0;
+	for(const auto &o : poly.outlines()) {
+		const int n = int(o.vertices.size());
+		for (int j=0;j<fragments;j++) {
+			const int ring1 = j * int(ringsize) + base;
+			const int ring2 = (j+1)%numrings * int(ringsize) + base;
+			for (int i=0;i<n;i++) {
+				triangles.push_back(IndexedTriangle(ring1 + (i+1)%n, ring2 + (i+1)%n, ring1 + i));
+				triangles.push_back(IndexedTriangle(ring2 + (i+1)%n, ring2 + i, ring1 + i));
+			}
 		}
+		base += n;
 	}
+	ps->append(vertices, triangles);
 }
 
-/*!
-	Input to extrude should be clean. This means non-intersecting, correct winding order
-	etc., the input coming from a library like Clipper.
-
-	FIXME: We should handle some common corner cases better:
-  o 2D polygon having an edge being on the Y axis:
-	  In this case, we don't need to generate geometry involving this edge as it
-		will be an internal edge.
-  o 2D polygon having a vertex touching the Y axis:
-    This is more complex as the resulting geometry will (may?) be nonmanifold.
-		In any case, the previous case is a specialization of this, so the following
-		should be handled for both cases:
-		Since the ring associated with this vertex will have a radius of zero, it will
-		collapse to one vertex. Any quad using this ring will be collapsed to a triangle.
-
-	Currently, we generate a lot of zero-area triangles
-
-*/
 static Geometry *rotatePolygon(const RotateExtrudeNode &node, const Polygon2d &poly)
 {
 	if (node.angle == 0) return NULL; 
@@ -836,52 +1798,19 @@ static Geometry *rotatePolygon(const RotateExtrudeNode &node, const Polygon2d &p
 		Transform3d rot(Eigen::AngleAxisd(M_PI/2, Vector3d::UnitX()));
 		ps_start->transform(rot);
 		// Flip vertex ordering
-		if (!flip_faces) {
-			for(auto &p : ps_start->polygons) {
-				std::reverse(p.begin(), p.end());
-			}
-		}
+		if (!flip_faces) ps_start->flipFaces();
 		ps->append(*ps_start);
 		delete ps_start;
 
 		PolySet *ps_end = poly.tessellate();
 		Transform3d rot2(Eigen::AngleAxisd(node.angle*M_PI/180, Vector3d::UnitZ()) * Eigen::AngleAxisd(M_PI/2, Vector3d::UnitX()));
 		ps_end->transform(rot2);
-		if (flip_faces) {
-			for(auto &p : ps_end->polygons) {
-				std::reverse(p.begin(), p.end());
-			}
-		}
+		if (flip_faces) ps_end->flipFaces();
 		ps->append(*ps_end);
 		delete ps_end;
 	}
 
-	for(const auto &o : poly.outlines()) {
-		std::vector<Vector3d> rings[2];
-		rings[0].resize(o.vertices.size());
-		rings[1].resize(o.vertices.size());
-
-		fill_ring(rings[0], o, (node.angle == 360) ? -M_PI/2 : M_PI/2, flip_faces); // first ring
-		for (int j = 0; j < fragments; j++) {
-			double a;
-			if (node.angle == 360)
-			    a = -M_PI/2 + ((j+1)%fragments*2*M_PI) / fragments; // start on the -X axis, for legacy support
-			else
-				a = M_PI/2 - (j+1)*(node.angle*M_PI/180) / fragments; // start on the X axis
-			fill_ring(rings[(j+1)%2], o, a, flip_faces);
-
-			for (size_t i=0;i<o.vertices.size();i++) {
-				ps->append_poly();
-				ps->insert_vertex(rings[j%2][i]);
-				ps->insert_vertex(rings[(j+1)%2][(i+1)%o.vertices.size()]);
-				ps->insert_vertex(rings[j%2][(i+1)%o.vertices.size()]);
-				ps->append_poly();
-				ps->insert_vertex(rings[j%2][i]);
-				ps->insert_vertex(rings[(j+1)%2][i]);
-				ps->insert_vertex(rings[(j+1)%2][(i+1)%o.vertices.size()]);
-			}
-		}
-	}
+	add_rings(ps, poly, node, fragments, flip_faces);
 	
 	return ps;
 }
@@ -895,25 +1824,27 @@ static Geometry *rotatePolygon(const RotateExtrudeNode &node, const Polygon2d &p
  */			
 Response GeometryEvaluator::visit(State &state, const RotateExtrudeNode &node)
 {
-	if (state.isPrefix() && isSmartCached(node)) return PruneTraversal;
+	if (state.isPrefix()) {
+		if (isSmartCached(node)) return PruneTraversal;
+		startTimer(node);
+	}
 	if (state.isPostfix()) {
 		shared_ptr<const Geometry> geom;
 		if (!isSmartCached(node)) {
-			const Geometry *geometry = NULL;
+			shared_ptr<const Geometry> geometry;
 			if (!node.filename.empty()) {
 				DxfData dxf(node.fn, node.fs, node.fa, node.filename, node.layername, node.origin_x, node.origin_y, node.scale);
 				Polygon2d *p2d = dxf.toPolygon2d();
-				if (p2d) geometry = ClipperUtils::sanitize(*p2d);
+				if (p2d) geometry.reset(ClipperUtils::sanitize(*p2d));
 				delete p2d;
 			}
 			else {
-				geometry = applyToChildren2D(node, OPENSCAD_UNION);
+				geometry = applyToChildren2D(node, OPENSCAD_UNION).constptr();
 			}
 			if (geometry) {
-				const Polygon2d *polygons = dynamic_cast<const Polygon2d*>(geometry);
+				const Polygon2d *polygons = dynamic_cast<const Polygon2d*>(geometry.get());
 				Geometry *rotated = rotatePolygon(node, *polygons);
 				geom.reset(rotated);
-				delete geometry;
 			}
 		}
 		else {
@@ -942,21 +1873,22 @@ Response GeometryEvaluator::visit(State &state, const AbstractPolyNode &node)
  */			
 Response GeometryEvaluator::visit(State &state, const ProjectionNode &node)
 {
-	if (state.isPrefix() && isSmartCached(node)) return PruneTraversal;
+	if (state.isPrefix()) {
+		if (isSmartCached(node)) return PruneTraversal;
+		startTimer(node);
+	}
 	if (state.isPostfix()) {
 		shared_ptr<const class Geometry> geom;
 		if (!isSmartCached(node)) {
 
 			if (!node.cut_mode) {
 				ClipperLib::Clipper sumclipper;
-				for(const auto &item : this->visitedchildren[node.index()]) {
+				for(const auto &item : childrenOf(node)) {
 					const AbstractNode *chnode = item.first;
 					const shared_ptr<const Geometry> &chgeom = item.second;
 					// FIXME: Don't use deep access to modinst members
 					if (chnode->modinst->isBackground()) continue;
 
-					const Polygon2d *poly = NULL;
-
 // CGAL version of Geometry projection
 // Causes crashes in createNefPolyhedronFromGeometry() for this model:
 // projection(cut=false) {
@@ -967,6 +1899,7 @@ Response GeometryEvaluator::visit(State &state, const ProjectionNode &node)
 //    }
 // }
 #if 0
+					const Polygon2d *poly = NULL;
 					shared_ptr<const PolySet> chPS = dynamic_pointer_cast<const PolySet>(chgeom);
 					const PolySet *ps2d = NULL;
 					shared_ptr<const CGAL_Nef_polyhedron> chN = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(chgeom);
@@ -997,30 +1930,42 @@ Response GeometryEvaluator::visit(State &state, const ProjectionNode &node)
 							}
 						}
 					}
-					if (chPS) poly = PolysetUtils::project(*chPS);
-#endif
-
-					if (poly) {
-						ClipperLib::Paths result = ClipperUtils::fromPolygon2d(*poly);
-						// Using NonZero ensures that we don't create holes from polygons sharing
-						// edges since we're unioning a mesh
-						result = ClipperUtils::process(result, 
-																					 ClipperLib::ctUnion, 
-																					 ClipperLib::pftNonZero);
+					if (chPS) {
 						// Add correctly winded polygons to the main clipper
-						sumclipper.AddPaths(result, ClipperLib::ptSubject, true);
+						sumclipper.AddPaths(ClipperUtils::project(*chPS), ClipperLib::ptSubject, true);
 					}
-
-					delete poly;
+#endif
 				}
 				ClipperLib::PolyTree sumresult;
 				// This is key - without StrictlySimple, we tend to get self-intersecting results
 				sumclipper.StrictlySimple(true);
+				OperationCounters::count(OperationCounters::CLIPPER_EXECUTIONS);
 				sumclipper.Execute(ClipperLib::ctUnion, sumresult, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
 				if (sumresult.Total() > 0) geom.reset(ClipperUtils::toPolygon2d(sumresult));
 			}
 			else {
-				shared_ptr<const Geometry> newgeom = applyToChildren3D(node, OPENSCAD_UNION).constptr();
+				// Children away from the plane don't need to be converted to Nef polyhedra
+				Geometry::Geometries &children = childrenOf(node);
+				bool culled = false;
+				for (auto it = children.begin(); it != children.end();) {
+					if (it->second && !touchesCutPlane(*it->second)) {
+						it = children.erase(it);
+						culled = true;
+					}
+					else ++it;
+				}
+				const Geometry::Geometries children3d = collectChildren3D(node);
+				Polygon2d *slice = sliceMeshes(children3d);
+				shared_ptr<const Geometry> newgeom;
+				if (slice) {
+					slice->setConvexity(node.convexity);
+					geom.reset(slice);
+				}
+				else {
+					newgeom = applyToChildren3D(children3d, OPENSCAD_UNION).constptr();
+					// Same as for cutting a solid away from the plane
+					if (!newgeom && culled) PRINT("WARNING: projection() failed.");
+				}
 				if (newgeom) {
 					shared_ptr<const CGAL_Nef_polyhedron> Nptr = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(newgeom);
 					if (!Nptr) {
@@ -1052,7 +1997,10 @@ Response GeometryEvaluator::visit(State &state, const ProjectionNode &node)
  */			
 Response GeometryEvaluator::visit(State &state, const CgaladvNode &node)
 {
-	if (state.isPrefix() && isSmartCached(node)) return PruneTraversal;
+	if (state.isPrefix()) {
+		if (isSmartCached(node)) return PruneTraversal;
+		startTimer(node);
+	}
 	if (state.isPostfix()) {
 		shared_ptr<const Geometry> geom;
 		if (!isSmartCached(node)) {
@@ -1062,10 +2010,8 @@ Response GeometryEvaluator::visit(State &state, const CgaladvNode &node)
 				geom = res.constptr();
 				// If we added convexity, we need to pass it on
 				if (geom && geom->getConvexity() != node.convexity) {
-					shared_ptr<Geometry> editablegeom;
-					// If we got a const object, make a copy
-					if (res.isConst()) editablegeom.reset(geom->copy());
-					else editablegeom = res.ptr();
+					geom.reset();
+					shared_ptr<Geometry> editablegeom = editableResult(node, res);
 					geom = editablegeom;
 					editablegeom->setConvexity(node.convexity);
 				}
@@ -1080,9 +2026,15 @@ Response GeometryEvaluator::visit(State &state, const CgaladvNode &node)
 				geom = res.constptr();
 				if (geom) {
 					shared_ptr<Geometry> editablegeom;
-					// If we got a const object, make a copy
-					if (res.isConst()) editablegeom.reset(geom->copy());
-					else editablegeom = res.ptr();
+					// Resize factors are rarely short numbers, so resize a mesh of
+					// a Nef polyhedron if there is one
+					shared_ptr<const CGAL_Nef_polyhedron> childN = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(geom);
+					if (childN) editablegeom = transformableMesh(node, childN, true);
+					if (!editablegeom) {
+						childN.reset();
+						geom.reset();
+						editablegeom = editableResult(node, res);
+					}
 					geom = editablegeom;
 
 					shared_ptr<CGAL_Nef_polyhedron> N = dynamic_pointer_cast<CGAL_Nef_polyhedron>(editablegeom);
@@ -1124,12 +2076,13 @@ Response GeometryEvaluator::visit(State &state, const AbstractIntersectionNode &
 {
 	if (state.isPrefix()) {
 		if (isSmartCached(node)) return PruneTraversal;
+		startTimer(node);
 		state.setPreferNef(true); // Improve quality of CSG by avoiding conversion loss
 	}
 	if (state.isPostfix()) {
 		shared_ptr<const class Geometry> geom;
 		if (!isSmartCached(node)) {
-			geom = applyToChildren(node, OPENSCAD_INTERSECTION).constptr();
+			geom = applyToChildren(node, OPENSCAD_INTERSECTION, true).constptr();
 		}
 		else {
 			geom = smartCacheGet(node, state.preferNef());
@@ -9,6 +9,11 @@
 #include <list>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <string>
+#include <chrono>
+#include <functional>
 
 class GeometryEvaluator : public NodeVisitor
 {
@@ -17,6 +22,14 @@ public:
 	virtual ~GeometryEvaluator() {}
 
 	shared_ptr<const Geometry> evaluateGeometry(const AbstractNode &node, bool allownef);
+	// True if the result of node is approximate, see applyWithFallback()
+	bool isApproximate(const AbstractNode &node) const { return this->approximate.count(this->tree.getIdString(node)) > 0; }
+	// Never fall back to approximate results
+	void requireExact() { this->exactonly = true; }
+	static size_t finishBackgroundTasks();
+
+	typedef std::function<void(const AbstractNode &, const shared_ptr<const Geometry> &)> ResultCallback;
+	void setResultCallback(const ResultCallback &callback) { this->resultcallback = callback; }
 
 	virtual Response visit(State &state, const AbstractNode &node);
 	virtual Response visit(State &state, const AbstractIntersectionNode &node);
@@ -26,24 +39,27 @@ public:
 	virtual Response visit(State &state, const GroupNode &node);
 	virtual Response visit(State &state, const RootNode &node);
 	virtual Response visit(State &state, const LeafNode &node);
+	virtual Response visit(State &state, const ImportNode &node);
 	virtual Response visit(State &state, const TransformNode &node);
 	virtual Response visit(State &state, const CsgOpNode &node);
 	virtual Response visit(State &state, const CgaladvNode &node);
 	virtual Response visit(State &state, const ProjectionNode &node);
 	virtual Response visit(State &state, const RenderNode &node);
+	virtual Response visit(State &state, const class SimplifyNode &node);
 	virtual Response visit(State &state, const TextNode &node);
 	virtual Response visit(State &state, const OffsetNode &node);
 
 	const Tree &getTree() const { return this->tree; }
+	static bool isThreadSafe(const AbstractNode &node);
 
 private:
 	class ResultObject {
 	public:
 		ResultObject() : is_const(true) {}
 		ResultObject(const Geometry *g) : is_const(true), const_pointer(g) {}
-		ResultObject(shared_ptr<const Geometry> &g) : is_const(true), const_pointer(g) {}
+		ResultObject(const shared_ptr<const Geometry> &g) : is_const(true), const_pointer(g) {}
 		ResultObject(Geometry *g) : is_const(false), pointer(g) {}
-		ResultObject(shared_ptr<Geometry> &g) : is_const(false), pointer(g) {}
+		ResultObject(const shared_ptr<Geometry> &g) : is_const(false), pointer(g) {}
 		bool isConst() const { return is_const; }
 		shared_ptr<Geometry> ptr() { assert(!is_const); return pointer; }
 		shared_ptr<const Geometry> constptr() const { 
@@ -55,6 +71,10 @@ private:
 		shared_ptr<const Geometry> const_pointer;
 	};
 
+	typedef std::chrono::steady_clock Clock;
+	void startTimer(const AbstractNode &node);
+	void findRepeatedSubtrees(const AbstractNode &node, std::unordered_set<std::string> &seen);
+	void evaluateParallel(const AbstractNode &node);
 	void smartCacheInsert(const AbstractNode &node, const shared_ptr<const Geometry> &geom);
 	shared_ptr<const Geometry> smartCacheGet(const AbstractNode &node, bool preferNef);
 	bool isSmartCached(const AbstractNode &node);
@@ -62,16 +82,44 @@ private:
 	Geometry::Geometries collectChildren3D(const AbstractNode &node);
 	Polygon2d *applyMinkowski2D(const AbstractNode &node);
 	Polygon2d *applyHull2D(const AbstractNode &node);
+	Polygon2d *applyOffset(const class OffsetNode &node, const Polygon2d &polygon);
 	Geometry *applyHull3D(const AbstractNode &node);
 	void applyResize3D(class CGAL_Nef_polyhedron &N, const Vector3d &newsize, const Eigen::Matrix<bool,3,1> &autosize);
-	Polygon2d *applyToChildren2D(const AbstractNode &node, OpenSCADOperator op);
-	ResultObject applyToChildren3D(const AbstractNode &node, OpenSCADOperator op);
-	ResultObject applyToChildren(const AbstractNode &node, OpenSCADOperator op);
+	ResultObject applyToChildren2D(const AbstractNode &node, OpenSCADOperator op);
+	bool cullChildren(Geometry::Geometries &children, OpenSCADOperator op);
+	void materializeNefs(Geometry::Geometries &children);
+	class PolySet *applyUnionDisjoint(const Geometry::Geometries &children);
+	bool uniteSubtrahends(Geometry::Geometries &children);
+	ResultObject applyToChildren3D(const AbstractNode &node, OpenSCADOperator op, bool fallback = false);
+	ResultObject applyToChildren3D(Geometry::Geometries children, OpenSCADOperator op);
+	ResultObject applyWithFallback(const AbstractNode &node, const Geometry::Geometries &children, OpenSCADOperator op, const Clock::time_point &deadline);
+	static class PolySet *approximateResult(const Geometry::Geometries &children, OpenSCADOperator op);
+	ResultObject applyToChildren(const AbstractNode &node, OpenSCADOperator op, bool fallback = false);
+	shared_ptr<Geometry> editableResult(const AbstractNode &node, ResultObject &res);
+	shared_ptr<class PolySet> transformableMesh(const AbstractNode &node, const shared_ptr<const class CGAL_Nef_polyhedron> &N, bool convert);
+	void traceNode(const AbstractNode &node, const shared_ptr<const Geometry> &geom, const Clock::time_point *start, double seconds);
 	void addToParent(const State &state, const AbstractNode &node, const shared_ptr<const Geometry> &geom);
+	bool canFlatten2D(const State &state, const AbstractNode &node);
+	void flattenToParent(const State &state, const AbstractNode &node);
+
+	Geometry::Geometries &childrenOf(const AbstractNode &node) { return this->visitedchildren[node.index() - this->firstindex]; }
 
-	std::map<int, Geometry::Geometries> visitedchildren;
+	// The results of the children of each node, indexed by node index from
+	// firstindex. A node's list is released when its own result is done.
+	std::vector<Geometry::Geometries> visitedchildren;
+	size_t firstindex;
+	std::map<int, Clock::time_point> starttimes;
+	std::map<int, double> evaltimes;
+	// Ids of subtrees occurring more than once in the evaluated tree
+	std::unordered_set<std::string> repeated;
+	// Results of repeated subtrees and parallel tasks, by id string
+	std::unordered_map<std::string, shared_ptr<const Geometry>> evaluated;
+	// Ids of subtrees with approximate results, which aren't cached
+	std::unordered_set<std::string> approximate;
+	bool exactonly;
 	const Tree &tree;
 	shared_ptr<const Geometry> root;
+	ResultCallback resultcallback;
 
 public:
 };
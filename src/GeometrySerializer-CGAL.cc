@@ -0,0 +1,222 @@
+#ifdef ENABLE_CGAL
+
+#include "GeometrySerializer.h"
+#include "CGAL_Nef_polyhedron.h"
+#include "CGAL_Nef3_workaround.h"
+#include "printutils.h"
+#include "cgal.h"
+#include <CGAL/IO/Nef_polyhedron_iostream_3.h>
+#include <CGAL/Polyhedron_incremental_builder_3.h>
+
+#include <map>
+#include <stdexcept>
+#include <sstream>
+#include <vector>
+
+/*
+	Nef polyhedra in the .scadgeom format. These live in a separate file
+	since GeometrySerializer itself is also built without CGAL.
+*/
+
+using GeometrySerializer::Writer;
+using GeometrySerializer::Reader;
+
+// How a Nef polyhedron is stored
+enum nef_storage_e {
+	NEF_EMPTY = 0,    // No polyhedron
+	NEF_FACETS = 1,   // The facets of a single solid
+	NEF_TEXT = 2      // CGAL's text format
+};
+
+// The magnitude of \a z as little-endian bytes, after its sign
+static void write_integer(Writer &out, mpz_srcptr z)
+{
+	std::vector<unsigned char> bytes((mpz_sizeinbase(z, 2) + 7) / 8);
+	size_t count = 0;
+	mpz_export(bytes.data(), &count, -1, 1, 0, 0, z);
+	out.u32(mpz_sgn(z) < 0);
+	out.u64(count);
+	out.bytes(bytes.data(), count);
+}
+
+static bool read_integer(Reader &in, mpz_ptr z)
+{
+	const bool negative = in.u32() != 0;
+	const uint64_t count = in.u64();
+	if (!in.has(count, 1)) return false;
+	std::vector<unsigned char> bytes(count);
+	if (!in.bytes(bytes.data(), count)) return false;
+	mpz_import(z, count, -1, 1, 0, 0, bytes.data());
+	if (negative) mpz_neg(z, z);
+	return true;
+}
+
+static void write_number(Writer &out, const NT3 &x)
+{
+	write_integer(out, mpq_numref(x.mpq()));
+	write_integer(out, mpq_denref(x.mpq()));
+}
+
+static bool read_number(Reader &in, NT3 &x)
+{
+	NT3 result;
+	if (!read_integer(in, mpq_numref(result.mpq())) || !read_integer(in, mpq_denref(result.mpq()))) return false;
+	if (mpz_sgn(mpq_denref(result.mpq())) == 0) return false;
+	mpq_canonicalize(result.mpq());
+	x = result;
+	return true;
+}
+
+/*!
+	Builds a polyhedron of the given facets, leaving out facets which would
+	make it non-manifold.
+*/
+class BuildPolyhedron : public CGAL::Modifier_base<CGAL_Polyhedron::HalfedgeDS>
+{
+public:
+	BuildPolyhedron(const std::vector<CGAL_Point_3> &vertices, const std::vector<std::vector<size_t>> &facets)
+		: vertices(vertices), facets(facets) {}
+
+	void operator()(CGAL_Polyhedron::HalfedgeDS &hds) {
+		CGAL::Polyhedron_incremental_builder_3<CGAL_Polyhedron::HalfedgeDS> B(hds, true);
+		B.begin_surface(this->vertices.size(), this->facets.size());
+		for(const auto &p : this->vertices) B.add_vertex(p);
+		for(const auto &f : this->facets) {
+			if (B.test_facet(f.begin(), f.end())) B.add_facet(f.begin(), f.end());
+		}
+		B.end_surface();
+	}
+
+private:
+	const std::vector<CGAL_Point_3> &vertices;
+	const std::vector<std::vector<size_t>> &facets;
+};
+
+/*!
+	Converts \a N to a polyhedron if it's a single solid, i.e. a 2-manifold
+	bounding one volume, which is rebuilt exactly from its facets.
+*/
+static bool single_solid(const CGAL_Nef_polyhedron3 &N, CGAL_Polyhedron &P)
+{
+	if (N.number_of_volumes() != 2 || N.volumes_begin()->mark() || !N.is_simple()) return false;
+	CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
+	bool err;
+	try {
+		err = nefworkaround::convert_to_Polyhedron<CGAL_Kernel3>(N, P);
+	}
+	catch (const CGAL::Failure_exception &e) {
+		PRINTDB("Nef polyhedron to polyhedron conversion failed: %s", e.what());
+		err = true;
+	}
+	CGAL::set_error_behaviour(old_behaviour);
+	return !err && P.is_closed();
+}
+
+namespace GeometrySerializer {
+
+void writeNef(Writer &out, const CGAL_Nef_polyhedron &N)
+{
+	out.u32(N.getConvexity());
+	if (!N.p3) {
+		out.u32(NEF_EMPTY);
+		return;
+	}
+
+	CGAL_Polyhedron P;
+	if (single_solid(*N.p3, P)) {
+		out.u32(NEF_FACETS);
+		std::map<const void *, uint32_t> indices;
+		out.u64(P.size_of_vertices());
+		for (auto v = P.vertices_begin(); v != P.vertices_end(); ++v) {
+			const uint32_t index = indices.size();
+			indices[&*v] = index;
+			write_number(out, v->point().x());
+			write_number(out, v->point().y());
+			write_number(out, v->point().z());
+		}
+		out.u64(P.size_of_facets());
+		for (auto f = P.facets_begin(); f != P.facets_end(); ++f) {
+			out.u32(f->size());
+			auto h = f->facet_begin();
+			do {
+				out.u32(indices[&*h->vertex()]);
+			} while (++h != f->facet_begin());
+		}
+		return;
+	}
+
+	out.u32(NEF_TEXT);
+	std::stringstream text;
+	text << *N.p3;
+	const std::string s = text.str();
+	out.u64(s.size());
+	out.bytes(s.data(), s.size());
+}
+
+CGAL_Nef_polyhedron *readNef(Reader &in)
+{
+	const int convexity = int(in.u32());
+	const uint32_t storage = in.u32();
+	if (!in.good()) return NULL;
+	CGAL_Nef_polyhedron *N = new CGAL_Nef_polyhedron;
+	N->setConvexity(convexity);
+	if (storage == NEF_EMPTY) return N;
+
+	CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
+	try {
+		if (storage == NEF_FACETS) {
+			const uint64_t numvertices = in.u64();
+			// Each coordinate takes at least 24 bytes
+			if (!in.has(numvertices, 3 * 24)) throw std::runtime_error("truncated");
+			std::vector<CGAL_Point_3> vertices;
+			vertices.reserve(numvertices);
+			for (uint64_t i = 0; i < numvertices; i++) {
+				NT3 x, y, z;
+				if (!read_number(in, x) || !read_number(in, y) || !read_number(in, z)) throw std::runtime_error("truncated");
+				vertices.push_back(CGAL_Point_3(x, y, z));
+			}
+			const uint64_t numfacets = in.u64();
+			if (!in.has(numfacets, 4)) throw std::runtime_error("truncated");
+			std::vector<std::vector<size_t>> facets(numfacets);
+			for (auto &f : facets) {
+				const uint32_t size = in.u32();
+				if (!in.has(size, 4)) throw std::runtime_error("truncated");
+				f.resize(size);
+				for (auto &index : f) {
+					index = in.u32();
+					if (index >= numvertices) throw std::runtime_error("bad vertex index");
+				}
+			}
+			CGAL_Polyhedron P;
+			BuildPolyhedron builder(vertices, facets);
+			P.delegate(builder);
+			if (!P.is_closed()) throw std::runtime_error("not closed");
+			N->p3.reset(new CGAL_Nef_polyhedron3(P));
+		}
+		else if (storage == NEF_TEXT) {
+			const uint64_t size = in.u64();
+			std::string text(in.has(size, 1) ? size : 0, '\0');
+			if (!in.bytes(&text[0], text.size())) throw std::runtime_error("truncated");
+			std::istringstream stream(text);
+			CGAL_Nef_polyhedron3 *p3 = new CGAL_Nef_polyhedron3;
+			N->p3.reset(p3);
+			stream >> *p3;
+			if (stream.fail()) throw std::runtime_error("bad Nef polyhedron");
+		}
+		else {
+			throw std::runtime_error("unknown storage");
+		}
+	}
+	catch (const std::exception &e) {
+		// Also CGAL::Failure_exception
+		PRINTDB("Reading a serialized Nef polyhedron failed: %s", e.what());
+		delete N;
+		N = NULL;
+	}
+	CGAL::set_error_behaviour(old_behaviour);
+	return N;
+}
+
+}
+
+#endif // ENABLE_CGAL
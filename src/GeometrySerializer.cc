@@ -0,0 +1,234 @@
+#include "GeometrySerializer.h"
+#include "Geometry.h"
+#include "Polygon2d.h"
+#include "polyset.h"
+
+#include <cstring>
+#include <stdint.h>
+
+#ifdef ENABLE_CGAL
+#include "CGAL_Nef_polyhedron.h"
+#endif
+
+using GeometrySerializer::Writer;
+using GeometrySerializer::Reader;
+
+static const char MAGIC[8] = { 'S', 'C', 'A', 'D', 'G', 'E', 'O', 'M' };
+static const uint32_t VERSION = 1;
+
+enum geometry_type_e {
+	GEOM_NULL = 0,
+	GEOM_POLYSET = 1,
+	GEOM_POLYGON2D = 2,
+	GEOM_NEF3 = 3
+};
+
+// Stored value of PolySet::convexValue()
+enum convex_e {
+	CONVEX_FALSE = 0,
+	CONVEX_TRUE = 1,
+	CONVEX_UNKNOWN = 2
+};
+
+static void write_polyset(Writer &out, const PolySet &ps)
+{
+	const boost::tribool convex = ps.convexValue();
+	out.u32(ps.getConvexity());
+	out.u32(boost::indeterminate(convex) ? CONVEX_UNKNOWN : convex ? CONVEX_TRUE : CONVEX_FALSE);
+	out.u64(ps.numVertices());
+	out.u64(ps.numPolygons());
+	out.u64(ps.getIndices().size());
+	for(const auto &v : ps.getVertices()) {
+		out.f64(v[0]);
+		out.f64(v[1]);
+		out.f64(v[2]);
+	}
+	for(const auto &f : ps.faces()) out.u32(f.size());
+	for(const auto &i : ps.getIndices()) out.u32(i);
+}
+
+static PolySet *read_polyset(Reader &in)
+{
+	const int convexity = int(in.u32());
+	const uint32_t convex = in.u32();
+	const uint64_t numvertices = in.u64();
+	const uint64_t numpolygons = in.u64();
+	const uint64_t numindices = in.u64();
+	if (!in.has(numvertices, 24) || !in.has(numpolygons, 4) || !in.has(numindices, 4)) return NULL;
+
+	PolySet *ps = new PolySet(3);
+	ps->setConvexity(convexity);
+	if (convex != CONVEX_UNKNOWN) ps->setConvexValue(convex == CONVEX_TRUE);
+	// The vertices were unique when written, so they don't need to be looked up
+	for (uint64_t i = 0; i < numvertices; i++) {
+		const double x = in.f64(), y = in.f64(), z = in.f64();
+		ps->append_unique_vertex(Vector3d(x, y, z));
+	}
+	std::vector<uint32_t> sizes(numpolygons);
+	uint64_t total = 0;
+	for (auto &s : sizes) total += s = in.u32();
+	if (total != numindices) {
+		delete ps;
+		return NULL;
+	}
+	for(const auto &s : sizes) {
+		ps->append_poly();
+		for (uint32_t j = 0; j < s; j++) {
+			const uint32_t idx = in.u32();
+			if (idx >= numvertices) {
+				delete ps;
+				return NULL;
+			}
+			ps->append_index(int(idx));
+		}
+	}
+	return ps;
+}
+
+static void write_polygon2d(Writer &out, const Polygon2d &poly)
+{
+	out.u32(poly.getConvexity());
+	out.u32(poly.isSanitized());
+	out.u64(poly.outlines().size());
+	for(const auto &o : poly.outlines()) {
+		out.u32(o.positive);
+		out.u64(o.vertices.size());
+		for(const auto &v : o.vertices) {
+			out.f64(v[0]);
+			out.f64(v[1]);
+		}
+	}
+}
+
+static Polygon2d *read_polygon2d(Reader &in)
+{
+	const int convexity = int(in.u32());
+	const bool sanitized = in.u32() != 0;
+	const uint64_t numoutlines = in.u64();
+	if (!in.has(numoutlines, 12)) return NULL;
+
+	Polygon2d *poly = new Polygon2d;
+	poly->setConvexity(convexity);
+	for (uint64_t i = 0; i < numoutlines; i++) {
+		Outline2d o;
+		o.positive = in.u32() != 0;
+		const uint64_t numvertices = in.u64();
+		if (!in.has(numvertices, 16)) {
+			delete poly;
+			return NULL;
+		}
+		o.vertices.resize(numvertices);
+		for (auto &v : o.vertices) {
+			v[0] = in.f64();
+			v[1] = in.f64();
+		}
+		poly->addOutline(o);
+	}
+	poly->setSanitized(sanitized);
+	return poly;
+}
+
+namespace GeometrySerializer {
+
+/*!
+	Serializes \a geom, which may be NULL, into \a data. Only 3D PolySets,
+	Polygon2d and Nef polyhedra can be serialized, for other types false is
+	returned.
+*/
+bool write(const shared_ptr<const Geometry> &geom, std::string &data)
+{
+	if (geom) return write(*geom, data);
+	std::string result;
+	Writer out(result);
+	out.bytes(MAGIC, sizeof(MAGIC));
+	out.u32(VERSION);
+	out.u32(GEOM_NULL);
+	data.swap(result);
+	return true;
+}
+
+bool write(const Geometry &geom, std::string &data)
+{
+	std::string result;
+	Writer out(result);
+	out.bytes(MAGIC, sizeof(MAGIC));
+	out.u32(VERSION);
+	if (const PolySet *ps = dynamic_cast<const PolySet *>(&geom)) {
+		if (ps->getDimension() != 3) return false;
+		out.u32(GEOM_POLYSET);
+		write_polyset(out, *ps);
+	}
+	else if (const Polygon2d *poly = dynamic_cast<const Polygon2d *>(&geom)) {
+		out.u32(GEOM_POLYGON2D);
+		write_polygon2d(out, *poly);
+	}
+#ifdef ENABLE_CGAL
+	else if (const CGAL_Nef_polyhedron *N = dynamic_cast<const CGAL_Nef_polyhedron *>(&geom)) {
+		out.u32(GEOM_NEF3);
+		writeNef(out, *N);
+	}
+#endif
+	else {
+		return false;
+	}
+	data.swap(result);
+	return true;
+}
+
+/*!
+	Returns true if \a data starts like serialized geometry.
+*/
+bool isSerialized(const char *data, size_t size)
+{
+	return size >= sizeof(MAGIC) && !memcmp(data, MAGIC, sizeof(MAGIC));
+}
+
+/*!
+	Reads geometry written by write() from \a size bytes at \a data into
+	\a geom, which is owned by the caller and NULL for null geometry.
+	Returns false if the data is truncated, corrupt or of another version.
+*/
+bool read(const char *data, size_t size, Geometry *&geom)
+{
+	geom = NULL;
+	if (!isSerialized(data, size)) return false;
+	Reader in(data + sizeof(MAGIC), size - sizeof(MAGIC));
+	if (in.u32() != VERSION) return false;
+
+	const uint32_t type = in.u32();
+	if (!in.good()) return false;
+	Geometry *result = NULL;
+	switch (type) {
+	case GEOM_NULL:
+		return true;
+	case GEOM_POLYSET:
+		result = read_polyset(in);
+		break;
+	case GEOM_POLYGON2D:
+		result = read_polygon2d(in);
+		break;
+#ifdef ENABLE_CGAL
+	case GEOM_NEF3:
+		result = readNef(in);
+		break;
+#endif
+	default:
+		return false;
+	}
+	if (!result || !in.good()) {
+		delete result;
+		return false;
+	}
+	geom = result;
+	return true;
+}
+
+bool read(const std::string &data, shared_ptr<const Geometry> &geom)
+{
+	Geometry *result;
+	if (!read(data.data(), data.size(), result)) return false;
+	geom.reset(result);
+	return true;
+}
+
+}
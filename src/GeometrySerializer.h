@@ -0,0 +1,116 @@
+#pragma once
+
+#include "memory.h"
+#include <string>
+#include <cstring>
+#include <stdint.h>
+
+class Geometry;
+
+/*!
+	Compact binary encoding of evaluated geometry, used by the .scadgeom
+	export and import format and by the persistent geometry cache.
+
+	The data starts with the 8 byte magic "SCADGEOM", a format version and
+	the geometry type, all little-endian. A 3D PolySet follows with its
+	convexity, the cached convexity check, the vertex, polygon and index
+	counts, and then the vertices as doubles, the polygon sizes and the
+	vertex indices as flat arrays. A Polygon2d has its convexity, the
+	sanitized flag and each outline with its vertex count and vertices.
+	Vertices are stored exactly and already welded, so reading back needs
+	neither number parsing nor vertex lookups.
+
+	A Nef polyhedron has its convexity and how it's stored. A single solid,
+	the most common result of CGAL operations, is stored as its facets,
+	with the exact coordinates of their vertices as GMP integers for the
+	numerators and denominators. Anything else is stored as CGAL's own text
+	format. Both are read back exactly.
+*/
+namespace GeometrySerializer {
+	/*!
+		Appends little-endian binary data to a string.
+	*/
+	class Writer
+	{
+	public:
+		Writer(std::string &data) : data(data) {}
+
+		void bytes(const void *p, size_t n) { this->data.append(static_cast<const char *>(p), n); }
+		void u32(uint32_t x) {
+			char buf[4];
+			for (int i = 0; i < 4; i++) buf[i] = char((x >> (8 * i)) & 0xff);
+			bytes(buf, 4);
+		}
+		void u64(uint64_t x) {
+			char buf[8];
+			for (int i = 0; i < 8; i++) buf[i] = char((x >> (8 * i)) & 0xff);
+			bytes(buf, 8);
+		}
+		void f64(double x) {
+			uint64_t bits;
+			memcpy(&bits, &x, sizeof(bits));
+			u64(bits);
+		}
+
+	private:
+		std::string &data;
+	};
+
+	/*!
+		Reads little-endian binary data, failing instead of reading past the end.
+	*/
+	class Reader
+	{
+	public:
+		Reader(const char *data, size_t size) : p(reinterpret_cast<const unsigned char *>(data)), end(p + size), ok(true) {}
+
+		bool good() const { return this->ok; }
+		// True if at least \a count items of \a size bytes are left
+		bool has(uint64_t count, size_t size) {
+			if (this->ok && count > uint64_t(this->end - this->p) / size) this->ok = false;
+			return this->ok;
+		}
+		bool bytes(void *out, size_t n) {
+			if (!has(n, 1)) return false;
+			memcpy(out, this->p, n);
+			this->p += n;
+			return true;
+		}
+		uint32_t u32() {
+			if (!has(1, 4)) return 0;
+			uint32_t x = 0;
+			for (int i = 0; i < 4; i++) x |= uint32_t(this->p[i]) << (8 * i);
+			this->p += 4;
+			return x;
+		}
+		uint64_t u64() {
+			if (!has(1, 8)) return 0;
+			uint64_t x = 0;
+			for (int i = 0; i < 8; i++) x |= uint64_t(this->p[i]) << (8 * i);
+			this->p += 8;
+			return x;
+		}
+		double f64() {
+			const uint64_t bits = u64();
+			double x;
+			memcpy(&x, &bits, sizeof(x));
+			return x;
+		}
+
+	private:
+		const unsigned char *p, *end;
+		bool ok;
+	};
+
+	bool write(const shared_ptr<const Geometry> &geom, std::string &data);
+	bool write(const Geometry &geom, std::string &data);
+	bool read(const char *data, size_t size, Geometry *&geom);
+	bool read(const std::string &data, shared_ptr<const Geometry> &geom);
+	bool isSerialized(const char *data, size_t size);
+
+#ifdef ENABLE_CGAL
+	// The Nef polyhedron part, in GeometrySerializer-CGAL.cc
+	void writeNef(Writer &out, const class CGAL_Nef_polyhedron &N);
+	class CGAL_Nef_polyhedron *readNef(Reader &in);
+#endif
+}
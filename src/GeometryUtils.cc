@@ -4,19 +4,144 @@
 #include "Reindexer.h"
 #include <boost/lexical_cast.hpp>
 #include <unordered_map>
+#include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <cstddef>
 
 #include <boost/functional/hash.hpp>
 
-static void *stdAlloc(void* userData, unsigned int size) {
-	TESS_NOTUSED(userData);
-	return malloc(size);
-}
+/*!
+	Memory for libtess2, kept in free lists of power of two size classes
+	rather than returned to the system. A tessellation allocates its mesh
+	and sweep structures of similar sizes every time, so after the first
+	polygons they're taken from the free lists.
 
-static void stdFree(void* userData, void* ptr) {
-	TESS_NOTUSED(userData);
-	free(ptr);
-}
+	Not thread safe: each thread has its own pool with its tessellator.
+*/
+class TessPool
+{
+public:
+	TessPool() : pooled(0) {
+		for (auto &list : this->freelists) list = NULL;
+	}
+	~TessPool() {
+		for (auto list : this->freelists) {
+			while (list) {
+				Block *next = list->next;
+				::free(list);
+				list = next;
+			}
+		}
+	}
+
+	static void *alloc(void *userData, unsigned int size) {
+		return static_cast<TessPool *>(userData)->allocate(size);
+	}
+	static void *realloc(void *userData, void *ptr, unsigned int size) {
+		return static_cast<TessPool *>(userData)->reallocate(ptr, size);
+	}
+	static void free(void *userData, void *ptr) {
+		static_cast<TessPool *>(userData)->release(ptr);
+	}
+
+private:
+	// Precedes the memory handed out, keeping it aligned like malloc's
+	union Block {
+		Block *next; // while in a free list
+		unsigned int sizeclass;
+		std::max_align_t align;
+	};
+	static const unsigned int MIN_CLASS = 4; // 16 bytes
+	static const unsigned int NUM_CLASSES = 20; // up to 8 MB, larger sizes use malloc directly
+	static const size_t MAX_POOLED_BYTES = 32*1024*1024;
+
+	static size_t classBytes(unsigned int sizeclass) { return size_t(1) << (sizeclass + MIN_CLASS); }
+
+	void *allocate(size_t size) {
+		unsigned int sizeclass = 0;
+		while (sizeclass < NUM_CLASSES && classBytes(sizeclass) < size) sizeclass++;
+		Block *block;
+		if (sizeclass < NUM_CLASSES && this->freelists[sizeclass]) {
+			block = this->freelists[sizeclass];
+			this->freelists[sizeclass] = block->next;
+			this->pooled -= classBytes(sizeclass);
+		}
+		else {
+			block = static_cast<Block *>(malloc(sizeof(Block) + (sizeclass < NUM_CLASSES ? classBytes(sizeclass) : size)));
+			if (!block) return NULL;
+		}
+		block->sizeclass = sizeclass;
+		return block + 1;
+	}
+
+	void *reallocate(void *ptr, size_t size) {
+		if (!ptr) return allocate(size);
+		Block *block = static_cast<Block *>(ptr) - 1;
+		if (block->sizeclass < NUM_CLASSES) {
+			if (classBytes(block->sizeclass) >= size) return ptr;
+			void *grown = allocate(size);
+			if (!grown) return NULL;
+			memcpy(grown, ptr, classBytes(block->sizeclass));
+			release(ptr);
+			return grown;
+		}
+		block = static_cast<Block *>(::realloc(block, sizeof(Block) + size));
+		return block ? block + 1 : NULL;
+	}
+
+	void release(void *ptr) {
+		if (!ptr) return;
+		Block *block = static_cast<Block *>(ptr) - 1;
+		const unsigned int sizeclass = block->sizeclass;
+		if (sizeclass >= NUM_CLASSES || this->pooled + classBytes(sizeclass) > MAX_POOLED_BYTES) {
+			::free(block);
+			return;
+		}
+		block->next = this->freelists[sizeclass];
+		this->freelists[sizeclass] = block;
+		this->pooled += classBytes(sizeclass);
+	}
+
+	Block *freelists[NUM_CLASSES];
+	size_t pooled; // bytes in the free lists
+};
+
+/*!
+	A libtess2 tessellator per thread, reused for every polygon since
+	creating one allocates its memory pools.
+*/
+class ThreadTessellator
+{
+public:
+	ThreadTessellator() : tess(NULL) {}
+	~ThreadTessellator() { reset(); }
+
+	TESStesselator *get() {
+		if (!this->tess) {
+			TESSalloc ma;
+			memset(&ma, 0, sizeof(ma));
+			ma.memalloc = TessPool::alloc;
+			ma.memrealloc = TessPool::realloc;
+			ma.memfree = TessPool::free;
+			ma.userData = &this->pool;
+			ma.extraVertices = 256;
+			this->tess = tessNewTess(&ma);
+		}
+		return this->tess;
+	}
+	// Drops the tessellator, e.g. when it failed with contours still added
+	void reset() {
+		if (this->tess) tessDeleteTess(this->tess);
+		this->tess = NULL;
+	}
+
+private:
+	TessPool pool; // Outlives the tessellator
+	TESStesselator *tess;
+};
+
+static thread_local ThreadTessellator threadTessellator;
 
 typedef std::pair<int,int> IndexedEdge;
 
@@ -266,15 +391,8 @@ bool GeometryUtils::tessellatePolygonWithHoles(const Vector3f *vertices,
     normalvec = passednormal;
   }
 
-  TESSalloc ma;
-  TESStesselator* tess = 0;
-
-  memset(&ma, 0, sizeof(ma));
-  ma.memalloc = stdAlloc;
-  ma.memfree = stdFree;
-  ma.extraVertices = 256; // realloc not provided, allow 256 extra vertices.
-  
-  if (!(tess = tessNewTess(&ma))) return true;
+  TESStesselator *tess = threadTessellator.get();
+  if (!tess) return true;
 
 	int numContours = 0;
   std::vector<TESSreal> contour;
@@ -296,7 +414,10 @@ bool GeometryUtils::tessellatePolygonWithHoles(const Vector3f *vertices,
 		numContours++;
   }
 
-  if (!tessTesselate(tess, TESS_WINDING_ODD, TESS_CONSTRAINED_DELAUNAY_TRIANGLES, 3, 3, normalvec)) return -1;
+  if (!tessTesselate(tess, TESS_WINDING_ODD, TESS_CONSTRAINED_DELAUNAY_TRIANGLES, 3, 3, normalvec)) {
+		threadTessellator.reset();
+		return true;
+	}
 
   const TESSindex *vindices = tessGetVertexIndices(tess);
   const TESSindex *elements = tessGetElements(tess);
@@ -411,11 +532,34 @@ bool GeometryUtils::tessellatePolygonWithHoles(const Vector3f *vertices,
 		}
 #endif
 
-  tessDeleteTess(tess);
-
   return false;
 }
 
+/*!
+	Returns true if face is a strictly convex polygon, which can be
+	triangulated as a fan without the tessellator.
+*/
+bool GeometryUtils::isStrictlyConvex(const Vector3f *verts, const IndexedFace &face)
+{
+	const size_t n = face.size();
+	if (n < 3) return false;
+	// Newell's method
+	Vector3d normal(0, 0, 0);
+	for (size_t i=0;i<n;i++) {
+		const Vector3d a = verts[face[i]].cast<double>();
+		const Vector3d b = verts[face[(i+1)%n]].cast<double>();
+		normal += Vector3d((a[1]-b[1])*(a[2]+b[2]), (a[2]-b[2])*(a[0]+b[0]), (a[0]-b[0])*(a[1]+b[1]));
+	}
+	for (size_t i=0;i<n;i++) {
+		const Vector3d a = verts[face[i]].cast<double>();
+		const Vector3d b = verts[face[(i+1)%n]].cast<double>();
+		const Vector3d c = verts[face[(i+2)%n]].cast<double>();
+		// Also false for NaN coordinates
+		if (!((b - a).cross(c - b).dot(normal) > 0)) return false;
+	}
+	return true;
+}
+
 /*!
 	Tessellates a single contour. Non-indexed version.
 	Appends resulting triangles to triangles.
@@ -448,6 +592,118 @@ bool GeometryUtils::tessellatePolygon(const Polygon &polygon, Polygons &triangle
 	return err;
 }
 
+/*!
+	Computes the convex hull of \a points with Andrew's monotone chain,
+	appending its vertices to \a hull counter-clockwise. Collinear and
+	duplicate points are left out. \a points is sorted in place.
+*/
+void GeometryUtils::convexHull2D(std::vector<Vector2d> &points, std::vector<Vector2d> &hull)
+{
+	std::sort(points.begin(), points.end(), [](const Vector2d &a, const Vector2d &b) {
+			return a[0] < b[0] || (a[0] == b[0] && a[1] < b[1]);
+		});
+	points.erase(std::unique(points.begin(), points.end()), points.end());
+	if (points.size() < 3) {
+		hull.insert(hull.end(), points.begin(), points.end());
+		return;
+	}
+
+	// Whether o, a, b don't turn counter-clockwise
+	auto clockwise = [](const Vector2d &o, const Vector2d &a, const Vector2d &b) {
+		return (a[0] - o[0]) * (b[1] - o[1]) - (a[1] - o[1]) * (b[0] - o[0]) <= 0;
+	};
+	std::vector<Vector2d> chain(2 * points.size());
+	size_t k = 0;
+	// Lower chain, left to right
+	for (size_t i = 0; i < points.size(); i++) {
+		while (k >= 2 && clockwise(chain[k-2], chain[k-1], points[i])) k--;
+		chain[k++] = points[i];
+	}
+	// Upper chain, right to left
+	const size_t lower = k + 1;
+	for (size_t i = points.size() - 1; i > 0; i--) {
+		while (k >= lower && clockwise(chain[k-2], chain[k-1], points[i-1])) k--;
+		chain[k++] = points[i-1];
+	}
+	// The last point is the first one again
+	hull.insert(hull.end(), chain.begin(), chain.begin() + (k - 1));
+}
+
+/*!
+	Triangulates a simple, counter-clockwise polygon without holes by ear
+	clipping. Convex polygons are done in linear time.
+
+	The output will be written as indices into the input vertex vector.
+	Only existing vertices are used, and no degenerate triangles are
+	created.
+
+	Returns true on error (e.g. if the polygon isn't simple), false on
+	success. On error, triangles is left unchanged.
+*/
+bool GeometryUtils::triangulateSimplePolygon(const std::vector<Vector2d> &vertices,
+																						 std::vector<IndexedTriangle> &triangles)
+{
+	const int n = vertices.size();
+	if (n < 3) return false;
+
+	auto cross = [&vertices](int a, int b, int c) {
+		const Vector2d &p = vertices[a], &q = vertices[b], &r = vertices[c];
+		return (q[0]-p[0])*(r[1]-p[1]) - (q[1]-p[1])*(r[0]-p[0]);
+	};
+
+	// Remaining vertices form a doubly linked list. Only reflex (or
+	// collinear) vertices can lie inside an ear, and convex vertices stay
+	// convex while ears are clipped.
+	std::vector<int> prev(n), next(n);
+	std::vector<bool> isreflex(n);
+	std::vector<int> reflex;
+	for (int i=0;i<n;i++) {
+		prev[i] = (i+n-1)%n;
+		next[i] = (i+1)%n;
+	}
+	for (int i=0;i<n;i++) {
+		isreflex[i] = cross(prev[i], i, next[i]) <= 0;
+		if (isreflex[i]) reflex.push_back(i);
+	}
+
+	auto isEar = [&](int i) {
+		if (isreflex[i]) return false;
+		const int a = prev[i], c = next[i];
+		for(int r : reflex) {
+			if (!isreflex[r] || r == a || r == c) continue;
+			if (cross(a, i, r) >= 0 && cross(i, c, r) >= 0 && cross(c, a, r) >= 0) return false;
+		}
+		return true;
+	};
+
+	std::vector<IndexedTriangle> result;
+	result.reserve(n - 2);
+	int remaining = n;
+	int i = 0;
+	int misses = 0;
+	while (remaining > 3) {
+		if (!isEar(i)) {
+			i = next[i];
+			if (++misses > remaining) return true; // No ear left: not a simple polygon
+			continue;
+		}
+		const int a = prev[i], c = next[i];
+		result.push_back(IndexedTriangle(a, i, c));
+		next[a] = c;
+		prev[c] = a;
+		remaining--;
+		if (isreflex[a]) isreflex[a] = cross(prev[a], a, c) <= 0;
+		if (isreflex[c]) isreflex[c] = cross(a, c, next[c]) <= 0;
+		misses = 0;
+		i = c;
+	}
+	if (cross(prev[i], i, next[i]) <= 0) return true;
+	result.push_back(IndexedTriangle(prev[i], i, next[i]));
+
+	triangles.insert(triangles.end(), result.begin(), result.end());
+	return false;
+}
+
 int GeometryUtils::findUnconnectedEdges(const std::vector<std::vector<IndexedFace>> &polygons)
 {
 	EdgeDict edges;
@@ -2,6 +2,7 @@
 
 #include "linalg.h"
 #include <vector>
+#include <functional>
 
 typedef std::vector<Vector3d> Polygon;
 typedef std::vector<Polygon> Polygons;
@@ -9,6 +10,9 @@ typedef std::vector<Polygon> Polygons;
 typedef std::vector<int> IndexedFace;
 typedef Vector3i IndexedTriangle;
 
+// Receives triangles one at a time, e.g. to write them without building a mesh
+typedef std::function<void(const Vector3d &, const Vector3d &, const Vector3d &)> TriangleSink;
+
 struct IndexedPolygons {
 	std::vector<Vector3f> vertices;
 	std::vector<IndexedFace> faces;
@@ -34,6 +38,13 @@ namespace GeometryUtils {
 																	std::vector<IndexedTriangle> &triangles,
 																	const Vector3f *normal = NULL);
 
+	bool isStrictlyConvex(const Vector3f *verts, const IndexedFace &face);
+
+	bool triangulateSimplePolygon(const std::vector<Vector2d> &vertices,
+																std::vector<IndexedTriangle> &triangles);
+
+	void convexHull2D(std::vector<Vector2d> &points, std::vector<Vector2d> &hull);
+
 	int findUnconnectedEdges(const std::vector<std::vector<IndexedFace>> &polygons);
 	int findUnconnectedEdges(const std::vector<IndexedTriangle> &triangles);
 }
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <functional>
+#include <ostream>
+
+/*!
+	A variable name with its hash and scope precomputed.
+
+	Lookup expressions construct their Identifier once at parse time, so
+	walking the context chain doesn't rehash or reclassify the name at
+	every level.
+*/
+class Identifier
+{
+public:
+	Identifier(const std::string &name)
+		: name(name), h(std::hash<std::string>()(name)),
+			config(!name.empty() && name[0] == '$' && name != "$children") {}
+
+	const std::string &str() const { return this->name; }
+	size_t hash() const { return this->h; }
+	// Config variables ($fn etc.) have dynamic scope and are passed down the
+	// call chain implicitly. $children is not a config variable.
+	bool isConfigVariable() const { return this->config; }
+
+	bool operator==(const Identifier &other) const {
+		return this->h == other.h && this->name == other.name;
+	}
+
+	struct Hash {
+		size_t operator()(const Identifier &id) const { return id.h; }
+	};
+
+private:
+	std::string name;
+	size_t h;
+	bool config;
+};
+
+inline std::ostream &operator<<(std::ostream &stream, const Identifier &id)
+{
+	return stream << id.str();
+}
@@ -0,0 +1,105 @@
+#include "ImportCache.h"
+#include "importnode.h"
+#include "handle_dep.h"
+#include "hash.h"
+#include "printutils.h"
+
+#include <fstream>
+#include <sstream>
+#include <boost/filesystem.hpp>
+namespace fs = boost::filesystem;
+
+/*!
+	Returns the parameters which affect the imported geometry.
+*/
+static std::string import_parameters(const ImportNode &node)
+{
+	std::stringstream params;
+	params << node.type << "," << node.layername << "," << node.convexity << ","
+				 << node.fn << "," << node.fs << "," << node.fa << ","
+				 << node.origin_x << "," << node.origin_y << "," << node.scale << ","
+				 << node.simplifyerror << "," << node.simplifyfaces;
+	return params.str();
+}
+
+/*!
+	Returns the geometry imported by \a node, calling \a import to read the
+	file if its contents aren't cached.
+*/
+shared_ptr<const Geometry> ImportCache::get(const ImportNode &node, const Importer &import)
+{
+	const std::string filename = node.filename;
+	std::string hash;
+	// Unreadable files aren't cached, so they are picked up once they appear
+	if (!contentHash(filename, hash)) return import();
+
+	const std::string key = hash + ":" + import_parameters(node);
+	shared_ptr<const Geometry> geom;
+	if (this->cache.access(key, [&geom](const cache_entry &entry) { geom = entry.geom; })) {
+		this->hits++;
+		handle_dep(filename);
+		PRINTDB("Import cache hit: %s", filename);
+		return geom;
+	}
+
+	this->misses++;
+	geom = import();
+	if (geom) this->cache.insert(key, new cache_entry(geom), geom->memsize());
+	return geom;
+}
+
+/*!
+	Returns the hash of the contents of \a filename in \a hash.
+	Returns false if the file can't be read.
+*/
+bool ImportCache::contentHash(const std::string &filename, std::string &hash)
+{
+	boost::system::error_code ec;
+	fs::path path(filename);
+	time_t mtime = fs::last_write_time(path, ec);
+	if (ec) return false;
+	uintmax_t size = fs::file_size(path, ec);
+	if (ec) return false;
+
+	std::lock_guard<std::mutex> lock(this->filesmutex);
+	auto it = this->files.find(filename);
+	if (it != this->files.end() && it->second.mtime == mtime && it->second.size == size &&
+			mtime < it->second.hashtime - 1) {
+		hash = it->second.hash;
+		return true;
+	}
+
+	std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+	if (!in.is_open()) return false;
+	std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	if (in.bad()) return false;
+
+	FileInfo &info = this->files[filename];
+	info.mtime = mtime;
+	info.size = size;
+	info.hashtime = time(NULL);
+	info.hash = hash128(data).toString();
+	hash = info.hash;
+	return true;
+}
+
+void ImportCache::clear()
+{
+	this->cache.clear();
+	std::lock_guard<std::mutex> lock(this->filesmutex);
+	this->files.clear();
+}
+
+CacheStats ImportCache::stats() const
+{
+	CacheStats st = this->cache.stats();
+	st.hits = this->hits;
+	st.misses = this->misses;
+	return st;
+}
+
+void ImportCache::print()
+{
+	PRINTB("Imports in cache: %d", this->cache.size());
+	PRINTB("Import cache size in bytes: %d", this->cache.totalCost());
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <atomic>
+#include <time.h>
+#include "cache.h"
+#include "memory.h"
+#include "Geometry.h"
+
+/*!
+	Cache of imported geometry, keyed by file contents rather than file name.
+
+	The contents are hashed together with the import parameters. To avoid
+	rehashing unchanged files, the hash is remembered per file along with
+	its size and modification time, and reused as long as those match. Files
+	modified right before they were hashed are always rehashed, since a
+	later change within the timestamp resolution would go unnoticed.
+
+	Entries are kept under a separate memory budget, so imports survive
+	eviction from GeometryCache (e.g. when a touched file changes the
+	node's cache key).
+*/
+class ImportCache
+{
+public:
+	ImportCache(size_t memorylimit = 100*1024*1024) : cache(memorylimit), hits(0), misses(0) {}
+
+	static ImportCache *instance() { static ImportCache *inst = new ImportCache; return inst; }
+
+	typedef std::function<shared_ptr<const Geometry>()> Importer;
+	shared_ptr<const Geometry> get(const class ImportNode &node, const Importer &import);
+
+	size_t maxSize() const { return this->cache.maxCost(); }
+	void setMaxSize(size_t limit) { this->cache.setMaxCost(limit); }
+	void clear();
+	CacheStats stats() const;
+	void print();
+
+private:
+	bool contentHash(const std::string &filename, std::string &hash);
+
+	struct FileInfo {
+		time_t mtime;
+		uintmax_t size;
+		time_t hashtime;
+		std::string hash;
+	};
+	std::mutex filesmutex;
+	std::unordered_map<std::string, FileInfo> files;
+
+	struct cache_entry {
+		shared_ptr<const Geometry> geom;
+		cache_entry(const shared_ptr<const Geometry> &geom) : geom(geom) {}
+	};
+	ShardedCache<std::string, cache_entry> cache;
+	std::atomic<size_t> hits;
+	std::atomic<size_t> misses;
+};
@@ -0,0 +1,249 @@
+#include "InstantiationCache.h"
+#include "FileModule.h"
+#include "ModuleCache.h"
+#include "UserModule.h"
+#include "ModuleInstantiation.h"
+#include "expression.h"
+#include "function.h"
+#include "context.h"
+#include "node.h"
+#include "Tree.h"
+#include "printutils.h"
+
+#include <sstream>
+#include <algorithm>
+#include <boost/lexical_cast.hpp>
+
+/*
+	Builtins whose results don't only depend on the design text. Statements
+	using them, directly or through the file's modules and functions, are
+	never reused.
+*/
+static const char *volatile_builtins[] = {
+	"import(", "import_stl(", "import_off(", "import_dxf(", "surface(",
+	"dxf_dim(", "dxf_cross(", "dxf_linear_extrude(", "dxf_rotate_extrude(",
+	"rands(", NULL
+};
+
+// Special variables which callers may set in the top-level context
+static const char *special_variables[] = { "$t", "$vpt", "$vpr", "$vpd", NULL };
+
+static bool is_volatile(const std::string &text)
+{
+	for (int i=0;volatile_builtins[i];i++) {
+		if (text.find(volatile_builtins[i]) != std::string::npos) return true;
+	}
+	return false;
+}
+
+void InstantiationCache::clear()
+{
+	deleteEntries(this->entries);
+	// Pending subtrees are owned by the current node tree
+	this->pending.clear();
+	this->restored.clear();
+	this->instpaths.clear();
+	this->pathinsts.clear();
+	this->environment.clear();
+	this->reusable = false;
+}
+
+void InstantiationCache::deleteEntries(EntryMap &entries)
+{
+	for(auto &e : entries) delete e.second.node;
+	entries.clear();
+}
+
+/*!
+	Takes ownership of the subtrees stored during the last instantiation,
+	removing them from \a root. Must be called before the old node tree is
+	deleted.
+*/
+void InstantiationCache::detach(AbstractNode &root)
+{
+	deleteEntries(this->entries);
+	for(auto &e : this->pending) {
+		auto it = std::find(root.children.begin(), root.children.end(), e.second.node);
+		if (it == root.children.end()) continue;
+		root.children.erase(it);
+		this->entries.insert(e);
+	}
+	this->pending.clear();
+}
+
+/*!
+	Seeds \a tree with the id strings of all reused nodes.
+*/
+void InstantiationCache::restoreIds(Tree &tree) const
+{
+	for(const auto &id : this->restored) tree.setIdString(*id.first, id.second);
+}
+
+/*!
+	Remembers the id strings of the stored subtrees, so they can be restored
+	if the subtrees are reused.
+*/
+void InstantiationCache::saveIds(const Tree &tree)
+{
+	for(auto &e : this->pending) {
+		e.second.ids.clear();
+		collectIds(e.second.node, tree, e.second.ids);
+	}
+}
+
+void InstantiationCache::collectIds(AbstractNode *node, const Tree &tree, NodeStrings &ids)
+{
+	if (!tree.hasIdString(*node)) return;
+	ids.push_back(std::make_pair(node, tree.getIdString(*node)));
+	for(const auto &child : node->children) collectIds(child, tree, ids);
+}
+
+/*!
+	Prepares for instantiating \a module. Subtrees from the previous
+	instantiation are discarded if anything but the top-level statements
+	changed.
+*/
+void InstantiationCache::begin(const FileModule &module, const Context *ctx)
+{
+	std::stringstream env;
+	for(const auto &f : module.scope.functions) env << f.second->dump("", f.first);
+	for(const auto &m : module.scope.modules) env << m.second->dump("", m.first);
+	for(const auto &ass : module.scope.assignments) env << ass.name << " = " << *ass.expr << ";\n";
+	std::vector<std::string> libs(module.usedlibs.begin(), module.usedlibs.end());
+	std::sort(libs.begin(), libs.end());
+	for(const auto &lib : libs) env << "use <" << lib << ">\n";
+	env << "libraries " << ModuleCache::instance()->generation() << "\n";
+	env << "path " << module.modulePath() << "\n";
+	for (int i=0;special_variables[i];i++) {
+		env << special_variables[i] << " = " << ctx->lookup_variable(special_variables[i], true)->toString() << "\n";
+	}
+
+	// Pending subtrees which weren't detached are gone with their tree
+	this->pending.clear();
+	this->restored.clear();
+	this->reused = 0;
+	if (env.str() != this->environment) deleteEntries(this->entries);
+	this->environment = env.str();
+	this->reusable = !is_volatile(this->environment);
+
+	this->instpaths.clear();
+	this->pathinsts.clear();
+	if (this->reusable) collectPaths(module.scope, "");
+}
+
+/*!
+	Deletes subtrees from the previous instantiation which weren't reused.
+*/
+void InstantiationCache::end()
+{
+	deleteEntries(this->entries);
+	PRINTDB("Reused %d of %d top-level subtrees", this->reused % this->pending.size());
+}
+
+/*!
+	Returns the subtree previously instantiated from an identical statement,
+	updated to belong to the current instantiation, or NULL if there is none.
+	\a index is the position of \a statement in the file.
+*/
+AbstractNode *InstantiationCache::take(const ModuleInstantiation *statement, size_t index)
+{
+	if (!this->reusable || this->entries.empty()) return NULL;
+	auto it = this->entries.find(statement->dump(""));
+	if (it == this->entries.end()) return NULL;
+
+	Entry &e = it->second;
+	const std::string prefix = "/" + boost::lexical_cast<std::string>(index);
+	std::vector<const ModuleInstantiation *> insts;
+	for(const auto &p : e.paths) {
+		const std::string path = (p.second[0] == '@') ? prefix + p.second.substr(1) : p.second;
+		auto inst = this->pathinsts.find(path);
+		if (inst == this->pathinsts.end()) {
+			delete e.node;
+			this->entries.erase(it);
+			return NULL;
+		}
+		insts.push_back(inst->second);
+	}
+	for (size_t i=0;i<insts.size();i++) e.paths[i].first->modinst = insts[i];
+
+	AbstractNode *node = e.node;
+	node->reindex();
+	this->restored.insert(this->restored.end(), e.ids.begin(), e.ids.end());
+	this->entries.erase(it);
+	this->reused++;
+	return node;
+}
+
+/*!
+	Stores the subtree instantiated from \a statement for reuse by the next
+	instantiation. The subtree stays owned by the node tree until detach().
+*/
+void InstantiationCache::store(const ModuleInstantiation *statement, size_t index, AbstractNode *node)
+{
+	if (!this->reusable) return;
+	const std::string text = statement->dump("");
+	if (is_volatile(text)) return;
+
+	Entry e;
+	e.node = node;
+	if (!collectNodePaths(node, "/" + boost::lexical_cast<std::string>(index), e.paths)) return;
+	this->pending.insert(std::make_pair(text, e));
+}
+
+/*!
+	Assigns a path to every ModuleInstantiation in the AST, which identifies
+	it independently of its address: top-level statements are numbered,
+	module definitions are named.
+*/
+void InstantiationCache::collectPaths(const LocalScope &scope, const std::string &prefix)
+{
+	for (size_t i=0;i<scope.children.size();i++) {
+		collectPaths(scope.children[i], prefix + "/" + boost::lexical_cast<std::string>(i));
+	}
+	for(const auto &m : scope.modules) {
+		if (const UserModule *usermod = dynamic_cast<const UserModule *>(m.second)) {
+			collectPaths(usermod->scope, prefix + "#" + m.first);
+		}
+	}
+}
+
+void InstantiationCache::collectPaths(const ModuleInstantiation *inst, const std::string &path)
+{
+	this->instpaths[inst] = path;
+	this->pathinsts[path] = inst;
+	collectPaths(inst->scope, path);
+	if (const IfElseModuleInstantiation *ifelse = dynamic_cast<const IfElseModuleInstantiation *>(inst)) {
+		collectPaths(ifelse->else_scope, path + "/else");
+	}
+}
+
+/*!
+	Records the paths of the ModuleInstantiations referenced by the subtree.
+	Paths within the statement at \a prefix are stored relative to it, since
+	the statement may move. Instantiations outside of the AST (library
+	modules, the caller's root instantiation) stay valid as long as the
+	environment is unchanged and aren't recorded.
+
+	Returns false if the subtree references another top-level statement.
+*/
+bool InstantiationCache::collectNodePaths(AbstractNode *node, const std::string &prefix, NodeStrings &paths) const
+{
+	auto it = this->instpaths.find(node->modinst);
+	if (it != this->instpaths.end()) {
+		const std::string &path = it->second;
+		if (path.compare(0, prefix.size(), prefix) == 0 &&
+				(path.size() == prefix.size() || path[prefix.size()] == '/' || path[prefix.size()] == '#')) {
+			paths.push_back(std::make_pair(node, "@" + path.substr(prefix.size())));
+		}
+		else if (path[0] == '/') {
+			return false;
+		}
+		else {
+			paths.push_back(std::make_pair(node, path));
+		}
+	}
+	for(const auto &child : node->children) {
+		if (!collectNodePaths(child, prefix, paths)) return false;
+	}
+	return true;
+}
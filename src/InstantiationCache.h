@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/*!
+	Keeps the top-level subtrees of the previous instantiation of a design
+	alive, so that FileModule::instantiate() can reuse them for statements
+	which haven't changed since.
+
+	A statement's subtree is reused when the statement's text is unchanged,
+	and so is everything else it could depend on: the file's assignments,
+	function and module definitions, used libraries and the special
+	variables set by the caller. Statements which print messages, read files
+	or use random numbers are always instantiated again.
+
+	Reused nodes are renumbered, so node indices stay unique per tree, and
+	are pointed at the ModuleInstantiations of the new AST. Their id strings
+	can be carried over into the new Tree using saveIds()/restoreIds().
+*/
+class InstantiationCache
+{
+public:
+	InstantiationCache() : reusable(false), reused(0) {}
+	~InstantiationCache() { clear(); }
+
+	void clear();
+	size_t size() const { return this->entries.size() + this->pending.size(); }
+	size_t reusedCount() const { return this->reused; }
+
+	void detach(class AbstractNode &root);
+	void restoreIds(class Tree &tree) const;
+	void saveIds(const class Tree &tree);
+
+	// Used by FileModule::instantiate()
+	void begin(const class FileModule &module, const class Context *ctx);
+	AbstractNode *take(const class ModuleInstantiation *statement, size_t index);
+	void store(const ModuleInstantiation *statement, size_t index, AbstractNode *node);
+	void end();
+
+private:
+	typedef std::vector<std::pair<AbstractNode *, std::string>> NodeStrings;
+	struct Entry {
+		AbstractNode *node;
+		// Paths of the ModuleInstantiations referenced by nodes in the subtree
+		NodeStrings paths;
+		NodeStrings ids;
+	};
+	typedef std::unordered_multimap<std::string, Entry> EntryMap;
+
+	void collectPaths(const class LocalScope &scope, const std::string &prefix);
+	void collectPaths(const ModuleInstantiation *inst, const std::string &path);
+	bool collectNodePaths(AbstractNode *node, const std::string &prefix, NodeStrings &paths) const;
+	static void collectIds(AbstractNode *node, const Tree &tree, NodeStrings &ids);
+	static void deleteEntries(EntryMap &entries);
+
+	std::string environment;
+	bool reusable;
+	size_t reused;
+	// Subtrees of the previous instantiation, owned after detach(), keyed by statement text
+	EntryMap entries;
+	// Subtrees of the current instantiation, still owned by the node tree
+	EntryMap pending;
+	NodeStrings restored;
+	// ModuleInstantiation paths of the current AST
+	std::unordered_map<const ModuleInstantiation *, std::string> instpaths;
+	std::unordered_map<std::string, const ModuleInstantiation *> pathinsts;
+};
@@ -0,0 +1,170 @@
+#include "LibraryIndex.h"
+#include "FileWatcher.h"
+#include "parsersettings.h"
+#include "openscad.h"
+
+#include <fstream>
+#include <sstream>
+#include <cctype>
+
+namespace {
+	bool is_identifier_char(char c)
+	{
+		return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '$';
+	}
+
+	/*!
+		Scans OpenSCAD source text like the lexer does, recording the
+		module and function definitions outside of any braces or brackets.
+		The scan may find more definitions than there are, e.g. in
+		included files, but never misses one.
+	*/
+	class SymbolScanner
+	{
+	public:
+		SymbolScanner(LibrarySymbols &symbols) : symbols(symbols) {}
+
+		void scanFile(const std::string &filename) {
+			LibrarySymbols::SourceFile file = { filename, false, 0, 0 };
+			struct stat st;
+			file.valid = FileWatcher::instance()->stat(filename, st);
+			file.mtime = st.st_mtime;
+			file.size = st.st_size;
+			this->symbols.files.push_back(file);
+			if (!file.valid) return;
+
+			// Include cycles are errors, the parser will report them
+			if (this->open.find(filename) != this->open.end()) return;
+			std::ifstream ifs(filename.c_str(), std::ios::binary);
+			if (!ifs.is_open()) {
+				this->symbols.complete = false;
+				return;
+			}
+			std::stringstream buf;
+			buf << ifs.rdbuf();
+			this->open.insert(filename);
+			scan(buf.str(), fs::path(filename).parent_path());
+			this->open.erase(filename);
+		}
+
+		void scan(const std::string &text, const fs::path &dir) {
+			int depth = 0;
+			std::string pending; // "module" or "function" before a name
+			size_t i = 0;
+			const size_t n = text.size();
+			while (i < n) {
+				const char c = text[i];
+				if (c == '/' && i + 1 < n && text[i + 1] == '/') {
+					i = text.find('\n', i);
+					if (i == std::string::npos) break;
+				}
+				else if (c == '/' && i + 1 < n && text[i + 1] == '*') {
+					i = text.find("*/", i + 2);
+					if (i == std::string::npos) break;
+					i += 2;
+				}
+				else if (c == '"') {
+					for (i++; i < n && text[i] != '"'; i++) {
+						if (text[i] == '\\') i++;
+					}
+					i++;
+					pending.clear();
+				}
+				else if (is_identifier_char(c)) {
+					const size_t start = i;
+					while (i < n && is_identifier_char(text[i])) i++;
+					const std::string word = text.substr(start, i - start);
+					if ((word == "include" || word == "use") && scanPath(text, i, dir, word == "include")) {
+						pending.clear();
+						continue;
+					}
+					if (!pending.empty()) {
+						if (pending == "module") this->symbols.modules.insert(word);
+						else this->symbols.functions.insert(word);
+						pending.clear();
+					}
+					else if (depth == 0 && (word == "module" || word == "function")) {
+						pending = word;
+					}
+				}
+				else {
+					if (c == '{' || c == '(' || c == '[') depth++;
+					else if (c == '}' || c == ')' || c == ']') depth--;
+					// Unbalanced text is a syntax error, or something not understood
+					if (depth < 0) this->symbols.complete = false;
+					if (!std::isspace(static_cast<unsigned char>(c))) pending.clear();
+					i++;
+				}
+			}
+			if (depth != 0) this->symbols.complete = false;
+		}
+
+	private:
+		/*!
+			Handles the <path> after include or use at \a i, scanning included
+			files. Returns false if \a i isn't at a path.
+		*/
+		bool scanPath(const std::string &text, size_t &i, const fs::path &dir, bool include) {
+			size_t j = i;
+			while (j < text.size() && (std::isspace(static_cast<unsigned char>(text[j])) || text[j] == '>')) j++;
+			if (j >= text.size() || text[j] != '<') return false;
+			const size_t end = text.find('>', j + 1);
+			if (end == std::string::npos) return false;
+			i = end + 1;
+			if (!include) return true;
+
+			std::string localpath;
+			for (size_t k = j + 1; k < end; k++) {
+				if (text[k] != '\t' && text[k] != '\r' && text[k] != '\n') localpath += text[k];
+			}
+			fs::path fullpath = find_valid_path(dir, fs::path(localpath));
+			// Files which appear later could define anything
+			if (fullpath.empty()) this->symbols.complete = false;
+			else scanFile(fullpath.generic_string());
+			return true;
+		}
+
+		LibrarySymbols &symbols;
+		std::unordered_set<std::string> open;
+	};
+
+	bool unchanged(const LibrarySymbols &symbols)
+	{
+		for(const auto &file : symbols.files) {
+			struct stat st;
+			const bool valid = FileWatcher::instance()->stat(file.filename, st);
+			if (valid != file.valid) return false;
+			if (valid && (st.st_mtime != file.mtime || st.st_size != file.size)) return false;
+		}
+		return true;
+	}
+}
+
+/*!
+	Returns the symbols of the library \a filename, scanning it if it's
+	new or changed. Sets \a changed if it changed since the last call.
+*/
+shared_ptr<const LibrarySymbols> LibraryIndex::symbols(const std::string &filename, bool *changed)
+{
+	if (changed) *changed = false;
+	std::lock_guard<std::mutex> lock(this->mutex);
+	auto it = this->entries.find(filename);
+	if (it != this->entries.end()) {
+		if (unchanged(*it->second)) return it->second;
+		if (changed) *changed = true;
+	}
+
+	auto symbols = make_shared<LibrarySymbols>();
+	SymbolScanner scanner(*symbols);
+	scanner.scanFile(filename);
+	// The parser appends the command line assignments to each library
+	scanner.scan(commandline_commands, fs::path(filename).parent_path());
+	this->entries[filename] = symbols;
+	return symbols;
+}
+
+void LibraryIndex::clear()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->entries.clear();
+}
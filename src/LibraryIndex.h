@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <time.h>
+#include "memory.h"
+
+/*!
+	The names of the modules and functions a library file may define at
+	top level, including those from files it includes. Found by scanning
+	the text for module and function definitions, without parsing it.
+*/
+class LibrarySymbols
+{
+public:
+	LibrarySymbols() : complete(true) {}
+
+	bool mayDefineModule(const std::string &name) const {
+		return !this->complete || this->modules.find(name) != this->modules.end();
+	}
+	bool mayDefineFunction(const std::string &name) const {
+		return !this->complete || this->functions.find(name) != this->functions.end();
+	}
+
+	// False if the scan was inconclusive, so the file may define anything
+	bool complete;
+	std::unordered_set<std::string> modules;
+	std::unordered_set<std::string> functions;
+
+	struct SourceFile {
+		std::string filename;
+		bool valid;
+		time_t mtime;
+		off_t size;
+	};
+	// The scanned files, to detect changes
+	std::vector<SourceFile> files;
+};
+
+/*!
+	Caches the symbols of library files until the files change. Used to
+	parse libraries included with use<> only when something they define is
+	called, see the lazy-use feature.
+*/
+class LibraryIndex
+{
+public:
+	static LibraryIndex *instance() { static LibraryIndex *inst = new LibraryIndex; return inst; }
+
+	shared_ptr<const LibrarySymbols> symbols(const std::string &filename, bool *changed = NULL);
+	void clear();
+
+private:
+	LibraryIndex() {}
+
+	std::mutex mutex;
+	std::unordered_map<std::string, shared_ptr<const LibrarySymbols>> entries;
+};
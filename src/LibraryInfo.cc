@@ -8,6 +8,7 @@
 #include "version_check.h"
 #include "PlatformUtils.h"
 #include "openscad.h"
+#include "feature.h"
 #define STRINGIFY(x) #x
 #define TOSTRING(x) STRINGIFY(x)
 
@@ -85,6 +86,7 @@ std::string LibraryInfo::info()
 	std::string cgal_2d_kernelEx = "";
 #endif // ENABLE_CGAL
 
+	const std::string features = Feature::enabledNames();
 	const char *env_path = getenv("OPENSCADPATH");
 	const char *env_font_path = getenv("OPENSCAD_FONT_PATH");
 	
@@ -100,6 +102,7 @@ std::string LibraryInfo::info()
 	  << "\nQScintilla version: " << QSCINTILLA_VERSION_STR
 #endif
 	  << "\nMingW build: " << mingwstatus
+	  << "\nEnabled features: " << (features.empty() ? "<none>" : features)
 	  << "\nGLib version: "       << GLIB_MAJOR_VERSION << "." << GLIB_MINOR_VERSION << "." << GLIB_MICRO_VERSION
 	  << "\nApplication Path: " << PlatformUtils::applicationPath()
 	  << "\nDocuments Path: " << PlatformUtils::documentsPath()
@@ -10,6 +10,7 @@
 #include "module.h"
 #include "ModuleInstantiation.h"
 #include "Tree.h"
+#include "InstantiationCache.h"
 #include "memory.h"
 #include "editor.h"
 #include "export.h"
@@ -33,10 +34,13 @@ public:
 	double anim_tval;
 	bool anim_dumping;
 	int anim_dump_start_step;
+	int anim_prefetchstep; // The next step the frame prefetcher delivers
 
 	QTimer *autoReloadTimer;
 	std::string autoReloadId;
+	std::string autoReloadHash; // Of the contents of the file when autoReloadId was set
 	QTimer *waitAfterReloadTimer;
+	QTimer *livePreviewTimer; // Waits for a pause in typing
 
 	QTime renderingTime;
 
@@ -46,9 +50,12 @@ public:
 	AbstractNode *absolute_root_node; // Result of tree evaluation
 	AbstractNode *root_node;          // Root if the root modifier (!) is used
 	Tree tree;
+	InstantiationCache instcache;     // Subtrees kept for the next instantiation
 
 #ifdef ENABLE_CGAL
 	shared_ptr<const class Geometry> root_geom;
+	shared_ptr<class PolySet> partial_geom; // Finished parts of the running render
+	bool restartrender;
 	class CGALRenderer *cgalRenderer;
 #endif
 #ifdef ENABLE_OPENCSG
@@ -91,19 +98,26 @@ private slots:
 	void setColorScheme(const QString &cs);
 	void showProgress();
 	void openCSGSettingsChanged();
-	void consoleOutput(const QString &msg);
+	void flushConsole();
 
 private:
         void initActionIcon(QAction *action, const char *darkResource, const char *lightResource);
         void handleFileDrop(const QString &filename);
 	void refreshDocument();
         void updateCamera();
+	void updateCamera(const ValuePtr &vpt, const ValuePtr &vpr, const ValuePtr &vpd);
 	void updateTemporalVariables();
 	bool fileChangedOnDisk();
 	void compileTopLevelDocument();
+	void parseTopLevelDocument(const std::string &fulltext, const std::string &filename);
         void updateCompileResult();
 	void compile(bool reload, bool forcedone = false);
-	void compileCSG(bool procevents);
+	void compileCSG();
+	void startPreview();
+	void showPreview();
+	void showPreviewMode();
+	void updatePreviewRenderers();
+	bool showPrefetchedFrame(int step);
 	bool maybeSave();
         void saveError(const QIODevice &file, const std::string &msg);
 	bool checkEditorModified();
@@ -149,6 +163,7 @@ private slots:
 	void hideToolbars();
 	void hideEditor();
 	void hideConsole();
+	void hideCachePanel();
 	void showConsole();
 
 private slots:
@@ -172,10 +187,14 @@ private slots:
 	void actionRenderPreview();
 	void csgRender();
 	void csgReloadRender();
+	void actionRenderPreviewPartial();
+	void actionRenderPreviewDone();
 #ifdef ENABLE_CGAL
 	void actionRender();
+	void actionRenderPartial(shared_ptr<const class Geometry>);
 	void actionRenderDone(shared_ptr<const class Geometry>);
 	void cgalRender();
+	void actionExportDone(bool);
 #endif
 	void actionCheckValidity();
 	void actionDisplayAST();
@@ -185,6 +204,7 @@ private slots:
 	void actionExportSTL();
 	void actionExportOFF();
 	void actionExportAMF();
+	void actionExport3MF();
 	void actionExportDXF();
 	void actionExportSVG();
 	void actionExportCSG();
@@ -218,6 +238,7 @@ public slots:
 	void viewModeShowAxes();
 	void viewModeShowCrosshairs();
 	void viewModeShowScaleProportional();
+	void viewModeShowFrameTime();
 	void viewModeAnimate();
 	void viewAngleTop();
 	void viewAngleBottom();
@@ -245,6 +266,8 @@ public slots:
 	void checkAutoReload();
 	void waitAfterReload();
 	void autoReloadSet(bool);
+	void livePreviewSet(bool);
+	void livePreview();
 	void setContentsChanged();
 
 private:
@@ -264,7 +287,16 @@ private:
 	class QTemporaryFile *tempFile;
 	class ProgressWidget *progresswidget;
 	class CGALWorker *cgalworker;
+	class ExportWorker *exportworker;
+	const char *exporttype; // Of the running export, e.g. "STL"
+	class CSGWorker *csgworker;
+	bool restartpreview; // Set when the design changes during a preview
+	bool livepreviewing; // Set while the CSG worker parses and instantiates for a live preview
+	class FramePrefetcher *prefetcher; // Evaluates the frames of a playing animation ahead
+	bool dumpframe;      // Save the preview as an animation frame
 	QMutex consolemutex;
+	QStringList pendingConsole;  // Messages not yet shown, guarded by consolemutex
+	QTime consoleFlushTime;
 	bool contentschanged; // Set if the source code has changes since the last render (F6)
 
 signals:
@@ -0,0 +1,98 @@
+#include "MemoryAccounting.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace MemoryAccounting {
+
+const char *name(Category category)
+{
+	static const char *names[NUM_CATEGORIES] = {
+		"other", "parser", "instantiation", "values", "nodes", "geometry", "cgal"
+	};
+	return category < NUM_CATEGORIES ? names[category] : "unknown";
+}
+
+#ifdef ENABLE_MEMORY_ACCOUNTING
+
+thread_local unsigned char current = OTHER;
+
+// Constant initialized, so they can be used by allocations before main()
+static std::atomic<size_t> live[NUM_CATEGORIES];
+static std::atomic<size_t> peak[NUM_CATEGORIES];
+
+size_t liveBytes(Category category) { return live[category]; }
+size_t peakBytes(Category category) { return peak[category]; }
+
+void resetPeaks()
+{
+	for (int i = 0; i < NUM_CATEGORIES; i++) peak[i] = size_t(live[i]);
+}
+
+/*!
+	Precedes each allocation, keeping the alignment malloc() guarantees.
+*/
+union Header {
+	struct {
+		size_t size;
+		unsigned char category;
+	} info;
+	std::max_align_t align;
+};
+
+static void *allocate(size_t size)
+{
+	Header *header = static_cast<Header *>(std::malloc(sizeof(Header) + size));
+	if (!header) return NULL;
+	const unsigned char category = current;
+	header->info.size = size;
+	header->info.category = category;
+	const size_t bytes = live[category] += size;
+	size_t p = peak[category];
+	while (bytes > p && !peak[category].compare_exchange_weak(p, bytes)) {}
+	return header + 1;
+}
+
+static void deallocate(void *ptr)
+{
+	if (!ptr) return;
+	Header *header = static_cast<Header *>(ptr) - 1;
+	live[header->info.category] -= header->info.size;
+	std::free(header);
+}
+
+static void *allocate_or_throw(size_t size)
+{
+	for (;;) {
+		if (void *ptr = allocate(size ? size : 1)) return ptr;
+		std::new_handler handler = std::set_new_handler(NULL);
+		std::set_new_handler(handler);
+		if (!handler) throw std::bad_alloc();
+		handler();
+	}
+}
+
+#else
+
+size_t liveBytes(Category) { return 0; }
+size_t peakBytes(Category) { return 0; }
+void resetPeaks() {}
+
+#endif // ENABLE_MEMORY_ACCOUNTING
+
+}
+
+#ifdef ENABLE_MEMORY_ACCOUNTING
+
+void *operator new(size_t size) { return MemoryAccounting::allocate_or_throw(size); }
+void *operator new[](size_t size) { return MemoryAccounting::allocate_or_throw(size); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept { return MemoryAccounting::allocate(size ? size : 1); }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return MemoryAccounting::allocate(size ? size : 1); }
+void operator delete(void *ptr) noexcept { MemoryAccounting::deallocate(ptr); }
+void operator delete[](void *ptr) noexcept { MemoryAccounting::deallocate(ptr); }
+void operator delete(void *ptr, const std::nothrow_t &) noexcept { MemoryAccounting::deallocate(ptr); }
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept { MemoryAccounting::deallocate(ptr); }
+
+#endif // ENABLE_MEMORY_ACCOUNTING
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+
+/*!
+	Attribution of the heap to subsystems, compiled in with
+	ENABLE_MEMORY_ACCOUNTING (CONFIG+=memory-accounting).
+
+	The global operator new is replaced to tag each allocation with the
+	category of the innermost Scope on the allocating thread, and to count
+	the live and peak bytes of each category. Memory is returned to the
+	category it was allocated for, wherever it is freed. Without the build
+	flag, Scope does nothing and no counts are available.
+*/
+namespace MemoryAccounting {
+	enum Category {
+		OTHER,
+		PARSER,        // AST of the parsed files
+		INSTANTIATION, // Contexts and other data of module instantiation
+		VALUES,
+		NODES,
+		GEOMETRY,      // PolySets, Polygon2ds and evaluation temporaries
+		CGAL,          // Nef polyhedra and CGAL temporaries
+		NUM_CATEGORIES
+	};
+
+	const char *name(Category category);
+
+#ifdef ENABLE_MEMORY_ACCOUNTING
+	extern thread_local unsigned char current;
+
+	class Scope {
+	public:
+		Scope(Category category) : previous(current) { current = category; }
+		~Scope() { current = this->previous; }
+	private:
+		unsigned char previous;
+	};
+
+	inline bool isAvailable() { return true; }
+	inline Category currentCategory() { return Category(current); }
+#else
+	class Scope {
+	public:
+		Scope(Category) {}
+	};
+
+	inline bool isAvailable() { return false; }
+	inline Category currentCategory() { return OTHER; }
+#endif
+
+	size_t liveBytes(Category category);
+	size_t peakBytes(Category category);
+	// Starts measuring peaks from the current live bytes
+	void resetPeaks();
+}
@@ -0,0 +1,348 @@
+#include "MeshValidator.h"
+#include "polyset.h"
+#include "PolySetBVH.h"
+#include "ThreadPool.h"
+#include "printutils.h"
+
+#include <algorithm>
+#include <functional>
+#include <cstdint>
+
+namespace {
+	// Faces are checked as fans from their first vertex, keeping the indices
+	struct Triangle {
+		uint32_t v[3];
+		uint32_t face;
+	};
+
+	// An edge of a triangle, with its lower vertex index first
+	struct Edge {
+		uint32_t a, b;
+		uint32_t reversed; // If the triangle goes from b to a
+		bool operator<(const Edge &other) const {
+			return this->a < other.a || (this->a == other.a && this->b < other.b);
+		}
+		bool sameVertices(const Edge &other) const { return this->a == other.a && this->b == other.b; }
+	};
+
+	// Problems found by one batch, merged in batch order
+	struct Findings {
+		Findings() : degenerate(0), volume(0), intersections(0) {}
+		size_t degenerate;
+		double volume;
+		size_t intersections;
+		std::vector<MeshValidator::Problem> problems;
+	};
+}
+
+// Items per task
+static const size_t BATCH_SIZE = 2000;
+
+/*!
+	Calls \a f for batches [first, last[ of the n items, on the thread pool
+	if there's more than one, and waits for all of them.
+*/
+static void for_batches(size_t n, const std::function<void(size_t, size_t, size_t)> &f)
+{
+	const size_t batches = (n + BATCH_SIZE - 1) / BATCH_SIZE;
+	if (batches <= 1) {
+		if (n > 0) f(0, 0, n);
+		return;
+	}
+	ThreadPool *pool = ThreadPool::instance();
+	ThreadPool::TaskGroup group;
+	for (size_t b = 0; b < batches; b++) {
+		pool->run(group, [&f, b, n]() { f(b, b * BATCH_SIZE, std::min(n, (b + 1) * BATCH_SIZE)); });
+	}
+	pool->wait(group);
+}
+
+/*!
+	Sorts \a edges by sorting batches in parallel, then merging pairs of
+	sorted runs in parallel until one is left.
+*/
+static void sort_edges(std::vector<Edge> &edges)
+{
+	const size_t n = edges.size();
+	for_batches(n, [&edges](size_t, size_t first, size_t last) {
+			std::sort(edges.begin() + first, edges.begin() + last);
+		});
+	for (size_t run = BATCH_SIZE; run < n; run *= 2) {
+		for_batches((n + 2 * run - 1) / (2 * run), [&edges, n, run](size_t, size_t first, size_t last) {
+				for (size_t i = first; i < last; i++) {
+					const size_t start = i * 2 * run, mid = std::min(n, start + run), end = std::min(n, start + 2 * run);
+					std::inplace_merge(edges.begin() + start, edges.begin() + mid, edges.begin() + end);
+				}
+			});
+	}
+}
+
+static double orient(const Vector3d &a, const Vector3d &b, const Vector3d &c, const Vector3d &d)
+{
+	return (b - a).cross(c - a).dot(d - a);
+}
+
+static double orient2d(const Vector2d &a, const Vector2d &b, const Vector2d &c)
+{
+	return (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+}
+
+static bool opposite(double x, double y)
+{
+	return (x > 0 && y < 0) || (x < 0 && y > 0);
+}
+
+/*!
+	Returns true if the segment pq crosses the plane of triangle t inside
+	it, or also on its edges if \a edges, setting \a at to the crossing.
+*/
+static bool segment_crosses(const Vector3d &p, const Vector3d &q, const Vector3d *t, bool edges, Vector3d &at)
+{
+	const double dp = orient(t[0], t[1], t[2], p), dq = orient(t[0], t[1], t[2], q);
+	if (!opposite(dp, dq)) return false;
+	const double s0 = orient(p, q, t[0], t[1]), s1 = orient(p, q, t[1], t[2]), s2 = orient(p, q, t[2], t[0]);
+	const bool inside = edges ?
+		(s0 >= 0 && s1 >= 0 && s2 >= 0) || (s0 <= 0 && s1 <= 0 && s2 <= 0) :
+		(s0 > 0 && s1 > 0 && s2 > 0) || (s0 < 0 && s1 < 0 && s2 < 0);
+	if (!inside) return false;
+	at = p + (q - p) * (dp / (dp - dq));
+	return true;
+}
+
+static bool inside2d(const Vector2d &p, const Vector2d *t)
+{
+	const double s0 = orient2d(t[0], t[1], p), s1 = orient2d(t[1], t[2], p), s2 = orient2d(t[2], t[0], p);
+	return (s0 > 0 && s1 > 0 && s2 > 0) || (s0 < 0 && s1 < 0 && s2 < 0);
+}
+
+/*!
+	Returns true if the coplanar triangles a and b overlap, projecting them
+	along the axis closest to their normal \a n.
+*/
+static bool coplanar_overlap(const Vector3d *a, const Vector3d *b, const Vector3d &n, Vector3d &at)
+{
+	int axis;
+	n.cwiseAbs().maxCoeff(&axis);
+	const int x = (axis + 1) % 3, y = (axis + 2) % 3;
+	Vector2d a2[3], b2[3];
+	for (int i = 0; i < 3; i++) {
+		a2[i] = Vector2d(a[i][x], a[i][y]);
+		b2[i] = Vector2d(b[i][x], b[i][y]);
+	}
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 3; j++) {
+			const Vector2d &p = a2[i], &q = a2[(i + 1) % 3], &r = b2[j], &s = b2[(j + 1) % 3];
+			const double o1 = orient2d(p, q, r), o2 = orient2d(p, q, s);
+			if (opposite(o1, o2) && opposite(orient2d(r, s, p), orient2d(r, s, q))) {
+				at = b[j] + (b[(j + 1) % 3] - b[j]) * (o1 / (o1 - o2));
+				return true;
+			}
+		}
+	}
+	for (int i = 0; i < 3; i++) {
+		if (inside2d(a2[i], b2)) { at = a[i]; return true; }
+		if (inside2d(b2[i], a2)) { at = b[i]; return true; }
+	}
+	return false;
+}
+
+/*!
+	Returns true if triangles s and t of the mesh cross each other.
+	Triangles sharing an edge only cross if they fold onto each other;
+	triangles sharing a vertex if an edge opposite to it crosses the other.
+	Other triangles mustn't touch at all, so their edges also count.
+*/
+static bool triangles_cross(const std::vector<Vector3d> &vertices, const Triangle &s, const Triangle &t, Vector3d &at)
+{
+	Vector3d a[3], b[3];
+	int shared = 0, sa = -1, sb = -1; // Shared vertex
+	for (int i = 0; i < 3; i++) {
+		a[i] = vertices[s.v[i]];
+		b[i] = vertices[t.v[i]];
+		for (int j = 0; j < 3; j++) {
+			if (s.v[i] == t.v[j]) {
+				shared++;
+				sa = i;
+				sb = j;
+			}
+		}
+	}
+	const Vector3d n = (a[1] - a[0]).cross(a[2] - a[0]);
+	const bool coplanar = orient(a[0], a[1], a[2], b[0]) == 0 && orient(a[0], a[1], a[2], b[1]) == 0 &&
+		orient(a[0], a[1], a[2], b[2]) == 0;
+
+	if (shared >= 2) {
+		if (shared > 2 || !coplanar) return false;
+		// Folded if the vertices which aren't shared are on the same side of the edge
+		int ia = 0, ib = 0;
+		while (s.v[ia] == t.v[0] || s.v[ia] == t.v[1] || s.v[ia] == t.v[2]) ia++;
+		while (t.v[ib] == s.v[0] || t.v[ib] == s.v[1] || t.v[ib] == s.v[2]) ib++;
+		const Vector3d &p = a[(ia + 1) % 3], &q = a[(ia + 2) % 3];
+		if ((q - p).cross(a[ia] - p).dot((q - p).cross(b[ib] - p)) <= 0) return false;
+		at = (a[ia] + b[ib]) / 2;
+		return true;
+	}
+	if (coplanar) return coplanar_overlap(a, b, n, at);
+	if (shared == 1) {
+		return segment_crosses(a[(sa + 1) % 3], a[(sa + 2) % 3], b, false, at) ||
+			segment_crosses(b[(sb + 1) % 3], b[(sb + 2) % 3], a, false, at);
+	}
+	for (int i = 0; i < 3; i++) {
+		if (segment_crosses(a[i], a[(i + 1) % 3], b, true, at) || segment_crosses(b[i], b[(i + 1) % 3], a, true, at)) return true;
+	}
+	return false;
+}
+
+namespace MeshValidator {
+
+const char *Problem::description() const
+{
+	switch (this->type) {
+	case OPEN_EDGE: return "Open edge";
+	case NONMANIFOLD_EDGE: return "Edge of more than two faces";
+	case FLIPPED_EDGE: return "Edge between faces of opposite orientation";
+	case DEGENERATE_FACE: return "Degenerate face";
+	case INSIDE_OUT: return "Mesh is inside out";
+	case SELF_INTERSECTION: return "Faces intersect";
+	}
+	return "";
+}
+
+void Report::print() const
+{
+	PRINTB("   Valid:      %6s", (isValid() ? "yes" : "no"));
+	PRINTB("   Triangles:  %6d", this->triangles);
+	if (this->openedges) PRINTB("   Open edges: %6d", this->openedges);
+	if (this->nonmanifoldedges) PRINTB("   Edges of more than two faces: %d", this->nonmanifoldedges);
+	if (this->flippededges) PRINTB("   Edges between faces of opposite orientation: %d", this->flippededges);
+	if (this->degeneratefaces) PRINTB("   Degenerate faces: %d", this->degeneratefaces);
+	if (this->selfintersections) PRINTB("   Intersecting triangle pairs: %d", this->selfintersections);
+	for (const auto &problem : this->problems) {
+		PRINTB("   %s at [%g, %g, %g]", problem.description() % problem.position[0] % problem.position[1] % problem.position[2]);
+	}
+}
+
+/*!
+	Checks \a ps, keeping the positions of up to \a maxproblems problems
+	of each type.
+*/
+Report validate(const PolySet &ps, size_t maxproblems)
+{
+	Report report;
+	const std::vector<Vector3d> &vertices = ps.getVertices();
+
+	std::vector<Triangle> triangles;
+	std::vector<Findings> findings((ps.numPolygons() + BATCH_SIZE - 1) / BATCH_SIZE);
+	for (size_t f = 0; f < ps.numPolygons(); f++) {
+		const PolySet::Face face = ps.face(f);
+		for (size_t i = 1; i + 1 < face.size(); i++) {
+			const Triangle t = {{uint32_t(face.index(0)), uint32_t(face.index(i)), uint32_t(face.index(i + 1))}, uint32_t(f)};
+			triangles.push_back(t);
+		}
+	}
+	report.triangles = triangles.size();
+
+	// Degenerate faces have no area, using the normal of the whole face
+	for_batches(ps.numPolygons(), [&](size_t b, size_t first, size_t last) {
+			Findings &found = findings[b];
+			for (size_t f = first; f < last; f++) {
+				const PolySet::Face face = ps.face(f);
+				Vector3d normal(0, 0, 0), center(0, 0, 0);
+				double longest = 0;
+				for (size_t i = 0; i < face.size(); i++) {
+					const Vector3d &p = face[i], &q = face[(i + 1) % face.size()];
+					normal += p.cross(q);
+					center += p;
+					longest = std::max(longest, (q - p).squaredNorm());
+				}
+				if (face.size() >= 3) {
+					for (size_t i = 1; i + 1 < face.size(); i++) found.volume += face[0].dot(face[i].cross(face[i + 1]));
+				}
+				if (face.size() < 3 || normal.norm() <= 1e-12 * longest) {
+					if (found.degenerate++ < maxproblems) {
+						found.problems.push_back(Problem(Problem::DEGENERATE_FACE, face.size() ? Vector3d(center / face.size()) : Vector3d(0, 0, 0)));
+					}
+				}
+			}
+		});
+	double volume = 0;
+	for (auto &found : findings) {
+		volume += found.volume;
+		report.degeneratefaces += found.degenerate;
+		for (const auto &problem : found.problems) {
+			if (report.problems.size() < maxproblems) report.problems.push_back(problem);
+		}
+	}
+
+	std::vector<Edge> edges(3 * triangles.size());
+	for_batches(triangles.size(), [&](size_t, size_t first, size_t last) {
+			for (size_t t = first; t < last; t++) {
+				for (int i = 0; i < 3; i++) {
+					const uint32_t a = triangles[t].v[i], b = triangles[t].v[(i + 1) % 3];
+					const Edge e = {std::min(a, b), std::max(a, b), a > b};
+					edges[3 * t + i] = e;
+				}
+			}
+		});
+	sort_edges(edges);
+	size_t edgeproblems[3] = {0, 0, 0};
+	for (size_t i = 0; i < edges.size(); ) {
+		size_t j = i + 1;
+		while (j < edges.size() && edges[j].sameVertices(edges[i])) j++;
+		if (edges[i].a == edges[i].b) { // Of a degenerate face
+			i = j;
+			continue;
+		}
+		int type = -1;
+		if (j - i == 1) type = Problem::OPEN_EDGE;
+		else if (j - i > 2) type = Problem::NONMANIFOLD_EDGE;
+		else if (edges[i].reversed == edges[i + 1].reversed) type = Problem::FLIPPED_EDGE;
+		if (type >= 0 && edgeproblems[type]++ < maxproblems) {
+			report.problems.push_back(Problem(Problem::type_e(type), (vertices[edges[i].a] + vertices[edges[i].b]) / 2));
+		}
+		i = j;
+	}
+	report.openedges = edgeproblems[Problem::OPEN_EDGE];
+	report.nonmanifoldedges = edgeproblems[Problem::NONMANIFOLD_EDGE];
+	report.flippededges = edgeproblems[Problem::FLIPPED_EDGE];
+
+	// A closed mesh with its faces turned inwards has a negative volume
+	if (!report.openedges && !report.nonmanifoldedges && !report.flippededges && volume < 0) {
+		report.insideout = true;
+		report.problems.push_back(Problem(Problem::INSIDE_OUT, ps.getBoundingBox().center()));
+	}
+
+	// Candidates for crossing are the triangles with overlapping bounding
+	// boxes. The BVH has the faces, whose other triangles don't count.
+	shared_ptr<const PolySetBVH> bvh = ps.getBVH();
+	std::vector<size_t> firsttriangle(ps.numPolygons() + 1, triangles.size());
+	for (size_t t = triangles.size(); t-- > 0; ) firsttriangle[triangles[t].face] = t;
+	for (size_t f = ps.numPolygons(); f-- > 0; ) firsttriangle[f] = std::min(firsttriangle[f], firsttriangle[f + 1]);
+	findings.assign((triangles.size() + BATCH_SIZE - 1) / BATCH_SIZE, Findings());
+	for_batches(triangles.size(), [&](size_t b, size_t first, size_t last) {
+			Findings &found = findings[b];
+			for (size_t i = first; i < last; i++) {
+				const Triangle &s = triangles[i];
+				BoundingBox box;
+				for (int k = 0; k < 3; k++) box.extend(vertices[s.v[k]]);
+				for (const auto f : bvh->overlapping(box)) {
+					if (f <= s.face) continue; // Each pair once, and not within a face
+					for (size_t j = firsttriangle[f]; j < firsttriangle[f + 1]; j++) {
+						Vector3d at;
+						if (!triangles_cross(vertices, s, triangles[j], at)) continue;
+						if (found.intersections++ < maxproblems) found.problems.push_back(Problem(Problem::SELF_INTERSECTION, at));
+					}
+				}
+			}
+		});
+	size_t intersections = 0;
+	for (const auto &found : findings) {
+		report.selfintersections += found.intersections;
+		for (const auto &problem : found.problems) {
+			if (intersections++ < maxproblems) report.problems.push_back(problem);
+		}
+	}
+	return report;
+}
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "linalg.h"
+#include <vector>
+
+class PolySet;
+
+/*!
+	Checks that a 3D PolySet is a valid solid: every edge is shared by
+	exactly two faces, which use it in opposite directions, faces aren't
+	degenerate, the mesh isn't inside out and no faces cross each other.
+
+	Works on the indexed vertices of the PolySet, so it's much faster than
+	building a Nef polyhedron to check it. Edges are sorted in parallel to
+	find their faces; crossing faces are found with the PolySetBVH.
+*/
+namespace MeshValidator {
+	struct Problem {
+		enum type_e { OPEN_EDGE, NONMANIFOLD_EDGE, FLIPPED_EDGE, DEGENERATE_FACE, INSIDE_OUT, SELF_INTERSECTION };
+		Problem(type_e type, const Vector3d &position) : type(type), position(position) {}
+		type_e type;
+		Vector3d position; // Where it is, e.g. the middle of an edge
+		const char *description() const;
+	};
+
+	struct Report {
+		Report() : triangles(0), openedges(0), nonmanifoldedges(0), flippededges(0),
+							 degeneratefaces(0), insideout(false), selfintersections(0) {}
+		bool isValid() const {
+			return !this->openedges && !this->nonmanifoldedges && !this->flippededges &&
+				!this->degeneratefaces && !this->insideout && !this->selfintersections;
+		}
+		void print() const;
+
+		size_t triangles;
+		size_t openedges;
+		size_t nonmanifoldedges;
+		size_t flippededges; // Edges between faces of opposite orientation
+		size_t degeneratefaces;
+		bool insideout;
+		size_t selfintersections; // Pairs of crossing triangles
+		std::vector<Problem> problems; // The first ones found of each type
+	};
+
+	Report validate(const PolySet &ps, size_t maxproblems = 10);
+}
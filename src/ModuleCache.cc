@@ -2,6 +2,13 @@
 #include "FileModule.h"
 #include "printutils.h"
 #include "openscad.h"
+#include "ASTCache.h"
+#include "feature.h"
+#include "FileWatcher.h"
+#include "ThreadPool.h"
+#include "Session.h"
+#include "hash.h"
+#include "GeometryBundle.h"
 
 #include <boost/format.hpp>
 #include <boost/filesystem.hpp>
@@ -20,6 +27,97 @@ namespace fs=boost::filesystem;
 
 ModuleCache *ModuleCache::inst = NULL;
 
+/*!
+	Returns the cache of the current Session, or the process-wide cache.
+*/
+ModuleCache *ModuleCache::instance()
+{
+	Session *session = Session::current();
+	if (session) return &session->moduleCache();
+	if (!inst) inst = new ModuleCache;
+	return inst;
+}
+
+/*!
+	Reads the text the parser is given for \a filename.
+*/
+static bool read_library(const std::string &filename, std::string &text)
+{
+	std::stringstream textbuf;
+	{
+		std::ifstream ifs(filename.c_str());
+		if (!ifs.is_open()) return false;
+		textbuf << ifs.rdbuf();
+	}
+	textbuf << "\n" << Session::commandlineCommands();
+	text = textbuf.str();
+	return true;
+}
+
+static std::string make_cache_id(const struct stat &st)
+{
+	return str(boost::format("%x.%x") % st.st_mtime % st.st_size);
+}
+
+/*!
+	Reads the files evaluate() is likely to compile among \a filenames
+	concurrently, and with the ast-cache feature also their cached ASTs,
+	so evaluate() only needs to parse them. The parser isn't reentrant, so
+	parsing still happens one file at a time.
+*/
+void ModuleCache::prefetch(const std::vector<std::string> &filenames)
+{
+	std::vector<std::pair<std::string, prefetched_entry *>> files;
+	for(const auto &filename : filenames) {
+		if (this->prefetched.find(filename) != this->prefetched.end()) continue;
+		struct stat st;
+		if (!FileWatcher::instance()->stat(filename, st)) continue;
+		const std::string cache_id = make_cache_id(st);
+		auto it = this->entries.find(filename);
+		if (it != this->entries.end() && it->second.cache_id == cache_id &&
+				!(it->second.module && it->second.module->includesChanged())) continue;
+		prefetched_entry &entry = this->prefetched[filename];
+		entry.cache_id = cache_id;
+		entry.valid = false;
+	}
+	// References to the entries stay valid while none are inserted
+	for(const auto &filename : filenames) {
+		auto it = this->prefetched.find(filename);
+		if (it != this->prefetched.end() && !it->second.valid && it->second.text.empty()) {
+			files.push_back(std::make_pair(filename, &it->second));
+		}
+	}
+	if (files.size() < 2) {
+		discardPrefetched(filenames);
+		return;
+	}
+
+	const bool useASTCache = Feature::ExperimentalASTCache.is_enabled();
+	ThreadPool::TaskGroup group;
+	for(const auto &file : files) {
+		const std::string &filename = file.first;
+		prefetched_entry *entry = file.second;
+		ThreadPool::instance()->run(group, [&filename, entry, useASTCache]() {
+			entry->valid = read_library(filename, entry->text);
+			if (entry->valid && useASTCache) ASTCache::read(filename, entry->text, entry->cached);
+		});
+	}
+	ThreadPool::instance()->wait(group);
+}
+
+/*!
+	Drops what prefetch() read for \a filenames and evaluate() didn't use.
+*/
+void ModuleCache::discardPrefetched(const std::vector<std::string> &filenames)
+{
+	for(const auto &filename : filenames) {
+		auto it = this->prefetched.find(filename);
+		if (it == this->prefetched.end()) continue;
+		delete it->second.cached.module;
+		this->prefetched.erase(it);
+	}
+}
+
 /*!
 	Reevaluate the given file and all it's dependencies and recompile anything
 	needing reevaluation. Updates the cache if necessary.
@@ -45,14 +143,13 @@ bool ModuleCache::evaluate(const std::string &filename, FileModule *&module)
 
 	// Create cache ID
 	struct stat st;
-	memset(&st, 0, sizeof(struct stat));
-	bool valid = (stat(filename.c_str(), &st) == 0);
+	bool valid = FileWatcher::instance()->stat(filename, st);
 
 	// If file isn't there, just return and let the cache retain the old module
 	if (!valid) return false;
 
 	// If the file is present, we'll always cache some result
-	std::string cache_id = str(boost::format("%x.%x") % st.st_mtime % st.st_size);
+	std::string cache_id = make_cache_id(st);
 
 	cache_entry &entry = this->entries[filename];
 	// Initialize entry, if new
@@ -63,6 +160,12 @@ bool ModuleCache::evaluate(const std::string &filename, FileModule *&module)
   
 	bool shouldCompile = true;
 	if (found) {
+		// Files rewritten with the same contents keep their module
+		std::string hash;
+		if (entry.cache_id != cache_id && !entry.hash.empty() &&
+				FileWatcher::instance()->contentHash(filename, hash) && hash == entry.hash) {
+			entry.cache_id = cache_id;
+		}
 		// Files should only be recompiled if the cache ID changed
 		if (entry.cache_id == cache_id) {
 			shouldCompile = false;
@@ -90,35 +193,61 @@ bool ModuleCache::evaluate(const std::string &filename, FileModule *&module)
 		}
 #endif
 
-		std::stringstream textbuf;
-		{
-			std::ifstream ifs(filename.c_str());
-			if (!ifs.is_open()) {
-				PRINTB("WARNING: Can't open library file '%s'\n", filename);
-				return false;
-			}
-			textbuf << ifs.rdbuf();
+		std::string text;
+		ASTCache::Entry cached;
+		bool wasprefetched = false;
+		auto pre = this->prefetched.find(filename);
+		if (pre != this->prefetched.end() && pre->second.cache_id == cache_id && pre->second.valid) {
+			text.swap(pre->second.text);
+			cached = pre->second.cached;
+			wasprefetched = true;
+			this->prefetched.erase(pre);
+		}
+		else if (!read_library(filename, text)) {
+			PRINTB("WARNING: Can't open library file '%s'\n", filename);
+			return false;
 		}
-		textbuf << "\n" << commandline_commands;
 		
 		print_messages_push();
 		
 		FileModule *oldmodule = lib_mod;
 		
         fs::path pathname = fs::path(filename);
-		lib_mod = dynamic_cast<FileModule*>(parse(textbuf.str().c_str(), pathname, false));
+		if (Feature::ExperimentalASTCache.is_enabled()) {
+			if (!wasprefetched) ASTCache::read(filename, text, cached);
+			lib_mod = ASTCache::finish(filename, cached);
+			if (!lib_mod) {
+				// Keep the parser's messages to print them again on cache hits
+				std::vector<std::string> messages;
+				{
+					PrintCapture capture(messages);
+					lib_mod = dynamic_cast<FileModule*>(parse(text.c_str(), pathname, false));
+				}
+				for(const auto &msg : messages) PRINT(msg);
+				if (lib_mod) ASTCache::save(filename, text, *lib_mod, messages);
+			}
+		}
+		else {
+			lib_mod = dynamic_cast<FileModule*>(parse(text.c_str(), pathname, false));
+		}
 		PRINTDB("  compiled module: %p", lib_mod);
 		
 		// We defer deletion so we can ensure that the new module won't
 		// have the same address as the old
-		if (oldmodule) delete oldmodule;
+		if (oldmodule) {
+			delete oldmodule;
+			this->gen++;
+		}
 		entry.module = lib_mod;
 		entry.cache_id = cache_id;
+		entry.hash = hash128(text).toString();
 		
 		print_messages_pop();
 	}
 	
 	module = lib_mod;
+	// Prebuilt geometry shipped with the library
+	GeometryBundles::instance()->loadForLibrary(filename);
 	bool depschanged = lib_mod ? lib_mod->handleDependencies() : false;
 
 	return shouldCompile || depschanged;
@@ -126,7 +255,10 @@ bool ModuleCache::evaluate(const std::string &filename, FileModule *&module)
 
 void ModuleCache::clear()
 {
+	for(auto &entry : this->prefetched) delete entry.second.cached.module;
+	this->prefetched.clear();
 	this->entries.clear();
+	this->gen++;
 }
 
 FileModule *ModuleCache::lookup(const std::string &filename)
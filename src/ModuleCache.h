@@ -2,6 +2,8 @@
 
 #include <string>
 #include <unordered_map>
+#include <vector>
+#include "ASTCache.h"
 
 /*!
 	Caches FileModules based on their filenames
@@ -9,15 +11,20 @@
 class ModuleCache
 {
 public:
-	static ModuleCache *instance() { if (!inst) inst = new ModuleCache; return inst; }
+	static ModuleCache *instance();
 	bool evaluate(const std::string &filename, class FileModule *&module);
 	class FileModule *lookup(const std::string &filename);
 	bool isCached(const std::string &filename);
 	size_t size() { return this->entries.size(); }
+	/*! Increases whenever a cached module is replaced or removed */
+	unsigned int generation() const { return this->gen; }
 	void clear();
+	void prefetch(const std::vector<std::string> &filenames);
+	void discardPrefetched(const std::vector<std::string> &filenames);
 
 private:
-	ModuleCache() {}
+	friend class Session;
+	ModuleCache() : gen(0) {}
 	~ModuleCache() {}
 
 	static ModuleCache *inst;
@@ -25,6 +32,15 @@ private:
 	struct cache_entry {
 		class FileModule *module;
 		std::string cache_id;
+		std::string hash; // Of the contents the module was compiled from
 	};
 	std::unordered_map<std::string, cache_entry> entries;
+	struct prefetched_entry {
+		std::string cache_id;
+		bool valid;
+		std::string text;
+		ASTCache::Entry cached;
+	};
+	std::unordered_map<std::string, prefetched_entry> prefetched;
+	unsigned int gen;
 };
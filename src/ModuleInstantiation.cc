@@ -73,7 +73,7 @@ std::string IfElseModuleInstantiation::dump(const std::string &indent) const
 
 AbstractNode *ModuleInstantiation::evaluate(const Context *ctx) const
 {
-	EvalContext c(ctx, this->arguments, &this->scope);
+	EvalContext c(ctx, this->arguments, &this->scope, &this->binding);
 
 #if 0 && DEBUG
 	PRINT("New eval ctx:");
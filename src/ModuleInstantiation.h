@@ -28,6 +28,8 @@ public:
 
 	AssignmentList arguments;
 	LocalScope scope;
+	// See ArgumentBinding
+	mutable shared_ptr<const class ArgumentBinding> binding;
 
 	bool tag_root;
 	bool tag_highlight;
@@ -8,6 +8,7 @@ void GLView::setCamera(const Camera &cam ) {assert(false && "not implemented");}
 void GLView::paintGL() {}
 void GLView::showSmallaxes(const Color4f &col) {}
 void GLView::showAxes(const Color4f &col) {}
+void GLView::showCachedAxes(const Color4f &col) {}
 void GLView::showCrosshairs() {}
 void GLView::setColorScheme(const ColorScheme &cs){assert(false && "not implemented");}
 void GLView::setColorScheme(const std::string &cs) {assert(false && "not implemented");}
@@ -27,7 +28,6 @@ CGALRenderer::CGALRenderer(shared_ptr<const class Geometry> geom) {}
 CGALRenderer::~CGALRenderer() {}
 void CGALRenderer::draw(bool showfaces, bool showedges) const {}
 BoundingBox CGALRenderer::getBoundingBox() const {assert(false && "not implemented");}
-void CGALRenderer::setColorScheme(const ColorScheme &cs){assert(false && "not implemented");}
 
 
 #include "system-gl.h"
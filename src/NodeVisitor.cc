@@ -1,35 +1,63 @@
 #include "NodeVisitor.h"
 #include "state.h"
 
+#include <deque>
+
 State NodeVisitor::nullstate(nullptr);
 
+namespace {
+	// A node being traversed, with the state its children inherit
+	struct Frame {
+		Frame(const AbstractNode &node, const State &state)
+			: node(&node), state(state), parent(state.parent()), next(0) {}
+		const AbstractNode *node;
+		State state;
+		const AbstractNode *parent;
+		size_t next; // the next child to traverse
+	};
+}
+
+/*!
+	Traverses the subtree of \a node depth-first, visiting each node in
+	prefix and postfix order. Children inherit the state set by the prefix
+	visit of their parent.
+
+	The pending nodes are kept on an explicit stack rather than the call
+	stack, so deep trees, e.g. long chains of transforms made by recursive
+	modules, don't overflow it.
+*/
 Response NodeVisitor::traverse(const AbstractNode &node, const State &state)
 {
-	State newstate = state;
-	newstate.setNumChildren(node.getChildren().size());
-	
-	Response response = ContinueTraversal;
-	newstate.setPrefix(true);
-	newstate.setParent(state.parent());
-	response = node.accept(newstate, *this);
+	// References to the frames stay valid when a deque grows
+	std::deque<Frame> stack;
+	auto enter = [&](const AbstractNode &n, const State &s) {
+		stack.emplace_back(n, s);
+		Frame &frame = stack.back();
+		frame.state.setNumChildren(n.getChildren().size());
+		frame.state.setPrefix(true);
+		const Response response = n.accept(frame.state, *this);
+		// Pruned traversals mean don't traverse children
+		if (response == ContinueTraversal) frame.state.setParent(&n);
+		else frame.next = n.getChildren().size();
+		return response;
+	};
 
-	// Pruned traversals mean don't traverse children
-	if (response == ContinueTraversal) {
-		newstate.setParent(&node);
-		for(const auto &chnode : node.getChildren()) {
-			response = this->traverse(*chnode, newstate);
-			if (response == AbortTraversal) return response; // Abort immediately
+	if (enter(node, state) == AbortTraversal) return AbortTraversal;
+	while (!stack.empty()) {
+		Frame &frame = stack.back();
+		const std::vector<AbstractNode *> &children = frame.node->getChildren();
+		if (frame.next < children.size()) {
+			const AbstractNode &child = *children[frame.next++];
+			if (enter(child, frame.state) == AbortTraversal) return AbortTraversal; // Abort immediately
+			continue;
 		}
-	}
 
-	// Postfix is executed for all non-aborted traversals
-	if (response != AbortTraversal) {
-		newstate.setParent(state.parent());
-		newstate.setPrefix(false);
-		newstate.setPostfix(true);
-		response = node.accept(newstate, *this);
+		// Postfix is executed for all non-aborted traversals
+		frame.state.setParent(frame.parent);
+		frame.state.setPrefix(false);
+		frame.state.setPostfix(true);
+		if (frame.node->accept(frame.state, *this) == AbortTraversal) return AbortTraversal;
+		stack.pop_back();
 	}
-
-	if (response != AbortTraversal) response = ContinueTraversal;
-	return response;
+	return ContinueTraversal;
 }
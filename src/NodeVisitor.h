@@ -21,7 +21,9 @@ class NodeVisitor :
 	public Visitor<class TextNode>,
 	public Visitor<class ProjectionNode>,
 	public Visitor<class RenderNode>,
+	public Visitor<class SimplifyNode>,
 	public Visitor<class SurfaceNode>,
+	public Visitor<class ReducedNode>,
 	public Visitor<class TransformNode>,
 	public Visitor<class ColorNode>,
 	public Visitor<class OffsetNode>
@@ -75,9 +77,15 @@ public:
   virtual Response visit(class State &state, const class RenderNode &node) {
 		return visit(state, (const class AbstractNode &)node);
 	}
+  virtual Response visit(class State &state, const class SimplifyNode &node) {
+		return visit(state, (const class AbstractNode &)node);
+	}
   virtual Response visit(class State &state, const class SurfaceNode &node) {
 		return visit(state, (const class LeafNode &)node);
 	}
+  virtual Response visit(class State &state, const class ReducedNode &node) {
+		return visit(state, (const class LeafNode &)node);
+	}
   virtual Response visit(class State &state, const class TransformNode &node) {
 		return visit(state, (const class AbstractNode &)node);
 	}
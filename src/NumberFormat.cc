@@ -0,0 +1,216 @@
+#include "NumberFormat.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <boost/lexical_cast.hpp>
+
+// Significant digits, like the default stream precision
+static const int PRECISION = 6;
+
+// Powers of ten which are exact doubles
+static const double powers_of_ten[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+static const int MAX_EXACT_POWER = 22;
+
+/*!
+	printf() in the current C locale, with the radix replaced by '.'.
+*/
+static int format_slow(double x, char *buf)
+{
+	const int len = snprintf(buf, NUMBER_BUFFER_SIZE, "%g", x);
+	char *out = buf;
+	bool radix = false;
+	for (int i = 0; i < len; i++) {
+		const char c = buf[i];
+		if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '-' || c == '+') {
+			*out++ = c;
+			radix = false;
+		}
+		else if (!radix) { // The locale's radix may have several bytes
+			*out++ = '.';
+			radix = true;
+		}
+	}
+	*out = '\0';
+	return out - buf;
+}
+
+static char *write_digits(char *out, const char *digits, int count)
+{
+	memcpy(out, digits, count);
+	return out + count;
+}
+
+/*!
+	Formats \a x into \a buf like printf("%g") in the C locale, and
+	returns the length. \a buf must have room for NUMBER_BUFFER_SIZE chars.
+
+	The digits are found by scaling with an exact power of ten, so the
+	result has a single rounding error. Results too close to a rounding
+	boundary to be sure, and special values, are left to printf().
+*/
+int format_number(double x, char *buf)
+{
+	if (x == 0 || !std::isfinite(x)) return format_slow(x, buf);
+
+	const double a = std::fabs(x);
+	int exponent = int(std::floor(std::log10(a)));
+	double scaled = 0;
+	for (int attempt = 0; attempt < 2; attempt++) {
+		const int shift = PRECISION - 1 - exponent;
+		if (shift > MAX_EXACT_POWER || shift < -MAX_EXACT_POWER) return format_slow(x, buf);
+		scaled = shift >= 0 ? a * powers_of_ten[shift] : a / powers_of_ten[-shift];
+		// log10() may be off by one close to powers of ten
+		if (scaled < 1e5) exponent--;
+		else if (scaled >= 1e6) exponent++;
+		else break;
+	}
+	if (scaled < 1e5 || scaled >= 1e6) return format_slow(x, buf);
+
+	const double integral = std::floor(scaled);
+	const double fraction = scaled - integral;
+	if (std::fabs(fraction - 0.5) < 1e-8) return format_slow(x, buf);
+	uint32_t n = uint32_t(integral) + (fraction > 0.5 ? 1 : 0);
+	if (n == 1000000) {
+		n = 100000;
+		exponent++;
+	}
+
+	char digits[PRECISION];
+	for (int i = PRECISION - 1; i >= 0; i--) {
+		digits[i] = '0' + n % 10;
+		n /= 10;
+	}
+	// %g drops trailing zeros
+	int count = PRECISION;
+	while (count > 1 && digits[count - 1] == '0') count--;
+
+	char *out = buf;
+	if (x < 0) *out++ = '-';
+	if (exponent < -4 || exponent >= PRECISION) {
+		*out++ = digits[0];
+		if (count > 1) {
+			*out++ = '.';
+			out = write_digits(out, digits + 1, count - 1);
+		}
+		*out++ = 'e';
+		*out++ = exponent < 0 ? '-' : '+';
+		int e = std::abs(exponent);
+		if (e >= 100) {
+			*out++ = '0' + e / 100;
+			e %= 100;
+		}
+		*out++ = '0' + e / 10;
+		*out++ = '0' + e % 10;
+	}
+	else if (exponent >= 0) {
+		const int integer = exponent + 1;
+		if (count <= integer) {
+			out = write_digits(out, digits, count);
+			for (int i = count; i < integer; i++) *out++ = '0';
+		}
+		else {
+			out = write_digits(out, digits, integer);
+			*out++ = '.';
+			out = write_digits(out, digits + integer, count - integer);
+		}
+	}
+	else {
+		*out++ = '0';
+		*out++ = '.';
+		for (int i = -1; i > exponent; i--) *out++ = '0';
+		out = write_digits(out, digits, count);
+	}
+	*out = '\0';
+	return out - buf;
+}
+
+/*!
+	Parses the text from \a begin to \a end as a double, like
+	boost::lexical_cast<double>, i.e. in the C locale and requiring the
+	whole text to be a number. Returns false if it isn't.
+
+	Plain decimals with up to 15 significant digits and a small exponent
+	are exact as an integer times or divided by an exact power of ten, so
+	the result is correctly rounded. Anything else goes to lexical_cast.
+*/
+bool parse_number(const char *begin, const char *end, double &result)
+{
+	const char *p = begin;
+	const bool negative = p < end && *p == '-';
+	if (p < end && (*p == '-' || *p == '+')) p++;
+
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0;
+	bool any = false;
+	for (; p < end && *p >= '0' && *p <= '9'; p++) {
+		any = true;
+		if (digits > 0 || *p != '0') {
+			mantissa = mantissa * 10 + (*p - '0');
+			if (++digits > 15) break;
+		}
+	}
+	if (p < end && *p == '.' && digits <= 15) {
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+			any = true;
+			if (digits > 0 || *p != '0') {
+				mantissa = mantissa * 10 + (*p - '0');
+				if (++digits > 15) break;
+			}
+			exponent--;
+		}
+	}
+	if (any && digits <= 15 && p < end && (*p == 'e' || *p == 'E')) {
+		const char *q = p + 1;
+		const bool negexp = q < end && *q == '-';
+		if (q < end && (*q == '-' || *q == '+')) q++;
+		int e = 0;
+		const char *first = q;
+		for (; q < end && *q >= '0' && *q <= '9' && e < 1000; q++) e = e * 10 + (*q - '0');
+		if (q > first) {
+			exponent += negexp ? -e : e;
+			p = q;
+		}
+	}
+	if (any && digits <= 15 && p == end && exponent >= -MAX_EXACT_POWER && exponent <= MAX_EXACT_POWER) {
+		const double m = double(mantissa);
+		result = exponent >= 0 ? m * powers_of_ten[exponent] : m / powers_of_ten[-exponent];
+		if (negative) result = -result;
+		return true;
+	}
+
+	try {
+		result = boost::lexical_cast<double>(std::string(begin, end));
+		return true;
+	}
+	catch (const boost::bad_lexical_cast &) {
+		return false;
+	}
+}
+
+/*!
+	Appends \a x formatted by format_number() to \a out. Returns the number
+	as it's written, i.e. what reading it back gives.
+*/
+double append_number(double x, std::string &out)
+{
+	char buf[NUMBER_BUFFER_SIZE];
+	const int len = format_number(x, buf);
+	out.append(buf, len);
+	double written;
+	return parse_number(buf, buf + len, written) ? written : x;
+}
+
+std::ostream &operator<<(std::ostream &stream, const Number &number)
+{
+	char buf[NUMBER_BUFFER_SIZE];
+	const int len = format_number(number.value, buf);
+	stream.write(buf, len);
+	return stream;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <iosfwd>
+#include <string>
+
+// Enough for any double formatted by format_number()
+#define NUMBER_BUFFER_SIZE 32
+
+int format_number(double x, char *buf);
+bool parse_number(const char *begin, const char *end, double &result);
+// Appends the formatted number, for writers which buffer their output
+double append_number(double x, std::string &out);
+
+/*!
+	Writes a double to a stream the way std::ostream does with the default
+	flags and precision, i.e. like printf("%g"), but always with '.' as
+	the radix and without going through the stream's locale facets. Used
+	by the exporters, which write millions of numbers:
+
+	output << Number(v[0]) << " " << Number(v[1]);
+*/
+class Number
+{
+public:
+	explicit Number(double x) : value(x) {}
+	double value;
+};
+
+std::ostream &operator<<(std::ostream &stream, const Number &number);
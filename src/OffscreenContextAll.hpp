@@ -58,6 +58,11 @@ OffscreenContext *create_offscreen_context_common(OffscreenContext *ctx)
 {
 	if (!ctx) return NULL;
 	GLenum err = glewInit(); // must come after Context creation and before FBO c$
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+	// GLEW built for GLX can't find a display for EGL contexts, but loads
+	// the GL functions anyway
+	if (err == GLEW_ERROR_NO_GLX_DISPLAY) err = GLEW_OK;
+#endif
 	if (GLEW_OK != err) {
 		std::cerr << "Unable to init GLEW: " << glewGetErrorString(err) << "\n";
 		return NULL;
@@ -11,6 +11,11 @@ http://www.mesa3d.org/brianp/sig97/offscrn.htm
 http://glprogramming.com/blue/ch07.html
 OffscreenContext.mm (Mac OSX version)
 
+With ENABLE_EGL, an EGL context is tried first, which needs no X server:
+on a GPU device if there is one, else on Mesa's surfaceless platform,
+which renders with llvmpipe on nodes without a GPU. GLX with a hidden
+window is the fallback.
+
 */
 
 /*
@@ -43,9 +48,14 @@ OffscreenContext.mm (Mac OSX version)
 
 #include <GL/gl.h>
 #include <GL/glx.h>
+#ifdef ENABLE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
 #include <assert.h>
 #include <sstream>
+#include <vector>
 
 #include <sys/utsname.h> // for uname
 
@@ -56,6 +66,11 @@ struct OffscreenContext
 	GLXContext openGLContext;
 	Display *xdisplay;
 	Window xwindow;
+#ifdef ENABLE_EGL
+	EGLDisplay egldisplay;
+	EGLSurface eglsurface;
+	EGLContext eglcontext;
+#endif
 	int width;
 	int height;
 	fbo_t *fbo;
@@ -70,6 +85,11 @@ void offscreen_context_init(OffscreenContext &ctx, int width, int height)
 	ctx.openGLContext = NULL;
 	ctx.xdisplay = NULL;
 	ctx.xwindow = (Window)NULL;
+#ifdef ENABLE_EGL
+	ctx.egldisplay = EGL_NO_DISPLAY;
+	ctx.eglsurface = EGL_NO_SURFACE;
+	ctx.eglcontext = EGL_NO_CONTEXT;
+#endif
 	ctx.fbo = NULL;
 }
 
@@ -94,6 +114,18 @@ string offscreen_context_getinfo(OffscreenContext *ctx)
 {
 	assert(ctx);
 
+#ifdef ENABLE_EGL
+	if (ctx->egldisplay != EGL_NO_DISPLAY) {
+		stringstream out;
+		out << "GL context creator: EGL\n"
+		    << "PNG generator: lodepng\n"
+		    << "EGL version: " << eglQueryString(ctx->egldisplay, EGL_VERSION) << "\n"
+		    << "EGL vendor: " << eglQueryString(ctx->egldisplay, EGL_VENDOR) << "\n"
+		    << get_os_info();
+		return out.str();
+	}
+#endif
+
 	if (!ctx->xdisplay)
 		return string("No GL Context initialized. No information to report\n");
 
@@ -226,6 +258,100 @@ bool create_glx_dummy_window(OffscreenContext &ctx)
 	return true;
 	}
 
+#ifdef ENABLE_EGL
+/*
+   Returns the EGL displays to try: those of the GPU devices, Mesa's
+   surfaceless platform, then the default display.
+ */
+static std::vector<EGLDisplay> get_egl_displays()
+{
+	std::vector<EGLDisplay> displays;
+	const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	const std::string clientextensions = extensions ? extensions : "";
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay) {
+		PFNEGLQUERYDEVICESEXTPROC queryDevices =
+			(PFNEGLQUERYDEVICESEXTPROC)eglGetProcAddress("eglQueryDevicesEXT");
+		if (queryDevices && clientextensions.find("EGL_EXT_platform_device") != std::string::npos) {
+			EGLDeviceEXT devices[16];
+			EGLint numdevices = 0;
+			if (queryDevices(16, devices, &numdevices)) {
+				for (EGLint i = 0; i < numdevices; i++) {
+					EGLDisplay dpy = getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, devices[i], NULL);
+					if (dpy != EGL_NO_DISPLAY) displays.push_back(dpy);
+				}
+			}
+		}
+		if (clientextensions.find("EGL_MESA_platform_surfaceless") != std::string::npos) {
+			EGLDisplay dpy = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+			if (dpy != EGL_NO_DISPLAY) displays.push_back(dpy);
+		}
+	}
+	EGLDisplay dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (dpy != EGL_NO_DISPLAY) displays.push_back(dpy);
+	return displays;
+}
+
+/*
+   Creates an OpenGL context on the EGL display \a dpy. Drawing goes to
+   the FBO, so a pbuffer is only used if the display has one; otherwise
+   the context is made current without a surface.
+ */
+static bool create_egl_context_on(OffscreenContext &ctx, EGLDisplay dpy)
+{
+	EGLint major, minor;
+	if (!eglInitialize(dpy, &major, &minor)) return false;
+
+	const EGLint attributes[] = {
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_ALPHA_SIZE, 8,
+		EGL_DEPTH_SIZE, 24, // depth-stencil for OpenCSG
+		EGL_STENCIL_SIZE, 8,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint numconfigs = 0;
+	if (!eglChooseConfig(dpy, attributes, &config, 1, &numconfigs) || numconfigs == 0 ||
+			!eglBindAPI(EGL_OPENGL_API)) {
+		eglTerminate(dpy);
+		return false;
+	}
+
+	EGLint surfacetype = 0;
+	eglGetConfigAttrib(dpy, config, EGL_SURFACE_TYPE, &surfacetype);
+	EGLSurface surface = EGL_NO_SURFACE;
+	if (surfacetype & EGL_PBUFFER_BIT) {
+		const EGLint pbufferattributes[] = { EGL_WIDTH, ctx.width, EGL_HEIGHT, ctx.height, EGL_NONE };
+		surface = eglCreatePbufferSurface(dpy, config, pbufferattributes);
+	}
+
+	EGLContext context = eglCreateContext(dpy, config, EGL_NO_CONTEXT, NULL);
+	if (context == EGL_NO_CONTEXT || !eglMakeCurrent(dpy, surface, surface, context)) {
+		if (context != EGL_NO_CONTEXT) eglDestroyContext(dpy, context);
+		if (surface != EGL_NO_SURFACE) eglDestroySurface(dpy, surface);
+		eglTerminate(dpy);
+		return false;
+	}
+
+	ctx.egldisplay = dpy;
+	ctx.eglsurface = surface;
+	ctx.eglcontext = context;
+	return true;
+}
+
+bool create_egl_dummy_context(OffscreenContext &ctx)
+{
+	for (EGLDisplay dpy : get_egl_displays()) {
+		if (create_egl_context_on(ctx, dpy)) return true;
+	}
+	return false;
+}
+#endif
+
 	Bool create_glx_dummy_context(OffscreenContext &ctx);
 
 	OffscreenContext *create_offscreen_context(int w, int h)
@@ -233,7 +359,10 @@ bool create_glx_dummy_window(OffscreenContext &ctx)
 		OffscreenContext *ctx = new OffscreenContext;
 		offscreen_context_init( *ctx, w, h );
 
-		// before an FBO can be setup, a GLX context must be created
+		// before an FBO can be setup, a GL context must be created
+#ifdef ENABLE_EGL
+		if (create_egl_dummy_context( *ctx )) return create_offscreen_context_common( ctx );
+#endif
 		// this call alters ctx->xDisplay and ctx->openGLContext 
 		//  and ctx->xwindow if successfull
 		if (!create_glx_dummy_context( *ctx )) {
@@ -249,6 +378,15 @@ bool create_glx_dummy_window(OffscreenContext &ctx)
 		if (ctx) {
 			fbo_unbind(ctx->fbo);
 			fbo_delete(ctx->fbo);
+#ifdef ENABLE_EGL
+			if (ctx->egldisplay != EGL_NO_DISPLAY) {
+				eglMakeCurrent(ctx->egldisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+				eglDestroyContext(ctx->egldisplay, ctx->eglcontext);
+				if (ctx->eglsurface != EGL_NO_SURFACE) eglDestroySurface(ctx->egldisplay, ctx->eglsurface);
+				eglTerminate(ctx->egldisplay);
+				return true;
+			}
+#endif
 			XDestroyWindow( ctx->xdisplay, ctx->xwindow );
 			glXDestroyContext( ctx->xdisplay, ctx->openGLContext );
 			XCloseDisplay( ctx->xdisplay );
@@ -259,6 +397,10 @@ bool create_glx_dummy_window(OffscreenContext &ctx)
 
 	bool save_framebuffer(OffscreenContext *ctx, std::ostream &output)
 	{
+#ifdef ENABLE_EGL
+		// The pixels are read from the FBO, there's nothing to swap
+		if (ctx->egldisplay != EGL_NO_DISPLAY) return save_framebuffer_common(ctx, output);
+#endif
 		glXSwapBuffers(ctx->xdisplay, ctx->xwindow);
 		return save_framebuffer_common(ctx, output);
 	}
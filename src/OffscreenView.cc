@@ -6,6 +6,7 @@
 #include <cstdlib>
 #include <sstream>
 #include "printutils.h"
+#include "imageutils.h"
 
 OffscreenView::OffscreenView(int width, int height)
 {
@@ -13,13 +14,73 @@ OffscreenView::OffscreenView(int width, int height)
   if ( this->ctx == NULL ) throw -1;
   GLView::initializeGL();
   GLView::resizeGL(width, height);
+  this->width = width;
+  this->height = height;
+
+  for (int i = 0; i < READBACK_SLOTS; i++) this->pbo[i] = 0;
+#ifndef NULLGL
+  if (GLEW_VERSION_2_1 || GLEW_ARB_pixel_buffer_object) {
+    glGenBuffers(READBACK_SLOTS, this->pbo);
+    for (int i = 0; i < READBACK_SLOTS; i++) {
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, this->pbo[i]);
+      glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 4, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  }
+#endif
 }
 
 OffscreenView::~OffscreenView()
 {
+#ifndef NULLGL
+  if (this->pbo[0]) glDeleteBuffers(READBACK_SLOTS, this->pbo);
+#endif
   teardown_offscreen_context(this->ctx);
 }
 
+/*!
+  Starts reading the rendered frame into \a slot. With pixel buffer
+  objects the copy runs on the GPU while the next frame is rendered,
+  otherwise the pixels are read right away.
+*/
+void OffscreenView::startReadback(int slot)
+{
+#ifndef NULLGL
+  if (this->pbo[slot]) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, this->pbo[slot]);
+    glReadPixels(0, 0, this->width, this->height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  }
+  else {
+    this->pixels[slot].resize(this->width * this->height * 4);
+    glReadPixels(0, 0, this->width, this->height, GL_RGBA, GL_UNSIGNED_BYTE, &this->pixels[slot][0]);
+  }
+#endif
+}
+
+/*!
+  Waits for the readback started in \a slot and stores the frame as RGBA
+  rows from top to bottom in \a image.
+*/
+void OffscreenView::finishReadback(int slot, std::vector<unsigned char> &image)
+{
+  image.assign(this->width * this->height * 4, 0);
+#ifndef NULLGL
+  if (this->pbo[slot]) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, this->pbo[slot]);
+    const unsigned char *mapped = static_cast<const unsigned char *>(glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY));
+    if (mapped) {
+      flip_image(mapped, &image[0], 4, this->width, this->height);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  }
+  else if (!this->pixels[slot].empty()) {
+    flip_image(&this->pixels[slot][0], &image[0], 4, this->width, this->height);
+  }
+#endif
+}
+
 #ifdef ENABLE_OPENCSG
 void OffscreenView::display_opencsg_warning()
 {
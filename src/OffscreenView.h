@@ -6,6 +6,7 @@
 #include <string>
 #include "system-gl.h"
 #include <iostream>
+#include <vector>
 #include "GLView.h"
 
 class OffscreenView : public GLView
@@ -16,10 +17,20 @@ public:
 	bool save(std::ostream &output);
 	OffscreenContext *ctx;
 
+	// Asynchronous readback of rendered frames
+	static const int READBACK_SLOTS = 2;
+	void startReadback(int slot);
+	void finishReadback(int slot, std::vector<unsigned char> &image);
+
 	// overrides
 	bool save(const char *filename);
 	std::string getRendererInfo() const;
 #ifdef ENABLE_OPENCSG
 	void display_opencsg_warning();
 #endif
+
+private:
+	// Pixel buffer objects, or 0 if reading back synchronously
+	GLuint pbo[READBACK_SLOTS];
+	std::vector<unsigned char> pixels[READBACK_SLOTS];
 };
@@ -30,6 +30,8 @@
 #include "csgnode.h"
 #include "stl-utils.h"
 
+#include <unordered_map>
+
 #ifdef ENABLE_OPENCSG
 #  include <opencsg.h>
 
@@ -61,21 +63,35 @@ OpenCSGRenderer::OpenCSGRenderer(shared_ptr<CSGProducts> root_products,
 {
 }
 
+OpenCSGRenderer::~OpenCSGRenderer()
+{
+#ifdef ENABLE_OPENCSG
+	for (auto *primitives : { &this->root_primitives, &this->highlights_primitives, &this->background_primitives }) {
+		for(const auto &product : primitives->products) {
+			for(auto &p : product) delete p;
+		}
+	}
+#endif
+}
+
 void OpenCSGRenderer::draw(bool /*showfaces*/, bool showedges) const
 {
+#ifdef ENABLE_OPENCSG
 	GLint *shaderinfo = this->shaderinfo;
 	if (!shaderinfo[0]) shaderinfo = NULL;
 	if (this->root_products) {
-		renderCSGProducts(*this->root_products, showedges ? shaderinfo : NULL, false, false);
+		renderCSGProducts(*this->root_products, this->root_primitives, showedges ? shaderinfo : NULL, false, false);
 	}
 	if (this->background_products) {
-		renderCSGProducts(*this->background_products, showedges ? shaderinfo : NULL, false, true);
+		renderCSGProducts(*this->background_products, this->background_primitives, showedges ? shaderinfo : NULL, false, true);
 	}
 	if (this->highlights_products) {
-		renderCSGProducts(*this->highlights_products, showedges ? shaderinfo : NULL, true, false);
+		renderCSGProducts(*this->highlights_products, this->highlights_primitives, showedges ? shaderinfo : NULL, true, false);
 	}
+#endif
 }
 
+#ifdef ENABLE_OPENCSG
 // Primitive for rendering using OpenCSG
 OpenCSGPrim *OpenCSGRenderer::createCSGPrimitive(const CSGChainObject &csgobj, OpenCSG::Operation operation, bool highlight_mode, bool background_mode, OpenSCADOperator type) const
 {
@@ -90,18 +106,96 @@ OpenCSGPrim *OpenCSGRenderer::createCSGPrimitive(const CSGChainObject &csgobj, O
 	return prim;
 }
 
-void OpenCSGRenderer::renderCSGProducts(const CSGProducts &products, GLint *shaderinfo, 
+/*!
+	Returns the box containing the visible parts of \a product, i.e. the
+	intersection of the boxes of its intersected objects.
+*/
+static BoundingBox product_bbox(const CSGProduct &product)
+{
+	BoundingBox bbox;
+	bool first = true;
+	for(const auto &csgobj : product.intersections) {
+		if (!csgobj.leaf->geom) continue;
+		const BoundingBox leafbox = Renderer::getRenderedBoundingBox(csgobj.leaf->geom, csgobj.leaf->matrix);
+		bbox = first ? leafbox : bbox.intersection(leafbox);
+		first = false;
+	}
+	return bbox;
+}
+
+/*!
+	Renders the products, using \a allprimitives for the OpenCSG
+	primitives of each. They are created on the first call and reused on
+	every later frame.
+
+	Products of a single opaque leaf need no CSG, so copies of the same
+	geometry in the same color are grouped and drawn with one buffer
+	binding, which is what makes large arrays of placed parts fast.
+*/
+void OpenCSGRenderer::renderCSGProducts(const CSGProducts &products, Primitives &allprimitives, GLint *shaderinfo,
 																				bool highlight_mode, bool background_mode) const
 {
-#ifdef ENABLE_OPENCSG
-	for(const auto &product : products.products) {
-		std::vector<OpenCSG::Primitive*> primitives;
-		for(const auto &csgobj : product.intersections) {
-			if (csgobj.leaf->geom) primitives.push_back(createCSGPrimitive(csgobj, OpenCSG::Intersection, highlight_mode, background_mode, OPENSCAD_INTERSECTION));
+	if (allprimitives.products.empty()) {
+		std::unordered_map<const Geometry *, std::vector<size_t>> groups;
+		for(const auto &product : products.products) {
+			allprimitives.products.push_back(std::vector<OpenCSG::Primitive*>());
+			allprimitives.boxes.push_back(BoundingBox());
+			if (product.intersections.size() == 1 && product.subtractions.empty()) {
+				const CSGLeaf &leaf = *product.intersections[0].leaf;
+				if (!leaf.geom) continue;
+				// Blending depends on the drawing order, so transparent leaves are drawn in place
+				if (leaf.color[3] < 0 || leaf.color[3] == 1) {
+					std::vector<size_t> &candidates = groups[leaf.geom.get()];
+					size_t i = 0;
+					while (i < candidates.size() && allprimitives.instances[candidates[i]].color != leaf.color) i++;
+					if (i == candidates.size()) {
+						candidates.push_back(allprimitives.instances.size());
+						InstanceGroup group;
+						group.geom = leaf.geom;
+						group.color = leaf.color;
+						allprimitives.instances.push_back(group);
+					}
+					InstanceGroup &group = allprimitives.instances[candidates[i]];
+					group.matrices.push_back(&leaf.matrix);
+					group.boxes.push_back(getRenderedBoundingBox(leaf.geom, leaf.matrix));
+					continue;
+				}
+			}
+			allprimitives.boxes.back() = product_bbox(product);
+			std::vector<OpenCSG::Primitive*> &primitives = allprimitives.products.back();
+			for(const auto &csgobj : product.intersections) {
+				if (csgobj.leaf->geom) primitives.push_back(createCSGPrimitive(csgobj, OpenCSG::Intersection, highlight_mode, background_mode, OPENSCAD_INTERSECTION));
+			}
+			for(const auto &csgobj : product.subtractions) {
+				if (csgobj.leaf->geom) primitives.push_back(createCSGPrimitive(csgobj, OpenCSG::Subtraction, highlight_mode, background_mode, OPENSCAD_DIFFERENCE));
+			}
 		}
-		for(const auto &csgobj : product.subtractions) {
-			if (csgobj.leaf->geom) primitives.push_back(createCSGPrimitive(csgobj, OpenCSG::Subtraction, highlight_mode, background_mode, OPENSCAD_DIFFERENCE));
+	}
+
+	const csgmode_e csgmode = csgmode_e(highlight_mode ? CSGMODE_HIGHLIGHT :
+																			(background_mode ? CSGMODE_BACKGROUND : CSGMODE_NORMAL));
+	const ColorMode colormode = highlight_mode ? COLORMODE_HIGHLIGHT :
+		(background_mode ? COLORMODE_BACKGROUND : COLORMODE_MATERIAL);
+	const ViewFrustum frustum;
+	if (!allprimitives.instances.empty()) {
+		if (shaderinfo) glUseProgram(shaderinfo[0]);
+		std::vector<const Transform3d *> visible;
+		for(const auto &group : allprimitives.instances) {
+			visible.clear();
+			for (size_t i = 0; i < group.matrices.size(); i++) {
+				if (frustum.isVisible(group.boxes[i])) visible.push_back(group.matrices[i]);
+			}
+			if (visible.empty()) continue;
+			setColor(colormode, group.color.data(), shaderinfo);
+			render_surface(group.geom, csgmode, visible, shaderinfo);
 		}
+		if (shaderinfo) glUseProgram(0);
+	}
+
+	for (size_t i = 0; i < products.products.size(); i++) {
+		const CSGProduct &product = products.products[i];
+		const std::vector<OpenCSG::Primitive*> &primitives = allprimitives.products[i];
+		if (primitives.empty() || !frustum.isVisible(allprimitives.boxes[i])) continue;
 		if (primitives.size() > 1) {
 			OpenCSG::render(primitives);
 			glDepthFunc(GL_EQUAL);
@@ -155,11 +249,10 @@ void OpenCSGRenderer::renderCSGProducts(const CSGProducts &products, GLint *shad
 		}
 
 		if (shaderinfo) glUseProgram(0);
-		for(auto &p : primitives) delete p;
 		glDepthFunc(GL_LEQUAL);
 	}
-#endif
 }
+#endif
 
 BoundingBox OpenCSGRenderer::getBoundingBox() const
 {
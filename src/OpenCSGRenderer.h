@@ -14,14 +14,39 @@ public:
 									shared_ptr<CSGProducts> highlights_products,
 									shared_ptr<CSGProducts> background_products,
 									GLint *shaderinfo);
+	virtual ~OpenCSGRenderer();
 	virtual void draw(bool showfaces, bool showedges) const;
 	virtual BoundingBox getBoundingBox() const;
 private:
 #ifdef ENABLE_OPENCSG
+	// Copies of one geometry in one color, drawn together
+	struct InstanceGroup {
+		shared_ptr<const class Geometry> geom;
+		Color4f color;
+		std::vector<const Transform3d *> matrices;
+		std::vector<BoundingBox> boxes;
+	};
+
+	/*!
+		The OpenCSG primitives of each product, made on the first draw.
+		Products of a single leaf have no primitives, they are drawn in the
+		instance groups instead. Products are skipped if their bounding box
+		is outside the view.
+	*/
+	struct Primitives {
+		std::vector<std::vector<OpenCSG::Primitive *>> products;
+		std::vector<BoundingBox> boxes;
+		std::vector<InstanceGroup> instances;
+	};
+
 	class OpenCSGPrim *createCSGPrimitive(const class CSGChainObject &csgobj, OpenCSG::Operation operation, bool highlight_mode, bool background_mode, OpenSCADOperator type) const;
+	void renderCSGProducts(const class CSGProducts &products, Primitives &primitives, GLint *shaderinfo,
+												 bool highlight_mode, bool background_mode) const;
+
+	mutable Primitives root_primitives;
+	mutable Primitives highlights_primitives;
+	mutable Primitives background_primitives;
 #endif
-	void renderCSGProducts(const class CSGProducts &products, GLint *shaderinfo, 
-											bool highlight_mode, bool background_mode) const;
 
 	shared_ptr<CSGProducts> root_products;
 	shared_ptr<CSGProducts> highlights_products;
@@ -0,0 +1,88 @@
+#include "OperationCounters.h"
+#include "printutils.h"
+
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <ostream>
+
+namespace OperationCounters {
+
+thread_local ThreadCounts *current = nullptr;
+
+// The counts of each running thread, and the totals of exited ones
+static std::mutex &threads_mutex() { static std::mutex *mutex = new std::mutex; return *mutex; }
+static std::vector<ThreadCounts *> &threads() { static auto *threads = new std::vector<ThreadCounts *>; return *threads; }
+static uint64_t exited[NUM_COUNTERS];
+
+namespace {
+	struct Registration {
+		ThreadCounts counts;
+		Registration() {
+			for (int i = 0; i < NUM_COUNTERS; i++) this->counts.counts[i] = 0;
+			std::lock_guard<std::mutex> lock(threads_mutex());
+			threads().push_back(&this->counts);
+		}
+		~Registration() {
+			std::lock_guard<std::mutex> lock(threads_mutex());
+			for (int i = 0; i < NUM_COUNTERS; i++) exited[i] += this->counts.counts[i];
+			auto &t = threads();
+			t.erase(std::remove(t.begin(), t.end(), &this->counts), t.end());
+			current = nullptr;
+		}
+	};
+}
+
+/*!
+	Registers the counts of the calling thread on its first count.
+*/
+ThreadCounts *attach()
+{
+	thread_local Registration registration;
+	current = &registration.counts;
+	return current;
+}
+
+const char *name(Counter counter)
+{
+	static const char *names[NUM_COUNTERS] = {
+		"polyset_to_nef", "nef_to_polyset", "nef_union", "nef_intersection", "nef_difference",
+		"nef_minkowski", "tessellations", "clipper_executions", "variable_lookup_misses",
+		"value_allocations"
+	};
+	return counter < NUM_COUNTERS ? names[counter] : "unknown";
+}
+
+uint64_t total(Counter counter)
+{
+	std::lock_guard<std::mutex> lock(threads_mutex());
+	uint64_t sum = exited[counter];
+	for (const auto &counts : threads()) sum += counts->counts[counter].load(std::memory_order_relaxed);
+	return sum;
+}
+
+/*!
+	Prints the counters which counted anything.
+*/
+void print()
+{
+	bool header = false;
+	for (int i = 0; i < NUM_COUNTERS; i++) {
+		const uint64_t n = total(Counter(i));
+		if (!n) continue;
+		if (!header) PRINT("Operations:");
+		header = true;
+		PRINTB("  %-24s %12d", name(Counter(i)) % n);
+	}
+}
+
+void writeJSON(std::ostream &out, const std::string &indent)
+{
+	out << "{";
+	for (int i = 0; i < NUM_COUNTERS; i++) {
+		out << (i > 0 ? ",\n" : "\n") << indent << "  \"" << name(Counter(i)) << "\": " << total(Counter(i));
+	}
+	out << "\n" << indent << "}";
+}
+
+}
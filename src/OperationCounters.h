@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <iosfwd>
+#include <stdint.h>
+
+/*!
+	Always-on counts of the operations which dominate renders, e.g. to see
+	how many Nef polyhedra are converted back and forth.
+
+	Each thread increments counters of its own, without locking or
+	contended atomics, so counting costs about as much as incrementing a
+	plain variable. total() adds up the counts of all threads, including
+	those which have exited. The totals are printed with --timing and
+	written to the --timing and --cache-stats JSON.
+*/
+namespace OperationCounters {
+	enum Counter {
+		POLYSET_TO_NEF,
+		NEF_TO_POLYSET,
+		NEF_UNION,
+		NEF_INTERSECTION,
+		NEF_DIFFERENCE,
+		NEF_MINKOWSKI,
+		TESSELLATIONS,        // Of whole PolySets and Polygon2ds
+		CLIPPER_EXECUTIONS,
+		VARIABLE_LOOKUP_MISSES, // Scopes searched by Context::lookup_variable() without finding the variable
+		VALUE_ALLOCATIONS,
+		NUM_COUNTERS
+	};
+
+	struct ThreadCounts {
+		std::atomic<uint64_t> counts[NUM_COUNTERS];
+	};
+	extern thread_local ThreadCounts *current;
+	ThreadCounts *attach();
+
+	inline void count(Counter counter, uint64_t n = 1) {
+		ThreadCounts *counts = current;
+		if (!counts) counts = attach();
+		// Only this thread writes its counts
+		std::atomic<uint64_t> &c = counts->counts[counter];
+		c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	const char *name(Counter counter);
+	uint64_t total(Counter counter);
+	void print();
+	void writeJSON(std::ostream &out, const std::string &indent = "");
+}
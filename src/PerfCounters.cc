@@ -0,0 +1,189 @@
+#include "PerfCounters.h"
+#include "printutils.h"
+
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#endif
+
+namespace PerfCounters {
+
+static std::mutex probes_mutex;
+static std::vector<Probe *> probes;
+static std::atomic<bool> available(false);
+
+/*!
+	Returns a new probe named \a name. Called once per PERF_PROBE() site.
+*/
+Probe *probe(const char *name)
+{
+	Probe *p = new Probe;
+	p->name = name;
+	p->calls = 0;
+	p->nanoseconds = 0;
+	for (int i = 0; i < NUM_COUNTERS; i++) p->counts[i] = 0;
+	std::lock_guard<std::mutex> lock(probes_mutex);
+	probes.push_back(p);
+	return p;
+}
+
+#ifdef __linux__
+
+/*!
+	The counters of one thread. They count user space only, which is
+	allowed at the default perf_event_paranoid level.
+*/
+class ThreadCounters
+{
+public:
+	ThreadCounters() : ok(true) {
+		static const uint64_t configs[NUM_COUNTERS] = {
+			PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+		};
+		const long pagesize = sysconf(_SC_PAGESIZE);
+		for (int i = 0; i < NUM_COUNTERS; i++) {
+			this->fds[i] = -1;
+			this->pages[i] = NULL;
+		}
+		for (int i = 0; i < NUM_COUNTERS && this->ok; i++) {
+			struct perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = configs[i];
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			this->fds[i] = int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+			if (this->fds[i] < 0) {
+				this->ok = false;
+				break;
+			}
+			void *page = mmap(NULL, pagesize, PROT_READ, MAP_SHARED, this->fds[i], 0);
+			if (page != MAP_FAILED) this->pages[i] = static_cast<perf_event_mmap_page *>(page);
+		}
+		if (this->ok) available = true;
+	}
+	~ThreadCounters() {
+		const long pagesize = sysconf(_SC_PAGESIZE);
+		for (int i = 0; i < NUM_COUNTERS; i++) {
+			if (this->pages[i]) munmap(this->pages[i], pagesize);
+			if (this->fds[i] >= 0) close(this->fds[i]);
+		}
+	}
+
+	void read(uint64_t values[NUM_COUNTERS]) const {
+		for (int i = 0; i < NUM_COUNTERS; i++) values[i] = this->ok ? readCounter(i) : 0;
+	}
+
+private:
+	uint64_t readCounter(int i) const {
+#if defined(__x86_64__) || defined(__i386__)
+		// The kernel's documented lock-free read of a self-monitoring counter
+		if (const perf_event_mmap_page *pc = this->pages[i]) {
+			uint32_t seq;
+			uint64_t count;
+			bool rdpmc;
+			do {
+				seq = pc->lock;
+				__sync_synchronize();
+				const uint32_t index = pc->index;
+				rdpmc = pc->cap_user_rdpmc && index;
+				count = pc->offset;
+				if (rdpmc) {
+					uint32_t lo, hi;
+					__asm__ volatile("rdpmc" : "=a"(lo), "=d"(hi) : "c"(index - 1));
+					int64_t pmc = int64_t((uint64_t(hi) << 32) | lo);
+					pmc <<= 64 - pc->pmc_width;
+					pmc >>= 64 - pc->pmc_width;
+					count += pmc;
+				}
+				__sync_synchronize();
+			} while (pc->lock != seq);
+			if (rdpmc) return count;
+		}
+#endif
+		uint64_t count = 0;
+		if (::read(this->fds[i], &count, sizeof(count)) != sizeof(count)) return 0;
+		return count;
+	}
+
+	bool ok;
+	int fds[NUM_COUNTERS];
+	perf_event_mmap_page *pages[NUM_COUNTERS];
+};
+
+static void read_counters(uint64_t values[NUM_COUNTERS])
+{
+	thread_local ThreadCounters counters;
+	counters.read(values);
+}
+
+#else
+
+static void read_counters(uint64_t values[NUM_COUNTERS])
+{
+	for (int i = 0; i < NUM_COUNTERS; i++) values[i] = 0;
+}
+
+#endif // __linux__
+
+static uint64_t now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Scope::Scope(Probe *probe) : probe(probe)
+{
+	read_counters(this->startcounts);
+	this->start = now();
+}
+
+Scope::~Scope()
+{
+	const uint64_t end = now();
+	uint64_t counts[NUM_COUNTERS];
+	read_counters(counts);
+	this->probe->calls.fetch_add(1, std::memory_order_relaxed);
+	this->probe->nanoseconds.fetch_add(end - this->start, std::memory_order_relaxed);
+	for (int i = 0; i < NUM_COUNTERS; i++) {
+		this->probe->counts[i].fetch_add(counts[i] - this->startcounts[i], std::memory_order_relaxed);
+	}
+}
+
+bool isAvailable()
+{
+	return available;
+}
+
+/*!
+	Prints the totals of the probes which were entered, the most expensive
+	first.
+*/
+void print()
+{
+	std::vector<Probe *> sorted;
+	{
+		std::lock_guard<std::mutex> lock(probes_mutex);
+		sorted = probes;
+	}
+	sorted.erase(std::remove_if(sorted.begin(), sorted.end(), [](const Probe *p) { return p->calls == 0; }), sorted.end());
+	if (sorted.empty()) return;
+	std::sort(sorted.begin(), sorted.end(), [](const Probe *a, const Probe *b) { return a->nanoseconds > b->nanoseconds; });
+
+	if (!isAvailable()) PRINT("Probes (no hardware counters available):");
+	PRINT("Probes:            calls       time/s        cycles  cache misses branch misses");
+	for(const auto &p : sorted) {
+		PRINTB("  %-12s %10d %12.3f %13d %13d %13d", p->name % p->calls % (p->nanoseconds * 1e-9) %
+					 p->counts[CYCLES] % p->counts[CACHE_MISSES] % p->counts[BRANCH_MISSES]);
+	}
+}
+
+}
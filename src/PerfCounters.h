@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+/*!
+	Hardware performance counters for hot code, compiled in with
+	ENABLE_PERF_COUNTERS (CONFIG+=perf-counters).
+
+	PERF_PROBE("name") at the start of a block counts the calls, the wall
+	time, and on Linux the CPU cycles, cache misses and branch misses of
+	the rest of the block, added up per probe over all threads. Counts of
+	nested probes are included in the enclosing ones. The counters are
+	opened per thread through perf_event_open() and read in user space
+	with rdpmc where the kernel allows it, so a probe costs some tens of
+	nanoseconds. The totals are printed with --timing.
+
+	Without the build flag PERF_PROBE() expands to nothing.
+*/
+namespace PerfCounters {
+	enum Counter { CYCLES, CACHE_MISSES, BRANCH_MISSES, NUM_COUNTERS };
+
+	struct Probe {
+		const char *name;
+		std::atomic<uint64_t> calls;
+		std::atomic<uint64_t> nanoseconds;
+		std::atomic<uint64_t> counts[NUM_COUNTERS];
+	};
+
+	Probe *probe(const char *name);
+
+	class Scope {
+	public:
+		Scope(Probe *probe);
+		~Scope();
+	private:
+		Probe *probe;
+		uint64_t start;
+		uint64_t startcounts[NUM_COUNTERS];
+	};
+
+	// True if the hardware counters could be opened
+	bool isAvailable();
+	void print();
+}
+
+#ifdef ENABLE_PERF_COUNTERS
+#define PERF_PROBE_JOIN2(a, b) a##b
+#define PERF_PROBE_JOIN(a, b) PERF_PROBE_JOIN2(a, b)
+#define PERF_PROBE(name) \
+	static PerfCounters::Probe *PERF_PROBE_JOIN(perf_probe_, __LINE__) = PerfCounters::probe(name); \
+	PerfCounters::Scope PERF_PROBE_JOIN(perf_scope_, __LINE__)(PERF_PROBE_JOIN(perf_probe_, __LINE__))
+#else
+#define PERF_PROBE(name)
+#endif
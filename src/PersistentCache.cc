@@ -0,0 +1,297 @@
+#include "PersistentCache.h"
+#include "printutils.h"
+
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <initializer_list>
+#include <time.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+namespace fs = boost::filesystem;
+
+static const char *cache_magic = "OpenSCAD-cache 1";
+
+PersistentCache::PersistentCache(size_t limit) : maxsize(limit), totalsize(0)
+{
+}
+
+/*!
+	Enables the on-disk tier using the given directory, creating it if
+	necessary. An empty path disables the tier.
+*/
+void PersistentCache::setDirectory(const std::string &path)
+{
+	std::lock_guard<std::recursive_mutex> lock(this->mutex);
+	this->dir.clear();
+	this->totalsize = 0;
+	this->misses.clear();
+	if (path.empty()) return;
+
+	try {
+		fs::path p(path);
+		if (!fs::exists(p)) fs::create_directories(p);
+		if (!fs::is_directory(p)) {
+			PRINTB("WARNING: Cache directory '%s' is not a directory, disabling persistent cache", path);
+			return;
+		}
+		this->dir = p;
+		scan();
+		trim(this->maxsize);
+	}
+	catch (const fs::filesystem_error &e) {
+		PRINTB("WARNING: Can't use cache directory '%s': %s", path % e.what());
+		this->dir.clear();
+	}
+}
+
+void PersistentCache::setMaxSize(size_t limit)
+{
+	std::lock_guard<std::recursive_mutex> lock(this->mutex);
+	this->maxsize = limit;
+	if (!this->dir.empty()) trim(this->maxsize);
+}
+
+/*!
+	Returns the name of the file used to store the given key. Keys are
+	hashed using 64-bit FNV-1a, which is stable across runs and platforms.
+	The full key is stored in the entry, so a hash collision only results
+	in a miss.
+*/
+std::string PersistentCache::entryName(const std::string &key, const std::string &type)
+{
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t i=0;i<key.size();i++) {
+		h ^= static_cast<unsigned char>(key[i]);
+		h *= 1099511628211ULL;
+	}
+	std::stringstream name;
+	name << std::hex;
+	name.width(16);
+	name.fill('0');
+	name << h << "." << type;
+	return name.str();
+}
+
+// An entry is the magic line, the key length, the key and the payload
+static std::string encode_entry(const std::string &key, const std::string &data)
+{
+	return std::string(cache_magic) + "\n" + std::to_string(key.size()) + "\n" + key + data;
+}
+
+static bool decode_entry(const std::string &entry, const std::string &key, std::string &data)
+{
+	const size_t magicend = entry.find('\n');
+	if (magicend == std::string::npos || entry.compare(0, magicend, cache_magic) != 0) return false;
+	const size_t lenend = entry.find('\n', magicend + 1);
+	if (lenend == std::string::npos) return false;
+	const size_t keylen = strtoul(entry.c_str() + magicend + 1, NULL, 10);
+	if (entry.size() - lenend - 1 < keylen || entry.compare(lenend + 1, keylen, key) != 0) return false;
+	data = entry.substr(lenend + 1 + keylen);
+	return true;
+}
+
+/*!
+	Looks up the given key, in the cache directory first and then in the
+	remote cache. On success, the payload is returned in \a data and the
+	entry is marked as recently used.
+*/
+bool PersistentCache::read(const std::string &key, const std::string &type, std::string &data)
+{
+	const std::string misskey = type + ":" + key;
+	{
+		std::lock_guard<std::recursive_mutex> lock(this->mutex);
+		if (!isEnabled()) return false;
+		if (this->misses.find(misskey) != this->misses.end()) {
+			this->counters.misses++;
+			return false;
+		}
+		if (!this->dir.empty() && readFile(key, type, data)) {
+			this->counters.hits++;
+			return true;
+		}
+	}
+
+	// The lock isn't held while waiting for the server
+	std::string entry;
+	const bool found = this->remote.get(entryName(key, type), entry) && decode_entry(entry, key, data);
+
+	std::lock_guard<std::recursive_mutex> lock(this->mutex);
+	if (!found) {
+		this->misses.insert(misskey);
+		this->counters.misses++;
+		return false;
+	}
+	if (!this->dir.empty()) writeFile(key, type, entry);
+	this->counters.hits++;
+	PRINTDB("Remote cache hit: %s", entryName(key, type));
+	return true;
+}
+
+bool PersistentCache::readFile(const std::string &key, const std::string &type, std::string &data)
+{
+	fs::path p = entryPath(key, type);
+	std::ifstream in(p.string().c_str(), std::ios::in | std::ios::binary);
+	if (!in.is_open()) return false;
+	const std::string entry((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	in.close();
+	if (!decode_entry(entry, key, data)) return false;
+
+	try {
+		fs::last_write_time(p, time(NULL));
+	}
+	catch (const fs::filesystem_error &) {
+		// Failing to update the LRU stamp is harmless
+	}
+	PRINTDB("Persistent cache hit: %s", p.string());
+	return true;
+}
+
+/*!
+	Stores the payload for the given key, in the cache directory and in the
+	remote cache.
+*/
+bool PersistentCache::write(const std::string &key, const std::string &type, const std::string &data)
+{
+	const std::string entry = encode_entry(key, data);
+	bool written = false;
+	{
+		std::lock_guard<std::recursive_mutex> lock(this->mutex);
+		if (!isEnabled()) return false;
+		if (entry.size() > this->maxsize) {
+			this->counters.rejections++;
+			return false;
+		}
+		if (!this->dir.empty()) written = writeFile(key, type, entry);
+	}
+	if (this->remote.put(entryName(key, type), entry)) written = true;
+
+	std::lock_guard<std::recursive_mutex> lock(this->mutex);
+	if (!written) return false;
+	this->misses.erase(type + ":" + key);
+	this->counters.insertions++;
+	return true;
+}
+
+/*!
+	Keeps the entries of \a key until all unpinned entries have been
+	removed, for the rest of the session.
+*/
+void PersistentCache::pin(const std::string &key)
+{
+	std::lock_guard<std::recursive_mutex> lock(this->mutex);
+	for (const auto type : { "geom", "nef3" }) this->pinned.insert(entryName(key, type));
+}
+
+/*!
+	Writes the file of an entry. The file is written under a temporary name
+	and renamed into place so that concurrent OpenSCAD processes sharing a
+	directory never see partial entries.
+*/
+bool PersistentCache::writeFile(const std::string &key, const std::string &type, const std::string &entry)
+{
+	fs::path p = entryPath(key, type);
+	fs::path tmp = p;
+	tmp += ".tmp";
+	{
+		std::ofstream out(tmp.string().c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!out.is_open()) return false;
+		out.write(entry.data(), entry.size());
+		if (!out.good()) {
+			out.close();
+			fs::remove(tmp);
+			return false;
+		}
+	}
+
+	try {
+		if (fs::exists(p)) this->totalsize -= std::min(this->totalsize, size_t(fs::file_size(p)));
+		fs::rename(tmp, p);
+		this->totalsize += fs::file_size(p);
+	}
+	catch (const fs::filesystem_error &e) {
+		PRINTB("WARNING: Persistent cache write failed: %s", e.what());
+		return false;
+	}
+	PRINTDB("Persistent cache insert: %s (%d bytes)", p.string() % entry.size());
+
+	if (this->totalsize > this->maxsize) trim(this->maxsize);
+	return true;
+}
+
+void PersistentCache::scan()
+{
+	this->totalsize = 0;
+	for (fs::directory_iterator it(this->dir); it != fs::directory_iterator(); ++it) {
+		if (fs::is_regular_file(it->status())) this->totalsize += fs::file_size(it->path());
+	}
+}
+
+/*!
+	Removes least recently used entries until the total size is at most
+	\a limit, unpinned entries first.
+*/
+void PersistentCache::trim(size_t limit)
+{
+	if (this->totalsize <= limit) return;
+
+	typedef std::pair<std::pair<bool, time_t>, fs::path> Entry;
+	std::vector<Entry> entries;
+	try {
+		for (fs::directory_iterator it(this->dir); it != fs::directory_iterator(); ++it) {
+			if (fs::is_regular_file(it->status())) {
+				const bool pinned = this->pinned.count(it->path().filename().string()) > 0;
+				entries.push_back(Entry(std::make_pair(pinned, fs::last_write_time(it->path())), it->path()));
+			}
+		}
+		std::sort(entries.begin(), entries.end());
+		for (const auto &e : entries) {
+			if (this->totalsize <= limit) break;
+			size_t size = fs::file_size(e.second);
+			fs::remove(e.second);
+			this->totalsize -= std::min(this->totalsize, size);
+			this->counters.evictions++;
+			this->counters.evictedcost += size;
+		}
+	}
+	catch (const fs::filesystem_error &e) {
+		PRINTB("WARNING: Persistent cache trim failed: %s", e.what());
+		scan();
+	}
+	this->misses.clear();
+}
+
+void PersistentCache::clear()
+{
+	std::lock_guard<std::recursive_mutex> lock(this->mutex);
+	if (this->dir.empty()) return;
+	// Removing everything on request is not an eviction
+	CacheStats saved = this->counters;
+	trim(0);
+	this->counters.evictions = saved.evictions;
+	this->counters.evictedcost = saved.evictedcost;
+}
+
+CacheStats PersistentCache::stats() const
+{
+	std::lock_guard<std::recursive_mutex> lock(this->mutex);
+	CacheStats st = this->counters;
+	st.cost = this->totalsize;
+	st.maxcost = this->maxsize;
+	return st;
+}
+
+void PersistentCache::print()
+{
+	std::lock_guard<std::recursive_mutex> lock(this->mutex);
+	if (!isEnabled()) return;
+	if (!this->dir.empty()) {
+		PRINTB("Persistent cache directory: %s", this->dir.string());
+		PRINTB("Persistent cache size in bytes: %d", this->totalsize);
+	}
+	const std::string url = this->remote.url();
+	if (!url.empty()) PRINTB("Remote cache: %s", url);
+	PRINTB("Persistent cache: %s", stats().toString());
+}
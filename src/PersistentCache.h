@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string>
+#include <unordered_set>
+#include <mutex>
+#include <boost/filesystem.hpp>
+#include "CacheStats.h"
+#include "RemoteCache.h"
+
+/*!
+	Optional on-disk tier behind GeometryCache.
+
+	Each entry is stored as one file in the cache directory, named after a
+	hash of the cache key. The full key is stored in the file header and
+	verified on read, so hash collisions result in cache misses rather than
+	wrong geometry. When the total size exceeds maxSize(), the least recently
+	used files (by modification time) are removed, pinned entries last.
+
+	With setRemote(), entries are also shared through a RemoteCache, which
+	is asked on local misses. Entries fetched from it are kept locally.
+
+	The tier is disabled until setDirectory() or setRemote() is called with
+	a non-empty path. All methods are thread-safe.
+*/
+class PersistentCache
+{
+public:
+	PersistentCache(size_t limit = 1024*1024*1024);
+
+	static PersistentCache *instance() { static PersistentCache *inst = new PersistentCache; return inst; }
+
+	bool isEnabled() const { std::lock_guard<std::recursive_mutex> lock(this->mutex); return !this->dir.empty() || this->remote.isEnabled(); }
+	void setDirectory(const std::string &path);
+	std::string directory() const { return this->dir.string(); }
+	bool setRemote(const std::string &url) { return this->remote.setURL(url); }
+
+	bool read(const std::string &key, const std::string &type, std::string &data);
+	bool write(const std::string &key, const std::string &type, const std::string &data);
+	void pin(const std::string &key);
+
+	size_t maxSize() const { return this->maxsize; }
+	void setMaxSize(size_t limit);
+	size_t totalSize() const { return this->totalsize; }
+	void clear();
+	CacheStats stats() const;
+	void print();
+
+private:
+	static std::string entryName(const std::string &key, const std::string &type);
+	boost::filesystem::path entryPath(const std::string &key, const std::string &type) const { return this->dir / entryName(key, type); }
+	bool readFile(const std::string &key, const std::string &type, std::string &data);
+	bool writeFile(const std::string &key, const std::string &type, const std::string &entry);
+	void scan();
+	void trim(size_t limit);
+
+	boost::filesystem::path dir;
+	RemoteCache remote;
+	size_t maxsize;
+	size_t totalsize;
+	std::unordered_set<std::string> misses;
+	std::unordered_set<std::string> pinned; // Entry names
+	CacheStats counters;
+	mutable std::recursive_mutex mutex;
+};
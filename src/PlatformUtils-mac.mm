@@ -1,6 +1,7 @@
 #include "PlatformUtils.h"
 #include <sys/types.h>
 #include <sys/sysctl.h>
+#include <sys/resource.h>
 #include <boost/lexical_cast.hpp>
 
 #import <Foundation/Foundation.h>
@@ -39,6 +40,14 @@ unsigned long PlatformUtils::stackLimit()
   return STACK_LIMIT_DEFAULT;
 }
 
+uint64_t PlatformUtils::peakMemoryUsage()
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+  // Mac OS X reports bytes
+  return usage.ru_maxrss;
+}
+
 std::string PlatformUtils::sysinfo(bool extended)
 {
   std::string result;
@@ -77,6 +77,14 @@ unsigned long PlatformUtils::stackLimit()
     return STACK_LIMIT_DEFAULT;
 }
 
+uint64_t PlatformUtils::peakMemoryUsage()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    // Linux and the BSDs report kilobytes
+    return uint64_t(usage.ru_maxrss) * 1024;
+}
+
 static std::string readText(const std::string &path)
 {
     std::ifstream s(path.c_str());
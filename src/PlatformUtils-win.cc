@@ -10,6 +10,7 @@
 #define _WIN32_IE 0x0501 // SHGFP_TYPE_CURRENT
 #endif
 #include <shlobj.h>
+#include <psapi.h>
 
 std::string PlatformUtils::pathSeparatorChar()
 {
@@ -100,6 +101,20 @@ unsigned long PlatformUtils::stackLimit()
     return STACK_LIMIT_DEFAULT;
 }
 
+typedef BOOL (WINAPI *LPFN_GETPROCESSMEMORYINFO) (HANDLE, PPROCESS_MEMORY_COUNTERS, DWORD);
+
+uint64_t PlatformUtils::peakMemoryUsage()
+{
+    // Looked up at runtime, so psapi.dll doesn't have to be linked on
+    // versions of Windows that lack the kernel32 entry point.
+    LPFN_GETPROCESSMEMORYINFO fnGetProcessMemoryInfo = (LPFN_GETPROCESSMEMORYINFO)GetProcAddress(GetModuleHandle(TEXT("kernel32")), "K32GetProcessMemoryInfo");
+    if (NULL == fnGetProcessMemoryInfo) return 0;
+
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!fnGetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return counters.PeakWorkingSetSize;
+}
+
 typedef BOOL (WINAPI *LPFN_ISWOW64PROCESS) (HANDLE, PBOOL);
 
 // see http://msdn.microsoft.com/en-us/library/windows/desktop/ms684139%28v=vs.85%29.aspx
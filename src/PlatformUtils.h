@@ -68,6 +68,13 @@ namespace PlatformUtils {
          * @return maximum stack size in bytes.
          */
         unsigned long stackLimit();
+
+        /**
+         * Return the peak physical memory used by the process so far.
+         *
+         * @return peak resident set size in bytes, or 0 if unknown.
+         */
+        uint64_t peakMemoryUsage();
         
 	/**
 	 * Single character separating path specifications in a list
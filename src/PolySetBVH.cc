@@ -0,0 +1,203 @@
+#include "PolySetBVH.h"
+#include "polyset.h"
+
+#include <algorithm>
+#include <limits>
+
+// Most polygons in a leaf
+static const size_t LEAF_SIZE = 4;
+// Deeper than any tree built from median splits of 32-bit polygon indices
+static const size_t MAX_DEPTH = 64;
+
+static bool overlaps(const BoundingBox &a, const BoundingBox &b)
+{
+	return !a.intersection(b).isEmpty();
+}
+
+PolySetBVH::PolySetBVH(const PolySet &ps) : ps(ps)
+{
+	const size_t n = ps.numPolygons();
+	std::vector<BoundingBox> boxes(n);
+	std::vector<Vector3d> centers(n);
+	for (size_t i = 0; i < n; i++) {
+		for (const auto &v : ps.face(i)) boxes[i].extend(v);
+		centers[i] = boxes[i].isEmpty() ? Vector3d(Vector3d::Zero()) : Vector3d(boxes[i].center());
+	}
+	this->polygons.resize(n);
+	for (size_t i = 0; i < n; i++) this->polygons[i] = uint32_t(i);
+	this->nodes.reserve(n > 0 ? 2 * ((n + LEAF_SIZE - 1) / LEAF_SIZE) : 0);
+	if (n > 0) build(0, n, boxes, centers);
+}
+
+/*!
+	Adds the node for the polygons [first, last[ and its subtree, splitting
+	at the median of the polygon centers along the longest axis.
+*/
+void PolySetBVH::build(size_t first, size_t last, const std::vector<BoundingBox> &boxes, const std::vector<Vector3d> &centers)
+{
+	const size_t index = this->nodes.size();
+	this->nodes.push_back(Node());
+	BoundingBox box, centerbox;
+	for (size_t i = first; i < last; i++) {
+		box.extend(boxes[this->polygons[i]]);
+		centerbox.extend(centers[this->polygons[i]]);
+	}
+	this->nodes[index].box = box;
+	if (last - first <= LEAF_SIZE) {
+		this->nodes[index].first = uint32_t(first);
+		this->nodes[index].count = uint32_t(last - first);
+		return;
+	}
+
+	int axis;
+	centerbox.sizes().maxCoeff(&axis);
+	const size_t mid = (first + last) / 2;
+	std::nth_element(this->polygons.begin() + first, this->polygons.begin() + mid, this->polygons.begin() + last,
+									 [&centers, axis](uint32_t a, uint32_t b) { return centers[a][axis] < centers[b][axis]; });
+	build(first, mid, boxes, centers);
+	this->nodes[index].first = uint32_t(this->nodes.size());
+	this->nodes[index].count = 0;
+	build(mid, last, boxes, centers);
+}
+
+const BoundingBox &PolySetBVH::getBoundingBox() const
+{
+	static const BoundingBox empty;
+	return this->nodes.empty() ? empty : this->nodes.front().box;
+}
+
+/*!
+	Returns true if the bounding box of any polygon overlaps or touches
+	\a box.
+*/
+bool PolySetBVH::intersects(const BoundingBox &box) const
+{
+	return findOverlapping(box, nullptr);
+}
+
+/*!
+	Returns the polygons whose bounding boxes overlap or touch \a box.
+*/
+std::vector<size_t> PolySetBVH::overlapping(const BoundingBox &box) const
+{
+	std::vector<size_t> result;
+	findOverlapping(box, &result);
+	return result;
+}
+
+/*!
+	Finds the polygons overlapping \a box, adding them to \a result. Without
+	a result, stops at the first one. Returns true if there are any.
+*/
+bool PolySetBVH::findOverlapping(const BoundingBox &box, std::vector<size_t> *result) const
+{
+	if (this->nodes.empty()) return false;
+	bool found = false;
+	uint32_t stack[MAX_DEPTH];
+	size_t depth = 0;
+	stack[depth++] = 0;
+	while (depth > 0) {
+		const uint32_t index = stack[--depth];
+		const Node &node = this->nodes[index];
+		if (!overlaps(node.box, box)) continue;
+		if (node.count == 0) {
+			stack[depth++] = node.first;
+			stack[depth++] = index + 1;
+			continue;
+		}
+		for (uint32_t i = node.first; i < node.first + node.count; i++) {
+			BoundingBox facebox;
+			for (const auto &v : this->ps.face(this->polygons[i])) facebox.extend(v);
+			if (!overlaps(facebox, box)) continue;
+			if (!result) return true;
+			result->push_back(this->polygons[i]);
+			found = true;
+		}
+	}
+	return found;
+}
+
+/*!
+	Returns the winding number of the mesh around \a p: the crossings of a
+	ray from \a p with the polygons, counted by their orientation. It is
+	non-zero inside closed meshes.
+
+	Polygons are split into triangle fans from their first vertex. Sets \a
+	ok to false if the ray passes too close to an edge of such a triangle,
+	or \a p lies on a polygon, to tell the crossings apart.
+*/
+int PolySetBVH::windingNumber(const Vector3d &p, bool &ok) const
+{
+	ok = true;
+	if (this->nodes.empty()) return 0;
+	// No component is zero, and the ray is unlikely to be aligned with any
+	// edge or face of a model
+	const Vector3d dir = Vector3d(0.6151, 0.7303, 0.2971).normalized();
+	const Vector3d invdir(1 / dir[0], 1 / dir[1], 1 / dir[2]);
+	const double eps = 1e-9;
+
+	int winding = 0;
+	uint32_t stack[MAX_DEPTH];
+	size_t depth = 0;
+	stack[depth++] = 0;
+	while (depth > 0) {
+		const uint32_t index = stack[--depth];
+		const Node &node = this->nodes[index];
+		// Slab test of the ray against the node's box
+		double tmin = 0, tmax = std::numeric_limits<double>::infinity();
+		for (int i = 0; i < 3; i++) {
+			double t1 = (node.box.min()[i] - p[i]) * invdir[i];
+			double t2 = (node.box.max()[i] - p[i]) * invdir[i];
+			if (t1 > t2) std::swap(t1, t2);
+			tmin = std::max(tmin, t1);
+			tmax = std::min(tmax, t2);
+		}
+		if (tmin > tmax) continue;
+		if (node.count == 0) {
+			stack[depth++] = node.first;
+			stack[depth++] = index + 1;
+			continue;
+		}
+		for (uint32_t i = node.first; i < node.first + node.count; i++) {
+			const PolySet::Face face = this->ps.face(this->polygons[i]);
+			for (size_t j = 1; j + 1 < face.size(); j++) {
+				// Moeller-Trumbore ray-triangle intersection
+				const Vector3d e1 = face[j] - face[0];
+				const Vector3d e2 = face[j + 1] - face[0];
+				const Vector3d q = dir.cross(e2);
+				const double det = e1.dot(q);
+				if (std::abs(det) <= eps * e1.norm() * e2.norm()) continue; // Parallel or degenerate
+				const Vector3d s = p - face[0];
+				const double u = s.dot(q) / det;
+				const Vector3d r = s.cross(e1);
+				const double v = dir.dot(r) / det;
+				const double t = e2.dot(r) / det;
+				if (u < -eps || v < -eps || u + v > 1 + eps || t < -eps) continue;
+				if (u <= eps || v <= eps || u + v >= 1 - eps || t <= eps) {
+					ok = false;
+					return 0;
+				}
+				winding += det > 0 ? 1 : -1;
+			}
+		}
+	}
+	return winding;
+}
+
+/*!
+	Returns true if \a box is known to lie outside the closed mesh: no
+	polygon touches it, so it is entirely inside or outside, and its center
+	is outside.
+*/
+bool PolySetBVH::isOutside(const BoundingBox &box) const
+{
+	if (box.isEmpty() || intersects(box)) return false;
+	bool ok;
+	const int winding = windingNumber(box.center(), ok);
+	return ok && winding == 0;
+}
+
+size_t PolySetBVH::memsize() const
+{
+	return this->nodes.capacity() * sizeof(Node) + this->polygons.capacity() * sizeof(uint32_t) + sizeof(PolySetBVH);
+}
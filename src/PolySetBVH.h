@@ -0,0 +1,43 @@
+#pragma once
+
+#include "linalg.h"
+#include <vector>
+#include <cstdint>
+
+class PolySet;
+
+/*!
+	Bounding volume hierarchy over the polygons of a PolySet, for overlap
+	tests and ray queries which would otherwise scan all polygons.
+
+	Built by PolySet::getBVH() on first use, and kept with the PolySet, so
+	cached geometry builds it at most once. It refers to the polygons of
+	the PolySet and is dropped when the PolySet changes.
+*/
+class PolySetBVH
+{
+public:
+	PolySetBVH(const PolySet &ps);
+
+	const BoundingBox &getBoundingBox() const;
+	bool intersects(const BoundingBox &box) const;
+	std::vector<size_t> overlapping(const BoundingBox &box) const;
+	int windingNumber(const Vector3d &p, bool &ok) const;
+	bool isOutside(const BoundingBox &box) const;
+	size_t memsize() const;
+
+private:
+	// Inner nodes have their left child next to them
+	struct Node {
+		BoundingBox box;
+		uint32_t first; // First polygon of leaves, right child of inner nodes
+		uint32_t count; // Number of polygons, 0 for inner nodes
+	};
+
+	bool findOverlapping(const BoundingBox &box, std::vector<size_t> *result) const;
+	void build(size_t first, size_t last, const std::vector<BoundingBox> &boxes, const std::vector<Vector3d> &centers);
+
+	const PolySet &ps;
+	std::vector<Node> nodes;
+	std::vector<uint32_t> polygons; // Polygon indices in leaf order
+};
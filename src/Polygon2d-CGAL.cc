@@ -1,6 +1,7 @@
 #include "Polygon2d-CGAL.h"
 #include "polyset.h"
 #include "printutils.h"
+#include "OperationCounters.h"
 
 #include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
 #include <CGAL/Constrained_Delaunay_triangulation_2.h>
@@ -98,12 +99,46 @@ mark_domains(CDT &cdt)
 	CGAL::set_error_behaviour(old_behaviour);
   
 
+// Ear clipping is quadratic in the worst case, so larger outlines go to the
+// triangulator
+static const size_t EARCLIP_MAX_VERTICES = 1000;
+
+/*!
+	Triangulates a sanitized polygon without holes by ear clipping.
+	Returns NULL if the polygon is not suitable, or ear clipping fails.
+*/
+static PolySet *tessellateEarClipping(const Polygon2d &poly)
+{
+	if (!poly.isSanitized() || poly.outlines().size() != 1) return NULL;
+	const Outline2d &outline = poly.outlines()[0];
+	if (!outline.positive || outline.vertices.size() > EARCLIP_MAX_VERTICES) return NULL;
+
+	std::vector<IndexedTriangle> triangles;
+	if (GeometryUtils::triangulateSimplePolygon(outline.vertices, triangles)) {
+		PRINTD("Polygon2d::tessellate(): Ear clipping failed");
+		return NULL;
+	}
+	PolySet *polyset = new PolySet(poly);
+	for(const auto &t : triangles) {
+		polyset->append_poly();
+		for (int i=0;i<3;i++) polyset->append_vertex(outline.vertices[t[i]][0], outline.vertices[t[i]][1], 0);
+	}
+	return polyset;
+}
+
 /*!
 	Triangulates this polygon2d and returns a 2D PolySet.
+
+	Extrusion caps and text are mostly small outlines without holes, which
+	are ear clipped. Anything else uses a constrained Delaunay triangulation,
+	which also handles holes and intersecting outlines.
 */
 PolySet *Polygon2d::tessellate() const
 {
 	PRINTDB("Polygon2d::tessellate(): %d outlines", this->outlines().size());
+	OperationCounters::count(OperationCounters::TESSELLATIONS);
+	if (PolySet *polyset = tessellateEarClipping(*this)) return polyset;
+
 	PolySet *polyset = new PolySet(*this);
 
 	Polygon2DCGAL::CDT cdt; // Uses a constrained Delaunay triangulator.
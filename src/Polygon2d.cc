@@ -1,5 +1,6 @@
 #include "Polygon2d.h"
 #include "printutils.h"
+#include "polyclipping/clipper.hpp"
 
 /*!
 	Class for holding 2D geometry.
@@ -22,6 +23,11 @@ size_t Polygon2d::memsize() const
 	for(const auto &o : this->outlines()) {
 		mem += o.vertices.size() * sizeof(Vector2d) + sizeof(Outline2d);
 	}
+	if (this->clipperpaths) {
+		for(const auto &p : *this->clipperpaths) {
+			mem += p.size() * sizeof(ClipperLib::IntPoint) + sizeof(ClipperLib::Path);
+		}
+	}
 	mem += sizeof(Polygon2d);
 	return mem;
 }
@@ -57,6 +63,7 @@ bool Polygon2d::isEmpty() const
 
 void Polygon2d::transform(const Transform2d &mat)
 {
+	this->clipperpaths.reset();
 	if (mat.matrix().determinant() == 0) {
 		PRINT("WARNING: Scaling a 2D object with 0 - removing object");
 		this->theoutlines.clear();
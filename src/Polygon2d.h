@@ -4,6 +4,8 @@
 #include "linalg.h"
 #include <vector>
 
+namespace ClipperLib { struct IntPoint; }
+
 /*!
 	A single contour.
 	positive is (optionally) used to distinguish between polygon contours and hold contours.
@@ -25,7 +27,7 @@ public:
 	virtual bool isEmpty() const;
 	virtual Geometry *copy() const { return new Polygon2d(*this); }
 
-	void addOutline(const Outline2d &outline) { this->theoutlines.push_back(outline); }
+	void addOutline(const Outline2d &outline) { this->theoutlines.push_back(outline); this->clipperpaths.reset(); }
 	class PolySet *tessellate() const;
 
 	typedef std::vector<Outline2d> Outlines2d;
@@ -37,7 +39,17 @@ public:
 	bool isSanitized() const { return this->sanitized; }
 	void setSanitized(bool s) { this->sanitized = s; }
 	bool is_convex() const;
+
+	// Same type as ClipperLib::Paths
+	typedef std::vector<std::vector<ClipperLib::IntPoint>> ClipperPaths;
+	/*!
+		The outlines in Clipper coordinates, if known. Set by ClipperUtils
+		so chained 2D operations don't need to convert again.
+	*/
+	const shared_ptr<const ClipperPaths> &clipperPaths() const { return this->clipperpaths; }
+	void setClipperPaths(const shared_ptr<const ClipperPaths> &paths) { this->clipperpaths = paths; }
 private:
 	Outlines2d theoutlines;
 	bool sanitized;
+	shared_ptr<const ClipperPaths> clipperpaths;
 };
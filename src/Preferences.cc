@@ -36,7 +36,6 @@
 #include "AutoUpdater.h"
 #include "feature.h"
 #ifdef ENABLE_CGAL
-#include "CGALCache.h"
 #endif
 #include "colormap.h"
 #include "rendersettings.h"
@@ -156,10 +155,9 @@ void Preferences::init() {
 	this->defaultmap["advanced/opencsg_show_warning"] = true;
 	this->defaultmap["advanced/enable_opencsg_opengl1x"] = true;
 	this->defaultmap["advanced/polysetCacheSize"] = uint(GeometryCache::instance()->maxSize());
-#ifdef ENABLE_CGAL
-	this->defaultmap["advanced/cgalCacheSize"] = uint(CGALCache::instance()->maxSize());
-#endif
 	this->defaultmap["advanced/openCSGLimit"] = RenderSettings::inst()->openCSGTermLimit;
+	this->defaultmap["advanced/previewFragmentLimit"] = 0;
+	this->defaultmap["advanced/threads"] = 0;
 	this->defaultmap["advanced/forceGoldfeather"] = false;
 	this->defaultmap["advanced/mdi"] = true;
 	this->defaultmap["advanced/undockableWindows"] = false;
@@ -192,11 +190,9 @@ void Preferences::init() {
 
   // Advanced pane	
 	QValidator *validator = new QIntValidator(this);
-#ifdef ENABLE_CGAL
-	this->cgalCacheSizeEdit->setValidator(validator);
-#endif
 	this->polysetCacheSizeEdit->setValidator(validator);
 	this->opencsgLimitEdit->setValidator(validator);
+	this->threadsEdit->setValidator(new QIntValidator(0, 1024, this));
 
 	initComboBox(this->comboBoxIndentUsing, Settings::Settings::indentStyle);
 	initComboBox(this->comboBoxLineWrap, Settings::Settings::lineWrap);
@@ -431,15 +427,6 @@ Preferences::on_enableOpenCSGBox_toggled(bool state)
 	settings.setValue("advanced/enable_opencsg_opengl1x", state);
 }
 
-void Preferences::on_cgalCacheSizeEdit_textChanged(const QString &text)
-{
-	QSettings settings;
-	settings.setValue("advanced/cgalCacheSize", text);
-#ifdef ENABLE_CGAL
-	CGALCache::instance()->setMaxSize(text.toULong());
-#endif
-}
-
 void Preferences::on_polysetCacheSizeEdit_textChanged(const QString &text)
 {
 	QSettings settings;
@@ -454,6 +441,18 @@ void Preferences::on_opencsgLimitEdit_textChanged(const QString &text)
 	// FIXME: Set this globally?
 }
 
+void Preferences::on_previewFragmentLimitEdit_textChanged(const QString &text)
+{
+	QSettings settings;
+	settings.setValue("advanced/previewFragmentLimit", text);
+}
+
+void Preferences::on_threadsEdit_textChanged(const QString &text)
+{
+	QSettings settings;
+	settings.setValue("advanced/threads", text);
+}
+
 void Preferences::on_localizationCheckBox_toggled(bool state)
 {
 	QSettings settings;
@@ -669,9 +668,10 @@ void Preferences::updateGUI()
 
 	this->openCSGWarningBox->setChecked(getValue("advanced/opencsg_show_warning").toBool());
 	this->enableOpenCSGBox->setChecked(getValue("advanced/enable_opencsg_opengl1x").toBool());
-	this->cgalCacheSizeEdit->setText(getValue("advanced/cgalCacheSize").toString());
 	this->polysetCacheSizeEdit->setText(getValue("advanced/polysetCacheSize").toString());
 	this->opencsgLimitEdit->setText(getValue("advanced/openCSGLimit").toString());
+	this->previewFragmentLimitEdit->setText(getValue("advanced/previewFragmentLimit").toString());
+	this->threadsEdit->setText(getValue("advanced/threads").toString());
 	this->localizationCheckBox->setChecked(getValue("advanced/localization").toBool());
 	this->forceGoldfeatherBox->setChecked(getValue("advanced/forceGoldfeather").toBool());
 	this->mdiCheckBox->setChecked(getValue("advanced/mdi").toBool());
@@ -0,0 +1,43 @@
+#include "PreviewCache.h"
+#include "Geometry.h"
+
+/*!
+	Returns the geometry drawn for subtree \a id, if it was made from
+	\a source. Otherwise NULL is returned.
+*/
+shared_ptr<const Geometry> PreviewCache::get(const std::string &id, const shared_ptr<const Geometry> &source)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	auto it = this->entries.find(id);
+	if (it == this->entries.end() || it->second.source != source) return shared_ptr<const Geometry>();
+	it->second.generation = this->generation;
+	return it->second.geom;
+}
+
+void PreviewCache::insert(const std::string &id, const shared_ptr<const Geometry> &source, const shared_ptr<const Geometry> &geom)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	Entry &entry = this->entries[id];
+	entry.source = source;
+	entry.geom = geom;
+	entry.generation = this->generation;
+}
+
+/*!
+	Drops the entries which weren't used since the last call.
+*/
+void PreviewCache::finishPreview()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	for (auto it = this->entries.begin(); it != this->entries.end();) {
+		if (it->second.generation != this->generation) it = this->entries.erase(it);
+		else it++;
+	}
+	this->generation++;
+}
+
+void PreviewCache::clear()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->entries.clear();
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "memory.h"
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class Geometry;
+
+/*!
+	Keeps the geometry drawn for the CSG leaves of the preview between
+	recompiles, keyed by the subtree id. A leaf whose subtree evaluates to
+	the same geometry as before gets the same tessellated PolySet, and with
+	it the vertex buffers already uploaded for it, so a recompile only
+	tessellates and uploads the parts which changed.
+
+	Entries not used by a preview are dropped when the next one is done.
+*/
+class PreviewCache
+{
+public:
+	PreviewCache() : generation(0) {}
+
+	static PreviewCache *instance() { static PreviewCache *inst = new PreviewCache; return inst; }
+
+	shared_ptr<const Geometry> get(const std::string &id, const shared_ptr<const Geometry> &source);
+	void insert(const std::string &id, const shared_ptr<const Geometry> &source, const shared_ptr<const Geometry> &geom);
+	void finishPreview();
+	void clear();
+
+private:
+	struct Entry {
+		shared_ptr<const Geometry> source;
+		shared_ptr<const Geometry> geom;
+		unsigned int generation;
+	};
+
+	std::mutex mutex;
+	std::unordered_map<std::string, Entry> entries;
+	unsigned int generation;
+};
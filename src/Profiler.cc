@@ -0,0 +1,121 @@
+#include "Profiler.h"
+#include "node.h"
+#include "ModuleInstantiation.h"
+#include "printutils.h"
+
+#include <algorithm>
+#include <ostream>
+#include <boost/format.hpp>
+
+thread_local std::vector<Profiler::Frame> Profiler::frames;
+thread_local unsigned long Profiler::nodes_created = 0;
+
+static std::string make_label(const char *kind, const std::string &name, int line)
+{
+	std::string label = std::string(kind) + " " + name;
+	if (line > 0) label += str(boost::format(" (line %d)") % line);
+	return label;
+}
+
+/*!
+	Starts a call of the module or function \a name, defined at \a line.
+*/
+void Profiler::enter(const char *kind, const std::string &name, int line)
+{
+	Frame frame;
+	frame.label = make_label(kind, name, line);
+	frame.childseconds = 0;
+	frame.nodes = nodes_created;
+	frame.start = Clock::now();
+	frames.push_back(frame);
+}
+
+void Profiler::leave()
+{
+	const Clock::time_point now = Clock::now();
+	const Frame &frame = frames.back();
+	const double seconds = std::chrono::duration<double>(now - frame.start).count();
+
+	std::string stack;
+	bool recursive = false;
+	for (size_t i = 0; i + 1 < frames.size(); i++) {
+		stack += frames[i].label;
+		stack += ';';
+		if (frames[i].label == frame.label) recursive = true;
+	}
+	stack += frame.label;
+
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		Stats &s = this->stats[frame.label];
+		s.calls++;
+		s.exclusive += seconds - frame.childseconds;
+		// Recursive calls are already included in the outermost call
+		if (!recursive) {
+			s.inclusive += seconds;
+			s.nodes += nodes_created - frame.nodes;
+		}
+		this->stacks[stack] += seconds - frame.childseconds;
+	}
+
+	frames.pop_back();
+	if (!frames.empty()) frames.back().childseconds += seconds;
+}
+
+/*!
+	Records the geometry evaluation of \a node, which took \a seconds
+	including \a childseconds for its children.
+*/
+void Profiler::addNode(const AbstractNode &node, double seconds, double childseconds)
+{
+	const int line = node.modinst ? node.modinst->location().firstLine() : 0;
+	const std::string label = make_label("node", node.name(), line);
+	std::lock_guard<std::mutex> lock(this->mutex);
+	Stats &s = this->stats[label];
+	s.calls++;
+	s.inclusive += seconds;
+	s.exclusive += seconds - childseconds;
+	this->stacks["geometry;" + label] += seconds - childseconds;
+}
+
+void Profiler::clear()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->stats.clear();
+	this->stacks.clear();
+}
+
+/*!
+	Writes the recorded stacks in the folded format read by flamegraph.pl,
+	one line per stack with the exclusive time in microseconds.
+*/
+void Profiler::write(std::ostream &stream) const
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	std::vector<std::pair<std::string, double>> sorted(this->stacks.begin(), this->stacks.end());
+	std::sort(sorted.begin(), sorted.end());
+	for(const auto &s : sorted) {
+		const long micros = long(s.second * 1e6 + 0.5);
+		if (micros > 0) stream << s.first << ' ' << micros << '\n';
+	}
+}
+
+/*!
+	Prints the \a count modules, functions and nodes with the most
+	exclusive time.
+*/
+void Profiler::print(size_t count) const
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	std::vector<std::pair<std::string, Stats>> sorted(this->stats.begin(), this->stats.end());
+	std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, Stats> &a, const std::pair<std::string, Stats> &b) {
+			return a.second.exclusive > b.second.exclusive;
+		});
+	if (sorted.size() > count) sorted.resize(count);
+
+	PRINT("Profile:      calls  inclusive/s  exclusive/s      nodes");
+	for(const auto &s : sorted) {
+		PRINTB("  %10d %12.3f %12.3f %10d  %s", s.second.calls % s.second.inclusive %
+					 s.second.exclusive % s.second.nodes % s.first);
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <iosfwd>
+#include <unordered_map>
+
+/*!
+	Measures where evaluation time goes in user code, enabled with
+	--profile. Records the calls of user modules and functions with a
+	Scope, and the evaluation time of geometry nodes with addNode().
+
+	Each call is charged to its stack of enclosing calls. write() outputs
+	these stacks in the folded format of flamegraph.pl, with the exclusive
+	time in microseconds, and print() a summary of the most expensive
+	modules and functions with their call counts, inclusive and exclusive
+	times and the number of nodes they created.
+*/
+class Profiler
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	static Profiler *instance() { static Profiler *inst = new Profiler; return inst; }
+
+	void enable(bool enabled) { this->enabled = enabled; }
+	bool isEnabled() const { return this->enabled; }
+
+	class Scope {
+	public:
+		Scope(const char *kind, const std::string &name, int line) : active(Profiler::instance()->isEnabled()) {
+			if (this->active) Profiler::instance()->enter(kind, name, line);
+		}
+		~Scope() { if (this->active) Profiler::instance()->leave(); }
+	private:
+		bool active;
+	};
+
+	void addNode(const class AbstractNode &node, double seconds, double childseconds);
+	// Called for each node created, to count them per call
+	static void nodeCreated() { nodes_created++; }
+
+	void clear();
+	void write(std::ostream &stream) const;
+	void print(size_t count = 20) const;
+
+private:
+	Profiler() : enabled(false) {}
+
+	void enter(const char *kind, const std::string &name, int line);
+	void leave();
+
+	struct Frame {
+		std::string label;
+		Clock::time_point start;
+		double childseconds;
+		unsigned long nodes;
+	};
+	struct Stats {
+		Stats() : calls(0), inclusive(0), exclusive(0), nodes(0) {}
+		unsigned long calls;
+		double inclusive;
+		double exclusive;
+		unsigned long nodes;
+	};
+
+	bool enabled;
+	mutable std::mutex mutex;
+	std::unordered_map<std::string, Stats> stats;
+	// Exclusive seconds per folded stack
+	std::unordered_map<std::string, double> stacks;
+
+	thread_local static std::vector<Frame> frames;
+	thread_local static unsigned long nodes_created;
+};
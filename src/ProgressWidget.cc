@@ -7,6 +7,7 @@ ProgressWidget::ProgressWidget(QWidget *parent)
 	setupUi(this);
 	setRange(0, 1000);
 	setValue(0);
+	setRemainingTime(-1);
 	this->wascanceled = false;
 	this->starttime.start();
 
@@ -27,6 +28,31 @@ int ProgressWidget::elapsedTime() const
 	return this->starttime.elapsed();
 }
 
+/*!
+	Returns the estimated seconds left, or -1 if unknown
+*/
+int ProgressWidget::remainingTime() const
+{
+	return this->remaining;
+}
+
+/*!
+	Shows the estimated time left next to the percentage done.
+	A negative time is unknown.
+*/
+void ProgressWidget::setRemainingTime(int seconds)
+{
+	this->remaining = seconds;
+	if (seconds < 0) {
+		this->progressBar->setFormat("%p%");
+	}
+	else {
+		const QString left = seconds < 60 ? QString("%1 s").arg(seconds) :
+			QString("%1:%2").arg(seconds / 60).arg(seconds % 60, 2, 10, QChar('0'));
+		this->progressBar->setFormat(QString(_("%p%, %1 left")).arg(left));
+	}
+}
+
 void ProgressWidget::cancel()
 {
 	this->wascanceled = true;
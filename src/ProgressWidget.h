@@ -13,11 +13,13 @@ public:
 	ProgressWidget(QWidget *parent = NULL);
 	bool wasCanceled() const;
 	int elapsedTime() const;
+	int remainingTime() const;
 
 public slots:
 	void setRange(int minimum, int maximum);
 	void setValue(int progress);
 	int value() const;
+	void setRemainingTime(int seconds);
 	void cancel();
 
 signals:
@@ -25,5 +27,6 @@ signals:
 
 private:
 	bool wascanceled;
+	int remaining;
 	QTime starttime;
 };
@@ -44,6 +44,7 @@
 #include "OpenCSGWarningDialog.h"
 
 #include <stdio.h>
+#include <chrono>
 
 #ifdef ENABLE_OPENCSG
 #  include <opencsg.h>
@@ -69,6 +70,12 @@ void QGLView::init()
 
   this->mouse_drag_active = false;
   this->statusLabel = NULL;
+  this->showframetime = false;
+  this->frametime = 0;
+  this->idleTimer = new QTimer(this);
+  this->idleTimer->setSingleShot(true);
+  this->idleTimer->setInterval(300);
+  connect(this->idleTimer, SIGNAL(timeout()), this, SLOT(viewIdle()));
 
   setMouseTracking(true);
 
@@ -165,15 +172,23 @@ void QGLView::resizeGL(int w, int h)
 
 void QGLView::paintGL()
 {
+  const auto start = std::chrono::steady_clock::now();
   GLView::paintGL();
+  if (this->showframetime) {
+    // Wait for the GPU, so slow fill rates show up too
+    glFinish();
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    this->frametime = this->frametime > 0 ? 0.8 * this->frametime + 0.2 * ms : ms;
+  }
 
   if (statusLabel) {
     Camera nc(cam);
     nc.gimbalDefaultTranslate();
-	const QString status = QString("%1 (%2x%3)")
+	QString status = QString("%1 (%2x%3)")
 		.arg(QString::fromStdString(nc.statusText()))
 		.arg(size().rwidth())
 		.arg(size().rheight());
+	if (this->showframetime) status += QString(" %1 ms/frame").arg(this->frametime, 0, 'f', 1);
     statusLabel->setText(status);
   }
 
@@ -302,12 +317,39 @@ void QGLView::mouseMoveEvent(QMouseEvent *event)
       cam.object_trans.z() += tm(2,3);
       }
     }
-    updateGL();
+    cameraMoved();
+    scheduleRepaint();
     emit doAnimateUpdate();
   }
   last_mouse = this_mouse;
 }
 
+/*!
+	Repaints with the next pass of the event loop. Repaints requested by
+	mouse events arriving faster than frames are drawn are coalesced into
+	one.
+*/
+void QGLView::scheduleRepaint()
+{
+  update();
+}
+
+/*!
+	Draws interactively, e.g. with reduced detail, until the camera has
+	stopped for a moment.
+*/
+void QGLView::cameraMoved()
+{
+  this->interactive = true;
+  this->idleTimer->start();
+}
+
+void QGLView::viewIdle()
+{
+  this->interactive = false;
+  updateGL();
+}
+
 void QGLView::mouseReleaseEvent(QMouseEvent*)
 {
   mouse_drag_active = false;
@@ -334,18 +376,21 @@ void QGLView::wheelEvent(QWheelEvent *event)
 #else
 	this->cam.zoom(event->delta());
 #endif
-  updateGL();
+  cameraMoved();
+  scheduleRepaint();
 }
 
 void QGLView::ZoomIn(void)
 {
   this->cam.zoom(120);
+  cameraMoved();
   updateGL();
 }
 
 void QGLView::ZoomOut(void)
 {
   this->cam.zoom(-120);
+  cameraMoved();
   updateGL();
 }
 
@@ -49,6 +49,8 @@ public:
 	void setOrthoMode(bool enabled);
 	bool showScaleProportional() const { return this->showscale; }
 	void setShowScaleProportional(bool enabled) { this->showscale = enabled; }
+	bool showFrameTime() const { return this->showframetime; }
+	void setShowFrameTime(bool enabled) { this->showframetime = enabled; this->frametime = 0; }
 	std::string getRendererInfo() const;
 #if QT_VERSION >= 0x050100
 	float getDPI() { return this->devicePixelRatio(); }
@@ -76,6 +78,9 @@ private:
 
 	bool mouse_drag_active;
 	QPoint last_mouse;
+	class QTimer *idleTimer; // Ends the interactive drawing once the camera stops
+	bool showframetime;
+	double frametime; // Smoothed milliseconds per frame, 0 until measured
 	QImage frame; // Used by grabFrame() and save()
 
 	void wheelEvent(QWheelEvent *event);
@@ -88,7 +93,9 @@ private:
 	void resizeGL(int w, int h);
 
 	void paintGL();
+	void scheduleRepaint();
 	void normalizeAngle(GLdouble& angle);
+	void cameraMoved();
 
 #ifdef ENABLE_OPENCSG
 	void display_opencsg_warning();
@@ -96,6 +103,9 @@ private slots:
 	void display_opencsg_warning_dialog();
 #endif
 
+private slots:
+	void viewIdle();
+
 signals:
 	void doAnimateUpdate();
 };
@@ -1,9 +1,9 @@
 #pragma once
 
-#include <unordered_map>
 #include <functional>
 #include <vector>
 #include <algorithm>
+#include <cstdint>
 #include "hash.h"
 
 /*!
@@ -21,11 +21,18 @@ public:
     Looks up a value. Will insert the value if it doesn't already exist.
     Returns the new index. */
   int lookup(const T &val) {
-    typename std::unordered_map<T, int>::const_iterator iter = this->map.find(val);
-    if (iter != this->map.end()) return iter->second;
-    else {
-      this->map.insert(std::make_pair(val, this->map.size()));
-      return this->map.size() - 1;
+    // The elements are kept in order in a flat array, and found through an
+    // open-addressing table of indices into it, kept at most half full
+    if (2 * (this->vec.size() + 1) > this->slots.size()) grow();
+    const std::size_t mask = this->slots.size() - 1;
+    for (std::size_t slot = slotOf(val, mask);; slot = (slot + 1) & mask) {
+      const int idx = this->slots[slot];
+      if (idx < 0) {
+        this->slots[slot] = int(this->vec.size());
+        this->vec.push_back(val);
+        return int(this->vec.size()) - 1;
+      }
+      if (this->vec[idx] == val) return idx;
     }
   }
 
@@ -33,31 +40,40 @@ public:
     Returns the current size of the new element array
   */
   std::size_t size() const {
-    return this->map.size();
+    return this->vec.size();
   }
 
   /*!
     Return the new element array.
   */
   const T *getArray() {
-    this->vec.resize(this->map.size());
-    typename std::unordered_map<T, int>::const_iterator iter = this->map.begin();
-    while (iter != this->map.end()) {
-      this->vec[iter->second] = iter->first;
-      iter++;
-    }
-    return &this->vec[0];
+    return this->vec.data();
   }
 
   /*!
     Copies the internal vector to the given destination
   */
   template <class OutputIterator> void copy(OutputIterator dest) {
-    this->getArray();
     std::copy(this->vec.begin(), this->vec.end(), dest);
   }
 
 private:
-  std::unordered_map<T, int> map;
+  static std::size_t slotOf(const T &val, std::size_t mask) {
+    // Mix the bits, since the table is indexed by the lowest ones
+    uint64_t h = uint64_t(std::hash<T>()(val)) * 0x9E3779B97F4A7C15ULL;
+    return std::size_t(h ^ (h >> 32)) & mask;
+  }
+
+  void grow() {
+    this->slots.assign(this->slots.empty() ? 16 : 2 * this->slots.size(), -1);
+    const std::size_t mask = this->slots.size() - 1;
+    for (std::size_t i = 0; i < this->vec.size(); i++) {
+      std::size_t slot = slotOf(this->vec[i], mask);
+      while (this->slots[slot] >= 0) slot = (slot + 1) & mask;
+      this->slots[slot] = int(i);
+    }
+  }
+
   std::vector<T> vec;
+  std::vector<int> slots; // Indices into vec, -1 if empty
 };
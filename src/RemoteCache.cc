@@ -0,0 +1,181 @@
+#include "RemoteCache.h"
+#include "printutils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <boost/algorithm/string.hpp>
+
+#ifndef _WIN32
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/*!
+	Sets the base URL of the tier, e.g. "http://cache.example.com:8080/openscad/".
+	Only plain HTTP is supported. An empty URL disables the tier.
+*/
+bool RemoteCache::setURL(const std::string &url)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->host.clear();
+	this->failed = false;
+	if (url.empty()) return true;
+#ifdef _WIN32
+	PRINT("WARNING: The remote cache is not supported on this platform");
+	return false;
+#else
+	if (!boost::starts_with(url, "http://")) {
+		PRINTB("WARNING: Remote cache URL '%s' doesn't start with http://, disabling remote cache", url);
+		return false;
+	}
+	const std::string rest = url.substr(7);
+	const size_t slash = rest.find('/');
+	const std::string hostport = rest.substr(0, slash);
+	this->path = slash == std::string::npos ? "/" : rest.substr(slash);
+	if (!boost::ends_with(this->path, "/")) this->path += "/";
+	const size_t colon = hostport.find(':');
+	this->port = colon == std::string::npos ? 80 : atoi(hostport.c_str() + colon + 1);
+	this->host = hostport.substr(0, colon);
+	if (this->host.empty() || this->port <= 0) {
+		PRINTB("WARNING: Invalid remote cache URL '%s', disabling remote cache", url);
+		this->host.clear();
+		return false;
+	}
+	return true;
+#endif
+}
+
+std::string RemoteCache::url() const
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	if (this->host.empty()) return "";
+	return "http://" + this->host + ":" + std::to_string(this->port) + this->path;
+}
+
+/*!
+	Fetches the object \a name. Returns false if it doesn't exist or the
+	server can't be reached.
+*/
+bool RemoteCache::get(const std::string &name, std::string &data)
+{
+	if (!isEnabled()) return false;
+	const int status = request("GET", name, "", data);
+	if (status == 200) return true;
+	if (status > 0 && status != 404) PRINTDB("Remote cache GET %s: status %d", name % status);
+	return false;
+}
+
+/*!
+	Stores \a data as the object \a name, replacing any earlier version.
+*/
+bool RemoteCache::put(const std::string &name, const std::string &data)
+{
+	if (!isEnabled()) return false;
+	std::string response;
+	const int status = request("PUT", name, data, response);
+	if (status >= 200 && status < 300) return true;
+	if (status > 0) PRINTDB("Remote cache PUT %s: status %d", name % status);
+	return false;
+}
+
+void RemoteCache::fail(const std::string &what)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	if (this->failed) return;
+	this->failed = true;
+	PRINTB("WARNING: Remote cache at %s failed: %s, disabling remote cache", this->host % what);
+}
+
+/*!
+	Sends an HTTP/1.0 request and returns the status code, or -1 if the
+	server can't be reached. The body of the answer goes to \a response.
+*/
+int RemoteCache::request(const std::string &method, const std::string &name, const std::string &body, std::string &response)
+{
+#ifdef _WIN32
+	return -1;
+#else
+	std::string host, path;
+	int port, timeout;
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		host = this->host;
+		path = this->path;
+		port = this->port;
+		timeout = this->timeout;
+	}
+
+	struct addrinfo hints, *addresses;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0) {
+		fail("can't resolve host");
+		return -1;
+	}
+	int fd = -1;
+	struct timeval tv;
+	tv.tv_sec = timeout;
+	tv.tv_usec = 0;
+	for (struct addrinfo *a = addresses; a && fd < 0; a = a->ai_next) {
+		fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+		if (fd < 0) continue;
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		if (connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(addresses);
+	if (fd < 0) {
+		fail("can't connect");
+		return -1;
+	}
+
+	std::string header = method + " " + path + name + " HTTP/1.0\r\n"
+		"Host: " + host + "\r\n"
+		"Connection: close\r\n";
+	if (method == "PUT") {
+		header += "Content-Type: application/octet-stream\r\n"
+			"Content-Length: " + std::to_string(body.size()) + "\r\n";
+	}
+	const std::string message = header + "\r\n" + body;
+	for (size_t sent = 0; sent < message.size(); ) {
+		const ssize_t n = send(fd, message.data() + sent, message.size() - sent, MSG_NOSIGNAL);
+		if (n <= 0) {
+			close(fd);
+			fail("can't send request");
+			return -1;
+		}
+		sent += n;
+	}
+
+	std::string answer;
+	char buffer[65536];
+	ssize_t n;
+	while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) answer.append(buffer, n);
+	close(fd);
+	if (n < 0) {
+		fail("no answer");
+		return -1;
+	}
+
+	// "HTTP/1.x 200 OK", headers, an empty line and the body
+	const size_t end = answer.find("\r\n\r\n");
+	if (!boost::starts_with(answer, "HTTP/") || end == std::string::npos) {
+		fail("invalid answer");
+		return -1;
+	}
+	const size_t space = answer.find(' ');
+	const int status = space < end ? atoi(answer.c_str() + space + 1) : -1;
+	response = answer.substr(end + 4);
+	return status;
+#endif
+}
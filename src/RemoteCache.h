@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <mutex>
+
+/*!
+	Remote tier behind PersistentCache, shared by several machines.
+
+	Entries are stored on an HTTP server which supports GET and PUT, like
+	a WebDAV share, nginx with the dav module or an object store gateway.
+	Each entry is the object with the name of its cache file below the base
+	URL, holding the same data as the file, so the full key is verified on
+	read like for local entries.
+
+	After a connection failure, the tier is disabled for the rest of the
+	run rather than slowing down every lookup. All methods are thread-safe.
+*/
+class RemoteCache
+{
+public:
+	RemoteCache() : port(0), failed(false), timeout(10) {}
+
+	bool setURL(const std::string &url);
+	std::string url() const;
+	bool isEnabled() const { std::lock_guard<std::mutex> lock(this->mutex); return !this->host.empty() && !this->failed; }
+
+	bool get(const std::string &name, std::string &data);
+	bool put(const std::string &name, const std::string &data);
+
+private:
+	int request(const std::string &method, const std::string &name, const std::string &body, std::string &response);
+	void fail(const std::string &what);
+
+	std::string host;
+	int port;
+	std::string path;
+	bool failed;
+	int timeout; // seconds
+	mutable std::mutex mutex;
+};
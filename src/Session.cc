@@ -0,0 +1,113 @@
+#include "Session.h"
+#include "ModuleCache.h"
+#include "FunctionCache.h"
+#include "openscad.h"
+
+#include <boost/algorithm/string/predicate.hpp>
+
+static thread_local Session *current_session = NULL;
+
+/*!
+	Messages are passed to \a outputhandler, one at a time, or are output
+	like those of threads without a session if it's NULL.
+*/
+Session::Session(OutputHandlerFunc *outputhandler, void *userdata)
+	: modulecache(new ModuleCache), functioncache(new FunctionCache),
+		outputhandler(outputhandler), outputhandler_data(userdata),
+		lastmessages(5), hascommands(false), nodeindex(1)
+{
+}
+
+Session::~Session()
+{
+	delete this->modulecache;
+	delete this->functioncache;
+}
+
+Session *Session::current()
+{
+	return current_session;
+}
+
+void Session::output(const std::string &msg, void *userdata)
+{
+	Session *session = static_cast<Session *>(userdata);
+	// Tasks of the session may print from several threads
+	std::lock_guard<std::mutex> lock(session->outputmutex);
+	if (boost::starts_with(msg, "WARNING") || boost::starts_with(msg, "ERROR")) {
+		// Like the process-wide output, after 5 equal consecutive messages
+		size_t i;
+		for (i = 0; i < session->lastmessages.size(); i++) {
+			if (session->lastmessages[i] != msg) break;
+		}
+		if (i == 5) return;
+		session->lastmessages.push_back(msg);
+	}
+	if (session->outputhandler) session->outputhandler(msg, session->outputhandler_data);
+}
+
+/*!
+	Replaces the output handler, e.g. to write the messages to a file for a
+	while. Only takes effect for threads on which the session became current
+	with a handler.
+*/
+void Session::setOutputHandler(OutputHandlerFunc *outputhandler, void *userdata)
+{
+	std::lock_guard<std::mutex> lock(this->outputmutex);
+	this->outputhandler = outputhandler;
+	this->outputhandler_data = userdata;
+}
+
+/*!
+	Sets the assignments appended to the documents and libraries parsed in
+	the session, instead of the global commandline_commands.
+*/
+void Session::setCommands(const std::string &commands)
+{
+	this->commands = commands;
+	this->hascommands = true;
+}
+
+const std::string &Session::commandlineCommands()
+{
+	if (current_session && current_session->hascommands) return current_session->commands;
+	return commandline_commands;
+}
+
+/*!
+	Sets the directory the session works in, which relative file names in
+	its output are given against. The process's working directory stays
+	as it is.
+*/
+void Session::setDirectory(const std::string &directory)
+{
+	this->directory = directory;
+}
+
+/*!
+	Returns the working directory of the current session, or of the
+	process if there is none.
+*/
+std::string Session::currentDirectory()
+{
+	if (current_session && !current_session->directory.empty()) return current_session->directory;
+	return boost::filesystem::current_path().string();
+}
+
+/*!
+	Makes \a session current on this thread while the Scope exists. NULL
+	makes no session current.
+*/
+Session::Scope::Scope(Session *session) : previous(current_session)
+{
+	current_session = session;
+	if (session && session->outputhandler) set_thread_output_handler(&Session::output, session);
+	else set_thread_output_handler(NULL, NULL);
+}
+
+Session::Scope::~Scope()
+{
+	current_session = this->previous;
+	if (this->previous && this->previous->outputhandler) set_thread_output_handler(&Session::output, this->previous);
+	else set_thread_output_handler(NULL, NULL);
+}
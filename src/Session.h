@@ -0,0 +1,75 @@
+#pragma once
+
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <boost/circular_buffer.hpp>
+#include "printutils.h"
+
+/*!
+	The state of evaluating one document, so one process can evaluate
+	independent documents concurrently on different threads.
+
+	While a session is current on a thread, see Session::Scope,
+	ModuleCache::instance() and FunctionCache::instance() return the
+	session's caches, and the thread's messages go to the session's output
+	handler. Tasks queued on the ThreadPool run in the session which
+	queued them.
+
+	Builtins are registered once at startup and only read afterwards, and
+	the geometry caches are keyed by content, so those stay shared. The
+	parser isn't reentrant, so sessions take turns parsing.
+
+	A session may also have its own command line assignments, working
+	directory and node indices, so documents don't have to change the
+	process-wide ones.
+*/
+class Session
+{
+public:
+	Session(OutputHandlerFunc *outputhandler = NULL, void *userdata = NULL);
+	~Session();
+
+	class ModuleCache &moduleCache() { return *this->modulecache; }
+	class FunctionCache &functionCache() { return *this->functioncache; }
+
+	static Session *current();
+
+	OutputHandlerFunc *outputHandler() const { return this->outputhandler; }
+	void *outputHandlerData() const { return this->outputhandler_data; }
+	void setOutputHandler(OutputHandlerFunc *outputhandler, void *userdata);
+
+	void setCommands(const std::string &commands);
+	static const std::string &commandlineCommands();
+	void setDirectory(const std::string &directory);
+	static std::string currentDirectory();
+
+	size_t nextNodeIndex() { return this->nodeindex++; }
+	void resetNodeIndex() { this->nodeindex = 1; }
+
+	class Scope
+	{
+	public:
+		Scope(Session *session);
+		~Scope();
+	private:
+		Session *previous;
+	};
+
+private:
+	Session(const Session &);
+	Session &operator=(const Session &);
+
+	static void output(const std::string &msg, void *userdata);
+
+	class ModuleCache *modulecache;
+	class FunctionCache *functioncache;
+	OutputHandlerFunc *outputhandler;
+	void *outputhandler_data;
+	std::mutex outputmutex;
+	boost::circular_buffer<std::string> lastmessages;
+	bool hascommands;
+	std::string commands;
+	std::string directory;
+	std::atomic<size_t> nodeindex;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+
+/*!
+	The layout of meshes exported to POSIX shared memory, e.g. by a server
+	job with "-o part.shm", so other processes can map them instead of
+	reading a file. It's plain C, so consumers can include this header.
+
+	The shared memory object is named after the output file, e.g.
+	"/part.shm". It starts with a SharedMeshHeader, followed by the arrays
+	at the offsets given in it, in the byte order of the machine:
+
+	- vertices: numvertices * 3 floats, the unique vertices of the mesh
+	- indices: numtriangles * 3 uint32_t, the vertices of each triangle,
+	  counterclockwise seen from outside
+	- normals: numtriangles * 3 floats, the unit normal of each triangle
+
+	Handshake: each export replaces the object by a new one, which is
+	created with state SHAREDMESH_WRITING and set to SHAREDMESH_READY,
+	with a release store, once it's complete. A consumer opens and maps
+	the object, checks the magic and version, and reads the mesh once the
+	state is SHAREDMESH_READY, e.g. after the server has answered the job.
+	Mappings of a replaced object stay valid. A consumer that's done may
+	set the state to SHAREDMESH_CONSUMED and shm_unlink() the object to
+	free its memory; the generation tells exports of one process apart.
+*/
+
+#define SHAREDMESH_MAGIC "SCADMESH"
+#define SHAREDMESH_VERSION 1
+
+enum SharedMeshState {
+	SHAREDMESH_WRITING = 0,
+	SHAREDMESH_READY = 1,
+	SHAREDMESH_CONSUMED = 2
+};
+
+struct SharedMeshHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t state; // A SharedMeshState
+	uint64_t generation; // Counts the exports of the process
+	uint32_t pid; // Of the process which wrote it
+	uint32_t reserved;
+	uint64_t numvertices;
+	uint64_t numtriangles;
+	// Offsets in bytes from the start of the header
+	uint64_t vertexoffset;
+	uint64_t indexoffset;
+	uint64_t normaloffset;
+	float bbox[6]; // Minimum and maximum x, y, z
+	uint64_t size; // Of the whole object
+};
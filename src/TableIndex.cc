@@ -0,0 +1,218 @@
+#include "TableIndex.h"
+#include "cache.h"
+
+#include <mutex>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+// Tables with fewer rows are scanned
+static const size_t MIN_INDEXED_ROWS = 256;
+
+/*!
+	Returns a hash of \a value consistent with Value::operator==.
+*/
+static size_t hash_value(const Value &value)
+{
+	size_t h = size_t(value.type());
+	switch (value.type()) {
+	case Value::BOOL:
+		return h * 31 + value.toBool();
+	case Value::NUMBER: {
+		const double d = value.toDouble();
+		return h * 31 + std::hash<double>()(d == 0 ? 0 : d); // 0 == -0
+	}
+	case Value::STRING:
+		return h * 31 + std::hash<std::string>()(value.toString());
+	case Value::VECTOR:
+		for(const auto &v : value.toVector()) h = h * 31 + hash_value(*v);
+		return h;
+	case Value::RANGE: {
+		RangeType range = value.toRange();
+		h = h * 31 + std::hash<double>()(range.begin_value());
+		h = h * 31 + std::hash<double>()(range.step_value());
+		return h * 31 + std::hash<double>()(range.end_value());
+	}
+	default:
+		return h;
+	}
+}
+
+/*!
+	Indexes each row under the values search() compares to: the element in
+	\a column, and for column 0 also the row itself.
+*/
+SearchIndex::SearchIndex(const Value::VectorType &table, unsigned int column) : column(column)
+{
+	for (size_t j = 0; j < table.size(); j++) {
+		const ValuePtr &row = table[j];
+		const Value::VectorType &vec = row->toVector();
+		const bool incolumn = column < vec.size();
+		const size_t h = incolumn ? hash_value(*vec[column]) : 0;
+		if (incolumn) this->rows[h].push_back(j);
+		if (column == 0) {
+			const size_t hrow = hash_value(*row);
+			if (!incolumn || hrow != h) this->rows[hrow].push_back(j);
+		}
+	}
+}
+
+/*!
+	Appends the numbers of up to \a num_returns_per_match (0 for all) rows
+	of \a table matching \a value to \a matches, like a scan would.
+*/
+void SearchIndex::find(const Value::VectorType &table, const ValuePtr &value,
+											 unsigned int num_returns_per_match, Value::VectorType &matches) const
+{
+	auto it = this->rows.find(hash_value(*value));
+	if (it == this->rows.end()) return;
+
+	unsigned int matchCount = 0;
+	for(const auto j : it->second) {
+		const ValuePtr &search_element = table[j];
+		if ((this->column == 0 && value == search_element) ||
+				(this->column < search_element->toVector().size() &&
+				 value == search_element->toVector()[this->column])) {
+			matches.push_back(ValuePtr(double(j)));
+			matchCount++;
+			if (num_returns_per_match != 0 && matchCount >= num_returns_per_match) break;
+		}
+	}
+}
+
+size_t SearchIndex::memsize() const
+{
+	size_t mem = sizeof(SearchIndex);
+	for(const auto &bucket : this->rows) {
+		mem += sizeof(bucket) + bucket.second.size() * sizeof(size_t);
+	}
+	return mem;
+}
+
+/*!
+	Takes the rows lookup() uses: [key, value] pairs of numbers. The table
+	must have a valid first row.
+*/
+LookupIndex::LookupIndex(const Value::VectorType &table) : valid(true)
+{
+	this->entries.reserve(table.size());
+	for (size_t i = 0; i < table.size(); i++) {
+		Entry entry = { 0, i, 0 };
+		if (table[i]->getVec2(entry.key, entry.value)) {
+			if (std::isnan(entry.key)) this->valid = false;
+			this->entries.push_back(entry);
+		}
+	}
+	if (this->entries.empty() || this->entries[0].row != 0) this->valid = false;
+	else this->first = this->entries[0];
+	std::sort(this->entries.begin(), this->entries.end());
+}
+
+/*!
+	Interpolates like the linear scan in builtin_lookup(): between the
+	first row with the largest key <= \a p and the first row with the
+	smallest key >= \a p, both defaulting to the first row.
+*/
+bool LookupIndex::lookup(double p, double &result) const
+{
+	if (!this->valid || std::isnan(p)) return false;
+
+	const Entry probe = { p, 0, 0 };
+	auto high = std::lower_bound(this->entries.begin(), this->entries.end(), probe);
+	auto upper = std::upper_bound(this->entries.begin(), this->entries.end(), p,
+		[](double p, const Entry &e) { return p < e.key; });
+
+	Entry low_e = this->first;
+	if (upper != this->entries.begin()) {
+		const Entry lowkey = { (upper - 1)->key, 0, 0 };
+		low_e = *std::lower_bound(this->entries.begin(), upper, lowkey);
+	}
+	const Entry high_e = (high != this->entries.end()) ? *high : this->first;
+
+	if (p <= low_e.key) result = high_e.value;
+	else if (p >= high_e.key) result = low_e.value;
+	else {
+		double f = (p-low_e.key) / (high_e.key-low_e.key);
+		result = high_e.value * f + low_e.value * (1-f);
+	}
+	return true;
+}
+
+namespace {
+	/*!
+		An index, or just a note that the table has been queried once.
+	*/
+	template <class Index> struct IndexEntry {
+		std::weak_ptr<const Value> table;
+		shared_ptr<const Index> index;
+	};
+
+	std::mutex index_mutex;
+	Cache<std::string, IndexEntry<SearchIndex>> search_indexes(16*1024*1024);
+	Cache<std::string, IndexEntry<LookupIndex>> lookup_indexes(16*1024*1024);
+
+	template <class Index, class Builder>
+	shared_ptr<const Index> get_index(Cache<std::string, IndexEntry<Index>> &cache,
+																		const ValuePtr &table, const std::string &key, const Builder &build)
+	{
+		if (table->toVector().size() < MIN_INDEXED_ROWS) return shared_ptr<const Index>();
+
+		{
+			std::lock_guard<std::mutex> lock(index_mutex);
+			IndexEntry<Index> *entry = cache.object(key);
+			// A different table may have been allocated at the same address
+			if (!entry || entry->table.lock().get() != table.get()) {
+				IndexEntry<Index> *seen = new IndexEntry<Index>;
+				seen->table = table;
+				cache.insert(key, seen, int(sizeof(IndexEntry<Index>)));
+				return shared_ptr<const Index>();
+			}
+			if (entry->index) return entry->index;
+		}
+
+		shared_ptr<const Index> index(build());
+		std::lock_guard<std::mutex> lock(index_mutex);
+		IndexEntry<Index> *entry = new IndexEntry<Index>;
+		entry->table = table;
+		entry->index = index;
+		cache.insert(key, entry, int(index->memsize()));
+		return index;
+	}
+
+	std::string table_key(const ValuePtr &table, unsigned int column)
+	{
+		const Value *ptr = table.get();
+		std::string key(reinterpret_cast<const char *>(&ptr), sizeof(ptr));
+		key.append(reinterpret_cast<const char *>(&column), sizeof(column));
+		return key;
+	}
+}
+
+/*!
+	Returns the index of \a table by \a column, or NULL if it should be
+	scanned.
+*/
+shared_ptr<const SearchIndex> TableIndex::search(const ValuePtr &table, unsigned int column)
+{
+	return get_index(search_indexes, table, table_key(table, column),
+		[&table, column]() { return new SearchIndex(table->toVector(), column); });
+}
+
+/*!
+	Returns the index of the lookup() table \a table, or NULL if it should
+	be scanned.
+*/
+shared_ptr<const LookupIndex> TableIndex::lookup(const ValuePtr &table)
+{
+	shared_ptr<const LookupIndex> index = get_index(lookup_indexes, table, table_key(table, 0),
+		[&table]() { return new LookupIndex(table->toVector()); });
+	if (index && !index->isValid()) return shared_ptr<const LookupIndex>();
+	return index;
+}
+
+void TableIndex::clear()
+{
+	std::lock_guard<std::mutex> lock(index_mutex);
+	search_indexes.clear();
+	lookup_indexes.clear();
+}
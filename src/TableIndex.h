@@ -0,0 +1,67 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include "value.h"
+#include "memory.h"
+
+/*!
+	Index of the rows of a search() table by their value in one column, so
+	repeated searches of a large table don't scan all its rows.
+*/
+class SearchIndex
+{
+public:
+	SearchIndex(const Value::VectorType &table, unsigned int column);
+
+	void find(const Value::VectorType &table, const ValuePtr &value,
+						unsigned int num_returns_per_match, Value::VectorType &matches) const;
+	size_t memsize() const;
+
+private:
+	unsigned int column;
+	// Row numbers in ascending order, by hash of the matching value
+	std::unordered_map<size_t, std::vector<size_t>> rows;
+};
+
+/*!
+	The [key, value] rows of a lookup() table, sorted by key.
+*/
+class LookupIndex
+{
+public:
+	LookupIndex(const Value::VectorType &table);
+
+	bool lookup(double p, double &result) const;
+	size_t memsize() const { return this->entries.size() * sizeof(Entry); }
+	// False if the table has NaN keys, which lookup() can't order
+	bool isValid() const { return this->valid; }
+
+private:
+	struct Entry {
+		double key;
+		size_t row;
+		double value;
+		bool operator<(const Entry &other) const {
+			return this->key < other.key || (this->key == other.key && this->row < other.row);
+		}
+	};
+	Entry first;
+	std::vector<Entry> entries;
+	bool valid;
+};
+
+/*!
+	Cache of the indexes of tables passed to search() and lookup(), keyed
+	by the identity of the table value. Values are immutable, so an index
+	stays valid as long as its table exists. Only large tables are indexed,
+	and only once they are queried a second time, since many tables are
+	built just to be searched once.
+*/
+class TableIndex
+{
+public:
+	static shared_ptr<const SearchIndex> search(const ValuePtr &table, unsigned int column);
+	static shared_ptr<const LookupIndex> lookup(const ValuePtr &table);
+	static void clear();
+};
@@ -0,0 +1,232 @@
+#include "ThreadPool.h"
+#include "Session.h"
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+static std::atomic<unsigned int> default_size(0);
+static std::atomic<bool> instance_created(false);
+
+ThreadPool *ThreadPool::instance()
+{
+	static ThreadPool *inst = []() {
+		instance_created = true;
+		return new ThreadPool(default_size);
+	}();
+	return inst;
+}
+
+/*!
+	Sets the number of threads of instance(), 0 for one per available
+	core. Returns false if the pool is already running, and then has no
+	effect.
+*/
+bool ThreadPool::setDefaultSize(unsigned int numthreads)
+{
+	if (instance_created) return false;
+	default_size = numthreads;
+	return true;
+}
+
+/*!
+	Returns the number of cores the process may use: those of its CPU
+	affinity mask, e.g. set by taskset or a cpuset, and at most its cgroup
+	CPU quota, rounded up.
+*/
+unsigned int ThreadPool::availableCores()
+{
+	unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) {
+		cores = CPU_COUNT(&set);
+	}
+	std::ifstream cpumax("/sys/fs/cgroup/cpu.max");
+	std::string quota;
+	long period = 0;
+	if (cpumax >> quota >> period && quota != "max" && period > 0) {
+		const long q = std::atol(quota.c_str());
+		if (q > 0) cores = std::min(cores, unsigned(std::max(1L, (q + period - 1) / period)));
+	}
+#endif
+	return cores;
+}
+
+ThreadPool::ThreadPool(unsigned int numthreads) : next(0), queued(0), stopping(false)
+{
+	if (numthreads == 0) numthreads = availableCores();
+	this->workers.reserve(numthreads);
+	for (unsigned int i=0;i<numthreads;i++) this->queues.push_back(new Queue);
+	for (unsigned int i=0;i<numthreads;i++) {
+		this->workers.push_back(std::thread(&ThreadPool::work, this, int(i)));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(this->idlemutex);
+		this->stopping = true;
+	}
+	this->idle.notify_all();
+	for(auto &worker : this->workers) worker.join();
+	for(auto &queue : this->queues) delete queue;
+}
+
+/*!
+	Queues \a task as part of \a group.
+*/
+void ThreadPool::run(TaskGroup &group, const Task &task)
+{
+	group.pending++;
+	Item item = { &group, task, Session::current(), MemoryAccounting::currentCategory() };
+
+	int self = -1;
+	const std::thread::id id = std::this_thread::get_id();
+	for (size_t i=0;i<this->workers.size();i++) {
+		if (this->workers[i].get_id() == id) self = int(i);
+	}
+	if (self >= 0) {
+		Queue &q = *this->queues[self];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		q.items.push_front(item);
+	}
+	else {
+		Queue &q = *this->queues[this->next++ % this->queues.size()];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		q.items.push_back(item);
+	}
+	this->queued++;
+	{
+		std::lock_guard<std::mutex> lock(this->idlemutex);
+	}
+	this->idle.notify_one();
+}
+
+/*!
+	Waits until all tasks in \a group have finished, running queued tasks
+	in the meantime.
+*/
+void ThreadPool::wait(TaskGroup &group)
+{
+	int self = -1;
+	const std::thread::id id = std::this_thread::get_id();
+	for (size_t i=0;i<this->workers.size();i++) {
+		if (this->workers[i].get_id() == id) self = int(i);
+	}
+
+	while (group.pending > 0) {
+		Item item;
+		if (pop(self, item)) {
+			execute(item);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(this->idlemutex);
+		if (group.pending == 0) break;
+		if (this->queued > 0) continue;
+		this->idle.wait(lock);
+	}
+	rethrow(group);
+}
+
+/*!
+	Waits until all tasks in \a group have finished or \a deadline has
+	passed. Unlike wait(), no other tasks are run meanwhile, as they could
+	take longer. Returns true if the group is done.
+*/
+bool ThreadPool::waitUntil(TaskGroup &group, const std::chrono::steady_clock::time_point &deadline)
+{
+	{
+		std::unique_lock<std::mutex> lock(this->idlemutex);
+		while (group.pending > 0) {
+			if (this->idle.wait_until(lock, deadline) == std::cv_status::timeout) break;
+			// The wakeup may have been meant for an idle worker
+			if (group.pending > 0 && this->queued > 0) this->idle.notify_all();
+		}
+		if (group.pending > 0) return false;
+	}
+	rethrow(group);
+	return true;
+}
+
+// Rethrows the first exception thrown by a task of \a group
+void ThreadPool::rethrow(TaskGroup &group)
+{
+	std::lock_guard<std::mutex> lock(group.mutex);
+	if (group.exception) {
+		std::exception_ptr e = group.exception;
+		group.exception = std::exception_ptr();
+		std::rethrow_exception(e);
+	}
+}
+
+/*!
+	Takes a task from the worker's own queue, or steals one from another
+	queue. \a self is -1 for threads outside the pool.
+*/
+bool ThreadPool::pop(int self, Item &item)
+{
+	if (self >= 0) {
+		Queue &q = *this->queues[self];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		if (!q.items.empty()) {
+			item = q.items.front();
+			q.items.pop_front();
+			this->queued--;
+			return true;
+		}
+	}
+	const size_t n = this->queues.size();
+	for (size_t i=1;i<=n;i++) {
+		Queue &q = *this->queues[(self + i) % n];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		if (!q.items.empty()) {
+			item = q.items.back();
+			q.items.pop_back();
+			this->queued--;
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadPool::execute(Item &item)
+{
+	TaskGroup &group = *item.group;
+	try {
+		Session::Scope scope(item.session);
+		MemoryAccounting::Scope memoryscope(item.memorycategory);
+		item.task();
+	}
+	catch (...) {
+		std::lock_guard<std::mutex> lock(group.mutex);
+		if (!group.exception) group.exception = std::current_exception();
+	}
+	{
+		// Waiters check the group under idlemutex, so this can't be missed
+		std::lock_guard<std::mutex> lock(this->idlemutex);
+		group.pending--;
+	}
+	this->idle.notify_all();
+}
+
+void ThreadPool::work(int self)
+{
+	while (true) {
+		Item item;
+		if (pop(self, item)) {
+			execute(item);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(this->idlemutex);
+		if (this->stopping) return;
+		if (this->queued > 0) continue;
+		this->idle.wait(lock);
+	}
+}
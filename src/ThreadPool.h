@@ -0,0 +1,87 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include "MemoryAccounting.h"
+
+/*!
+	Work-stealing thread pool.
+
+	Each worker has its own task queue. Tasks submitted from a worker go to
+	the front of that worker's queue and are run depth-first by it; idle
+	workers steal from the back of other queues. Tasks submitted from other
+	threads are distributed round-robin. Tasks run in the Session current
+	when they were submitted, and their allocations are accounted like
+	those of the submitting thread.
+
+	Tasks are grouped in a TaskGroup. wait() runs queued tasks while the
+	group is incomplete, so tasks may wait for nested groups without
+	exhausting the pool. The first exception thrown by a task of a group is
+	rethrown by wait().
+
+	instance() is the pool shared by all parallel work of the process. Its
+	size is set with --threads or in the preferences, and defaults to the
+	cores the process may use, so jobs confined to a set of cores or a CPU
+	quota don't start more threads than they have cores.
+*/
+class ThreadPool
+{
+public:
+	typedef std::function<void()> Task;
+
+	class TaskGroup
+	{
+	public:
+		TaskGroup() : pending(0) {}
+		bool isDone() const { return this->pending == 0; }
+	private:
+		friend class ThreadPool;
+		std::atomic<int> pending;
+		std::mutex mutex;
+		std::exception_ptr exception;
+	};
+
+	explicit ThreadPool(unsigned int numthreads = 0);
+	~ThreadPool();
+
+	static ThreadPool *instance();
+	static bool setDefaultSize(unsigned int numthreads);
+	static unsigned int availableCores();
+
+	unsigned int size() const { return this->workers.size(); }
+	void run(TaskGroup &group, const Task &task);
+	void wait(TaskGroup &group);
+	bool waitUntil(TaskGroup &group, const std::chrono::steady_clock::time_point &deadline);
+
+private:
+	struct Item {
+		TaskGroup *group;
+		Task task;
+		class Session *session;
+		MemoryAccounting::Category memorycategory;
+	};
+	struct Queue {
+		std::mutex mutex;
+		std::deque<Item> items;
+	};
+
+	bool pop(int self, Item &item);
+	void rethrow(TaskGroup &group);
+	void execute(Item &item);
+	void work(int self);
+
+	std::vector<std::thread> workers;
+	std::vector<Queue *> queues;
+	std::atomic<unsigned int> next;
+	std::atomic<int> queued;
+	std::mutex idlemutex;
+	std::condition_variable idle;
+	bool stopping;
+};
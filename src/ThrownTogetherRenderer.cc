@@ -55,10 +55,11 @@ void ThrownTogetherRenderer::draw(bool /*showfaces*/, bool showedges) const
 	 	renderCSGProducts(*this->highlight_products, true, false, showedges, false);
 }
 
-void ThrownTogetherRenderer::renderChainObject(const CSGChainObject &csgobj, bool highlight_mode,
+void ThrownTogetherRenderer::renderChainObject(const CSGChainObject &csgobj, const ViewFrustum &frustum, bool highlight_mode,
 																							 bool background_mode, bool showedges, bool fberror, OpenSCADOperator type) const
 {
 	if (this->geomVisitMark[std::make_pair(csgobj.leaf->geom.get(), &csgobj.leaf->matrix)]++ > 0) return;
+	if (!frustum.isVisible(getRenderedBoundingBox(csgobj.leaf->geom, csgobj.leaf->matrix))) return;
 	const Color4f &c = csgobj.leaf->color;
 	csgmode_e csgmode = csgmode_e(
 		(highlight_mode ? 
@@ -121,12 +122,13 @@ void ThrownTogetherRenderer::renderCSGProducts(const CSGProducts &products, bool
 	glDepthFunc(GL_LEQUAL);
 	this->geomVisitMark.clear();
 
+	const ViewFrustum frustum;
 	for(const auto &product : products.products) {
 		for(const auto &csgobj : product.intersections) {
-			renderChainObject(csgobj, highlight_mode, background_mode, showedges, fberror, OPENSCAD_INTERSECTION);
+			renderChainObject(csgobj, frustum, highlight_mode, background_mode, showedges, fberror, OPENSCAD_INTERSECTION);
 		}
 		for(const auto &csgobj : product.subtractions) {
-			renderChainObject(csgobj, highlight_mode, background_mode, showedges, fberror, OPENSCAD_DIFFERENCE);
+			renderChainObject(csgobj, frustum, highlight_mode, background_mode, showedges, fberror, OPENSCAD_DIFFERENCE);
 		}
 	}
 }
@@ -16,7 +16,7 @@ public:
 private:
 	void renderCSGProducts(const CSGProducts &products, bool highlight_mode, bool background_mode, bool showedges, 
 											bool fberror) const;
-	void renderChainObject(const class CSGChainObject &csgobj, bool highlight_mode,
+	void renderChainObject(const class CSGChainObject &csgobj, const ViewFrustum &frustum, bool highlight_mode,
 												 bool background_mode, bool showedges, bool fberror, OpenSCADOperator type) const;
 
 	shared_ptr<CSGProducts> root_products;
@@ -0,0 +1,202 @@
+#include "Timing.h"
+#include "node.h"
+#include "ModuleInstantiation.h"
+#include "PlatformUtils.h"
+#include "GeometryCache.h"
+#include "PerfCounters.h"
+#include "OperationCounters.h"
+#include "feature.h"
+#include "printutils.h"
+
+#include <algorithm>
+#include <ostream>
+#include <boost/format.hpp>
+
+// Most nodes kept by addNode(), which bounds the count given to print()
+static const size_t MAX_NODES = 100;
+
+static bool slower(const Timing::NodeTime &a, const Timing::NodeTime &b)
+{
+	return a.exclusive > b.exclusive;
+}
+
+static std::string json_string(const std::string &s)
+{
+	std::string result = "\"";
+	for(const auto c : s) {
+		if (c == '"' || c == '\\') result += '\\';
+		result += c;
+	}
+	return result + "\"";
+}
+
+/*!
+	Starts the phase \a name, which ends when the Phase is destroyed.
+*/
+Timing::Phase::Phase(const char *name) : active(Timing::instance()->isEnabled()), index(0)
+{
+	if (!this->active) return;
+	Timing *timing = Timing::instance();
+	{
+		std::lock_guard<std::mutex> lock(timing->mutex);
+		this->index = timing->phases.size();
+		Record record;
+		record.name = name;
+		record.wall = 0;
+		record.cpu = 0;
+		record.peakmemory = 0;
+		record.cachebytes = 0;
+		std::fill(record.categorypeaks, record.categorypeaks + MemoryAccounting::NUM_CATEGORIES, 0);
+		timing->phases.push_back(record);
+	}
+	MemoryAccounting::resetPeaks();
+	this->cpustart = std::clock();
+	this->start = Clock::now();
+}
+
+Timing::Phase::~Phase()
+{
+	if (!this->active) return;
+	const double wall = std::chrono::duration<double>(Clock::now() - this->start).count();
+	// The CPU time of all threads of the process
+	const double cpu = double(std::clock() - this->cpustart) / CLOCKS_PER_SEC;
+	Timing *timing = Timing::instance();
+	std::lock_guard<std::mutex> lock(timing->mutex);
+	Record &record = timing->phases[this->index];
+	record.wall = wall;
+	record.cpu = cpu;
+	record.peakmemory = PlatformUtils::peakMemoryUsage();
+	record.cachebytes = GeometryCache::instance()->stats().cost;
+	for (int i = 0; i < MemoryAccounting::NUM_CATEGORIES; i++) {
+		record.categorypeaks[i] = MemoryAccounting::peakBytes(MemoryAccounting::Category(i));
+	}
+}
+
+/*!
+	Adds \a n objects of the kind \a what, e.g. "nodes", to the phase.
+*/
+void Timing::Phase::count(const char *what, size_t n)
+{
+	if (!this->active) return;
+	Timing *timing = Timing::instance();
+	std::lock_guard<std::mutex> lock(timing->mutex);
+	timing->phases[this->index].counts.push_back(std::make_pair(std::string(what), n));
+}
+
+/*!
+	Records the geometry evaluation of \a node, which took \a seconds
+	including \a childseconds for its children. Only the slowest nodes by
+	exclusive time are kept.
+*/
+void Timing::addNode(const AbstractNode &node, double seconds, double childseconds)
+{
+	NodeTime t;
+	t.inclusive = seconds;
+	t.exclusive = seconds - childseconds;
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+	if (this->nodes.size() == MAX_NODES && t.exclusive <= this->nodes.front().exclusive) return;
+	const int line = node.modinst ? node.modinst->location().firstLine() : 0;
+	t.label = node.name();
+	if (line > 0) t.label += str(boost::format(" (line %d)") % line);
+	// A heap with the fastest kept node on top
+	this->nodes.push_back(t);
+	std::push_heap(this->nodes.begin(), this->nodes.end(), slower);
+	if (this->nodes.size() > MAX_NODES) {
+		std::pop_heap(this->nodes.begin(), this->nodes.end(), slower);
+		this->nodes.pop_back();
+	}
+}
+
+std::vector<Timing::NodeTime> Timing::slowestNodes(size_t count) const
+{
+	std::vector<NodeTime> sorted(this->nodes);
+	std::sort(sorted.begin(), sorted.end(), slower);
+	if (sorted.size() > count) sorted.resize(count);
+	return sorted;
+}
+
+/*!
+	Prints the phases and the \a count slowest geometry nodes.
+*/
+void Timing::print(size_t count) const
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	PRINT("Timing:            wall/s        cpu/s  peak memory  geometry cache");
+	for(const auto &p : this->phases) {
+		std::string counts;
+		for(const auto &c : p.counts) counts += str(boost::format(", %d %s") % c.second % c.first);
+		PRINTB("  %-12s %12.3f %12.3f %12s %15s%s", p.name % p.wall % p.cpu %
+					 PlatformUtils::toMemorySizeString(p.peakmemory, 3) %
+					 PlatformUtils::toMemorySizeString(p.cachebytes, 3) % counts);
+		if (MemoryAccounting::isAvailable()) {
+			std::string peaks;
+			for (int i = 0; i < MemoryAccounting::NUM_CATEGORIES; i++) {
+				if (!p.categorypeaks[i]) continue;
+				peaks += str(boost::format("%s%s %s") % (peaks.empty() ? "" : ", ") %
+										 MemoryAccounting::name(MemoryAccounting::Category(i)) %
+										 PlatformUtils::toMemorySizeString(p.categorypeaks[i], 3));
+			}
+			PRINTB("    peak heap: %s", peaks);
+		}
+	}
+	const std::vector<NodeTime> sorted = slowestNodes(count);
+	if (!sorted.empty()) {
+		PRINT("Slowest nodes: inclusive/s  exclusive/s");
+		for(const auto &n : sorted) {
+			PRINTB("  %12.3f %12.3f  %s", n.inclusive % n.exclusive % n.label);
+		}
+	}
+	OperationCounters::print();
+#ifdef ENABLE_PERF_COUNTERS
+	PerfCounters::print();
+#endif
+}
+
+/*!
+	Writes the phases, the \a count slowest geometry nodes, the operation
+	counts and the enabled experimental features as a JSON object. Times
+	are in seconds and memory in bytes.
+*/
+void Timing::writeJSON(std::ostream &stream, size_t count) const
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	stream << "{\n  \"phases\": [";
+	for (size_t i = 0; i < this->phases.size(); i++) {
+		const Record &p = this->phases[i];
+		stream << (i > 0 ? ",\n" : "\n")
+					 << "    {\n"
+					 << "      \"name\": " << json_string(p.name) << ",\n"
+					 << "      \"wall\": " << p.wall << ",\n"
+					 << "      \"cpu\": " << p.cpu << ",\n"
+					 << "      \"peak_memory\": " << p.peakmemory << ",\n"
+					 << "      \"geometry_cache\": " << p.cachebytes << ",\n";
+		if (MemoryAccounting::isAvailable()) {
+			stream << "      \"peak_heap\": {";
+			for (int i = 0; i < MemoryAccounting::NUM_CATEGORIES; i++) {
+				stream << (i > 0 ? ", " : " ") << json_string(MemoryAccounting::name(MemoryAccounting::Category(i)))
+							 << ": " << p.categorypeaks[i];
+			}
+			stream << " },\n";
+		}
+		stream << "      \"counts\": {";
+		for (size_t j = 0; j < p.counts.size(); j++) {
+			stream << (j > 0 ? ", " : " ") << json_string(p.counts[j].first) << ": " << p.counts[j].second;
+		}
+		stream << (p.counts.empty() ? "}\n" : " }\n") << "    }";
+	}
+	stream << "\n  ],\n  \"slowest_nodes\": [";
+	const std::vector<NodeTime> sorted = slowestNodes(count);
+	for (size_t i = 0; i < sorted.size(); i++) {
+		const NodeTime &n = sorted[i];
+		stream << (i > 0 ? ",\n" : "\n")
+					 << "    { \"node\": " << json_string(n.label)
+					 << ", \"inclusive\": " << n.inclusive
+					 << ", \"exclusive\": " << n.exclusive << " }";
+	}
+	stream << "\n  ],\n  \"operations\": ";
+	OperationCounters::writeJSON(stream, "  ");
+	stream << ",\n  \"features\": ";
+	Feature::writeJSON(stream, "  ");
+	stream << "\n}\n";
+}
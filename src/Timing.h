@@ -0,0 +1,75 @@
+#pragma once
+
+#include <chrono>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <iosfwd>
+#include <stddef.h>
+#include <stdint.h>
+#include "MemoryAccounting.h"
+
+/*!
+	Per-phase costs of a command-line run, enabled with --timing. Each
+	Phase records its wall and CPU time, the peak memory of the process
+	when it ends, the size of the geometry cache and any object counts
+	added to it. Builds with memory accounting also record the peak bytes
+	of each MemoryAccounting category during the phase. The evaluation time
+	of geometry nodes is passed to addNode(), so the slowest ones can be
+	listed.
+
+	print() outputs a summary to the console and writeJSON() the same
+	data for tracking over time.
+*/
+class Timing
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	static Timing *instance() { static Timing *inst = new Timing; return inst; }
+
+	void enable(bool enabled) { this->enabled = enabled; }
+	bool isEnabled() const { return this->enabled; }
+
+	class Phase {
+	public:
+		Phase(const char *name);
+		~Phase();
+		void count(const char *what, size_t n);
+	private:
+		bool active;
+		size_t index;
+		Clock::time_point start;
+		std::clock_t cpustart;
+	};
+
+	struct NodeTime {
+		std::string label;
+		double inclusive;
+		double exclusive;
+	};
+	void addNode(const class AbstractNode &node, double seconds, double childseconds);
+
+	void print(size_t count = 10) const;
+	void writeJSON(std::ostream &stream, size_t count = 10) const;
+
+private:
+	Timing() : enabled(false) {}
+
+	struct Record {
+		std::string name;
+		double wall;
+		double cpu;
+		uint64_t peakmemory;
+		size_t cachebytes;
+		size_t categorypeaks[MemoryAccounting::NUM_CATEGORIES];
+		std::vector<std::pair<std::string, size_t>> counts;
+	};
+	std::vector<NodeTime> slowestNodes(size_t count) const;
+
+	bool enabled;
+	mutable std::mutex mutex;
+	std::vector<Record> phases;
+	std::vector<NodeTime> nodes;
+};
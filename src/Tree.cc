@@ -3,61 +3,69 @@
 #include "printutils.h"
 
 #include <assert.h>
-#include <algorithm>
 #include <sstream>
-#include <boost/regex.hpp>
 
 Tree::~Tree()
 {
-	this->nodecache.clear();
 	this->nodeidcache.clear();
 }
 
 /*!
-	Returns the cached string representation of the subtree rooted by \a node.
-	If node is not cached, the cache will be rebuilt.
+	Writes the text of the subtree rooted by \a node to \a stream as it's
+	dumped. With \a withIds, the id of each node is written in front of it,
+	for CSGLoader.
 */
-const std::string &Tree::getString(const AbstractNode &node) const
+void Tree::dump(std::ostream &stream, const AbstractNode &node, bool withIds) const
 {
-	assert(this->root_node);
-	if (!this->nodecache.contains(node)) {
-		this->nodecache.clear();
-		this->nodeidcache.clear();
-		NodeDumper dumper(this->nodecache, false);
-		dumper.traverse(*this->root_node);
-		assert(this->nodecache.contains(*this->root_node) &&
-					 "NodeDumper failed to create a cache");
-	}
-	return this->nodecache[node];
+	if (withIds) getIdString(node);
+	NodeDumper dumper(stream, false, withIds ? &this->nodeidcache : NULL);
+	dumper.traverse(node);
+}
+
+/*!
+	Returns the string representation of the subtree rooted by \a node.
+*/
+std::string Tree::getString(const AbstractNode &node) const
+{
+	std::stringstream stream;
+	dump(stream, node);
+	return stream.str();
 }
 
 /*!
 	Returns the cached ID string representation of the subtree rooted by \a node.
 	If node is not cached, the cache will be rebuilt.
 
-	The difference between this method and getString() is that the ID string
-	is stripped for whitespace. Especially indentation whitespace is important to
-	strip to enable cache hits for equivalent nodes from different scopes.
+	The ID string is a structural hash of the subtree, used as the key for
+	geometry caches. Subtrees with equal text dumps (ignoring whitespace,
+	e.g. indentation in different scopes) get equal IDs. Use getString()
+	to obtain the full text for debugging.
 */
 const std::string &Tree::getIdString(const AbstractNode &node) const
 {
 	assert(this->root_node);
 
+	// Ids only depend on their subtree, so already cached entries, e.g. from
+	// setIdString(), stay valid and are reused by the dumper.
 	if (!this->nodeidcache.contains(node)) {
-		const std::string &nodestr = getString(node);
-		const boost::regex re("[^\\s\\\"]+|\\\"(?:[^\\\"\\\\]|\\\\.)*\\\"");
-		std::stringstream sstream;
-		boost::sregex_token_iterator i(nodestr.begin(), nodestr.end(), re, 0);
-		std::copy(i, boost::sregex_token_iterator(), std::ostream_iterator<std::string>(sstream));
-
-		const std::string & result = this->nodeidcache.insert(node, sstream.str());
-		PRINTDB("Id Cache MISS: %s", result);
-		return result;
-	} else {
-		const std::string & result = this->nodeidcache[node];
-		PRINTDB("Id Cache HIT:  %s", result);
-		return result;
+		NodeDumper dumper(this->nodeidcache, false, true, this->idsalt);
+		dumper.traverse(*this->root_node);
+		assert(this->nodeidcache.contains(*this->root_node) &&
+					 "NodeDumper failed to create an id cache");
+		PRINTDB("Id Cache MISS: %s", this->nodeidcache[node]);
 	}
+	return this->nodeidcache[node];
+}
+
+/*!
+	Returns the text of the subtree rooted by \a node like getString(), with
+	the id of each node in front of it, for CSGLoader.
+*/
+std::string Tree::getStringWithIds(const AbstractNode &node) const
+{
+	std::stringstream stream;
+	dump(stream, node, true);
+	return stream.str();
 }
 
 /*!
@@ -66,5 +74,5 @@ const std::string &Tree::getIdString(const AbstractNode &node) const
 void Tree::setRoot(const AbstractNode *root)
 {
 	this->root_node = root; 
-	this->nodecache.clear();
+	this->nodeidcache.clear();
 }
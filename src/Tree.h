@@ -1,27 +1,34 @@
 #pragma once
 
+#include <ostream>
 #include "nodecache.h"
 
 /*!  
-	For now, just an abstraction of the node tree which keeps a dump
-	cache based on node indices around.
+	For now, just an abstraction of the node tree which keeps a cache of
+	the ids of its subtrees, based on node indices, around. The text dump
+	isn't cached: it's only needed for .csg export and debugging.
 
 	Note that since node trees don't survive a recompilation, the tree cannot either.
  */
 class Tree
 {
 public:
-	Tree(const AbstractNode *root = NULL) : root_node(root) {}
+	Tree(const AbstractNode *root = NULL, const std::string &idsalt = std::string()) : root_node(root), idsalt(idsalt) {}
 	~Tree();
 
 	void setRoot(const AbstractNode *root);
 	const AbstractNode *root() const { return this->root_node; }
 
-	const std::string &getString(const AbstractNode &node) const;
+	void dump(std::ostream &stream, const AbstractNode &node, bool withIds = false) const;
+	std::string getString(const AbstractNode &node) const;
 	const std::string &getIdString(const AbstractNode &node) const;
+	std::string getStringWithIds(const AbstractNode &node) const;
+	bool hasIdString(const AbstractNode &node) const { return this->nodeidcache.contains(node); }
+	void setIdString(const AbstractNode &node, const std::string &id) { this->nodeidcache.insert(node, id); }
 
 private:
 	const AbstractNode *root_node;
-  mutable NodeCache nodecache;
+	// Mixed into all ids, to keep geometry made differently from the same nodes apart
+	std::string idsalt;
   mutable NodeCache nodeidcache;
 };
@@ -32,10 +32,11 @@
 #include "stackcheck.h"
 #include "modcontext.h"
 #include "expression.h"
+#include "Profiler.h"
 
 #include <sstream>
 
-std::deque<std::string> UserModule::module_stack;
+thread_local std::deque<std::string> UserModule::module_stack;
 
 AbstractNode *UserModule::instantiate(const Context *ctx, const ModuleInstantiation *inst, EvalContext *evalctx) const
 {
@@ -43,16 +44,19 @@ AbstractNode *UserModule::instantiate(const Context *ctx, const ModuleInstantiat
 		throw RecursionException::create("module", inst->name());
 		return NULL;
 	}
+	Profiler::Scope profile("module", inst->name(), this->location().firstLine());
 
 	// At this point we know that nobody will modify the dependencies of the local scope
 	// passed to this instance, so we can populate the context
 	inst->scope.apply(*evalctx);
     
+	static const Identifier children("$children");
+	static const Identifier parent_modules("$parent_modules");
 	ModuleContext c(ctx, evalctx);
 	// set $children first since we might have variables depending on it
-	c.set_variable("$children", ValuePtr(double(inst->scope.children.size())));
+	c.set_variable(children, ValuePtr(double(inst->scope.children.size())));
 	module_stack.push_back(inst->name());
-	c.set_variable("$parent_modules", ValuePtr(double(module_stack.size())));
+	c.set_variable(parent_modules, ValuePtr(double(module_stack.size())));
 	c.initializeModule(*this);
 	// FIXME: Set document path to the path of the module
 #if 0 && DEBUG
@@ -23,5 +23,5 @@ public:
 	LocalScope scope;
 
 private:
-	static std::deque<std::string> module_stack;
+	static thread_local std::deque<std::string> module_stack;
 };
@@ -42,6 +42,7 @@ extern void register_builtin_primitives();
 extern void register_builtin_surface();
 extern void register_builtin_control();
 extern void register_builtin_render();
+extern void register_builtin_simplify();
 extern void register_builtin_import();
 extern void register_builtin_projection();
 extern void register_builtin_cgaladv();
@@ -68,6 +69,7 @@ void Builtins::initialize()
 	register_builtin_surface();
 	register_builtin_control();
 	register_builtin_render();
+	register_builtin_simplify();
 	register_builtin_import();
 	register_builtin_projection();
 	register_builtin_cgaladv();
@@ -45,32 +45,65 @@
 #pragma once
 
 #include <unordered_map>
+#include <map>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <atomic>
+#include <stdint.h>
 #include <boost/format.hpp>
 #include "printutils.h"
+#include "CacheStats.h"
 
+/*!
+	Cost-aware cache using the GreedyDual-Size replacement policy.
+
+	Each entry has a cost (its size) and a benefit (typically the time it
+	took to compute). Entries are assigned the priority L + benefit/cost,
+	where L is the priority of the last evicted entry, and the entry with
+	the lowest priority is evicted first. Accessing an entry refreshes its
+	priority. Equal priorities are evicted in least recently used order, so
+	with zero benefits this degrades to plain LRU.
+
+	Pinned entries are taken out of the replacement order and are never
+	evicted, even if they make the cache exceed its maximum cost.
+*/
 template <class Key, class T>
 class Cache
 {
+	struct Node;
+	typedef std::map<std::pair<double, uint64_t>, Node *> queue_type;
 	struct Node {
-		inline Node() : keyPtr(0) {}
-		inline Node(T *data, int cost)
-			: keyPtr(0), t(data), c(cost), p(0), n(0) {}
-		const Key *keyPtr; T *t; int c; Node *p,*n;
+		inline Node() : keyPtr(0), t(0), c(0), b(0), pinned(false) {}
+		inline Node(T *data, int cost, double benefit)
+			: keyPtr(0), t(data), c(cost), b(benefit), pinned(false) {}
+		const Key *keyPtr; T *t; int c; double b; bool pinned;
+		typename queue_type::iterator pos;
 	};
 	typedef typename std::unordered_map<Key, Node> map_type;
 	typedef typename map_type::iterator iterator_type;
 	typedef typename map_type::value_type value_type;
 
 	std::unordered_map<Key, Node> hash;
-	Node *f, *l;
-	void *unused;
+	queue_type queue;
+	double inflation;
 	int mx, total;
 
+	inline double priority(const Node &n) const {
+		return this->inflation + n.b / (n.c > 0 ? n.c : 1);
+	}
+	// Global access stamp used to break ties in least recently used order,
+	// shared by all caches of the same type.
+	static uint64_t nextStamp() {
+		static std::atomic<uint64_t> stamp(0);
+		return stamp++;
+	}
+	inline void enqueue(Node &n) {
+		if (n.pinned) return;
+		n.pos = this->queue.insert(std::make_pair(std::make_pair(priority(n), nextStamp()), &n)).first;
+	}
 	inline void unlink(Node &n) {
-		if (n.p) n.p->n = n.n;
-		if (n.n) n.n->p = n.p;
-		if (l == &n) l = n.p;
-		if (f == &n) f = n.n;
+		if (!n.pinned) this->queue.erase(n.pos);
 		total -= n.c;
 		T *obj = n.t;
 		hash.erase(*n.keyPtr);
@@ -81,21 +114,16 @@ class Cache
 		if (i == hash.end()) return 0;
 
 		Node &n = i->second;
-		if (f != &n) {
-			if (n.p) n.p->n = n.n;
-			if (n.n) n.n->p = n.p;
-			if (l == &n) l = n.p;
-			n.p = 0;
-			n.n = f;
-			f->p = &n;
-			f = &n;
+		if (!n.pinned) {
+			this->queue.erase(n.pos);
+			enqueue(n);
 		}
 		return n.t;
 	}
 
 public:
 	inline explicit Cache(int maxCost = 100)
-		: f(0), l(0), unused(0), mx(maxCost), total(0) { }
+		: inflation(0), mx(maxCost), total(0) { }
 	inline ~Cache() { clear(); }
 
 	inline int maxCost() const { return mx; }
@@ -106,17 +134,42 @@ public:
 	inline bool empty() const { return hash.empty(); }
 
 	void clear() {
-		while (f) { delete f->t; f = f->n; }
-		hash.clear(); l = 0; total = 0;
+		for (auto &item : hash) delete item.second.t;
+		hash.clear(); queue.clear(); total = 0; inflation = 0;
 	}
 
-	bool insert(const Key &key, T *object, int cost = 1);
+	bool insert(const Key &key, T *object, int cost = 1, double benefit = 0);
 	T *object(const Key &key) const { return const_cast<Cache<Key,T>*>(this)->relink(key); }
 	inline bool contains(const Key &key) const { return hash.find(key) != hash.end(); }
 	T *operator[](const Key &key) const { return object(key); }
 
+	bool setPinned(const Key &key, bool pinned);
+	bool isPinned(const Key &key) const {
+		typename map_type::const_iterator i = hash.find(key);
+		return i != hash.end() && i->second.pinned;
+	}
+	/*! Calls \a f with each entry, its cost and whether it's pinned, in no particular order. */
+	void forEach(const std::function<void(const Key &, const T &, int, bool)> &f) const {
+		for (const auto &item : hash) f(item.first, *item.second.t, item.second.c, item.second.pinned);
+	}
+
 	bool remove(const Key &key);
 	T *take(const Key &key);
+	int removeLeastRecent();
+	/*! Calls \a f with the next entry to be evicted. Returns false if the cache is empty. */
+	bool peekLeastRecent(const std::function<void(const Key &, const T &)> &f) const {
+		if (queue.empty()) return false;
+		const Node *n = queue.begin()->second;
+		f(*n->keyPtr, *n->t);
+		return true;
+	}
+	typedef std::pair<double, uint64_t> priority_type;
+	/*! Returns true if there is an entry which can be evicted */
+	bool evictable() const { return !queue.empty(); }
+	/*! Returns the priority of the next entry to be evicted */
+	priority_type lowestPriority() const {
+		return queue.empty() ? priority_type(std::numeric_limits<double>::max(), 0) : queue.begin()->first;
+	}
 
 private:
 	void trim(int m);
@@ -140,45 +193,292 @@ inline T *Cache<Key,T>::take(const Key &key)
 	iterator_type i = hash.find(key);
 	if (i == hash.end()) return 0;
 
-	Node &n = *i;
+	Node &n = i->second;
 	T *t = n.t;
 	n.t = 0;
 	unlink(n);
 	return t;
 }
 
+/*!
+	Removes the entry with the lowest priority and raises the inflation
+	value accordingly.
+	Returns the cost of the removed entry, or -1 if the cache is empty.
+*/
 template <class Key, class T>
-bool Cache<Key,T>::insert(const Key &akey, T *aobject, int acost)
+inline int Cache<Key,T>::removeLeastRecent()
 {
+	if (queue.empty()) return -1;
+	Node *n = queue.begin()->second;
+	this->inflation = queue.begin()->first.first;
+	int cost = n->c;
+#ifdef DEBUG
+	PRINTB("Trimming cache: %1% (%2% bytes)", n->keyPtr->substr(0, 40) % n->c);
+#endif
+	unlink(*n);
+	return cost;
+}
+
+/*!
+	Takes the entry for \a key out of the replacement order, or puts it
+	back with a fresh priority. Returns false if not found.
+*/
+template <class Key, class T>
+bool Cache<Key,T>::setPinned(const Key &key, bool pinned)
+{
+	iterator_type i = hash.find(key);
+	if (i == hash.end()) return false;
+
+	Node &n = i->second;
+	if (n.pinned == pinned) return true;
+	if (pinned) {
+		this->queue.erase(n.pos);
+		n.pinned = true;
+	}
+	else {
+		n.pinned = false;
+		enqueue(n);
+	}
+	return true;
+}
+
+/*!
+	Inserts \a aobject, replacing any entry for \a akey. A pinned entry
+	stays pinned when it's replaced.
+*/
+template <class Key, class T>
+bool Cache<Key,T>::insert(const Key &akey, T *aobject, int acost, double abenefit)
+{
+	const bool pinned = isPinned(akey);
 	remove(akey);
 	if (acost > mx) {
 		delete aobject;
 		return false;
 	}
 	trim(mx - acost);
-	Node node(aobject, acost);
+	Node node(aobject, acost, abenefit);
 	hash[akey] = node;
 	iterator_type i = hash.find(akey);
 	total += acost;
 	Node *n = &i->second;
 	n->keyPtr = &i->first;
-	if (f) f->p = n;
-	n->n = f;
-	f = n;
-	if (!l) l = f;
+	n->pinned = pinned;
+	enqueue(*n);
 	return true;
 }
 
 template <class Key, class T>
 void Cache<Key,T>::trim(int m)
 {
-	Node *n = l;
-	while (n && total > m) {
-		Node *u = n;
-		n = n->p;
-#ifdef DEBUG
-		PRINTB("Trimming cache: %1% (%2% bytes)", u->keyPtr->substr(0, 40) % u->c);
-#endif
-		unlink(*u);
-	}
+	while (total > m && removeLeastRecent() >= 0) {}
 }
+
+/*!
+	Thread-safe variant of Cache.
+
+	Keys are distributed over a fixed number of shards by hash, each shard
+	being a Cache with its own mutex and LRU list. The total cost is tracked
+	atomically across all shards. When the total exceeds maxCost(), entries
+	are evicted from the shard holding the lowest priority entry, which
+	approximates the global replacement order of Cache.
+
+	Since another thread may evict an entry at any time, objects are never
+	handed out by pointer; use access() to read an entry while the shard
+	is locked.
+*/
+template <class Key, class T, size_t NumShards = 16>
+class ShardedCache
+{
+	struct Shard {
+		Shard() : cache(std::numeric_limits<int>::max()) {}
+		mutable std::mutex mutex;
+		Cache<Key, T> cache;
+	};
+	typedef std::lock_guard<std::mutex> Lock;
+
+	Shard shards[NumShards];
+	std::atomic<size_t> total;
+	std::atomic<size_t> mx;
+	std::atomic<size_t> insertions;
+	std::atomic<size_t> rejections;
+	std::atomic<size_t> evictions;
+	std::atomic<size_t> evictedcost;
+
+	Shard &shard(const Key &key) { return shards[std::hash<Key>()(key) % NumShards]; }
+	const Shard &shard(const Key &key) const { return shards[std::hash<Key>()(key) % NumShards]; }
+
+	// Returns the shard holding the entry to be evicted next, or NumShards if empty
+	size_t victimShard() const {
+		size_t victim = NumShards;
+		typename Cache<Key, T>::priority_type lowest;
+		for (size_t i=0;i<NumShards;i++) {
+			Lock lock(this->shards[i].mutex);
+			if (this->shards[i].cache.evictable() &&
+					(victim == NumShards || this->shards[i].cache.lowestPriority() < lowest)) {
+				lowest = this->shards[i].cache.lowestPriority();
+				victim = i;
+			}
+		}
+		return victim;
+	}
+
+	// Evicts the next entry of shard \a victim, passing it to \a f first if set
+	int evictFrom(size_t victim, const std::function<void(const Key &, const T &)> &f) {
+		Shard &s = this->shards[victim];
+		Lock lock(s.mutex);
+		if (f) s.cache.peekLeastRecent(f);
+		int cost = s.cache.removeLeastRecent();
+		if (cost >= 0) {
+			this->total -= cost;
+			this->evictions++;
+			this->evictedcost += cost;
+		}
+		return cost;
+	}
+
+	void trim(size_t m) {
+		while (this->total > m) {
+			size_t victim = victimShard();
+			if (victim == NumShards) break;
+			evictFrom(victim, nullptr);
+		}
+	}
+
+public:
+	explicit ShardedCache(size_t maxCost = 100)
+		: total(0), mx(maxCost), insertions(0), rejections(0), evictions(0), evictedcost(0) {}
+
+	size_t maxCost() const { return this->mx; }
+	void setMaxCost(size_t m) { this->mx = m; trim(m); }
+	size_t totalCost() const { return this->total; }
+
+	size_t size() const {
+		size_t n = 0;
+		for (size_t i=0;i<NumShards;i++) {
+			Lock lock(this->shards[i].mutex);
+			n += this->shards[i].cache.size();
+		}
+		return n;
+	}
+
+	void clear() {
+		for (size_t i=0;i<NumShards;i++) {
+			Lock lock(this->shards[i].mutex);
+			this->total -= this->shards[i].cache.totalCost();
+			this->shards[i].cache.clear();
+		}
+	}
+
+	/*!
+		Returns insertion and eviction counters. Lookups are counted by the
+		owner of the cache, which knows what constitutes a hit.
+	*/
+	CacheStats stats() const {
+		CacheStats st;
+		st.insertions = this->insertions;
+		st.rejections = this->rejections;
+		st.evictions = this->evictions;
+		st.evictedcost = this->evictedcost;
+		st.entries = size();
+		st.cost = this->total;
+		st.maxcost = this->mx;
+		return st;
+	}
+
+	void resetStats() {
+		this->insertions = this->rejections = this->evictions = this->evictedcost = 0;
+	}
+
+	bool contains(const Key &key) const {
+		const Shard &s = shard(key);
+		Lock lock(s.mutex);
+		return s.cache.contains(key);
+	}
+
+	/*!
+		Calls \a f with the entry for \a key while holding the shard lock,
+		marking the entry as recently used. Returns false if not found.
+	*/
+	bool access(const Key &key, const std::function<void(const T &)> &f) {
+		Shard &s = shard(key);
+		Lock lock(s.mutex);
+		T *obj = s.cache.object(key);
+		if (!obj) return false;
+		f(*obj);
+		return true;
+	}
+
+	/*!
+		Inserts \a object, taking ownership. Returns false, and deletes
+		the object, if the cost exceeds maxCost().
+	*/
+	bool insert(const Key &key, T *object, size_t cost = 1, double benefit = 0) {
+		if (cost > this->mx || cost > size_t(std::numeric_limits<int>::max())) {
+			delete object;
+			remove(key);
+			this->rejections++;
+			return false;
+		}
+		this->insertions++;
+		{
+			Shard &s = shard(key);
+			Lock lock(s.mutex);
+			this->total -= s.cache.totalCost();
+			s.cache.insert(key, object, int(cost), benefit);
+			this->total += s.cache.totalCost();
+		}
+		if (this->total > this->mx) trim(this->mx);
+		return true;
+	}
+
+	/*!
+		Evicts entries in replacement order until their costs add up to at
+		least \a cost or the cache is empty, calling \a f with each entry
+		before it's removed. Returns the cost evicted.
+	*/
+	size_t evict(size_t cost, const std::function<void(const Key &, const T &)> &f) {
+		size_t evicted = 0;
+		while (evicted < cost) {
+			size_t victim = victimShard();
+			if (victim == NumShards) break;
+			int c = evictFrom(victim, f);
+			if (c > 0) evicted += c;
+		}
+		return evicted;
+	}
+
+	bool remove(const Key &key) {
+		Shard &s = shard(key);
+		Lock lock(s.mutex);
+		this->total -= s.cache.totalCost();
+		bool removed = s.cache.remove(key);
+		this->total += s.cache.totalCost();
+		return removed;
+	}
+
+	/*!
+		Pins or unpins the entry for \a key. Unpinning may evict entries
+		if pinned entries made the cache exceed maxCost().
+	*/
+	bool setPinned(const Key &key, bool pinned) {
+		bool found;
+		{
+			Shard &s = shard(key);
+			Lock lock(s.mutex);
+			found = s.cache.setPinned(key, pinned);
+		}
+		if (!pinned && this->total > this->mx) trim(this->mx);
+		return found;
+	}
+
+	/*!
+		Calls \a f with each entry, its cost and whether it's pinned. Each
+		shard is locked while its entries are visited.
+	*/
+	void forEach(const std::function<void(const Key &, const T &, size_t, bool)> &f) const {
+		for (size_t i=0;i<NumShards;i++) {
+			Lock lock(this->shards[i].mutex);
+			this->shards[i].cache.forEach([&f](const Key &key, const T &t, int cost, bool pinned) { f(key, t, cost, pinned); });
+		}
+	}
+};
@@ -27,6 +27,10 @@
 #include "calc.h"
 #include "grid.h"
 #include <cmath>
+#include <atomic>
+
+// Read by the worker threads of parallel evaluation
+static std::atomic<int> fragment_limit(0);
 
 /*!
 	Returns the number of subdivision of a whole circle, given radius and
@@ -37,7 +41,18 @@ int Calc::get_fragments_from_r(double r, double fn, double fs, double fa)
 	// FIXME: It would be better to refuse to create an object. Let's do more strict error handling
 	// in future versions of OpenSCAD
 	if (r < GRID_FINE || std::isinf(fn) || std::isnan(fn)) return 3;
-	if (fn > 0.0) return (int)(fn >= 3 ? fn : 3);
-	return (int)ceil(fmax(fmin(360.0 / fa, r*2*M_PI / fs), 5));
+	const int fragments = fn > 0.0 ? (int)(fn >= 3 ? fn : 3) : (int)ceil(fmax(fmin(360.0 / fa, r*2*M_PI / fs), 5));
+	const int limit = fragment_limit;
+	return limit > 0 && fragments > limit ? limit : fragments;
+}
+
+Calc::FragmentLimit::FragmentLimit(int limit) : previous(fragment_limit)
+{
+	fragment_limit = limit > 0 && limit < 3 ? 3 : limit;
+}
+
+Calc::FragmentLimit::~FragmentLimit()
+{
+	fragment_limit = this->previous;
 }
 
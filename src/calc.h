@@ -2,4 +2,19 @@
 
 namespace Calc {
 	int get_fragments_from_r(double r, double fn, double fs, double fa);
+
+	/*!
+		While it exists, get_fragments_from_r() returns at most \a limit
+		fragments, for quick previews. A limit of 0 means no limit. As the
+		limit is global, nothing else may be evaluated meanwhile, and the
+		geometry must be cached apart from full detail geometry.
+	*/
+	class FragmentLimit
+	{
+	public:
+		FragmentLimit(int limit);
+		~FragmentLimit();
+	private:
+		int previous;
+	};
 }
@@ -29,7 +29,16 @@
 #include "svg.h"
 #include "Reindexer.h"
 #include "GeometryUtils.h"
-
+#include "feature.h"
+#include "ThreadPool.h"
+#include "MemoryAccounting.h"
+#include "PerfCounters.h"
+#include "OperationCounters.h"
+#include "Tree.h"
+#include "cache.h"
+
+#include <algorithm>
+#include <atomic>
 #include <map>
 #include <queue>
 #include <unordered_set>
@@ -72,15 +81,141 @@ namespace CGALUtils {
 		return visited.size() == p.size_of_facets();
 	}
 
+	// Makes CGAL throw on errors for the lifetime of the object
+	class ThrowOnError {
+	public:
+		ThrowOnError() : old_behaviour(CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION)) {}
+		~ThrowOnError() { CGAL::set_error_behaviour(this->old_behaviour); }
+	private:
+		CGAL::Failure_behaviour old_behaviour;
+	};
+
+/*!
+	Unites the children by a balanced tree of pairwise unions. The
+	conversions to Nef polyhedra and the unions of each level of the tree
+	run in parallel. CGAL errors are rethrown in the calling thread.
+*/
+	static CGAL_Nef_polyhedron *applyUnionParallel(const Geometry::Geometries &children)
+	{
+		typedef shared_ptr<const CGAL_Nef_polyhedron3> NefPtr;
+		ThreadPool *pool = ThreadPool::instance();
+		const std::vector<Geometry::GeometryItem> items(children.begin(), children.end());
+
+		std::vector<NefPtr> level(items.size());
+		ThreadPool::TaskGroup group;
+		for (size_t i=0;i<items.size();i++) {
+			pool->run(group, [&items, &level, i]() {
+					ThrowOnError guard;
+					shared_ptr<const CGAL_Nef_polyhedron> chN = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(items[i].second);
+					if (!chN) {
+						const PolySet *chps = dynamic_cast<const PolySet*>(items[i].second.get());
+						if (chps) chN.reset(createNefPolyhedronFromGeometry(*chps));
+					}
+					if (chN && !chN->isEmpty()) level[i] = chN->p3;
+				});
+		}
+		pool->wait(group);
+		level.erase(std::remove(level.begin(), level.end(), NefPtr()), level.end());
+		if (level.empty()) return NULL;
+
+		while (level.size() > 1) {
+			std::vector<NefPtr> next((level.size() + 1) / 2);
+			for (size_t i=0;i+1<level.size();i+=2) {
+				pool->run(group, [&level, &next, i]() {
+						ThrowOnError guard;
+						OperationCounters::count(OperationCounters::NEF_UNION);
+						next[i/2].reset(new CGAL_Nef_polyhedron3(*level[i] + *level[i+1]));
+					});
+			}
+			if (level.size() % 2) next.back() = level.back();
+			pool->wait(group);
+			level.swap(next);
+		}
+		return new CGAL_Nef_polyhedron(new CGAL_Nef_polyhedron3(*level.front()));
+	}
+
+/*!
+	Intersects the children by a balanced tree of pairwise intersections,
+	like applyUnionParallel(). The children are paired by the volume of
+	their bounding boxes, so the smallest ones shrink the partial results
+	early. Stops as soon as a partial result is empty.
+*/
+	static CGAL_Nef_polyhedron *applyIntersectionParallel(const Geometry::Geometries &children)
+	{
+		typedef shared_ptr<const CGAL_Nef_polyhedron3> NefPtr;
+		ThreadPool *pool = ThreadPool::instance();
+		std::vector<Geometry::GeometryItem> items(children.begin(), children.end());
+		std::vector<double> volumes(items.size());
+		std::vector<size_t> order(items.size());
+		for (size_t i=0;i<items.size();i++) {
+			const BoundingBox bbox = items[i].second->getBoundingBox();
+			volumes[i] = bbox.isEmpty() ? 0 : bbox.volume();
+			order[i] = i;
+		}
+		std::stable_sort(order.begin(), order.end(), [&volumes](size_t a, size_t b) { return volumes[a] < volumes[b]; });
+
+		std::atomic<bool> empty(false);
+		std::vector<NefPtr> level(items.size());
+		ThreadPool::TaskGroup group;
+		for (size_t i=0;i<items.size();i++) {
+			pool->run(group, [&items, &order, &level, &empty, i]() {
+					if (empty) return;
+					ThrowOnError guard;
+					const shared_ptr<const Geometry> &geom = items[order[i]].second;
+					shared_ptr<const CGAL_Nef_polyhedron> chN = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(geom);
+					if (!chN) {
+						const PolySet *chps = dynamic_cast<const PolySet*>(geom.get());
+						if (chps) chN.reset(createNefPolyhedronFromGeometry(*chps));
+					}
+					if (!chN || chN->isEmpty()) empty = true;
+					else level[i] = chN->p3;
+				});
+		}
+		pool->wait(group);
+
+		while (!empty && level.size() > 1) {
+			std::vector<NefPtr> next((level.size() + 1) / 2);
+			for (size_t i=0;i+1<level.size();i+=2) {
+				pool->run(group, [&level, &next, &empty, i]() {
+						if (empty) return;
+						ThrowOnError guard;
+						OperationCounters::count(OperationCounters::NEF_INTERSECTION);
+						next[i/2].reset(new CGAL_Nef_polyhedron3(*level[i] * *level[i+1]));
+						if (next[i/2]->is_empty()) empty = true;
+					});
+			}
+			if (level.size() % 2) next.back() = level.back();
+			pool->wait(group);
+			level.swap(next);
+		}
+		if (empty) return new CGAL_Nef_polyhedron(new CGAL_Nef_polyhedron3);
+		return new CGAL_Nef_polyhedron(new CGAL_Nef_polyhedron3(*level.front()));
+	}
+
 /*!
 	Applies op to all children and returns the result.
 	The child list should be guaranteed to contain non-NULL 3D or empty Geometry objects
 */
 	CGAL_Nef_polyhedron *applyOperator(const Geometry::Geometries &children, OpenSCADOperator op)
 	{
+		MemoryAccounting::Scope memoryscope(MemoryAccounting::CGAL);
+		PERF_PROBE("nef-boolean");
 		CGAL_Nef_polyhedron *N = NULL;
 		CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
 		try {
+			if (op == OPENSCAD_UNION && children.size() > 2 &&
+					Feature::ExperimentalParallelEvaluation.is_enabled()) {
+				N = applyUnionParallel(children);
+				CGAL::set_error_behaviour(old_behaviour);
+				return N;
+			}
+			if (op == OPENSCAD_INTERSECTION && children.size() > 2 &&
+					Feature::ExperimentalParallelEvaluation.is_enabled()) {
+				N = applyIntersectionParallel(children);
+				CGAL::set_error_behaviour(old_behaviour);
+				return N;
+			}
+
 			// Speeds up n-ary union operations significantly
 			CGAL::Nef_nary_union_3<CGAL_Nef_polyhedron3> nary_union;
 			int nary_union_num_inserted = 0;
@@ -131,10 +266,12 @@ namespace CGALUtils {
 				default:
 					PRINTB("ERROR: Unsupported CGAL operator: %d", op);
 				}
-				item.first->progress_report();
+				if (item.first) item.first->progress_report();
 			}
 
 			if (op == OPENSCAD_UNION && nary_union_num_inserted > 0) {
+				// One union of each operand with the rest
+				OperationCounters::count(OperationCounters::NEF_UNION, nary_union_num_inserted - 1);
 				N = new CGAL_Nef_polyhedron(new CGAL_Nef_polyhedron3(nary_union.get_union()));
 			}
 		}
@@ -149,13 +286,61 @@ namespace CGALUtils {
 
 
 
+/*!
+	Reduces points to the vertices of their convex hull. Point clouds larger
+	than a few chunks are split into one chunk per thread, and the chunks are
+	hulled in parallel. Since hull vertices of the chunks include all hull
+	vertices of the whole cloud, the final hull is unchanged.
+	Degenerate chunks are kept as they are.
+*/
+	static void reduceHullPoints(std::vector<CGAL::Epick::Point_3> &points)
+	{
+		typedef CGAL::Epick K;
+		const size_t minchunk = 10000;
+		ThreadPool *pool = ThreadPool::instance();
+		const size_t numchunks = std::min<size_t>(pool->size(), points.size() / minchunk);
+		if (numchunks < 2) return;
+
+		const size_t chunksize = (points.size() + numchunks - 1) / numchunks;
+		std::vector<std::vector<K::Point_3>> reduced(numchunks);
+		ThreadPool::TaskGroup group;
+		for (size_t c=0;c<numchunks;c++) {
+			pool->run(group, [&points, &reduced, c, chunksize]() {
+					const auto begin = points.begin() + std::min(points.size(), c * chunksize);
+					const auto end = points.begin() + std::min(points.size(), (c+1) * chunksize);
+					ThrowOnError guard;
+					try {
+						CGAL::Polyhedron_3<K> r;
+						CGAL::convex_hull_3(begin, end, r);
+						if (r.size_of_vertices() >= 4) {
+							for (auto v = r.vertices_begin(); v != r.vertices_end(); ++v) reduced[c].push_back(v->point());
+							return;
+						}
+					}
+					catch (const CGAL::Failure_exception &e) {
+						// Keep the chunk as is, and let the final hull report the error
+					}
+					reduced[c].assign(begin, end);
+				});
+		}
+		pool->wait(group);
+
+		points.clear();
+		for(const auto &r : reduced) points.insert(points.end(), r.begin(), r.end());
+	}
+
 	bool applyHull(const Geometry::Geometries &children, PolySet &result)
 	{
+		MemoryAccounting::Scope memoryscope(MemoryAccounting::CGAL);
 		typedef CGAL::Epick K;
-		// Collect point cloud
-		// NB! CGAL's convex_hull_3() doesn't like std::set iterators, so we use a list
-		// instead.
-		std::list<K::Point_3> points;
+		// Collect point cloud. Duplicate vertices, e.g. shared by touching
+		// children, are removed using a grid; the original coordinates are kept.
+		std::vector<K::Point_3> points;
+		VertexWelder welder(GRID_FINE);
+		auto addPoint = [&points, &welder](const Vector3d &v) {
+			Vector3d aligned = v;
+			if (welder.align(aligned) == int(points.size())) points.push_back(K::Point_3(v[0], v[1], v[2]));
+		};
 
 		for(const auto &item : children) {
 			const shared_ptr<const Geometry> &chgeom = item.second;
@@ -163,23 +348,25 @@ namespace CGALUtils {
 			if (N) {
 				if (!N->isEmpty()) {
 					for (CGAL_Nef_polyhedron3::Vertex_const_iterator i = N->p3->vertices_begin(); i != N->p3->vertices_end(); ++i) {
-						points.push_back(vector_convert<K::Point_3>(i->point()));
+						addPoint(vector_convert<Vector3d>(i->point()));
 					}
 				}
 			} else {
 				const PolySet *ps = dynamic_cast<const PolySet *>(chgeom.get());
 				if (ps) {
-					for(const auto &p : ps->polygons) {
-						for(const auto &v : p) {
-							points.push_back(K::Point_3(v[0], v[1], v[2]));
-						}
-					}
+					for(const auto &v : ps->getVertices()) addPoint(v);
 				}
 			}
 		}
 
 		if (points.size() <= 3) return false;
 
+		if (Feature::ExperimentalParallelEvaluation.is_enabled()) {
+			PRINTDB("Hull points before reduction: %d", points.size());
+			reduceHullPoints(points);
+			PRINTDB("Hull points after reduction: %d", points.size());
+		}
+
 		// Apply hull
 		bool success = false;
 		if (points.size() >= 4) {
@@ -202,194 +389,336 @@ namespace CGALUtils {
 	}
 
 
-	/*!
-		children cannot contain NULL objects
-	*/
-	Geometry const * applyMinkowski(const Geometry::Geometries &children)
+/*!
+	Groups the children into sets whose bounding boxes overlap or touch,
+	transitively. Children of different groups are guaranteed to be
+	disjoint.
+*/
+	std::vector<Geometry::Geometries> groupByBoundingBox(const Geometry::Geometries &children)
 	{
-		CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
-		CGAL::Timer t,t_tot;
-		assert(children.size() >= 2);
-		Geometry::Geometries::const_iterator it = children.begin();
-		t_tot.start();
-		Geometry const* operands[2] = {it->second.get(), NULL};
-		try {
-			while (++it != children.end()) {
-				operands[1] = it->second.get();
+		const std::vector<Geometry::GeometryItem> items(children.begin(), children.end());
+		std::vector<BoundingBox> boxes;
+		for(const auto &item : items) boxes.push_back(item.second->getBoundingBox());
+
+		// Union-find over overlapping boxes
+		std::vector<size_t> group(items.size());
+		for (size_t i=0;i<group.size();i++) group[i] = i;
+		auto find = [&group](size_t i) {
+			while (group[i] != i) i = group[i] = group[group[i]];
+			return i;
+		};
+		for (size_t i=0;i<items.size();i++) {
+			for (size_t j=i+1;j<items.size();j++) {
+				if (!boxes[i].intersection(boxes[j]).isEmpty()) group[find(j)] = find(i);
+			}
+		}
+		std::map<size_t, Geometry::Geometries> groups;
+		for (size_t i=0;i<items.size();i++) groups[find(i)].push_back(items[i]);
 
-				typedef CGAL::Epick Hull_kernel;
+		std::vector<Geometry::Geometries> result;
+		for(auto &g : groups) result.push_back(g.second);
+		return result;
+	}
 
-				std::list<CGAL_Polyhedron> P[2];
-				std::list<CGAL::Polyhedron_3<Hull_kernel>> result_parts;
+	typedef CGAL::Epick Hull_kernel;
+	typedef std::vector<Hull_kernel::Point_3> HullPoints;
+	// Vertices of the convex parts of a Minkowski operand
+	typedef std::vector<HullPoints> ConvexParts;
 
-				for (size_t i = 0; i < 2; i++) {
-					CGAL_Polyhedron poly;
+/*!
+	Convex decompositions of Minkowski operands, keyed by subtree id like
+	the GeometryCache.
+*/
+	static ShardedCache<std::string, shared_ptr<const ConvexParts>> &decompositionCache()
+	{
+		static ShardedCache<std::string, shared_ptr<const ConvexParts>> *cache =
+			new ShardedCache<std::string, shared_ptr<const ConvexParts>>(20*1024*1024);
+		return *cache;
+	}
+
+	static void appendConvexPart(const CGAL_Polyhedron &poly, ConvexParts &parts)
+	{
+		parts.push_back(HullPoints());
+		parts.back().reserve(poly.size_of_vertices());
+		for (CGAL_Polyhedron::Vertex_const_iterator pi = poly.vertices_begin(); pi != poly.vertices_end(); ++pi) {
+			CGAL_Polyhedron::Point_3 const& p = pi->point();
+			parts.back().push_back(Hull_kernel::Point_3(to_double(p[0]),to_double(p[1]),to_double(p[2])));
+		}
+	}
 
-					const PolySet * ps = dynamic_cast<const PolySet *>(operands[i]);
+/*!
+	Splits a Minkowski operand into convex parts, decomposing the Nef
+	polyhedron of non-convex operands. Throws if that isn't possible.
+*/
+	static void decomposeConvex(const Geometry *geom, ConvexParts &parts)
+	{
+		CGAL_Polyhedron poly;
 
-					const CGAL_Nef_polyhedron * nef = dynamic_cast<const CGAL_Nef_polyhedron *>(operands[i]);
+		const PolySet * ps = dynamic_cast<const PolySet *>(geom);
 
-					if (ps) CGALUtils::createPolyhedronFromPolySet(*ps, poly);
-					else if (nef && nef->p3->is_simple()) nefworkaround::convert_to_Polyhedron<CGAL_Kernel3>(*nef->p3, poly);
-					else throw 0;
+		const CGAL_Nef_polyhedron * nef = dynamic_cast<const CGAL_Nef_polyhedron *>(geom);
 
-					if ((ps && ps->is_convex()) ||
-							(!ps && is_weakly_convex(poly))) {
-						PRINTDB("Minkowski: child %d is convex and %s",i % (ps?"PolySet":"Nef"));
-						P[i].push_back(poly);
-					} else {
-						CGAL_Nef_polyhedron3 decomposed_nef;
+		if (ps) CGALUtils::createPolyhedronFromPolySet(*ps, poly);
+		else if (nef && nef->p3->is_simple()) nefworkaround::convert_to_Polyhedron<CGAL_Kernel3>(*nef->p3, poly);
+		else throw 0;
 
-						if (ps) {
-							PRINTDB("Minkowski: child %d is nonconvex PolySet, transforming to Nef and decomposing...", i);
-							CGAL_Nef_polyhedron *p = createNefPolyhedronFromGeometry(*ps);
-							if (!p->isEmpty()) decomposed_nef = *p->p3;
-							delete p;
-						} else {
-							PRINTDB("Minkowski: child %d is nonconvex Nef, decomposing...",i);
-							decomposed_nef = *nef->p3;
-						}
+		if ((ps && ps->is_convex()) ||
+				(!ps && is_weakly_convex(poly))) {
+			PRINTDB("Minkowski: child is convex and %s", (ps?"PolySet":"Nef"));
+			appendConvexPart(poly, parts);
+			return;
+		}
 
-						t.start();
-						CGAL::convex_decomposition_3(decomposed_nef);
-
-						// the first volume is the outer volume, which ignored in the decomposition
-						CGAL_Nef_polyhedron3::Volume_const_iterator ci = ++decomposed_nef.volumes_begin();
-						for(; ci != decomposed_nef.volumes_end(); ++ci) {
-							if(ci->mark()) {
-								CGAL_Polyhedron poly;
-								decomposed_nef.convert_inner_shell_to_polyhedron(ci->shells_begin(), poly);
-								P[i].push_back(poly);
-							}
-						}
+		CGAL_Nef_polyhedron3 decomposed_nef;
 
+		if (ps) {
+			PRINTD("Minkowski: child is nonconvex PolySet, transforming to Nef and decomposing...");
+			CGAL_Nef_polyhedron *p = createNefPolyhedronFromGeometry(*ps);
+			if (!p->isEmpty()) decomposed_nef = *p->p3;
+			delete p;
+		} else {
+			PRINTD("Minkowski: child is nonconvex Nef, decomposing...");
+			decomposed_nef = *nef->p3;
+		}
 
-						PRINTDB("Minkowski: decomposed into %d convex parts", P[i].size());
-						t.stop();
-						PRINTDB("Minkowski: decomposition took %f s", t.time());
-					}
-				}
+		CGAL::Timer t;
+		t.start();
+		CGAL::convex_decomposition_3(decomposed_nef);
+
+		// the first volume is the outer volume, which ignored in the decomposition
+		CGAL_Nef_polyhedron3::Volume_const_iterator ci = ++decomposed_nef.volumes_begin();
+		for(; ci != decomposed_nef.volumes_end(); ++ci) {
+			if(ci->mark()) {
+				CGAL_Polyhedron poly;
+				decomposed_nef.convert_inner_shell_to_polyhedron(ci->shells_begin(), poly);
+				appendConvexPart(poly, parts);
+			}
+		}
 
-				std::vector<Hull_kernel::Point_3> points[2];
-				std::vector<Hull_kernel::Point_3> minkowski_points;
+		PRINTDB("Minkowski: decomposed into %d convex parts", parts.size());
+		t.stop();
+		PRINTDB("Minkowski: decomposition took %f s", t.time());
+	}
 
-				for (size_t i = 0; i < P[0].size(); i++) {
-					for (size_t j = 0; j < P[1].size(); j++) {
-						t.start();
-						points[0].clear();
-						points[1].clear();
+/*!
+	Returns the convex parts of \a geom, using the decomposition cache
+	when \a key isn't empty.
+*/
+	static shared_ptr<const ConvexParts> getConvexParts(const Geometry *geom, const std::string &key)
+	{
+		shared_ptr<const ConvexParts> parts;
+		if (!key.empty() &&
+				decompositionCache().access(key, [&parts](const shared_ptr<const ConvexParts> &p) { parts = p; })) {
+			PRINTD("Minkowski: using cached convex decomposition");
+			return parts;
+		}
 
-						for (int k = 0; k < 2; k++) {
-							std::list<CGAL_Polyhedron>::iterator it = P[k].begin();
-							std::advance(it, k==0?i:j);
+		CGAL::Timer t;
+		t.start();
+		ConvexParts *newparts = new ConvexParts;
+		parts.reset(newparts);
+		decomposeConvex(geom, *newparts);
+		t.stop();
+
+		if (!key.empty()) {
+			size_t memsize = sizeof(ConvexParts);
+			for(const auto &part : *parts) memsize += sizeof(HullPoints) + part.size() * sizeof(Hull_kernel::Point_3);
+			decompositionCache().insert(key, new shared_ptr<const ConvexParts>(parts), memsize, t.time());
+		}
+		return parts;
+	}
 
-							CGAL_Polyhedron const& poly = *it;
-							points[k].reserve(poly.size_of_vertices());
+/*!
+	Computes the convex hull of the Minkowski sum of two convex parts.
+	Returns false if the sum is degenerate.
+*/
+	static bool hullMinkowskiPair(const HullPoints &a, const HullPoints &b,
+																CGAL::Polyhedron_3<Hull_kernel> &result)
+	{
+		CGAL::Timer t;
+		t.start();
+		std::vector<Hull_kernel::Point_3> minkowski_points;
+		minkowski_points.reserve(a.size() * b.size());
+		for (size_t i = 0; i < a.size(); i++) {
+			for (size_t j = 0; j < b.size(); j++) {
+				minkowski_points.push_back(a[i]+(b[j]-CGAL::ORIGIN));
+			}
+		}
 
-							for (CGAL_Polyhedron::Vertex_const_iterator pi = poly.vertices_begin(); pi != poly.vertices_end(); ++pi) {
-								CGAL_Polyhedron::Point_3 const& p = pi->point();
-								points[k].push_back(Hull_kernel::Point_3(to_double(p[0]),to_double(p[1]),to_double(p[2])));
-							}
-						}
+		if (minkowski_points.size() <= 3) return false;
 
-						minkowski_points.clear();
-						minkowski_points.reserve(points[0].size() * points[1].size());
-						for (size_t i = 0; i < points[0].size(); i++) {
-							for (size_t j = 0; j < points[1].size(); j++) {
-								minkowski_points.push_back(points[0][i]+(points[1][j]-CGAL::ORIGIN));
-							}
-						}
+		t.stop();
+		PRINTDB("Minkowski: Point cloud creation (%d ⨉ %d -> %d) took %f ms", a.size() % b.size() % minkowski_points.size() % (t.time()*1000));
+		t.reset();
 
-						if (minkowski_points.size() <= 3) {
-							t.stop();
-							continue;
-						}
+		t.start();
 
+		CGAL::convex_hull_3(minkowski_points.begin(), minkowski_points.end(), result);
 
-						CGAL::Polyhedron_3<Hull_kernel> result;
-						t.stop();
-						PRINTDB("Minkowski: Point cloud creation (%d ⨉ %d -> %d) took %f ms", points[0].size() % points[1].size() % minkowski_points.size() % (t.time()*1000));
-						t.reset();
+		std::vector<Hull_kernel::Point_3> strict_points;
+		strict_points.reserve(minkowski_points.size());
 
-						t.start();
+		for (CGAL::Polyhedron_3<Hull_kernel>::Vertex_iterator i = result.vertices_begin(); i != result.vertices_end(); ++i) {
+			Hull_kernel::Point_3 const& p = i->point();
 
-						CGAL::convex_hull_3(minkowski_points.begin(), minkowski_points.end(), result);
+			CGAL::Polyhedron_3<Hull_kernel>::Vertex::Halfedge_handle h,e;
+			h = i->halfedge();
+			e = h;
+			bool collinear = false;
+			bool coplanar = true;
 
-						std::vector<Hull_kernel::Point_3> strict_points;
-						strict_points.reserve(minkowski_points.size());
+			do {
+				Hull_kernel::Point_3 const& q = h->opposite()->vertex()->point();
+				if (coplanar && !CGAL::coplanar(p,q,
+												h->next_on_vertex()->opposite()->vertex()->point(),
+												h->next_on_vertex()->next_on_vertex()->opposite()->vertex()->point())) {
+					coplanar = false;
+				}
 
-						for (CGAL::Polyhedron_3<Hull_kernel>::Vertex_iterator i = result.vertices_begin(); i != result.vertices_end(); ++i) {
-							Hull_kernel::Point_3 const& p = i->point();
 
-							CGAL::Polyhedron_3<Hull_kernel>::Vertex::Halfedge_handle h,e;
-							h = i->halfedge();
-							e = h;
-							bool collinear = false;
-							bool coplanar = true;
+				for (CGAL::Polyhedron_3<Hull_kernel>::Vertex::Halfedge_handle j = h->next_on_vertex();
+					 j != h && !collinear && ! coplanar;
+					 j = j->next_on_vertex()) {
 
-							do {
-								Hull_kernel::Point_3 const& q = h->opposite()->vertex()->point();
-								if (coplanar && !CGAL::coplanar(p,q,
-																h->next_on_vertex()->opposite()->vertex()->point(),
-																h->next_on_vertex()->next_on_vertex()->opposite()->vertex()->point())) {
-									coplanar = false;
-								}
+					Hull_kernel::Point_3 const& r = j->opposite()->vertex()->point();
+					if (CGAL::collinear(p,q,r)) {
+						collinear = true;
+					}
+				}
 
+				h = h->next_on_vertex();
+			} while (h != e && !collinear);
 
-								for (CGAL::Polyhedron_3<Hull_kernel>::Vertex::Halfedge_handle j = h->next_on_vertex();
-									 j != h && !collinear && ! coplanar;
-									 j = j->next_on_vertex()) {
+			if (!collinear && !coplanar)
+				strict_points.push_back(p);
+		}
 
-									Hull_kernel::Point_3 const& r = j->opposite()->vertex()->point();
-									if (CGAL::collinear(p,q,r)) {
-										collinear = true;
-									}
-								}
+		result.clear();
+		CGAL::convex_hull_3(strict_points.begin(), strict_points.end(), result);
 
-								h = h->next_on_vertex();
-							} while (h != e && !collinear);
+		t.stop();
+		PRINTDB("Minkowski: Computing convex hull took %f s", t.time());
+		return true;
+	}
 
-							if (!collinear && !coplanar)
-								strict_points.push_back(p);
-						}
+/*!
+	Unites the convex parts of a Minkowski sum. Parts are grouped by
+	bounding box, so only overlapping parts go through Nef unions, and the
+	disjoint groups are concatenated.
+*/
+	static Geometry *unionMinkowskiParts(const Geometry::Geometries &parts)
+	{
+		CGAL::Timer t;
+		t.start();
+		PRINTDB("Minkowski: Computing union of %d parts", parts.size());
+		const std::vector<Geometry::Geometries> groups = groupByBoundingBox(parts);
+		PRINTDB("Minkowski: %d disjoint groups", groups.size());
+
+		std::vector<shared_ptr<const Geometry>> results;
+		for (const auto &g : groups) {
+			if (g.size() == 1) {
+				results.push_back(g.front().second);
+				continue;
+			}
+			Geometry::Geometries nefs;
+			for(const auto &item : g) {
+				const PolySet *ps = static_cast<const PolySet *>(item.second.get());
+				nefs.push_back(std::make_pair(item.first, shared_ptr<const Geometry>(createNefPolyhedronFromGeometry(*ps))));
+			}
+			CGAL_Nef_polyhedron *N = CGALUtils::applyOperator(nefs, OPENSCAD_UNION);
+			// FIXME: This hould really never throw.
+			// Assert once we figured out what went wrong with issue #1069?
+			if (!N) throw 0;
+			results.push_back(shared_ptr<const Geometry>(N));
+		}
 
-						result.clear();
-						CGAL::convex_hull_3(strict_points.begin(), strict_points.end(), result);
+		Geometry *result;
+		if (results.size() == 1) {
+			result = results.front()->copy();
+		}
+		else {
+			PolySet *ps = new PolySet(3);
+			for(const auto &geom : results) {
+				if (const PolySet *chps = dynamic_cast<const PolySet *>(geom.get())) {
+					ps->append(*chps);
+				}
+				else if (const CGAL_Nef_polyhedron *N = dynamic_cast<const CGAL_Nef_polyhedron *>(geom.get())) {
+					PolySet chps(3);
+					if (createPolySetFromNefPolyhedron3(*N->p3, chps)) {
+						PRINT("ERROR: Nef->PolySet failed");
+					}
+					ps->append(chps);
+				}
+			}
+			result = ps;
+		}
+		t.stop();
+		PRINTDB("Minkowski: Union done: %f s",t.time());
+		return result;
+	}
 
+	/*!
+		children cannot contain NULL objects.
+		If \a tree is given, the convex decompositions of the children are
+		cached by their subtree id.
+	*/
+	Geometry const * applyMinkowski(const Geometry::Geometries &children, const Tree *tree)
+	{
+		MemoryAccounting::Scope memoryscope(MemoryAccounting::CGAL);
+		CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
+		CGAL::Timer t_tot;
+		assert(children.size() >= 2);
+		Geometry::Geometries::const_iterator it = children.begin();
+		t_tot.start();
+		Geometry const* operands[2] = {it->second.get(), NULL};
+		auto key = [tree](const Geometry::GeometryItem &item) {
+			return tree && item.first ? tree->getIdString(*item.first) : std::string();
+		};
+		std::string key0 = key(*it);
+		try {
+			while (++it != children.end()) {
+				operands[1] = it->second.get();
 
-						t.stop();
-						PRINTDB("Minkowski: Computing convex hull took %f s", t.time());
-						t.reset();
+				shared_ptr<const ConvexParts> P[2];
+				P[0] = getConvexParts(operands[0], key0);
+				P[1] = getConvexParts(operands[1], key(*it));
+				// Intermediate results have no id
+				key0.clear();
+
+				// Hull all pairs of parts, in parallel if enabled
+				const size_t numpairs = P[0]->size() * P[1]->size();
+				std::vector<CGAL::Polyhedron_3<Hull_kernel>> hulls(numpairs);
+				std::vector<char> valid(numpairs, 0);
+				auto hullPair = [&P, &hulls, &valid](size_t k) {
+					ThrowOnError guard;
+					const size_t n = P[1]->size();
+					valid[k] = hullMinkowskiPair((*P[0])[k / n], (*P[1])[k % n], hulls[k]);
+				};
+				if (numpairs > 1 && Feature::ExperimentalParallelEvaluation.is_enabled()) {
+					ThreadPool *pool = ThreadPool::instance();
+					ThreadPool::TaskGroup group;
+					for (size_t k=0;k<numpairs;k++) pool->run(group, [&hullPair, k]() { hullPair(k); });
+					pool->wait(group);
+				}
+				else {
+					for (size_t k=0;k<numpairs;k++) hullPair(k);
+				}
 
-						result_parts.push_back(result);
-					}
+				Geometry::Geometries result_parts;
+				for (size_t k=0;k<numpairs;k++) {
+					if (!valid[k]) continue;
+					PolySet *ps = new PolySet(3,true);
+					createPolySetFromPolyhedron(hulls[k], *ps);
+					result_parts.push_back(std::make_pair((const AbstractNode*)NULL, shared_ptr<const Geometry>(ps)));
 				}
 
 				if (it != boost::next(children.begin()))
 					delete operands[0];
 
 				if (result_parts.size() == 1) {
-					PolySet *ps = new PolySet(3,true);
-					createPolySetFromPolyhedron(*result_parts.begin(), *ps);
-					operands[0] = ps;
+					operands[0] = result_parts.front().second->copy();
 				} else if (!result_parts.empty()) {
-					t.start();
-					PRINTDB("Minkowski: Computing union of %d parts",result_parts.size());
-					Geometry::Geometries fake_children;
-					for (std::list<CGAL::Polyhedron_3<Hull_kernel>>::iterator i = result_parts.begin(); i != result_parts.end(); ++i) {
-						PolySet ps(3,true);
-						createPolySetFromPolyhedron(*i, ps);
-						fake_children.push_back(std::make_pair((const AbstractNode*)NULL,
-															   shared_ptr<const Geometry>(createNefPolyhedronFromGeometry(ps))));
-					}
-					CGAL_Nef_polyhedron *N = CGALUtils::applyOperator(fake_children, OPENSCAD_UNION);
-					// FIXME: This hould really never throw.
-					// Assert once we figured out what went wrong with issue #1069?
-					if (!N) throw 0;
-					t.stop();
-					PRINTDB("Minkowski: Union done: %f s",t.time());
-					t.reset();
-					operands[0] = N;
+					operands[0] = unionMinkowskiParts(result_parts);
 				} else {
                     operands[0] = new CGAL_Nef_polyhedron();
 				}
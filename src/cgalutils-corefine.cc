@@ -0,0 +1,153 @@
+// this file is split into many separate cgalutils* files
+// in order to workaround gcc 4.9.1 crashing on systems with only 2GB of RAM
+
+#ifdef ENABLE_CGAL
+
+#include "cgalutils.h"
+#include "polyset.h"
+#include "polyset-utils.h"
+#include "printutils.h"
+#include "grid.h"
+#include "MemoryAccounting.h"
+
+#include <CGAL/version.h>
+#include <algorithm>
+
+#if CGAL_VERSION_NR >= CGAL_VERSION_NUMBER(4,10,0)
+#include <CGAL/Exact_predicates_exact_constructions_kernel.h>
+#include <CGAL/Surface_mesh.h>
+#include <CGAL/Polygon_mesh_processing/corefinement.h>
+#include <CGAL/Polygon_mesh_processing/orient_polygon_soup.h>
+#include <CGAL/Polygon_mesh_processing/polygon_soup_to_polygon_mesh.h>
+#include <CGAL/Polygon_mesh_processing/self_intersections.h>
+#include <CGAL/Polygon_mesh_processing/orientation.h>
+
+namespace PMP = CGAL::Polygon_mesh_processing;
+
+namespace /* anonymous */ {
+	typedef CGAL::Epeck KernelE;
+	typedef CGAL::Surface_mesh<KernelE::Point_3> CorefinementMesh;
+
+	/*
+		Builds a closed triangle mesh from the PolySet. Returns false if the
+		PolySet isn't a closed, non-self-intersecting surface, which
+		corefinement can't handle.
+	*/
+	bool createMesh(const PolySet &ps, CorefinementMesh &mesh)
+	{
+		PolySet tris(3);
+		PolysetUtils::tessellate_faces(ps, tris);
+
+		VertexWelder welder(GRID_FINE, tris.numVertices());
+		const std::vector<int> gridindex = welder.weld(tris.getVertices());
+		std::vector<KernelE::Point_3> points;
+		points.reserve(welder.size());
+		for (size_t i=0;i<welder.size();i++) {
+			const Vector3d v = welder.vertex(i);
+			points.push_back(KernelE::Point_3(v[0], v[1], v[2]));
+		}
+		std::vector<std::vector<size_t>> faces;
+		for(const auto &poly : tris.faces()) {
+			std::vector<size_t> face;
+			for (size_t i=0;i<poly.size();i++) {
+				const size_t idx = gridindex[poly.index(i)];
+				if (std::find(face.begin(), face.end(), idx) == face.end()) face.push_back(idx);
+			}
+			if (face.size() == 3) faces.push_back(face);
+		}
+		if (!PMP::orient_polygon_soup(points, faces)) return false;
+		PMP::polygon_soup_to_polygon_mesh(points, faces, mesh);
+		if (!CGAL::is_closed(mesh) || PMP::does_self_intersect(mesh)) return false;
+		if (!PMP::is_outward_oriented(mesh)) PMP::reverse_face_orientations(mesh);
+		return true;
+	}
+
+	void createPolySet(const CorefinementMesh &mesh, PolySet &ps)
+	{
+		for(const auto &f : mesh.faces()) {
+			ps.append_poly();
+			for(const auto &v : CGAL::vertices_around_face(mesh.halfedge(f), mesh)) {
+				const KernelE::Point_3 &p = mesh.point(v);
+				ps.append_vertex(CGAL::to_double(p.x()), CGAL::to_double(p.y()), CGAL::to_double(p.z()));
+			}
+		}
+	}
+}
+
+namespace CGALUtils {
+
+/*!
+	Applies a Boolean operation by corefinement of triangle meshes, using a
+	lazily exact kernel instead of Nef polyhedra.
+
+	Returns NULL if any child isn't a PolySet forming a closed surface, or
+	if CGAL fails, so the caller can fall back to Nef polyhedra.
+*/
+	PolySet *applyOperatorCorefine(const Geometry::Geometries &children, OpenSCADOperator op)
+	{
+		MemoryAccounting::Scope memoryscope(MemoryAccounting::CGAL);
+		if (op != OPENSCAD_UNION && op != OPENSCAD_INTERSECTION && op != OPENSCAD_DIFFERENCE) return NULL;
+
+		CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
+		PolySet *result = NULL;
+		try {
+			CorefinementMesh mesh;
+			bool first = true;
+			bool empty = false;
+			for(const auto &item : children) {
+				const PolySet *ps = dynamic_cast<const PolySet *>(item.second.get());
+				if (!ps) throw std::exception();
+				if (ps->isEmpty()) {
+					// Intersecting with nothing, or subtracting from nothing, gives nothing
+					if (op == OPENSCAD_INTERSECTION || (op == OPENSCAD_DIFFERENCE && first)) empty = true;
+					if (empty) break;
+					continue;
+				}
+				CorefinementMesh operand;
+				if (!createMesh(*ps, operand)) throw std::exception();
+				if (first) {
+					mesh = operand;
+					first = false;
+					continue;
+				}
+				bool ok = false;
+				switch (op) {
+				case OPENSCAD_UNION:
+					ok = PMP::corefine_and_compute_union(mesh, operand, mesh);
+					break;
+				case OPENSCAD_INTERSECTION:
+					ok = PMP::corefine_and_compute_intersection(mesh, operand, mesh);
+					break;
+				case OPENSCAD_DIFFERENCE:
+					ok = PMP::corefine_and_compute_difference(mesh, operand, mesh);
+					break;
+				default:
+					break;
+				}
+				if (!ok) throw std::exception();
+				if (item.first) item.first->progress_report();
+			}
+			result = new PolySet(3);
+			if (!empty) createPolySet(mesh, *result);
+		}
+		catch (const std::exception &e) {
+			// Includes CGAL::Failure_exception; the caller uses Nef polyhedra instead
+			PRINTD("Corefinement not possible, using Nef polyhedra");
+		}
+		CGAL::set_error_behaviour(old_behaviour);
+		return result;
+	}
+}
+
+#else // CGAL < 4.10 has no corefinement
+
+namespace CGALUtils {
+	PolySet *applyOperatorCorefine(const Geometry::Geometries &, OpenSCADOperator)
+	{
+		return NULL;
+	}
+}
+
+#endif
+
+#endif /* ENABLE_CGAL */
@@ -43,30 +43,29 @@ namespace /* anonymous */ {
 		void operator()(HDS& hds) {
 			CGAL_Polybuilder B(hds, true);
 		
-			Grid3d<int> grid(GRID_FINE);
 			std::vector<CGALPoint> vertices;
 			std::vector<std::vector<size_t>> indices;
 
-			// Align all vertices to grid and build vertex array in vertices
-			for(const auto &p : ps.polygons) {
+			// Align all unique vertices to grid and build vertex array in vertices
+			VertexWelder welder(GRID_FINE, ps.numVertices());
+			const std::vector<int> gridindex = welder.weld(ps.getVertices());
+			vertices.reserve(welder.size());
+			for (size_t i=0;i<welder.size();i++) {
+				const Vector3d v = welder.vertex(i);
+				vertices.push_back(CGALPoint(v[0], v[1], v[2]));
+			}
+			indices.reserve(ps.numPolygons());
+			for(const auto &p : ps.faces()) {
 				indices.push_back(std::vector<size_t>());
 				indices.back().reserve(p.size());
-				for (auto v : boost::adaptors::reverse(p)) {
-					// align v to the grid; the CGALPoint will receive the aligned vertex
-					size_t idx = grid.align(v);
-					if (idx == vertices.size()) {
-						CGALPoint p(v[0], v[1], v[2]);
-						vertices.push_back(p);
-					}
-					indices.back().push_back(idx);
-				}
+				for (size_t i=p.size();i-->0;) indices.back().push_back(gridindex[p.index(i)]);
 			}
 
 #ifdef GEN_SURFACE_DEBUG
 			printf("polyhedron(faces=[");
 			int pidx = 0;
 #endif
-			B.begin_surface(vertices.size(), ps.polygons.size());
+			B.begin_surface(vertices.size(), ps.numPolygons());
 			for(const auto &p : vertices) {
 				B.add_vertex(p);
 			}
@@ -116,12 +115,12 @@ namespace /* anonymous */ {
 				std::vector<size_t> indices(3);
 
 				// Estimating same # of vertices as polygons (very rough)
-				B.begin_surface(ps.polygons.size(), ps.polygons.size());
+				B.begin_surface(ps.numPolygons(), ps.numPolygons());
 				int pidx = 0;
 #ifdef GEN_SURFACE_DEBUG
 				printf("polyhedron(faces=[");
 #endif
-				for(const auto &p : ps.polygons) {
+				for(const auto &p : ps.faces()) {
 #ifdef GEN_SURFACE_DEBUG
 					if (pidx++ > 0) printf(",");
 #endif
@@ -99,7 +99,6 @@ Notes on CGAL's Nef Polyhedron2:
 The class uses the 'visitor' pattern from the CGAL manual. See also
 http://www.cgal.org/Manual/latest/doc_html/cgal_manual/Nef_3/Chapter_main.html
 http://www.cgal.org/Manual/latest/doc_html/cgal_manual/Nef_3_ref/Class_Nef_polyhedron3.html
-OGL_helper.h
 */
 
 class ZRemover {
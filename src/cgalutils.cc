@@ -6,6 +6,7 @@
 #include "cgalutils.h"
 #include "polyset.h"
 #include "printutils.h"
+#include "OperationCounters.h"
 #include "Polygon2d.h"
 #include "polyset-utils.h"
 #include "grid.h"
@@ -26,36 +27,82 @@
 #include "convex_hull_3_bugfix.h"
 #endif
 
+#if CGAL_VERSION_NR >= CGAL_VERSION_NUMBER(4,10,0)
+#include <CGAL/Surface_mesh.h>
+#include <CGAL/boost/graph/helpers.h>
+#endif
+
 #include "svg.h"
 #include "Reindexer.h"
 #include "hash.h"
 #include "GeometryUtils.h"
+#include "feature.h"
+#include "ThreadPool.h"
+#include "MemoryAccounting.h"
 
 #include <map>
 #include <queue>
+#include <atomic>
+#include <chrono>
+#include <gmp.h>
+
+/*!
+	Builds a Nef polyhedron directly from a triangle mesh, without going
+	through a Polyhedron_3. Returns NULL if the mesh isn't a closed
+	manifold, in which case the caller should use the slower, more
+	forgiving construction.
+*/
+static CGAL_Nef_polyhedron3 *createNefPolyhedronFromClosedMesh(const PolySet &tris)
+{
+#if CGAL_VERSION_NR >= CGAL_VERSION_NUMBER(4,10,0)
+	std::vector<IndexedTriangle> triangles;
+	triangles.reserve(tris.numPolygons());
+	for(const auto &p : tris.faces()) {
+		if (p.size() != 3) return NULL;
+		const IndexedTriangle t(p.index(0), p.index(1), p.index(2));
+		if (t[0] == t[1] || t[1] == t[2] || t[2] == t[0]) return NULL;
+		triangles.push_back(t);
+	}
+	// Every edge must be matched by an opposite edge
+	if (triangles.empty() || GeometryUtils::findUnconnectedEdges(triangles) != 0) return NULL;
+
+	typedef CGAL::Surface_mesh<CGAL_Point_3> Mesh;
+	Mesh mesh;
+	std::vector<Mesh::Vertex_index> vertices;
+	vertices.reserve(tris.numVertices());
+	for(const auto &v : tris.getVertices()) {
+		vertices.push_back(mesh.add_vertex(vector_convert<CGAL_Point_3>(v)));
+	}
+	for(const auto &t : triangles) {
+		// add_face() rejects non-manifold edges and vertices
+		if (mesh.add_face(vertices[t[0]], vertices[t[1]], vertices[t[2]]) == Mesh::null_face()) return NULL;
+	}
+	if (!CGAL::is_closed(mesh)) return NULL;
+	return new CGAL_Nef_polyhedron3(mesh);
+#else
+	return NULL;
+#endif
+}
 
-static CGAL_Nef_polyhedron *createNefPolyhedronFromPolySet(const PolySet &ps)
+static CGAL_Nef_polyhedron *convertPolySet(const PolySet &ps, const char *&path)
 {
+	path = "empty";
 	if (ps.isEmpty()) return new CGAL_Nef_polyhedron();
 	assert(ps.getDimension() == 3);
 
-	// Since is_convex doesn't work well with non-planar faces,
-	// we tessellate the polyset before checking.
 	PolySet psq(ps);
 	psq.quantizeVertices();
-	PolySet ps_tri(3, psq.convexValue());
-	PolysetUtils::tessellate_faces(psq, ps_tri);
-	if (ps_tri.is_convex()) {
+	// Check the original, so the result is remembered by cached geometry
+	if (ps.is_convex()) {
+		path = "convex hull";
 		typedef CGAL::Epick K;
 		// Collect point cloud
 		// FIXME: Use unordered container (need hash)
 		// NB! CGAL's convex_hull_3() doesn't like std::set iterators, so we use a list
 		// instead.
 		std::list<K::Point_3> points;
-		for(const auto &poly : psq.polygons) {
-			for(const auto &p : poly) {
-				points.push_back(vector_convert<K::Point_3>(p));
-			}
+		for(const auto &p : psq.getVertices()) {
+			points.push_back(vector_convert<K::Point_3>(p));
 		}
 
 		if (points.size() <= 3) return new CGAL_Nef_polyhedron();;
@@ -71,6 +118,23 @@ static CGAL_Nef_polyhedron *createNefPolyhedronFromPolySet(const PolySet &ps)
 	CGAL_Nef_polyhedron3 *N = NULL;
 	bool plane_error = false;
 	CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
+	// Triangles are always planar, so a closed triangle mesh can skip the
+	// Polyhedron_3 and the nonplanar retry below. A tessellated copy isn't used
+	// here since tessellated faces have their vertices rounded to float.
+	try {
+		N = createNefPolyhedronFromClosedMesh(psq);
+	}
+	catch (const CGAL::Assertion_exception &e) {
+		PRINTDB("Direct Nef construction failed, falling back: %s", e.what());
+		N = NULL;
+	}
+	if (N) {
+		path = "closed mesh";
+		CGAL::set_error_behaviour(old_behaviour);
+		return new CGAL_Nef_polyhedron(N);
+	}
+
+	path = "polyhedron";
 	try {
 		CGAL_Polyhedron P;
 		bool err = CGALUtils::createPolyhedronFromPolySet(psq, P);
@@ -91,6 +155,9 @@ static CGAL_Nef_polyhedron *createNefPolyhedronFromPolySet(const PolySet &ps)
 		}
 	}
 	if (plane_error) try {
+			path = "tessellated polyhedron";
+			PolySet ps_tri(3);
+			PolysetUtils::tessellate_faces(psq, ps_tri);
 			CGAL_Polyhedron P;
 			bool err = CGALUtils::createPolyhedronFromPolySet(ps_tri, P);
             if (!err) {
@@ -106,6 +173,17 @@ static CGAL_Nef_polyhedron *createNefPolyhedronFromPolySet(const PolySet &ps)
 	return new CGAL_Nef_polyhedron(N);
 }
 
+static CGAL_Nef_polyhedron *createNefPolyhedronFromPolySet(const PolySet &ps)
+{
+	OperationCounters::count(OperationCounters::POLYSET_TO_NEF);
+	const auto start = std::chrono::steady_clock::now();
+	const char *path = NULL;
+	CGAL_Nef_polyhedron *N = convertPolySet(ps, path);
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	PRINTDB("PolySet->Nef conversion of %d polygons (%s): %.3f s", ps.numPolygons() % path % seconds);
+	return N;
+}
+
 static CGAL_Nef_polyhedron *createNefPolyhedronFromPolygon2d(const Polygon2d &polygon)
 {
 	shared_ptr<PolySet> ps(polygon.tessellate());
@@ -167,16 +245,16 @@ namespace CGALUtils {
 		typedef std::pair<Vector3d,Vector3d> Edge;
 		typedef std::map<Edge, int, VecPairCompare> Edge_to_facet_map;
 		Edge_to_facet_map edge_to_facet_map;
-		std::vector<Plane> facet_planes; facet_planes.reserve(ps.polygons.size());
+		std::vector<Plane> facet_planes; facet_planes.reserve(ps.numPolygons());
 
-		for (size_t i = 0; i < ps.polygons.size(); i++) {
+		for (size_t i = 0; i < ps.numPolygons(); i++) {
 			Plane plane;
-			size_t N = ps.polygons[i].size();
+			size_t N = ps.face(i).size();
 			if (N >= 3) {
 				std::vector<Point> v(N);
 				for (size_t j = 0; j < N; j++) {
-					v[j] = vector_convert<Point>(ps.polygons[i][j]);
-					Edge edge(ps.polygons[i][j],ps.polygons[i][(j+1)%N]);
+					v[j] = vector_convert<Point>(ps.face(i)[j]);
+					Edge edge(ps.face(i)[j],ps.face(i)[(j+1)%N]);
 					if (edge_to_facet_map.count(edge)) return false; // edge already exists: nonmanifold
 					edge_to_facet_map[edge] = i;
 				}
@@ -187,18 +265,18 @@ namespace CGALUtils {
 			facet_planes.push_back(plane);
 		}
 
-		for (size_t i = 0; i < ps.polygons.size(); i++) {
-			size_t N = ps.polygons[i].size();
+		for (size_t i = 0; i < ps.numPolygons(); i++) {
+			size_t N = ps.face(i).size();
 			if (N < 3) continue;
 			for (size_t j = 0; j < N; j++) {
-				Edge other_edge(ps.polygons[i][(j+1)%N], ps.polygons[i][j]);
+				Edge other_edge(ps.face(i)[(j+1)%N], ps.face(i)[j]);
 				if (edge_to_facet_map.count(other_edge) == 0) return false;//
 				//Edge_to_facet_map::const_iterator it = edge_to_facet_map.find(other_edge);
 				//if (it == edge_to_facet_map.end()) return false; // not a closed manifold
 				//int other_facet = it->second;
 				int other_facet = edge_to_facet_map[other_edge];
 
-				Point p = vector_convert<Point>(ps.polygons[i][(j+2)%N]);
+				Point p = vector_convert<Point>(ps.face(i)[(j+2)%N]);
 
 				if (facet_planes[other_facet].has_on_positive_side(p)) {
 					// Check angle
@@ -221,9 +299,9 @@ namespace CGALUtils {
 		while(!facets_to_visit.empty()) {
 			int f = facets_to_visit.front(); facets_to_visit.pop();
 
-			for (size_t i = 0; i < ps.polygons[f].size(); i++) {
-				int j = (i+1) % ps.polygons[f].size();
-				Edge_to_facet_map::iterator it = edge_to_facet_map.find(Edge(ps.polygons[f][j], ps.polygons[f][i]));
+			for (size_t i = 0; i < ps.face(f).size(); i++) {
+				int j = (i+1) % ps.face(f).size();
+				Edge_to_facet_map::iterator it = edge_to_facet_map.find(Edge(ps.face(f)[j], ps.face(f)[i]));
 				if (it == edge_to_facet_map.end()) return false; // Nonmanifold
 				if (!explored_facets.count(it->second)) {
 					explored_facets.insert(it->second);
@@ -233,12 +311,13 @@ namespace CGALUtils {
 		}
 
 		// Make sure that we were able to reach all polygons during our visit
-		return explored_facets.size() == ps.polygons.size();
+		return explored_facets.size() == ps.numPolygons();
 	}
 
 
 	CGAL_Nef_polyhedron *createNefPolyhedronFromGeometry(const Geometry &geom)
 	{
+		MemoryAccounting::Scope memoryscope(MemoryAccounting::CGAL);
 		const PolySet *ps = dynamic_cast<const PolySet*>(&geom);
 		if (ps) {
 			return createNefPolyhedronFromPolySet(*ps);
@@ -251,6 +330,91 @@ namespace CGALUtils {
 		return NULL;
 	}
 
+/*!
+	Adds the cycles of a Nef facet to faces, the first being the outline
+	and the others holes. Vertices are indexed as floats in vertices.
+	Nothing is added for facets of the empty volume.
+*/
+	static void getFacetCycles(CGAL_Nef_polyhedron3::Halffacet_const_handle hfaceti,
+														 Reindexer<Vector3f> &vertices, std::vector<IndexedFace> &faces)
+	{
+		// the 0-mark-volume is the 'empty' volume of space. skip it.
+		if (hfaceti->incident_volume()->mark()) return;
+		// Since we're downscaling to float, vertices might merge during this conversion.
+		// To avoid passing equal vertices to the tessellator, we remove consecutively identical
+		// vertices.
+		CGAL_Nef_polyhedron3::Halffacet_cycle_const_iterator cyclei;
+		CGAL_forall_facet_cycles_of(cyclei, hfaceti) {
+			CGAL_Nef_polyhedron3::SHalfedge_around_facet_const_circulator c1(cyclei);
+			CGAL_Nef_polyhedron3::SHalfedge_around_facet_const_circulator c2(c1);
+			faces.push_back(IndexedFace());
+			IndexedFace &currface = faces.back();
+			CGAL_For_all(c1, c2) {
+				CGAL_Point_3 p = c1->source()->center_vertex()->point();
+				// Create vertex indices and remove consecutive duplicate vertices
+				int idx = vertices.lookup(vector_convert<Vector3f>(p));
+				if (currface.empty() || idx != currface.back()) currface.push_back(idx);
+			}
+			if (!currface.empty() && currface.front() == currface.back()) currface.pop_back();
+			if (currface.size() < 3) faces.pop_back(); // Cull empty triangles
+		}
+	}
+
+/*!
+	Triangulates a facet given as its outline and holes. On error, no
+	triangles are added.
+*/
+	static void triangulateFacet(const Vector3f *verts, const std::vector<IndexedFace> &faces,
+															 std::vector<IndexedTriangle> &triangles)
+	{
+		if (faces.size() == 1 && GeometryUtils::isStrictlyConvex(verts, faces[0])) {
+			const IndexedFace &face = faces[0];
+			for (size_t i=1;i+1<face.size();i++) {
+				triangles.push_back(IndexedTriangle(face[0], face[i], face[i+1]));
+			}
+			return;
+		}
+
+		/* at this stage, we have a sequence of polygons. the first
+			 is the "outside edge' or 'body' or 'border', and the rest of the
+			 polygons are 'holes' within the first. there are several
+			 options here to get rid of the holes. we choose to go ahead
+			 and let the tessellater deal with the holes, and then
+			 just output the resulting 3d triangles*/
+
+		// We cannot trust the plane from Nef polyhedron to be correct.
+		// Passing an incorrect normal vector can cause a crash in the constrained delaunay triangulator
+		// See http://cgal-discuss.949826.n4.nabble.com/Nef3-Wrong-normal-vector-reported-causes-triangulator-crash-tt4660282.html
+		// CGAL::Vector_3<CGAL_Kernel3> nvec = plane.orthogonal_vector();
+		// K::Vector_3 normal(CGAL::to_double(nvec.x()), CGAL::to_double(nvec.y()), CGAL::to_double(nvec.z()));
+		bool err = GeometryUtils::tessellatePolygonWithHoles(verts, faces, triangles, NULL);
+		if (err) triangles.clear();
+	}
+
+/*!
+	Triangulates the facets of a Nef polyhedron one at a time and passes
+	the triangles to sink, in the same order and with the same vertices as
+	createPolySetFromNefPolyhedron3(). Unlike it, no mesh is built, so
+	exporters can stream large results without holding a copy, but the
+	mesh is not checked for manifoldness.
+*/
+	void tessellateNefPolyhedron3(const CGAL_Nef_polyhedron3 &N, const TriangleSink &sink)
+	{
+		CGAL_Nef_polyhedron3::Halffacet_const_iterator hfaceti;
+		CGAL_forall_halffacets(hfaceti, N) {
+			Reindexer<Vector3f> facetVertices;
+			std::vector<IndexedFace> faces;
+			getFacetCycles(hfaceti, facetVertices, faces);
+			if (faces.empty()) continue;
+			const Vector3f *verts = facetVertices.getArray();
+			std::vector<IndexedTriangle> triangles;
+			triangulateFacet(verts, faces, triangles);
+			for(const auto &t : triangles) {
+				sink(verts[t[0]].cast<double>(), verts[t[1]].cast<double>(), verts[t[2]].cast<double>());
+			}
+		}
+	}
+
 /*
 	Create a PolySet from a Nef Polyhedron 3. return false on success, 
 	true on failure. The trick to this is that Nef Polyhedron3 faces have 
@@ -261,6 +425,7 @@ namespace CGALUtils {
 #if 1
 	bool createPolySetFromNefPolyhedron3(const CGAL_Nef_polyhedron3 &N, PolySet &ps)
 	{
+		OperationCounters::count(OperationCounters::NEF_TO_POLYSET);
 		// 1. Build Indexed PolyMesh
 		// 2. Validate mesh (manifoldness)
 		// 3. Triangulate each face
@@ -276,31 +441,9 @@ namespace CGALUtils {
 
 		CGAL_Nef_polyhedron3::Halffacet_const_iterator hfaceti;
 		CGAL_forall_halffacets(hfaceti, N) {
-			CGAL::Plane_3<CGAL_Kernel3> plane(hfaceti->plane());
-			// Since we're downscaling to float, vertices might merge during this conversion.
-			// To avoid passing equal vertices to the tessellator, we remove consecutively identical
-			// vertices.
 			polygons.push_back(std::vector<IndexedFace>());
-			std::vector<IndexedFace> &faces = polygons.back();
-			// the 0-mark-volume is the 'empty' volume of space. skip it.
-			if (!hfaceti->incident_volume()->mark()) {
-				CGAL_Nef_polyhedron3::Halffacet_cycle_const_iterator cyclei;
-				CGAL_forall_facet_cycles_of(cyclei, hfaceti) {
-					CGAL_Nef_polyhedron3::SHalfedge_around_facet_const_circulator c1(cyclei);
-					CGAL_Nef_polyhedron3::SHalfedge_around_facet_const_circulator c2(c1);
-					faces.push_back(IndexedFace());
-					IndexedFace &currface = faces.back();
-					CGAL_For_all(c1, c2) {
-						CGAL_Point_3 p = c1->source()->center_vertex()->point();
-						// Create vertex indices and remove consecutive duplicate vertices
-						int idx = allVertices.lookup(vector_convert<Vector3f>(p));
-						if (currface.empty() || idx != currface.back()) currface.push_back(idx);
-					}
-					if (!currface.empty() && currface.front() == currface.back()) currface.pop_back();
-					if (currface.size() < 3) faces.pop_back(); // Cull empty triangles
-				}
-			}
-			if (faces.empty()) polygons.pop_back(); // Cull empty faces
+			getFacetCycles(hfaceti, allVertices, polygons.back());
+			if (polygons.back().empty()) polygons.pop_back(); // Cull empty faces
 		}
 
 		// 2. Validate mesh (manifoldness)
@@ -309,56 +452,38 @@ namespace CGALUtils {
 			PRINTB("Error: Non-manifold mesh encountered: %d unconnected edges", unconnected);
 		}
 		// 3. Triangulate each face
+		// Simple faces (convex, without holes) are fan-triangulated directly;
+		// only the others go through the tessellator. Faces are triangulated
+		// in batches on the thread pool when parallel evaluation is enabled.
 		const Vector3f *verts = allVertices.getArray();
-		std::vector<IndexedTriangle> allTriangles;
-		for(const auto &faces : polygons) {
-#if 0 // For debugging
-			std::cerr << "---\n";
-			for(const auto &poly : faces) {
-				for(auto i : poly) {
-					std::cerr << i << " ";
-				}
-				std::cerr << "\n";
-			}
-#if 0 // debug
-			std::cerr.precision(20);
-			for(const auto &poly : faces) {
-				for(auto i : poly) {
-					std::cerr << verts[i][0] << "," << verts[i][1] << "," << verts[i][2] << "\n";
-				}
-				std::cerr << "\n";
+		std::vector<std::vector<IndexedTriangle>> facetriangles(polygons.size());
+		auto triangulate = [&polygons, &facetriangles, verts](size_t f) {
+			triangulateFacet(verts, polygons[f], facetriangles[f]);
+		};
+
+		const size_t batchsize = 500;
+		if (polygons.size() > batchsize && Feature::ExperimentalParallelEvaluation.is_enabled()) {
+			ThreadPool *pool = ThreadPool::instance();
+			ThreadPool::TaskGroup group;
+			for (size_t start=0;start<polygons.size();start+=batchsize) {
+				const size_t end = std::min(polygons.size(), start + batchsize);
+				pool->run(group, [&triangulate, start, end]() {
+						for (size_t f=start;f<end;f++) triangulate(f);
+					});
 			}
-#endif // debug
-			std::cerr << "-\n";
-#endif // debug
-#if 0 // For debugging
-		std::cerr.precision(20);
-		for (size_t i=0;i<allVertices.size();i++) {
-			std::cerr << verts[i][0] << ", " << verts[i][1] << ", " << verts[i][2] << "\n";
-		}		
-#endif // debug
-
-			/* at this stage, we have a sequence of polygons. the first
-				 is the "outside edge' or 'body' or 'border', and the rest of the
-				 polygons are 'holes' within the first. there are several
-				 options here to get rid of the holes. we choose to go ahead
-				 and let the tessellater deal with the holes, and then
-				 just output the resulting 3d triangles*/
+			pool->wait(group);
+		}
+		else {
+			for (size_t f=0;f<polygons.size();f++) triangulate(f);
+		}
 
-			// We cannot trust the plane from Nef polyhedron to be correct.
-			// Passing an incorrect normal vector can cause a crash in the constrained delaunay triangulator
-			// See http://cgal-discuss.949826.n4.nabble.com/Nef3-Wrong-normal-vector-reported-causes-triangulator-crash-tt4660282.html
-			// CGAL::Vector_3<CGAL_Kernel3> nvec = plane.orthogonal_vector();
-			// K::Vector_3 normal(CGAL::to_double(nvec.x()), CGAL::to_double(nvec.y()), CGAL::to_double(nvec.z()));
-			std::vector<IndexedTriangle> triangles;
-			bool err = GeometryUtils::tessellatePolygonWithHoles(verts, faces, triangles, NULL);
-			if (!err) {
-				for(const auto &t : triangles) {
-					assert(t[0] >= 0 && t[0] < (int)allVertices.size());
-					assert(t[1] >= 0 && t[1] < (int)allVertices.size());
-					assert(t[2] >= 0 && t[2] < (int)allVertices.size());
-					allTriangles.push_back(t);
-				}
+		std::vector<IndexedTriangle> allTriangles;
+		for(const auto &triangles : facetriangles) {
+			for(const auto &t : triangles) {
+				assert(t[0] >= 0 && t[0] < (int)allVertices.size());
+				assert(t[1] >= 0 && t[1] < (int)allVertices.size());
+				assert(t[2] >= 0 && t[2] < (int)allVertices.size());
+				allTriangles.push_back(t);
 			}
 		}
 
@@ -688,6 +813,45 @@ namespace CGALUtils {
 	}
 #endif // createPolySetFromNefPolyhedron3
 
+/*
+	GMP allocation hooks, used to measure the heap actually held by exact
+	numbers. These forward to the C allocator, so blocks allocated before
+	tracking was enabled can safely be freed afterwards.
+*/
+	static std::atomic<long long> gmp_bytes_in_use(0);
+
+	static void *gmp_tracked_alloc(size_t size)
+	{
+		gmp_bytes_in_use += size;
+		return malloc(size);
+	}
+
+	static void *gmp_tracked_realloc(void *ptr, size_t old_size, size_t new_size)
+	{
+		gmp_bytes_in_use += (long long)new_size - (long long)old_size;
+		return realloc(ptr, new_size);
+	}
+
+	static void gmp_tracked_free(void *ptr, size_t size)
+	{
+		gmp_bytes_in_use -= size;
+		free(ptr);
+	}
+
+	/*!
+		Installs allocation hooks counting the heap used by GMP numbers.
+		Should be called before any exact number is created.
+	*/
+	void enableGmpMemoryTracking()
+	{
+		mp_set_memory_functions(gmp_tracked_alloc, gmp_tracked_realloc, gmp_tracked_free);
+	}
+
+	size_t gmpMemoryInUse()
+	{
+		long long bytes = gmp_bytes_in_use;
+		return bytes > 0 ? size_t(bytes) : 0;
+	}
 
 }; // namespace CGALUtils
 
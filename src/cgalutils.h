@@ -21,12 +21,14 @@ namespace /* anonymous */ {
 namespace CGALUtils {
 	bool applyHull(const Geometry::Geometries &children, PolySet &P);
 	CGAL_Nef_polyhedron *applyOperator(const Geometry::Geometries &children, OpenSCADOperator op);
+	PolySet *applyOperatorCorefine(const Geometry::Geometries &children, OpenSCADOperator op);
 	//FIXME: Old, can be removed:
 	//void applyBinaryOperator(CGAL_Nef_polyhedron &target, const CGAL_Nef_polyhedron &src, OpenSCADOperator op);
 	Polygon2d *project(const CGAL_Nef_polyhedron &N, bool cut);
 	CGAL_Iso_cuboid_3 boundingBox(const CGAL_Nef_polyhedron3 &N);
 	bool is_approximately_convex(const PolySet &ps);
-	Geometry const* applyMinkowski(const Geometry::Geometries &children);
+	Geometry const* applyMinkowski(const Geometry::Geometries &children, const class Tree *tree = NULL);
+	std::vector<Geometry::Geometries> groupByBoundingBox(const Geometry::Geometries &children);
 
 	template <typename Polyhedron> std::string printPolyhedron(const Polyhedron &p);
 	template <typename Polyhedron> bool createPolySetFromPolyhedron(const Polyhedron &p, PolySet &ps);
@@ -36,6 +38,10 @@ namespace CGALUtils {
 
 	CGAL_Nef_polyhedron *createNefPolyhedronFromGeometry(const class Geometry &geom);
 	bool createPolySetFromNefPolyhedron3(const CGAL_Nef_polyhedron3 &N, PolySet &ps);
+	void tessellateNefPolyhedron3(const CGAL_Nef_polyhedron3 &N, const TriangleSink &sink);
+
+	void enableGmpMemoryTracking();
+	size_t gmpMemoryInUse();
 
 	bool tessellatePolygon(const PolygonK &polygon,
 												 Polygons &triangles,
@@ -1,28 +1,48 @@
 #include "cgalworker.h"
-#include <QThread>
 
 #include "Tree.h"
 #include "GeometryEvaluator.h"
+#include "CGAL_Nef_polyhedron.h"
+#include "cgalutils.h"
+#include "polyset.h"
+#include "CGALRenderer.h"
 #include "progress.h"
 #include "printutils.h"
+#include "ThreadPool.h"
 
-CGALWorker::CGALWorker()
+CGALWorker::CGALWorker() : renderer(NULL), running(false)
 {
-	this->thread = new QThread();
-	if (this->thread->stackSize() < 1024*1024) this->thread->setStackSize(1024*1024);
-	connect(this->thread, SIGNAL(started()), this, SLOT(work()));
-	moveToThread(this->thread);
 }
 
 CGALWorker::~CGALWorker()
 {
-	delete this->thread;
+	if (!this->group.isDone()) ThreadPool::instance()->wait(this->group);
+	delete this->renderer;
+}
+
+bool CGALWorker::isRunning() const
+{
+	return this->running;
+}
+
+/*!
+	Returns the renderer for the last result, which the caller then owns,
+	or NULL if there was no result.
+*/
+CGALRenderer *CGALWorker::takeRenderer()
+{
+	CGALRenderer *renderer = this->renderer;
+	this->renderer = NULL;
+	return renderer;
 }
 
 void CGALWorker::start(const Tree &tree)
 {
+	delete this->renderer;
+	this->renderer = NULL;
 	this->tree = &tree;
-	this->thread->start();
+	this->running = true;
+	ThreadPool::instance()->run(this->group, [this]() { work(); });
 }
 
 void CGALWorker::work()
@@ -30,12 +50,27 @@ void CGALWorker::work()
 	shared_ptr<const Geometry> root_geom;
 	try {
 		GeometryEvaluator evaluator(*this->tree);
+		// Stream finished top-level objects as meshes, so they can be shown
+		// before the whole design is done
+		if (this->tree->root()->children.size() > 1) {
+			evaluator.setResultCallback([this](const AbstractNode &, const shared_ptr<const Geometry> &geom) {
+					if (!geom || geom->isEmpty() || geom->getDimension() != 3) return;
+					shared_ptr<const Geometry> mesh = geom;
+					if (const CGAL_Nef_polyhedron *N = dynamic_cast<const CGAL_Nef_polyhedron *>(geom.get())) {
+						PolySet *ps = new PolySet(3);
+						mesh.reset(ps);
+						if (CGALUtils::createPolySetFromNefPolyhedron3(*N->p3, *ps)) return;
+					}
+					emit partial(mesh);
+				});
+		}
 		root_geom = evaluator.evaluateGeometry(*this->tree->root(), true);
+		if (root_geom) this->renderer = new CGALRenderer(root_geom);
 	}
 	catch (const ProgressCancelException &e) {
 		PRINT("Rendering cancelled.");
 	}
 
+	this->running = false;
 	emit done(root_geom);
-	thread->quit();
 }
@@ -1,8 +1,14 @@
 #pragma once
 
 #include <QObject>
+#include <atomic>
 #include "memory.h"
+#include "ThreadPool.h"
 
+/*!
+	Evaluates the geometry of a tree as a task on the shared ThreadPool, so
+	the GUI stays responsive while rendering.
+*/
 class CGALWorker : public QObject
 {
 	Q_OBJECT;
@@ -10,17 +16,23 @@ public:
 	CGALWorker();
 	virtual ~CGALWorker();
 
+	bool isRunning() const;
+	class CGALRenderer *takeRenderer();
+
 public slots:
 	void start(const class Tree &tree);
 
-protected slots:
+protected:
 	void work();
 
 signals:
+	void partial(shared_ptr<const class Geometry>);
 	void done(shared_ptr<const class Geometry>);
 
 protected:
-
-	class QThread *thread;
 	const class Tree *tree;
+	// Prepared for the result by the worker, so the GUI thread doesn't have to
+	class CGALRenderer *renderer;
+	std::atomic<bool> running;
+	ThreadPool::TaskGroup group;
 };
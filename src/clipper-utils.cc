@@ -1,5 +1,9 @@
 #include "clipper-utils.h"
+#include "polyset.h"
 #include "printutils.h"
+#include "OperationCounters.h"
+#include "feature.h"
+#include "ThreadPool.h"
 
 namespace ClipperUtils {
 
@@ -16,6 +20,7 @@ namespace ClipperUtils {
 	}
 
 	ClipperLib::Paths fromPolygon2d(const Polygon2d &poly) {
+		if (poly.clipperPaths()) return *poly.clipperPaths();
 		ClipperLib::Paths result;
 		for(const auto &outline : poly.outlines()) {
 			result.push_back(fromOutline2d(outline, poly.isSanitized() ? true : false));
@@ -39,6 +44,7 @@ namespace ClipperUtils {
                   // an exception of type char* rather than a clipperException()
 		  PRINT("WARNING: Range check failed for polygon. skipping");
 		}
+		OperationCounters::count(OperationCounters::CLIPPER_EXECUTIONS);
 		clipper.Execute(ClipperLib::ctUnion, result, ClipperLib::pftEvenOdd);
 		return result;
 	}
@@ -53,6 +59,7 @@ namespace ClipperUtils {
 		const double CLEANING_DISTANCE = 0.001 * CLIPPER_SCALE;
 
 		Polygon2d *result = new Polygon2d;
+		shared_ptr<ClipperLib::Paths> paths(new ClipperLib::Paths);
 		const ClipperLib::PolyNode *node = poly.GetFirst();
 		while (node) {
 			Outline2d outline;
@@ -70,11 +77,15 @@ namespace ClipperUtils {
 					outline.vertices.push_back(v);
 				}
 				result->addOutline(outline);
+				paths->push_back(cleaned_path);
 			}
 
 			node = node->GetNext();
 		}
 		result->setSanitized(true);
+		// The outlines convert back to exactly these paths, so keep them for
+		// the next operation
+		result->setClipperPaths(paths);
 		return result;
 	}
 
@@ -85,10 +96,33 @@ namespace ClipperUtils {
 		ClipperLib::Paths result;
 		ClipperLib::Clipper clipper;
 		clipper.AddPaths(polygons, ClipperLib::ptSubject, true);
+		OperationCounters::count(OperationCounters::CLIPPER_EXECUTIONS);
 		clipper.Execute(cliptype, result, polytype);
 		return result;
 	}
 
+	/*!
+		Unites \a outlines by the non-zero rule, keeping their orientation.
+		Returns NULL if they are out of Clipper's coordinate range.
+	*/
+	Polygon2d *uniteNonZero(const std::vector<Outline2d> &outlines)
+	{
+		ClipperLib::Paths paths;
+		for(const auto &outline : outlines) paths.push_back(fromOutline2d(outline, true));
+		ClipperLib::Clipper clipper;
+		try {
+			clipper.AddPaths(paths, ClipperLib::ptSubject, true);
+		}
+		catch(...) {
+			return NULL;
+		}
+		ClipperLib::PolyTree result;
+		clipper.StrictlySimple(true);
+		OperationCounters::count(OperationCounters::CLIPPER_EXECUTIONS);
+		clipper.Execute(ClipperLib::ctUnion, result, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
+		return toPolygon2d(result);
+	}
+
 	/*!
 		Apply the clipper operator to the given paths.
 
@@ -106,6 +140,7 @@ namespace ClipperUtils {
 			for (unsigned int i = 1; i < pathsvector.size(); i++) {
 				clipper.AddPaths(source, ClipperLib::ptSubject, true);
 				clipper.AddPaths(pathsvector[i], ClipperLib::ptClip, true);
+				OperationCounters::count(OperationCounters::CLIPPER_EXECUTIONS);
 				clipper.Execute(clipType, result, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
 				if (i != pathsvector.size()-1) {
                     ClipperLib::PolyTreeToPaths(result, source);
@@ -121,6 +156,7 @@ namespace ClipperUtils {
 			if (first) first = false;
 		}
 		ClipperLib::PolyTree sumresult;
+		OperationCounters::count(OperationCounters::CLIPPER_EXECUTIONS);
 		clipper.Execute(clipType, sumresult, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
 		// The returned result will have outlines ordered according to whether 
 		// they're positive or negative: Positive outlines counter-clockwise and 
@@ -216,10 +252,86 @@ namespace ClipperUtils {
 		}
 	}
 
+	/*!
+		Unites each set of paths, then unites the results by a balanced tree
+		of pairwise unions. Each level runs on the thread pool.
+	*/
+	ClipperLib::Paths unionTree(std::vector<ClipperLib::Paths> &level)
+	{
+		ThreadPool *pool = ThreadPool::instance();
+		ThreadPool::TaskGroup group;
+		for (size_t i=0;i<level.size();i++) {
+			pool->run(group, [&level, i]() {
+					level[i] = process(level[i], ClipperLib::ctUnion, ClipperLib::pftNonZero);
+				});
+		}
+		pool->wait(group);
+
+		while (level.size() > 1) {
+			std::vector<ClipperLib::Paths> next((level.size() + 1) / 2);
+			for (size_t i=0;i+1<level.size();i+=2) {
+				pool->run(group, [&level, &next, i]() {
+						ClipperLib::Clipper c;
+						c.AddPaths(level[i], ClipperLib::ptSubject, true);
+						c.AddPaths(level[i+1], ClipperLib::ptSubject, true);
+						OperationCounters::count(OperationCounters::CLIPPER_EXECUTIONS);
+						c.Execute(ClipperLib::ctUnion, next[i/2], ClipperLib::pftNonZero, ClipperLib::pftNonZero);
+					});
+			}
+			if (level.size() % 2) next.back().swap(level.back());
+			pool->wait(group);
+			level.swap(next);
+		}
+		return level.empty() ? ClipperLib::Paths() : level.front();
+	}
+
+	/*!
+		Parallel variant of applyMinkowski(). The band swept by each pair of
+		outlines and the filled insides are united separately before being
+		united with each other. Only complete bands are united, since
+		uniting parts of a band could open cracks between them.
+	*/
+	static Polygon2d *applyMinkowskiParallel(const std::vector<const Polygon2d*> &polygons)
+	{
+		ThreadPool *pool = ThreadPool::instance();
+		ClipperLib::Paths lhs = ClipperUtils::fromPolygon2d(*polygons[0]);
+
+		for (size_t i=1; i<polygons.size(); i++) {
+			const ClipperLib::Paths rhs = ClipperUtils::fromPolygon2d(*polygons[i]);
+
+			std::vector<ClipperLib::Paths> terms(lhs.size() * rhs.size() + 1);
+			ThreadPool::TaskGroup group;
+			for (size_t r=0;r<rhs.size();r++) {
+				for (size_t l=0;l<lhs.size();l++) {
+					ClipperLib::Paths &result = terms[r * lhs.size() + l];
+					pool->run(group, [&lhs, &rhs, &result, l, r]() {
+							minkowski_outline(lhs[l], rhs[r], result, true, true);
+						});
+				}
+			}
+			pool->wait(group);
+
+			fill_minkowski_insides(lhs, rhs, terms.back());
+			fill_minkowski_insides(rhs, lhs, terms.back());
+
+			lhs = unionTree(terms);
+		}
+
+		ClipperLib::Clipper c;
+		c.AddPaths(lhs, ClipperLib::ptSubject, true);
+		ClipperLib::PolyTree polytree;
+		OperationCounters::count(OperationCounters::CLIPPER_EXECUTIONS);
+		c.Execute(ClipperLib::ctUnion, polytree, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
+
+		return toPolygon2d(polytree);
+	}
+
 	Polygon2d *applyMinkowski(const std::vector<const Polygon2d*> &polygons)
 	{
 		if (polygons.size() == 1) return new Polygon2d(*polygons[0]); // Just copy
 
+		if (Feature::ExperimentalParallelEvaluation.is_enabled()) return applyMinkowskiParallel(polygons);
+
 		ClipperLib::Clipper c;
 		ClipperLib::Paths lhs = ClipperUtils::fromPolygon2d(*polygons[0]);
 
@@ -245,21 +357,100 @@ namespace ClipperUtils {
 			c.Clear();
 			c.AddPaths(minkowski_terms, ClipperLib::ptSubject, true);
 
-			if (i != polygons.size() - 1)
+			if (i != polygons.size() - 1) {
+				OperationCounters::count(OperationCounters::CLIPPER_EXECUTIONS);
 				c.Execute(ClipperLib::ctUnion, lhs, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
+			}
 		}
 
 		ClipperLib::PolyTree polytree;
+		OperationCounters::count(OperationCounters::CLIPPER_EXECUTIONS);
 		c.Execute(ClipperLib::ctUnion, polytree, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
 
 		return toPolygon2d(polytree);
 	}
 
+	/*!
+		Projects all polygons of a 3D PolySet (also back-facing) onto the XY
+		plane and unites them, without going through Nef polyhedra.
+		PolySet polygons are convex, so their projections are simple paths
+		and need no triangulation. Vertices are converted to Clipper
+		coordinates once. With parallel evaluation enabled, batches of
+		polygons are projected and united on the thread pool.
+	*/
+	ClipperLib::Paths project(const PolySet &ps)
+	{
+		std::vector<ClipperLib::IntPoint> points;
+		points.reserve(ps.numVertices());
+		for(const auto &v : ps.getVertices()) {
+			points.push_back(ClipperLib::IntPoint(v[0]*CLIPPER_SCALE, v[1]*CLIPPER_SCALE));
+		}
+
+		const size_t batchsize = 2000;
+		const size_t numpolygons = ps.numPolygons();
+		std::vector<ClipperLib::Paths> batches((numpolygons + batchsize - 1) / batchsize);
+		auto projectBatch = [&ps, &points, &batches, batchsize, numpolygons](size_t b) {
+			ClipperLib::Paths &paths = batches[b];
+			for (size_t f=b*batchsize;f<std::min(numpolygons, (b+1)*batchsize);f++) {
+				const PolySet::Face face = ps.face(f);
+				ClipperLib::Path path;
+				path.reserve(face.size());
+				for (size_t i=0;i<face.size();i++) path.push_back(points[face.index(i)]);
+				// Skip polygons seen edge-on
+				const double area = ClipperLib::Area(path);
+				if (area == 0) continue;
+				if (area < 0) ClipperLib::ReversePath(path);
+				paths.push_back(path);
+			}
+		};
+
+		if (batches.size() > 1 && Feature::ExperimentalParallelEvaluation.is_enabled()) {
+			ThreadPool *pool = ThreadPool::instance();
+			ThreadPool::TaskGroup group;
+			for (size_t b=0;b<batches.size();b++) pool->run(group, [&projectBatch, b]() { projectBatch(b); });
+			pool->wait(group);
+			return unionTree(batches);
+		}
+
+		ClipperLib::Paths paths;
+		for (size_t b=0;b<batches.size();b++) {
+			projectBatch(b);
+			paths.insert(paths.end(), batches[b].begin(), batches[b].end());
+		}
+		// Using NonZero ensures that we don't create holes from polygons sharing
+		// edges since we're unioning a mesh
+		return process(paths, ClipperLib::ctUnion, ClipperLib::pftNonZero);
+	}
+
 	Polygon2d *applyOffset(const Polygon2d& poly, double offset, ClipperLib::JoinType joinType, double miter_limit, double arc_tolerance) {
+		return applyOffset(fromPolygon2d(poly), offset, joinType, miter_limit, arc_tolerance);
+	}
+
+	Polygon2d *applyOffset(const ClipperLib::Paths &paths, double offset, ClipperLib::JoinType joinType, double miter_limit, double arc_tolerance) {
 		ClipperLib::ClipperOffset co(miter_limit, arc_tolerance * CLIPPER_SCALE);
-		co.AddPaths(fromPolygon2d(poly), joinType, ClipperLib::etClosedPolygon);
+		co.AddPaths(paths, joinType, ClipperLib::etClosedPolygon);
 		ClipperLib::PolyTree result;
+		OperationCounters::count(OperationCounters::CLIPPER_EXECUTIONS);
 		co.Execute(result, offset * CLIPPER_SCALE);
 		return toPolygon2d(result);
 	}
+
+	/*!
+		Splits \a tree into its islands: each outer contour with the holes
+		directly inside it. Islands inside holes are islands of their own.
+	*/
+	std::vector<ClipperLib::Paths> islands(const ClipperLib::PolyTree &tree) {
+		std::vector<ClipperLib::Paths> result;
+		std::vector<const ClipperLib::PolyNode *> outers(tree.Childs.begin(), tree.Childs.end());
+		while (!outers.empty()) {
+			const ClipperLib::PolyNode *outer = outers.back();
+			outers.pop_back();
+			result.push_back(ClipperLib::Paths(1, outer->Contour));
+			for(const auto hole : outer->Childs) {
+				result.back().push_back(hole->Contour);
+				outers.insert(outers.end(), hole->Childs.begin(), hole->Childs.end());
+			}
+		}
+		return result;
+	}
 };
@@ -12,10 +12,15 @@ namespace ClipperUtils {
 	ClipperLib::PolyTree sanitize(const ClipperLib::Paths &paths);
 	Polygon2d *sanitize(const Polygon2d &poly);
 	Polygon2d *toPolygon2d(const ClipperLib::PolyTree &poly);
+	Polygon2d *uniteNonZero(const std::vector<Outline2d> &outlines);
 	ClipperLib::Paths process(const ClipperLib::Paths &polygons, 
 														ClipperLib::ClipType, ClipperLib::PolyFillType);
 	Polygon2d *applyOffset(const Polygon2d& poly, double offset, ClipperLib::JoinType joinType, double miter_limit, double arc_tolerance);
+	Polygon2d *applyOffset(const ClipperLib::Paths &paths, double offset, ClipperLib::JoinType joinType, double miter_limit, double arc_tolerance);
+	std::vector<ClipperLib::Paths> islands(const ClipperLib::PolyTree &tree);
 	Polygon2d *applyMinkowski(const std::vector<const Polygon2d*> &polygons);
 	Polygon2d *apply(const std::vector<const Polygon2d*> &polygons, ClipperLib::ClipType);
 	Polygon2d *apply(const std::vector<ClipperLib::Paths> &pathsvector, ClipperLib::ClipType);
+	ClipperLib::Paths unionTree(std::vector<ClipperLib::Paths> &level);
+	ClipperLib::Paths project(const class PolySet &ps);
 };
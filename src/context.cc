@@ -32,16 +32,11 @@
 #include "ModuleInstantiation.h"
 #include "builtin.h"
 #include "printutils.h"
+#include "PerfCounters.h"
+#include "OperationCounters.h"
 #include <boost/filesystem.hpp>
 namespace fs = boost::filesystem;
 
-// $children is not a config_variable. config_variables have dynamic scope, 
-// meaning they are passed down the call chain implicitly.
-// $children is simply misnamed and shouldn't have included the '$'.
-static bool is_config_variable(const std::string &name) {
-	return name[0] == '$' && name != "$children";
-}
-
 /*!
 	Initializes this context. Optionally initializes a context for an 
 	external library. Note that if parent is null, a new stack will be
@@ -62,6 +57,21 @@ Context::Context(const Context *parent)
 	this->ctx_stack->push_back(this);
 }
 
+/*!
+	Initializes a context on a separate copy of the parent's context stack,
+	so it can be used on another thread while the parent's stack is left
+	alone. \a stack must outlive this context.
+*/
+Context::Context(const Context *parent, Stack &stack)
+	: parent(parent)
+{
+	assert(parent && parent->ctx_stack && "Parent context stack was null!");
+	stack = *parent->ctx_stack;
+	this->ctx_stack = &stack;
+	this->document_path = parent->document_path;
+	this->ctx_stack->push_back(this);
+}
+
 Context::~Context()
 {
 	assert(this->ctx_stack && "Context stack was null at destruction!");
@@ -76,6 +86,23 @@ Context::~Context()
 void Context::setVariables(const AssignmentList &args,
 													 const EvalContext *evalctx)
 {
+	// Call sites keep the binding of their arguments, so the names aren't
+	// looked up on every call
+	shared_ptr<const ArgumentBinding> binding;
+	if (evalctx) binding = evalctx->getBinding(args);
+	if (binding) {
+		for (size_t i=0; i<args.size(); i++) {
+			set_variable(binding->parameters[i], args[i].expr ? args[i].expr->evaluate(this->parent) : ValuePtr::undefined);
+		}
+		for (size_t i=0; i<evalctx->numArgs(); i++) {
+			ValuePtr val = evalctx->getArgValue(i);
+			const int target = binding->targets[i];
+			if (target >= 0) this->set_variable(binding->parameters[target], val);
+			else if (target == ArgumentBinding::NAMED) this->set_variable(binding->names[i], val);
+		}
+		return;
+	}
+
 	for(const auto &arg : args) {
 		set_variable(arg.name, arg.expr ? arg.expr->evaluate(this->parent) : ValuePtr::undefined);
 	}
@@ -96,8 +123,13 @@ void Context::setVariables(const AssignmentList &args,
 
 void Context::set_variable(const std::string &name, const ValuePtr &value)
 {
-	if (is_config_variable(name)) this->config_variables[name] = value;
-	else this->variables[name] = value;
+	set_variable(Identifier(name), value);
+}
+
+void Context::set_variable(const Identifier &id, const ValuePtr &value)
+{
+	if (id.isConfigVariable()) this->config_variables[id] = value;
+	else this->variables[id] = value;
 }
 
 void Context::set_variable(const std::string &name, const Value &value)
@@ -123,42 +155,92 @@ void Context::set_constant(const std::string &name, const Value &value)
 void Context::apply_variables(const Context &other)
 {
 	for (ValueMap::const_iterator it = other.variables.begin();it != other.variables.end();it++) {
-		set_variable((*it).first, (*it).second);
+		set_variable((*it).first.str(), (*it).second);
 	}
 }
 
+// Number of config variable lookups made by this thread
+static thread_local unsigned int config_lookups = 0;
+
+unsigned int Context::configLookups()
+{
+	return config_lookups;
+}
+
+void Context::countConfigLookup()
+{
+	config_lookups++;
+}
+
 ValuePtr Context::lookup_variable(const std::string &name, bool silent) const
 {
+	return lookup_variable(Identifier(name), silent);
+}
+
+ValuePtr Context::lookup_variable(const Identifier &name, bool silent) const
+{
+	PERF_PROBE("lookup-variable");
 	if (!this->ctx_stack) {
 		PRINT("ERROR: Context had null stack in lookup_variable()!!");
 		return ValuePtr::undefined;
 	}
-	if (is_config_variable(name)) {
+	if (name.isConfigVariable()) {
+		config_lookups++;
 		for (int i = this->ctx_stack->size()-1; i >= 0; i--) {
 			const ValueMap &confvars = ctx_stack->at(i)->config_variables;
-			if (confvars.find(name) != confvars.end())
-				return confvars.find(name)->second;
+			ValueMap::const_iterator it = confvars.find(name);
+			if (it != confvars.end()) return it->second;
 		}
 		return ValuePtr::undefined;
 	}
-	if (!this->parent && this->constants.find(name) != this->constants.end())
-		return this->constants.find(name)->second;
-	if (this->variables.find(name) != this->variables.end())
-		return this->variables.find(name)->second;
-	if (this->parent)
-		return this->parent->lookup_variable(name, silent);
+	const Context *ctx = this;
+	for (; ctx->parent; ctx = ctx->parent) {
+		ValueMap::const_iterator it = ctx->variables.find(name);
+		if (it != ctx->variables.end()) return it->second;
+		OperationCounters::count(OperationCounters::VARIABLE_LOOKUP_MISSES);
+	}
+	ValueMap::const_iterator it = ctx->constants.find(name);
+	if (it != ctx->constants.end()) return it->second;
+	it = ctx->variables.find(name);
+	if (it != ctx->variables.end()) return it->second;
+	OperationCounters::count(OperationCounters::VARIABLE_LOOKUP_MISSES);
 	if (!silent)
-		PRINTB("WARNING: Ignoring unknown variable '%s'.", name);
+		PRINTB("WARNING: Ignoring unknown variable '%s'.", name.str());
 	return ValuePtr::undefined;
 }
 
 bool Context::has_local_variable(const std::string &name) const
 {
-	if (is_config_variable(name))
-		return config_variables.find(name) != config_variables.end();
-	if (!parent && constants.find(name) != constants.end())
+	const Identifier id(name);
+	if (id.isConfigVariable())
+		return config_variables.find(id) != config_variables.end();
+	if (!parent && constants.find(id) != constants.end())
 		return true;
-	return variables.find(name) != variables.end();
+	return variables.find(id) != variables.end();
+}
+
+/*!
+	Collects the values an expression evaluated directly in this context
+	can see besides its parents: the local variables, and the config
+	variables of the whole call stack, innermost first.
+*/
+void Context::getBindings(std::map<std::string, ValuePtr> &bindings) const
+{
+	for(const auto &v : this->variables) bindings.insert(std::make_pair(v.first.str(), v.second));
+	getConfigVariables(bindings);
+}
+
+/*!
+	Adds the config variables visible through the call stack, which aren't
+	in \a variables yet.
+*/
+void Context::getConfigVariables(std::map<std::string, ValuePtr> &variables) const
+{
+	for (int i = this->ctx_stack->size()-1; i >= 0; i--) {
+		for(const auto &v : ctx_stack->at(i)->config_variables) {
+			variables.insert(std::make_pair(v.first.str(), v.second));
+		}
+	}
 }
 
 /**
@@ -181,6 +263,15 @@ ValuePtr Context::evaluate_function(const std::string &name, const EvalContext *
 	return ValuePtr::undefined;
 }
 
+/*!
+	Returns the function which evaluate_function() would call for \a name,
+	or NULL.
+*/
+const AbstractFunction *Context::findFunction(const std::string &name) const
+{
+	return this->parent ? this->parent->findFunction(name) : NULL;
+}
+
 AbstractNode *Context::instantiate_module(const ModuleInstantiation &inst, EvalContext *evalctx) const
 {
 	if (this->parent) return this->parent->instantiate_module(inst, evalctx);
@@ -3,8 +3,10 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <map>
 #include "value.h"
 #include "Assignment.h"
+#include "Identifier.h"
 #include "memory.h"
 
 class Context
@@ -12,23 +14,32 @@ class Context
 public:
 	typedef std::vector<const Context*> Stack;
 	Context(const Context *parent = NULL);
+	Context(const Context *parent, Stack &stack);
 	virtual ~Context();
 
 	const Context *getParent() const { return this->parent; }
 	virtual ValuePtr evaluate_function(const std::string &name, const class EvalContext *evalctx) const;
+	virtual const class AbstractFunction *findFunction(const std::string &name) const;
 	virtual class AbstractNode *instantiate_module(const class ModuleInstantiation &inst, EvalContext *evalctx) const;
 
 	void setVariables(const AssignmentList &args,
 										const class EvalContext *evalctx = NULL);
 
 	void set_variable(const std::string &name, const ValuePtr &value);
+	void set_variable(const Identifier &name, const ValuePtr &value);
 	void set_variable(const std::string &name, const Value &value);
 	void set_constant(const std::string &name, const ValuePtr &value);
 	void set_constant(const std::string &name, const Value &value);
 
         void apply_variables(const Context &other);
 	ValuePtr lookup_variable(const std::string &name, bool silent = false) const;
+	ValuePtr lookup_variable(const Identifier &name, bool silent = false) const;
 	bool has_local_variable(const std::string &name) const;
+	void getBindings(std::map<std::string, ValuePtr> &bindings) const;
+	void getConfigVariables(std::map<std::string, ValuePtr> &variables) const;
+	// Number of config variable lookups made by this thread so far
+	static unsigned int configLookups();
+	static void countConfigLookup();
 
 	void setDocumentPath(const std::string &path) { this->document_path = path; }
 	const std::string &documentPath() const { return this->document_path; }
@@ -40,7 +51,7 @@ protected:
 	const Context *parent;
 	Stack *ctx_stack;
 
-	typedef std::unordered_map<std::string, ValuePtr> ValueMap;
+	typedef std::unordered_map<Identifier, ValuePtr, Identifier::Hash> ValueMap;
 	ValueMap constants;
 	ValueMap variables;
 	ValueMap config_variables;
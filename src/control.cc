@@ -32,9 +32,14 @@
 #include "expression.h"
 #include "builtin.h"
 #include "printutils.h"
+#include "reducednode.h"
+#include "feature.h"
 #include <cstdint>
 #include <sstream>
 
+// Children of a loop reduced at a time with streaming-for
+static const size_t STREAMED_LOOP_CHILDREN = 1000;
+
 class ControlModule : public AbstractModule
 {
 public: // types
@@ -56,7 +61,7 @@ public: // methods
 	virtual AbstractNode *instantiate(const Context *ctx, const ModuleInstantiation *inst, EvalContext *evalctx) const;
 
 	static void for_eval(AbstractNode &node, const ModuleInstantiation &inst, size_t l, 
-						 const Context *ctx, const EvalContext *evalctx);
+						 const Context *ctx, const EvalContext *evalctx, size_t &reduceat);
 
 	static const EvalContext* getLastModuleCtx(const EvalContext *evalctx);
 	
@@ -67,8 +72,12 @@ private: // data
 
 }; // class ControlModule
 
+/*!
+	With streaming-for, the children are reduced to their geometry once
+	there are \a reduceat of them.
+*/
 void ControlModule::for_eval(AbstractNode &node, const ModuleInstantiation &inst, size_t l, 
-							const Context *ctx, const EvalContext *evalctx)
+							const Context *ctx, const EvalContext *evalctx, size_t &reduceat)
 {
 	if (evalctx->numArgs() > l) {
 		const std::string &it_name = evalctx->getArgName(l);
@@ -76,25 +85,24 @@ void ControlModule::for_eval(AbstractNode &node, const ModuleInstantiation &inst
 		Context c(ctx);
 		if (it_values->type() == Value::RANGE) {
 			RangeType range = it_values->toRange();
-			uint32_t steps = range.numValues();
-			if (steps >= 10000) {
-				PRINTB("WARNING: Bad range parameter in for statement: too many elements (%lu).", steps);
+			if (range.isUnbounded()) {
+				PRINTB("WARNING: Bad range parameter in for statement: too many elements (%lu).", range.numValues());
 			} else {
 				for (RangeType::iterator it = range.begin();it != range.end();it++) {
 					c.set_variable(it_name, ValuePtr(*it));
-					for_eval(node, inst, l+1, &c, evalctx);
+					for_eval(node, inst, l+1, &c, evalctx, reduceat);
 				}
 			}
 		}
 		else if (it_values->type() == Value::VECTOR) {
 			for (size_t i = 0; i < it_values->toVector().size(); i++) {
 				c.set_variable(it_name, it_values->toVector()[i]);
-				for_eval(node, inst, l+1, &c, evalctx);
+				for_eval(node, inst, l+1, &c, evalctx, reduceat);
 			}
 		}
 		else if (it_values->type() != Value::UNDEFINED) {
 			c.set_variable(it_name, it_values);
-			for_eval(node, inst, l+1, &c, evalctx);
+			for_eval(node, inst, l+1, &c, evalctx, reduceat);
 		}
 	} else if (l > 0) {
 		// At this point, the for loop variables have been set and we can initialize
@@ -106,6 +114,11 @@ void ControlModule::for_eval(AbstractNode &node, const ModuleInstantiation &inst
 		
 		std::vector<AbstractNode *> instantiatednodes = inst.instantiateChildren(&c);
 		node.children.insert(node.children.end(), instantiatednodes.begin(), instantiatednodes.end());
+		// Keeps the nodes of large loops bounded by accumulating their geometry
+		if (node.children.size() >= reduceat && Feature::ExperimentalStreamingFor.is_enabled()) {
+			ReducedNode::reduce(node);
+			reduceat = node.children.size() + STREAMED_LOOP_CHILDREN;
+		}
 	}
 }
 
@@ -157,7 +170,7 @@ AbstractNode* ControlModule::getChild(const ValuePtr &value, const EvalContext*
 		return NULL;
 	}
 	// OK
-	return modulectx->getChild(n)->evaluate(modulectx);
+	return modulectx->instantiateChild(n);
 }
 
 AbstractNode *ControlModule::instantiate(const Context* /*ctx*/, const ModuleInstantiation *inst, EvalContext *evalctx) const
@@ -187,7 +200,7 @@ AbstractNode *ControlModule::instantiate(const Context* /*ctx*/, const ModuleIns
 		}
 		// This will trigger if trying to invoke child from the root of any file
         if (n < (int)modulectx->numChildren()) {
-			node = modulectx->getChild(n)->evaluate(modulectx);
+			node = modulectx->instantiateChild(n);
 		}
 		else {
 			// How to deal with negative objects in this case?
@@ -210,7 +223,7 @@ AbstractNode *ControlModule::instantiate(const Context* /*ctx*/, const ModuleIns
 			// no parameters => all children
 			AbstractNode* node = new GroupNode(inst);
 			for (int n = 0; n < (int)modulectx->numChildren(); ++n) {
-				AbstractNode* childnode = modulectx->getChild(n)->evaluate(modulectx);
+				AbstractNode* childnode = modulectx->instantiateChild(n);
 				if (childnode==NULL) continue; // error
 				node->children.push_back(childnode);
 			}
@@ -234,9 +247,8 @@ AbstractNode *ControlModule::instantiate(const Context* /*ctx*/, const ModuleIns
 			}
 			else if (value->type() == Value::RANGE) {
 				RangeType range = value->toRange();
-				uint32_t steps = range.numValues();
-				if (steps >= 10000) {
-					PRINTB("WARNING: Bad range parameter for children: too many elements (%lu).", steps);
+				if (range.isUnbounded()) {
+					PRINTB("WARNING: Bad range parameter for children: too many elements (%lu).", range.numValues());
 					return NULL;
 				}
 				AbstractNode* node = new GroupNode(inst);
@@ -267,9 +279,11 @@ AbstractNode *ControlModule::instantiate(const Context* /*ctx*/, const ModuleIns
 			if (!evalctx->getArgName(i).empty()) msg << evalctx->getArgName(i) << " = ";
 			ValuePtr val = evalctx->getArgValue(i);
 			if (val->type() == Value::STRING) {
-				msg << '"' << val->toString() << '"';
+				msg << '"';
+				val->toStream(msg);
+				msg << '"';
 			} else {
-				msg << val->toString();
+				val->toStream(msg);
 			}
 		}
 		PRINTB("%s", msg.str());
@@ -304,14 +318,18 @@ AbstractNode *ControlModule::instantiate(const Context* /*ctx*/, const ModuleIns
 	}
 		break;
 
-	case FOR:
+	case FOR: {
 		node = new GroupNode(inst);
-		for_eval(*node, *inst, 0, evalctx, evalctx);
+		size_t reduceat = STREAMED_LOOP_CHILDREN;
+		for_eval(*node, *inst, 0, evalctx, evalctx, reduceat);
+	}
 		break;
 
-	case INT_FOR:
+	case INT_FOR: {
 		node = new AbstractIntersectionNode(inst);
-		for_eval(*node, *inst, 0, evalctx, evalctx);
+		size_t reduceat = STREAMED_LOOP_CHILDREN;
+		for_eval(*node, *inst, 0, evalctx, evalctx, reduceat);
+	}
 		break;
 
 	case IF: {
@@ -170,22 +170,44 @@ std::string CSGOperation::dump()
 	return dump.str();
 }
 
-void CSGProducts::import(shared_ptr<CSGNode> csgnode, OpenSCADOperator type, CSGNode::Flag flags)
+/*!
+	Adds the products of \a csgtree. The tree is walked with an explicit
+	stack, as normalized trees are chains as long as their products, and
+	the leaves are referenced without touching their reference counts.
+*/
+void CSGProducts::import(const shared_ptr<CSGNode> &csgtree, OpenSCADOperator type, CSGNode::Flag flags)
 {
-	CSGNode::Flag newflags = (CSGNode::Flag)(csgnode->getFlags() | flags);
+	this->terms.push_back(csgtree);
+	struct Pending {
+		const CSGNode *node;
+		OpenSCADOperator type;
+		CSGNode::Flag flags;
+	};
+	std::vector<Pending> stack;
+	stack.push_back({csgtree.get(), type, flags});
+	while (!stack.empty()) {
+		const Pending p = stack.back();
+		stack.pop_back();
+		CSGNode::Flag newflags = (CSGNode::Flag)(p.node->getFlags() | p.flags);
 
-	if (shared_ptr<CSGLeaf> leaf = dynamic_pointer_cast<CSGLeaf>(csgnode)) {
-		if (type == OPENSCAD_UNION && this->currentproduct->intersections.size() > 0) {
-			this->createProduct();
-		}
-		else if (type == OPENSCAD_DIFFERENCE) {
-			this->currentlist = &this->currentproduct->subtractions;
+		if (const CSGLeaf *leaf = dynamic_cast<const CSGLeaf *>(p.node)) {
+			if (p.type == OPENSCAD_UNION && this->currentproduct->intersections.size() > 0) {
+				this->createProduct();
+			}
+			else if (p.type == OPENSCAD_DIFFERENCE) {
+				this->currentlist = &this->currentproduct->subtractions;
+			}
+			this->currentlist->push_back(CSGChainObject(leaf, newflags));
+			// FIXME: Should intersect rather than extend
+			if (this->currentlist == &this->currentproduct->intersections && !leaf->getBoundingBox().isEmpty()) {
+				this->currentproduct->bbox.extend(leaf->getBoundingBox());
+			}
+		} else if (const CSGOperation *op = dynamic_cast<const CSGOperation *>(p.node)) {
+			assert(op->left() && op->right());
+			// The left operand is imported first
+			stack.push_back({op->right().get(), op->getType(), newflags});
+			stack.push_back({op->left().get(), p.type, newflags});
 		}
-		this->currentlist->push_back(CSGChainObject(leaf, newflags));
-	} else if (shared_ptr<CSGOperation> op = dynamic_pointer_cast<CSGOperation>(csgnode)) {
-		assert(op->left() && op->right());
-		import(op->left(), type, newflags);
-		import(op->right(), op->getType(), newflags);
 	}
 }
 
@@ -204,19 +226,6 @@ std::string CSGProduct::dump() const
 	return dump.str();
 }
 
-BoundingBox CSGProduct::getBoundingBox() const
-{
-	BoundingBox bbox;
-	for(const auto &csgobj : this->intersections) {
-		if (csgobj.leaf->geom) {
-			BoundingBox psbox = csgobj.leaf->geom->getBoundingBox();
-			// FIXME: Should intersect rather than extend
-			if (!psbox.isEmpty()) bbox.extend(csgobj.leaf->matrix * psbox);
-		}
-	}
-	return bbox;
-}
-
 std::string CSGProducts::dump() const
 {
 	std::stringstream dump;
@@ -227,6 +236,11 @@ std::string CSGProducts::dump() const
 	return dump.str();
 }
 
+/*!
+	The leaves' boxes are transformed once when they're made, and each
+	product's box is kept as its leaves are imported, so this doesn't
+	visit any geometry.
+*/
 BoundingBox CSGProducts::getBoundingBox() const
 {
 	BoundingBox bbox;
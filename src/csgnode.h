@@ -45,6 +45,8 @@ public:
 
 	shared_ptr<CSGNode> &left() { return this->children[0]; }
 	shared_ptr<CSGNode> &right() { return this->children[1]; }
+	const shared_ptr<CSGNode> &left() const { return this->children[0]; }
+	const shared_ptr<CSGNode> &right() const { return this->children[1]; }
 
 	OpenSCADOperator getType() const { return this->type; }
 	
@@ -79,15 +81,16 @@ public:
 
 /*
 	Flags are accumulated in the CSG tree, so the rendered object may
-	have different flags than the corresponding leaf node.
+	have different flags than the corresponding leaf node. The leaf is kept
+	alive by the CSGProducts holding the object.
 */
 class CSGChainObject
 {
 public:
-	CSGChainObject(const shared_ptr<CSGLeaf> &leaf, CSGNode::Flag flags = CSGNode::FLAG_NONE)
+	CSGChainObject(const CSGLeaf *leaf, CSGNode::Flag flags = CSGNode::FLAG_NONE)
 		: leaf(leaf), flags(flags) {}
 
-	shared_ptr<CSGLeaf> leaf;
+	const CSGLeaf *leaf;
 	CSGNode::Flag flags;
 };
 
@@ -98,10 +101,16 @@ public:
 	~CSGProduct() {}
 
 	std::string dump() const;
-	BoundingBox getBoundingBox() const;
+	const BoundingBox &getBoundingBox() const { return this->bbox; }
 
 	std::vector<CSGChainObject> intersections;
 	std::vector<CSGChainObject> subtractions;
+
+private:
+	// Of the intersected leaves, extended as they're imported
+	BoundingBox bbox;
+
+	friend class CSGProducts;
 };
 
 class CSGProducts
@@ -112,7 +121,7 @@ public:
 	}
 	~CSGProducts() {}
 
-	void import(shared_ptr<CSGNode> csgtree, OpenSCADOperator type = OPENSCAD_UNION, CSGNode::Flag flags = CSGNode::FLAG_NONE);
+	void import(const shared_ptr<CSGNode> &csgtree, OpenSCADOperator type = OPENSCAD_UNION, CSGNode::Flag flags = CSGNode::FLAG_NONE);
 	std::string dump() const;
 	BoundingBox getBoundingBox() const;
 
@@ -129,4 +138,5 @@ private:
 
 	std::vector<CSGChainObject> *currentlist;
 	CSGProduct *currentproduct;
+	std::vector<shared_ptr<CSGNode>> terms; // Own the leaves of the products
 };
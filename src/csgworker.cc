@@ -0,0 +1,238 @@
+#include "csgworker.h"
+#include <QThread>
+
+#include "Tree.h"
+#include "GeometryEvaluator.h"
+#include "CSGTreeEvaluator.h"
+#include "CSGTreeNormalizer.h"
+#include "csgnode.h"
+#include "GeometryCache.h"
+#include "ThreadPool.h"
+#include "feature.h"
+#include "rendernode.h"
+#include "cgaladvnode.h"
+#include "calc.h"
+#include "progress.h"
+#include "printutils.h"
+#include "stackcheck.h"
+#include "PlatformUtils.h"
+
+#include <unordered_set>
+#include <boost/format.hpp>
+
+CSGWorker::CSGWorker() : tree(NULL), fragmentlimit(0), normalizelimit(0), cancelled(false)
+{
+	this->thread = new QThread();
+	// Instantiating a design recurses like on the main thread
+	this->thread->setStackSize(PlatformUtils::stackLimit() + STACK_BUFFER_SIZE);
+	connect(this->thread, SIGNAL(started()), this, SLOT(work()));
+	moveToThread(this->thread);
+}
+
+CSGWorker::~CSGWorker()
+{
+	delete this->thread;
+}
+
+bool CSGWorker::isRunning() const
+{
+	return this->thread->isRunning();
+}
+
+/*!
+	Returns the products of the last run, which are empty if it was
+	cancelled or there was nothing to show.
+*/
+CSGWorker::Result CSGWorker::takeResult()
+{
+	Result result = this->result;
+	this->result = Result();
+	return result;
+}
+
+/*!
+	Returns the preview with placeholders emitted by partial(), if any.
+*/
+CSGWorker::Result CSGWorker::takePartialResult()
+{
+	std::lock_guard<std::mutex> lock(this->partialmutex);
+	Result result = this->partialresult;
+	this->partialresult = Result();
+	return result;
+}
+
+/*!
+	Starts building the preview of \a tree. With a \a fragmentlimit above 0,
+	circles and spheres get at most that many fragments.
+*/
+void CSGWorker::start(const Tree &tree, int fragmentlimit, size_t normalizelimit)
+{
+	this->result = Result();
+	this->tree = &tree;
+	this->instantiate = Instantiation();
+	this->fragmentlimit = fragmentlimit;
+	this->normalizelimit = normalizelimit;
+	this->cancelled = false;
+	this->thread->start();
+}
+
+/*!
+	Starts a preview of the tree made by \a instantiate, which is called in
+	the thread. Nothing else may use the state it changes until done().
+*/
+void CSGWorker::start(const Instantiation &instantiate, int fragmentlimit, size_t normalizelimit)
+{
+	this->result = Result();
+	this->tree = NULL;
+	this->instantiate = instantiate;
+	this->fragmentlimit = fragmentlimit;
+	this->normalizelimit = normalizelimit;
+	this->cancelled = false;
+	this->thread->start();
+}
+
+static void normalize(CSGTreeNormalizer &normalizer, const std::vector<shared_ptr<CSGNode>> &terms,
+											const char *name, shared_ptr<CSGProducts> &products, const std::atomic<bool> &cancelled)
+{
+	if (terms.empty() || cancelled) return;
+	PRINTB("Compiling %s (%d CSG Trees)...", name % terms.size());
+	products.reset(new CSGProducts());
+	for(const auto &term : terms) {
+		if (cancelled) break;
+		products->import(normalizer.normalize(term));
+	}
+}
+
+/*!
+	Finds the uncached render() nodes which the preview of \a node
+	evaluates, i.e. those not below other render() nodes or nodes evaluated
+	as a whole.
+*/
+static void find_render_nodes(const Tree &tree, const AbstractNode &node, std::unordered_set<std::string> &keys,
+															std::vector<const AbstractNode *> &nodes)
+{
+	if (dynamic_cast<const RenderNode *>(&node)) {
+		const std::string &key = tree.getIdString(node);
+		if (!keys.insert(key).second || GeometryCache::instance()->contains(key)) return;
+		if (GeometryEvaluator::isThreadSafe(node)) nodes.push_back(&node);
+		return;
+	}
+	if (dynamic_cast<const AbstractPolyNode *>(&node) || dynamic_cast<const CgaladvNode *>(&node)) return;
+	for(const auto &child : node.children) find_render_nodes(tree, *child, keys, nodes);
+}
+
+// Builds and normalizes the CSG tree, with placeholders for uncached render() nodes if set
+static CSGWorker::Result build_products(const Tree &tree, size_t normalizelimit, bool placeholders, std::atomic<bool> &cancelled)
+{
+	const AbstractNode *root = tree.root();
+#ifdef ENABLE_CGAL
+	GeometryEvaluator geomevaluator(tree);
+	CSGTreeEvaluator csgrenderer(tree, &geomevaluator);
+#else
+	CSGTreeEvaluator csgrenderer(tree);
+#endif
+	csgrenderer.setPlaceholders(placeholders);
+
+	CSGWorker::Result result;
+	try {
+		result.root = csgrenderer.buildCSGTree(*root);
+		if (!placeholders) GeometryCache::instance()->print();
+	}
+	catch (const ProgressCancelException &e) {
+		cancelled = true;
+	}
+
+	CSGTreeNormalizer normalizer(normalizelimit);
+	if (result.root && !cancelled) {
+		PRINT("Compiling design (CSG Products normalization)...");
+		result.normalized = normalizer.normalize(result.root);
+		if (result.normalized) {
+			result.root_products.reset(new CSGProducts());
+			result.root_products->import(result.normalized);
+		}
+		else {
+			PRINT("WARNING: CSG normalization resulted in an empty tree");
+		}
+	}
+	normalize(normalizer, csgrenderer.getHighlightNodes(), "highlights", result.highlights_products, cancelled);
+	normalize(normalizer, csgrenderer.getBackgroundNodes(), "background", result.background_products, cancelled);
+	return result;
+}
+
+/*!
+	Builds and normalizes the CSG tree of \a tree in the calling thread.
+	Sets \a cancelled if the progress report cancelled it, and stops early
+	once it's set.
+
+	With \a partial set and parallel evaluation enabled, the uncached
+	render() nodes are evaluated by the thread pool first, and \a partial
+	is called with a preview showing placeholders for them meanwhile.
+*/
+CSGWorker::Result CSGWorker::build(const Tree &tree, int fragmentlimit, size_t normalizelimit, std::atomic<bool> &cancelled,
+																	 const PartialCallback &partial)
+{
+	const AbstractNode *root = tree.root();
+	// Reduced detail geometry is kept apart in the caches through its own ids
+	Tree lodtree(root, str(boost::format("fragments<=%d;") % fragmentlimit));
+	const Tree &previewtree = fragmentlimit > 0 ? lodtree : tree;
+	Calc::FragmentLimit limit(fragmentlimit);
+
+#ifdef ENABLE_CGAL
+	if (partial && Feature::ExperimentalParallelEvaluation.is_enabled()) {
+		std::unordered_set<std::string> keys;
+		std::vector<const AbstractNode *> nodes;
+		find_render_nodes(previewtree, *root, keys, nodes);
+		if (!nodes.empty()) {
+			PRINTB("Evaluating %d render() nodes in the background...", nodes.size());
+			ThreadPool *pool = ThreadPool::instance();
+			ThreadPool::TaskGroup group;
+			for(const auto node : nodes) {
+				pool->run(group, [&previewtree, node]() {
+						GeometryEvaluator evaluator(previewtree);
+						evaluator.evaluateGeometry(*node, false);
+					});
+			}
+			Result placeholders = build_products(previewtree, normalizelimit, true, cancelled);
+			if (!cancelled) partial(placeholders);
+			// The tasks use the tree, so they're waited for even when cancelled
+			try {
+				pool->wait(group);
+			}
+			catch (const ProgressCancelException &e) {
+				cancelled = true;
+			}
+			if (cancelled) return Result();
+		}
+	}
+#endif
+	return build_products(previewtree, normalizelimit, false, cancelled);
+}
+
+void CSGWorker::work()
+{
+	StackCheck::inst()->init();
+	if (this->instantiate) {
+		this->tree = this->instantiate();
+		this->instantiate = Instantiation();
+		if (!this->tree || this->cancelled) {
+			if (this->cancelled) PRINT("CSG generation cancelled.");
+			emit done();
+			thread->quit();
+			return;
+		}
+	}
+
+	Result result = build(*this->tree, this->fragmentlimit, this->normalizelimit, this->cancelled, [this](const Result &r) {
+			{
+				std::lock_guard<std::mutex> lock(this->partialmutex);
+				this->partialresult = r;
+			}
+			emit partial();
+		});
+
+	if (this->cancelled) PRINT("CSG generation cancelled.");
+	else this->result = result;
+
+	emit done();
+	thread->quit();
+}
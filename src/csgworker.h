@@ -0,0 +1,71 @@
+#pragma once
+
+#include <QObject>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "memory.h"
+
+/*!
+	Builds and normalizes the CSG tree of a preview in a separate thread, so
+	the GUI stays responsive. The products are taken with takeResult() once
+	done() is emitted; the renderers are then made by the GUI thread.
+
+	A preview can also start by parsing and instantiating the design in the
+	thread, e.g. for previews updated while typing.
+
+	With parallel evaluation, the render() nodes of the preview are
+	evaluated by the thread pool, and partial() is emitted with a preview
+	showing the boxes around them while they're running.
+*/
+class CSGWorker : public QObject
+{
+	Q_OBJECT;
+public:
+	struct Result {
+		shared_ptr<class CSGNode> root;
+		shared_ptr<CSGNode> normalized;
+		shared_ptr<class CSGProducts> root_products;
+		shared_ptr<CSGProducts> highlights_products;
+		shared_ptr<CSGProducts> background_products;
+	};
+
+	// Makes the tree to preview, or returns NULL if there is nothing to show
+	typedef std::function<const class Tree *()> Instantiation;
+	typedef std::function<void(const Result &)> PartialCallback;
+
+	CSGWorker();
+	virtual ~CSGWorker();
+
+	bool isRunning() const;
+	void cancel() { this->cancelled = true; }
+	Result takeResult();
+	Result takePartialResult();
+	void start(const Instantiation &instantiate, int fragmentlimit, size_t normalizelimit);
+
+	static Result build(const class Tree &tree, int fragmentlimit, size_t normalizelimit, std::atomic<bool> &cancelled,
+											const PartialCallback &partial = nullptr);
+
+public slots:
+	void start(const class Tree &tree, int fragmentlimit, size_t normalizelimit);
+
+protected slots:
+	void work();
+
+signals:
+	void partial();
+	void done();
+
+protected:
+	class QThread *thread;
+	const class Tree *tree;
+	Instantiation instantiate;
+	int fragmentlimit;
+	size_t normalizelimit;
+	// Checked between the steps which can't be cancelled through the progress report
+	std::atomic<bool> cancelled;
+	Result result;
+	std::mutex partialmutex;
+	Result partialresult;
+};
@@ -29,6 +29,9 @@
 #include "printutils.h"
 #include "handle_dep.h"
 #include "calc.h"
+#include "fileutils.h"
+#include "NumberFormat.h"
+#include "Session.h"
 
 #include <fstream>
 #include <assert.h>
@@ -37,8 +40,9 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 #include <algorithm>
+#include <cstring>
 #include <sstream>
-#include <map>
+#include <set>
 
 #include "value.h"
 #include "boost-utils.h"
@@ -64,10 +68,96 @@ namespace fs=boost::filesystem;
 
 struct Line {
 	int idx[2]; // indices into DxfData::points
+	int node[2]; // indices of the joined end points
 	bool disabled;
-	Line(int i1 = -1, int i2 = -1) { idx[0] = i1; idx[1] = i2; disabled = false; }
+	Line(int i1 = -1, int i2 = -1, int n1 = -1, int n2 = -1) {
+		idx[0] = i1; idx[1] = i2; node[0] = n1; node[1] = n2; disabled = false;
+	}
+};
+
+enum entity_e {
+	ENTITY_UNKNOWN,
+	ENTITY_SECTION,
+	ENTITY_LINE,
+	ENTITY_LWPOLYLINE,
+	ENTITY_CIRCLE,
+	ENTITY_ARC,
+	ENTITY_ELLIPSE,
+	ENTITY_INSERT,
+	ENTITY_DIMENSION,
+	ENTITY_BLOCK,
+	ENTITY_ENDBLK,
+	ENTITY_ENDSEC
 };
 
+static entity_e entity_type(const std::string &name)
+{
+	static const std::unordered_map<std::string, entity_e> types = {
+		{"SECTION", ENTITY_SECTION},
+		{"LINE", ENTITY_LINE},
+		{"LWPOLYLINE", ENTITY_LWPOLYLINE},
+		{"CIRCLE", ENTITY_CIRCLE},
+		{"ARC", ENTITY_ARC},
+		{"ELLIPSE", ENTITY_ELLIPSE},
+		{"INSERT", ENTITY_INSERT},
+		{"DIMENSION", ENTITY_DIMENSION},
+		{"BLOCK", ENTITY_BLOCK},
+		{"ENDBLK", ENTITY_ENDBLK},
+		{"ENDSEC", ENTITY_ENDSEC}
+	};
+	const auto it = types.find(name);
+	return it == types.end() ? ENTITY_UNKNOWN : it->second;
+}
+
+/*!
+	Splits DXF data into lines with surrounding whitespace removed. A DXF
+	file is a sequence of pairs of lines, a group code and a value.
+*/
+class DxfReader
+{
+public:
+	DxfReader(const std::string &data) : p(data.c_str()), end(p + data.size()) {}
+
+	bool line(const char *&begin, const char *&last) {
+		if (this->p == this->end) return false;
+		const char *eol = static_cast<const char *>(memchr(this->p, '\n', this->end - this->p));
+		if (!eol) eol = this->end;
+		begin = this->p;
+		last = eol;
+		while (begin < last && is_space(*begin)) begin++;
+		while (last > begin && is_space(last[-1])) last--;
+		this->p = eol == this->end ? eol : eol + 1;
+		return true;
+	}
+
+private:
+	static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f'; }
+
+	const char *p, *end;
+};
+
+static bool parse_group_code(const char *begin, const char *end, int &id)
+{
+	const bool negative = begin < end && *begin == '-';
+	if (begin < end && (*begin == '-' || *begin == '+')) begin++;
+	if (begin == end || end - begin > 9) return false;
+	int x = 0;
+	for (; begin < end; begin++) {
+		if (*begin < '0' || *begin > '9') return false;
+		x = x * 10 + (*begin - '0');
+	}
+	id = negative ? -x : x;
+	return true;
+}
+
+// Like boost::lexical_cast<double>(), without the stream for plain decimals
+static double to_double(const std::string &data)
+{
+	double x;
+	if (!parse_number(data.data(), data.data() + data.size(), x)) throw boost::bad_lexical_cast();
+	return x;
+}
+
 DxfData::DxfData()
 {
 }
@@ -81,13 +171,16 @@ DxfData::DxfData(double fn, double fs, double fa,
 {
 	handle_dep(filename); // Register ourselves as a dependency
 
-	std::ifstream stream(filename.c_str());
-	if (!stream.good()) {
+	std::string filedata;
+	if (!read_file(filename, filedata)) {
 		PRINTB("WARNING: Can't open DXF file '%s'.", filename);
 		return;
 	}
+	DxfReader reader(filedata);
 
-	Grid2d< std::vector<int>> grid(GRID_COARSE);
+	// Joined end points, numbered from 1
+	Grid2d<int> grid(GRID_COARSE);
+	int numnodes = 0;
 	std::vector<Line> lines;                       // Global lines
 	std::unordered_map< std::string, std::vector<Line>> blockdata; // Lines in blocks
 
@@ -102,19 +195,22 @@ DxfData::DxfData(double fn, double fs, double fa,
 		if (in_entities_section &&                              \
 				!(layername.empty() || layername == layer))         \
 			break;                                                \
-		grid.align(_p1x, _p1y);                                 \
-		grid.align(_p2x, _p2y);                                 \
-		grid.data(_p1x, _p1y).push_back(lines.size());          \
-		grid.data(_p2x, _p2y).push_back(lines.size());          \
+		int &_n1 = grid.align(_p1x, _p1y);                      \
+		if (!_n1) _n1 = ++numnodes;                             \
+		const int _node1 = _n1 - 1;                             \
+		int &_n2 = grid.align(_p2x, _p2y);                      \
+		if (!_n2) _n2 = ++numnodes;                             \
+		const int _node2 = _n2 - 1;                             \
 		if (in_entities_section)                                \
-			lines.push_back(                                      \
-				Line(addPoint(_p1x, _p1y), addPoint(_p2x, _p2y)));	\
+			lines.push_back(Line(addPoint(_p1x, _p1y),            \
+				addPoint(_p2x, _p2y), _node1, _node2));             \
 		if (in_blocks_section && !current_block.empty())        \
 			blockdata[current_block].push_back(	                  \
 				Line(addPoint(_p1x, _p1y), addPoint(_p2x, _p2y)));	\
 	} while (0)
 
-	std::string mode, layer, name, iddata;
+	std::string mode, layer, name, iddata, data;
+	entity_e entity = ENTITY_UNKNOWN;
 	int dimtype = 0;
 	double coords[7][2]; // Used by DIMENSION entities
 	std::vector<double> xverts;
@@ -133,54 +229,53 @@ DxfData::DxfData(double fn, double fs, double fa,
 	//
 	// Parse DXF file. Will populate this->points, this->dims, lines and blockdata
 	//
-	while (!stream.eof())
+	const char *id_begin, *id_end;
+	while (reader.line(id_begin, id_end))
 	{
-		std::string id_str, data;
-		std::getline(stream, id_str);
-		boost::trim(id_str);
-		std::getline(stream, data);
-		boost::trim(data);
+		const char *data_begin = id_end, *data_end = id_end;
+		const bool has_data = reader.line(data_begin, data_end);
+		data.assign(data_begin, data_end);
 
 		int id;
-    try {
-		  id = boost::lexical_cast<int>(id_str);
-    }
-    catch (const boost::bad_lexical_cast &blc) {
-			if (!stream.eof()) {
-				PRINTB("WARNING: Illegal ID '%s' in `%s'", id_str % filename);
+		if (!parse_group_code(id_begin, id_end, id)) {
+			if (has_data) {
+				PRINTB("WARNING: Illegal ID '%s' in `%s'", std::string(id_begin, id_end) % filename);
 			}
 			break;
-  	}
+		}
     try {
+		// Coordinates are parsed once for both uses below
+		const bool is_coord = (id >= 10 && id <= 16) || (id >= 20 && id <= 26);
+		const double coord = is_coord ? to_double(data) : 0;
 		if (id >= 10 && id <= 16) {
 			if (in_blocks_section)
-				coords[id-10][0] = boost::lexical_cast<double>(data);
+				coords[id-10][0] = coord;
 			else if (id == 11 || id == 12 || id == 16)
-				coords[id-10][0] = boost::lexical_cast<double>(data) * scale;
+				coords[id-10][0] = coord * scale;
 			else
-				coords[id-10][0] = (boost::lexical_cast<double>(data) - xorigin) * scale;
+				coords[id-10][0] = (coord - xorigin) * scale;
 		}
 
 		if (id >= 20 && id <= 26) {
 			if (in_blocks_section)
-				coords[id-20][1] = boost::lexical_cast<double>(data);
+				coords[id-20][1] = coord;
 			else if (id == 21 || id == 22 || id == 26)
-				coords[id-20][1] = boost::lexical_cast<double>(data) * scale;
+				coords[id-20][1] = coord * scale;
 			else
-				coords[id-20][1] = (boost::lexical_cast<double>(data) - yorigin) * scale;
+				coords[id-20][1] = (coord - yorigin) * scale;
 		}
 
 		switch (id)
 		{
 		case 0:
-			if (mode == "SECTION") {
+			if (entity == ENTITY_SECTION) {
 				in_entities_section = iddata == "ENTITIES";
 				in_blocks_section = iddata == "BLOCKS";
 			}
-			else if (mode == "LINE") {
+			else if (entity == ENTITY_LINE) {
 				ADD_LINE(xverts.at(0), yverts.at(0), xverts.at(1), yverts.at(1));
 			}
-			else if (mode == "LWPOLYLINE") {
+			else if (entity == ENTITY_LWPOLYLINE) {
 				// assert(xverts.size() == yverts.size());
 				// Get maximum to enforce managed exception if xverts.size() != yverts.size()
 				int numverts = std::max(xverts.size(), yverts.size());
@@ -192,7 +287,7 @@ DxfData::DxfData(double fn, double fs, double fa,
 					ADD_LINE(xverts.at(numverts-1), yverts.at(numverts-1), xverts.at(0), yverts.at(0));
 				}
 			}
-			else if (mode == "CIRCLE") {
+			else if (entity == ENTITY_CIRCLE) {
 				int n = Calc::get_fragments_from_r(radius, fn, fs, fa);
 				Vector2d center(xverts.at(0), yverts.at(0));
 				for (int i = 0; i < n; i++) {
@@ -202,7 +297,7 @@ DxfData::DxfData(double fn, double fs, double fa,
 									 cos(a2)*radius + center[0], sin(a2)*radius + center[1]);
 				}
 			}
-			else if (mode == "ARC") {
+			else if (entity == ENTITY_ARC) {
 				Vector2d center(xverts.at(0), yverts.at(0));
 				int n = Calc::get_fragments_from_r(radius, fn, fs, fa);
 				while (arc_start_angle > arc_stop_angle)
@@ -217,7 +312,7 @@ DxfData::DxfData(double fn, double fs, double fa,
 									 cos(a2)*radius + center[0], sin(a2)*radius + center[1]);
 				}
 			}
-			else if (mode == "ELLIPSE") {
+			else if (entity == ENTITY_ELLIPSE) {
 				// Commented code is meant as documentation of vector math
 				while (ellipse_start_angle > ellipse_stop_angle) ellipse_stop_angle += 2 * M_PI;
 //				Vector2d center(xverts[0], yverts[0]);
@@ -264,7 +359,7 @@ DxfData::DxfData(double fn, double fs, double fa,
 					p1[1] = p2_rot[1];
 				}
 			}
-			else if (mode == "INSERT") {
+			else if (entity == ENTITY_INSERT) {
 				// scale is stored in ellipse_start|stop_angle, rotation in arc_start_angle;
 				// due to the parser code not checking entity type
 				int n = blockdata[iddata].size();
@@ -281,7 +376,7 @@ DxfData::DxfData(double fn, double fs, double fa,
 					ADD_LINE(px1, py1, px2, py2);
 				}
 			}
-			else if (mode == "DIMENSION" &&
+			else if (entity == ENTITY_DIMENSION &&
 					(layername.empty() || layername == layer)) {
 				this->dims.push_back(Dim());
 				this->dims.back().type = dimtype;
@@ -292,19 +387,20 @@ DxfData::DxfData(double fn, double fs, double fa,
 				this->dims.back().length = radius;
 				this->dims.back().name = name;
 			}
-			else if (mode == "BLOCK") {
+			else if (entity == ENTITY_BLOCK) {
 				current_block = iddata;
 			}
-			else if (mode == "ENDBLK") {
+			else if (entity == ENTITY_ENDBLK) {
 				current_block.erase();
 			}
-			else if (mode == "ENDSEC") {
+			else if (entity == ENTITY_ENDSEC) {
 			}
 			else if (in_blocks_section || (in_entities_section &&
 					(layername.empty() || layername == layer))) {
 				unsupported_entities_list[mode]++;
 			}
 			mode = data;
+			entity = entity_type(mode);
 			layer.erase();
 			name.erase();
 			iddata.erase();
@@ -316,7 +412,7 @@ DxfData::DxfData(double fn, double fs, double fa,
 			yverts.clear();
 			radius = arc_start_angle = arc_stop_angle = 0;
 			ellipse_start_angle = ellipse_stop_angle = 0;
-			if (mode == "INSERT") {
+			if (entity == ENTITY_INSERT) {
 				ellipse_start_angle = ellipse_stop_angle = 1.0; // scale
 			}
 			break;
@@ -330,54 +426,44 @@ DxfData::DxfData(double fn, double fs, double fa,
 			layer = data;
 			break;
 		case 10:
-			if (in_blocks_section)
-				xverts.push_back((boost::lexical_cast<double>(data)));
-			else
-				xverts.push_back((boost::lexical_cast<double>(data) - xorigin) * scale);
-			break;
 		case 11:
 			if (in_blocks_section)
-				xverts.push_back((boost::lexical_cast<double>(data)));
+				xverts.push_back(coord);
 			else
-				xverts.push_back((boost::lexical_cast<double>(data) - xorigin) * scale);
+				xverts.push_back((coord - xorigin) * scale);
 			break;
 		case 20:
-			if (in_blocks_section)
-				yverts.push_back((boost::lexical_cast<double>(data)));
-			else
-				yverts.push_back((boost::lexical_cast<double>(data) - yorigin) * scale);
-			break;
 		case 21:
 			if (in_blocks_section)
-				yverts.push_back((boost::lexical_cast<double>(data)));
+				yverts.push_back(coord);
 			else
-				yverts.push_back((boost::lexical_cast<double>(data) - yorigin) * scale);
+				yverts.push_back((coord - yorigin) * scale);
 			break;
 		case 40:
 			// CIRCLE, ARC: radius
 			// ELLIPSE: minor to major ratio
 			// DIMENSION (radial, diameter): Leader length
-			radius = boost::lexical_cast<double>(data);
+			radius = to_double(data);
 			if (!in_blocks_section) radius *= scale;
 			break;
 		case 41:
 			// ELLIPSE: start_angle
 			// INSERT: X scale
-			ellipse_start_angle = boost::lexical_cast<double>(data);
+			ellipse_start_angle = to_double(data);
 			break;
 		case 50:
 			// ARC: start_angle
 			// INSERT: rot angle
       // DIMENSION: linear and rotated: angle
-			arc_start_angle = boost::lexical_cast<double>(data);
+			arc_start_angle = to_double(data);
 			break;
 		case 42:
 			// ELLIPSE: stop_angle
 			// INSERT: Y scale
-			ellipse_stop_angle = boost::lexical_cast<double>(data);
+			ellipse_stop_angle = to_double(data);
 			break;
 		case 51: // ARC
-			arc_stop_angle = boost::lexical_cast<double>(data);
+			arc_stop_angle = to_double(data);
 			break;
 		case 70:
 			// LWPOLYLINE: polyline flag
@@ -397,110 +483,84 @@ DxfData::DxfData(double fn, double fs, double fa,
 	for(const auto &i : unsupported_entities_list) {
 		if (layername.empty()) {
 			PRINTB("WARNING: Unsupported DXF Entity '%s' (%x) in %s.",
-						 i.first % i.second % QuotedString(boostfs_uncomplete(filename, fs::current_path()).generic_string()));
+						 i.first % i.second % QuotedString(boostfs_uncomplete(filename, fs::path(Session::currentDirectory())).generic_string()));
 		} else {
 			PRINTB("WARNING: Unsupported DXF Entity '%s' (%x) in layer '%s' of %s.",
-						 i.first % i.second % layername % QuotedString(boostfs_uncomplete(filename, fs::current_path()).generic_string()));
+						 i.first % i.second % layername % QuotedString(boostfs_uncomplete(filename, fs::path(Session::currentDirectory())).generic_string()));
 		}
 	}
 
-	// Extract paths from parsed data
-
-	typedef std::map<int, int> LineMap;
-	LineMap enabled_lines;
+	// Extract paths from parsed data. Each end point has the list of lines
+	// meeting there, and the number of entries in it which aren't disabled.
+	std::vector<std::vector<int>> node_lines(numnodes);
 	for (size_t i = 0; i < lines.size(); i++) {
-		enabled_lines[i] = i;
+		node_lines[lines[i].node[0]].push_back(i);
+		node_lines[lines[i].node[1]].push_back(i);
+	}
+	std::vector<size_t> enabled_count(numnodes);
+	for (int n = 0; n < numnodes; n++) enabled_count[n] = node_lines[n].size();
+	// Lines before this position in a node's list are all disabled
+	std::vector<size_t> next_line(numnodes, 0);
+
+	// True if end point j of line l meets no other enabled line
+	auto is_open_end = [&](int l, int j) {
+		const Line &line = lines[l];
+		return enabled_count[line.node[j]] == (line.node[0] == line.node[1] ? 2u : 1u);
+	};
+	auto is_open = [&](int l) {
+		return !lines[l].disabled && (is_open_end(l, 0) || is_open_end(l, 1));
+	};
+
+	// Lines with an open end, in order so paths are found as before
+	std::set<int> open_lines;
+	for (size_t i = 0; i < lines.size(); i++) {
+		if (is_open(i)) open_lines.insert(i);
 	}
 
-	// extract all open paths
-	while (enabled_lines.size() > 0)
-	{
-		int current_line, current_point;
-
-		for(const auto &l : enabled_lines) {
-			int idx = l.second;
-			for (int j = 0; j < 2; j++) {
-				std::vector<int> *lv = &grid.data(this->points[lines[idx].idx[j]][0], this->points[lines[idx].idx[j]][1]);
-				for (size_t ki = 0; ki < lv->size(); ki++) {
-					int k = lv->at(ki);
-					if (k == idx || lines[k].disabled)
-						continue;
-					goto next_open_path_j;
-				}
-				current_line = idx;
-				current_point = j;
-				goto create_open_path;
-			next_open_path_j:;
+	auto disable = [&](int l) {
+		lines[l].disabled = true;
+		for (int j = 0; j < 2; j++) enabled_count[lines[l].node[j]]--;
+		for (int j = 0; j < 2; j++) {
+			// Only lines at an end point with at most one other line can become open
+			const int n = lines[l].node[j];
+			if (enabled_count[n] > 2) continue;
+			for(const auto &k : node_lines[n]) {
+				if (is_open(k)) open_lines.insert(k);
 			}
 		}
+	};
 
-		break;
-
-	create_open_path:
+	// Follows connected lines from end point current_point of current_line
+	auto create_path = [&](int current_line, int current_point, bool closed) {
 		this->paths.push_back(Path());
 		Path *this_path = &this->paths.back();
+		this_path->is_closed = closed;
 
 		this_path->indices.push_back(lines[current_line].idx[current_point]);
 		while (1) {
 			this_path->indices.push_back(lines[current_line].idx[!current_point]);
-			const Vector2d &ref_point = this->points[lines[current_line].idx[!current_point]];
-			lines[current_line].disabled = true;
-			enabled_lines.erase(current_line);
-			std::vector<int> *lv = &grid.data(ref_point[0], ref_point[1]);
-			for (size_t ki = 0; ki < lv->size(); ki++) {
-				int k = lv->at(ki);
-				if (lines[k].disabled)
-					continue;
-				if (grid.eq(ref_point[0], ref_point[1], this->points[lines[k].idx[0]][0], this->points[lines[k].idx[0]][1])) {
-					current_line = k;
-					current_point = 0;
-					goto found_next_line_in_open_path;
-				}
-				if (grid.eq(ref_point[0], ref_point[1], this->points[lines[k].idx[1]][0], this->points[lines[k].idx[1]][1])) {
-					current_line = k;
-					current_point = 1;
-					goto found_next_line_in_open_path;
-				}
-			}
-			break;
-		found_next_line_in_open_path:;
+			const int n = lines[current_line].node[!current_point];
+			disable(current_line);
+			const std::vector<int> &lv = node_lines[n];
+			size_t &ki = next_line[n];
+			while (ki < lv.size() && lines[lv[ki]].disabled) ki++;
+			if (ki == lv.size()) break;
+			current_line = lv[ki];
+			current_point = lines[current_line].node[0] == n ? 0 : 1;
 		}
+	};
+
+	// extract all open paths
+	while (!open_lines.empty()) {
+		const int l = *open_lines.begin();
+		open_lines.erase(open_lines.begin());
+		if (!is_open(l)) continue;
+		create_path(l, is_open_end(l, 0) ? 0 : 1, false);
 	}
 
 	// extract all closed paths
-	while (enabled_lines.size() > 0)
-	{
-		int current_line = enabled_lines.begin()->second, current_point = 0;
-
-		this->paths.push_back(Path());
-		Path *this_path = &this->paths.back();
-		this_path->is_closed = true;
-		
-		this_path->indices.push_back(lines[current_line].idx[current_point]);
-		while (1) {
-			this_path->indices.push_back(lines[current_line].idx[!current_point]);
-			const Vector2d &ref_point = this->points[lines[current_line].idx[!current_point]];
-			lines[current_line].disabled = true;
-			enabled_lines.erase(current_line);
-			std::vector<int> *lv = &grid.data(ref_point[0], ref_point[1]);
-			for (size_t ki = 0; ki < lv->size(); ki++) {
-				int k = lv->at(ki);
-				if (lines[k].disabled)
-					continue;
-				if (grid.eq(ref_point[0], ref_point[1], this->points[lines[k].idx[0]][0], this->points[lines[k].idx[0]][1])) {
-					current_line = k;
-					current_point = 0;
-					goto found_next_line_in_closed_path;
-				}
-					if (grid.eq(ref_point[0], ref_point[1], this->points[lines[k].idx[1]][0], this->points[lines[k].idx[1]][1])) {
-					current_line = k;
-					current_point = 1;
-					goto found_next_line_in_closed_path;
-				}
-			}
-			break;
-		found_next_line_in_closed_path:;
-		}
+	for (size_t i = 0; i < lines.size(); i++) {
+		if (!lines[i].disabled) create_path(i, 0, true);
 	}
 
 	fixup_path_direction();
@@ -32,14 +32,19 @@
 #include "printutils.h"
 #include "fileutils.h"
 #include "evalcontext.h"
+#include "FunctionCache.h"
 
 #include <cmath>
 #include <sstream>
 #include <cstdint>
+#include <mutex>
 
 #include <boost/filesystem.hpp>
 std::unordered_map<std::string, ValuePtr> dxf_dim_cache;
 std::unordered_map<std::string, ValuePtr> dxf_cross_cache;
+// Documents may be instantiated on several threads. The lock is held
+// while reading the file, so it's only read once.
+static std::mutex dxf_cache_mutex;
 namespace fs = boost::filesystem;
 
 ValuePtr builtin_dxf_dim(const Context *ctx, const EvalContext *evalctx)
@@ -78,7 +83,10 @@ ValuePtr builtin_dxf_dim(const Context *ctx, const EvalContext *evalctx)
 	keystream << filename << "|" << layername << "|" << name << "|" << xorigin
 						<< "|" << yorigin <<"|" << scale << "|" << lastwritetime
 						<< "|" << filesize;
+	// The result depends on the file
+	FunctionCache::markVolatile();
 	std::string key = keystream.str();
+	std::lock_guard<std::mutex> lock(dxf_cache_mutex);
 	if (dxf_dim_cache.find(key) != dxf_dim_cache.end())
 		return dxf_dim_cache.find(key)->second;
 
@@ -168,8 +176,11 @@ ValuePtr builtin_dxf_cross(const Context *ctx, const EvalContext *evalctx)
 	keystream << filename << "|" << layername << "|" << xorigin << "|" << yorigin
 						<< "|" << scale << "|" << lastwritetime
 						<< "|" << filesize;
+	// The result depends on the file
+	FunctionCache::markVolatile();
 	std::string key = keystream.str();
 
+	std::lock_guard<std::mutex> lock(dxf_cache_mutex);
 	if (dxf_cross_cache.find(key) != dxf_cross_cache.end()) {
 		return dxf_cross_cache.find(key)->second;
 	}
@@ -7,11 +7,69 @@
 #include "builtin.h"
 #include "localscope.h"
 #include "exceptions.h"
+#include "FunctionCache.h"
+#include "node.h"
 
+ArgumentBinding::ArgumentBinding(const AssignmentList &parameters, const AssignmentList &arguments)
+{
+	this->parameters.reserve(parameters.size());
+	for(const auto &param : parameters) this->parameters.push_back(Identifier(param.name));
+
+	size_t posarg = 0;
+	this->targets.reserve(arguments.size());
+	this->names.reserve(arguments.size());
+	for(const auto &arg : arguments) {
+		this->names.push_back(Identifier(arg.name));
+		if (arg.name.empty()) {
+			this->targets.push_back(posarg < parameters.size() ? int(posarg++) : int(IGNORED));
+			continue;
+		}
+		int target = NAMED;
+		for (size_t i=0; i<parameters.size(); i++) {
+			if (parameters[i].name == arg.name) target = int(i);
+		}
+		this->targets.push_back(target);
+	}
+}
+
+/*!
+	Returns true if this binding was made for \a parameters. Call sites
+	usually call the same definition, but may call others, and builtins
+	build their parameter lists on each call.
+*/
+bool ArgumentBinding::matches(const AssignmentList &parameters) const
+{
+	if (parameters.size() != this->parameters.size()) return false;
+	for (size_t i=0; i<parameters.size(); i++) {
+		if (parameters[i].name != this->parameters[i].str()) return false;
+	}
+	return true;
+}
+
+/*!
+	\a binding, if given, is where the call site keeps its ArgumentBinding.
+*/
 EvalContext::EvalContext(const Context *parent, 
-												 const AssignmentList &args, const class LocalScope *const scope)
-	: Context(parent), eval_arguments(args), scope(scope)
+												 const AssignmentList &args, const class LocalScope *const scope,
+												 shared_ptr<const ArgumentBinding> *binding)
+	: Context(parent), eval_arguments(args), scope(scope), binding(binding)
+{
+}
+
+/*!
+	Returns the binding of the arguments to \a parameters, or NULL if the
+	call site doesn't keep one.
+*/
+shared_ptr<const ArgumentBinding> EvalContext::getBinding(const AssignmentList &parameters) const
 {
+	if (!this->binding) return shared_ptr<const ArgumentBinding>();
+	// Call sites may be evaluated by several threads
+	shared_ptr<const ArgumentBinding> binding = std::atomic_load(this->binding);
+	if (!binding || !binding->matches(parameters)) {
+		binding = make_shared<const ArgumentBinding>(parameters, this->eval_arguments);
+		std::atomic_store(this->binding, binding);
+	}
+	return binding;
 }
 
 const std::string &EvalContext::getArgName(size_t i) const
@@ -31,6 +89,13 @@ ValuePtr EvalContext::getArgValue(size_t i, const Context *ctx) const
 	return v;
 }
 
+EvalContext::~EvalContext()
+{
+	for(const auto &child : this->instantiated) {
+		if (--child.node->refcount == 0) delete child.node;
+	}
+}
+
 size_t EvalContext::numChildren() const
 {
 	return this->scope ? this->scope->children.size() : 0;
@@ -41,6 +106,44 @@ ModuleInstantiation *EvalContext::getChild(size_t i) const
 	return this->scope ? this->scope->children[i] : NULL; 
 }
 
+/*!
+	Instantiates child \a i in this context, for children(). Modules calling
+	children() repeatedly get the subtree of the previous call again, shared,
+	if the config variables visible through the call stack are the same.
+	Children which print messages or use rands() and the like are
+	instantiated every time.
+*/
+AbstractNode *EvalContext::instantiateChild(size_t i) const
+{
+	std::map<std::string, ValuePtr> configvariables;
+	getConfigVariables(configvariables);
+	for(const auto &child : this->instantiated) {
+		if (child.index == i && child.configvariables == configvariables) {
+			child.node->refcount++;
+			return child.node;
+		}
+	}
+
+	const unsigned int calls = FunctionCache::volatileCalls();
+	print_messages_push();
+	AbstractNode *node;
+	try {
+		node = getChild(i)->evaluate(this);
+	}
+	catch (...) {
+		print_messages_pop();
+		throw;
+	}
+	const bool printed = !print_messages_top().empty();
+	print_messages_pop();
+	if (node && !printed && FunctionCache::volatileCalls() == calls) {
+		InstantiatedChild child = { i, configvariables, node };
+		node->refcount++;
+		this->instantiated.push_back(child);
+	}
+	return node;
+}
+
 void EvalContext::assignTo(Context &target) const
 {
 	for(const auto &assignment : this->eval_arguments) {
@@ -3,6 +3,28 @@
 #include "context.h"
 #include "Assignment.h"
 
+/*!
+	How the arguments of a call map to the parameters of the called module
+	or function. Computed once per call site and kept by it, so binding the
+	arguments of repeated calls doesn't look up names.
+*/
+class ArgumentBinding
+{
+public:
+	ArgumentBinding(const AssignmentList &parameters, const AssignmentList &arguments);
+
+	bool matches(const AssignmentList &parameters) const;
+
+	enum { NAMED = -1, IGNORED = -2 };
+
+	std::vector<Identifier> parameters;
+	// The parameter of each argument, NAMED for named arguments which
+	// aren't parameters, or IGNORED for surplus positional arguments
+	std::vector<int> targets;
+	// The names of the arguments
+	std::vector<Identifier> names;
+};
+
 /*!
   This hold the evaluation context (the parameters actually sent
 	when calling a module or function, including the children).
@@ -13,8 +35,9 @@ public:
 	typedef std::vector<class ModuleInstantiation *> InstanceList;
 
 	EvalContext(const Context *parent, 
-							const AssignmentList &args, const class LocalScope *const scope = NULL);
-	virtual ~EvalContext() {}
+							const AssignmentList &args, const class LocalScope *const scope = NULL,
+							shared_ptr<const ArgumentBinding> *binding = NULL);
+	virtual ~EvalContext();
 
 	size_t numArgs() const { return this->eval_arguments.size(); }
 	const std::string &getArgName(size_t i) const;
@@ -22,8 +45,10 @@ public:
 
 	size_t numChildren() const;
 	ModuleInstantiation *getChild(size_t i) const;
+	class AbstractNode *instantiateChild(size_t i) const;
 
 	void assignTo(Context &target) const;
+	shared_ptr<const ArgumentBinding> getBinding(const AssignmentList &parameters) const;
 
 #ifdef DEBUG
 	virtual std::string dump(const class AbstractModule *mod, const ModuleInstantiation *inst);
@@ -32,4 +57,15 @@ public:
 private:
 	const AssignmentList &eval_arguments;
 	const LocalScope *const scope;
+	// The call site's binding, if it keeps one
+	shared_ptr<const ArgumentBinding> *binding;
+
+	// Children instantiated by instantiateChild(), with the config
+	// variables they were instantiated with. A reference is kept to each.
+	struct InstantiatedChild {
+		size_t index;
+		std::map<std::string, ValuePtr> configvariables;
+		class AbstractNode *node;
+	};
+	mutable std::vector<InstantiatedChild> instantiated;
 };
@@ -26,25 +26,35 @@
 
 #include "export.h"
 #include "printutils.h"
+#include "PerfCounters.h"
 #include "Geometry.h"
 
+#include <cstdio>
 #include <fstream>
+#include <functional>
 
 #define QUOTE(x__) # x__
 #define QUOTED(x__) QUOTE(x__)
 
 void exportFile(const shared_ptr<const Geometry> &root_geom, std::ostream &output, FileFormat format)
 {
+	PERF_PROBE("export");
 	switch (format) {
 	case OPENSCAD_STL:
 		export_stl(root_geom, output);
 		break;
+	case OPENSCAD_STL_BINARY:
+		export_stl_binary(root_geom, output);
+		break;
 	case OPENSCAD_OFF:
 		export_off(root_geom, output);
 		break;
 	case OPENSCAD_AMF:
 		export_amf(root_geom, output);
 		break;
+	case OPENSCAD_3MF:
+		export_3mf(root_geom, output);
+		break;
 	case OPENSCAD_DXF:
 		export_dxf(root_geom, output);
 		break;
@@ -57,32 +67,143 @@ void exportFile(const shared_ptr<const Geometry> &root_geom, std::ostream &outpu
 	case OPENSCAD_NEF3:
 		export_nef3(root_geom, output);
 		break;
+	case OPENSCAD_SCADGEOM:
+		export_scadgeom(root_geom, output);
+		break;
 	default:
 		assert(false && "Unknown file format");
 	}
 }
 
-void exportFileByName(const shared_ptr<const Geometry> &root_geom, FileFormat format,
-	const char *name2open, const char *name2display)
+/*!
+	Passes the output on to another stream buffer until \a cancel is set.
+	Then every write fails, so an exporter stops at its next write.
+*/
+class CancellableBuffer : public std::streambuf
 {
-	std::ofstream fstream(name2open);
-	if (!fstream.is_open()) {
+public:
+	CancellableBuffer(std::streambuf *dest, const std::atomic<bool> &cancel) : dest(dest), cancel(cancel) {
+		setp(this->buffer, this->buffer + sizeof(this->buffer));
+	}
+	virtual ~CancellableBuffer() { flush(); }
+
+protected:
+	virtual int_type overflow(int_type c) {
+		if (flush() < 0) return traits_type::eof();
+		if (!traits_type::eq_int_type(c, traits_type::eof())) {
+			*pptr() = traits_type::to_char_type(c);
+			pbump(1);
+		}
+		return traits_type::not_eof(c);
+	}
+	virtual int sync() { return flush() < 0 || this->dest->pubsync() < 0 ? -1 : 0; }
+	// Seeking is passed on, e.g. for the facet count of binary STL files
+	virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) {
+		if (flush() < 0) return pos_type(off_type(-1));
+		return this->dest->pubseekoff(off, dir, which);
+	}
+	virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which) {
+		if (flush() < 0) return pos_type(off_type(-1));
+		return this->dest->pubseekpos(pos, which);
+	}
+
+private:
+	int flush() {
+		if (this->cancel) return -1;
+		const std::streamsize n = pptr() - pbase();
+		if (n > 0 && this->dest->sputn(pbase(), n) != n) return -1;
+		setp(this->buffer, this->buffer + sizeof(this->buffer));
+		return 0;
+	}
+
+	std::streambuf *dest;
+	const std::atomic<bool> &cancel;
+	char buffer[65536];
+};
+
+/*!
+	Opens the file \a name2open, or standard output if it is "-", and
+	writes it with \a write. If \a cancel is set while writing, the file
+	is removed.
+*/
+static void writeFileByName(const std::function<void(std::ostream &)> &write, bool binary,
+														const char *name2open, const char *name2display,
+														const std::atomic<bool> *cancel = NULL)
+{
+	const std::ios::openmode mode = binary ? std::ios::out | std::ios::binary : std::ios::out;
+	const bool tostdout = std::string(name2open) == "-";
+	std::ofstream fstream;
+	if (!tostdout) fstream.open(name2open, mode);
+	std::ostream &output = tostdout ? std::cout : fstream;
+	if (!tostdout && !fstream.is_open()) {
 		PRINTB(_("Can't open file \"%s\" for export"), name2display);
 	} else {
 		bool onerror = false;
-		fstream.exceptions(std::ios::badbit|std::ios::failbit);
+		const std::ios::iostate exceptions = output.exceptions();
+		output.exceptions(std::ios::badbit|std::ios::failbit);
 		try {
-			exportFile(root_geom, fstream, format);
+			if (cancel) {
+				CancellableBuffer buffer(output.rdbuf(), *cancel);
+				std::ostream cancellable(&buffer);
+				cancellable.exceptions(std::ios::badbit|std::ios::failbit);
+				write(cancellable);
+				cancellable.flush();
+			}
+			else {
+				write(output);
+			}
 		} catch (std::ios::failure x) {
 			onerror = true;
 		}
 		try { // make sure file closed - resources released
-			fstream.close();
+			if (tostdout) output.flush();
+			else fstream.close();
 		} catch (std::ios::failure x) {
 			onerror = true;
 		}
-		if (onerror) {
+		if (tostdout) {
+			std::cout.clear();
+			std::cout.exceptions(exceptions);
+		}
+		if (cancel && *cancel) {
+			if (!tostdout) std::remove(name2open);
+			PRINTB(_("Export of \"%s\" cancelled."), name2display);
+		}
+		else if (onerror) {
 			PRINTB(_("ERROR: \"%s\" write error. (Disk full?)"), name2display);
 		}
 	}
 }
+
+/*!
+	Exports \a root_geom to the file \a name2open, or to standard output if
+	it is "-". Setting \a cancel stops the export at the next write.
+	Shared memory objects are written directly instead of as a file.
+*/
+void exportFileByName(const shared_ptr<const Geometry> &root_geom, FileFormat format,
+	const char *name2open, const char *name2display, const std::atomic<bool> *cancel)
+{
+	if (format == OPENSCAD_SHM) {
+		PERF_PROBE("export");
+		export_shm(root_geom, name2open);
+		return;
+	}
+	const bool binary = format == OPENSCAD_STL_BINARY || format == OPENSCAD_3MF || format == OPENSCAD_SCADGEOM;
+	writeFileByName([&root_geom, format](std::ostream &output) { exportFile(root_geom, output, format); },
+									binary, name2open, name2display, cancel);
+}
+
+/*!
+	Exports the 2D \a layers together to one DXF or SVG file, or to standard
+	output if \a name2open is "-".
+*/
+void exportLayersByName(const std::vector<ExportLayer> &layers, FileFormat format,
+	const char *name2open, const char *name2display)
+{
+	writeFileByName([&layers, format](std::ostream &output) {
+			PERF_PROBE("export");
+			if (format == OPENSCAD_DXF) export_dxf(layers, output);
+			else if (format == OPENSCAD_SVG) export_svg(layers, output);
+			else assert(false && "Layers can only be exported as DXF or SVG");
+		}, false, name2open, name2display);
+}
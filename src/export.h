@@ -1,30 +1,56 @@
 #pragma once
 
+#include <atomic>
 #include <iostream>
+#include <string>
+#include <vector>
 #include "Tree.h"
 #include "Camera.h"
 #include "memory.h"
+#include "ThreadPool.h"
 
 enum FileFormat {
 	OPENSCAD_STL,
+	OPENSCAD_STL_BINARY,
 	OPENSCAD_OFF,
 	OPENSCAD_AMF,
+	OPENSCAD_3MF,
 	OPENSCAD_DXF,
 	OPENSCAD_SVG,
 	OPENSCAD_NEFDBG,
-	OPENSCAD_NEF3
+	OPENSCAD_NEF3,
+	OPENSCAD_SCADGEOM,
+	OPENSCAD_SHM
 };
 
 void exportFileByName(const shared_ptr<const class Geometry> &root_geom, FileFormat format,
-											const char *name2open, const char *name2display);
+											const char *name2open, const char *name2display,
+											const std::atomic<bool> *cancel = NULL);
+
+/*!
+	A named 2D layer of a file, e.g. one of the slices made by --slices.
+*/
+struct ExportLayer {
+	std::string name;
+	shared_ptr<const class Polygon2d> polygon;
+};
+
+void exportLayersByName(const std::vector<ExportLayer> &layers, FileFormat format,
+												const char *name2open, const char *name2display);
 
 void export_stl(const shared_ptr<const Geometry> &geom, std::ostream &output);
+void export_stl_binary(const shared_ptr<const Geometry> &geom, std::ostream &output);
 void export_off(const shared_ptr<const Geometry> &geom, std::ostream &output);
 void export_amf(const shared_ptr<const Geometry> &geom, std::ostream &output);
+void export_3mf(const shared_ptr<const Geometry> &geom, std::ostream &output);
 void export_dxf(const shared_ptr<const Geometry> &geom, std::ostream &output);
 void export_svg(const shared_ptr<const Geometry> &geom, std::ostream &output);
+void export_dxf(const std::vector<ExportLayer> &layers, std::ostream &output);
+void export_svg(const std::vector<ExportLayer> &layers, std::ostream &output);
 void export_nefdbg(const shared_ptr<const Geometry> &geom, std::ostream &output);
 void export_nef3(const shared_ptr<const Geometry> &geom, std::ostream &output);
+void export_scadgeom(const shared_ptr<const Geometry> &geom, std::ostream &output);
+void export_shm(const shared_ptr<const Geometry> &geom, const char *filename);
 
 // void exportFile(const class Geometry *root_geom, std::ostream &output, FileFormat format);
 
@@ -32,3 +58,36 @@ void export_png(const shared_ptr<const class Geometry> &root_geom, Camera &c, st
 void export_png(const shared_ptr<const class CGAL_Nef_polyhedron> &root_N, Camera &c, std::ostream &output);
 void export_png_with_opencsg(Tree &tree, Camera &c, std::ostream &output);
 void export_png_with_throwntogether(Tree &tree, Camera &c, std::ostream &output);
+
+/*!
+	A camera and the PNG file to render it to. A list of views is rendered
+	with one offscreen context, so all views must have the same image size.
+*/
+struct PngView {
+	Camera camera;
+	std::string filename;
+};
+
+/*!
+	Encodes and writes PNG images on the thread pool while rendering goes
+	on. write() waits for the queued images when too many are pending.
+*/
+class PngWriter
+{
+public:
+	PngWriter();
+	~PngWriter() { wait(); }
+
+	void write(const std::string &filename, const shared_ptr<std::vector<unsigned char>> &image, int width, int height);
+	bool wait();
+
+private:
+	ThreadPool::TaskGroup group;
+	size_t pending;
+	size_t maxpending;
+	std::atomic<bool> ok;
+};
+
+bool export_png(const shared_ptr<const class Geometry> &root_geom, std::vector<PngView> &views, PngWriter &writer);
+bool export_png_with_opencsg(Tree &tree, std::vector<PngView> &views, PngWriter &writer);
+bool export_png_with_throwntogether(Tree &tree, std::vector<PngView> &views, PngWriter &writer);
@@ -0,0 +1,316 @@
+/*
+ *  OpenSCAD (www.openscad.org)
+ *  Copyright (C) 2009-2011 Clifford Wolf <clifford@clifford.at> and
+ *                          Marius Kintel <marius@kintel.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  As a special exception, you have permission to link this program
+ *  with the CGAL library and distribute executables, as long as you
+ *  follow the requirements of the GNU GPL in regard to all of the
+ *  software in the executable aside from CGAL.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "export.h"
+#include "polyset.h"
+#include "polyset-utils.h"
+#include "printutils.h"
+#include "NumberFormat.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <string.h>
+#include <stdint.h>
+#include <zlib.h>
+
+#ifdef ENABLE_CGAL
+#include "CGAL_Nef_polyhedron.h"
+#include "cgal.h"
+#include "cgalutils.h"
+
+#define QUOTE(x__) # x__
+#define QUOTED(x__) QUOTE(x__)
+
+/*
+	3MF is a zip archive of XML parts. The mesh is written as chunks of
+	about CHUNK_SIZE bytes of XML, which are formatted and compressed in
+	parallel on the thread pool. Each chunk is deflated separately and
+	ends with a sync flush, so the compressed chunks can be concatenated
+	into a single deflate stream, as done by pigz.
+*/
+
+// Vertices or triangles per chunk, giving roughly a megabyte of XML
+static const size_t CHUNK_ITEMS = 20000;
+
+/*!
+	A compressed piece of a zip entry.
+*/
+struct DeflatedChunk {
+	std::string data;
+	uint32_t crc;
+	size_t size;
+};
+
+static bool deflate_chunk(const std::string &text, bool last, DeflatedChunk &chunk)
+{
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	// Raw deflate without zlib header, as used by zip
+	if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+
+	chunk.data.resize(deflateBound(&zs, text.size()) + 16);
+	zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(text.data()));
+	zs.avail_in = text.size();
+	zs.next_out = reinterpret_cast<Bytef *>(&chunk.data[0]);
+	zs.avail_out = chunk.data.size();
+	const int result = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+	const bool ok = last ? result == Z_STREAM_END : result == Z_OK && zs.avail_in == 0;
+	chunk.data.resize(chunk.data.size() - zs.avail_out);
+	deflateEnd(&zs);
+
+	chunk.crc = crc32(crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef *>(text.data()), text.size());
+	chunk.size = text.size();
+	return ok;
+}
+
+static void append_number(std::string &out, double x)
+{
+	char buf[NUMBER_BUFFER_SIZE];
+	out.append(buf, format_number(x, buf));
+}
+
+static void append_index(std::string &out, int i)
+{
+	char buf[16];
+	out.append(buf, snprintf(buf, sizeof(buf), "%d", i));
+}
+
+/*!
+	Writes the mesh of a triangulated PolySet as the chunks of the 3D
+	model part. The vertices of the PolySet are already unique.
+*/
+static bool deflate_model(const PolySet &ps, std::vector<DeflatedChunk> &chunks)
+{
+	const std::vector<Vector3d> &vertices = ps.getVertices();
+	const size_t numvertexchunks = (vertices.size() + CHUNK_ITEMS - 1) / CHUNK_ITEMS;
+	const size_t numtrianglechunks = (ps.numPolygons() + CHUNK_ITEMS - 1) / CHUNK_ITEMS;
+	// The header and footer are chunks of their own
+	chunks.resize(numvertexchunks + numtrianglechunks + 2);
+	std::vector<char> ok(chunks.size(), false);
+
+	std::string header = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<model unit=\"millimeter\" xml:lang=\"en-US\" xmlns=\"http://schemas.microsoft.com/3dmanufacturing/core/2015/02\">\n"
+		" <metadata name=\"Application\">OpenSCAD " QUOTED(OPENSCAD_VERSION) "</metadata>\n"
+		" <resources>\n"
+		"  <object id=\"1\" type=\"model\">\n"
+		"   <mesh>\n"
+		"    <vertices>\n";
+	ok[0] = deflate_chunk(header, false, chunks[0]);
+
+	ThreadPool *pool = ThreadPool::instance();
+	ThreadPool::TaskGroup group;
+	for (size_t c = 0; c < numvertexchunks; c++) {
+		pool->run(group, [&vertices, &chunks, &ok, c, numvertexchunks]() {
+				std::string text;
+				const size_t end = std::min(vertices.size(), (c + 1) * CHUNK_ITEMS);
+				for (size_t i = c * CHUNK_ITEMS; i < end; i++) {
+					const Vector3d &v = vertices[i];
+					text += "     <vertex x=\"";
+					append_number(text, v[0]);
+					text += "\" y=\"";
+					append_number(text, v[1]);
+					text += "\" z=\"";
+					append_number(text, v[2]);
+					text += "\"/>\n";
+				}
+				if (c + 1 == numvertexchunks) text += "    </vertices>\n    <triangles>\n";
+				ok[1 + c] = deflate_chunk(text, false, chunks[1 + c]);
+			});
+	}
+	for (size_t c = 0; c < numtrianglechunks; c++) {
+		pool->run(group, [&ps, &chunks, &ok, c, numvertexchunks]() {
+				std::string text;
+				const size_t end = std::min(ps.numPolygons(), (c + 1) * CHUNK_ITEMS);
+				for (size_t i = c * CHUNK_ITEMS; i < end; i++) {
+					const PolySet::Face f = ps.face(i);
+					// 3MF doesn't allow triangles with repeated vertices
+					if (f.index(0) == f.index(1) || f.index(0) == f.index(2) || f.index(1) == f.index(2)) continue;
+					text += "     <triangle v1=\"";
+					append_index(text, f.index(0));
+					text += "\" v2=\"";
+					append_index(text, f.index(1));
+					text += "\" v3=\"";
+					append_index(text, f.index(2));
+					text += "\"/>\n";
+				}
+				ok[1 + numvertexchunks + c] = deflate_chunk(text, false, chunks[1 + numvertexchunks + c]);
+			});
+	}
+	pool->wait(group);
+
+	std::string footer;
+	if (numvertexchunks == 0) footer += "    </vertices>\n    <triangles>\n";
+	footer += "    </triangles>\n"
+		"   </mesh>\n"
+		"  </object>\n"
+		" </resources>\n"
+		" <build>\n"
+		"  <item objectid=\"1\"/>\n"
+		" </build>\n"
+		"</model>\n";
+	ok.back() = deflate_chunk(footer, true, chunks.back());
+
+	return std::find(ok.begin(), ok.end(), false) == ok.end();
+}
+
+static void put_uint16(std::string &out, uint16_t n)
+{
+	for (int i = 0; i < 2; i++) out += char((n >> (8 * i)) & 0xff);
+}
+
+static void put_uint32(std::string &out, uint32_t n)
+{
+	for (int i = 0; i < 4; i++) out += char((n >> (8 * i)) & 0xff);
+}
+
+/*!
+	Writes a zip archive without zip64 extensions, so entries and the
+	archive are limited to 4GB.
+*/
+class ZipWriter
+{
+public:
+	ZipWriter(std::ostream &output) : output(output), offset(0), count(0) {}
+
+	bool add(const std::string &name, const std::vector<DeflatedChunk> &chunks) {
+		uint32_t crc = crc32(0, Z_NULL, 0);
+		uint64_t size = 0, compressed = 0;
+		for(const auto &c : chunks) {
+			crc = crc32_combine(crc, c.crc, c.size);
+			size += c.size;
+			compressed += c.data.size();
+		}
+		if (size > 0xffffffffu || this->offset + compressed > 0xffffffffu) return false;
+
+		std::string entry;
+		put_uint16(entry, 20); // Version needed: deflate
+		put_uint16(entry, 0); // Flags
+		put_uint16(entry, 8); // Method: deflate
+		put_uint16(entry, 0); // Time
+		put_uint16(entry, (1 << 5) | 1); // Date: 1980-01-01
+		put_uint32(entry, crc);
+		put_uint32(entry, uint32_t(compressed));
+		put_uint32(entry, uint32_t(size));
+		put_uint16(entry, name.size());
+		put_uint16(entry, 0); // Extra field length
+
+		std::string local;
+		put_uint32(local, 0x04034b50);
+		local += entry;
+		local += name;
+		this->output.write(local.data(), local.size());
+		for(const auto &c : chunks) this->output.write(c.data.data(), c.data.size());
+
+		put_uint32(this->directory, 0x02014b50);
+		put_uint16(this->directory, 20); // Version made by
+		this->directory += entry;
+		put_uint16(this->directory, 0); // Comment length
+		put_uint16(this->directory, 0); // Disk number
+		put_uint16(this->directory, 0); // Internal attributes
+		put_uint32(this->directory, 0); // External attributes
+		put_uint32(this->directory, uint32_t(this->offset));
+		this->directory += name;
+
+		this->offset += local.size() + compressed;
+		this->count++;
+		return true;
+	}
+
+	bool add(const std::string &name, const std::string &text) {
+		std::vector<DeflatedChunk> chunks(1);
+		return deflate_chunk(text, true, chunks[0]) && add(name, chunks);
+	}
+
+	void finish() {
+		std::string end;
+		put_uint32(end, 0x06054b50);
+		put_uint16(end, 0); // Disk number
+		put_uint16(end, 0); // Disk with the directory
+		put_uint16(end, this->count);
+		put_uint16(end, this->count);
+		put_uint32(end, this->directory.size());
+		put_uint32(end, uint32_t(this->offset));
+		put_uint16(end, 0); // Comment length
+		this->output.write(this->directory.data(), this->directory.size());
+		this->output.write(end.data(), end.size());
+	}
+
+private:
+	std::ostream &output;
+	std::string directory;
+	uint64_t offset;
+	uint16_t count;
+};
+
+static const char *CONTENT_TYPES =
+	"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+	"<Types xmlns=\"http://schemas.openxmlformats.org/package/2006/content-types\">\n"
+	" <Default Extension=\"rels\" ContentType=\"application/vnd.openxmlformats-package.relationships+xml\"/>\n"
+	" <Default Extension=\"model\" ContentType=\"application/vnd.ms-package.3dmanufacturing-3dmodel+xml\"/>\n"
+	"</Types>\n";
+
+static const char *RELATIONSHIPS =
+	"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+	"<Relationships xmlns=\"http://schemas.openxmlformats.org/package/2006/relationships\">\n"
+	" <Relationship Target=\"/3D/3dmodel.model\" Id=\"rel0\" Type=\"http://schemas.microsoft.com/3dmanufacturing/2013/01/3dmodel\"/>\n"
+	"</Relationships>\n";
+
+/*!
+	Exports the geometry as a 3MF package with a single mesh object.
+*/
+void export_3mf(const shared_ptr<const Geometry> &geom, std::ostream &output)
+{
+	PolySet triangulated(3);
+	if (const CGAL_Nef_polyhedron *N = dynamic_cast<const CGAL_Nef_polyhedron *>(geom.get())) {
+		if (!N->p3->is_simple()) {
+			PRINT("WARNING: Exported object may not be a valid 2-manifold and may need repair");
+		}
+		// The PolySet of a Nef polyhedron is already triangulated
+		if (CGALUtils::createPolySetFromNefPolyhedron3(*(N->p3), triangulated)) {
+			PRINT("ERROR: Nef->PolySet failed");
+			return;
+		}
+	}
+	else if (const PolySet *ps = dynamic_cast<const PolySet *>(geom.get())) {
+		PolysetUtils::tessellate_faces(*ps, triangulated);
+	}
+	else {
+		assert(false && "Unsupported file format");
+	}
+
+	std::vector<DeflatedChunk> model;
+	ZipWriter zip(output);
+	if (!deflate_model(triangulated, model) ||
+			!zip.add("[Content_Types].xml", CONTENT_TYPES) ||
+			!zip.add("_rels/.rels", RELATIONSHIPS) ||
+			!zip.add("3D/3dmodel.model", model)) {
+		PRINT("ERROR: 3MF export failed, the model may be too large");
+		return;
+	}
+	zip.finish();
+}
+
+#endif // ENABLE_CGAL
@@ -28,6 +28,7 @@
 #include "polyset.h"
 #include "polyset-utils.h"
 #include "dxfdata.h"
+#include "NumberFormat.h"
 
 #ifdef ENABLE_CGAL
 #include "CGAL_Nef_polyhedron.h"
@@ -87,13 +88,13 @@ static void append_amf(const CGAL_Nef_polyhedron &root_N, std::ostream &output)
 				double y3 = CGAL::to_double(v3.point().y());
 				double z3 = CGAL::to_double(v3.point().z());
 				std::stringstream stream;
-				stream << x1 << " " << y1 << " " << z1;
+				stream << Number(x1) << " " << Number(y1) << " " << Number(z1);
 				std::string vs1 = stream.str();
 				stream.str("");
-				stream << x2 << " " << y2 << " " << z2;
+				stream << Number(x2) << " " << Number(y2) << " " << Number(z2);
 				std::string vs2 = stream.str();
 				stream.str("");
-				stream << x3 << " " << y3 << " " << z3;
+				stream << Number(x3) << " " << Number(y3) << " " << Number(z3);
 				std::string vs3 = stream.str();
 				if (std::find(vertices.begin(), vertices.end(), vs1) == vertices.end())
 					vertices.push_back(vs1);
@@ -174,8 +175,6 @@ static void append_amf(const shared_ptr<const Geometry> &geom, std::ostream &out
 
 void export_amf(const shared_ptr<const Geometry> &geom, std::ostream &output)
 {
-	setlocale(LC_NUMERIC, "C"); // Ensure radix is . (not ,) in output
-
 	output << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\r\n"
 				 << "<amf unit=\"millimeter\">\r\n"
 				 << " <metadata type=\"producer\">OpenSCAD " << QUOTED(OPENSCAD_VERSION)
@@ -188,7 +187,6 @@ void export_amf(const shared_ptr<const Geometry> &geom, std::ostream &output)
 	append_amf(geom, output);
 
 	output << "</amf>\r\n";
-	setlocale(LC_NUMERIC, ""); // Set default locale
 }
 
 #endif // ENABLE_CGAL
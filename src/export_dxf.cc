@@ -28,13 +28,10 @@
 #include "polyset.h"
 #include "polyset-utils.h"
 #include "dxfdata.h"
+#include "NumberFormat.h"
 
-/*!
-	Saves the current Polygon2d as DXF to the given absolute filename.
- */
-void export_dxf(const Polygon2d &poly, std::ostream &output)
+static void write_dxf_header(std::ostream &output)
 {
-	setlocale(LC_NUMERIC, "C"); // Ensure radix is . (not ,) in output
 	// Some importers (e.g. Inkscape) needs a BLOCKS section to be present
 	output << "  0\n"
 				 <<	"SECTION\n"
@@ -46,33 +43,49 @@ void export_dxf(const Polygon2d &poly, std::ostream &output)
 				 << "SECTION\n"
 				 << "  2\n"
 				 << "ENTITIES\n";
+}
+
+// The lines are written to the stream in pieces of about this size
+static const size_t DXF_BUFFER_SIZE = 64 * 1024;
 
+/*!
+	Writes the outlines of \a poly as lines on the layer \a layer. Each
+	vertex is formatted once, for both lines it ends.
+*/
+static void write_dxf_lines(const Polygon2d &poly, const std::string &layer, std::ostream &output)
+{
+	// Some importers (e.g. Inkscape) needs a layer to be specified
+	const std::string header = "  0\nLINE\n  8\n" + layer + "\n";
+	std::string buf;
+	std::vector<std::string> xs, ys;
 	for(const auto &o : poly.outlines()) {
-		for (unsigned int i=0;i<o.vertices.size();i++) {
-			const Vector2d &p1 = o.vertices[i];
-			const Vector2d &p2 = o.vertices[(i+1)%o.vertices.size()];
-			double x1 = p1[0];
-			double y1 = p1[1];
-			double x2 = p2[0];
-			double y2 = p2[1];
-			output << "  0\n"
-						 << "LINE\n";
-			// Some importers (e.g. Inkscape) needs a layer to be specified
-      // The [X1 Y1 X2 Y2] order is the most common and can be parsed linearly.
+		const size_t n = o.vertices.size();
+		xs.assign(n, std::string());
+		ys.assign(n, std::string());
+		for (size_t i=0;i<n;i++) {
+			append_number(o.vertices[i][0], xs[i]);
+			append_number(o.vertices[i][1], ys[i]);
+		}
+		for (size_t i=0;i<n;i++) {
+			const size_t j = (i+1)%n;
+			// The [X1 Y1 X2 Y2] order is the most common and can be parsed linearly.
 			// Some libraries, like the python libraries dxfgrabber and ezdxf, cannot open [X1 X2 Y1 Y2] order.
-			output << "  8\n"
-						 << "0\n"
-						 << " 10\n"
-						 << x1 << "\n"
-						 << " 20\n"
-						 << y1 << "\n"
-						 << " 11\n"
-						 << x2 << "\n"
-						 << " 21\n"
-						 << y2 << "\n";
+			buf += header;
+			buf.append(" 10\n").append(xs[i]).append("\n");
+			buf.append(" 20\n").append(ys[i]).append("\n");
+			buf.append(" 11\n").append(xs[j]).append("\n");
+			buf.append(" 21\n").append(ys[j]).append("\n");
+			if (buf.size() >= DXF_BUFFER_SIZE) {
+				output.write(buf.data(), buf.size());
+				buf.clear();
+			}
 		}
 	}
+	output.write(buf.data(), buf.size());
+}
 
+static void write_dxf_footer(std::ostream &output)
+{
 	output << "  0\n"
 				 << "ENDSEC\n";
 
@@ -88,8 +101,27 @@ void export_dxf(const Polygon2d &poly, std::ostream &output)
 
 	output << "  0\n"
 				 <<"EOF\n";
+}
+
+/*!
+	Saves the current Polygon2d as DXF to the given absolute filename.
+ */
+void export_dxf(const Polygon2d &poly, std::ostream &output)
+{
+	write_dxf_header(output);
+	write_dxf_lines(poly, "0", output);
+	write_dxf_footer(output);
+}
 
-	setlocale(LC_NUMERIC, "");      // Set default locale
+/*!
+	Saves \a layers as the layers of one DXF file, for example the slices of
+	an object for laser cutting.
+*/
+void export_dxf(const std::vector<ExportLayer> &layers, std::ostream &output)
+{
+	write_dxf_header(output);
+	for(const auto &layer : layers) write_dxf_lines(*layer.polygon, layer.name, output);
+	write_dxf_footer(output);
 }
 
 void export_dxf(const shared_ptr<const Geometry> &geom, std::ostream &output)
@@ -28,47 +28,39 @@
 #include "polyset.h"
 #include "polyset-utils.h"
 #include "dxfdata.h"
+#include "NumberFormat.h"
 
 #ifdef ENABLE_CGAL
 #include "CGAL_Nef_polyhedron.h"
 #include "cgal.h"
 #include "cgalutils.h"
 
-#include "Reindexer.h"
-#include "grid.h"
-
-struct IndexedMesh {
-	IndexedMesh() : numfaces(0) {}
-
-	Reindexer<Vector3d> vertices;
-	std::vector<int> indices;
-	size_t numfaces;
-};
-
-
-static void append_geometry(const PolySet &ps, IndexedMesh &mesh)
+static void export_off(const PolySet &ps, std::ostream &output)
 {
-	for(const auto &p : ps.polygons) {
-		for(const auto &v : p) {
-			mesh.indices.push_back(mesh.vertices.lookup(v));
-		}
-		mesh.numfaces++;
-		mesh.indices.push_back(-1);
+	// The PolySet vertices are already unique, so they can be written as-is
+	output << "OFF " << ps.numVertices() << " " << ps.numPolygons() << " 0\n";
+	for(const auto &v : ps.getVertices()) {
+		output << Number(v[0]) << " " << Number(v[1]) << " " << Number(v[2]) << " " << "\n";
+	}
+	for(const auto &p : ps.faces()) {
+		output << p.size();
+		for (size_t n=0;n<p.size();n++) output << " " << p.index(n);
+		output << "\n";
 	}
 }
 
-void append_geometry(const shared_ptr<const Geometry> &geom, IndexedMesh &mesh)
+void export_off(const shared_ptr<const Geometry> &geom, std::ostream &output)
 {
 	if (const CGAL_Nef_polyhedron *N = dynamic_cast<const CGAL_Nef_polyhedron *>(geom.get())) {
 		PolySet ps(3);
 		bool err = CGALUtils::createPolySetFromNefPolyhedron3(*(N->p3), ps);
 		if (err) { PRINT("ERROR: Nef->PolySet failed"); }
 		else {
-			append_geometry(ps, mesh);
+			export_off(ps, output);
 		}
 	}
 	else if (const PolySet *ps = dynamic_cast<const PolySet *>(geom.get())) {
-		append_geometry(*ps, mesh);
+		export_off(*ps, output);
 	}
 	else if (const Polygon2d *poly = dynamic_cast<const Polygon2d *>(geom.get())) {
 		assert(false && "Unsupported file format");
@@ -77,28 +69,4 @@ void append_geometry(const shared_ptr<const Geometry> &geom, IndexedMesh &mesh)
 	}
 }
 
-void export_off(const shared_ptr<const Geometry> &geom, std::ostream &output)
-{
-	IndexedMesh mesh;
-	append_geometry(geom, mesh);
-
-	output << "OFF " << mesh.vertices.size() << " " << mesh.numfaces << " 0\n";
-	const Vector3d *v = mesh.vertices.getArray();
-	size_t numverts = mesh.vertices.size();
-	for (size_t i=0;i<numverts;i++) {
-		output << v[i][0] << " " << v[i][1] << " " << v[i][2] << " " << "\n";
-	}
-	size_t cnt = 0;
-	for (size_t i=0;i<mesh.numfaces;i++) {
-		size_t nverts = 0;
-		while (mesh.indices[cnt++] != -1) nverts++;
-		output << nverts;
-		cnt -= nverts + 1;
-		for (size_t n=0;n<nverts;n++) output << " " << mesh.indices[cnt++];
-		output << "\n";
-        cnt++; // Skip the -1 marker
-	}
-
-}
-
 #endif // ENABLE_CGAL
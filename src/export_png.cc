@@ -3,8 +3,50 @@
 #include "OffscreenView.h"
 #include "CsgInfo.h"
 #include <stdio.h>
+#include <fstream>
+#include <algorithm>
+#include <functional>
+#include <mutex>
 #include "polyset.h"
 #include "rendersettings.h"
+#include "imageutils.h"
+
+PngWriter::PngWriter() : pending(0), ok(true)
+{
+	// Limits the number of images held in memory while waiting for encoding
+	this->maxpending = 2 * std::max(1u, ThreadPool::instance()->size());
+}
+
+/*!
+	Queues \a image, RGBA rows from top to bottom, for writing to \a filename.
+*/
+void PngWriter::write(const std::string &filename, const shared_ptr<std::vector<unsigned char>> &image, int width, int height)
+{
+	ThreadPool::instance()->run(this->group, [this, filename, image, width, height]() {
+			std::ofstream fstream(filename.c_str(), std::ios::out | std::ios::binary);
+			if (!fstream.is_open()) {
+				PRINTB("Can't open file \"%s\" for export", filename);
+				this->ok = false;
+				return;
+			}
+			if (!write_png(fstream, &(*image)[0], width, height)) this->ok = false;
+		});
+	if (++this->pending == this->maxpending) {
+		ThreadPool::instance()->wait(this->group);
+		this->pending = 0;
+	}
+}
+
+/*!
+	Waits until all queued images are written. Returns false if any of
+	them couldn't be written.
+*/
+bool PngWriter::wait()
+{
+	ThreadPool::instance()->wait(this->group);
+	this->pending = 0;
+	return this->ok;
+}
 
 #ifdef ENABLE_CGAL
 #include "CGALRenderer.h"
@@ -19,26 +61,95 @@ static void setupCamera(Camera &cam, const BoundingBox &bbox)
 	if (cam.viewall) cam.viewAll(bbox);
 }
 
-void export_png(const shared_ptr<const Geometry> &root_geom, Camera &cam, std::ostream &output)
+// Images are rendered one at a time, as OpenCSG keeps its state in globals
+static std::mutex render_mutex;
+
+/*!
+	Returns an offscreen view of the given size. The view and its GL context
+	are kept for later exports of the same size, as creating a context costs
+	more than rendering a small image. A GL context is current on one thread
+	only, so each thread has its own view.
+*/
+static OffscreenView *get_offscreen_view(unsigned int width, unsigned int height)
 {
-	PRINTD("export_png geom");
-	OffscreenView *glview;
-	try {
-		glview = new OffscreenView(cam.pixel_width, cam.pixel_height);
-	} catch (int error) {
-		fprintf(stderr,"Can't create OpenGL OffscreenView. Code: %i.\n", error);
-		return;
+	static thread_local OffscreenView *glview = NULL;
+	if (glview && (glview->width != width || glview->height != height)) {
+		delete glview;
+		glview = NULL;
 	}
-	CGALRenderer cgalRenderer(root_geom);
-
-	BoundingBox bbox = cgalRenderer.getBoundingBox();
-	setupCamera(cam, bbox);
+	if (!glview) {
+		try {
+			glview = new OffscreenView(width, height);
+		} catch (int error) {
+			fprintf(stderr,"Can't create OpenGL OffscreenView. Code: %i.\n", error);
+			return NULL;
+		}
+	}
+	return glview;
+}
 
+static bool render_view(OffscreenView *glview, Camera &cam, std::ostream &output)
+{
+	setupCamera(cam, glview->getRenderer()->getBoundingBox());
 	glview->setCamera(cam);
+	glview->paintGL();
+	return glview->save(output);
+}
+
+/*!
+	Renders each of \a views and queues it on \a writer. A frame is read
+	back while the next one is rendered. All views must have the size of
+	\a glview.
+*/
+static void render_views(OffscreenView *glview, std::vector<PngView> &views, PngWriter &writer)
+{
+	const BoundingBox bbox = glview->getRenderer()->getBoundingBox();
+	auto finish = [&](size_t i) {
+		shared_ptr<std::vector<unsigned char>> image(new std::vector<unsigned char>);
+		glview->finishReadback(i % OffscreenView::READBACK_SLOTS, *image);
+		writer.write(views[i].filename, image, glview->width, glview->height);
+	};
+
+	for (size_t i = 0; i < views.size(); i++) {
+		setupCamera(views[i].camera, bbox);
+		glview->setCamera(views[i].camera);
+		glview->paintGL();
+		glview->startReadback(i % OffscreenView::READBACK_SLOTS);
+		if (i > 0) finish(i - 1);
+	}
+	if (!views.empty()) finish(views.size() - 1);
+}
+
+static bool export_png_common(const shared_ptr<const Geometry> &root_geom, const Camera &size,
+															const std::function<bool(OffscreenView *)> &render)
+{
+	std::lock_guard<std::mutex> lock(render_mutex);
+	OffscreenView *glview = get_offscreen_view(size.pixel_width, size.pixel_height);
+	if (!glview) return false;
+	CGALRenderer cgalRenderer(root_geom);
 	glview->setRenderer(&cgalRenderer);
 	glview->setColorScheme(RenderSettings::inst()->colorscheme);
-	glview->paintGL();
-	glview->save(output);
+	const bool ok = render(glview);
+	glview->setRenderer(NULL);
+	return ok;
+}
+
+void export_png(const shared_ptr<const Geometry> &root_geom, Camera &cam, std::ostream &output)
+{
+	PRINTD("export_png geom");
+	export_png_common(root_geom, cam, [&](OffscreenView *glview) {
+			return render_view(glview, cam, output);
+		});
+}
+
+bool export_png(const shared_ptr<const Geometry> &root_geom, std::vector<PngView> &views, PngWriter &writer)
+{
+	PRINTD("export_png geom views");
+	if (views.empty()) return true;
+	return export_png_common(root_geom, views[0].camera, [&](OffscreenView *glview) {
+			render_views(glview, views, writer);
+			return true;
+		});
 }
 
 enum Previewer { OPENCSG, THROWNTOGETHER } previewer;
@@ -49,19 +160,16 @@ enum Previewer { OPENCSG, THROWNTOGETHER } previewer;
 #endif
 #include "ThrownTogetherRenderer.h"
 
-void export_png_preview_common(Tree &tree, Camera &cam, std::ostream &output, Previewer previewer = OPENCSG)
+static bool export_png_preview_common(Tree &tree, const Camera &size, Previewer previewer,
+																			const std::function<bool(OffscreenView *)> &render)
 {
 	PRINTD("export_png_preview_common");
 	CsgInfo csgInfo = CsgInfo();
-  csgInfo.compile_products(tree);
-
-	OffscreenView *glview;
-	try {
-		glview = new OffscreenView(cam.pixel_width, cam.pixel_height);
-	} catch (int error) {
-		fprintf(stderr,"Can't create OpenGL OffscreenView. Code: %i.\n", error);
-		return;
-	}
+	csgInfo.compile_products(tree);
+
+	std::lock_guard<std::mutex> lock(render_mutex);
+	OffscreenView *glview = get_offscreen_view(size.pixel_width, size.pixel_height);
+	if (!glview) return false;
 
 #ifdef ENABLE_OPENCSG
 	OpenCSGRenderer openCSGRenderer(csgInfo.root_products, csgInfo.highlights_products, csgInfo.background_products, glview->shaderinfo);
@@ -75,32 +183,58 @@ void export_png_preview_common(Tree &tree, Camera &cam, std::ostream &output, Pr
 #endif
 		glview->setRenderer(&thrownTogetherRenderer);
 #ifdef ENABLE_OPENCSG
-	BoundingBox bbox = glview->getRenderer()->getBoundingBox();
-	setupCamera(cam, bbox);
-
-	glview->setCamera(cam);
 	OpenCSG::setContext(0);
 	OpenCSG::setOption(OpenCSG::OffscreenSetting, OpenCSG::FrameBufferObject);
 #endif
 	glview->setColorScheme(RenderSettings::inst()->colorscheme);
-	glview->paintGL();
-	glview->save(output);
+	const bool ok = render(glview);
+	glview->setRenderer(NULL);
+	return ok;
 }
 
 void export_png_with_opencsg(Tree &tree, Camera &cam, std::ostream &output)
 {
 	PRINTD("export_png_w_opencsg");
 #ifdef ENABLE_OPENCSG
-	export_png_preview_common(tree, cam, output, OPENCSG);
+	export_png_preview_common(tree, cam, OPENCSG, [&](OffscreenView *glview) {
+			return render_view(glview, cam, output);
+		});
 #else
 	fprintf(stderr,"This openscad was built without OpenCSG support\n");
 #endif
 }
 
+bool export_png_with_opencsg(Tree &tree, std::vector<PngView> &views, PngWriter &writer)
+{
+	PRINTD("export_png_w_opencsg views");
+#ifdef ENABLE_OPENCSG
+	if (views.empty()) return true;
+	return export_png_preview_common(tree, views[0].camera, OPENCSG, [&](OffscreenView *glview) {
+			render_views(glview, views, writer);
+			return true;
+		});
+#else
+	fprintf(stderr,"This openscad was built without OpenCSG support\n");
+	return false;
+#endif
+}
+
 void export_png_with_throwntogether(Tree &tree, Camera &cam, std::ostream &output)
 {
 	PRINTD("export_png_w_thrown");
-	export_png_preview_common(tree, cam, output, THROWNTOGETHER);
+	export_png_preview_common(tree, cam, THROWNTOGETHER, [&](OffscreenView *glview) {
+			return render_view(glview, cam, output);
+		});
+}
+
+bool export_png_with_throwntogether(Tree &tree, std::vector<PngView> &views, PngWriter &writer)
+{
+	PRINTD("export_png_w_thrown views");
+	if (views.empty()) return true;
+	return export_png_preview_common(tree, views[0].camera, THROWNTOGETHER, [&](OffscreenView *glview) {
+			render_views(glview, views, writer);
+			return true;
+		});
 }
 
 #endif // ENABLE_CGAL
@@ -0,0 +1,125 @@
+#include "export.h"
+#include "printutils.h"
+#include "polyset.h"
+#include "polyset-utils.h"
+#include "SharedMesh.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef ENABLE_CGAL
+#include "CGAL_Nef_polyhedron.h"
+#include "cgal.h"
+#include "cgalutils.h"
+
+// The name of the shared memory object for an output file
+static std::string shm_name(const std::string &filename)
+{
+	const size_t slash = filename.find_last_of("/\\");
+	return "/" + (slash == std::string::npos ? filename : filename.substr(slash + 1));
+}
+
+static uint64_t aligned(uint64_t offset)
+{
+	return (offset + 15) & ~uint64_t(15);
+}
+
+/*!
+	Exports the triangles of the geometry to the shared memory object named
+	after \a filename, in the layout described in SharedMesh.h.
+*/
+void export_shm(const shared_ptr<const Geometry> &geom, const char *filename)
+{
+#ifdef _WIN32
+	PRINTB("ERROR: Can't export \"%s\": Shared memory export isn't supported on this platform", filename);
+#else
+	PolySet triangulated(3);
+	if (const CGAL_Nef_polyhedron *N = dynamic_cast<const CGAL_Nef_polyhedron *>(geom.get())) {
+		if (!N->p3->is_simple()) {
+			PRINT("WARNING: Exported object may not be a valid 2-manifold and may need repair");
+		}
+		// The PolySet of a Nef polyhedron is already triangulated
+		if (CGALUtils::createPolySetFromNefPolyhedron3(*(N->p3), triangulated)) {
+			PRINT("ERROR: Nef->PolySet failed");
+			return;
+		}
+	}
+	else if (const PolySet *ps = dynamic_cast<const PolySet *>(geom.get())) {
+		PolysetUtils::tessellate_faces(*ps, triangulated);
+	}
+	else {
+		assert(false && "Unsupported file format");
+	}
+
+	const std::vector<Vector3d> &vertices = triangulated.getVertices();
+	SharedMeshHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SHAREDMESH_MAGIC, sizeof(header.magic));
+	header.version = SHAREDMESH_VERSION;
+	header.state = SHAREDMESH_WRITING;
+	static std::atomic<uint64_t> generation(0);
+	header.generation = ++generation;
+	header.pid = uint32_t(getpid());
+	header.numvertices = vertices.size();
+	header.numtriangles = triangulated.numPolygons();
+	header.vertexoffset = aligned(sizeof(header));
+	header.indexoffset = aligned(header.vertexoffset + 3 * sizeof(float) * header.numvertices);
+	header.normaloffset = aligned(header.indexoffset + 3 * sizeof(uint32_t) * header.numtriangles);
+	header.size = header.normaloffset + 3 * sizeof(float) * header.numtriangles;
+	const BoundingBox bbox = triangulated.getBoundingBox();
+	for (int i = 0; i < 3 && !bbox.isEmpty(); i++) {
+		header.bbox[i] = float(bbox.min()[i]);
+		header.bbox[i + 3] = float(bbox.max()[i]);
+	}
+
+	// Consumers keep their mappings of the previous object
+	const std::string name = shm_name(filename);
+	shm_unlink(name.c_str());
+	const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) {
+		PRINTB("ERROR: Can't create shared memory object \"%s\": %s", name % strerror(errno));
+		return;
+	}
+	void *data = MAP_FAILED;
+	if (ftruncate(fd, off_t(header.size)) == 0) {
+		data = mmap(NULL, header.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (data == MAP_FAILED) {
+		PRINTB("ERROR: Can't map shared memory object \"%s\": %s", name % strerror(errno));
+		shm_unlink(name.c_str());
+		return;
+	}
+
+	char *base = static_cast<char *>(data);
+	memcpy(base, &header, sizeof(header));
+	float *outvertices = reinterpret_cast<float *>(base + header.vertexoffset);
+	for (const auto &v : vertices) {
+		for (int i = 0; i < 3; i++) *outvertices++ = float(v[i]);
+	}
+	uint32_t *outindices = reinterpret_cast<uint32_t *>(base + header.indexoffset);
+	float *outnormals = reinterpret_cast<float *>(base + header.normaloffset);
+	for (const auto &face : triangulated.faces()) {
+		for (int i = 0; i < 3; i++) *outindices++ = uint32_t(face.index(i));
+		Vector3d normal = (face[1] - face[0]).cross(face[2] - face[0]);
+		normal.normalize();
+		if (!is_finite(normal) || is_nan(normal)) normal = Vector3d(0, 0, 0);
+		for (int i = 0; i < 3; i++) *outnormals++ = float(normal[i]);
+	}
+
+	SharedMeshHeader *shared = reinterpret_cast<SharedMeshHeader *>(base);
+	__atomic_store_n(&shared->state, uint32_t(SHAREDMESH_READY), __ATOMIC_RELEASE);
+	munmap(data, header.size);
+#endif
+}
+
+#endif // ENABLE_CGAL
@@ -28,166 +28,38 @@
 #include "polyset.h"
 #include "polyset-utils.h"
 #include "dxfdata.h"
+#include "NumberFormat.h"
+
+#include <string.h>
+#include <stdint.h>
 
 #ifdef ENABLE_CGAL
 #include "CGAL_Nef_polyhedron.h"
 #include "cgal.h"
 #include "cgalutils.h"
 
-static void append_stl(const PolySet &ps, std::ostream &output)
+static std::string vertex_string(const Vector3d &v)
 {
-	PolySet triangulated(3);
-	PolysetUtils::tessellate_faces(ps, triangulated);
-
-	setlocale(LC_NUMERIC, "C"); // Ensure radix is . (not ,) in output
-	for(const auto &p : triangulated.polygons) {
-		assert(p.size() == 3); // STL only allows triangles
-		std::stringstream stream;
-		stream << p[0][0] << " " << p[0][1] << " " << p[0][2];
-		std::string vs1 = stream.str();
-		stream.str("");
-		stream << p[1][0] << " " << p[1][1] << " " << p[1][2];
-		std::string vs2 = stream.str();
-		stream.str("");
-		stream << p[2][0] << " " << p[2][1] << " " << p[2][2];
-		std::string vs3 = stream.str();
-		if (vs1 != vs2 && vs1 != vs3 && vs2 != vs3) {
-			// The above condition ensures that there are 3 distinct vertices, but
-			// they may be collinear. If they are, the unit normal is meaningless
-			// so the default value of "1 0 0" can be used. If the vertices are not
-			// collinear then the unit normal must be calculated from the
-			// components.
-			output << "  facet normal ";
-			Vector3d normal = (p[1] - p[0]).cross(p[2] - p[0]);
-			normal.normalize();
-			if (is_finite(normal) && !is_nan(normal)) {
-				output << normal[0] << " " << normal[1] << " " << normal[2] << "\n";
-			}
-			else {
-				output << "0 0 0\n";
-			}
-			output << "    outer loop\n";
-		
-			for(const auto &v : p) {
-				output << "      vertex " << v[0] << " " << v[1] << " " << v[2] << "\n";
-			}
-			output << "    endloop\n";
-			output << "  endfacet\n";
-		}
-	}
-	setlocale(LC_NUMERIC, "");      // Set default locale
-}
-
-static void append_stl(const CGAL_Polyhedron &P, std::ostream &output)
-{
-	typedef CGAL_Polyhedron::Vertex                                 Vertex;
-	typedef CGAL_Polyhedron::Vertex_const_iterator                  VCI;
-	typedef CGAL_Polyhedron::Facet_const_iterator                   FCI;
-	typedef CGAL_Polyhedron::Halfedge_around_facet_const_circulator HFCC;
-
-	for (FCI fi = P.facets_begin(); fi != P.facets_end(); ++fi) {
-		HFCC hc = fi->facet_begin();
-		HFCC hc_end = hc;
-		Vertex v1, v2, v3;
-		v1 = *VCI((hc++)->vertex());
-		v3 = *VCI((hc++)->vertex());
-		do {
-			v2 = v3;
-			v3 = *VCI((hc++)->vertex());
-			double x1 = CGAL::to_double(v1.point().x());
-			double y1 = CGAL::to_double(v1.point().y());
-			double z1 = CGAL::to_double(v1.point().z());
-			double x2 = CGAL::to_double(v2.point().x());
-			double y2 = CGAL::to_double(v2.point().y());
-			double z2 = CGAL::to_double(v2.point().z());
-			double x3 = CGAL::to_double(v3.point().x());
-			double y3 = CGAL::to_double(v3.point().y());
-			double z3 = CGAL::to_double(v3.point().z());
-			std::stringstream stream;
-			stream << x1 << " " << y1 << " " << z1;
-			std::string vs1 = stream.str();
-			stream.str("");
-			stream << x2 << " " << y2 << " " << z2;
-			std::string vs2 = stream.str();
-			stream.str("");
-			stream << x3 << " " << y3 << " " << z3;
-			std::string vs3 = stream.str();
-			if (vs1 != vs2 && vs1 != vs3 && vs2 != vs3) {
-				// The above condition ensures that there are 3 distinct vertices, but
-				// they may be collinear. If they are, the unit normal is meaningless
-				// so the default value of "1 0 0" can be used. If the vertices are not
-				// collinear then the unit normal must be calculated from the
-				// components.
-				if (!CGAL::collinear(v1.point(),v2.point(),v3.point())) {
-					CGAL_Polyhedron::Traits::Vector_3 normal = CGAL::normal(v1.point(),v2.point(),v3.point());
-					output << "  facet normal "
-								 << CGAL::sign(normal.x()) * sqrt(CGAL::to_double(normal.x()*normal.x()/normal.squared_length()))
-								 << " "
-								 << CGAL::sign(normal.y()) * sqrt(CGAL::to_double(normal.y()*normal.y()/normal.squared_length()))
-								 << " "
-								 << CGAL::sign(normal.z()) * sqrt(CGAL::to_double(normal.z()*normal.z()/normal.squared_length()))
-								 << "\n";
-				}
-				else output << "  facet normal 1 0 0\n";
-				output << "    outer loop\n";
-				output << "      vertex " << vs1 << "\n";
-				output << "      vertex " << vs2 << "\n";
-				output << "      vertex " << vs3 << "\n";
-				output << "    endloop\n";
-				output << "  endfacet\n";
-			}
-		} while (hc != hc_end);
-	}
+	std::ostringstream stream;
+	stream << Number(v[0]) << " " << Number(v[1]) << " " << Number(v[2]);
+	return stream.str();
 }
 
 /*!
-	Saves the current 3D CGAL Nef polyhedron as STL to the given file.
-	The file must be open.
- */
-static void append_stl(const CGAL_Nef_polyhedron &root_N, std::ostream &output)
-{
-	if (!root_N.p3->is_simple()) {
-		PRINT("WARNING: Exported object may not be a valid 2-manifold and may need repair");
-	}
-
-	bool usePolySet = true;
-	if (usePolySet) {
-		PolySet ps(3);
-		bool err = CGALUtils::createPolySetFromNefPolyhedron3(*(root_N.p3), ps);
-		if (err) { PRINT("ERROR: Nef->PolySet failed"); }
-		else {
-			append_stl(ps, output);
-		}
-	}
-	else {
-		CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
-		try {
-			CGAL_Polyhedron P;
-			//root_N.p3->convert_to_Polyhedron(P);
-			bool err = nefworkaround::convert_to_Polyhedron<CGAL_Kernel3>( *(root_N.p3), P );
-			if (err) {
-				PRINT("ERROR: CGAL NefPolyhedron->Polyhedron conversion failed");
-				return;
-			}
-			append_stl(P, output);
-		}
-		catch (const CGAL::Assertion_exception &e) {
-			PRINTB("ERROR: CGAL error in CGAL_Nef_polyhedron3::convert_to_Polyhedron(): %s", e.what());
-		}
-		catch (...) {
-			PRINT("ERROR: CGAL unknown error in CGAL_Nef_polyhedron3::convert_to_Polyhedron()");
-		}
-		CGAL::set_error_behaviour(old_behaviour);
-	}
-}
-
-static void append_stl(const shared_ptr<const Geometry> &geom, std::ostream &output)
+	Passes the triangles of the geometry to \a sink. Faces are tessellated
+	one at a time while they are written, so no triangulated copy of the
+	mesh is built.
+*/
+static void for_each_triangle(const shared_ptr<const Geometry> &geom, const TriangleSink &sink)
 {
 	if (const CGAL_Nef_polyhedron *N = dynamic_cast<const CGAL_Nef_polyhedron *>(geom.get())) {
-		append_stl(*N, output);
+		if (!N->p3->is_simple()) {
+			PRINT("WARNING: Exported object may not be a valid 2-manifold and may need repair");
+		}
+		CGALUtils::tessellateNefPolyhedron3(*(N->p3), sink);
 	}
 	else if (const PolySet *ps = dynamic_cast<const PolySet *>(geom.get())) {
-		append_stl(*ps, output);
+		PolysetUtils::tessellate_faces(*ps, sink);
 	}
 	else if (const Polygon2d *poly = dynamic_cast<const Polygon2d *>(geom.get())) {
 		assert(false && "Unsupported file format");
@@ -196,15 +68,125 @@ static void append_stl(const shared_ptr<const Geometry> &geom, std::ostream &out
 	}
 }
 
+static void write_facet(const Vector3d &v0, const Vector3d &v1, const Vector3d &v2, std::ostream &output)
+{
+	const std::string vs1 = vertex_string(v0);
+	const std::string vs2 = vertex_string(v1);
+	const std::string vs3 = vertex_string(v2);
+	if (vs1 != vs2 && vs1 != vs3 && vs2 != vs3) {
+		// The above condition ensures that there are 3 distinct vertices, but
+		// they may be collinear. If they are, the unit normal is meaningless
+		// so the default value of "1 0 0" can be used. If the vertices are not
+		// collinear then the unit normal must be calculated from the
+		// components.
+		output << "  facet normal ";
+		Vector3d normal = (v1 - v0).cross(v2 - v0);
+		normal.normalize();
+		if (is_finite(normal) && !is_nan(normal)) {
+			output << Number(normal[0]) << " " << Number(normal[1]) << " " << Number(normal[2]) << "\n";
+		}
+		else {
+			output << "0 0 0\n";
+		}
+		output << "    outer loop\n";
+		output << "      vertex " << vs1 << "\n";
+		output << "      vertex " << vs2 << "\n";
+		output << "      vertex " << vs3 << "\n";
+		output << "    endloop\n";
+		output << "  endfacet\n";
+	}
+}
+
 void export_stl(const shared_ptr<const Geometry> &geom, std::ostream &output)
 {
-	setlocale(LC_NUMERIC, "C"); // Ensure radix is . (not ,) in output
 	output << "solid OpenSCAD_Model\n";
 
-	append_stl(geom, output);
+	for_each_triangle(geom, [&output](const Vector3d &v0, const Vector3d &v1, const Vector3d &v2) {
+			write_facet(v0, v1, v2, output);
+		});
 
 	output << "endsolid OpenSCAD_Model\n";
-	setlocale(LC_NUMERIC, "");      // Set default locale
+}
+
+/*!
+	Writes the little-endian IEEE 754 representation of \a f to \a buf.
+*/
+static void put_float(unsigned char *buf, float f)
+{
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	for (int i = 0; i < 4; i++) buf[i] = (bits >> (8 * i)) & 0xff;
+}
+
+static void put_uint32(unsigned char *buf, uint32_t n)
+{
+	for (int i = 0; i < 4; i++) buf[i] = (n >> (8 * i)) & 0xff;
+}
+
+/*!
+	Returns true if two vertices of the triangle are the same once rounded
+	to single precision. Such facets are left out, like the ASCII writer
+	leaves out facets with the same printed vertices.
+*/
+static bool is_degenerate_float(const Vector3d &v0, const Vector3d &v1, const Vector3d &v2)
+{
+	const Eigen::Vector3f f0 = v0.cast<float>(), f1 = v1.cast<float>(), f2 = v2.cast<float>();
+	return f0 == f1 || f0 == f2 || f1 == f2;
+}
+
+/*!
+	Exports the geometry as binary STL: An 80 byte header, the number of
+	facets, and 50 bytes per facet with the normal and vertices as
+	single precision floats.
+
+	The facets are written while they are tessellated. The count is filled
+	in afterwards if the stream can seek, otherwise the triangles are
+	counted in a first pass.
+*/
+void export_stl_binary(const shared_ptr<const Geometry> &geom, std::ostream &output)
+{
+	const std::streampos start = output.tellp();
+	const bool seekable = start != std::streampos(-1);
+
+	uint32_t count = 0;
+	if (!seekable) {
+		for_each_triangle(geom, [&count](const Vector3d &v0, const Vector3d &v1, const Vector3d &v2) {
+				if (!is_degenerate_float(v0, v1, v2)) count++;
+			});
+	}
+
+	unsigned char header[84];
+	memset(header, 0, sizeof(header));
+	const char name[] = "OpenSCAD_Model";
+	memcpy(header, name, sizeof(name) - 1);
+	put_uint32(header + 80, count);
+	output.write(reinterpret_cast<const char *>(header), sizeof(header));
+
+	unsigned char facet[50];
+	memset(facet, 0, sizeof(facet)); // Attribute byte count is 0
+	uint32_t written = 0;
+	for_each_triangle(geom, [&](const Vector3d &v0, const Vector3d &v1, const Vector3d &v2) {
+			if (is_degenerate_float(v0, v1, v2)) return;
+			Vector3d normal = (v1 - v0).cross(v2 - v0);
+			normal.normalize();
+			if (!is_finite(normal) || is_nan(normal)) normal = Vector3d(0, 0, 0);
+			const Vector3d *v[3] = { &v0, &v1, &v2 };
+			for (int i = 0; i < 3; i++) put_float(facet + 4 * i, normal[i]);
+			for (int j = 0; j < 3; j++) {
+				for (int i = 0; i < 3; i++) put_float(facet + 12 + 12 * j + 4 * i, (*v[j])[i]);
+			}
+			output.write(reinterpret_cast<const char *>(facet), sizeof(facet));
+			written++;
+		});
+
+	if (seekable) {
+		const std::streampos end = output.tellp();
+		unsigned char buf[4];
+		put_uint32(buf, written);
+		output.seekp(start + std::streamoff(80));
+		output.write(reinterpret_cast<const char *>(buf), sizeof(buf));
+		output.seekp(end);
+	}
 }
 
 #endif // ENABLE_CGAL
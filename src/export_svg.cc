@@ -27,28 +27,63 @@
 #include "export.h"
 #include "polyset.h"
 #include "polyset-utils.h"
+#include "NumberFormat.h"
 
+// The path is written to the stream in pieces of about this size
+static const size_t SVG_BUFFER_SIZE = 64 * 1024;
+
+// The coordinate \a x as written with the precision of absolute coordinates
+static double rounded(double x)
+{
+	char buf[NUMBER_BUFFER_SIZE];
+	const int len = format_number(x, buf);
+	double result;
+	return parse_number(buf, buf + len, result) ? result : x;
+}
+
+/*!
+	Writes the outlines of \a poly as one path. Each outline starts with an
+	absolute moveto, followed by a single relative lineto for all its other
+	vertices. The offsets are taken from the position the offsets written
+	so far lead to, so their rounding errors don't add up along the outline.
+	Vertices which don't move once rounded are left out.
+*/
 static void append_svg(const Polygon2d &poly, std::ostream &output)
 {
-	output << "<path d=\"\n";
+	std::string buf = "<path d=\"\n";
 	for(const auto &o : poly.outlines()) {
 		if (o.vertices.empty()) {
 			continue;
 		}
-		
-		const Eigen::Vector2d& p0 = o.vertices[0];
-		output << "M " << p0.x() << "," << -p0.y();
-		for (unsigned int idx = 1;idx < o.vertices.size();idx++) {
-			const Eigen::Vector2d& p = o.vertices[idx];
-			output << " L " << p.x() << "," << -p.y();
-			if ((idx % 6) == 5) {
-				output << "\n";
-			}
+
+		buf += "M ";
+		double x = append_number(o.vertices[0].x(), buf);
+		buf += ",";
+		double y = append_number(-o.vertices[0].y(), buf);
+		double lastx = x, lasty = y;
+		size_t written = 0;
+		for (size_t idx = 1; idx < o.vertices.size(); idx++) {
+			const double px = rounded(o.vertices[idx].x());
+			const double py = rounded(-o.vertices[idx].y());
+			if (px == lastx && py == lasty) continue;
+			buf += written == 0 ? " l " : ((written % 8) == 0 ? "\n" : " ");
+			if (px == lastx) buf += "0";
+			else x += append_number(px - x, buf);
+			buf += ",";
+			if (py == lasty) buf += "0";
+			else y += append_number(py - y, buf);
+			lastx = px;
+			lasty = py;
+			written++;
+		}
+		buf += " z\n";
+		if (buf.size() >= SVG_BUFFER_SIZE) {
+			output.write(buf.data(), buf.size());
+			buf.clear();
 		}
-		output << " z\n";
 	}
-	output << "\" stroke=\"black\" fill=\"lightgray\" stroke-width=\"0.5\"/>\n";
-
+	buf += "\" stroke=\"black\" fill=\"lightgray\" stroke-width=\"0.5\"/>\n";
+	output.write(buf.data(), buf.size());
 }
 
 static void append_svg(const shared_ptr<const Geometry> &geom, std::ostream &output)
@@ -63,11 +98,8 @@ static void append_svg(const shared_ptr<const Geometry> &geom, std::ostream &out
 	}
 }
 
-void export_svg(const shared_ptr<const Geometry> &geom, std::ostream &output)
+static void write_svg_header(const BoundingBox &bbox, std::ostream &output)
 {
-	setlocale(LC_NUMERIC, "C"); // Ensure radix is . (not ,) in output
-	
-	BoundingBox bbox = geom->getBoundingBox();
 	int minx = floor(bbox.min().x());
 	int miny = floor(-bbox.max().y());
 	int maxx = ceil(bbox.max().x());
@@ -82,9 +114,31 @@ void export_svg(const shared_ptr<const Geometry> &geom, std::ostream &output)
 		<< "mm\" viewBox=\"" << minx << " " << miny << " " << width << " " << height
 		<< "\" xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\">\n"
 		<< "<title>OpenSCAD Model</title>\n";
+}
 
+void export_svg(const shared_ptr<const Geometry> &geom, std::ostream &output)
+{
+	write_svg_header(geom->getBoundingBox(), output);
 	append_svg(geom, output);
+	output << "</svg>\n";
+}
 
-	output << "</svg>\n";	
-	setlocale(LC_NUMERIC, "");      // Set default locale
+/*!
+	Saves \a layers as groups of one SVG file, each with the id of its
+	layer name.
+*/
+void export_svg(const std::vector<ExportLayer> &layers, std::ostream &output)
+{
+	BoundingBox bbox;
+	for(const auto &layer : layers) {
+		if (!layer.polygon->isEmpty()) bbox.extend(layer.polygon->getBoundingBox());
+	}
+	if (bbox.isEmpty()) bbox = BoundingBox(Vector3d::Zero(), Vector3d::Zero());
+	write_svg_header(bbox, output);
+	for(const auto &layer : layers) {
+		output << "<g id=\"" << layer.name << "\">\n";
+		append_svg(*layer.polygon, output);
+		output << "</g>\n";
+	}
+	output << "</svg>\n";
 }
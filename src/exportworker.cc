@@ -0,0 +1,42 @@
+#include "exportworker.h"
+
+#include "Geometry.h"
+#include "printutils.h"
+#include "ThreadPool.h"
+
+ExportWorker::ExportWorker() : format(OPENSCAD_STL), cancelled(false), running(false)
+{
+}
+
+ExportWorker::~ExportWorker()
+{
+	if (!this->group.isDone()) ThreadPool::instance()->wait(this->group);
+}
+
+bool ExportWorker::isRunning() const
+{
+	return this->running;
+}
+
+/*!
+	Starts exporting \a geom, which is kept alive until the export is done.
+*/
+void ExportWorker::start(const shared_ptr<const Geometry> &geom, FileFormat format,
+												 const std::string &name2open, const std::string &name2display)
+{
+	this->geom = geom;
+	this->format = format;
+	this->name2open = name2open;
+	this->name2display = name2display;
+	this->cancelled = false;
+	this->running = true;
+	ThreadPool::instance()->run(this->group, [this]() { work(); });
+}
+
+void ExportWorker::work()
+{
+	exportFileByName(this->geom, this->format, this->name2open.c_str(), this->name2display.c_str(), &this->cancelled);
+	this->geom.reset();
+	this->running = false;
+	emit done(!this->cancelled);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <QObject>
+#include <atomic>
+#include <string>
+#include "memory.h"
+#include "export.h"
+#include "ThreadPool.h"
+
+/*!
+	Writes an export file as a task on the shared ThreadPool, so the GUI stays responsive
+	while large meshes are converted, tessellated and written. done() is
+	emitted with false if the export was cancelled, in which case the
+	partly written file is removed.
+*/
+class ExportWorker : public QObject
+{
+	Q_OBJECT;
+public:
+	ExportWorker();
+	virtual ~ExportWorker();
+
+	bool isRunning() const;
+	void start(const shared_ptr<const class Geometry> &geom, FileFormat format,
+						 const std::string &name2open, const std::string &name2display);
+
+public slots:
+	void cancel() { this->cancelled = true; }
+
+protected:
+	void work();
+
+signals:
+	void done(bool);
+
+protected:
+	shared_ptr<const Geometry> geom;
+	FileFormat format;
+	std::string name2open;
+	std::string name2display;
+	std::atomic<bool> cancelled;
+	std::atomic<bool> running;
+	ThreadPool::TaskGroup group;
+};
@@ -30,23 +30,24 @@
 #include <assert.h>
 #include <sstream>
 #include <algorithm>
+#include <map>
 #include "printutils.h"
 #include "stackcheck.h"
 #include "exceptions.h"
 #include "feature.h"
+#include "function.h"
+#include "builtin.h"
+#include "ThreadPool.h"
+#include "FunctionCache.h"
 #include <boost/bind.hpp>
 
 // unnamed namespace
 namespace {
 	Value::VectorType flatten(Value::VectorType const& vec) {
-		int n = 0;
+		Value::VectorType ret;
 		for (unsigned int i = 0; i < vec.size(); i++) {
 			assert(vec[i]->type() == Value::VECTOR);
-			n += vec[i]->toVector().size();
-		}
-		Value::VectorType ret; ret.reserve(n);
-		for (unsigned int i = 0; i < vec.size(); i++) {
-			std::copy(vec[i]->toVector().begin(),vec[i]->toVector().end(),std::back_inserter(ret));
+			ret.append(vec[i]->toVector());
 		}
 		return ret;
 	}
@@ -59,6 +60,23 @@ namespace {
 
 namespace /* anonymous*/ {
 
+	void visit_arguments(AssignmentList &args, const Expression::ChildVisitor &visit) {
+		for(auto &arg : args) {
+			if (arg.expr) visit(arg.expr);
+		}
+	}
+
+	void bound_names(const AssignmentList &args, std::vector<std::string> &names) {
+		for(const auto &arg : args) names.push_back(arg.name);
+	}
+
+	bool is_parallel_safe(const AssignmentList &args, const Context *context) {
+		for(const auto &arg : args) {
+			if (arg.expr && !arg.expr->isParallelSafe(context)) return false;
+		}
+		return true;
+	}
+
 	std::ostream &operator << (std::ostream &o, AssignmentList const& l) {
 		for (size_t i=0; i < l.size(); i++) {
 			const Assignment &arg = l[i];
@@ -76,10 +94,34 @@ bool Expression::isListComprehension() const
 	return false;
 }
 
+/*!
+	Replaces a constant expression by a literal holding its value, so it's
+	evaluated once at parse time rather than on every evaluation. The
+	original expression is kept for printing. Takes ownership of expr.
+*/
+Expression *Expression::fold(Expression *expr)
+{
+	if (expr->isLiteral() || !expr->isConstant()) return expr;
+	// A vector of plain literals prints like its value, so it's dropped
+	if (Vector *vector = dynamic_cast<Vector *>(expr)) {
+		if (vector->isPacked()) {
+			Literal *literal = new Literal(vector->takePacked(), vector->location());
+			delete vector;
+			return literal;
+		}
+	}
+	return new Literal(expr->evaluate(NULL), expr);
+}
+
 UnaryOp::UnaryOp(UnaryOp::Op op, Expression *expr, const Location &loc) : Expression(loc), op(op), expr(expr)
 {
 }
 
+bool UnaryOp::isConstant() const
+{
+	return this->expr->isLiteral();
+}
+
 ValuePtr UnaryOp::evaluate(const Context *context) const
 {
 	switch (this->op) {
@@ -113,11 +155,26 @@ void UnaryOp::print(std::ostream &stream) const
 	stream << opString() << *this->expr;
 }
 
+bool UnaryOp::isParallelSafe(const Context *context) const
+{
+	return this->expr->isParallelSafe(context);
+}
+
+void UnaryOp::forEachChild(const ChildVisitor &visit)
+{
+	visit(this->expr);
+}
+
 BinaryOp::BinaryOp(Expression *left, BinaryOp::Op op, Expression *right, const Location &loc) :
 	Expression(loc), op(op), left(left), right(right)
 {
 }
 
+bool BinaryOp::isConstant() const
+{
+	return this->left->isLiteral() && this->right->isLiteral();
+}
+
 ValuePtr BinaryOp::evaluate(const Context *context) const
 {
 	switch (this->op) {
@@ -219,11 +276,27 @@ void BinaryOp::print(std::ostream &stream) const
 	stream << "(" << *this->left << " " << opString() << " " << *this->right << ")";
 }
 
+bool BinaryOp::isParallelSafe(const Context *context) const
+{
+	return this->left->isParallelSafe(context) && this->right->isParallelSafe(context);
+}
+
+void BinaryOp::forEachChild(const ChildVisitor &visit)
+{
+	visit(this->left);
+	visit(this->right);
+}
+
 TernaryOp::TernaryOp(Expression *cond, Expression *ifexpr, Expression *elseexpr, const Location &loc)
 	: Expression(loc), cond(cond), ifexpr(ifexpr), elseexpr(elseexpr)
 {
 }
 
+bool TernaryOp::isConstant() const
+{
+	return this->cond->isLiteral() && this->ifexpr->isLiteral() && this->elseexpr->isLiteral();
+}
+
 ValuePtr TernaryOp::evaluate(const Context *context) const
 {
 	return (this->cond->evaluate(context) ? this->ifexpr : this->elseexpr)->evaluate(context);
@@ -234,6 +307,19 @@ void TernaryOp::print(std::ostream &stream) const
 	stream << "(" << *this->cond << " ? " << *this->ifexpr << " : " << *this->elseexpr << ")";
 }
 
+bool TernaryOp::isParallelSafe(const Context *context) const
+{
+	return this->cond->isParallelSafe(context) &&
+		this->ifexpr->isParallelSafe(context) && this->elseexpr->isParallelSafe(context);
+}
+
+void TernaryOp::forEachChild(const ChildVisitor &visit)
+{
+	visit(this->cond);
+	visit(this->ifexpr);
+	visit(this->elseexpr);
+}
+
 ArrayLookup::ArrayLookup(Expression *array, Expression *index, const Location &loc)
 	: Expression(loc), array(array), index(index)
 {
@@ -248,10 +334,26 @@ void ArrayLookup::print(std::ostream &stream) const
 	stream << *array << "[" << *index << "]";
 }
 
+bool ArrayLookup::isParallelSafe(const Context *context) const
+{
+	return this->array->isParallelSafe(context) && this->index->isParallelSafe(context);
+}
+
+void ArrayLookup::forEachChild(const ChildVisitor &visit)
+{
+	visit(this->array);
+	visit(this->index);
+}
+
 Literal::Literal(const ValuePtr &val, const Location &loc) : Expression(loc), value(val)
 {
 }
 
+Literal::Literal(const ValuePtr &val, Expression *source)
+	: Expression(source->location()), value(val), source(source)
+{
+}
+
 ValuePtr Literal::evaluate(const class Context *) const
 {
 	return this->value;
@@ -259,7 +361,13 @@ ValuePtr Literal::evaluate(const class Context *) const
 
 void Literal::print(std::ostream &stream) const
 {
-    stream << *this->value;
+	if (this->source) this->source->print(stream);
+	else stream << *this->value;
+}
+
+bool Literal::isParallelSafe(const Context *) const
+{
+	return true;
 }
 
 Range::Range(Expression *begin, Expression *end, const Location &loc)
@@ -272,6 +380,11 @@ Range::Range(Expression *begin, Expression *step, Expression *end, const Locatio
 {
 }
 
+bool Range::isConstant() const
+{
+	return this->begin->isLiteral() && (!this->step || this->step->isLiteral()) && this->end->isLiteral();
+}
+
 ValuePtr Range::evaluate(const Context *context) const
 {
 	ValuePtr beginValue = this->begin->evaluate(context);
@@ -301,34 +414,89 @@ void Range::print(std::ostream &stream) const
 	stream << "]";
 }
 
+bool Range::isParallelSafe(const Context *context) const
+{
+	return this->begin->isParallelSafe(context) &&
+		(!this->step || this->step->isParallelSafe(context)) && this->end->isParallelSafe(context);
+}
+
+void Range::forEachChild(const ChildVisitor &visit)
+{
+	visit(this->begin);
+	if (this->step) visit(this->step);
+	visit(this->end);
+}
+
 Vector::Vector(const Location &loc) : Expression(loc)
 {
 }
 
+/*!
+	Adds an element. Plain literals are packed as long as all elements are
+	ones, so the parser builds large generated arrays, e.g. the points of
+	a polyhedron, directly as values.
+*/
 void Vector::push_back(Expression *expr)
 {
+	const Literal *literal = dynamic_cast<const Literal *>(expr);
+	if (isPacked() && literal && literal->isPlain()) {
+		this->packed.push_back(literal->evaluate(NULL));
+		delete expr;
+		return;
+	}
+	unpack();
 	this->children.push_back(shared_ptr<Expression>(expr));
 }
 
+// Turns the packed elements back into literals
+void Vector::unpack()
+{
+	if (!isPacked()) return;
+	for (const auto &value : this->packed) {
+		this->children.push_back(make_shared<Literal>(value, location()));
+	}
+	this->packed.clear();
+}
+
+/*!
+	Returns the value of a vector of plain literals, moving it out.
+*/
+ValuePtr Vector::takePacked()
+{
+	assert(isPacked());
+	return ValuePtr(std::move(this->packed));
+}
+
+bool Vector::isConstant() const
+{
+	for(const auto &e : this->children) {
+		if (!e->isLiteral()) return false;
+	}
+	return true;
+}
+
 ValuePtr Vector::evaluate(const Context *context) const
 {
+	if (isPacked()) return ValuePtr(this->packed);
 	Value::VectorType vec;
+	vec.reserve(this->children.size());
 	for(const auto &e : this->children) {
 		ValuePtr tmpval = e->evaluate(context);
 		if (e->isListComprehension()) {
-			const Value::VectorType result = tmpval->toVector();
-			for (size_t i = 0;i < result.size();i++) {
-				vec.push_back(result[i]);
-			}
+			vec.append(tmpval->toVector());
 		} else {
 			vec.push_back(tmpval);
 		}
 	}
-	return ValuePtr(vec);
+	return ValuePtr(std::move(vec));
 }
 
 void Vector::print(std::ostream &stream) const
 {
+	if (isPacked()) {
+		stream << Value(this->packed);
+		return;
+	}
 	stream << "[";
 	for (size_t i=0; i < this->children.size(); i++) {
 		if (i > 0) stream << ", ";
@@ -337,6 +505,20 @@ void Vector::print(std::ostream &stream) const
 	stream << "]";
 }
 
+bool Vector::isParallelSafe(const Context *context) const
+{
+	for(const auto &e : this->children) {
+		if (!e->isParallelSafe(context)) return false;
+	}
+	return true;
+}
+
+void Vector::forEachChild(const ChildVisitor &visit)
+{
+	unpack();
+	for(auto &e : this->children) visit(e);
+}
+
 Lookup::Lookup(const std::string &name, const Location &loc) : Expression(loc), name(name)
 {
 }
@@ -351,6 +533,11 @@ void Lookup::print(std::ostream &stream) const
 	stream << this->name;
 }
 
+bool Lookup::isParallelSafe(const Context *) const
+{
+	return true;
+}
+
 MemberLookup::MemberLookup(Expression *expr, const std::string &member, const Location &loc)
 	: Expression(loc), expr(expr), member(member)
 {
@@ -377,6 +564,16 @@ void MemberLookup::print(std::ostream &stream) const
 	stream << *this->expr << "." << this->member;
 }
 
+bool MemberLookup::isParallelSafe(const Context *context) const
+{
+	return this->expr->isParallelSafe(context);
+}
+
+void MemberLookup::forEachChild(const ChildVisitor &visit)
+{
+	visit(this->expr);
+}
+
 FunctionCall::FunctionCall(const std::string &name, 
 													 const AssignmentList &args, const Location &loc)
 	: Expression(loc), name(name), arguments(args)
@@ -389,7 +586,7 @@ ValuePtr FunctionCall::evaluate(const Context *context) const
 		throw RecursionException::create("function", this->name);
 	}
     
-	EvalContext c(context, this->arguments);
+	EvalContext c(context, this->arguments, NULL, &this->binding);
 	ValuePtr result = context->evaluate_function(this->name, &c);
 
 	return result;
@@ -400,6 +597,29 @@ void FunctionCall::print(std::ostream &stream) const
 	stream << this->name << "(" << this->arguments << ")";
 }
 
+/*!
+	Calls are safe if they resolve to a builtin which neither uses shared
+	state (random numbers, file caches) nor reads the module stack.
+	User-defined functions could reach anything, so they aren't.
+*/
+bool FunctionCall::isParallelSafe(const Context *context) const
+{
+	static const char *unsafe[] = { "rands", "parent_module", "dxf_dim", "dxf_cross", NULL };
+	for (int i=0;unsafe[i];i++) {
+		if (this->name == unsafe[i]) return false;
+	}
+	const LocalScope::FunctionContainer &builtins = Builtins::instance()->getGlobalScope().functions;
+	LocalScope::FunctionContainer::const_iterator it = builtins.find(this->name);
+	if (it == builtins.end() || !dynamic_cast<const BuiltinFunction *>(it->second)) return false;
+	if (context->findFunction(this->name) != it->second) return false;
+	return is_parallel_safe(this->arguments, context);
+}
+
+void FunctionCall::forEachChild(const ChildVisitor &visit)
+{
+	visit_arguments(this->arguments, visit);
+}
+
 Let::Let(const AssignmentList &args, Expression *expr, const Location &loc)
 	: Expression(loc), arguments(args), expr(expr)
 {
@@ -418,6 +638,22 @@ void Let::print(std::ostream &stream) const
 	stream << "let(" << this->arguments << ") " << *expr;
 }
 
+bool Let::isParallelSafe(const Context *context) const
+{
+	return is_parallel_safe(this->arguments, context) && this->expr->isParallelSafe(context);
+}
+
+void Let::forEachChild(const ChildVisitor &visit)
+{
+	visit_arguments(this->arguments, visit);
+	visit(this->expr);
+}
+
+void Let::getBoundNames(std::vector<std::string> &names) const
+{
+	bound_names(this->arguments, names);
+}
+
 ListComprehension::ListComprehension(const Location &loc) : Expression(loc)
 {
 }
@@ -449,7 +685,7 @@ ValuePtr LcIf::evaluate(const Context *context) const
         }
     }
 
-    return ValuePtr(vec);
+    return ValuePtr(std::move(vec));
 }
 
 void LcIf::print(std::ostream &stream) const
@@ -460,6 +696,19 @@ void LcIf::print(std::ostream &stream) const
     }
 }
 
+bool LcIf::isParallelSafe(const Context *context) const
+{
+	return this->cond->isParallelSafe(context) && this->ifexpr->isParallelSafe(context) &&
+		(!this->elseexpr || this->elseexpr->isParallelSafe(context));
+}
+
+void LcIf::forEachChild(const ChildVisitor &visit)
+{
+	visit(this->cond);
+	visit(this->ifexpr);
+	if (this->elseexpr) visit(this->elseexpr);
+}
+
 LcEach::LcEach(Expression *expr, const Location &loc) : ListComprehension(loc), expr(expr)
 {
 }
@@ -474,10 +723,10 @@ ValuePtr LcEach::evaluate(const Context *context) const
 
     if (v->type() == Value::RANGE) {
         RangeType range = v->toRange();
-        uint32_t steps = range.numValues();
-        if (steps >= 1000000) {
-            PRINTB("WARNING: Bad range parameter in for statement: too many elements (%lu).", steps);
+        if (range.isUnbounded()) {
+            PRINTB("WARNING: Bad range parameter in for statement: too many elements (%lu).", range.numValues());
         } else {
+            vec.reserve(range.numValues());
             for (RangeType::iterator it = range.begin();it != range.end();it++) {
                 vec.push_back(ValuePtr(*it));
             }
@@ -494,7 +743,7 @@ ValuePtr LcEach::evaluate(const Context *context) const
     if (this->expr->isListComprehension()) {
         return ValuePtr(flatten(vec));
     } else {
-        return ValuePtr(vec);
+        return ValuePtr(std::move(vec));
     }
 }
 
@@ -503,11 +752,24 @@ void LcEach::print(std::ostream &stream) const
     stream << "each (" << *this->expr << ")";
 }
 
+bool LcEach::isParallelSafe(const Context *context) const
+{
+	return this->expr->isParallelSafe(context);
+}
+
+void LcEach::forEachChild(const ChildVisitor &visit)
+{
+	visit(this->expr);
+}
+
 LcFor::LcFor(const AssignmentList &args, Expression *expr, const Location &loc)
 	: ListComprehension(loc), arguments(args), expr(expr)
 {
 }
 
+// Comprehensions with fewer iterations are not worth distributing
+static const size_t PARALLEL_LC_MIN_ITERATIONS = 1000;
+
 ValuePtr LcFor::evaluate(const Context *context) const
 {
 	Value::VectorType vec;
@@ -520,25 +782,34 @@ ValuePtr LcFor::evaluate(const Context *context) const
     const std::string &it_name = for_context.getArgName(0);
     ValuePtr it_values = for_context.getArgValue(0, &assign_context);
 
-    Context c(context);
-
+    // Ranges are iterated in place rather than expanded, so only the result
+    // takes memory proportional to the number of iterations
     if (it_values->type() == Value::RANGE) {
         RangeType range = it_values->toRange();
-        uint32_t steps = range.numValues();
-        if (steps >= 1000000) {
-            PRINTB("WARNING: Bad range parameter in for statement: too many elements (%lu).", steps);
-        } else {
+        if (range.isUnbounded()) {
+            PRINTB("WARNING: Bad range parameter in for statement: too many elements (%lu).", range.numValues());
+        } else if (!evaluateParallel(context, it_name, it_values, range.numValues(), vec)) {
+            vec.clear();
+            vec.reserve(range.numValues());
+            Context c(context);
             for (RangeType::iterator it = range.begin();it != range.end();it++) {
                 c.set_variable(it_name, ValuePtr(*it));
                 vec.push_back(this->expr->evaluate(&c));
             }
         }
     } else if (it_values->type() == Value::VECTOR) {
-        for (size_t i = 0; i < it_values->toVector().size(); i++) {
-            c.set_variable(it_name, it_values->toVector()[i]);
-            vec.push_back(this->expr->evaluate(&c));
+        const Value::VectorType &items = it_values->toVector();
+        if (!evaluateParallel(context, it_name, it_values, items.size(), vec)) {
+            vec.clear();
+            vec.reserve(items.size());
+            Context c(context);
+            for(const auto &item : items) {
+                c.set_variable(it_name, item);
+                vec.push_back(this->expr->evaluate(&c));
+            }
         }
     } else if (it_values->type() != Value::UNDEFINED) {
+        Context c(context);
         c.set_variable(it_name, it_values);
         vec.push_back(this->expr->evaluate(&c));
     }
@@ -546,15 +817,107 @@ ValuePtr LcFor::evaluate(const Context *context) const
     if (this->expr->isListComprehension()) {
         return ValuePtr(flatten(vec));
     } else {
-        return ValuePtr(vec);
+        return ValuePtr(std::move(vec));
     }
 }
 
+/*!
+	Evaluates the body for the (about) \a n items of \a it_values, a range
+	or a vector, in chunks on the thread pool. Each chunk has its own context
+	stack, and collects the messages it prints. These are printed in order
+	afterwards, so the output is the same as for sequential evaluation.
+	Returns false, with nothing printed, if the comprehension is too small
+	or unsafe to distribute or a chunk failed; the caller then evaluates
+	sequentially, reporting any error.
+*/
+bool LcFor::evaluateParallel(const Context *context, const std::string &it_name,
+														 const ValuePtr &it_values, size_t n, Value::VectorType &vec) const
+{
+	if (n < PARALLEL_LC_MIN_ITERATIONS ||
+			!Feature::ExperimentalParallelEvaluation.is_enabled() ||
+			!this->expr->isParallelSafe(context)) {
+		return false;
+	}
+
+	// Range values are accumulated like RangeType::iterator does, so step
+	// through the range once for the exact count and the start value of each
+	// chunk; numValues() may be off by one for fractional steps
+	const bool isrange = it_values->type() == Value::RANGE;
+	RangeType range = isrange ? it_values->toRange() : RangeType(0, 0);
+	if (isrange) {
+		n = 0;
+		for (RangeType::iterator it = range.begin();it != range.end();it++) n++;
+	}
+
+	ThreadPool *pool = ThreadPool::instance();
+	const size_t chunks = std::min(n, size_t(pool->size()) * 4);
+	std::vector<std::vector<std::string>> messages(chunks);
+
+	std::vector<double> starts;
+	if (isrange) {
+		starts.reserve(chunks);
+		size_t j = 0;
+		for (RangeType::iterator it = range.begin();starts.size() < chunks;it++, j++) {
+			if (j == n * starts.size() / chunks) starts.push_back(*it);
+		}
+	}
+	vec.resize(n);
+
+	ThreadPool::TaskGroup group;
+	for (size_t i=0;i<chunks;i++) {
+		const size_t begin = n * i / chunks;
+		const size_t end = n * (i + 1) / chunks;
+		pool->run(group, [this, context, &it_name, &it_values, &range, &starts, isrange, &vec, &messages, i, begin, end]() {
+				PrintCapture capture(messages[i]);
+				Context::Stack stack;
+				Context c(context, stack);
+				double val = isrange ? starts[i] : 0;
+				for (size_t j=begin;j<end;j++) {
+					if (isrange) {
+						c.set_variable(it_name, ValuePtr(val));
+						val += range.step_value();
+					}
+					else {
+						c.set_variable(it_name, it_values->toVector()[j]);
+					}
+					vec[j] = this->expr->evaluate(&c);
+				}
+			});
+	}
+	try {
+		pool->wait(group);
+	}
+	catch (...) {
+		return false;
+	}
+
+	for(const auto &chunk : messages) {
+		for(const auto &msg : chunk) PRINT(msg);
+	}
+	return true;
+}
+
 void LcFor::print(std::ostream &stream) const
 {
     stream << "for(" << this->arguments << ") (" << *this->expr << ")";
 }
 
+bool LcFor::isParallelSafe(const Context *context) const
+{
+	return is_parallel_safe(this->arguments, context) && this->expr->isParallelSafe(context);
+}
+
+void LcFor::forEachChild(const ChildVisitor &visit)
+{
+	visit_arguments(this->arguments, visit);
+	visit(this->expr);
+}
+
+void LcFor::getBoundNames(std::vector<std::string> &names) const
+{
+	bound_names(this->arguments, names);
+}
+
 LcForC::LcForC(const AssignmentList &args, const AssignmentList &incrargs, Expression *cond, Expression *expr, const Location &loc)
 	: ListComprehension(loc), arguments(args), incr_arguments(incrargs), cond(cond), expr(expr)
 {
@@ -583,7 +946,7 @@ ValuePtr LcForC::evaluate(const Context *context) const
     if (this->expr->isListComprehension()) {
         return ValuePtr(flatten(vec));
     } else {
-        return ValuePtr(vec);
+        return ValuePtr(std::move(vec));
     }
 }
 
@@ -596,6 +959,20 @@ void LcForC::print(std::ostream &stream) const
         << ") " << *this->expr;
 }
 
+void LcForC::forEachChild(const ChildVisitor &visit)
+{
+	visit_arguments(this->arguments, visit);
+	visit_arguments(this->incr_arguments, visit);
+	visit(this->cond);
+	visit(this->expr);
+}
+
+void LcForC::getBoundNames(std::vector<std::string> &names) const
+{
+	bound_names(this->arguments, names);
+	bound_names(this->incr_arguments, names);
+}
+
 LcLet::LcLet(const AssignmentList &args, Expression *expr, const Location &loc)
 	: ListComprehension(loc), arguments(args), expr(expr)
 {
@@ -613,6 +990,231 @@ void LcLet::print(std::ostream &stream) const
     stream << "let(" << this->arguments << ") (" << *this->expr << ")";
 }
 
+bool LcLet::isParallelSafe(const Context *context) const
+{
+	return is_parallel_safe(this->arguments, context) && this->expr->isParallelSafe(context);
+}
+
+void LcLet::forEachChild(const ChildVisitor &visit)
+{
+	visit_arguments(this->arguments, visit);
+	visit(this->expr);
+}
+
+void LcLet::getBoundNames(std::vector<std::string> &names) const
+{
+	bound_names(this->arguments, names);
+}
+
+// The frame of the function call being evaluated by this thread
+static thread_local CommonSubexpression::Frame *current_frame = NULL;
+
+CommonSubexpression::Frame::Frame(size_t function, unsigned int slots)
+	: function(function), slots(slots), previous(current_frame)
+{
+	current_frame = this;
+}
+
+CommonSubexpression::Frame::~Frame()
+{
+	current_frame = this->previous;
+}
+
+void CommonSubexpression::Frame::reset()
+{
+	for(auto &slot : this->slots) slot = Slot();
+}
+
+CommonSubexpression::Frame *CommonSubexpression::Frame::current()
+{
+	return current_frame;
+}
+
+CommonSubexpression::CommonSubexpression(const shared_ptr<Expression> &expr, size_t function, unsigned int slot)
+	: Expression(expr->location()), expr(expr), function(function), slot(slot)
+{
+}
+
+ValuePtr CommonSubexpression::evaluate(const Context *context) const
+{
+	Frame *frame = current_frame;
+	if (!frame || frame->function != this->function) return this->expr->evaluate(context);
+
+	Frame::Slot &slot = frame->slots[this->slot];
+	if (!slot.set) {
+		const unsigned int volatiles = FunctionCache::volatileCalls();
+		std::vector<std::string> messages;
+		ValuePtr value;
+		try {
+			PrintCapture capture(messages);
+			value = this->expr->evaluate(context);
+		}
+		catch (...) {
+			for(const auto &msg : messages) PRINT(msg);
+			throw;
+		}
+		for(const auto &msg : messages) PRINT(msg);
+		// Results of e.g. unseeded rands() differ between evaluations
+		if (FunctionCache::volatileCalls() != volatiles) return value;
+		slot.set = true;
+		slot.value = value;
+		slot.messages.swap(messages);
+		return value;
+	}
+	for(const auto &msg : slot.messages) PRINT(msg);
+	return slot.value;
+}
+
+void CommonSubexpression::print(std::ostream &stream) const
+{
+	this->expr->print(stream);
+}
+
+bool CommonSubexpression::isParallelSafe(const Context *context) const
+{
+	return this->expr->isParallelSafe(context);
+}
+
+namespace {
+	/*!
+		Finds the subexpressions of a function body worth sharing: those
+		which occur more than once, or inside a for() comprehension, and
+		have the same value wherever they occur.
+	*/
+	class SubexpressionSharing
+	{
+	public:
+		SubexpressionSharing(size_t function) : function(function) {}
+
+		unsigned int share(shared_ptr<Expression> &body) {
+			Scope scope;
+			scope.spine = true;
+			analyze(body, scope);
+			rewrite(body);
+			return this->slots.size();
+		}
+
+	private:
+		// Where a subexpression occurs
+		struct Scope {
+			Scope() : loop(false), spine(false), rebindsConfig(false) {}
+			// Variables bound on the way by let() and for()
+			std::vector<std::string> bound;
+			// Evaluated repeatedly by a for() comprehension
+			bool loop;
+			// Ternaries, let() and calls in tail position must keep their type,
+			// see FunctionTailRecursion
+			bool spine;
+			// A let() or for() on the way binds a $ variable, which changes what
+			// called functions see
+			bool rebindsConfig;
+		};
+
+		// What a subexpression depends on
+		struct Dependencies {
+			Dependencies() : calls(false), config(false) {}
+			std::vector<std::string> names;
+			bool calls;
+			bool config;
+		};
+
+		Scope childScope(Expression &parent, const shared_ptr<Expression> &child, const Scope &scope) {
+			Scope s;
+			s.bound = scope.bound;
+			std::vector<std::string> names;
+			parent.getBoundNames(names);
+			s.rebindsConfig = scope.rebindsConfig;
+			for(const auto &name : names) {
+				if (!name.empty() && name[0] == '$') s.rebindsConfig = true;
+				s.bound.push_back(name);
+			}
+			s.loop = scope.loop || dynamic_cast<LcFor *>(&parent) || dynamic_cast<LcForC *>(&parent);
+			if (scope.spine) {
+				if (TernaryOp *op = dynamic_cast<TernaryOp *>(&parent)) {
+					s.spine = &child == &op->ifexpr || &child == &op->elseexpr;
+				}
+				else if (Let *let = dynamic_cast<Let *>(&parent)) {
+					s.spine = &child == &let->expr;
+				}
+			}
+			return s;
+		}
+
+		Dependencies analyze(shared_ptr<Expression> &expr, const Scope &scope) {
+			Dependencies deps;
+			if (const Lookup *lookup = dynamic_cast<const Lookup *>(expr.get())) {
+				const std::string &name = lookup->getName().str();
+				deps.names.push_back(name);
+				deps.config = !name.empty() && name[0] == '$';
+				return deps;
+			}
+			if (dynamic_cast<const FunctionCall *>(expr.get())) deps.calls = true;
+
+			Expression &parent = *expr;
+			expr->forEachChild([this, &parent, &scope, &deps](shared_ptr<Expression> &child) {
+					Dependencies d = analyze(child, childScope(parent, child, scope));
+					deps.names.insert(deps.names.end(), d.names.begin(), d.names.end());
+					deps.calls |= d.calls;
+					deps.config |= d.config;
+				});
+
+			if (isShareable(*expr, deps, scope)) {
+				std::stringstream key;
+				key << *expr;
+				Candidate &candidate = this->candidates[key.str()];
+				candidate.count++;
+				candidate.loop |= scope.loop;
+				this->keys[expr.get()] = key.str();
+			}
+			return deps;
+		}
+
+		static bool isShareable(const Expression &expr, const Dependencies &deps, const Scope &scope) {
+			if (scope.spine || expr.isLiteral() || expr.isListComprehension()) return false;
+			if (deps.config || (deps.calls && scope.rebindsConfig)) return false;
+			for(const auto &name : deps.names) {
+				if (std::find(scope.bound.begin(), scope.bound.end(), name) != scope.bound.end()) return false;
+			}
+			return true;
+		}
+
+		void rewrite(shared_ptr<Expression> &expr) {
+			auto key = this->keys.find(expr.get());
+			if (key != this->keys.end()) {
+				const Candidate &candidate = this->candidates[key->second];
+				if (candidate.count > 1 || candidate.loop) {
+					auto slot = this->slots.insert(std::make_pair(key->second, this->slots.size())).first;
+					expr = make_shared<CommonSubexpression>(expr, this->function, slot->second);
+					return;
+				}
+			}
+			expr->forEachChild([this](shared_ptr<Expression> &child) { rewrite(child); });
+		}
+
+		struct Candidate {
+			Candidate() : count(0), loop(false) {}
+			unsigned int count;
+			bool loop;
+		};
+
+		size_t function;
+		// By printed form, which is equal for equal expressions
+		std::map<std::string, Candidate> candidates;
+		std::map<const Expression *, std::string> keys;
+		std::map<std::string, unsigned int> slots;
+	};
+}
+
+/*!
+	Replaces the subexpressions of the function body \a body which can be
+	shared by CommonSubexpression nodes. Returns the number of slots a
+	Frame of \a function needs.
+*/
+unsigned int CommonSubexpression::share(shared_ptr<Expression> &body, size_t function)
+{
+	return SubexpressionSharing(function).share(body);
+}
+
 std::ostream &operator<<(std::ostream &stream, const Expression &expr)
 {
 	expr.print(stream);
@@ -4,9 +4,11 @@
 
 #include <string>
 #include <vector>
+#include <functional>
 #include "value.h"
 #include "memory.h"
 #include "Assignment.h"
+#include "Identifier.h"
 
 class Expression : public ASTNode
 {
@@ -15,8 +17,22 @@ public:
 	virtual ~Expression() {}
 
 	virtual bool isListComprehension() const;
+	virtual bool isLiteral() const { return false; }
+	// True if all operands are literals, so evaluation doesn't depend on context
+	virtual bool isConstant() const { return false; }
 	virtual ValuePtr evaluate(const class Context *context) const = 0;
 	virtual void print(std::ostream &stream) const = 0;
+	// True if this can be evaluated on another thread, i.e. it only calls
+	// builtin functions without shared state, as resolved from context
+	virtual bool isParallelSafe(const class Context *) const { return false; }
+
+	typedef std::function<void(shared_ptr<Expression> &)> ChildVisitor;
+	// Calls visit on each direct subexpression, for passes over the tree
+	virtual void forEachChild(const ChildVisitor &) {}
+	// Variables bound for the subexpressions, by let() and for()
+	virtual void getBoundNames(std::vector<std::string> &) const {}
+
+	static Expression *fold(Expression *expr);
 };
 
 std::ostream &operator<<(std::ostream &stream, const Expression &expr);
@@ -30,10 +46,14 @@ public:
 	};
 
 	UnaryOp(Op op, Expression *expr, const Location &loc);
+	virtual bool isConstant() const;
 	virtual ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	virtual bool isParallelSafe(const class Context *context) const;
+	virtual void forEachChild(const ChildVisitor &visit);
 
 private:
+	friend class ASTWriter;
 	const char *opString() const;
 
 	Op op;
@@ -60,10 +80,14 @@ public:
 	};
 
 	BinaryOp(Expression *left, Op op, Expression *right, const Location &loc);
+	virtual bool isConstant() const;
 	virtual ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	virtual bool isParallelSafe(const class Context *context) const;
+	virtual void forEachChild(const ChildVisitor &visit);
 
 private:
+	friend class ASTWriter;
 	const char *opString() const;
 
 	Op op;
@@ -75,8 +99,11 @@ class TernaryOp : public Expression
 {
 public:
 	TernaryOp(Expression *cond, Expression *ifexpr, Expression *elseexpr, const Location &loc);
+	virtual bool isConstant() const;
 	ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	virtual bool isParallelSafe(const class Context *context) const;
+	virtual void forEachChild(const ChildVisitor &visit);
 
 	shared_ptr<Expression> cond;
 	shared_ptr<Expression> ifexpr;
@@ -89,7 +116,10 @@ public:
 	ArrayLookup(Expression *array, Expression *index, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	virtual bool isParallelSafe(const class Context *context) const;
+	virtual void forEachChild(const ChildVisitor &visit);
 private:
+	friend class ASTWriter;
 	shared_ptr<Expression> array;
 	shared_ptr<Expression> index;
 };
@@ -98,10 +128,19 @@ class Literal : public Expression
 {
 public:
 	Literal(const ValuePtr &val, const Location &loc = Location::NONE);
+	Literal(const ValuePtr &val, Expression *source);
+	virtual bool isLiteral() const { return true; }
+	virtual bool isConstant() const { return true; }
+	// True if it prints like its value, i.e. it wasn't folded from an expression
+	bool isPlain() const { return !this->source; }
 	ValuePtr evaluate(const class Context *) const;
 	virtual void print(std::ostream &stream) const;
+	virtual bool isParallelSafe(const class Context *context) const;
 private:
+	friend class ASTWriter;
 	ValuePtr value;
+	// The constant expression this was folded from, if any
+	shared_ptr<Expression> source;
 };
 
 class Range : public Expression
@@ -109,9 +148,13 @@ class Range : public Expression
 public:
 	Range(Expression *begin, Expression *end, const Location &loc);
 	Range(Expression *begin, Expression *step, Expression *end, const Location &loc);
+	virtual bool isConstant() const;
 	ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	virtual bool isParallelSafe(const class Context *context) const;
+	virtual void forEachChild(const ChildVisitor &visit);
 private:
+	friend class ASTWriter;
 	shared_ptr<Expression> begin;
 	shared_ptr<Expression> step;
 	shared_ptr<Expression> end;
@@ -121,11 +164,22 @@ class Vector : public Expression
 {
 public:
 	Vector(const Location &loc);
+	virtual bool isConstant() const;
 	ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	virtual bool isParallelSafe(const class Context *context) const;
+	virtual void forEachChild(const ChildVisitor &visit);
 	void push_back(Expression *expr);
+	bool isPacked() const { return this->children.empty(); }
+	ValuePtr takePacked();
 private:
+	void unpack();
+
+	friend class ASTWriter;
 	std::vector<shared_ptr<Expression>> children;
+	// Leading plain literals, kept as values until a child which isn't one
+	// is added, so vectors of literals don't need an expression per element
+	Value::VectorType packed;
 };
 
 class Lookup : public Expression
@@ -134,8 +188,11 @@ public:
 	Lookup(const std::string &name, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	virtual bool isParallelSafe(const class Context *context) const;
+	const Identifier &getName() const { return this->name; }
 private:
-	std::string name;
+	friend class ASTWriter;
+	Identifier name;
 };
 
 class MemberLookup : public Expression
@@ -144,7 +201,10 @@ public:
 	MemberLookup(Expression *expr, const std::string &member, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	virtual bool isParallelSafe(const class Context *context) const;
+	virtual void forEachChild(const ChildVisitor &visit);
 private:
+	friend class ASTWriter;
 	shared_ptr<Expression> expr;
 	std::string member;
 };
@@ -155,9 +215,13 @@ public:
 	FunctionCall(const std::string &funcname, const AssignmentList &arglist, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	virtual bool isParallelSafe(const class Context *context) const;
+	virtual void forEachChild(const ChildVisitor &visit);
 public:
 	std::string name;
 	AssignmentList arguments;
+	// See ArgumentBinding
+	mutable shared_ptr<const class ArgumentBinding> binding;
 };
 
 class Let : public Expression
@@ -166,7 +230,10 @@ public:
 	Let(const AssignmentList &args, Expression *expr, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
-private:
+	virtual bool isParallelSafe(const class Context *context) const;
+	virtual void forEachChild(const ChildVisitor &visit);
+	virtual void getBoundNames(std::vector<std::string> &names) const;
+
 	AssignmentList arguments;
 	shared_ptr<Expression> expr;
 };
@@ -185,7 +252,10 @@ public:
 	LcIf(Expression *cond, Expression *ifexpr, Expression *elseexpr, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	virtual bool isParallelSafe(const class Context *context) const;
+	virtual void forEachChild(const ChildVisitor &visit);
 private:
+	friend class ASTWriter;
 	shared_ptr<Expression> cond;
 	shared_ptr<Expression> ifexpr;
 	shared_ptr<Expression> elseexpr;
@@ -197,7 +267,14 @@ public:
 	LcFor(const AssignmentList &args, Expression *expr, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	virtual bool isParallelSafe(const class Context *context) const;
+	virtual void forEachChild(const ChildVisitor &visit);
+	virtual void getBoundNames(std::vector<std::string> &names) const;
 private:
+	friend class ASTWriter;
+	bool evaluateParallel(const class Context *context, const std::string &it_name,
+												const ValuePtr &it_values, size_t n, Value::VectorType &vec) const;
+
 	AssignmentList arguments;
 	shared_ptr<Expression> expr;
 };
@@ -208,7 +285,10 @@ public:
 	LcForC(const AssignmentList &args, const AssignmentList &incrargs, Expression *cond, Expression *expr, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	virtual void forEachChild(const ChildVisitor &visit);
+	virtual void getBoundNames(std::vector<std::string> &names) const;
 private:
+	friend class ASTWriter;
 	AssignmentList arguments;
 	AssignmentList incr_arguments;
 	shared_ptr<Expression> cond;
@@ -221,7 +301,10 @@ public:
 	LcEach(Expression *expr, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	virtual bool isParallelSafe(const class Context *context) const;
+	virtual void forEachChild(const ChildVisitor &visit);
 private:
+	friend class ASTWriter;
 	shared_ptr<Expression> expr;
 };
 
@@ -231,7 +314,60 @@ public:
 	LcLet(const AssignmentList &args, Expression *expr, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	virtual bool isParallelSafe(const class Context *context) const;
+	virtual void forEachChild(const ChildVisitor &visit);
+	virtual void getBoundNames(std::vector<std::string> &names) const;
 private:
+	friend class ASTWriter;
 	AssignmentList arguments;
 	shared_ptr<Expression> expr;
 };
+
+/*!
+	A subexpression which yields the same value wherever it occurs in a
+	function body, because no let() or for() on the way to it rebinds its
+	variables. It's evaluated at most once per call of the function, when
+	first reached, and its value and messages are reused by the other
+	occurrences and loop iterations.
+*/
+class CommonSubexpression : public Expression
+{
+public:
+	CommonSubexpression(const shared_ptr<Expression> &expr, size_t function, unsigned int slot);
+	ValuePtr evaluate(const class Context *context) const;
+	virtual void print(std::ostream &stream) const;
+	virtual bool isParallelSafe(const class Context *context) const;
+
+	static unsigned int share(shared_ptr<Expression> &body, size_t function);
+
+	/*!
+		The shared values of one call of a function. While another frame, or
+		none, is current, its subexpressions are evaluated normally.
+	*/
+	class Frame
+	{
+	public:
+		Frame(size_t function, unsigned int slots);
+		~Frame();
+		// Forgets the values, after the function's arguments were rebound
+		void reset();
+		static Frame *current();
+	private:
+		friend class CommonSubexpression;
+		struct Slot {
+			Slot() : set(false) {}
+			bool set;
+			ValuePtr value;
+			std::vector<std::string> messages;
+		};
+		size_t function;
+		std::vector<Slot> slots;
+		Frame *previous;
+	};
+
+private:
+	friend class ASTWriter;
+	shared_ptr<Expression> expr;
+	size_t function;
+	unsigned int slot;
+};
@@ -22,6 +22,14 @@ Feature::list_t Feature::feature_list;
 const Feature Feature::ExperimentalEachExpression("lc-each", "Enable <code>each</code> expression in list comprehensions.");
 const Feature Feature::ExperimentalElseExpression("lc-else", "Enable <code>else</code> expression in list comprehensions.");
 const Feature Feature::ExperimentalForCExpression("lc-for-c", "Enable C-style <code>for</code> expression in list comprehensions.");
+const Feature Feature::ExperimentalParallelEvaluation("parallel-eval", "Evaluate independent subtrees of the geometry in parallel.");
+const Feature Feature::ExperimentalCorefinement("corefinement", "Use mesh corefinement instead of Nef polyhedra for 3D Boolean operations where possible.");
+const Feature Feature::ExperimentalAdaptiveExtrude("adaptive-extrude", "Choose the number of twisted <code>linear_extrude</code> slices from the size of the extruded shape when <code>slices</code> is not given.");
+const Feature Feature::ExperimentalFunctionMemo("function-memo", "Remember the results of top-level user-defined functions called repeatedly with the same arguments.");
+const Feature Feature::ExperimentalASTCache("ast-cache", "Cache parsed library files on disk, so unchanged libraries aren't parsed again by new processes.");
+const Feature Feature::ExperimentalLazyUse("lazy-use", "Parse libraries included with <code>use</code> only once a module or function they define is called.");
+const Feature Feature::ExperimentalVectorMath("vector-math", "Apply math functions like <code>sin</code> and <code>pow</code> to each element of vector arguments.");
+const Feature Feature::ExperimentalStreamingFor("streaming-for", "Evaluate the iterations of large <code>for</code> and <code>intersection_for</code> loops while instantiating them, keeping only their accumulated geometry.");
 
 Feature::Feature(const std::string &name, const std::string &description)
 	: enabled(false), name(name), description(description)
@@ -81,6 +89,30 @@ void Feature::dump_features()
 	}
 }
 
+void Feature::writeJSON(std::ostream &out, const std::string &indent)
+{
+	out << "{";
+	for (list_t::iterator it = feature_list.begin(); it != feature_list.end(); it++) {
+		out << (it == feature_list.begin() ? "\n" : ",\n") << indent << "  \"" << (*it)->get_name() << "\": "
+				<< ((*it)->is_enabled() ? "true" : "false");
+	}
+	out << "\n" << indent << "}";
+}
+
+/*!
+	Returns the names of the enabled features, separated by spaces.
+*/
+std::string Feature::enabledNames()
+{
+	std::string names;
+	for (list_t::iterator it = feature_list.begin(); it != feature_list.end(); it++) {
+		if (!(*it)->is_enabled()) continue;
+		if (!names.empty()) names += " ";
+		names += (*it)->get_name();
+	}
+	return names;
+}
+
 ExperimentalFeatureException::ExperimentalFeatureException(const std::string &what_arg)
     : EvaluationException(what_arg)
 {
@@ -17,6 +17,14 @@ public:
         static const Feature ExperimentalEachExpression;
         static const Feature ExperimentalElseExpression;
         static const Feature ExperimentalForCExpression;
+        static const Feature ExperimentalParallelEvaluation;
+        static const Feature ExperimentalCorefinement;
+        static const Feature ExperimentalAdaptiveExtrude;
+        static const Feature ExperimentalFunctionMemo;
+        static const Feature ExperimentalASTCache;
+        static const Feature ExperimentalLazyUse;
+        static const Feature ExperimentalVectorMath;
+        static const Feature ExperimentalStreamingFor;
 
 	const std::string& get_name() const;
 	const std::string& get_description() const;
@@ -28,6 +36,9 @@ public:
 	static iterator end();
     
 	static void dump_features();
+	// Writes whether each feature is enabled as a JSON object
+	static void writeJSON(std::ostream &out, const std::string &indent = "");
+	static std::string enabledNames();
 	static void enable_feature(const std::string &feature_name, bool status = true);
 
 private:
@@ -1,6 +1,7 @@
 #include "fileutils.h"
 #include "printutils.h"
 
+#include <fstream>
 #include <boost/filesystem.hpp>
 namespace fs = boost::filesystem;
 
@@ -32,3 +33,22 @@ std::string lookup_file(const std::string &filename,
 	}
 	return resultfile;
 }
+
+/*!
+	Reads the whole file into \a data. Returns false if it can't be opened.
+*/
+bool read_file(const std::string &filename, std::string &data)
+{
+	std::ifstream f(filename.c_str(), std::ios::in | std::ios::binary);
+	if (!f.good()) return false;
+	f.seekg(0, std::ios::end);
+	const std::streamoff file_size = f.tellg();
+	f.seekg(0);
+	data.clear();
+	if (file_size > 0) {
+		data.resize(size_t(file_size));
+		f.read(&data[0], file_size);
+		data.resize(size_t(f.gcount()));
+	}
+	return true;
+}
@@ -4,3 +4,4 @@
 
 std::string lookup_file(const std::string &filename, 
                         const std::string &path, const std::string &fallbackpath);
+bool read_file(const std::string &filename, std::string &data);
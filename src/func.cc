@@ -37,12 +37,16 @@
 #include "exceptions.h"
 #include "memory.h"
 #include "UserModule.h"
+#include "FunctionCache.h"
+#include "TableIndex.h"
+#include "feature.h"
 
 #include <cmath>
 #include <sstream>
 #include <ctime>
 #include <cmath>
 #include <limits>
+#include <cstdint>
 #include <algorithm>
 
 /*
@@ -69,8 +73,42 @@ int process_id = _getpid();
 int process_id = getpid();
 #endif
 
-boost::mt19937 deterministic_rng;
-boost::mt19937 lessdeterministic_rng( std::time(0) + process_id );
+/*
+	The generators are per thread, as documents can be evaluated
+	concurrently. Seeded results come from the Mersenne Twister, so a seed
+	gives the same numbers as it always did and results cached by value
+	stay valid across runs. Unseeded results only need to be fast, and come
+	from xorshift128+.
+*/
+static thread_local boost::mt19937 deterministic_rng;
+
+class FastRandom
+{
+public:
+	FastRandom() {
+		// splitmix64 of the time, process and thread, so no two threads share a stream
+		uint64_t x = uint64_t(std::time(0)) ^ (uint64_t(process_id) << 32) ^ uint64_t(reinterpret_cast<uintptr_t>(this));
+		for (auto &s : this->state) {
+			x += 0x9E3779B97F4A7C15ULL;
+			uint64_t z = x;
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+			s = z ^ (z >> 31);
+		}
+	}
+	// Uniform in [0, 1), using the top 53 bits
+	double next() {
+		uint64_t s1 = this->state[0];
+		const uint64_t s0 = this->state[1];
+		this->state[0] = s0;
+		s1 ^= s1 << 23;
+		this->state[1] = s1 ^ s0 ^ (s1 >> 17) ^ (s0 >> 26);
+		return double((this->state[1] + s0) >> 11) * (1.0 / 9007199254740992.0);
+	}
+private:
+	uint64_t state[2];
+};
+static thread_local FastRandom lessdeterministic_rng;
 
 static inline double deg2rad(double x)
 {
@@ -82,28 +120,113 @@ static inline double rad2deg(double x)
 	return x * 180.0 / M_PI;
 }
 
-ValuePtr builtin_abs(const Context *, const EvalContext *evalctx)
+typedef double (*unary_math_func)(double);
+typedef double (*binary_math_func)(double, double);
+
+/*!
+	Applies \a F to each element of the vector \a vec, recursing into
+	nested vectors. Elements which aren't numbers become undef.
+*/
+template <unary_math_func F>
+static ValuePtr map_unary(const Value::VectorType &vec)
+{
+	Value::VectorType result;
+	result.reserve(vec.size());
+	for(const auto &v : vec) {
+		switch (v->type()) {
+		case Value::NUMBER: result.emplace_back(F(v->toDouble())); break;
+		case Value::VECTOR: result.push_back(map_unary<F>(v->toVector())); break;
+		default: result.push_back(ValuePtr::undefined);
+		}
+	}
+	return ValuePtr(std::move(result));
+}
+
+/*!
+	Applies \a F to the numbers \a v0 and \a v1. If one or both are
+	vectors, \a F is applied element-wise, pairing vector elements like
+	vector addition does, or each element with the number.
+*/
+template <binary_math_func F>
+static ValuePtr map_binary(const ValuePtr &v0, const ValuePtr &v1)
+{
+	const bool vec0 = v0->type() == Value::VECTOR, vec1 = v1->type() == Value::VECTOR;
+	if (!vec0 && !vec1) {
+		if (v0->type() == Value::NUMBER && v1->type() == Value::NUMBER)
+			return ValuePtr(F(v0->toDouble(), v1->toDouble()));
+		return ValuePtr::undefined;
+	}
+	Value::VectorType result;
+	if (vec0 && vec1) {
+		const Value::VectorType &a = v0->toVector(), &b = v1->toVector();
+		const size_t n = std::min(a.size(), b.size());
+		result.reserve(n);
+		for (size_t i = 0; i < n; i++) result.push_back(map_binary<F>(a[i], b[i]));
+	}
+	else if (vec0) {
+		const Value::VectorType &a = v0->toVector();
+		result.reserve(a.size());
+		for(const auto &v : a) result.push_back(map_binary<F>(v, v1));
+	}
+	else {
+		const Value::VectorType &b = v1->toVector();
+		result.reserve(b.size());
+		for(const auto &v : b) result.push_back(map_binary<F>(v0, v));
+	}
+	return ValuePtr(std::move(result));
+}
+
+/*!
+	Builtin function of one number. With the vector-math feature, it's
+	also applied to each element of a vector argument.
+*/
+template <unary_math_func F>
+ValuePtr builtin_unary(const Context *, const EvalContext *evalctx)
 {
 	if (evalctx->numArgs() == 1) {
 		ValuePtr v = evalctx->getArgValue(0);
 		if (v->type() == Value::NUMBER)
-			return ValuePtr(std::fabs(v->toDouble()));
+			return ValuePtr(F(v->toDouble()));
+		if (v->type() == Value::VECTOR && Feature::ExperimentalVectorMath.is_enabled())
+			return map_unary<F>(v->toVector());
 	}
 	return ValuePtr::undefined;
 }
 
-ValuePtr builtin_sign(const Context *, const EvalContext *evalctx)
+/*!
+	Builtin function of two numbers. With the vector-math feature, either
+	argument may also be a vector, see map_binary().
+*/
+template <binary_math_func F>
+ValuePtr builtin_binary(const Context *, const EvalContext *evalctx)
 {
-	if (evalctx->numArgs() == 1) {
-		ValuePtr v = evalctx->getArgValue(0);
-		if (v->type() == Value::NUMBER) {
-			double x = v->toDouble();
-			return ValuePtr((x<0) ? -1.0 : ((x>0) ? 1.0 : 0.0));
-		}
+	if (evalctx->numArgs() == 2) {
+		ValuePtr v0 = evalctx->getArgValue(0), v1 = evalctx->getArgValue(1);
+		if (v0->type() == Value::NUMBER && v1->type() == Value::NUMBER)
+			return ValuePtr(F(v0->toDouble(), v1->toDouble()));
+		if ((v0->type() == Value::VECTOR || v1->type() == Value::VECTOR) &&
+				Feature::ExperimentalVectorMath.is_enabled())
+			return map_binary<F>(v0, v1);
 	}
 	return ValuePtr::undefined;
 }
 
+static double math_abs(double x) { return std::fabs(x); }
+static double math_sign(double x) { return (x<0) ? -1.0 : ((x>0) ? 1.0 : 0.0); }
+static double math_asin(double x) { return rad2deg(asin(x)); }
+static double math_acos(double x) { return rad2deg(acos(x)); }
+static double math_tan(double x) { return tan(deg2rad(x)); }
+static double math_atan(double x) { return rad2deg(atan(x)); }
+static double math_atan2(double y, double x) { return rad2deg(atan2(y, x)); }
+static double math_pow(double x, double y) { return pow(x, y); }
+static double math_round(double x) { return round(x); }
+static double math_ceil(double x) { return ceil(x); }
+static double math_floor(double x) { return floor(x); }
+static double math_sqrt(double x) { return sqrt(x); }
+static double math_exp(double x) { return exp(x); }
+static double math_ln(double x) { return log(x); }
+static double math_log10(double x) { return log(x) / log(10.0); }
+
 ValuePtr builtin_rands(const Context *, const EvalContext *evalctx)
 {
 	size_t n = evalctx->numArgs();
@@ -139,6 +262,7 @@ ValuePtr builtin_rands(const Context *, const EvalContext *evalctx)
 		size_t numresults = boost_numeric_cast<size_t,double>( numresultsd );
 
 		bool deterministic = false;
+		if (n == 3) FunctionCache::markVolatile();
 		if (n > 3) {
 			ValuePtr v3 = evalctx->getArgValue(3);
 			if (v3->type() != Value::NUMBER) goto quit;
@@ -146,21 +270,21 @@ ValuePtr builtin_rands(const Context *, const EvalContext *evalctx)
 			deterministic_rng.seed( seed );
 			deterministic = true;
 		}
-		Value::VectorType vec;
-		if (min==max) { // Boost doesn't allow min == max
-			for (size_t i=0; i < numresults; i++)
-				vec.push_back(ValuePtr(min));
-		} else {
-			boost::uniform_real<> distributor( min, max );
-			for (size_t i=0; i < numresults; i++) {
-				if ( deterministic ) {
-					vec.push_back(ValuePtr(distributor(deterministic_rng)));
-				} else {
-					vec.push_back(ValuePtr(distributor(lessdeterministic_rng)));
-				}
+		// Generated in bulk, then boxed
+		std::vector<double> numbers(numresults, min);
+		if (min != max) { // Boost doesn't allow min == max
+			if (deterministic) {
+				boost::uniform_real<> distributor( min, max );
+				for (auto &x : numbers) x = distributor(deterministic_rng);
+			} else {
+				const double range = max - min;
+				for (auto &x : numbers) x = min + lessdeterministic_rng.next() * range;
 			}
 		}
-		return ValuePtr(vec);
+		Value::VectorType vec;
+		vec.reserve(numresults);
+		for (const auto x : numbers) vec.push_back(ValuePtr(x));
+		return ValuePtr(std::move(vec));
 	}
 quit:
 	return ValuePtr::undefined;
@@ -269,16 +393,6 @@ double sin_degrees(double x)
 	return oppose ? -x : x;
 }
 
-ValuePtr builtin_sin(const Context *, const EvalContext *evalctx)
-{
-	if (evalctx->numArgs() == 1) {
-		ValuePtr v = evalctx->getArgValue(0);
-		if (v->type() == Value::NUMBER)
-			return ValuePtr(sin_degrees(v->toDouble()));
-	}
-	return ValuePtr::undefined;
-}
-
 double cos_degrees(double x)
 {
 	// use positive tests because of possible Inf/NaN
@@ -316,131 +430,19 @@ double cos_degrees(double x)
 	return oppose ? -x : x;
 }
 
-ValuePtr builtin_cos(const Context *, const EvalContext *evalctx)
-{
-	if (evalctx->numArgs() == 1) {
-		ValuePtr v = evalctx->getArgValue(0);
-		if (v->type() == Value::NUMBER)
-			return ValuePtr(cos_degrees(v->toDouble()));
-	}
-	return ValuePtr::undefined;
-}
-
-ValuePtr builtin_asin(const Context *, const EvalContext *evalctx)
-{
-	if (evalctx->numArgs() == 1) {
-		ValuePtr v = evalctx->getArgValue(0);
-		if (v->type() == Value::NUMBER)
-			return ValuePtr(rad2deg(asin(v->toDouble())));
-	}
-	return ValuePtr::undefined;
-}
-
-ValuePtr builtin_acos(const Context *, const EvalContext *evalctx)
-{
-	if (evalctx->numArgs() == 1) {
-		ValuePtr v = evalctx->getArgValue(0);
-		if (v->type() == Value::NUMBER)
-			return ValuePtr(rad2deg(acos(v->toDouble())));
-	}
-	return ValuePtr::undefined;
-}
-
-ValuePtr builtin_tan(const Context *, const EvalContext *evalctx)
-{
-	if (evalctx->numArgs() == 1) {
-		ValuePtr v = evalctx->getArgValue(0);
-		if (v->type() == Value::NUMBER)
-			return ValuePtr(tan(deg2rad(v->toDouble())));
-	}
-	return ValuePtr::undefined;
-}
-
-ValuePtr builtin_atan(const Context *, const EvalContext *evalctx)
-{
-	if (evalctx->numArgs() == 1) {
-		ValuePtr v = evalctx->getArgValue(0);
-		if (v->type() == Value::NUMBER)
-			return ValuePtr(rad2deg(atan(v->toDouble())));
-	}
-	return ValuePtr::undefined;
-}
-
-ValuePtr builtin_atan2(const Context *, const EvalContext *evalctx)
-{
-	if (evalctx->numArgs() == 2) {
-		ValuePtr v0 = evalctx->getArgValue(0), v1 = evalctx->getArgValue(1);
-		if (v0->type() == Value::NUMBER && v1->type() == Value::NUMBER)
-			return ValuePtr(rad2deg(atan2(v0->toDouble(), v1->toDouble())));
-	}
-	return ValuePtr::undefined;
-}
-
-ValuePtr builtin_pow(const Context *, const EvalContext *evalctx)
-{
-	if (evalctx->numArgs() == 2) {
-		ValuePtr v0 = evalctx->getArgValue(0), v1 = evalctx->getArgValue(1);
-		if (v0->type() == Value::NUMBER && v1->type() == Value::NUMBER)
-			return ValuePtr(pow(v0->toDouble(), v1->toDouble()));
-	}
-	return ValuePtr::undefined;
-}
-
-ValuePtr builtin_round(const Context *, const EvalContext *evalctx)
-{
-	if (evalctx->numArgs() == 1) {
-		ValuePtr v = evalctx->getArgValue(0);
-		if (v->type() == Value::NUMBER)
-			return ValuePtr(round(v->toDouble()));
-	}
-	return ValuePtr::undefined;
-}
-
-ValuePtr builtin_ceil(const Context *, const EvalContext *evalctx)
-{
-	if (evalctx->numArgs() == 1) {
-		ValuePtr v = evalctx->getArgValue(0);
-		if (v->type() == Value::NUMBER)
-			return ValuePtr(ceil(v->toDouble()));
-	}
-	return ValuePtr::undefined;
-}
-
-ValuePtr builtin_floor(const Context *, const EvalContext *evalctx)
-{
-	if (evalctx->numArgs() == 1) {
-		ValuePtr v = evalctx->getArgValue(0);
-		if (v->type() == Value::NUMBER)
-			return ValuePtr(floor(v->toDouble()));
-	}
-	return ValuePtr::undefined;
-}
-
-ValuePtr builtin_sqrt(const Context *, const EvalContext *evalctx)
-{
-	if (evalctx->numArgs() == 1) {
-		ValuePtr v = evalctx->getArgValue(0);
-		if (v->type() == Value::NUMBER)
-			return ValuePtr(sqrt(v->toDouble()));
-	}
-	return ValuePtr::undefined;
-}
-
-ValuePtr builtin_exp(const Context *, const EvalContext *evalctx)
-{
-	if (evalctx->numArgs() == 1) {
-		ValuePtr v = evalctx->getArgValue(0);
-		if (v->type() == Value::NUMBER)
-			return ValuePtr(exp(v->toDouble()));
-	}
-	return ValuePtr::undefined;
-}
-
 ValuePtr builtin_length(const Context *, const EvalContext *evalctx)
 {
 	if (evalctx->numArgs() == 1) {
 		ValuePtr v = evalctx->getArgValue(0);
 		if (v->type() == Value::VECTOR) return ValuePtr(int(v->toVector().size()));
+		if (v->type() == Value::RANGE) {
+			RangeType range = v->toRange();
+			if (range.isUnbounded()) return ValuePtr::undefined;
+			// Count by iterating, as numValues() is approximate for fractional steps
+			double n = 0;
+			for (RangeType::iterator it = range.begin();it != range.end();it++) n++;
+			return ValuePtr(n);
+		}
 		if (v->type() == Value::STRING) {
 			//Unicode glyph count for the length -- rather than the string (num. of bytes) length.
 			std::string text = v->toString();
@@ -453,7 +455,8 @@ ValuePtr builtin_length(const Context *, const EvalContext *evalctx)
 ValuePtr builtin_log(const Context *, const EvalContext *evalctx)
 {
 	size_t n = evalctx->numArgs();
-	if (n == 1 || n == 2) {
+	if (n == 1) return builtin_unary<math_log10>(NULL, evalctx);
+	if (n == 2) {
 		ValuePtr v0 = evalctx->getArgValue(0);
 		if (v0->type() == Value::NUMBER) {
 			double x = 10.0, y = v0->toDouble();
@@ -469,35 +472,24 @@ quit:
 	return ValuePtr::undefined;
 }
 
-ValuePtr builtin_ln(const Context *, const EvalContext *evalctx)
-{
-	if (evalctx->numArgs() == 1) {
-		ValuePtr v = evalctx->getArgValue(0);
-		if (v->type() == Value::NUMBER)
-			return ValuePtr(log(v->toDouble()));
-	}
-	return ValuePtr::undefined;
-}
-
 ValuePtr builtin_str(const Context *, const EvalContext *evalctx)
 {
-	std::stringstream stream;
+	std::ostringstream stream;
 
 	for (size_t i = 0; i < evalctx->numArgs(); i++) {
-		stream << evalctx->getArgValue(i)->toString();
+		evalctx->getArgValue(i)->toStream(stream);
 	}
 	return ValuePtr(stream.str());
 }
 
 ValuePtr builtin_chr(const Context *, const EvalContext *evalctx)
 {
-	std::stringstream stream;
-	
+	std::string result;
+
 	for (size_t i = 0; i < evalctx->numArgs(); i++) {
-		ValuePtr v = evalctx->getArgValue(i);
-		stream << v->chrString();
+		evalctx->getArgValue(i)->chrAppend(result);
 	}
-	return ValuePtr(stream.str());
+	return ValuePtr(result);
 }
 
 ValuePtr builtin_concat(const Context *, const EvalContext *evalctx)
@@ -507,14 +499,12 @@ ValuePtr builtin_concat(const Context *, const EvalContext *evalctx)
 	for (size_t i = 0; i < evalctx->numArgs(); i++) {
 		ValuePtr val = evalctx->getArgValue(i);
 		if (val->type() == Value::VECTOR) {
-			for(const auto &v : val->toVector()) { 
-				result.push_back(v);
-			}
+			result.append(val->toVector());
 		} else {
 			result.push_back(val);
 		}
 	}
-	return ValuePtr(result);
+	return ValuePtr(std::move(result));
 }
 
 ValuePtr builtin_lookup(const Context *, const EvalContext *evalctx)
@@ -531,6 +521,10 @@ ValuePtr builtin_lookup(const Context *, const EvalContext *evalctx)
 
 	if (!vec[0]->getVec2(low_p, low_v) || !vec[0]->getVec2(high_p, high_v))
 		return ValuePtr::undefined;
+	if (shared_ptr<const LookupIndex> index = TableIndex::lookup(v1)) {
+		double result;
+		if (index->lookup(p, result)) return ValuePtr(result);
+	}
 	for (size_t i = 1; i < vec.size(); i++) {
 		double this_p, this_v;
 		if (vec[i]->getVec2(this_p, this_v)) {
@@ -682,6 +676,26 @@ static Value::VectorType search(const std::string &find, const Value::VectorType
 	return returnvec;
 }
 
+/*!
+	Appends the indices of up to \a num_returns_per_match (0 for all) values
+	of \a range equal to \a find to \a matches, without expanding the range.
+*/
+static void search(const ValuePtr &find, RangeType range,
+									 unsigned int num_returns_per_match, Value::VectorType &matches)
+{
+	if (find->type() != Value::NUMBER || range.isUnbounded()) return;
+	const double value = find->toDouble();
+	unsigned int matchCount = 0;
+	double j = 0;
+	for (RangeType::iterator it = range.begin();it != range.end();it++, j++) {
+		if (*it == value) {
+			matches.push_back(ValuePtr(j));
+			matchCount++;
+			if (num_returns_per_match != 0 && matchCount >= num_returns_per_match) break;
+		}
+	}
+}
+
 ValuePtr builtin_search(const Context *, const EvalContext *evalctx)
 {
 	if (evalctx->numArgs() < 2) return ValuePtr::undefined;
@@ -693,7 +707,21 @@ ValuePtr builtin_search(const Context *, const EvalContext *evalctx)
 
 	Value::VectorType returnvec;
 
-	if (findThis->type() == Value::NUMBER) {
+	// Ranges only hold numbers, so there are no columns to index
+	if (searchTable->type() == Value::RANGE && findThis->type() == Value::NUMBER) {
+		if (index_col_num == 0) search(findThis, searchTable->toRange(), num_returns_per_match, returnvec);
+	} else if (searchTable->type() == Value::RANGE && findThis->type() == Value::VECTOR) {
+		for (const auto &find_value : findThis->toVector()) {
+			Value::VectorType resultvec;
+			if (index_col_num == 0) search(find_value, searchTable->toRange(), num_returns_per_match, resultvec);
+			if (num_returns_per_match == 1 && !resultvec.empty()) returnvec.push_back(resultvec[0]);
+			else returnvec.push_back(ValuePtr(resultvec));
+		}
+	} else if (findThis->type() == Value::NUMBER) {
+		if (shared_ptr<const SearchIndex> index = TableIndex::search(searchTable, index_col_num)) {
+			index->find(searchTable->toVector(), findThis, num_returns_per_match, returnvec);
+			return ValuePtr(std::move(returnvec));
+		}
 		unsigned int matchCount = 0;
 
 		for (size_t j = 0; j < searchTable->toVector().size(); j++) {
@@ -715,12 +743,20 @@ ValuePtr builtin_search(const Context *, const EvalContext *evalctx)
 			returnvec = search(findThis->toString(), searchTable->toVector(), num_returns_per_match, index_col_num);
 		}
 	} else if (findThis->type() == Value::VECTOR) {
+		shared_ptr<const SearchIndex> index = TableIndex::search(searchTable, index_col_num);
 		for (size_t i = 0; i < findThis->toVector().size(); i++) {
 		  unsigned int matchCount = 0;
 			Value::VectorType resultvec;
 
 			const ValuePtr &find_value = findThis->toVector()[i];
 
+			if (index) {
+				index->find(searchTable->toVector(), find_value, num_returns_per_match, resultvec);
+				if (num_returns_per_match == 1 && !resultvec.empty()) returnvec.push_back(resultvec[0]);
+				else returnvec.push_back(ValuePtr(resultvec));
+				continue;
+			}
+
 			for (size_t j = 0; j < searchTable->toVector().size(); j++) {
 
 				const ValuePtr &search_element = searchTable->toVector()[j];
@@ -749,7 +785,7 @@ ValuePtr builtin_search(const Context *, const EvalContext *evalctx)
 	} else {
 		return ValuePtr::undefined;
 	}
-	return ValuePtr(returnvec);
+	return ValuePtr(std::move(returnvec));
 }
 
 #define QUOTE(x__) # x__
@@ -764,7 +800,7 @@ ValuePtr builtin_version(const Context *, const EvalContext *evalctx)
 #ifdef OPENSCAD_DAY
 	val.push_back(double(OPENSCAD_DAY));
 #endif
-	return ValuePtr(val);
+	return ValuePtr(std::move(val));
 }
 
 ValuePtr builtin_version_num(const Context *ctx, const EvalContext *evalctx)
@@ -783,6 +819,7 @@ ValuePtr builtin_parent_module(const Context *, const EvalContext *evalctx)
 {
 	int n;
 	double d;
+	FunctionCache::markVolatile();
 	int s = UserModule::stack_size();
 	if (evalctx->numArgs() == 0)
 		d=1; // parent module
@@ -876,32 +913,32 @@ ValuePtr builtin_cross(const Context *, const EvalContext *evalctx)
 	result.push_back(ValuePtr(x));
 	result.push_back(ValuePtr(y));
 	result.push_back(ValuePtr(z));
-	return ValuePtr(result);
+	return ValuePtr(std::move(result));
 }
 
 void register_builtin_functions()
 {
-	Builtins::init("abs", new BuiltinFunction(&builtin_abs));
-	Builtins::init("sign", new BuiltinFunction(&builtin_sign));
+	Builtins::init("abs", new BuiltinFunction(&builtin_unary<math_abs>));
+	Builtins::init("sign", new BuiltinFunction(&builtin_unary<math_sign>));
 	Builtins::init("rands", new BuiltinFunction(&builtin_rands));
 	Builtins::init("min", new BuiltinFunction(&builtin_min));
 	Builtins::init("max", new BuiltinFunction(&builtin_max));
-	Builtins::init("sin", new BuiltinFunction(&builtin_sin));
-	Builtins::init("cos", new BuiltinFunction(&builtin_cos));
-	Builtins::init("asin", new BuiltinFunction(&builtin_asin));
-	Builtins::init("acos", new BuiltinFunction(&builtin_acos));
-	Builtins::init("tan", new BuiltinFunction(&builtin_tan));
-	Builtins::init("atan", new BuiltinFunction(&builtin_atan));
-	Builtins::init("atan2", new BuiltinFunction(&builtin_atan2));
-	Builtins::init("round", new BuiltinFunction(&builtin_round));
-	Builtins::init("ceil", new BuiltinFunction(&builtin_ceil));
-	Builtins::init("floor", new BuiltinFunction(&builtin_floor));
-	Builtins::init("pow", new BuiltinFunction(&builtin_pow));
-	Builtins::init("sqrt", new BuiltinFunction(&builtin_sqrt));
-	Builtins::init("exp", new BuiltinFunction(&builtin_exp));
+	Builtins::init("sin", new BuiltinFunction(&builtin_unary<sin_degrees>));
+	Builtins::init("cos", new BuiltinFunction(&builtin_unary<cos_degrees>));
+	Builtins::init("asin", new BuiltinFunction(&builtin_unary<math_asin>));
+	Builtins::init("acos", new BuiltinFunction(&builtin_unary<math_acos>));
+	Builtins::init("tan", new BuiltinFunction(&builtin_unary<math_tan>));
+	Builtins::init("atan", new BuiltinFunction(&builtin_unary<math_atan>));
+	Builtins::init("atan2", new BuiltinFunction(&builtin_binary<math_atan2>));
+	Builtins::init("round", new BuiltinFunction(&builtin_unary<math_round>));
+	Builtins::init("ceil", new BuiltinFunction(&builtin_unary<math_ceil>));
+	Builtins::init("floor", new BuiltinFunction(&builtin_unary<math_floor>));
+	Builtins::init("pow", new BuiltinFunction(&builtin_binary<math_pow>));
+	Builtins::init("sqrt", new BuiltinFunction(&builtin_unary<math_sqrt>));
+	Builtins::init("exp", new BuiltinFunction(&builtin_unary<math_exp>));
 	Builtins::init("len", new BuiltinFunction(&builtin_length));
 	Builtins::init("log", new BuiltinFunction(&builtin_log));
-	Builtins::init("ln", new BuiltinFunction(&builtin_ln));
+	Builtins::init("ln", new BuiltinFunction(&builtin_unary<math_ln>));
 	Builtins::init("str", new BuiltinFunction(&builtin_str));
 	Builtins::init("chr", new BuiltinFunction(&builtin_chr));
 	Builtins::init("concat", new BuiltinFunction(&builtin_concat));
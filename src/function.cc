@@ -27,6 +27,9 @@
 #include "function.h"
 #include "evalcontext.h"
 #include "expression.h"
+#include "modcontext.h"
+#include "FunctionCache.h"
+#include "Profiler.h"
 
 AbstractFunction::~AbstractFunction()
 {
@@ -35,6 +38,9 @@ AbstractFunction::~AbstractFunction()
 UserFunction::UserFunction(const char *name, AssignmentList &definition_arguments, shared_ptr<Expression> expr, const Location &loc)
 	: ASTNode(loc), name(name), definition_arguments(definition_arguments), expr(expr)
 {
+	static std::atomic<size_t> next_id(0);
+	this->id = next_id++;
+	this->shared_slots = this->expr ? CommonSubexpression::share(this->expr, this->id) : 0;
 }
 
 UserFunction::~UserFunction()
@@ -44,11 +50,22 @@ UserFunction::~UserFunction()
 ValuePtr UserFunction::evaluate(const Context *ctx, const EvalContext *evalctx) const
 {
 	if (!expr) return ValuePtr::undefined;
+	Profiler::Scope profile("function", this->name, this->location().firstLine());
 	Context c(ctx);
 	c.setVariables(definition_arguments, evalctx);
-	ValuePtr result = expr->evaluate(&c);
+	CommonSubexpression::Frame frame(this->id, this->shared_slots);
 
-	return result;
+	// Only top-level functions are memoized, since module variables differ
+	// between instantiations of the module
+	if (Feature::ExperimentalFunctionMemo.is_enabled() && dynamic_cast<const FileContext *>(ctx)) {
+		return FunctionCache::instance()->evaluate(this->id, c, [this, &c]() { return evaluateBody(c); });
+	}
+	return evaluateBody(c);
+}
+
+ValuePtr UserFunction::evaluateBody(Context &c) const
+{
+	return expr->evaluate(&c);
 }
 
 std::string UserFunction::dump(const std::string &indent, const std::string &name) const
@@ -65,61 +82,94 @@ std::string UserFunction::dump(const std::string &indent, const std::string &nam
 	return dump.str();
 }
 
+/*!
+	A function whose body ends in calls to itself, possibly through nested
+	conditionals and let() expressions. Such tail calls rebind the
+	arguments and loop instead of recursing, so accumulator style functions
+	aren't limited by the stack depth.
+*/
 class FunctionTailRecursion : public UserFunction
 {
 private:
-	bool invert;
-	shared_ptr<TernaryOp> op;
-	shared_ptr<FunctionCall> call;
-	shared_ptr<Expression> endexpr;
+	// Owns the let() contexts entered on the way to a tail expression, and
+	// destroys them innermost first as the context stack requires.
+	class Scopes {
+	public:
+		~Scopes() {
+			while (!contexts.empty()) {
+				delete contexts.back();
+				contexts.pop_back();
+			}
+		}
+		Context *push(const Context *parent) {
+			contexts.push_back(new Context(parent));
+			return contexts.back();
+		}
+	private:
+		std::vector<Context *> contexts;
+	};
 
 public:
 	FunctionTailRecursion(const char *name, AssignmentList &definition_arguments,
-												shared_ptr<TernaryOp> expr, shared_ptr<FunctionCall> call,
-												shared_ptr<Expression> endexpr, bool invert,
-												const Location &loc)
-		: UserFunction(name, definition_arguments, expr, loc),
-			invert(invert), op(expr), call(call), endexpr(endexpr) {
+												shared_ptr<Expression> expr, const Location &loc)
+		: UserFunction(name, definition_arguments, expr, loc) {
 	}
 
 	virtual ~FunctionTailRecursion() { }
 
-	virtual ValuePtr evaluate(const Context *ctx, const EvalContext *evalctx) const {
-		if (!expr) return ValuePtr::undefined;
-		
-		Context c(ctx);
-		c.setVariables(definition_arguments, evalctx);
-		
-		EvalContext ec(&c, call->arguments);
-		Context tmp(&c);
+	// Returns true if expr is, or through conditionals and let() ends in, a call to name
+	static bool hasTailCall(const std::string &name, const Expression *expr) {
+		if (const TernaryOp *op = dynamic_cast<const TernaryOp *>(expr)) {
+			return hasTailCall(name, op->ifexpr.get()) || hasTailCall(name, op->elseexpr.get());
+		}
+		if (const Let *let = dynamic_cast<const Let *>(expr)) {
+			return hasTailCall(name, let->expr.get());
+		}
+		const FunctionCall *call = dynamic_cast<const FunctionCall *>(expr);
+		return call && call->name == name;
+	}
+
+protected:
+	virtual ValuePtr evaluateBody(Context &c) const {
+		const Context *ctx = c.getParent();
 		unsigned int counter = 0;
-		while (invert ^ this->op->cond->evaluate(&c)) {
+		while (true) {
+			Scopes scopes;
+			const Context *scope = &c;
+			const Expression *e = this->expr.get();
+			while (true) {
+				if (const TernaryOp *op = dynamic_cast<const TernaryOp *>(e)) {
+					e = (op->cond->evaluate(scope) ? op->ifexpr : op->elseexpr).get();
+				}
+				else if (const Let *let = dynamic_cast<const Let *>(e)) {
+					Context *letctx = scopes.push(scope);
+					EvalContext(letctx, let->arguments).assignTo(*letctx);
+					scope = letctx;
+					e = let->expr.get();
+				}
+				else break;
+			}
+
+			const FunctionCall *call = dynamic_cast<const FunctionCall *>(e);
+			if (!call || call->name != this->name) return e->evaluate(scope);
+
+			if (counter++ == 1000000) throw RecursionException::create("function", this->name);
+
+			// Bind the arguments as a call would, with defaults evaluated in the
+			// definition context, then reuse this frame for the next iteration
+			EvalContext ec(scope, call->arguments, NULL, &call->binding);
+			Context tmp(ctx);
 			tmp.setVariables(definition_arguments, &ec);
 			c.apply_variables(tmp);
-			
-			if (counter++ == 1000000) throw RecursionException::create("function", this->name);
+			CommonSubexpression::Frame::current()->reset();
 		}
-		
-		ValuePtr result = endexpr->evaluate(&c);
-		
-		return result;
 	}
 };
 
 UserFunction *UserFunction::create(const char *name, AssignmentList &definition_arguments, shared_ptr<Expression> expr, const Location &loc)
 {
-	if (shared_ptr<TernaryOp> ternary = dynamic_pointer_cast<TernaryOp>(expr)) {
-		shared_ptr<FunctionCall> ifcall = dynamic_pointer_cast<FunctionCall>(ternary->ifexpr);
-		shared_ptr<FunctionCall> elsecall = dynamic_pointer_cast<FunctionCall>(ternary->elseexpr);
-		if (ifcall && !elsecall) {
-			if (name == ifcall->name) {
-				return new FunctionTailRecursion(name, definition_arguments, ternary, ifcall, ternary->elseexpr, false, loc);
-			}
-		} else if (elsecall && !ifcall) {
-			if (name == elsecall->name) {
-				return new FunctionTailRecursion(name, definition_arguments, ternary, elsecall, ternary->ifexpr, true, loc);
-			}
-		}
+	if (expr && FunctionTailRecursion::hasTailCall(name, expr.get())) {
+		return new FunctionTailRecursion(name, definition_arguments, expr, loc);
 	}
 	return new UserFunction(name, definition_arguments, expr, loc);
 }
@@ -51,4 +51,14 @@ public:
 	virtual std::string dump(const std::string &indent, const std::string &name) const;
         
 	static UserFunction *create(const char *name, AssignmentList &definition_arguments, shared_ptr<Expression> expr, const Location &loc);
+
+protected:
+	// Evaluates the body in c, which holds the bound arguments
+	virtual ValuePtr evaluateBody(class Context &c) const;
+
+private:
+	// Unique per definition, used to key FunctionCache
+	size_t id;
+	// Number of subexpressions of the body shared by CommonSubexpression
+	unsigned int shared_slots;
 };
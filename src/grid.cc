@@ -0,0 +1,121 @@
+#include "grid.h"
+
+static_assert(sizeof(Vector3d) == 3 * sizeof(double), "Vertex arrays must be flat arrays of coordinates");
+
+static inline size_t hash_key(const int64_t *key)
+{
+	return grid_hash(key[0], key[1], key[2]);
+}
+
+VertexWelder::VertexWelder(double resolution, size_t expected) : res(resolution)
+{
+	reserve(expected);
+}
+
+/*!
+	Makes room for \a count grid points, keeping the table at most half full.
+*/
+void VertexWelder::reserve(size_t count)
+{
+	size_t capacity = 16;
+	while (capacity < 2 * count) capacity *= 2;
+	if (capacity <= this->slots.size()) return;
+	this->slots.assign(capacity, -1);
+	const size_t mask = capacity - 1;
+	for (size_t i = 0; i < size(); i++) {
+		size_t slot = hash_key(&this->keys[3 * i]) & mask;
+		while (this->slots[slot] >= 0) slot = (slot + 1) & mask;
+		this->slots[slot] = int(i);
+	}
+}
+
+int VertexWelder::find(const int64_t *key) const
+{
+	const size_t mask = this->slots.size() - 1;
+	for (size_t slot = hash_key(key) & mask;; slot = (slot + 1) & mask) {
+		const int index = this->slots[slot];
+		if (index < 0) return -1;
+		const int64_t *k = &this->keys[3 * index];
+		if (k[0] == key[0] && k[1] == key[1] && k[2] == key[2]) return index;
+	}
+}
+
+/*!
+	Returns the index of the grid point \a key, or of the closest existing
+	neighbour if there is no such point, adding \a key if there is neither.
+*/
+int VertexWelder::weldKey(const int64_t *key)
+{
+	int index = find(key);
+	if (index >= 0) return index;
+
+	// Same search order as Grid3d, so ties go to the same neighbour
+	int64_t dist = 4; // > max possible squared distance
+	for (int64_t dx = -1; dx <= 1; dx++) {
+		for (int64_t dy = -1; dy <= 1; dy++) {
+			for (int64_t dz = -1; dz <= 1; dz++) {
+				const int64_t d = dx * dx + dy * dy + dz * dz;
+				if (d == 0 || d >= dist) continue;
+				const int64_t k[3] = { key[0] + dx, key[1] + dy, key[2] + dz };
+				const int found = find(k);
+				if (found < 0) continue;
+				dist = d;
+				index = found;
+			}
+		}
+	}
+	if (index >= 0) return index;
+
+	index = int(size());
+	if (2 * (size() + 1) > this->slots.size()) reserve(size() + 1);
+	this->keys.insert(this->keys.end(), key, key + 3);
+	const size_t mask = this->slots.size() - 1;
+	size_t slot = hash_key(key) & mask;
+	while (this->slots[slot] >= 0) slot = (slot + 1) & mask;
+	this->slots[slot] = index;
+	return index;
+}
+
+/*!
+	Aligns \a v to the grid. Returns the index of its grid point, new grid
+	points getting the next index.
+*/
+int VertexWelder::align(Vector3d &v)
+{
+	const int64_t key[3] = { int64_t(v[0] / this->res), int64_t(v[1] / this->res), int64_t(v[2] / this->res) };
+	const int index = weldKey(key);
+	v = vertex(index);
+	return index;
+}
+
+/*!
+	Welds all of \a vertices in order, like calling align() for each of
+	them. Returns the index of the grid point of each vertex.
+*/
+std::vector<int> VertexWelder::weld(const std::vector<Vector3d> &vertices)
+{
+	const size_t n = vertices.size();
+	std::vector<int> indices(n);
+	if (n == 0) return indices;
+
+	// A plain loop over the coordinates, which the compiler can vectorize
+	std::vector<int64_t> quantized(3 * n);
+	const double *coords = vertices[0].data();
+	const double res = this->res;
+	for (size_t i = 0; i < 3 * n; i++) quantized[i] = int64_t(coords[i] / res);
+
+	reserve(size() + n);
+	for (size_t i = 0; i < n; i++) indices[i] = weldKey(&quantized[3 * i]);
+	return indices;
+}
+
+/*!
+	Returns the aligned coordinates of all grid points in index order.
+*/
+std::vector<Vector3d> VertexWelder::vertices() const
+{
+	std::vector<Vector3d> result;
+	result.reserve(size());
+	for (size_t i = 0; i < size(); i++) result.push_back(vertex(int(i)));
+	return result;
+}
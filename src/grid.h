@@ -2,12 +2,12 @@
 
 #include "linalg.h"
 #include "hash.h"
-#include <boost/functional/hash.hpp>
 #include <cmath>
 
 #include <cstdint> // int64_t
-#include <unordered_map>
+#include <algorithm>
 #include <utility>
+#include <vector>
 
 //const double GRID_COARSE = 0.001;
 //const double GRID_FINE   = 0.000001;
@@ -19,52 +19,118 @@ for ctest -R CGAL. We choose 1/1024 and 1/(1024*1024) In python: print
 const double GRID_COARSE = 0.0009765625;
 const double GRID_FINE   = 0.00000095367431640625;
 
+// Mixes the quantized coordinates of a grid point
+inline size_t grid_hash(int64_t x, int64_t y, int64_t z = 0)
+{
+	uint64_t h = uint64_t(x) * 0x9E3779B97F4A7C15ULL;
+	h ^= uint64_t(y) * 0xC2B2AE3D27D4EB4FULL;
+	h ^= uint64_t(z) * 0x165667B19E3779F9ULL;
+	return size_t(h ^ (h >> 31));
+}
+
+/*!
+	Values of grid points of \a N coordinates, kept in flat arrays with an
+	open-addressing hash table of their indices, like VertexWelder. Points
+	can't be removed. References to values stay valid until the next point
+	is added.
+*/
+template <typename T, int N>
+class GridMap
+{
+public:
+	GridMap() : slots(16, -1) {}
+
+	size_t size() const { return this->values.size(); }
+	const int64_t *key(int index) const { return &this->keys[N * index]; }
+	T &value(int index) { return this->values[index]; }
+
+	// Returns the index of the point \a key, or -1
+	int find(const int64_t *key) const {
+		const size_t mask = this->slots.size() - 1;
+		for (size_t slot = hash(key) & mask;; slot = (slot + 1) & mask) {
+			const int index = this->slots[slot];
+			if (index < 0) return -1;
+			if (std::equal(key, key + N, &this->keys[N * index])) return index;
+		}
+	}
+
+	// Returns the index of the point \a key, adding it with value \a init if it's new
+	int insert(const int64_t *key, const T &init = T()) {
+		int index = find(key);
+		if (index >= 0) return index;
+		if (2 * (size() + 1) > this->slots.size()) grow();
+		index = int(size());
+		this->keys.insert(this->keys.end(), key, key + N);
+		this->values.push_back(init);
+		place(index);
+		return index;
+	}
+
+private:
+	static size_t hash(const int64_t *key) { return grid_hash(key[0], key[1], N > 2 ? key[2] : 0); }
+
+	void place(int index) {
+		const size_t mask = this->slots.size() - 1;
+		size_t slot = hash(key(index)) & mask;
+		while (this->slots[slot] >= 0) slot = (slot + 1) & mask;
+		this->slots[slot] = index;
+	}
+
+	void grow() {
+		this->slots.assign(2 * this->slots.size(), -1);
+		for (size_t i = 0; i < size(); i++) place(int(i));
+	}
+
+	std::vector<int64_t> keys;
+	std::vector<T> values;
+	std::vector<int> slots; // Indices of points, -1 if empty
+};
+
 template <typename T>
 class Grid2d
 {
 public:
 	double res;
-	std::unordered_map<std::pair<int64_t,int64_t>, T, boost::hash<std::pair<int64_t,int64_t>>> db;
+	GridMap<T, 2> db;
 
 	Grid2d(double resolution) {
 		res = resolution;
 	}
 	/*!
 		Aligns x,y to the grid or to existing point if one close enough exists.
-		Returns the value stored if a point already existing or an uninitialized new value
-		if not.
+		Returns the value stored if a point already existing or a value
+		initialized new value if not.
 	*/ 
 	T &align(double &x, double &y) {
-		int64_t ix = (int64_t)std::round(x / res);
-		int64_t iy = (int64_t)std::round(y / res);
-		if (db.find(std::make_pair(ix, iy)) == db.end()) {
+		int64_t key[2] = { (int64_t)std::round(x / res), (int64_t)std::round(y / res) };
+		int index = db.find(key);
+		if (index < 0) {
 			int dist = 10;
-			for (int64_t jx = ix - 1; jx <= ix + 1; jx++) {
-				for (int64_t jy = iy - 1; jy <= iy + 1; jy++) {
-					if (db.find(std::make_pair(jx, jy)) == db.end())
-						continue;
-					int d = abs(int(ix-jx)) + abs(int(iy-jy));
+			for (int64_t jx = key[0] - 1; jx <= key[0] + 1; jx++) {
+				for (int64_t jy = key[1] - 1; jy <= key[1] + 1; jy++) {
+					const int64_t k[2] = { jx, jy };
+					const int found = db.find(k);
+					if (found < 0) continue;
+					int d = abs(int(key[0]-jx)) + abs(int(key[1]-jy));
 					if (d < dist) {
 					  dist = d;
-						ix = jx;
-						iy = jy;
+						index = found;
 					}
 				}
 			}
 		}
-		x = ix * res, y = iy * res;
-		return db[std::make_pair(ix, iy)];
+		if (index < 0) index = db.insert(key);
+		x = db.key(index)[0] * res, y = db.key(index)[1] * res;
+		return db.value(index);
 	}
 
 	bool has(double x, double y) const {
-		int64_t ix = (int64_t)std::round(x / res);
-		int64_t iy = (int64_t)std::round(y / res);
-		if (db.find(std::make_pair(ix, iy)) != db.end())
-			return true;
+		const int64_t ix = (int64_t)std::round(x / res);
+		const int64_t iy = (int64_t)std::round(y / res);
 		for (int64_t jx = ix - 1; jx <= ix + 1; jx++)
 		for (int64_t jy = iy - 1; jy <= iy + 1; jy++) {
-			if (db.find(std::make_pair(jx, jy)) != db.end())
-				return true;
+			const int64_t k[2] = { jx, jy };
+			if (db.find(k) >= 0) return true;
 		}
 		return false;
 	}
@@ -89,76 +155,64 @@ class Grid3d
 {
 public:
 	double res;
-	typedef Vector3l Key;
-	typedef std::unordered_map<Key, T> GridContainer;
-	GridContainer db;
+	GridMap<T, 3> db;
 
 	Grid3d(double resolution) {
 		res = resolution;
 	}
 
-	inline void createGridVertex(const Vector3d &v, Vector3l &i) {
-		i[0] = int64_t(v[0] / this->res);
-		i[1] = int64_t(v[1] / this->res);
-		i[2] = int64_t(v[2] / this->res);
+	inline void createGridVertex(const Vector3d &v, int64_t *key) const {
+		key[0] = int64_t(v[0] / this->res);
+		key[1] = int64_t(v[1] / this->res);
+		key[2] = int64_t(v[2] / this->res);
 	}
 
 	// Aligns vertex to the grid. Returns index of the vertex.
 	// Will automatically increase the index as new unique vertices are added.
 	T align(Vector3d &v) {
-		Vector3l key;
+		int64_t key[3];
 		createGridVertex(v, key);
-		typename GridContainer::iterator iter = db.find(key);
-		if (iter == db.end()) {
+		int index = db.find(key);
+		if (index < 0) {
 			float dist = 10.0f; // > max possible distance
 			for (int64_t jx = key[0] - 1; jx <= key[0] + 1; jx++) {
 				for (int64_t jy = key[1] - 1; jy <= key[1] + 1; jy++) {
 					for (int64_t jz = key[2] - 1; jz <= key[2] + 1; jz++) {
-						Vector3l k(jx, jy, jz);
-						typename GridContainer::iterator tmpiter = db.find(k);
-						if (tmpiter == db.end()) continue;
-						float d = sqrt((key-k).squaredNorm());
+						const int64_t k[3] = { jx, jy, jz };
+						const int found = db.find(k);
+						if (found < 0) continue;
+						float d = sqrt(float((key[0]-jx)*(key[0]-jx) + (key[1]-jy)*(key[1]-jy) + (key[2]-jz)*(key[2]-jz)));
 						if (d < dist) {
 						  dist = d;
-							iter = tmpiter;
+							index = found;
 						}
 					}
 				}
 			}
 		}
 
-		T data;
-		if (iter == db.end()) { // Not found: insert using key
-			data = db.size();
-			db[key] = data;
-		}
-		else {
-			// If found return existing data
-			key = iter->first;
-			data = iter->second;
-		}
+		// Not found: insert using key, the data being the index
+		if (index < 0) index = db.insert(key, T(db.size()));
 
 		// Align vertex
-		v[0] = key[0] * this->res;
-		v[1] = key[1] * this->res;
-		v[2] = key[2] * this->res;
+		const int64_t *aligned = db.key(index);
+		v[0] = aligned[0] * this->res;
+		v[1] = aligned[1] * this->res;
+		v[2] = aligned[2] * this->res;
 
-		return data;
+		return db.value(index);
 	}
 
 	bool has(const Vector3d &v, T *data = NULL) {
-		Vector3l key = createGridVertex(v);
-		typename GridContainer::iterator pos = db.find(key);
-		if (pos != db.end()) {
-			if (data) *data = pos->second;
-			return true;
-		}
+		int64_t key[3];
+		createGridVertex(v, key);
 		for (int64_t jx = key[0] - 1; jx <= key[0] + 1; jx++)
 			for (int64_t jy = key[1] - 1; jy <= key[1] + 1; jy++)
 				for (int64_t jz = key[2] - 1; jz <= key[2] + 1; jz++) {
-					pos = db.find(Vector3l(jx, jy, jz));
-					if (pos != db.end()) {
-						if (data) *data = pos->second;
+					const int64_t k[3] = { jx, jy, jz };
+					const int found = db.find(k);
+					if (found >= 0) {
+						if (data) *data = db.value(found);
 						return true;
 					}
 				}
@@ -170,3 +224,35 @@ public:
 	}
 
 };
+
+/*!
+	Welds vertices to the grid like Grid3d<int>, each vertex snapping to an
+	existing grid point next to it, giving the same indices and coordinates.
+
+	The grid points are kept in flat arrays with an open-addressing hash
+	table over them, rather than a node per point, and weld() quantizes a
+	whole vertex array in one pass over its coordinates.
+*/
+class VertexWelder
+{
+public:
+	VertexWelder(double resolution, size_t expected = 0);
+
+	int align(Vector3d &v);
+	std::vector<int> weld(const std::vector<Vector3d> &vertices);
+	size_t size() const { return this->keys.size() / 3; }
+	Vector3d vertex(int index) const {
+		const int64_t *key = &this->keys[3 * index];
+		return Vector3d(key[0] * this->res, key[1] * this->res, key[2] * this->res);
+	}
+	std::vector<Vector3d> vertices() const;
+
+private:
+	int find(const int64_t *key) const;
+	int weldKey(const int64_t *key);
+	void reserve(size_t count);
+
+	double res;
+	std::vector<int64_t> keys; // Three coordinates per grid point
+	std::vector<int> slots; // Indices of grid points, -1 if empty
+};
@@ -1,22 +1,29 @@
 #include "handle_dep.h"
+#include "Session.h"
 #include <string>
 #include <sstream>
 #include <stdlib.h> // for system()
 #include <unordered_set>
+#include <mutex>
 #include <boost/regex.hpp>
 #include <boost/filesystem.hpp>
 namespace fs = boost::filesystem;
 
 std::unordered_set<std::string> dependencies;
 const char *make_command = NULL;
+// Sessions may parse on several threads
+static std::mutex dependencies_mutex;
 
 void handle_dep(const std::string &filename)
 {
 	fs::path filepath(filename);
 	std::string dep;
 	if (filepath.is_absolute()) dep = filename;
-	else dep = (fs::current_path() / filepath).string();
-	dependencies.insert(boost::regex_replace(filename, boost::regex("\\ "), "\\\\ "));
+	else dep = (fs::path(Session::currentDirectory()) / filepath).string();
+	{
+		std::lock_guard<std::mutex> lock(dependencies_mutex);
+		dependencies.insert(boost::regex_replace(filename, boost::regex("\\ "), "\\\\ "));
+	}
 
 	if (!fs::exists(filepath) && make_command) {
 		std::stringstream buf;
@@ -34,6 +41,7 @@ bool write_deps(const std::string &filename, const std::string &output_file)
 	}
 	fprintf(fp, "%s:", output_file.c_str());
 
+	std::lock_guard<std::mutex> lock(dependencies_mutex);
 	for(const auto &str : dependencies) {
 		fprintf(fp, " \\\n\t%s", str.c_str());
 	}
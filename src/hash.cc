@@ -1,5 +1,5 @@
 #include "hash.h"
-#include <boost/functional/hash.hpp>
+#include <string.h>
 
 namespace std {
 	std::size_t hash<Vector3f>::operator()(const Vector3f &s) const {
@@ -13,20 +13,123 @@ namespace std {
 	}
 }
 
+/*
+	MurmurHash3 was written by Austin Appleby, and is placed in the public
+	domain. This is the x64_128 variant.
+*/
+static inline uint64_t rotl64(uint64_t x, int8_t r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+// Bits of a coordinate, with 0 and -0 the same since they compare equal
+static inline uint64_t coordinate_bits(double d)
+{
+	if (d == 0) d = 0;
+	uint64_t bits;
+	memcpy(&bits, &d, sizeof(bits));
+	return bits;
+}
+
+static inline uint64_t coordinate_bits(float f)
+{
+	if (f == 0) f = 0;
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	return bits;
+}
+
+/*!
+	Mixes three coordinates with one multiply each and a final avalanche,
+	rotating each by a different amount so equal coordinates don't cancel.
+*/
+static inline size_t hash_coordinates(uint64_t x, uint64_t y, uint64_t z)
+{
+	const uint64_t h = (x * 0x9E3779B97F4A7C15ULL) ^
+		(rotl64(y, 21) * 0xC2B2AE3D27D4EB4FULL) ^
+		(rotl64(z, 42) * 0x165667B19E3779F9ULL);
+	return size_t(fmix64(h));
+}
+
 namespace Eigen {
-  size_t hash_value(Vector3f const &v) {
-    size_t seed = 0;
-    for (int i=0;i<3;i++) boost::hash_combine(seed, v[i]);
-    return seed;
-  }
-  size_t hash_value(Vector3d const &v) {
-    size_t seed = 0;
-    for (int i=0;i<3;i++) boost::hash_combine(seed, v[i]);
-    return seed;
-  }
-  size_t hash_value(Eigen::Matrix<int64_t, 3, 1> const &v) {
-    size_t seed = 0;
-    for (int i=0;i<3;i++) boost::hash_combine(seed, v[i]);
-    return seed;
-  }
+	size_t hash_value(Vector3f const &v) {
+		return hash_coordinates(coordinate_bits(v[0]), coordinate_bits(v[1]), coordinate_bits(v[2]));
+	}
+	size_t hash_value(Vector3d const &v) {
+		return hash_coordinates(coordinate_bits(v[0]), coordinate_bits(v[1]), coordinate_bits(v[2]));
+	}
+	size_t hash_value(Eigen::Matrix<int64_t, 3, 1> const &v) {
+		return hash_coordinates(uint64_t(v[0]), uint64_t(v[1]), uint64_t(v[2]));
+	}
+}
+
+Hash128 hash128(const void *key, size_t len, uint64_t seed)
+{
+	const uint8_t *data = static_cast<const uint8_t*>(key);
+	const size_t nblocks = len / 16;
+	const uint64_t c1 = 0x87c37b91114253d5ULL;
+	const uint64_t c2 = 0x4cf5ad432745937fULL;
+	uint64_t h1 = seed;
+	uint64_t h2 = seed;
+
+	for (size_t i = 0; i < nblocks; i++) {
+		uint64_t k1, k2;
+		memcpy(&k1, data + i*16, 8);
+		memcpy(&k2, data + i*16 + 8, 8);
+
+		k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+		h1 = rotl64(h1, 27); h1 += h2; h1 = h1*5 + 0x52dce729;
+		k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+		h2 = rotl64(h2, 31); h2 += h1; h2 = h2*5 + 0x38495ab5;
+	}
+
+	const uint8_t *tail = data + nblocks*16;
+	uint64_t k1 = 0;
+	uint64_t k2 = 0;
+	switch (len & 15) {
+	case 15: k2 ^= uint64_t(tail[14]) << 48;
+	case 14: k2 ^= uint64_t(tail[13]) << 40;
+	case 13: k2 ^= uint64_t(tail[12]) << 32;
+	case 12: k2 ^= uint64_t(tail[11]) << 24;
+	case 11: k2 ^= uint64_t(tail[10]) << 16;
+	case 10: k2 ^= uint64_t(tail[ 9]) << 8;
+	case  9: k2 ^= uint64_t(tail[ 8]) << 0;
+		k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+	case  8: k1 ^= uint64_t(tail[ 7]) << 56;
+	case  7: k1 ^= uint64_t(tail[ 6]) << 48;
+	case  6: k1 ^= uint64_t(tail[ 5]) << 40;
+	case  5: k1 ^= uint64_t(tail[ 4]) << 32;
+	case  4: k1 ^= uint64_t(tail[ 3]) << 24;
+	case  3: k1 ^= uint64_t(tail[ 2]) << 16;
+	case  2: k1 ^= uint64_t(tail[ 1]) << 8;
+	case  1: k1 ^= uint64_t(tail[ 0]) << 0;
+		k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+	}
+
+	h1 ^= len; h2 ^= len;
+	h1 += h2; h2 += h1;
+	h1 = fmix64(h1); h2 = fmix64(h2);
+	h1 += h2; h2 += h1;
+	return Hash128(h1, h2);
+}
+
+std::string Hash128::toString() const
+{
+	static const char *digits = "0123456789abcdef";
+	std::string str(32, '0');
+	for (int i = 0; i < 16; i++) {
+		str[15 - i] = digits[(h1 >> (4*i)) & 0xf];
+		str[31 - i] = digits[(h2 >> (4*i)) & 0xf];
+	}
+	return str;
 }
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "linalg.h"
+#include <string>
+#include <stdint.h>
 
 typedef Eigen::Matrix<int64_t, 3, 1> Vector3l;
 
@@ -15,3 +17,21 @@ namespace Eigen {
 	size_t hash_value(Vector3d const &v);
 	size_t hash_value(Vector3l const &v);
 }
+
+/*!
+	128-bit non-cryptographic hash value (MurmurHash3, x64 variant).
+	The value is stable across runs and platforms, so it can be used as a
+	persistent cache key.
+*/
+struct Hash128 {
+	Hash128() : h1(0), h2(0) {}
+	Hash128(uint64_t h1, uint64_t h2) : h1(h1), h2(h2) {}
+	bool operator==(const Hash128 &other) const { return h1 == other.h1 && h2 == other.h2; }
+	bool operator!=(const Hash128 &other) const { return !(*this == other); }
+	std::string toString() const;
+
+	uint64_t h1, h2;
+};
+
+Hash128 hash128(const void *data, size_t len, uint64_t seed = 0);
+inline Hash128 hash128(const std::string &str, uint64_t seed = 0) { return hash128(str.data(), str.size(), seed); }
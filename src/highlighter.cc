@@ -139,8 +139,46 @@
 #include <QTextDocument>
 #include <QTextCursor>
 #include <QColor>
+#include <QTimer>
+#include <QScrollBar>
+#include <QElapsedTimer>
+#include <algorithm>
 //#include "printutils.h"
 
+// Set in the block state of blocks not formatted yet
+static const int DEFERRED = 0x100;
+// Smaller documents are always formatted right away
+static const int DEFER_MIN_BLOCKS = 2000;
+// Blocks this close to the visible ones are formatted right away
+static const int VISIBLE_MARGIN = 50;
+// The pause in editing before deferred blocks are formatted, and the time
+// they may take each time the editor is idle
+static const int DEFER_DELAY_MS = 50;
+static const int DEFER_SLICE_MS = 20;
+
+static int encode_state(Highlighter::state_e state, bool deferred)
+{
+	return (state + 1) | (deferred ? DEFERRED : 0);
+}
+
+static Highlighter::state_e decode_state(int state)
+{
+	if (state == -1) return Highlighter::NORMAL;
+	return Highlighter::state_e((state & ~DEFERRED) - 1);
+}
+
+// Characters which are tokens by themselves, so "{[a+b]}" is " { [ a + b ] } "
+static bool is_split_char(QChar c)
+{
+	switch (c.unicode()) {
+	case '=': case '!': case '+': case '-': case '*': case '/': case '%': case '#': case ';':
+	case '[': case ']': case '(': case ')': case '{': case '}': case ':': case ',':
+		return true;
+	default:
+		return false;
+	}
+}
+
 void format_colors_for_light_background(QMap<QString,QTextCharFormat> &formats)
 {
 	//PRINT("format for light");
@@ -190,6 +228,7 @@ void format_colors_for_dark_background(QMap<QString,QTextCharFormat> &formats)
 void Highlighter::assignFormatsToTokens(const QString &s)
 {
 	//PRINTB("assign fmts %s",s.toStdString());
+	this->enabled = s != "Off";
 	if (s=="For Light Background") {
 		format_colors_for_light_background(this->typeformats);
 	} else if (s=="For Dark Background") {
@@ -215,13 +254,19 @@ void Highlighter::assignFormatsToTokens(const QString &s)
 }
 
 Highlighter::Highlighter(QTextDocument *parent)
-		: QSyntaxHighlighter(parent)
+		: QSyntaxHighlighter(parent), view(NULL), visibleFirst(0), visibleLast(0)
 {
+	this->enabled = Preferences::inst()->getValue("editor/syntaxhighlight").toString() != "Off";
+	this->deferTimer = new QTimer(this);
+	this->deferTimer->setSingleShot(true);
+	this->deferTimer->setInterval(DEFER_DELAY_MS);
+	connect(this->deferTimer, SIGNAL(timeout()), this, SLOT(highlightDeferred()));
+
 	tokentypes["operator"] << "=" << "!" << "&&" << "||" << "+" << "-" << "*" << "/" << "%" << "!" << "#" << ";";
 	tokentypes["math"] << "abs" << "sign" << "acos" << "asin" << "atan" << "atan2" << "sin" << "cos" << "floor" << "round" << "ceil" << "ln" << "log" << "lookup" << "min" << "max" << "pow" << "sqrt" << "exp" << "rands";
 	tokentypes["keyword"] << "module" << "function" << "for" << "intersection_for" << "if" << "assign" << "echo"<< "search" << "str" << "let" << "each";
 	tokentypes["transform"] << "scale" << "translate" << "rotate" << "multmatrix" << "color" << "projection" << "hull" << "resize" << "mirror" << "minkowski";
-	tokentypes["csgop"]	<< "union" << "intersection" << "difference" << "render";
+	tokentypes["csgop"]	<< "union" << "intersection" << "difference" << "render" << "simplify";
 	tokentypes["prim3d"] << "cube" << "cylinder" << "sphere" << "polyhedron";
 	tokentypes["prim2d"] << "square" << "polygon" << "circle";
 	tokentypes["import"] << "include" << "use" << "import_stl" << "import" << "import_dxf" << "dxf_dim" << "dxf_cross" << "surface";
@@ -279,7 +324,9 @@ void Highlighter::unhighlightLastError()
 void Highlighter::portable_rehighlightBlock( const QTextBlock &block )
 {
 #if (QT_VERSION >= QT_VERSION_CHECK(4, 6, 0))
+	this->forcedBlock = block;
 	rehighlightBlock( block );
+	this->forcedBlock = QTextBlock();
 #else
 	rehighlight(); // slow on very large files
 #endif
@@ -295,6 +342,72 @@ int Highlighter::lastDocumentPos()
 #endif
 }
 
+/*!
+	Defers formatting the blocks far from the visible part of \a view.
+*/
+void Highlighter::setView(QTextEdit *view)
+{
+	this->view = view;
+	connect(view->verticalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(scheduleDeferred()));
+	connect(document(), SIGNAL(contentsChange(int, int, int)), this, SLOT(scheduleDeferred()));
+	updateVisibleRange();
+}
+
+void Highlighter::updateVisibleRange()
+{
+	if (!this->view) return;
+	const QWidget *viewport = this->view->viewport();
+	this->visibleFirst = this->view->cursorForPosition(QPoint(0, 0)).blockNumber();
+	this->visibleLast = this->view->cursorForPosition(QPoint(viewport->width() - 1, viewport->height() - 1)).blockNumber();
+}
+
+bool Highlighter::isDeferrable(const QTextBlock &block) const
+{
+	if (!this->view || block == this->forcedBlock || document()->blockCount() < DEFER_MIN_BLOCKS) return false;
+	const int n = block.blockNumber();
+	if (n >= this->visibleFirst - VISIBLE_MARGIN && n <= this->visibleLast + VISIBLE_MARGIN) return false;
+	// The block being edited
+	return n != this->view->textCursor().blockNumber();
+}
+
+void Highlighter::scheduleDeferred()
+{
+	if (this->view && document()->blockCount() >= DEFER_MIN_BLOCKS) this->deferTimer->start();
+}
+
+/*!
+	Formats deferred blocks, starting at the visible ones, until the time
+	slice is used up. The rest waits until the editor is idle again.
+*/
+void Highlighter::highlightDeferred()
+{
+	if (!this->enabled) return;
+	updateVisibleRange();
+	QElapsedTimer elapsed;
+	elapsed.start();
+	const QTextBlock first = document()->findBlockByNumber(std::max(0, this->visibleFirst));
+	QTextBlock block = first;
+	bool wrapped = false;
+	while (true) {
+		if (!block.isValid()) {
+			if (wrapped) break;
+			// Continue at the start of the document
+			wrapped = true;
+			block = document()->begin();
+		}
+		if (wrapped && block == first) break;
+		const int state = block.userState();
+		if (state != -1 && (state & DEFERRED)) {
+			if (elapsed.elapsed() > DEFER_SLICE_MS) {
+				this->deferTimer->start();
+				return;
+			}
+			portable_rehighlightBlock(block);
+		}
+		block = block.next();
+	}
+}
+
 void Highlighter::highlightBlock(const QString &text)
 {
 	int block_first_pos = currentBlock().position();
@@ -304,70 +417,73 @@ void Highlighter::highlightBlock(const QString &text)
 	//  << ", text:'" << text.toStdString() << "'\n";
 
 	// If desired, skip all highlighting .. except for error highlighting.
-	if (Preferences::inst()->getValue("editor/syntaxhighlight").toString()==QString("Off")) {
+	if (!this->enabled) {
 		if (errorState)
 			setFormat( errorPos - block_first_pos, 1, errorFormat);
 		return;
 	}
 
+	// Blocks far from the view only get their state for now
+	const bool deferred = isDeferrable(currentBlock());
+	auto mark = [this, deferred](int start, int count, const QTextCharFormat &format) {
+		if (!deferred) setFormat(start, count, format);
+	};
+
 	// bit of a kludge (for historical convenience)
-	QTextCharFormat &quoteFormat = tokenFormats["_$quote"];
-	QTextCharFormat &commentFormat = tokenFormats["_$comment"];
-	QTextCharFormat &numberFormat = tokenFormats["_$number"];
-
-	// Split the block into chunks (tokens), based on whitespace,
-	// and then highlight each token as appropriate
-	QString newtext = text;
-	QStringList splitHelpers;
-	QStringList::iterator sh, token;
-	// splitHelpers - so "{[a+b]}" is treated as " { [ a + b ] } "
-	splitHelpers << tokentypes["operator"] << tokentypes["bracket"]
-	  << tokentypes["curlies"] << ":" << ",";
-	for ( sh = splitHelpers.begin(); sh!=splitHelpers.end(); ++sh ) {
-		newtext = newtext.replace( *sh, " " + *sh + " ");
-	}
-	//PRINTB("\nnewtext: %s", newtext.toStdString() );
-	QStringList tokens = newtext.split(QRegExp("\\s"));
-	int tokindex = 0; // tokindex helps w duplicate tokens in a single block
-	bool numtest;
-	for ( token = tokens.begin(); token!=tokens.end(); ++token ){
-		if ( tokenFormats.contains( *token ) ) {
-			tokindex = text.indexOf( *token, tokindex );
-			setFormat( tokindex, token->size(), tokenFormats[ *token ]);
-			std::string tokprint = (*token).toStdString();
-			//PRINTB("found tok '%s' at %i", tokprint % tokindex );
-			tokindex += token->size();
-		} else {
-			(*token).toDouble( &numtest );
-			if ( numtest ) {
-				tokindex = text.indexOf( *token, tokindex );
-				setFormat( tokindex, token->size(), numberFormat );
-				std::string tokprint = (*token).toStdString();
-				//PRINTB("found num '%s' at %i", tokprint % tokindex );
-				tokindex += token->size();
+	const QTextCharFormat quoteFormat = tokenFormats["_$quote"];
+	const QTextCharFormat commentFormat = tokenFormats["_$comment"];
+	const QTextCharFormat numberFormat = tokenFormats["_$number"];
+
+	// Split the block into tokens at whitespace and around operators,
+	// brackets, curlies, ':' and ',', and highlight each token as appropriate
+	for (int n = 0; n < text.size() && !deferred; ) {
+		if (text[n].isSpace()) {
+			n++;
+			continue;
+		}
+		int length = 1;
+		if ((text[n] == '&' || text[n] == '|') && n+1 < text.size() && text[n+1] == text[n]) {
+			length = 2;
+		}
+		else if (!is_split_char(text[n])) {
+			while (n+length < text.size() && !text[n+length].isSpace() && !is_split_char(text[n+length])) {
+				// "&&" and "||" split tokens like the operators
+				if ((text[n+length] == '&' || text[n+length] == '|') &&
+						n+length+1 < text.size() && text[n+length+1] == text[n+length]) break;
+				length++;
 			}
 		}
+		const QString token = text.mid(n, length);
+		QHash<QString, QTextCharFormat>::const_iterator it = tokenFormats.constFind(token);
+		if (it != tokenFormats.constEnd()) {
+			setFormat(n, length, *it);
+		} else {
+			bool numtest;
+			token.toDouble( &numtest );
+			if ( numtest ) setFormat(n, length, numberFormat);
+		}
+		n += length;
 	}
 
 	// Quoting and Comments.
-	state_e state = (state_e) previousBlockState();
+	state_e state = decode_state(previousBlockState());
 	int quote_esc_state = 0;
 	for (int n = 0; n < text.size(); ++n){
 		if (state == NORMAL){
 			if (text[n] == '"'){
 				state = QUOTE;
-				setFormat(n,1,quoteFormat);
+				mark(n,1,quoteFormat);
 			} else if (text[n] == '/'){
 				if ( n+1 < text.size() && text[n+1] == '/'){
-					setFormat(n,text.size(),commentFormat);
+					mark(n,text.size(),commentFormat);
 					break;
 				} else if ( n+1 < text.size() && text[n+1] == '*'){
-					setFormat(n++,2,commentFormat);
+					mark(n++,2,commentFormat);
 					state = COMMENT;
 				}
 			}
 		} else if (state == QUOTE){
-			setFormat(n,1,quoteFormat);
+			mark(n,1,quoteFormat);
 			if (quote_esc_state > 0)
 				quote_esc_state = 0;
 			else if (text[n] == '\\')
@@ -375,19 +491,18 @@ void Highlighter::highlightBlock(const QString &text)
 			else if (text[n] == '"')
 				state = NORMAL;
 		} else if (state == COMMENT){
-			setFormat(n,1,commentFormat);
+			mark(n,1,commentFormat);
 			if (text[n] == '*' && n+1 < text.size() && text[n+1] == '/'){
-				setFormat(++n,1,commentFormat);
+				mark(++n,1,commentFormat);
 				state = NORMAL;
 			}
 		}
 	}
-	setCurrentBlockState((int) state);
+	setCurrentBlockState(encode_state(state, deferred));
 
 	// Highlight an error. Do it last to 'overwrite' other formatting.
-	if (errorState) {
+	if (errorState && !deferred) {
 		setFormat( errorPos - block_first_pos, 1, errorFormat);
 	}
 
 }
-
@@ -6,6 +6,15 @@
 #include <QTextEdit>
 #include <QHash>
 
+/*!
+	Highlights the legacy editor's document.
+
+	In large documents, only blocks near the visible part of the view are
+	formatted while editing. Blocks further away only get their quote and
+	comment state, which the following blocks depend on, and are formatted
+	later while the editor is idle, the visible ones first. So pasting or
+	changing the start of a huge generated file doesn't freeze the editor.
+*/
 class Highlighter : public QSyntaxHighlighter
 {
 	Q_OBJECT
@@ -19,7 +28,21 @@ public:
 	void portable_rehighlightBlock( const QTextBlock &text );
 	void highlightError(int error_pos);
 	void unhighlightLastError();
+	void setView(QTextEdit *view);
+
+private slots:
+	void scheduleDeferred();
+	void highlightDeferred();
+
 private:
+	bool isDeferrable(const QTextBlock &block) const;
+	void updateVisibleRange();
+
+	QTextEdit *view;
+	class QTimer *deferTimer;
+	int visibleFirst, visibleLast; // Block numbers shown in the view
+	QTextBlock forcedBlock; // Formatted even if deferrable
+	bool enabled; // Unless syntax highlighting is off
 	QTextBlock lastErrorBlock;
 	int errorPos;
 	bool errorState;
@@ -5,15 +5,55 @@
 #include <vector>
 #include <iterator>
 #include <algorithm>
+#include <zlib.h>
+
+/*!
+	Compresses the filtered image data with zlib at the level pointed to by
+	the custom context, which is several times faster than lodepng's own
+	deflate at similar sizes.
+*/
+static unsigned zlib_compress(unsigned char **out, size_t *outsize, const unsigned char *in, size_t insize,
+															const LodePNGCompressSettings *settings)
+{
+	const int level = *static_cast<const int *>(settings->custom_context);
+	uLongf size = compressBound(uLong(insize));
+	// Freed by lodepng with free()
+	unsigned char *data = static_cast<unsigned char *>(malloc(size));
+	if (!data) return 83;
+	if (compress2(data, &size, in, uLong(insize), level) != Z_OK) {
+		free(data);
+		return 111;
+	}
+	*out = data;
+	*outsize = size;
+	return 0;
+}
 
 bool write_png(std::ostream &output, unsigned char *pixels, int width, int height)
 {
+	const PngOptions &options = PngOptions::defaults();
 	std::vector<unsigned char> dataout;
 	lodepng::State state;
 	state.encoder.auto_convert = LAC_NO;
 	// some png renderers have different interpretations of alpha, so don't use it
 	state.info_png.color.colortype = LCT_RGB;
 	state.info_png.color.bitdepth = 8;
+	int level = std::min(std::max(options.level, 0), 9);
+	state.encoder.zlibsettings.custom_zlib = zlib_compress;
+	state.encoder.zlibsettings.custom_context = &level;
+	std::vector<unsigned char> filters;
+	if (options.filter == PngOptions::FILTER_ADAPTIVE) {
+		state.encoder.filter_strategy = LFS_MINSUM;
+	}
+	else if (options.filter == PngOptions::FILTER_NONE) {
+		state.encoder.filter_strategy = LFS_ZERO;
+	}
+	else {
+		filters.assign(std::max(height, 1), (unsigned char)options.filter);
+		state.encoder.filter_strategy = LFS_PREDEFINED;
+		state.encoder.filter_palette_zero = 0;
+		state.encoder.predefined_filters = &filters[0];
+	}
 	unsigned err = lodepng::encode(dataout, pixels, width, height, state);
 	if ( err ) return false;
 	output.write( reinterpret_cast<const char *>(&dataout[0]), dataout.size());
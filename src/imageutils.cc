@@ -3,6 +3,24 @@
 #include <string.h>
 #include <fstream>
 
+PngOptions &PngOptions::defaults()
+{
+	static PngOptions options;
+	return options;
+}
+
+bool PngOptions::parseFilter(const std::string &name, Filter &filter)
+{
+	static const char *names[] = { "none", "sub", "up", "average", "paeth", "adaptive" };
+	for (int i = 0; i <= FILTER_ADAPTIVE; i++) {
+		if (name == names[i]) {
+			filter = Filter(i);
+			return true;
+		}
+	}
+	return false;
+}
+
 void flip_image(const unsigned char *src, unsigned char *dst, size_t pixelsize, size_t width, size_t height)
 {
   assert( src && dst );
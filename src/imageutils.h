@@ -2,6 +2,25 @@
 
 #include <stdlib.h>
 #include <iostream>
+#include <string>
+
+/*!
+	How PNG exports are compressed, set with --png-compression and
+	--png-filter. Level 0 stores the image data, 1 is the fastest and 9
+	the smallest. The filter is applied to each row before compression:
+	ADAPTIVE picks one per row, the others use the same for all rows, and
+	NONE is the fastest. The macOS image writer ignores these.
+*/
+struct PngOptions {
+	enum Filter { FILTER_NONE, FILTER_SUB, FILTER_UP, FILTER_AVERAGE, FILTER_PAETH, FILTER_ADAPTIVE };
+
+	PngOptions() : level(6), filter(FILTER_ADAPTIVE) {}
+	int level;
+	Filter filter;
+
+	static PngOptions &defaults();
+	static bool parseFilter(const std::string &name, Filter &filter);
+};
 
 bool write_png(const char *filename, unsigned char *pixels, int width, int height);
 bool write_png(std::ostream &output, unsigned char *pixels, int width, int height);
@@ -36,18 +36,17 @@
 #include "printutils.h"
 #include "fileutils.h"
 #include "handle_dep.h" // handle_dep()
-
-#ifdef ENABLE_CGAL
-#include "cgalutils.h"
-#endif
+#include "NumberFormat.h"
+#include "GeometrySerializer.h"
+#include "Reindexer.h"
+#include "polyset-utils.h"
 
 #include <sys/types.h>
 #include <fstream>
 #include <sstream>
 #include <assert.h>
+#include <cmath>
 #include <boost/algorithm/string.hpp>
-#include <boost/regex.hpp>
-#include <boost/lexical_cast.hpp>
 #include <boost/filesystem.hpp>
 namespace fs = boost::filesystem;
 #include <boost/assign/std/vector.hpp>
@@ -56,11 +55,15 @@ using namespace boost::assign; // bring 'operator+=()' into scope
 #include <boost/detail/endian.hpp>
 #include <cstdint>
 
+double ImportNode::defaultsimplifyerror = 0;
+size_t ImportNode::defaultsimplifyfaces = 100000;
+
 class ImportModule : public AbstractModule
 {
 public:
 	import_type_e type;
 	ImportModule(import_type_e type = TYPE_UNKNOWN) : type(type) { }
+	virtual bool is_leaf() const { return true; }
 	virtual AbstractNode *instantiate(const Context *ctx, const ModuleInstantiation *inst, EvalContext *evalctx) const;
 };
 
@@ -106,6 +109,7 @@ AbstractNode *ImportModule::instantiate(const Context *ctx, const ModuleInstanti
 		if (ext == ".stl") actualtype = TYPE_STL;
 		else if (ext == ".off") actualtype = TYPE_OFF;
 		else if (ext == ".dxf") actualtype = TYPE_DXF;
+		else if (ext == ".scadgeom") actualtype = TYPE_SCADGEOM;
 	}
 
 	ImportNode *node = new ImportNode(inst, actualtype);
@@ -115,6 +119,8 @@ AbstractNode *ImportModule::instantiate(const Context *ctx, const ModuleInstanti
 	node->fa = c.lookup_variable("$fa")->toDouble();
 
 	node->filename = filename;
+	// Recorded here too, so the dependencies are known without evaluating geometry
+	if (!filename.empty()) handle_dep(filename);
 	Value layerval = *c.lookup_variable("layer", true);
 	if (layerval.isUndefined()) {
 		layerval = *c.lookup_variable("layername");
@@ -132,6 +138,8 @@ AbstractNode *ImportModule::instantiate(const Context *ctx, const ModuleInstanti
 	origin->getVec2(node->origin_x, node->origin_y);
 
 	node->scale = c.lookup_variable("scale", true)->toDouble();
+	node->simplifyerror = ImportNode::defaultsimplifyerror;
+	node->simplifyfaces = ImportNode::defaultsimplifyfaces;
 
 	if (node->scale <= 0) node->scale = 1;
 
@@ -139,22 +147,12 @@ AbstractNode *ImportModule::instantiate(const Context *ctx, const ModuleInstanti
 }
 
 #define STL_FACET_NUMBYTES 4*3*4+2
-// as there is no 'float32_t' standard, we assume the systems 'float'
-// is a 'binary32' aka 'single' standard IEEE 32-bit floating point type
-union stl_facet {
-	uint8_t data8[ STL_FACET_NUMBYTES ];
-	uint32_t data32[4*3];
-	struct facet_data {
-	  float i, j, k;
-	  float x1, y1, z1;
-	  float x2, y2, z2;
-	  float x3, y3, z3;
-	  uint16_t attribute_byte_count;
-	} data;
-};
 
-void uint32_byte_swap( uint32_t &x )
+static uint32_t read_uint32(const char *data)
 {
+	uint32_t x;
+	memcpy(&x, data, sizeof(x));
+#ifdef BOOST_BIG_ENDIAN
 #if __GNUC__ >= 4 && __GNUC_MINOR__ >= 3
 	x = __builtin_bswap32( x );
 #elif defined(__clang__)
@@ -168,17 +166,231 @@ void uint32_byte_swap( uint32_t &x )
 	uint32_t b4 = ( 0xFF000000 & x ) >> 24;
 	x = b1 | b2 | b3 | b4;
 #endif
+#endif
+	return x;
 }
 
-void read_stl_facet( std::ifstream &f, stl_facet &facet )
+// as there is no 'float32_t' standard, we assume the systems 'float'
+// is a 'binary32' aka 'single' standard IEEE 32-bit floating point type
+static float read_float(const char *data)
 {
-	f.read( (char*)facet.data8, STL_FACET_NUMBYTES );
-#ifdef BOOST_BIG_ENDIAN
-	for ( int i = 0; i < 12; i++ ) {
-		uint32_byte_swap( facet.data32[ i ] );
+	const uint32_t bits = read_uint32(data);
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+/*!
+	Adds the triangles of an STL file to the empty PolySet \a p, taking
+	three vertices per triangle from \a vertices. Shared vertices are
+	merged in one pass before building the PolySet.
+*/
+static void append_stl_triangles(const std::vector<Vector3d> &vertices, PolySet &p)
+{
+	Reindexer<Vector3d> unique;
+	std::vector<int> indices(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++) indices[i] = unique.lookup(vertices[i]);
+	const Vector3d *array = unique.getArray();
+	for (size_t i = 0; i < unique.size(); i++) p.append_unique_vertex(array[i]);
+	for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+		p.append_poly();
+		for (int j = 0; j < 3; j++) p.append_index(indices[i + j]);
 	}
-	// we ignore attribute byte count
-#endif
+}
+
+/*!
+	Reads binary STL from \a data, which holds \a count facets after the
+	84 byte header.
+*/
+static void import_stl_binary(const std::string &data, uint32_t count, PolySet &p)
+{
+	std::vector<Vector3d> vertices;
+	vertices.reserve(3 * size_t(count));
+	const char *facet = data.data() + 84;
+	for (uint32_t n = 0; n < count; n++, facet += STL_FACET_NUMBYTES) {
+		// Skip the normal, and ignore the attribute byte count at the end
+		for (int i = 0; i < 3; i++) {
+			const char *v = facet + 12 + 12 * i;
+			vertices.push_back(Vector3d(read_float(v), read_float(v + 4), read_float(v + 8)));
+		}
+	}
+	append_stl_triangles(vertices, p);
+}
+
+static bool is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v';
+}
+
+/*!
+	Reads ASCII STL from \a data. Only the vertex lines matter, three of
+	them after each "outer loop" line make a triangle.
+*/
+static void import_stl_ascii(const std::string &data, PolySet &p)
+{
+	const char *pos = data.data();
+	const char *const end = pos + data.size();
+	// The first line is the "solid" line
+	pos = static_cast<const char *>(memchr(pos, '\n', end - pos));
+	if (!pos) return;
+
+	std::vector<Vector3d> vertices;
+	int i = 0;
+	double vdata[3][3];
+	while (pos < end) {
+		const char *eol = static_cast<const char *>(memchr(pos, '\n', end - pos));
+		if (!eol) eol = end;
+		const char *line = pos;
+		pos = eol + 1;
+
+		while (line < eol && is_space(*line)) line++;
+		const char *word = line;
+		while (line < eol && !is_space(*line)) line++;
+		const size_t len = line - word;
+		if (len == 5 && !memcmp(word, "outer", 5)) {
+			i = 0;
+			continue;
+		}
+		if (len != 6 || memcmp(word, "vertex", 6)) continue;
+
+		bool ok = i < 3;
+		for (int v = 0; v < 3 && ok; v++) {
+			while (line < eol && is_space(*line)) line++;
+			const char *number = line;
+			while (line < eol && !is_space(*line)) line++;
+			ok = line > number && parse_number(number, line, vdata[i][v]);
+		}
+		if (!ok) {
+			if (i < 3) {
+				const char *last = eol;
+				while (last > word && is_space(last[-1])) last--;
+				PRINTB("WARNING: Can't parse vertex line '%s'.", std::string(word, last));
+			}
+			i = 10;
+			continue;
+		}
+		if (++i == 3) {
+			for (int v = 0; v < 3; v++) vertices.push_back(Vector3d(vdata[v][0], vdata[v][1], vdata[v][2]));
+		}
+	}
+	append_stl_triangles(vertices, p);
+}
+
+/*!
+	Reads the words of an OFF file, skipping comments.
+*/
+class OffScanner
+{
+public:
+	OffScanner(const std::string &data) : pos(data.data()), end(data.data() + data.size()) {}
+
+	// Returns false at the end of the data
+	bool word(const char *&begin, const char *&last) {
+		while (pos < end) {
+			if (*pos == '#') {
+				while (pos < end && *pos != '\n') pos++;
+			}
+			else if (is_space(*pos)) pos++;
+			else break;
+		}
+		if (pos == end) return false;
+		begin = pos;
+		while (pos < end && !is_space(*pos) && *pos != '#') pos++;
+		last = pos;
+		return true;
+	}
+
+	bool number(double &x) {
+		const char *begin, *last;
+		return word(begin, last) && parse_number(begin, last, x);
+	}
+
+	bool integer(long &n) {
+		double x;
+		if (!number(x) || x != std::floor(x)) return false;
+		n = long(x);
+		return true;
+	}
+
+	// Skips extra values like colors, which end at the line end
+	void skipLine() {
+		while (pos < end && *pos != '\n') pos++;
+	}
+
+private:
+	const char *pos;
+	const char *end;
+};
+
+/*!
+	Reads an ASCII OFF file: The OFF keyword, optionally prefixed with
+	flags like C (colors) or N (normals), the numbers of vertices, faces
+	and edges, then the vertices and the faces as a vertex count followed
+	by indices. Values after a vertex or face, e.g. colors, are ignored.
+*/
+static bool import_off(const std::string &data, const std::string &filename, PolySet &p)
+{
+	OffScanner scanner(data);
+	const char *begin, *last;
+	if (!scanner.word(begin, last)) return false;
+	const std::string keyword(begin, last);
+	if (keyword.size() < 3 || keyword.compare(keyword.size() - 3, 3, "OFF")) {
+		PRINTB("WARNING: '%s' is not an OFF file.", filename);
+		return false;
+	}
+	if (keyword.find('4') != std::string::npos || keyword.find('n') != std::string::npos) {
+		PRINTB("WARNING: Unsupported OFF variant '%s' in '%s'.", keyword % filename);
+		return false;
+	}
+	// Normals and texture coordinates are on the vertex lines, and skipped
+
+	long numvertices, numfaces, numedges;
+	if (!scanner.integer(numvertices) || !scanner.integer(numfaces) || !scanner.integer(numedges) ||
+			numvertices < 0 || numfaces < 0) {
+		PRINTB("WARNING: Can't read the OFF header of '%s'.", filename);
+		return false;
+	}
+
+	std::vector<Vector3d> vertices;
+	vertices.reserve(numvertices);
+	for (long i = 0; i < numvertices; i++) {
+		Vector3d v;
+		if (!scanner.number(v[0]) || !scanner.number(v[1]) || !scanner.number(v[2])) {
+			PRINTB("WARNING: Can't read vertex %d of '%s'.", i % filename);
+			return false;
+		}
+		scanner.skipLine();
+		vertices.push_back(v);
+	}
+
+	std::vector<IndexedFace> faces;
+	faces.reserve(numfaces);
+	for (long i = 0; i < numfaces; i++) {
+		long n;
+		if (!scanner.integer(n) || n < 0) {
+			PRINTB("WARNING: Can't read face %d of '%s'.", i % filename);
+			return false;
+		}
+		IndexedFace face;
+		face.reserve(n);
+		for (long j = 0; j < n; j++) {
+			long index;
+			if (!scanner.integer(index)) {
+				PRINTB("WARNING: Can't read face %d of '%s'.", i % filename);
+				return false;
+			}
+			if (index < 0 || index >= numvertices) {
+				PRINTB("WARNING: Face %d of '%s' refers to vertex %d, which doesn't exist.", i % filename % index);
+				face.clear();
+				break;
+			}
+			face.push_back(int(index));
+		}
+		scanner.skipLine();
+		if (face.size() >= 3) faces.push_back(face);
+	}
+	p.append(vertices, faces);
+	return true;
 }
 
 /*!
@@ -194,103 +406,36 @@ const Geometry *ImportNode::createGeometry() const
 		g = p;
 
 		handle_dep((std::string)this->filename);
-		// Open file and position at the end
-		std::ifstream f(this->filename.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
-		if (!f.good()) {
+		// Read the whole file at once, both formats are parsed from memory
+		std::string data;
+		if (!read_file(this->filename, data)) {
 			PRINTB("WARNING: Can't open import file '%s'.", this->filename);
 			return g;
 		}
 
-		boost::regex ex_sfe("solid|facet|endloop");
-		boost::regex ex_outer("outer loop");
-		boost::regex ex_vertex("vertex");
-		boost::regex ex_vertices("\\s*vertex\\s+([^\\s]+)\\s+([^\\s]+)\\s+([^\\s]+)");
-
-		bool binary = false;
-		std::streampos file_size = f.tellg();
-		f.seekg(80);
-		if (f.good() && !f.eof()) {
-			uint32_t facenum = 0;
-			f.read((char *)&facenum, sizeof(uint32_t));
-#ifdef BOOST_BIG_ENDIAN
-			uint32_byte_swap( facenum );
-#endif
-			if (file_size ==  static_cast<std::streamoff>(80 + 4 + 50*facenum)) {
-				binary = true;
+		if (data.size() >= 84) {
+			const uint32_t facenum = read_uint32(data.data() + 80);
+			if (data.size() == 84 + uint64_t(STL_FACET_NUMBYTES) * facenum) {
+				import_stl_binary(data, facenum, *p);
+				break;
 			}
 		}
-		f.seekg(0);
-
-		char data[5];
-		f.read(data, 5);
-		if (!binary && !f.eof() && f.good() && !memcmp(data, "solid", 5)) {
-			int i = 0;
-			double vdata[3][3];
-			std::string line;
-			std::getline(f, line);
-			while (!f.eof()) {
-				std::getline(f, line);
-				boost::trim(line);
-				if (boost::regex_search(line, ex_sfe)) {
-					continue;
-				}
-				if (boost::regex_search(line, ex_outer)) {
-					i = 0;
-					continue;
-				}
-				boost::smatch results;
-				if (boost::regex_search(line, results, ex_vertices)) {
-					try {
-						for (int v=0;v<3;v++) {
-							vdata[i][v] = boost::lexical_cast<double>(results[v+1]);
-						}
-					}
-					catch (const boost::bad_lexical_cast &blc) {
-						PRINTB("WARNING: Can't parse vertex line '%s'.", line);
-						i = 10;
-						continue;
-					}
-					if (++i == 3) {
-						p->append_poly();
-						p->append_vertex(vdata[0][0], vdata[0][1], vdata[0][2]);
-						p->append_vertex(vdata[1][0], vdata[1][1], vdata[1][2]);
-						p->append_vertex(vdata[2][0], vdata[2][1], vdata[2][2]);
-					}
-				}
-			}
-		}
-		else if (binary && !f.eof() && f.good())
-		{
-			f.ignore(80-5+4);
-			while (1) {
-				stl_facet facet;
-				read_stl_facet( f, facet );
-				if (f.eof()) break;
-				p->append_poly();
-				p->append_vertex(facet.data.x1, facet.data.y1, facet.data.z1);
-				p->append_vertex(facet.data.x2, facet.data.y2, facet.data.z2);
-				p->append_vertex(facet.data.x3, facet.data.y3, facet.data.z3);
-			}
+		if (data.size() > 5 && !memcmp(data.data(), "solid", 5)) {
+			import_stl_ascii(data, *p);
 		}
 	}
 		break;
 	case TYPE_OFF: {
 		PolySet *p = new PolySet(3);
 		g = p;
-#ifdef ENABLE_CGAL
-		CGAL_Polyhedron poly;
-		std::ifstream file(this->filename.c_str(), std::ios::in | std::ios::binary);
-		if (!file.good()) {
+		handle_dep((std::string)this->filename);
+		std::string data;
+		if (!read_file(this->filename, data)) {
 			PRINTB("WARNING: Can't open import file '%s'.", this->filename);
 		}
 		else {
-			file >> poly;
-			file.close();
-			bool err = CGALUtils::createPolySetFromPolyhedron(poly, *p);
+			import_off(data, this->filename, *p);
 		}
-#else
-  PRINT("WARNING: OFF import requires CGAL.");
-#endif
 	}
 		break;
 	case TYPE_DXF: {
@@ -298,11 +443,31 @@ const Geometry *ImportNode::createGeometry() const
 		g = dd.toPolygon2d();
 	}
 		break;
+	case TYPE_SCADGEOM: {
+		handle_dep((std::string)this->filename);
+		std::string data;
+		if (!read_file(this->filename, data)) {
+			PRINTB("WARNING: Can't open import file '%s'.", this->filename);
+		}
+		else if (!GeometrySerializer::read(data.data(), data.size(), g)) {
+			PRINTB("WARNING: '%s' is not a valid .scadgeom file.", this->filename);
+		}
+		if (!g) g = new PolySet(3);
+	}
+		break;
 	default:
 		PRINTB("ERROR: Unsupported file format while trying to import file '%s'", this->filename);
 		g = new PolySet(0);
 	}
 
+	// Dense meshes are simplified before any operation uses them
+	const PolySet *ps = dynamic_cast<const PolySet *>(g);
+	if (ps && this->simplifyerror > 0 && ps->getDimension() == 3 && ps->numPolygons() > this->simplifyfaces) {
+		g = PolysetUtils::simplify(*ps, this->simplifyerror);
+		PRINTB("Simplified '%s' from %d to %d faces", this->filename % ps->numPolygons() % static_cast<PolySet *>(g)->numPolygons());
+		delete ps;
+	}
+
 	if (g) g->setConvexity(this->convexity);
 	return g;
 }
@@ -319,8 +484,11 @@ std::string ImportNode::toString() const
 		"scale = " << this->scale << ", "
 		"convexity = " << this->convexity << ", "
 		"$fn = " << this->fn << ", $fa = " << this->fa << ", $fs = " << this->fs
-				 << ", " "timestamp = " << (fs::exists(path) ? fs::last_write_time(path) : 0)
-				 << ")";
+				 << ", " "timestamp = " << (fs::exists(path) ? fs::last_write_time(path) : 0);
+	if (this->simplifyerror > 0) {
+		stream << ", simplify = " << this->simplifyerror << ", simplifyfaces = " << this->simplifyfaces;
+	}
+	stream << ")";
 
 
 	return stream.str();
@@ -7,14 +7,15 @@ enum import_type_e {
 	TYPE_UNKNOWN,
 	TYPE_STL,
 	TYPE_OFF,
-	TYPE_DXF
+	TYPE_DXF,
+	TYPE_SCADGEOM
 };
 
 class ImportNode : public LeafNode
 {
 public:
 	VISITABLE();
-	ImportNode(const ModuleInstantiation *mi, import_type_e type) : LeafNode(mi), type(type) { }
+	ImportNode(const ModuleInstantiation *mi, import_type_e type) : LeafNode(mi), type(type), simplifyerror(0), simplifyfaces(0) { }
 	virtual std::string toString() const;
 	virtual std::string name() const;
 
@@ -24,5 +25,12 @@ public:
 	int convexity;
 	double fn, fs, fa;
 	double origin_x, origin_y, scale;
+	// Meshes of more than simplifyfaces triangles are simplified to this error, if it's set
+	double simplifyerror;
+	size_t simplifyfaces;
 	virtual const class Geometry *createGeometry() const;
+
+	// What's set for new nodes, e.g. by --simplify-imports
+	static double defaultsimplifyerror;
+	static size_t defaultsimplifyfaces;
 };
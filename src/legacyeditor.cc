@@ -16,6 +16,7 @@ LegacyEditor::LegacyEditor(QWidget *parent) : EditorInterface(parent)
 	this->textedit->setTabStopWidth(30);
 
 	this->highlighter = new Highlighter(this->textedit->document());
+	this->highlighter->setView(this->textedit);
 
 	connect(this->textedit, SIGNAL(textChanged()), this, SIGNAL(contentsChanged()));
 	connect(this->textedit->document(), SIGNAL(modificationChanged(bool)), this, SIGNAL(modificationChanged(bool)));
@@ -152,7 +153,7 @@ void LegacyEditor::unhighlightLastError()
 void LegacyEditor::setHighlightScheme(const QString &name)
 {
 	highlighter->assignFormatsToTokens(name);
-	highlighter->rehighlight(); // slow on large files
+	highlighter->rehighlight(); // Only formats the visible part of large files right away
 }
 
 QSize LegacyEditor::sizeHint() const
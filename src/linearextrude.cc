@@ -31,9 +31,11 @@
 #include "evalcontext.h"
 #include "printutils.h"
 #include "fileutils.h"
+#include "handle_dep.h"
 #include "builtin.h"
 #include "calc.h"
 #include "polyset.h"
+#include "feature.h"
 
 #include <cmath>
 #include <sstream>
@@ -78,6 +80,7 @@ AbstractNode *LinearExtrudeModule::instantiate(const Context *ctx, const ModuleI
 	if (!file->isUndefined() && file->type() == Value::STRING) {
 		printDeprecation("Support for reading files in linear_extrude will be removed in future releases. Use a child import() instead.");
 		node->filename = lookup_file(file->toString(), inst->path(), c.documentPath());
+		handle_dep(node->filename);
 	}
 
 	// if height not given, and first argument is a number,
@@ -118,7 +121,8 @@ AbstractNode *LinearExtrudeModule::instantiate(const Context *ctx, const ModuleI
 	twist->getFiniteDouble(node->twist);
 	if (node->twist != 0.0) {
 		if (node->slices == 0) {
-			node->slices = (int)fmax(2, fabs(Calc::get_fragments_from_r(node->height, node->fn, node->fs, node->fa) * node->twist / 360));
+			if (Feature::ExperimentalAdaptiveExtrude.is_enabled()) node->auto_slices = true;
+			else node->slices = (int)fmax(2, fabs(Calc::get_fragments_from_r(node->height, node->fn, node->fs, node->fa) * node->twist / 360));
 		}
 		node->has_twist = true;
 	}
@@ -157,6 +161,9 @@ std::string LinearExtrudeNode::toString() const
 	if (this->slices > 1) {
 		stream << ", slices = " << this->slices;
 	}
+	else if (this->auto_slices) {
+		stream << ", slices = 0";
+	}
 	stream << ", scale = [" << this->scale_x << ", " << this->scale_y << "]";
 	stream << ", $fn = " << this->fn << ", $fa = " << this->fa << ", $fs = " << this->fs << ")";
 	
@@ -12,7 +12,7 @@ public:
 		fn = fs = fa = height = twist = 0;
 		origin_x = origin_y = 0;
 		scale_x = scale_y = 1;
-		center = has_twist = false;
+		center = has_twist = auto_slices = false;
 	}
 	virtual std::string toString() const;
 	virtual std::string name() const { return "linear_extrude"; }
@@ -21,6 +21,8 @@ public:
 	double fn, fs, fa, height, twist;
 	double origin_x, origin_y, scale_x, scale_y;
 	bool center, has_twist;
+	// Slices are chosen from the outline size when evaluating
+	bool auto_slices;
 	Filename filename;
 	std::string layername;
 };
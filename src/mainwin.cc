@@ -26,7 +26,12 @@
 #include <iostream>
 #include "openscad.h"
 #include "GeometryCache.h"
+#include "ImportCache.h"
+#include "PreviewCache.h"
+#include "FunctionCache.h"
+#include "TableIndex.h"
 #include "ModuleCache.h"
+#include "FileWatcher.h"
 #include "MainWindow.h"
 #include "OpenSCADApp.h"
 #include "parsersettings.h"
@@ -87,6 +92,7 @@
 #include <QSettings>
 #include <QProgressDialog>
 #include <QMutexLocker>
+#include <QThread>
 #include <QTemporaryFile>
 #include <QDockWidget>
 #include <QClipboard>
@@ -110,21 +116,27 @@
 
 #ifdef ENABLE_CGAL
 
-#include "CGALCache.h"
 #include "GeometryEvaluator.h"
 #include "CGALRenderer.h"
 #include "CGAL_Nef_polyhedron.h"
 #include "cgal.h"
 #include "cgalworker.h"
+#include "exportworker.h"
 #include "cgalutils.h"
+#include "MeshValidator.h"
 
 #endif // ENABLE_CGAL
+#include "csgworker.h"
+#include "FramePrefetcher.h"
 
 #include "FontCache.h"
 
 // Global application state
 unsigned int GuiLocker::gui_locked = 0;
 
+// Memory the frames prefetched while playing an animation may take
+static const size_t ANIMATION_PREFETCH_BUDGET = 256 * 1024 * 1024;
+
 static char copyrighttext[] =
 	"Copyright (C) 2009-2015 The OpenSCAD Developers\n"
 	"\n"
@@ -180,6 +192,8 @@ MainWindow::MainWindow(const QString &filename)
 	this->editorDock->setAction(this->viewActionHideEditor);
 	this->consoleDock->setConfigKey("view/hideConsole");
 	this->consoleDock->setAction(this->viewActionHideConsole);
+	this->cacheDock->setConfigKey("view/hideCachePanel");
+	this->cacheDock->setAction(this->viewActionHideCachePanel);
 
 	this->versionLabel = NULL; // must be initialized before calling updateStatusBar()
 	updateStatusBar(NULL);
@@ -219,9 +233,22 @@ MainWindow::MainWindow(const QString &filename)
 
 #ifdef ENABLE_CGAL
 	this->cgalworker = new CGALWorker();
+	connect(this->cgalworker, SIGNAL(partial(shared_ptr<const Geometry>)),
+					this, SLOT(actionRenderPartial(shared_ptr<const Geometry>)));
 	connect(this->cgalworker, SIGNAL(done(shared_ptr<const Geometry>)), 
 					this, SLOT(actionRenderDone(shared_ptr<const Geometry>)));
+	this->restartrender = false;
+	this->exportworker = new ExportWorker();
+	connect(this->exportworker, SIGNAL(done(bool)), this, SLOT(actionExportDone(bool)));
+	this->exporttype = NULL;
 #endif
+	this->csgworker = new CSGWorker();
+	connect(this->csgworker, SIGNAL(partial()), this, SLOT(actionRenderPreviewPartial()));
+	connect(this->csgworker, SIGNAL(done()), this, SLOT(actionRenderPreviewDone()));
+	this->restartpreview = false;
+	this->livepreviewing = false;
+	this->prefetcher = new FramePrefetcher(ANIMATION_PREFETCH_BUDGET);
+	this->dumpframe = false;
 
 	top_ctx.registerBuiltin();
 
@@ -242,6 +269,7 @@ MainWindow::MainWindow(const QString &filename)
 	this->anim_tval = 0.0;
 	this->anim_dumping = false;
 	this->anim_dump_start_step = 0;
+	this->anim_prefetchstep = 0;
 
 	const QString importStatement = "import(\"%1\");\n";
 	const QString surfaceStatement = "surface(\"%1\");\n";
@@ -275,6 +303,11 @@ MainWindow::MainWindow(const QString &filename)
 	waitAfterReloadTimer->setInterval(200);
 	connect(waitAfterReloadTimer, SIGNAL(timeout()), this, SLOT(waitAfterReload()));
 
+	livePreviewTimer = new QTimer(this);
+	livePreviewTimer->setSingleShot(true);
+	livePreviewTimer->setInterval(500);
+	connect(livePreviewTimer, SIGNAL(timeout()), this, SLOT(livePreview()));
+
 	connect(this->e_tval, SIGNAL(textChanged(QString)), this, SLOT(updatedAnimTval()));
 	connect(this->e_fps, SIGNAL(textChanged(QString)), this, SLOT(updatedAnimFps()));
 	connect(this->e_fsteps, SIGNAL(textChanged(QString)), this, SLOT(updatedAnimSteps()));
@@ -347,6 +380,7 @@ MainWindow::MainWindow(const QString &filename)
 
 	// Design menu
 	connect(this->designActionAutoReload, SIGNAL(toggled(bool)), this, SLOT(autoReloadSet(bool)));
+	connect(this->designActionLivePreview, SIGNAL(toggled(bool)), this, SLOT(livePreviewSet(bool)));
 	connect(this->designActionReloadAndPreview, SIGNAL(triggered()), this, SLOT(actionReloadRenderPreview()));
 	connect(this->designActionPreview, SIGNAL(triggered()), this, SLOT(actionRenderPreview()));
 #ifdef ENABLE_CGAL
@@ -361,6 +395,7 @@ MainWindow::MainWindow(const QString &filename)
 	connect(this->fileActionExportSTL, SIGNAL(triggered()), this, SLOT(actionExportSTL()));
 	connect(this->fileActionExportOFF, SIGNAL(triggered()), this, SLOT(actionExportOFF()));
 	connect(this->fileActionExportAMF, SIGNAL(triggered()), this, SLOT(actionExportAMF()));
+	connect(this->fileActionExport3MF, SIGNAL(triggered()), this, SLOT(actionExport3MF()));
 	connect(this->fileActionExportDXF, SIGNAL(triggered()), this, SLOT(actionExportDXF()));
 	connect(this->fileActionExportSVG, SIGNAL(triggered()), this, SLOT(actionExportSVG()));
 	connect(this->fileActionExportCSG, SIGNAL(triggered()), this, SLOT(actionExportCSG()));
@@ -389,6 +424,7 @@ MainWindow::MainWindow(const QString &filename)
 	connect(this->viewActionShowAxes, SIGNAL(triggered()), this, SLOT(viewModeShowAxes()));
 	connect(this->viewActionShowCrosshairs, SIGNAL(triggered()), this, SLOT(viewModeShowCrosshairs()));
 	connect(this->viewActionShowScaleProportional, SIGNAL(triggered()), this, SLOT(viewModeShowScaleProportional()));
+	connect(this->viewActionShowFrameTime, SIGNAL(triggered()), this, SLOT(viewModeShowFrameTime()));
 	connect(this->viewActionAnimate, SIGNAL(triggered()), this, SLOT(viewModeAnimate()));
 	connect(this->viewActionTop, SIGNAL(triggered()), this, SLOT(viewAngleTop()));
 	connect(this->viewActionBottom, SIGNAL(triggered()), this, SLOT(viewAngleBottom()));
@@ -407,6 +443,7 @@ MainWindow::MainWindow(const QString &filename)
 	connect(this->viewActionHideToolBars, SIGNAL(triggered()), this, SLOT(hideToolbars()));
 	connect(this->viewActionHideEditor, SIGNAL(triggered()), this, SLOT(hideEditor()));
 	connect(this->viewActionHideConsole, SIGNAL(triggered()), this, SLOT(hideConsole()));
+	connect(this->viewActionHideCachePanel, SIGNAL(triggered()), this, SLOT(hideCachePanel()));
 
 	// Help menu
 	connect(this->helpActionAbout, SIGNAL(triggered()), this, SLOT(helpAbout()));
@@ -619,6 +656,10 @@ void MainWindow::loadViewSettings(){
         viewActionShowScaleProportional->setChecked(true);
         viewModeShowScaleProportional();
     }
+	if (settings.value("view/showFrameTime").toBool()) {
+		viewActionShowFrameTime->setChecked(true);
+		viewModeShowFrameTime();
+	}
 	if (settings.value("view/orthogonalProjection").toBool()) {
 		viewOrthogonal();
 	} else {
@@ -628,6 +669,8 @@ void MainWindow::loadViewSettings(){
 	hideConsole();
 	viewActionHideEditor->setChecked(settings.value("view/hideEditor").toBool());
 	hideEditor();
+	viewActionHideCachePanel->setChecked(settings.value("view/hideCachePanel", true).toBool());
+	hideCachePanel();
 	viewActionHideToolBars->setChecked(settings.value("view/hideToolbar").toBool());
 	hideToolbars();
 	updateMdiMode(settings.value("advanced/mdi").toBool());
@@ -641,12 +684,9 @@ void MainWindow::loadDesignSettings()
 	if (settings.value("design/autoReload", true).toBool()) {
 		designActionAutoReload->setChecked(true);
 	}
+	designActionLivePreview->setChecked(settings.value("design/livePreview", false).toBool());
 	uint polySetCacheSize = Preferences::inst()->getValue("advanced/polysetCacheSize").toUInt();
 	GeometryCache::instance()->setMaxSize(polySetCacheSize);
-#ifdef ENABLE_CGAL
-	uint cgalCacheSize = Preferences::inst()->getValue("advanced/cgalCacheSize").toUInt();
-	CGALCache::instance()->setMaxSize(cgalCacheSize);
-#endif
 }
 
 void MainWindow::updateMdiMode(bool mdi)
@@ -681,6 +721,7 @@ void MainWindow::updateReorderMode(bool reorderMode)
 
 MainWindow::~MainWindow()
 {
+	delete this->prefetcher;
 	if (root_module) delete root_module;
 	if (root_node) delete root_node;
 #ifdef ENABLE_CGAL
@@ -707,13 +748,21 @@ void MainWindow::showProgress()
 void MainWindow::report_func(const class AbstractNode*, void *vp, int mark)
 {
 	MainWindow *thisp = static_cast<MainWindow*>(vp);
-	int v = (int)((mark*1000.0) / progress_report_count);
+	const ProgressStatus status = progress_status();
+	int v = (int)(status.fraction * 1000);
 	int permille = v < 1000 ? v : 999;
-	if (permille > thisp->progresswidget->value()) {
+	const int remaining = status.remaining < 0 ? -1 : (int)(status.remaining + 0.5);
+	const bool advanced = permille > thisp->progresswidget->value();
+	const bool reestimated = remaining != thisp->progresswidget->remainingTime();
+	if (advanced) {
 		QMetaObject::invokeMethod(thisp->progresswidget, "setValue", Qt::QueuedConnection,
 															Q_ARG(int, permille));
-		QApplication::processEvents();
 	}
+	if (reestimated) {
+		QMetaObject::invokeMethod(thisp->progresswidget, "setRemainingTime", Qt::QueuedConnection,
+															Q_ARG(int, remaining));
+	}
+	if (advanced || reestimated) QApplication::processEvents();
 
 	// FIXME: Check if cancel was requested by e.g. Application quit
 	if (thisp->progresswidget->wasCanceled()) throw ProgressCancelException();
@@ -806,6 +855,7 @@ void MainWindow::updatedAnimTval()
 	else {
 		this->anim_tval = 0.0;
 	}
+	this->prefetcher->stop();
 	actionRenderPreview();
 }
 
@@ -814,6 +864,7 @@ void MainWindow::updatedAnimFps()
 	bool fps_ok;
 	double fps = this->e_fps->text().toDouble(&fps_ok);
 	animate_timer->stop();
+	this->prefetcher->stop();
 	if (fps_ok && fps > 0 && this->anim_numsteps > 0) {
 		this->anim_step = int(this->anim_tval * this->anim_numsteps) % this->anim_numsteps;
 		animate_timer->setSingleShot(false);
@@ -846,17 +897,82 @@ void MainWindow::updateTVal()
 {
 	if (this->anim_numsteps == 0) return;
 
-	if (this->anim_numsteps > 1) {
-		this->anim_step = (this->anim_step + 1) % this->anim_numsteps;
-		this->anim_tval = 1.0 * this->anim_step / this->anim_numsteps;
+	const int step = this->anim_numsteps > 1 ? (this->anim_step + 1) % this->anim_numsteps : 0;
+	// While playing, frames are evaluated ahead and shown once ready
+	if (!animate_timer->isSingleShot()) {
+		showPrefetchedFrame(step);
+		return;
 	}
-	else if (this->anim_numsteps > 0) {
-		this->anim_step = 0;
-		this->anim_tval = 0.0;
+
+	this->anim_step = step;
+	this->anim_tval = 1.0 * this->anim_step / this->anim_numsteps;
+	QString txt;
+	txt.sprintf("%.5f", this->anim_tval);
+	this->e_tval->setText(txt);
+}
+
+/*!
+	Shows the prefetched frame of \a step of the playing animation. Returns
+	false if it isn't ready yet, so playback waits for it rather than
+	skipping frames. Prefetching starts again from \a step if the document
+	changed.
+*/
+bool MainWindow::showPrefetchedFrame(int step)
+{
+	// Another job evaluates geometry, e.g. a render, which the frames wait for
+	if (GuiLocker::isLocked()) return false;
+
+	FramePrefetcher::Job job;
+	job.fulltext = std::string(editor->toPlainText().toUtf8().constData()) + "\n" + commandline_commands;
+	job.filename = this->fileName.isEmpty() ? "" : this->fileName.toLocal8Bit().constData();
+	job.documentpath = this->top_ctx.documentPath();
+	job.numsteps = this->anim_numsteps;
+	job.fragmentlimit = Preferences::inst()->getValue("advanced/previewFragmentLimit").toInt();
+	job.normalizelimit = 2 * Preferences::inst()->getValue("advanced/openCSGLimit").toUInt();
+	if (!this->prefetcher->isRunning() || job != this->prefetcher->currentJob() ||
+			step != this->anim_prefetchstep) {
+		updateTemporalVariables();
+		job.vpt = this->top_ctx.lookup_variable("$vpt");
+		job.vpr = this->top_ctx.lookup_variable("$vpr");
+		job.vpd = this->top_ctx.lookup_variable("$vpd");
+		this->prefetcher->start(job, step);
+		this->anim_prefetchstep = step;
+		return false;
 	}
+
+	FramePrefetcher::Frame frame;
+	if (!this->prefetcher->take(step, frame)) return false;
+	this->anim_prefetchstep = (step + 1) % this->anim_numsteps;
+
+	GuiLocker::lock();
+	setCurrentOutput();
+	flushConsole();
+	compileErrors = 0;
+	compileWarnings = 0;
+	console->clear();
+	for(const auto &msg : frame.messages) PRINT(msg);
+
+	this->anim_step = step;
+	this->anim_tval = 1.0 * this->anim_step / this->anim_numsteps;
 	QString txt;
 	txt.sprintf("%.5f", this->anim_tval);
+	// The frame is shown already, so it's not previewed again
+	this->e_tval->blockSignals(true);
 	this->e_tval->setText(txt);
+	this->e_tval->blockSignals(false);
+	this->last_compiled_doc = editor->toPlainText();
+
+	if (frame.compiled) updateCamera(frame.vpt, frame.vpr, frame.vpd);
+	updateCompileResult();
+	this->csgRoot = frame.result.root;
+	this->normalizedRoot = frame.result.normalized;
+	this->root_products = frame.result.root_products;
+	this->highlights_products = frame.result.highlights_products;
+	this->background_products = frame.result.background_products;
+	updatePreviewRenderers();
+	this->dumpframe = true;
+	showPreview();
+	return true;
 }
 
 void MainWindow::refreshDocument()
@@ -890,6 +1006,11 @@ void MainWindow::compile(bool reload, bool forcedone)
 	bool shouldcompiletoplevel = false;
 	bool didcompile = false;
 
+	// Nothing else may evaluate geometry meanwhile
+	this->prefetcher->stop();
+
+	// Messages of earlier actions don't count for this compilation
+	flushConsole();
 	compileErrors = 0;
 	compileWarnings = 0;
 
@@ -899,8 +1020,9 @@ void MainWindow::compile(bool reload, bool forcedone)
 	if (reload) {
 		// Refresh files if it has changed on disk
 		if (fileChangedOnDisk() && checkEditorModified()) {
-			shouldcompiletoplevel = true;
 			refreshDocument();
+			// Saving from the editor changes the file to what was compiled
+			shouldcompiletoplevel = editor->toPlainText() != last_compiled_doc || last_compiled_doc.isEmpty();
 		}
 		// If the file hasn't changed, we might still need to compile it
 		// if we haven't yet compiled the current text.
@@ -974,6 +1096,7 @@ void MainWindow::on_toolButtonCompileResultClose_clicked()
 
 void MainWindow::updateCompileResult()
 {
+	flushConsole();
 	if ((compileErrors == 0) && (compileWarnings == 0)) {
 		frameCompileResult->hide();
 		return;
@@ -1038,16 +1161,11 @@ void MainWindow::instantiateRoot()
 {
 	// Go on and instantiate root_node, then call the continuation slot
 
-  // Invalidate renderers before we kill the CSG tree
-	this->qglview->setRenderer(NULL);
-#ifdef ENABLE_OPENCSG
-	delete this->opencsgRenderer;
-	this->opencsgRenderer = NULL;
-#endif
-	delete this->thrownTogetherRenderer;
-	this->thrownTogetherRenderer = NULL;
+	// The preview renderers keep their products alive, so they are only
+	// replaced once the next preview is done
 
-	// Remove previous CSG tree
+	// Remove previous CSG tree, keeping subtrees which may be reused
+	if (this->absolute_root_node) this->instcache.detach(*this->absolute_root_node);
 	delete this->absolute_root_node;
 	this->absolute_root_node = NULL;
 
@@ -1069,7 +1187,7 @@ void MainWindow::instantiateRoot()
 		ModuleInstantiation mi = ModuleInstantiation( "group" );
 		this->root_inst = mi;
 
-		this->absolute_root_node = this->root_module->instantiate(&top_ctx, &this->root_inst, NULL);
+		this->absolute_root_node = this->root_module->instantiate(&top_ctx, &this->root_inst, this->instcache);
 
 		if (this->absolute_root_node) {
 			// Do we have an explicit root node (! modifier)?
@@ -1078,9 +1196,11 @@ void MainWindow::instantiateRoot()
 			}
 			// FIXME: Consider giving away ownership of root_node to the Tree, or use reference counted pointers
 			this->tree.setRoot(this->root_node);
+			this->instcache.restoreIds(this->tree);
 			// Dump the tree (to initialize caches).
 			// FIXME: We shouldn't really need to do this explicitly..
-			this->tree.getString(*this->root_node);
+			this->tree.getIdString(*this->root_node);
+			this->instcache.saveIds(this->tree);
 		}
 	}
 
@@ -1095,94 +1215,101 @@ void MainWindow::instantiateRoot()
 }
 
 /*!
-	Generates CSG tree for OpenCSG evaluation.
+	Generates CSG tree for OpenCSG evaluation in the CSG worker, which calls
+	actionRenderPreviewDone() when done.
 	Assumes that the design has been parsed and evaluated (this->root_node is set)
 */
-void MainWindow::compileCSG(bool procevents)
+void MainWindow::compileCSG()
 {
 	assert(this->root_node);
 	PRINT("Compiling design (CSG Products generation)...");
-	if (procevents) QApplication::processEvents();
 
 	// Main CSG evaluation
 	this->progresswidget = new ProgressWidget(this);
 	connect(this->progresswidget, SIGNAL(requestShow()), this, SLOT(showProgress()));
 
-#ifdef ENABLE_CGAL
-		GeometryEvaluator geomevaluator(this->tree);
-#else
-		// FIXME: Will we support this?
-#endif
-#ifdef ENABLE_OPENCSG
-		CSGTreeEvaluator csgrenderer(this->tree, &geomevaluator);
-#endif
-
 	progress_report_prep(this->root_node, report_func, this);
-	try {
-#ifdef ENABLE_OPENCSG
-		if (procevents) QApplication::processEvents();
-		this->csgRoot = csgrenderer.buildCSGTree(*root_node);
-#endif
-		GeometryCache::instance()->print();
-#ifdef ENABLE_CGAL
-		CGALCache::instance()->print();
-#endif
-		if (procevents) QApplication::processEvents();
-	}
-	catch (const ProgressCancelException &e) {
-		PRINT("CSG generation cancelled.");
-	}
-	progress_report_fin();
-	updateStatusBar(NULL);
+	const int fragmentlimit = Preferences::inst()->getValue("advanced/previewFragmentLimit").toInt();
+	const size_t normalizelimit = 2 * Preferences::inst()->getValue("advanced/openCSGLimit").toUInt();
+	this->csgworker->start(this->tree, fragmentlimit, normalizelimit);
+}
 
-	PRINT("Compiling design (CSG Products normalization)...");
-	if (procevents) QApplication::processEvents();
+/*!
+	Shows the preview with placeholders for the render() nodes the CSG
+	worker is still evaluating.
+*/
+void MainWindow::actionRenderPreviewPartial()
+{
+	CSGWorker::Result result = this->csgworker->takePartialResult();
+	if (this->restartpreview || this->livepreviewing || !result.root) return;
 
-	size_t normalizelimit = 2 * Preferences::inst()->getValue("advanced/openCSGLimit").toUInt();
-	CSGTreeNormalizer normalizer(normalizelimit);
-	
-	if (this->csgRoot) {
-		this->normalizedRoot = normalizer.normalize(this->csgRoot);
-		if (this->normalizedRoot) {
-			this->root_products.reset(new CSGProducts());
-			this->root_products->import(this->normalizedRoot);
-		}
-		else {
-			this->root_products.reset();
-			PRINT("WARNING: CSG normalization resulted in an empty tree");
-			if (procevents) QApplication::processEvents();
-		}
-	}
+	this->csgRoot = result.root;
+	this->normalizedRoot = result.normalized;
+	this->root_products = result.root_products;
+	this->highlights_products = result.highlights_products;
+	this->background_products = result.background_products;
+	updatePreviewRenderers();
+	showPreviewMode();
+}
 
-	const std::vector<shared_ptr<CSGNode> > &highlight_terms = csgrenderer.getHighlightNodes();
-	if (highlight_terms.size() > 0) {
-		PRINTB("Compiling highlights (%d CSG Trees)...", highlight_terms.size());
-		if (procevents) QApplication::processEvents();
-		
-		this->highlights_products.reset(new CSGProducts());
-		for (unsigned int i = 0; i < highlight_terms.size(); i++) {
-			shared_ptr<CSGNode> nterm = normalizer.normalize(highlight_terms[i]);
-			this->highlights_products->import(nterm);
-		}
-	}
-	else {
-		this->highlights_products.reset();
+/*!
+	Replaces the preview renderers by ones for the products built by the
+	CSG worker, unless the design changed meanwhile.
+*/
+void MainWindow::actionRenderPreviewDone()
+{
+	progress_report_fin();
+	updateStatusBar(NULL);
+	CSGWorker::Result result = this->csgworker->takeResult();
+	const bool live = this->livepreviewing;
+	this->livepreviewing = false;
+
+	if (this->restartpreview) {
+		this->restartpreview = false;
+		// A live preview starts again after the next pause in typing
+		const bool restart = !designActionLivePreview->isChecked();
+		if (restart) PRINT("Design changed, restarting preview...");
+		compileEnded();
+		if (restart) QTimer::singleShot(1000, this, SLOT(actionRenderPreview()));
+		return;
 	}
-	
-	const std::vector<shared_ptr<CSGNode> > &background_terms = csgrenderer.getBackgroundNodes();
-	if (background_terms.size() > 0) {
-		PRINTB("Compiling background (%d CSG Trees)...", background_terms.size());
-		if (procevents) QApplication::processEvents();
-		
-		this->background_products.reset(new CSGProducts());
-		for (unsigned int i = 0; i < background_terms.size(); i++) {
-			shared_ptr<CSGNode> nterm = normalizer.normalize(background_terms[i]);
-			this->background_products->import(nterm);
+
+	if (live) {
+		updateCamera();
+		updateCompileResult();
+		emit unhighlightLastError();
+		if (!this->root_module) emit highlightError(parser_error_pos);
+		// Keep showing the last good preview while the design doesn't compile
+		if (!this->root_node) {
+			compileEnded();
+			return;
 		}
 	}
-	else {
-		this->background_products.reset();
-	}
+
+	this->csgRoot = result.root;
+	this->normalizedRoot = result.normalized;
+	this->root_products = result.root_products;
+	this->highlights_products = result.highlights_products;
+	this->background_products = result.background_products;
+	updatePreviewRenderers();
+	PRINT("Compile and preview finished.");
+	int s = this->renderingTime.elapsed() / 1000;
+	PRINTB("Total rendering time: %d hours, %d minutes, %d seconds", (s / (60*60)) % ((s / 60) % 60) % (s % 60));
+	showPreview();
+}
+
+/*!
+	Replaces the preview renderers by ones for the current products.
+*/
+void MainWindow::updatePreviewRenderers()
+{
+	this->qglview->setRenderer(NULL);
+#ifdef ENABLE_OPENCSG
+	delete this->opencsgRenderer;
+	this->opencsgRenderer = NULL;
+#endif
+	delete this->thrownTogetherRenderer;
+	this->thrownTogetherRenderer = NULL;
 
 	if (this->root_products &&
 			(this->root_products->size() >
@@ -1203,10 +1330,6 @@ void MainWindow::compileCSG(bool procevents)
 	this->thrownTogetherRenderer = new ThrownTogetherRenderer(this->root_products,
 																														this->highlights_products,
 																														this->background_products);
-	PRINT("Compile and preview finished.");
-	int s = this->renderingTime.elapsed() / 1000;
-	PRINTB("Total rendering time: %d hours, %d minutes, %d seconds", (s / (60*60)) % ((s / 60) % 60) % (s % 60));
-	if (procevents) QApplication::processEvents();
 }
 
 void MainWindow::actionNew()
@@ -1608,6 +1731,16 @@ void MainWindow::updateCamera()
 	if (!root_module)
 		return;
 	
+	updateCamera(root_module->lookup_variable("$vpt"), root_module->lookup_variable("$vpr"),
+							 root_module->lookup_variable("$vpd"));
+}
+
+/*!
+	Sets up the viewport camera from the values of $vpt, $vpr and $vpd
+	set by a design.
+*/
+void MainWindow::updateCamera(const ValuePtr &vpt, const ValuePtr &vpr, const ValuePtr &vpd)
+{
 	bool camera_set = false;
 
 	Camera cam(qglview->cam);
@@ -1621,7 +1754,6 @@ void MainWindow::updateCamera()
 	double d = cam.zoomValue();
 
 	double x, y, z;
-	const ValuePtr vpr = root_module->lookup_variable("$vpr");
 	if (vpr->getVec3(x, y, z)) {
 		rx = x;
 		ry = y;
@@ -1629,7 +1761,6 @@ void MainWindow::updateCamera()
 		camera_set = true;
 	}
 
-	const ValuePtr vpt = root_module->lookup_variable("$vpt");
 	if (vpt->getVec3(x, y, z)) {
 		tx = x;
 		ty = y;
@@ -1637,7 +1768,6 @@ void MainWindow::updateCamera()
 		camera_set = true;
 	}
 
-	const ValuePtr vpd = root_module->lookup_variable("$vpd");
 	if (vpd->type() == Value::NUMBER) {
 		d = vpd->toDouble();
 		camera_set = true;
@@ -1660,13 +1790,16 @@ void MainWindow::updateCamera()
 /*!
 	Returns true if the current document is a file on disk and that file has new content.
 	Returns false if a file on disk has disappeared or if we haven't yet saved.
+
+	The contents are only hashed once the size or timestamp changed, so
+	files rewritten unchanged, e.g. by editors on save, don't count.
 */
 bool MainWindow::fileChangedOnDisk()
 {
 	if (!this->fileName.isEmpty()) {
+		const std::string filename(this->fileName.toLocal8Bit().constData());
 		struct stat st;
-		memset(&st, 0, sizeof(struct stat));
-		bool valid = (stat(this->fileName.toLocal8Bit(), &st) == 0);
+		bool valid = FileWatcher::instance()->stat(filename, st);
 		// If file isn't there, just return and use current editor text
 		if (!valid) return false;
 
@@ -1674,6 +1807,9 @@ bool MainWindow::fileChangedOnDisk()
 
 		if (newid != this->autoReloadId) {
 			this->autoReloadId = newid;
+			std::string hash;
+			if (FileWatcher::instance()->contentHash(filename, hash) && hash == this->autoReloadHash) return false;
+			this->autoReloadHash = hash;
 			return true;
 		}
 	}
@@ -1693,13 +1829,21 @@ void MainWindow::compileTopLevelDocument()
 		std::string(this->last_compiled_doc.toUtf8().constData()) +
 		"\n" + commandline_commands;
 	
-	delete this->root_module;
-	this->root_module = NULL;
-
 	auto fnameba = this->fileName.toLocal8Bit();
     const char* fname =
         this->fileName.isEmpty() ? "" : fnameba;
-	this->root_module = parse(fulltext.c_str(), fs::path(fname), false);
+	parseTopLevelDocument(fulltext, fname);
+}
+
+/*!
+	Replaces the root module by the one parsed from \a fulltext. Doesn't
+	touch any widget, so it may run in the CSG worker.
+*/
+void MainWindow::parseTopLevelDocument(const std::string &fulltext, const std::string &filename)
+{
+	delete this->root_module;
+	this->root_module = NULL;
+	this->root_module = parse(fulltext.c_str(), fs::path(filename), false);
 }
 
 void MainWindow::checkAutoReload()
@@ -1720,6 +1864,68 @@ void MainWindow::autoReloadSet(bool on)
 	}
 }
 
+void MainWindow::livePreviewSet(bool on)
+{
+	QSettings settings;
+	settings.setValue("design/livePreview", on);
+	if (on) livePreviewTimer->start();
+	else livePreviewTimer->stop();
+}
+
+/*!
+	Previews the text in the editor once typing pauses. Unlike
+	actionRenderPreview(), the design is also parsed and instantiated in
+	the CSG worker, and the shown preview is only replaced when the new one
+	is done. Typing meanwhile cancels the job, and a new one starts after
+	the next pause.
+*/
+void MainWindow::livePreview()
+{
+	if (!designActionLivePreview->isChecked()) return;
+	if (GuiLocker::isLocked()) {
+		// Try again once the running action is done
+		livePreviewTimer->start();
+		return;
+	}
+	GuiLocker::lock();
+	autoReloadTimer->stop();
+	this->prefetcher->stop();
+	setCurrentOutput();
+	flushConsole();
+	compileErrors = 0;
+	compileWarnings = 0;
+	this->renderingTime.start();
+	console->clear();
+	if (editor->isContentModified()) saveBackup();
+
+	// Everything read from widgets is taken before the worker starts
+	resetPrintedDeprecations();
+	updateTemporalVariables();
+	this->last_compiled_doc = editor->toPlainText();
+	const std::string fulltext =
+		std::string(this->last_compiled_doc.toUtf8().constData()) +
+		"\n" + commandline_commands;
+	const std::string filename = this->fileName.isEmpty() ? "" : this->fileName.toLocal8Bit().constData();
+
+	this->livepreviewing = true;
+	this->dumpframe = false;
+	this->procevents = false;
+	this->progresswidget = new ProgressWidget(this);
+	connect(this->progresswidget, SIGNAL(requestShow()), this, SLOT(showProgress()));
+	const int fragmentlimit = Preferences::inst()->getValue("advanced/previewFragmentLimit").toInt();
+	const size_t normalizelimit = 2 * Preferences::inst()->getValue("advanced/openCSGLimit").toUInt();
+	this->csgworker->start([this, fulltext, filename]() -> const Tree * {
+			PRINT("Parsing design (AST generation)...");
+			parseTopLevelDocument(fulltext, filename);
+			if (this->root_module) this->root_module->handleDependencies();
+			instantiateRoot();
+			if (!this->root_node) return NULL;
+			PRINT("Compiling design (CSG Products generation)...");
+			progress_report_prep(this->root_node, report_func, this);
+			return &this->tree;
+		}, fragmentlimit, normalizelimit);
+}
+
 bool MainWindow::checkEditorModified()
 {
 	if (editor->isContentModified()) {
@@ -1752,20 +1958,8 @@ void MainWindow::actionReloadRenderPreview()
 
 void MainWindow::csgReloadRender()
 {
-	if (this->root_node) compileCSG(true);
-
-	// Go to non-CGAL view mode
-	if (viewActionThrownTogether->isChecked()) {
-		viewModeThrownTogether();
-	}
-	else {
-#ifdef ENABLE_OPENCSG
-		viewModePreview();
-#else
-		viewModeThrownTogether();
-#endif
-	}
-	compileEnded();
+	this->dumpframe = false;
+	startPreview();
 }
 
 void MainWindow::actionRenderPreview()
@@ -1794,9 +1988,38 @@ void MainWindow::actionRenderPreview()
 
 void MainWindow::csgRender()
 {
-	if (this->root_node) compileCSG(!viewActionAnimate->isChecked());
+	this->dumpframe = true;
+	startPreview();
+}
 
-	// Go to non-CGAL view mode
+void MainWindow::startPreview()
+{
+	if (this->root_node) {
+		compileCSG();
+		return;
+	}
+
+	// Nothing to show
+	this->qglview->setRenderer(NULL);
+#ifdef ENABLE_OPENCSG
+	delete this->opencsgRenderer;
+	this->opencsgRenderer = NULL;
+#endif
+	delete this->thrownTogetherRenderer;
+	this->thrownTogetherRenderer = NULL;
+	this->csgRoot.reset();
+	this->normalizedRoot.reset();
+	this->root_products.reset();
+	this->highlights_products.reset();
+	this->background_products.reset();
+	showPreview();
+}
+
+/*!
+	Goes to the non-CGAL view mode.
+*/
+void MainWindow::showPreviewMode()
+{
 	if (viewActionThrownTogether->isChecked()) {
 		viewModeThrownTogether();
 	}
@@ -1807,8 +2030,16 @@ void MainWindow::csgRender()
 		viewModeThrownTogether();
 #endif
 	}
+}
 
-	if (e_dump->isChecked() && animate_timer->isActive()) {
+/*!
+	Goes to the preview mode showing the current renderers, and saves the
+	frame if animation frames are being dumped.
+*/
+void MainWindow::showPreview()
+{
+	showPreviewMode();
+	if (this->dumpframe && e_dump->isChecked() && animate_timer->isActive()) {
 		if (anim_dumping && anim_dump_start_step == anim_step) {
 			anim_dumping=false;
 			e_dump->setChecked(false);
@@ -1856,26 +2087,57 @@ void MainWindow::cgalRender()
 	delete this->cgalRenderer;
 	this->cgalRenderer = NULL;
 	this->root_geom.reset();
+	this->partial_geom.reset();
 
 	PRINT("Rendering Polygon Mesh using CGAL...");
 
 	this->progresswidget = new ProgressWidget(this);
 	connect(this->progresswidget, SIGNAL(requestShow()), this, SLOT(showProgress()));
 
-	progress_report_prep(this->root_node, report_func, this);
+	progress_report_prep(this->root_node, report_func, this, &this->tree);
 
 	this->cgalworker->start(this->tree);
 }
 
+/*!
+	Shows the top-level objects finished so far while rendering.
+*/
+void MainWindow::actionRenderPartial(shared_ptr<const Geometry> geom)
+{
+	const PolySet *ps = dynamic_cast<const PolySet *>(geom.get());
+	if (!ps || this->restartrender) return;
+	if (!this->partial_geom) this->partial_geom.reset(new PolySet(3));
+	this->partial_geom->append(*ps);
+
+	this->qglview->setRenderer(NULL);
+	delete this->cgalRenderer;
+	this->cgalRenderer = new CGALRenderer(shared_ptr<const Geometry>(new PolySet(*this->partial_geom)));
+	if (viewActionWireframe->isChecked()) viewModeWireframe();
+	else viewModeSurface();
+}
+
 void MainWindow::actionRenderDone(shared_ptr<const Geometry> root_geom)
 {
 	progress_report_fin();
+	this->partial_geom.reset();
+	this->qglview->setRenderer(NULL);
+	delete this->cgalRenderer;
+	this->cgalRenderer = this->cgalworker->takeRenderer();
+
+	if (this->restartrender) {
+		delete this->cgalRenderer;
+		this->cgalRenderer = NULL;
+		// Finished subtrees are cached, so the new render continues from there
+		this->restartrender = false;
+		PRINT("Design changed, restarting rendering...");
+		updateStatusBar(NULL);
+		compileEnded();
+		QTimer::singleShot(1000, this, SLOT(actionRender()));
+		return;
+	}
 
 	if (root_geom) {
 		GeometryCache::instance()->print();
-#ifdef ENABLE_CGAL
-		CGALCache::instance()->print();
-#endif
 
 		int s = this->renderingTime.elapsed() / 1000;
 		PRINTB("Total rendering time: %d hours, %d minutes, %d seconds", (s / (60*60)) % ((s / 60) % 60) % (s % 60));
@@ -1911,7 +2173,6 @@ void MainWindow::actionRenderDone(shared_ptr<const Geometry> root_geom)
 		PRINT("Rendering finished.");
 
 		this->root_geom = root_geom;
-		this->cgalRenderer = new CGALRenderer(root_geom);
 		// Go to CGAL view mode
 		if (viewActionWireframe->isChecked()) viewModeWireframe();
 		else viewModeSurface();
@@ -2036,15 +2297,19 @@ void MainWindow::actionCheckValidity() {
 		return;
 	}
 
-	bool valid = false;
-	shared_ptr<const CGAL_Nef_polyhedron> N;
-	if (const PolySet *ps = dynamic_cast<const PolySet *>(this->root_geom.get())) {
-		N.reset(CGALUtils::createNefPolyhedronFromGeometry(*ps));
-	}
-	if (N || (N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(this->root_geom))) {
-            valid = N->p3 ? N->p3->is_valid() : false;
+	// Checks the mesh which is exported, without building a Nef polyhedron
+	shared_ptr<const PolySet> ps = dynamic_pointer_cast<const PolySet>(this->root_geom);
+	if (!ps) {
+		shared_ptr<const CGAL_Nef_polyhedron> N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(this->root_geom);
+		PolySet *mesh = new PolySet(3);
+		ps.reset(mesh);
+		if (N && N->p3 && CGALUtils::createPolySetFromNefPolyhedron3(*N->p3, *mesh)) {
+			PRINT("ERROR: Nef->PolySet failed");
+			clearCurrentOutput();
+			return;
+		}
 	}
-	PRINTB("   Valid:      %6s", (valid ? "yes" : "no"));
+	MeshValidator::validate(*ps).print();
 	clearCurrentOutput();
 #endif /* ENABLE_CGAL */
 }
@@ -2097,21 +2362,43 @@ void MainWindow::actionExport(FileFormat format, const char *type_name, const ch
 
 	QString title = QString(_("Export %1 File")).arg(type_name);
 	QString filter = QString(_("%1 Files (*%2)")).arg(type_name, suffix);
+	// STL can be written as text or binary, chosen by the filter
+	QString binaryfilter = QString(_("Binary %1 Files (*%2)")).arg(type_name, suffix);
+	if (format == OPENSCAD_STL) filter += ";;" + binaryfilter;
 	QString filename = this->fileName.isEmpty() ? QString(_("Untitled")) + suffix : QFileInfo(this->fileName).completeBaseName() + suffix;
-	QString export_filename = QFileDialog::getSaveFileName(this, title, filename, filter);
+	QString selectedfilter;
+	QString export_filename = QFileDialog::getSaveFileName(this, title, filename, filter, &selectedfilter);
 	if (export_filename.isEmpty()) {
 		clearCurrentOutput();
 		return;
 	}
+	if (format == OPENSCAD_STL && selectedfilter == binaryfilter) format = OPENSCAD_STL_BINARY;
 
-	exportFileByName(this->root_geom, format,
+	// The GUI stays locked until the export worker is done. There is no
+	// fraction done to show, only a busy indicator to cancel.
+	GuiLocker::lock();
+	this->exporttype = type_name;
+	this->progresswidget = new ProgressWidget(this);
+	this->progresswidget->setRange(0, 0);
+	connect(this->progresswidget, SIGNAL(requestShow()), this, SLOT(showProgress()));
+	// The worker thread doesn't process events until it is done
+	connect(this->progresswidget->stopButton, SIGNAL(clicked()), this->exportworker, SLOT(cancel()), Qt::DirectConnection);
+	this->exportworker->start(this->root_geom, format,
 		export_filename.toLocal8Bit().constData(),
-		export_filename.toUtf8());
-	PRINTB("%s export finished.", type_name);
+		export_filename.toUtf8().constData());
+#endif /* ENABLE_CGAL */
+}
 
+#ifdef ENABLE_CGAL
+void MainWindow::actionExportDone(bool finished)
+{
+	updateStatusBar(NULL);
+	if (finished) PRINTB("%s export finished.", this->exporttype);
+	this->exporttype = NULL;
 	clearCurrentOutput();
-#endif /* ENABLE_CGAL */
+	GuiLocker::unlock();
 }
+#endif
 
 void MainWindow::actionExportSTL()
 {
@@ -2128,6 +2415,11 @@ void MainWindow::actionExportAMF()
 	actionExport(OPENSCAD_AMF, "AMF", ".amf", 3);
 }
 
+void MainWindow::actionExport3MF()
+{
+	actionExport(OPENSCAD_3MF, "3MF", ".3mf", 3);
+}
+
 void MainWindow::actionExportDXF()
 {
 	actionExport(OPENSCAD_DXF, "DXF", ".dxf", 2);
@@ -2162,7 +2454,8 @@ void MainWindow::actionExportCSG()
 		PRINTB("Can't open file \"%s\" for export", csg_filename.toLocal8Bit().constData());
 	}
 	else {
-		fstream << this->tree.getString(*this->root_node) << "\n";
+		this->tree.dump(fstream, *this->root_node);
+		fstream << "\n";
 		fstream.close();
 		PRINT("CSG export finished.");
 	}
@@ -2199,9 +2492,11 @@ void MainWindow::actionCopyViewport()
 void MainWindow::actionFlushCaches()
 {
 	GeometryCache::instance()->clear();
-#ifdef ENABLE_CGAL
-	CGALCache::instance()->clear();
-#endif
+	ImportCache::instance()->clear();
+	PreviewCache::instance()->clear();
+	FunctionCache::instance()->clear();
+	TableIndex::clear();
+	this->instcache.clear();
 	dxf_dim_cache.clear();
 	dxf_cross_cache.clear();
 	ModuleCache::instance()->clear();
@@ -2306,6 +2601,14 @@ void MainWindow::viewModeShowScaleProportional()
     this->qglview->updateGL();
 }
 
+void MainWindow::viewModeShowFrameTime()
+{
+	QSettings settings;
+	settings.setValue("view/showFrameTime", viewActionShowFrameTime->isChecked());
+	this->qglview->setShowFrameTime(viewActionShowFrameTime->isChecked());
+	this->qglview->updateGL();
+}
+
 void MainWindow::viewModeAnimate()
 {
 	if (viewActionAnimate->isChecked()) {
@@ -2315,6 +2618,7 @@ void MainWindow::viewModeAnimate()
 	} else {
 		animate_panel->hide();
 		animate_timer->stop();
+		this->prefetcher->stop();
 	}
 }
 
@@ -2494,6 +2798,15 @@ void MainWindow::hideConsole()
 	}
 }
 
+void MainWindow::hideCachePanel()
+{
+	if (viewActionHideCachePanel->isChecked()) {
+		cacheDock->hide();
+	} else {
+		cacheDock->show();
+	}
+}
+
 void MainWindow::dragEnterEvent(QDragEnterEvent *event)
 {
 	if (event->mimeData()->hasUrls())
@@ -2655,31 +2968,61 @@ void MainWindow::quit()
 #endif
 }
 
+/*!
+	Collects messages for the console, which are shown in batches by
+	flushConsole(): at the latest every 100 ms while the main thread is
+	busy, e.g. compiling, and otherwise once the event loop runs again.
+	Models which echo thousands of lines would otherwise update the
+	console and process events for each line.
+*/
 void MainWindow::consoleOutput(const std::string &msg, void *userdata)
 {
-	// Invoke the method in the main thread in case the output
-	// originates in a worker thread.
 	MainWindow *thisp = static_cast<MainWindow*>(userdata);
-	QMetaObject::invokeMethod(thisp, "consoleOutput", Q_ARG(QString, QString::fromStdString(msg)));
+	bool first;
+	{
+		QMutexLocker lock(&thisp->consolemutex);
+		first = thisp->pendingConsole.isEmpty();
+		thisp->pendingConsole.append(QString::fromStdString(msg));
+	}
+	if (QThread::currentThread() == thisp->thread() && thisp->consoleFlushTime.elapsed() >= 100) {
+		thisp->flushConsole();
+	}
+	else if (first) {
+		// Invoke the method in the main thread in case the output
+		// originates in a worker thread.
+		QMetaObject::invokeMethod(thisp, "flushConsole", Qt::QueuedConnection);
+	}
 }
 
-void MainWindow::consoleOutput(const QString &msg)
+void MainWindow::flushConsole()
 {
-	QString qmsg;
-	if (msg.startsWith("WARNING:") || msg.startsWith("DEPRECATED:")) {
-		this->compileWarnings++;
-		qmsg = "<html><span style=\"color: black; background-color: #ffffb0;\">" + msg + "</span></html>\n";
-	} else if (msg.startsWith("ERROR:")) {
-		this->compileErrors++;
-		qmsg = "<html><span style=\"color: black; background-color: #ffb0b0;\">" + msg + "</span></html>\n";
-	}
-	else {
-		qmsg = msg;
+	QStringList messages;
+	{
+		QMutexLocker lock(&this->consolemutex);
+		messages.swap(this->pendingConsole);
 	}
+	this->consoleFlushTime.start();
+	if (messages.isEmpty()) return;
+
 	QTextCursor c = this->console->textCursor();
 	c.movePosition(QTextCursor::End);
 	this->console->setTextCursor(c);
-	this->console->append(qmsg);
+	this->console->setUpdatesEnabled(false);
+	for(const auto &msg : messages) {
+		QString qmsg;
+		if (msg.startsWith("WARNING:") || msg.startsWith("DEPRECATED:")) {
+			this->compileWarnings++;
+			qmsg = "<html><span style=\"color: black; background-color: #ffffb0;\">" + msg + "</span></html>\n";
+		} else if (msg.startsWith("ERROR:")) {
+			this->compileErrors++;
+			qmsg = "<html><span style=\"color: black; background-color: #ffb0b0;\">" + msg + "</span></html>\n";
+		}
+		else {
+			qmsg = msg;
+		}
+		this->console->append(qmsg);
+	}
+	this->console->setUpdatesEnabled(true);
 	if (this->procevents) QApplication::processEvents();
 }
 
@@ -2704,5 +3047,19 @@ void MainWindow::openCSGSettingsChanged()
 void MainWindow::setContentsChanged()
 {
 	this->contentschanged = true;
+#ifdef ENABLE_CGAL
+	// Editing the design cancels a running render and starts it again
+	if (this->cgalworker->isRunning() && this->progresswidget && !this->restartrender) {
+		this->progresswidget->cancel();
+		this->restartrender = true;
+	}
+#endif
+	// Likewise for a preview
+	if (this->csgworker->isRunning() && this->progresswidget && !this->restartpreview) {
+		this->progresswidget->cancel();
+		this->csgworker->cancel();
+		this->restartpreview = true;
+	}
+	if (designActionLivePreview->isChecked()) livePreviewTimer->start();
 }
 
@@ -2,6 +2,7 @@
 #include "math.h"
 
 #include "modcontext.h"
+#include "evalcontext.h"
 #include "UserModule.h"
 #include "ModuleInstantiation.h"
 #include "expression.h"
@@ -9,10 +10,14 @@
 #include "printutils.h"
 #include "builtin.h"
 #include "ModuleCache.h"
+#include "LibraryIndex.h"
+#include "feature.h"
+#include "FunctionCache.h"
 #include <cmath>
+#include <mutex>
 
 ModuleContext::ModuleContext(const Context *parent, const EvalContext *evalctx)
-	: Context(parent), functions_p(NULL), modules_p(NULL), evalctx(evalctx)
+	: Context(parent), functions_p(NULL), modules_p(NULL), evalctx(evalctx), evaluationonly(false)
 {
 }
 
@@ -135,9 +140,28 @@ ValuePtr ModuleContext::evaluate_function(const std::string &name,
 	return Context::evaluate_function(name, evalctx);
 }
 
+const AbstractFunction *ModuleContext::findFunction(const std::string &name) const
+{
+	if (this->functions_p) {
+		LocalScope::FunctionContainer::const_iterator it = this->functions_p->find(name);
+		if (it != this->functions_p->end()) return it->second;
+	}
+	return Context::findFunction(name);
+}
+
+/*!
+	When evaluating only, the modules of this context which make geometry
+	aren't instantiated. Their arguments are still evaluated, for the
+	messages of the functions called, but no nodes are made. Set on the
+	context of the builtins to run a design just for its output.
+*/
 AbstractNode *ModuleContext::instantiate_module(const ModuleInstantiation &inst, EvalContext *evalctx) const
 {
 	const AbstractModule *foundm = this->findLocalModule(inst.name());
+	if (foundm && this->evaluationonly && foundm->is_leaf()) {
+		for (size_t i = 0; i < evalctx->numArgs(); i++) evalctx->getArgValue(i);
+		return NULL;
+	}
 	if (foundm) return foundm->instantiate(this, &inst, evalctx);
 
 	return Context::instantiate_module(inst, evalctx);
@@ -182,12 +206,36 @@ FileContext::FileContext(const class FileModule &module, const Context *parent)
 	if (!module.modulePath().empty()) this->document_path = module.modulePath();
 }
 
+/*!
+	Returns the used library \a filename if it may define the module or
+	function \a name. With the lazy-use feature, libraries are parsed here
+	when they are first needed.
+*/
+static FileModule *find_used_module(const std::string &filename, const std::string &name, bool module)
+{
+	// Libraries are normally parsed by FileModule::handleDependencies()
+	FileModule *usedmod = ModuleCache::instance()->lookup(filename);
+	if (usedmod || !Feature::ExperimentalLazyUse.is_enabled()) return usedmod;
+
+	static std::mutex mutex;
+	std::lock_guard<std::mutex> lock(mutex);
+	// NULL if the library was parsed, but couldn't be compiled
+	if (ModuleCache::instance()->isCached(filename)) return ModuleCache::instance()->lookup(filename);
+	auto symbols = LibraryIndex::instance()->symbols(filename);
+	if (!(module ? symbols->mayDefineModule(name) : symbols->mayDefineFunction(name))) return NULL;
+
+	PRINTDB("Loading library '%s' for '%s'", filename % name);
+	ModuleCache::instance()->evaluate(filename, usedmod);
+	if (!usedmod) PRINTB_NOCACHE("WARNING: Failed to compile library '%s'.", filename);
+	return usedmod;
+}
+
 ValuePtr FileContext::sub_evaluate_function(const std::string &name, 
 																													 const EvalContext *evalctx,
 																													 FileModule *usedmod) const
 {
 	FileContext ctx(*usedmod, this->parent);
-	ctx.initializeModule(*usedmod);
+	ctx.initializeLibrary(*usedmod);
 	// FIXME: Set document path
 #ifdef DEBUG
 	PRINTDB("New lib Context for %s func:", name);
@@ -204,7 +252,7 @@ ValuePtr FileContext::evaluate_function(const std::string &name,
 
 	for(const auto &m : this->usedlibs) {
 		// usedmod is NULL if the library wasn't be compiled (error or file-not-found)
-		FileModule *usedmod = ModuleCache::instance()->lookup(m);
+		FileModule *usedmod = find_used_module(m, name, false);
 		if (usedmod && usedmod->scope.functions.find(name) != usedmod->scope.functions.end())
 			return sub_evaluate_function(name, evalctx, usedmod);
 	}
@@ -212,18 +260,34 @@ ValuePtr FileContext::evaluate_function(const std::string &name,
 	return ModuleContext::evaluate_function(name, evalctx);
 }
 
+const AbstractFunction *FileContext::findFunction(const std::string &name) const
+{
+	if (this->functions_p) {
+		LocalScope::FunctionContainer::const_iterator it = this->functions_p->find(name);
+		if (it != this->functions_p->end()) return it->second;
+	}
+	for(const auto &m : this->usedlibs) {
+		FileModule *usedmod = find_used_module(m, name, false);
+		if (usedmod) {
+			LocalScope::FunctionContainer::const_iterator it = usedmod->scope.functions.find(name);
+			if (it != usedmod->scope.functions.end()) return it->second;
+		}
+	}
+	return ModuleContext::findFunction(name);
+}
+
 AbstractNode *FileContext::instantiate_module(const ModuleInstantiation &inst, EvalContext *evalctx) const
 {
 	const AbstractModule *foundm = this->findLocalModule(inst.name());
 	if (foundm) return foundm->instantiate(this, &inst, evalctx);
 
 	for(const auto &m : this->usedlibs) {
-		FileModule *usedmod = ModuleCache::instance()->lookup(m);
+		FileModule *usedmod = find_used_module(m, inst.name(), true);
 		// usedmod is NULL if the library wasn't be compiled (error or file-not-found)
 		if (usedmod &&
 				usedmod->scope.modules.find(inst.name()) != usedmod->scope.modules.end()) {
 			FileContext ctx(*usedmod, this->parent);
-			ctx.initializeModule(*usedmod);
+			ctx.initializeLibrary(*usedmod);
 			// FIXME: Set document path
 #ifdef DEBUG
 			PRINTD("New file Context:");
@@ -245,3 +309,49 @@ void FileContext::initializeModule(const class FileModule &module)
 		this->set_variable(ass.name, ass.expr->evaluate(this));
 	}
 }
+
+/*!
+	Like initializeModule(), for the used library \a module, whose functions
+	and modules are called with a new context each time. Its top-level
+	assignments, e.g. lookup tables, are evaluated once and memoized in
+	the module if they only depend on the library: evaluations which look
+	up config variables, call rands() and the like or print messages are
+	repeated every time.
+*/
+void FileContext::initializeLibrary(const FileModule &module)
+{
+	this->functions_p = &module.scope.functions;
+	this->modules_p = &module.scope.modules;
+	FileModule::AssignmentValues memoized = module.memoizedAssignments();
+	if (memoized && memoized->size() == module.scope.assignments.size()) {
+		size_t i = 0;
+		for(const auto &ass : module.scope.assignments) {
+			this->set_variable(ass.name, (*memoized)[i++]);
+		}
+		return;
+	}
+
+	const unsigned int calls = FunctionCache::volatileCalls();
+	const unsigned int lookups = Context::configLookups();
+	shared_ptr<std::vector<ValuePtr>> values(new std::vector<ValuePtr>);
+	values->reserve(module.scope.assignments.size());
+	print_messages_push();
+	try {
+		for(const auto &ass : module.scope.assignments) {
+			ValuePtr value = ass.expr->evaluate(this);
+			this->set_variable(ass.name, value);
+			values->push_back(value);
+		}
+	}
+	catch (...) {
+		print_messages_pop();
+		throw;
+	}
+	const bool printed = !print_messages_top().empty();
+	print_messages_pop();
+	// Variables of other parents than the root context could change
+	if (!printed && calls == FunctionCache::volatileCalls() &&
+			lookups == Context::configLookups() && this->parent && !this->parent->getParent()) {
+		module.memoizeAssignments(values);
+	}
+}
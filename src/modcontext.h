@@ -17,8 +17,10 @@ public:
 
 	void initializeModule(const class UserModule &m);
 	void registerBuiltin();
+	void setEvaluationOnly(bool on) { this->evaluationonly = on; }
 	virtual ValuePtr evaluate_function(const std::string &name, 
 																										const EvalContext *evalctx) const;
+	virtual const AbstractFunction *findFunction(const std::string &name) const;
 	virtual AbstractNode *instantiate_module(const ModuleInstantiation &inst, 
 																					 EvalContext *evalctx) const;
 
@@ -35,6 +37,8 @@ public:
 	virtual std::string dump(const class AbstractModule *mod, const ModuleInstantiation *inst);
 #endif
 private:
+	bool evaluationonly;
+
 // Experimental code. See issue #399
 //	void evaluateAssignments(const AssignmentList &assignments);
 };
@@ -45,8 +49,10 @@ public:
 	FileContext(const FileModule &module, const Context *parent);
 	virtual ~FileContext() {}
 	void initializeModule(const FileModule &module);
+	void initializeLibrary(const FileModule &module);
 	virtual ValuePtr evaluate_function(const std::string &name, 
 																		 const EvalContext *evalctx) const;
+	virtual const AbstractFunction *findFunction(const std::string &name) const;
 	virtual AbstractNode *instantiate_module(const ModuleInstantiation &inst, 
 																					 EvalContext *evalctx) const;
 
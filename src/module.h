@@ -14,6 +14,8 @@ public:
 	virtual ~AbstractModule();
 	virtual bool is_experimental() const { return feature != NULL; }
 	virtual bool is_enabled() const { return (feature == NULL) || feature->is_enabled(); }
+	// Leaf modules only make geometry, from their arguments
+	virtual bool is_leaf() const { return false; }
 	virtual class AbstractNode *instantiate(const class Context *ctx, const class ModuleInstantiation *inst, class EvalContext *evalctx = NULL) const = 0;
 	virtual std::string dump(const std::string &indent, const std::string &name) const;
 	virtual double lookup_double_variable_with_default(Context &c, std::string variable, double def) const;
@@ -29,21 +29,175 @@
 #include "ModuleInstantiation.h"
 #include "progress.h"
 #include "stl-utils.h"
+#include "Profiler.h"
+#include "MemoryAccounting.h"
+#include "Session.h"
 
 #include <iostream>
+#include <sstream>
 #include <algorithm>
+#include <mutex>
+#include <new>
 
 size_t AbstractNode::idx_counter;
 
+namespace {
+	const size_t NODE_ALIGNMENT = 16;
+	const size_t NODE_MAX_POOLED_SIZE = 512;
+	const size_t NODE_SIZE_CLASSES = NODE_MAX_POOLED_SIZE / NODE_ALIGNMENT;
+	const size_t NODE_CHUNK_SIZE = 64*1024;
+
+	struct FreeBlock {
+		FreeBlock *next;
+	};
+
+	/*!
+		Free lists of node memory, by size class. The memory of freed nodes
+		is kept for new nodes rather than returned to the heap, so building
+		and discarding large trees doesn't go through malloc() for each node.
+		Each thread has its own pool; pools of threads which exit are left to
+		the other threads.
+	*/
+	struct NodePool {
+		FreeBlock *blocks[NODE_SIZE_CLASSES];
+		char *chunk;
+		size_t remaining;
+		bool exited;
+	};
+	// Plain data, so it can still be used while the thread's destructors run
+	thread_local NodePool pool;
+
+	std::mutex orphan_mutex;
+	FreeBlock *orphaned_blocks[NODE_SIZE_CLASSES];
+
+	void push(FreeBlock *&list, void *ptr)
+	{
+		FreeBlock *block = static_cast<FreeBlock *>(ptr);
+		block->next = list;
+		list = block;
+	}
+
+	class NodePoolRelease {
+	public:
+		~NodePoolRelease() {
+			std::lock_guard<std::mutex> lock(orphan_mutex);
+			for (size_t i=0;i<NODE_SIZE_CLASSES;i++) {
+				while (FreeBlock *block = pool.blocks[i]) {
+					pool.blocks[i] = block->next;
+					push(orphaned_blocks[i], block);
+				}
+			}
+			pool.exited = true;
+		}
+	};
+	thread_local NodePoolRelease pool_release;
+}
+
+void *AbstractNode::operator new(size_t size)
+{
+	MemoryAccounting::Scope memoryscope(MemoryAccounting::NODES);
+	if (size > NODE_MAX_POOLED_SIZE) return ::operator new(size);
+	const size_t sizeclass = (size + NODE_ALIGNMENT - 1) / NODE_ALIGNMENT - 1;
+	(void)&pool_release; // Registers the pool's release on thread exit
+	if (!pool.blocks[sizeclass] && !pool.exited) {
+		std::lock_guard<std::mutex> lock(orphan_mutex);
+		pool.blocks[sizeclass] = orphaned_blocks[sizeclass];
+		orphaned_blocks[sizeclass] = NULL;
+	}
+	if (FreeBlock *block = pool.blocks[sizeclass]) {
+		pool.blocks[sizeclass] = block->next;
+		return block;
+	}
+
+	const size_t blocksize = (sizeclass + 1) * NODE_ALIGNMENT;
+	if (pool.remaining < blocksize) {
+		pool.chunk = static_cast<char *>(::operator new(NODE_CHUNK_SIZE));
+		pool.remaining = NODE_CHUNK_SIZE;
+	}
+	void *ptr = pool.chunk;
+	pool.chunk += blocksize;
+	pool.remaining -= blocksize;
+	return ptr;
+}
+
+/*!
+	\a size is the size of the dynamic type, since nodes have a virtual
+	destructor.
+*/
+void AbstractNode::operator delete(void *ptr, size_t size)
+{
+	if (!ptr) return;
+	if (size > NODE_MAX_POOLED_SIZE) {
+		::operator delete(ptr);
+		return;
+	}
+	const size_t sizeclass = (size + NODE_ALIGNMENT - 1) / NODE_ALIGNMENT - 1;
+	if (pool.exited) {
+		std::lock_guard<std::mutex> lock(orphan_mutex);
+		push(orphaned_blocks[sizeclass], ptr);
+	}
+	else {
+		push(pool.blocks[sizeclass], ptr);
+	}
+}
+
+/*!
+	Nodes instantiated in a Session are numbered by the session, so
+	documents evaluated concurrently each get their own indices.
+*/
+static size_t next_index(size_t &counter)
+{
+	Session *session = Session::current();
+	return session ? session->nextNodeIndex() : counter++;
+}
+
+void AbstractNode::resetIndexCounter()
+{
+	Session *session = Session::current();
+	if (session) session->resetNodeIndex();
+	else idx_counter = 1;
+}
+
 AbstractNode::AbstractNode(const ModuleInstantiation *mi)
 {
 	modinst = mi;
-	idx = idx_counter++;
+	idx = next_index(idx_counter);
+	refcount = 1;
+	Profiler::nodeCreated();
+}
+
+/*!
+	Assigns new indices to this subtree, as if it had just been instantiated.
+	Used when nodes are carried over into a new tree.
+*/
+void AbstractNode::reindex()
+{
+	idx = next_index(idx_counter);
+	for(auto &child : this->children) child->reindex();
 }
 
+/*!
+	Deletes the children as well, unless they are shared. Subtrees are
+	deleted iteratively by the outermost destructor, so deleting deep
+	trees doesn't recurse.
+*/
 AbstractNode::~AbstractNode()
 {
-	std::for_each(this->children.begin(), this->children.end(), del_fun<AbstractNode>());
+	static thread_local std::vector<AbstractNode *> *pending = NULL;
+	std::vector<AbstractNode *> nodes;
+	const bool outermost = !pending;
+	if (outermost) pending = &nodes;
+	for(const auto &child : this->children) {
+		if (--child->refcount == 0) pending->push_back(child);
+	}
+	if (outermost) {
+		while (!nodes.empty()) {
+			AbstractNode *node = nodes.back();
+			nodes.pop_back();
+			delete node;
+		}
+		pending = NULL;
+	}
 }
 
 std::string AbstractNode::toString() const
@@ -73,7 +227,7 @@ std::string AbstractIntersectionNode::name() const
 	return "intersection";
 }
 
-void AbstractNode::progress_prepare()
+void AbstractNode::progress_prepare() const
 {
 	std::for_each(this->children.begin(), this->children.end(), std::mem_fun(&AbstractNode::progress_prepare));
 	this->progress_mark = ++progress_report_count;
@@ -100,3 +254,49 @@ AbstractNode *find_root_tag(AbstractNode *n)
   return NULL;
 }
 
+/*!
+	Removes the objects below \a node which aren't instantiated from one of
+	\a modules and don't contain such an object. The selected objects stay
+	in place, with the transformations above them. Returns the number of
+	objects selected.
+*/
+size_t select_subtrees(AbstractNode *node, const std::vector<std::string> &modules)
+{
+	size_t selected = 0;
+	std::vector<AbstractNode *> kept;
+	for(auto child : node->children) {
+		const size_t found = std::find(modules.begin(), modules.end(), child->modinst->name()) != modules.end() ?
+			1 : select_subtrees(child, modules);
+		selected += found;
+		if (found) kept.push_back(child);
+		else if (--child->refcount == 0) delete child;
+	}
+	node->children = kept;
+	return selected;
+}
+
+/*!
+	Makes identical subtrees below \a node share one node object. Subtrees
+	are identical if they were instantiated by the same statement with the
+	same parameters and have identical children, like the objects placed by
+	the transformations in a loop. Shared subtrees are dumped and evaluated
+	only once.
+
+	\a nodes maps the keys of the subtrees seen so far to their node. Returns
+	the node to use in place of \a node.
+*/
+AbstractNode *share_identical_subtrees(AbstractNode *node, SharedNodeMap &nodes)
+{
+	std::stringstream key;
+	key << node->modinst << " " << node->toString();
+	for(auto &child : node->children) {
+		AbstractNode *shared = share_identical_subtrees(child, nodes);
+		if (shared != child) {
+			shared->refcount++;
+			if (--child->refcount == 0) delete child;
+			child = shared;
+		}
+		key << " " << child;
+	}
+	return nodes.insert(std::make_pair(key.str(), node)).first->second;
+}
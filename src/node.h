@@ -2,13 +2,14 @@
 
 #include <vector>
 #include <string>
+#include <unordered_map>
 #include "BaseVisitable.h"
 
 extern int progress_report_count;
 extern void (*progress_report_f)(const class AbstractNode*, void*, int);
 extern void *progress_report_vp;
 
-void progress_report_prep(class AbstractNode *root, void (*f)(const class AbstractNode *node, void *vp, int mark), void *vp);
+void progress_report_prep(const class AbstractNode *root, void (*f)(const class AbstractNode *node, void *vp, int mark), void *vp, const class Tree *tree);
 void progress_report_fin();
 
 /*!  
@@ -29,6 +30,9 @@ public:
 	VISITABLE();
 	AbstractNode(const class ModuleInstantiation *mi);
 	virtual ~AbstractNode();
+	// Nodes are allocated from per-thread pools
+	static void *operator new(size_t size);
+	static void operator delete(void *ptr, size_t size);
 	virtual std::string toString() const;
 	/*! The 'OpenSCAD name' of this node, defaults to classname, but can be 
 	    overloaded to provide specialization for e.g. CSG nodes, primitive nodes etc.
@@ -40,7 +44,8 @@ public:
 	}
 	size_t index() const { return this->idx; }
 
-	static void resetIndexCounter() { idx_counter = 1; }
+	static void resetIndexCounter();
+	void reindex();
 
 	// FIXME: Make protected
 	std::vector<AbstractNode*> children;
@@ -48,11 +53,12 @@ public:
 
 	// progress_mark is a running number used for progress indication
 	// FIXME: Make all progress handling external, put it in the traverser class?
-	int progress_mark;
-	void progress_prepare();
+	mutable int progress_mark;
+	void progress_prepare() const;
 	void progress_report() const;
 
 	int idx; // Node index (unique per tree)
+	int refcount; // Number of parents sharing this node, see share_identical_subtrees()
 };
 
 class AbstractIntersectionNode : public AbstractNode
@@ -115,3 +121,7 @@ public:
 
 std::ostream &operator<<(std::ostream &stream, const AbstractNode &node);
 AbstractNode *find_root_tag(AbstractNode *n);
+size_t select_subtrees(AbstractNode *node, const std::vector<std::string> &modules);
+
+typedef std::unordered_map<std::string, AbstractNode *> SharedNodeMap;
+AbstractNode *share_identical_subtrees(AbstractNode *node, SharedNodeMap &nodes);
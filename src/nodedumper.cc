@@ -2,6 +2,7 @@
 #include "state.h"
 #include "module.h"
 #include "ModuleInstantiation.h"
+#include "hash.h"
 
 #include <string>
 #include <sstream>
@@ -13,11 +14,22 @@
 	A visitor responsible for creating a text dump of a node tree.  Also
 	contains a cache for fast retrieval of the text representation of
 	any node or subtree.
+
+	In hash-only mode, the cache instead receives a 128-bit structural hash
+	of each subtree, computed bottom-up from the node's own text and the
+	hashes of its children. Two subtrees get the same hash exactly when
+	their whitespace-stripped text dumps are equal, but the cost is linear
+	in the size of the tree rather than quadratic.
+
+	In streaming mode, the text dump of the traversed subtree is written to
+	a stream as nodes are visited, so its memory doesn't grow with the
+	depth of the tree. The output is the same as the cached text of the
+	subtree.
 */
 
 bool NodeDumper::isCached(const AbstractNode &node) const
 {
-	return this->cache.contains(node);
+	return this->cache && this->cache->contains(node);
 }
 
 /*!
@@ -61,7 +73,7 @@ std::string NodeDumper::dumpChildren(const AbstractNode &node)
 			 iter != this->visitedchildren[node.index()].end();
 			 iter++) {
 		assert(isCached(**iter));
-		const std::string &str = this->cache[**iter];
+		const std::string &str = (*this->cache)[**iter];
 		if (!str.empty()) {
             if (iter != this->visitedchildren[node.index()].begin()) dump << "\n";
 			if ((*iter)->modinst->isBackground()) dump << "%";
@@ -72,22 +84,97 @@ std::string NodeDumper::dumpChildren(const AbstractNode &node)
 	return dump.str();
 }
 
+/*!
+	Hashes the children contained in this->visitedchildren, including
+	their modifiers. All children are assumed to be cached already.
+*/
+std::string NodeDumper::hashChildren(const AbstractNode &node)
+{
+	std::string key;
+	for(const auto &child : this->visitedchildren[node.index()]) {
+		assert(isCached(*child));
+		if (child->modinst->isBackground()) key += "%";
+		if (child->modinst->isHighlight()) key += "#";
+		key += (*this->cache)[*child];
+	}
+	return key;
+}
+
+/*!
+	Writes the text of \a node to the stream: its line and the opening
+	brace of its children on the prefix visit, the closing brace on the
+	postfix visit.
+*/
+void NodeDumper::streamNode(const State &state, const AbstractNode &node)
+{
+	std::ostream &out = *this->output;
+	const bool haschildren = state.numChildren() > 0;
+	if (state.isPrefix()) {
+		if (state.parent()) {
+			if (!this->firstchild.back()) out << "\n";
+			this->firstchild.back() = false;
+			if (node.modinst->isBackground()) out << "%";
+			if (node.modinst->isHighlight()) out << "#";
+		}
+		out << this->currindent;
+		if (this->idprefix) out << "n" << node.index() << ":";
+		if (this->ids) out << "/*id:" << (*this->ids)[node] << "*/ ";
+		out << node;
+		if (haschildren) {
+			out << " {\n";
+			this->firstchild.push_back(true);
+		}
+		else {
+			out << ";";
+		}
+		this->currindent += "\t";
+	}
+	else if (state.isPostfix()) {
+		this->currindent.erase(this->currindent.length() - 1);
+		if (haschildren) {
+			this->firstchild.pop_back();
+			out << "\n" << this->currindent << "}";
+		}
+	}
+}
+
 /*!
 	Called for each node in the tree.
 	Will abort traversal if we're cached
 */
 Response NodeDumper::visit(State &state, const AbstractNode &node)
 {
-	if (isCached(node)) return PruneTraversal;
+	if (this->output) {
+		streamNode(state, node);
+		return ContinueTraversal;
+	}
+
+	if (isCached(node)) {
+		handleVisitedChildren(state, node);
+		return PruneTraversal;
+	}
+
+	if (this->hashonly) {
+		if (state.isPostfix()) {
+			std::string key = this->salt;
+			key += node.toString();
+			key += '\0';
+			key += hashChildren(node);
+			this->cache->insert(node, hash128(key).toString());
+		}
+		handleVisitedChildren(state, node);
+		return ContinueTraversal;
+	}
 
 	handleIndent(state);
 	if (state.isPostfix()) {
 		std::stringstream dump;
 		dump << this->currindent;
 		if (this->idprefix) dump << "n" << node.index() << ":";
+		if (this->ids) dump << "/*id:" << (*this->ids)[node] << "*/ ";
 		dump << node;
 		dump << dumpChildBlock(node);
-		this->cache.insert(node, dump.str());
+		this->cache->insert(node, dump.str());
 	}
 
 	handleVisitedChildren(state, node);
@@ -99,12 +186,35 @@ Response NodeDumper::visit(State &state, const AbstractNode &node)
 */
 Response NodeDumper::visit(State &state, const RootNode &node)
 {
-	if (isCached(node)) return PruneTraversal;
+	if (this->output) {
+		if (state.isPrefix()) this->firstchild.push_back(true);
+		else if (state.isPostfix()) this->firstchild.pop_back();
+		return ContinueTraversal;
+	}
+
+	if (isCached(node)) {
+		handleVisitedChildren(state, node);
+		return PruneTraversal;
+	}
 
 	if (state.isPostfix()) {
-		std::stringstream dump;
-		dump << dumpChildren(node);
-		this->cache.insert(node, dump.str());
+		if (this->hashonly) {
+			// Like the text dump, a root with a single unmodified child is
+			// equivalent to that child
+			const ChildList &children = this->visitedchildren[node.index()];
+			if (children.size() == 1 && !children.front()->modinst->isBackground() &&
+					!children.front()->modinst->isHighlight()) {
+				this->cache->insert(node, (*this->cache)[*children.front()]);
+			}
+			else {
+				this->cache->insert(node, hash128(this->salt + hashChildren(node)).toString());
+			}
+		}
+		else {
+			std::stringstream dump;
+			dump << dumpChildren(node);
+			this->cache->insert(node, dump.str());
+		}
 	}
 
 	handleVisitedChildren(state, node);
@@ -3,6 +3,8 @@
 #include <string>
 #include <map>
 #include <list>
+#include <vector>
+#include <ostream>
 #include "NodeVisitor.h"
 #include "node.h"
 #include "nodecache.h"
@@ -11,9 +13,18 @@ class NodeDumper : public NodeVisitor
 {
 public:
         /*! If idPrefix is true, we will output "n<id>:" in front of each node,
-          which is useful for debugging. */
-        NodeDumper(NodeCache &cache, bool idPrefix = false) :
-                cache(cache), idprefix(idPrefix), root(NULL) { }
+          which is useful for debugging.
+          If hashOnly is true, we will only store a structural hash of each
+          subtree instead of its full text, with salt mixed into each hash.
+          If ids is given, the id of each node is written in a comment in
+          front of it, as read by CSGLoader. */
+        NodeDumper(NodeCache &cache, bool idPrefix = false, bool hashOnly = false, const std::string &salt = std::string(),
+                   const NodeCache *ids = NULL) :
+                cache(&cache), output(NULL), idprefix(idPrefix), hashonly(hashOnly), salt(salt), ids(ids), root(NULL) { }
+        /*! Writes the text dump of the traversed subtree to stream as it
+          goes, without caching the text of each subtree. */
+        NodeDumper(std::ostream &stream, bool idPrefix = false, const NodeCache *ids = NULL) :
+                cache(NULL), output(&stream), idprefix(idPrefix), hashonly(false), ids(ids), root(NULL) { }
         virtual ~NodeDumper() {}
 
         virtual Response visit(State &state, const AbstractNode &node);
@@ -25,12 +36,19 @@ private:
         void handleIndent(const State &state);
         std::string dumpChildBlock(const AbstractNode &node);
         std::string dumpChildren(const AbstractNode &node);
+        std::string hashChildren(const AbstractNode &node);
+        void streamNode(const State &state, const AbstractNode &node);
 
-        NodeCache &cache;
+        NodeCache *cache;
+        std::ostream *output;
         bool idprefix;
+        bool hashonly;
+        std::string salt;
+        const NodeCache *ids;
 
         std::string currindent;
         const AbstractNode *root;
         typedef std::list<const AbstractNode *> ChildList;
         std::map<int, ChildList> visitedchildren;
+        std::vector<bool> firstchild; // While streaming, if no child of the node was written yet
 };
@@ -72,6 +72,7 @@ AbstractNode *OffsetModule::instantiate(const Context *ctx, const ModuleInstanti
 	const ValuePtr r = c.lookup_variable("r", true);
 	const ValuePtr delta = c.lookup_variable("delta", true);
 	const ValuePtr chamfer = c.lookup_variable("chamfer", true);
+	const ValuePtr tolerance = c.lookup_variable("tolerance", true);
 	
 	if (r->isDefinedAs(Value::NUMBER)) {
 	    r->getDouble(node->delta);
@@ -85,6 +86,11 @@ AbstractNode *OffsetModule::instantiate(const Context *ctx, const ModuleInstanti
 	    }
 	}
 	
+	if (tolerance->isDefinedAs(Value::NUMBER)) {
+		tolerance->getDouble(node->tolerance);
+		if (node->tolerance < 0) node->tolerance = 0;
+	}
+
 	std::vector<AbstractNode *> instantiatednodes = inst->instantiateChildren(evalctx);
 	node->children.insert(node->children.end(), instantiatednodes.begin(), instantiatednodes.end());
 
@@ -102,6 +108,9 @@ std::string OffsetNode::toString() const
 	if (!isRadius) {
 	    stream << ", chamfer = " << (this->chamfer ? "true" : "false");
 	}
+	if (this->tolerance > 0) {
+		stream << ", tolerance = " << this->tolerance;
+	}
 	stream  << ", $fn = " << this->fn
 		<< ", $fa = " << this->fa
 		<< ", $fs = " << this->fs << ")";
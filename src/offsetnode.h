@@ -8,12 +8,13 @@ class OffsetNode : public AbstractPolyNode
 {
 public:
 	VISITABLE();
-	OffsetNode(const ModuleInstantiation *mi) : AbstractPolyNode(mi), fn(0), fs(0), fa(0), delta(1), miter_limit(1000000.0), join_type(ClipperLib::jtRound) { }
+	OffsetNode(const ModuleInstantiation *mi) : AbstractPolyNode(mi), fn(0), fs(0), fa(0), delta(1), tolerance(0), miter_limit(1000000.0), join_type(ClipperLib::jtRound) { }
 	virtual std::string toString() const;
 	virtual std::string name() const { return "offset"; }
 
         bool chamfer;
 	double fn, fs, fa, delta;
+	double tolerance; // Maximum deviation of arcs from the true outline, 0 to use the fragments
         double miter_limit; // currently fixed high value to disable chamfers with jtMiter
         ClipperLib::JoinType join_type;
 };
@@ -31,6 +31,7 @@
 #include "modcontext.h"
 #include "value.h"
 #include "export.h"
+#include "imageutils.h"
 #include "builtin.h"
 #include "printutils.h"
 #include "handle_dep.h"
@@ -40,19 +41,42 @@
 #include "PlatformUtils.h"
 #include "LibraryInfo.h"
 #include "nodedumper.h"
+#include "CSGLoader.h"
+#include "importnode.h"
 #include "stackcheck.h"
 #include "CocoaUtils.h"
 #include "FontCache.h"
 #include "OffscreenView.h"
 #include "GeometryEvaluator.h"
+#include "PersistentCache.h"
+#include "GeometryCache.h"
+#include "GeometryBundle.h"
+#include "ModuleCache.h"
+#include "InstantiationCache.h"
+#include "CacheStats.h"
+#include "EvaluationBudget.h"
+#include "Profiler.h"
+#include "Timing.h"
+#include "EvaluationTrace.h"
+#include "ThreadPool.h"
+#include "Session.h"
+#include "progress.h"
 
 #include <string>
 #include <vector>
 #include <fstream>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <unordered_set>
 
 #ifdef ENABLE_CGAL
 #include "CGAL_Nef_polyhedron.h"
 #include "cgalutils.h"
+#include "polyset.h"
+#include "polyset-utils.h"
+#include "MeshValidator.h"
+#include "clipper-utils.h"
 #endif
 
 #include "csgnode.h"
@@ -61,9 +85,11 @@
 #include <sstream>
 
 #include "Camera.h"
+#include <algorithm>
 #include <boost/algorithm/string.hpp>
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/property_tree/json_parser.hpp>
 
 #ifdef __APPLE__
 #include "AppleEvents.h"
@@ -89,6 +115,18 @@ std::string commandline_commands;
 std::string currentdir;
 static bool arg_info = false;
 static std::string arg_colorscheme;
+static std::string arg_export_format;
+static std::string arg_camera_file;
+static std::vector<std::string> arg_select;
+static bool arg_deps_only = false;
+static unsigned int arg_animate = 0;
+static unsigned int arg_turntable = 0;
+static std::vector<double> arg_slices;
+static bool arg_progress = false;
+static bool arg_csg_ids = false;
+static double arg_fallback_time = 0;
+static bool arg_validate = false;
+static bool arg_threads = false;
 
 #define QUOTE(x__) # x__
 #define QUOTED(x__) QUOTE(x__)
@@ -111,19 +149,37 @@ std::string openscad_detailedversionnumber =
   openscad_versionnumber;
 #endif
 
+/*!
+	Writes the messages to a file while it exists. Within a session with an
+	output handler, like the jobs of --batch, only the session's messages
+	are redirected.
+*/
 class Echostream : public std::ofstream
 {
 public:
-	Echostream( const char * filename ) : std::ofstream( filename ) {
-		set_output_handler( &Echostream::output, this );
+	Echostream( const char * filename ) : std::ofstream( filename ), session(Session::current()) {
+		if (this->session && this->session->outputHandler()) {
+			this->previous = this->session->outputHandler();
+			this->previous_data = this->session->outputHandlerData();
+			this->session->setOutputHandler( &Echostream::output, this );
+		}
+		else {
+			this->session = NULL;
+			set_output_handler( &Echostream::output, this );
+		}
 	}
 	static void output( const std::string &msg, void *userdata ) {
 		Echostream *thisp = static_cast<Echostream*>(userdata);
 		*thisp << msg << "\n";
 	}
 	~Echostream() {
+		if (this->session) this->session->setOutputHandler( this->previous, this->previous_data );
 		this->close();
 	}
+private:
+	Session *session;
+	OutputHandlerFunc *previous;
+	void *previous_data;
 };
 
 static void help(const char *progname, bool failure = false)
@@ -133,18 +189,28 @@ static void help(const char *progname, bool failure = false)
   for (int i=0;i<tablen;i++) tabstr[i] = ' ';
   tabstr[tablen] = '\0';
 
-	PRINTB("Usage: %1% [ -o output_file [ -d deps_file ] ]\\\n"
-         "%2%[ -m make_command ] [ -D var=val [..] ] \\\n"
+	PRINTB("Usage: %1% [ -o output_file [ -o output_file ... ] [ --export-format=binstl|asciistl|... ] [ -d deps_file ] ]\\\n"
+         "%2%[ -m make_command ] [ -D var=val [..] ] [ --deps-only ] \\\n"
 	 "%2%[ --help ] print this help message and exit \\\n"
          "%2%[ --version ] [ --info ] \\\n"
          "%2%[ --camera=translatex,y,z,rotx,y,z,dist | \\\n"
-         "%2%  --camera=eyex,y,z,centerx,y,z ] \\\n"
+         "%2%  --camera=eyex,y,z,centerx,y,z ] [ --camera-file=file ] \\\n"
+         "%2%[ --select=module[,module...] ] \\\n"
+         "%2%[ --animate=frames ] [ --turntable=frames ] [ --slices=from:step:to|z[,z...] ] \\\n"
          "%2%[ --autocenter ] \\\n"
          "%2%[ --viewall ] \\\n"
          "%2%[ --imgsize=width,height ] [ --projection=(o)rtho|(p)ersp] \\\n"
+         "%2%[ --png-compression=0-9 ] [ --png-filter=none|sub|up|average|paeth|adaptive ] \\\n"
          "%2%[ --render | --preview[=throwntogether] ] \\\n"
          "%2%[ --colorscheme=[Cornfield|Sunset|Metallic|Starnight|BeforeDawn|Nature|DeepOcean] ] \\\n"
-         "%2%[ --csglimit=num ]"
+         "%2%[ --csglimit=num ] \\\n"
+         "%2%[ --cache-dir=directory [ --cache-size=MB ] ] [ --cache-url=url ] [ --cache-stats=file ] \\\n"
+         "%2%[ --cache-grid=mm ] \\\n"
+         "%2%[ --warm-cache ] [ --param-sets=file ] \\\n"
+         "%2%[ --server ] [ --batch=file ] \\\n"
+         "%2%[ --time-limit=seconds ] [ --node-time-limit=seconds ] [ --memory-limit=MB ] \\\n"
+         "%2%[ --memory-high-water=MB [ --spill-dir=directory ] ] [ --fallback-time=seconds ] \\\n"
+         "%2%[ --profile=file ] [ --timing[=file] ] [ --trace=file ]"
 #ifdef ENABLE_EXPERIMENTAL
          " [ --enable=<feature> ]"
 #endif
@@ -199,32 +265,38 @@ void localization_init() {
 	}
 }
 
-Camera get_camera(po::variables_map vm)
+/*!
+	Sets up \a camera from the comma separated numbers of a --camera option.
+*/
+static bool parse_camera(const std::string &spec, Camera &camera)
 {
-	Camera camera;
-
-	if (vm.count("camera")) {
-		vector<string> strs;
-		vector<double> cam_parameters;
-		split(strs, vm["camera"].as<string>(), is_any_of(","));
-		if ( strs.size()==6 || strs.size()==7 ) {
-			try {
-				for(const auto &s : strs) cam_parameters.push_back(lexical_cast<double>(s));
-				camera.setup(cam_parameters);
-			}
-			catch (bad_lexical_cast &) {
-				PRINT("Camera setup requires numbers as parameters");
-			}
-		} else {
-			PRINT("Camera setup requires either 7 numbers for Gimbal Camera");
-			PRINT("or 6 numbers for Vector Camera");
-			exit(1);
-		}
+	vector<string> strs;
+	vector<double> cam_parameters;
+	split(strs, spec, is_any_of(","));
+	if (strs.size() != 6 && strs.size() != 7) {
+		PRINT("Camera setup requires either 7 numbers for Gimbal Camera");
+		PRINT("or 6 numbers for Vector Camera");
+		return false;
 	}
-
+	try {
+		for(const auto &s : strs) cam_parameters.push_back(lexical_cast<double>(s));
+	}
+	catch (bad_lexical_cast &) {
+		PRINT("Camera setup requires numbers as parameters");
+		return false;
+	}
+	camera.setup(cam_parameters);
 	if (camera.type == Camera::GIMBAL) {
 		camera.gimbalDefaultTranslate();
 	}
+	return true;
+}
+
+Camera get_camera(po::variables_map vm)
+{
+	Camera camera;
+
+	if (vm.count("camera") && !parse_camera(vm["camera"].as<string>(), camera)) exit(1);
 
 	if (vm.count("viewall")) {
 		camera.viewall = true;
@@ -289,6 +361,126 @@ static bool checkAndExport(shared_ptr<const Geometry> root_geom, unsigned nd,
 	return true;
 }
 
+#ifdef ENABLE_CGAL
+/*!
+	Writes the output files of formats which only read the mesh of the
+	geometry, in parallel. A Nef polyhedron is converted to a PolySet
+	once for all of them, since CGAL objects can't be shared between
+	threads. Returns false if any export failed.
+*/
+static bool exportConcurrently(shared_ptr<const Geometry> root_geom, FileFormat stl_format,
+															 const char *stl_output_file, const char *off_output_file,
+															 const char *threemf_output_file, const char *dxf_output_file,
+															 const char *svg_output_file, const char *scadgeom_output_file,
+															 const char *shm_output_file)
+{
+	struct Export {
+		FileFormat format;
+		unsigned int dim;
+		const char *filename;
+	};
+	std::vector<Export> exports;
+	if (stl_output_file) exports.push_back({stl_format, 3, stl_output_file});
+	if (off_output_file) exports.push_back({OPENSCAD_OFF, 3, off_output_file});
+	if (threemf_output_file) exports.push_back({OPENSCAD_3MF, 3, threemf_output_file});
+	if (dxf_output_file) exports.push_back({OPENSCAD_DXF, 2, dxf_output_file});
+	if (svg_output_file) exports.push_back({OPENSCAD_SVG, 2, svg_output_file});
+	// Both 2D and 3D objects can be exported
+	if (scadgeom_output_file) exports.push_back({OPENSCAD_SCADGEOM, root_geom->getDimension(), scadgeom_output_file});
+	if (shm_output_file) exports.push_back({OPENSCAD_SHM, 3, shm_output_file});
+
+	if (exports.empty()) return true;
+	if (exports.size() == 1) return checkAndExport(root_geom, exports[0].dim, exports[0].format, exports[0].filename);
+
+	const CGAL_Nef_polyhedron *N = dynamic_cast<const CGAL_Nef_polyhedron *>(root_geom.get());
+	if (N && N->p3) {
+		if (!N->p3->is_simple()) {
+			PRINT("WARNING: Exported object may not be a valid 2-manifold and may need repair");
+		}
+		PolySet *ps = new PolySet(3);
+		shared_ptr<const Geometry> mesh(ps);
+		if (CGALUtils::createPolySetFromNefPolyhedron3(*N->p3, *ps)) {
+			PRINT("ERROR: Nef->PolySet failed");
+			return false;
+		}
+		ps->setConvexity(N->getConvexity());
+		root_geom = mesh;
+	}
+
+	std::vector<char> ok(exports.size(), false);
+	ThreadPool *pool = ThreadPool::instance();
+	ThreadPool::TaskGroup group;
+	for (size_t i = 0; i < exports.size(); i++) {
+		pool->run(group, [&exports, &ok, &root_geom, i]() {
+				const Export &e = exports[i];
+				ok[i] = checkAndExport(root_geom, e.dim, e.format, e.filename);
+			});
+	}
+	pool->wait(group);
+	return std::find(ok.begin(), ok.end(), false) == ok.end();
+}
+#endif
+
+#ifdef ENABLE_CGAL
+/*!
+	Checks that a 3D object is a valid solid before it's exported, printing
+	where it isn't. Returns false if it isn't.
+*/
+static bool validate_geometry(const shared_ptr<const Geometry> &root_geom)
+{
+	if (!root_geom || root_geom->getDimension() != 3 || root_geom->isEmpty()) return true;
+	shared_ptr<const PolySet> ps = dynamic_pointer_cast<const PolySet>(root_geom);
+	if (!ps) {
+		const CGAL_Nef_polyhedron *N = dynamic_cast<const CGAL_Nef_polyhedron *>(root_geom.get());
+		if (!N || !N->p3) return true;
+		PolySet *mesh = new PolySet(3);
+		ps.reset(mesh);
+		if (CGALUtils::createPolySetFromNefPolyhedron3(*N->p3, *mesh)) {
+			PRINT("ERROR: Nef->PolySet failed");
+			return false;
+		}
+	}
+	const MeshValidator::Report report = MeshValidator::validate(*ps);
+	if (report.isValid()) return true;
+	PRINT("ERROR: The top level object isn't a valid solid:");
+	report.print();
+	return false;
+}
+#endif
+
+/*!
+	Writes the cached geometry of the subtrees of the design which have
+	children to a geometry bundle, to be shipped with a library.
+*/
+static bool write_bundle(const Tree &tree, const char *filename)
+{
+	GeometryCache *cache = GeometryCache::instance();
+	std::vector<GeometryBundle::Object> objects;
+	std::unordered_set<std::string> ids;
+	std::vector<const AbstractNode *> pending(1, tree.root());
+	while (!pending.empty()) {
+		const AbstractNode *node = pending.back();
+		pending.pop_back();
+		if (node->children.empty()) continue;
+		pending.insert(pending.end(), node->children.begin(), node->children.end());
+		const std::string &id = tree.getIdString(*node);
+		if (!ids.insert(id).second) continue;
+		GeometryBundle::Object object;
+		object.id = id;
+		object.geom = cache->get(id);
+		if (object.geom) objects.push_back(object);
+#ifdef ENABLE_CGAL
+		// Nef polyhedra too, so they needn't be made from the meshes
+		shared_ptr<const CGAL_Nef_polyhedron> N = cache->getNef(id);
+		if (N && N != object.geom) {
+			object.geom = N;
+			objects.push_back(object);
+		}
+#endif
+	}
+	return GeometryBundle::write(filename, objects);
+}
+
 void set_render_color_scheme(const std::string color_scheme, const bool exit_if_not_found)
 {
 	if (color_scheme.empty()) {
@@ -313,17 +505,251 @@ void set_render_color_scheme(const std::string color_scheme, const bool exit_if_
 
 #include <QCoreApplication>
 
-int cmdline(const char *deps_output_file, const std::string &filename, Camera &camera, const char *output_file, const fs::path &original_path, Render::type renderer, int argc, char ** argv )
+/*!
+	Sets \a var to the output file \a file, failing if there already is
+	an output file of that format.
+*/
+static bool set_output_file(const char *&var, const char *file)
+{
+	if (var) {
+		PRINTB("Only one output file per format is supported, got %s and %s\n", var % file);
+		return false;
+	}
+	var = file;
+	return true;
+}
+
+/*!
+	Returns \a file with \a number added to its name, e.g. "frame.png" and
+	"00001" give "frame00001.png".
+*/
+static std::string numbered_file(const std::string &file, const std::string &number)
+{
+	const fs::path path(file);
+	return (path.parent_path() / (path.stem().string() + number + path.extension().string())).string();
+}
+
+/*!
+	Reads the views for --camera-file, one camera per line in the format of
+	--camera, optionally followed by the PNG file to write. Without a file
+	name, the n-th view goes to \a png_output_file with "-n" added to its
+	name. Empty lines and lines starting with '#' are ignored.
+*/
+static bool read_camera_file(const std::string &filename, const Camera &base,
+														 const std::string &png_output_file, std::vector<PngView> &views)
+{
+	std::ifstream ifs(filename.c_str());
+	if (!ifs.is_open()) {
+		PRINTB("Can't open camera file '%s'!\n", filename);
+		return false;
+	}
+	std::string line;
+	while (std::getline(ifs, line)) {
+		boost::algorithm::trim(line);
+		if (line.empty() || line[0] == '#') continue;
+		const size_t end = line.find_first_of(" \t");
+		PngView view;
+		view.camera = base;
+		if (!parse_camera(line.substr(0, end), view.camera)) return false;
+		if (end != std::string::npos) {
+			view.filename = boost::algorithm::trim_copy(line.substr(end));
+		}
+		else {
+			view.filename = numbered_file(png_output_file, str(boost::format("-%d") % (views.size() + 1)));
+		}
+		views.push_back(view);
+	}
+	return true;
+}
+
+/*!
+	Returns \a base turned around the z axis by \a angle degrees, for the
+	frames of --turntable.
+*/
+static Camera turntable_camera(const Camera &base, double angle)
+{
+	Camera camera = base;
+	if (camera.type == Camera::NONE) {
+		// The default view, as set up by Camera::viewAll()
+		camera.type = Camera::VECTOR;
+		camera.viewall = true;
+		camera.autocenter = true;
+	}
+	if (camera.type == Camera::GIMBAL) {
+		camera.object_rot.z() += angle;
+	}
+	else {
+		const Eigen::AngleAxisd rotation(-angle * M_PI / 180, Eigen::Vector3d::UnitZ());
+		camera.eye = camera.center + rotation * (camera.eye - camera.center);
+	}
+	return camera;
+}
+
+static size_t count_nodes(const AbstractNode &node)
+{
+	size_t count = 1;
+	for(const auto &child : node.children) count += count_nodes(*child);
+	return count;
+}
+
+/*!
+	Parses the heights of --slices, either "from:step:to" like a range, or a
+	comma separated list. Returns false if \a spec is invalid.
+*/
+static bool parse_slices(const std::string &spec, std::vector<double> &heights)
+{
+	std::vector<std::string> strs;
+	heights.clear();
+	try {
+		if (spec.find(':') != std::string::npos) {
+			boost::split(strs, spec, boost::is_any_of(":"));
+			if (strs.size() != 3) return false;
+			const double from = lexical_cast<double>(boost::algorithm::trim_copy(strs[0]));
+			const double step = lexical_cast<double>(boost::algorithm::trim_copy(strs[1]));
+			const double to = lexical_cast<double>(boost::algorithm::trim_copy(strs[2]));
+			if (!(step > 0) || !(to >= from) || (to - from) / step >= 100000) return false;
+			// Allow for rounding errors in the last step, like ranges do
+			const size_t count = size_t(std::floor((to - from) / step + 1e-9)) + 1;
+			for (size_t i = 0; i < count; i++) heights.push_back(from + i * step);
+		}
+		else {
+			boost::split(strs, spec, boost::is_any_of(","));
+			for(const auto &s : strs) heights.push_back(lexical_cast<double>(boost::algorithm::trim_copy(s)));
+		}
+	}
+	catch (bad_lexical_cast &) {
+		return false;
+	}
+	return !heights.empty();
+}
+
+#ifdef ENABLE_CGAL
+/*!
+	Slices the 3D object \a geom at each of \a heights, for the layers of
+	--slices. The mesh is swept once for all heights. A Nef polyhedron is
+	converted to a mesh for this, and objects which can't be sliced that way
+	are cut at each height with CGAL.
+*/
+static bool slice_layers(const shared_ptr<const Geometry> &geom, const std::vector<double> &heights,
+												 std::vector<ExportLayer> &layers)
+{
+	if (geom->getDimension() != 3) {
+		PRINT("Current top level object is not a 3D object.");
+		return false;
+	}
+	const CGAL_Nef_polyhedron *N = dynamic_cast<const CGAL_Nef_polyhedron *>(geom.get());
+	shared_ptr<const PolySet> ps = dynamic_pointer_cast<const PolySet>(geom);
+	if (N && N->p3) {
+		PolySet *mesh = new PolySet(3);
+		ps.reset(mesh);
+		if (CGALUtils::createPolySetFromNefPolyhedron3(*N->p3, *mesh)) ps.reset();
+	}
+	std::vector<std::vector<Outline2d>> outlines;
+	const bool sliced = ps && PolysetUtils::sliceLayers(*ps, heights, outlines);
+
+	const BoundingBox bbox = geom->getBoundingBox();
+	shared_ptr<const CGAL_Nef_polyhedron> nef;
+	layers.clear();
+	for (size_t i = 0; i < heights.size(); i++) {
+		const double z = heights[i];
+		ExportLayer layer;
+		layer.name = str(boost::format("z%g") % z);
+		Polygon2d *poly = sliced ? ClipperUtils::uniteNonZero(outlines[i]) : NULL;
+		if (!poly && !geom->isEmpty() && z >= bbox.min().z() && z <= bbox.max().z()) {
+			if (!nef) nef.reset(N ? new CGAL_Nef_polyhedron(*N) : CGALUtils::createNefPolyhedronFromGeometry(*geom));
+			if (nef && !nef->isEmpty()) {
+				CGAL_Nef_polyhedron cut(*nef);
+				cut.transform(Transform3d(Eigen::Translation3d(0, 0, -z)));
+				poly = CGALUtils::project(cut, true);
+			}
+		}
+		layer.polygon.reset(poly ? poly : new Polygon2d());
+		layers.push_back(layer);
+	}
+	return true;
+}
+
+static void write_progress(const ProgressStatus &status)
+{
+	flush_output();
+	std::cerr << boost::format("{\"progress\": %.4f, \"elapsed\": %.3f, \"remaining\": ") % status.fraction % status.elapsed;
+	if (status.remaining < 0) std::cerr << "null";
+	else std::cerr << boost::format("%.3f") % status.remaining;
+	std::cerr << ", \"nodes\": " << status.nodes << ", \"total\": " << status.total << "}" << std::endl;
+}
+
+/*!
+	Writes the progress to stderr as a JSON line, at most twice a second.
+*/
+static void report_progress(const AbstractNode *, void *, int)
+{
+	static double last = -1;
+	const ProgressStatus status = progress_status();
+	// A new evaluation starts again at 0
+	if (last >= 0 && status.elapsed >= last && status.elapsed < last + 0.5) return;
+	last = status.elapsed;
+	write_progress(status);
+}
+
+static shared_ptr<const Geometry> evaluate_geometry(GeometryEvaluator &geomevaluator, const Tree &tree, Render::type renderer)
+{
+	Timing::Phase phase("geometry");
+	if (arg_progress) progress_report_prep(tree.root(), report_progress, NULL, &tree);
+	// Force creation of CGAL objects (for testing)
+	shared_ptr<const Geometry> root_geom = geomevaluator.evaluateGeometry(*tree.root(), true);
+	if (arg_progress) {
+		ProgressStatus status = progress_status();
+		status.fraction = 1;
+		status.remaining = 0;
+		write_progress(status);
+		progress_report_fin();
+	}
+	if (geomevaluator.isApproximate(*tree.root())) {
+		PRINTB("WARNING: The result is approximate, as rendering took longer than %g seconds", arg_fallback_time);
+	}
+	if (!root_geom) root_geom.reset(new CGAL_Nef_polyhedron());
+	if (renderer == Render::CGAL && root_geom->getDimension() == 3) {
+		const CGAL_Nef_polyhedron *N = dynamic_cast<const CGAL_Nef_polyhedron*>(root_geom.get());
+		if (!N) {
+			N = CGALUtils::createNefPolyhedronFromGeometry(*root_geom);
+			root_geom.reset(N);
+			PRINT("Converted to Nef polyhedron");
+		}
+	}
+	phase.count("bytes", root_geom->memsize());
+	return root_geom;
+}
+#endif
+
+/*!
+	Changes the working directory, or only that of the current session, so
+	the concurrent jobs of --batch don't change it for each other.
+*/
+static void change_directory(const fs::path &path)
+{
+	Session *session = Session::current();
+	if (session) session->setDirectory(path.string());
+	else fs::current_path(path);
+}
+
+int cmdline(const char *deps_output_file, const std::string &filename, Camera &camera, const std::vector<std::string> &output_files, const fs::path &original_path, Render::type renderer, int argc, char ** argv )
 {
 #ifdef OPENSCAD_QTGUI
-	QCoreApplication app(argc, argv);
+	// The jobs of --server and --batch share the application
+	std::unique_ptr<QCoreApplication> app;
+	if (!QCoreApplication::instance()) app.reset(new QCoreApplication(argc, argv));
 	const std::string application_path = QCoreApplication::instance()->applicationDirPath().toLocal8Bit().constData();
 #else
 	const std::string application_path = fs::absolute(boost::filesystem::path(argv[0]).parent_path()).generic_string();
 #endif	
-	PlatformUtils::registerApplicationPath(application_path);
-	parser_init();
-	localization_init();
+	// Only once, as the jobs of --batch run concurrently
+	static std::once_flag initialized;
+	std::call_once(initialized, [&]() {
+			PlatformUtils::registerApplicationPath(application_path);
+			parser_init();
+			localization_init();
+			set_render_color_scheme(arg_colorscheme, true);
+		});
 
 	Tree tree;
 #ifdef ENABLE_CGAL
@@ -336,6 +762,7 @@ int cmdline(const char *deps_output_file, const std::string &filename, Camera &c
 	const char *stl_output_file = NULL;
 	const char *off_output_file = NULL;
 	const char *amf_output_file = NULL;
+	const char *threemf_output_file = NULL;
 	const char *dxf_output_file = NULL;
 	const char *svg_output_file = NULL;
 	const char *csg_output_file = NULL;
@@ -345,32 +772,109 @@ int cmdline(const char *deps_output_file, const std::string &filename, Camera &c
 	const char *echo_output_file = NULL;
 	const char *nefdbg_output_file = NULL;
 	const char *nef3_output_file = NULL;
+	const char *scadgeom_output_file = NULL;
+	const char *shm_output_file = NULL;
+	const char *bundle_output_file = NULL;
 
-	std::string suffix = fs::path(output_file).extension().generic_string();
-	boost::algorithm::to_lower( suffix );
-
-	if (suffix == ".stl") stl_output_file = output_file;
-	else if (suffix == ".off") off_output_file = output_file;
-	else if (suffix == ".amf") amf_output_file = output_file;
-	else if (suffix == ".dxf") dxf_output_file = output_file;
-	else if (suffix == ".svg") svg_output_file = output_file;
-	else if (suffix == ".csg") csg_output_file = output_file;
-	else if (suffix == ".png") png_output_file = output_file;
-	else if (suffix == ".ast") ast_output_file = output_file;
-	else if (suffix == ".term") term_output_file = output_file;
-	else if (suffix == ".echo") echo_output_file = output_file;
-	else if (suffix == ".nefdbg") nefdbg_output_file = output_file;
-	else if (suffix == ".nef3") nef3_output_file = output_file;
-	else {
-		PRINTB("Unknown suffix for output file %s\n", output_file);
+	if (arg_deps_only && !deps_output_file) {
+		PRINT("--deps-only requires a deps file given with -d\n");
 		return 1;
 	}
 
-	set_render_color_scheme(arg_colorscheme, true);
-	
+	if (output_files.size() > 1 && !arg_export_format.empty()) {
+		PRINT("--export-format can only be used with a single output file\n");
+		return 1;
+	}
+
+	FileFormat stl_format = OPENSCAD_STL;
+	for(const auto &file : output_files) {
+		const char *output_file = file.c_str();
+		if (file == "-" && arg_export_format.empty()) {
+			PRINT("Writing to standard output requires --export-format\n");
+			return 1;
+		}
+		std::string suffix = fs::path(output_file).extension().generic_string();
+		boost::algorithm::to_lower( suffix );
+
+		// An explicit format overrides the suffix
+		if (arg_export_format == "binstl") {
+			suffix = ".stl";
+			stl_format = OPENSCAD_STL_BINARY;
+		}
+		else if (arg_export_format == "asciistl") suffix = ".stl";
+		else if (!arg_export_format.empty()) suffix = "." + arg_export_format;
+
+		bool ok;
+		if (suffix == ".stl") ok = set_output_file(stl_output_file, output_file);
+		else if (suffix == ".off") ok = set_output_file(off_output_file, output_file);
+		else if (suffix == ".amf") ok = set_output_file(amf_output_file, output_file);
+		else if (suffix == ".3mf") ok = set_output_file(threemf_output_file, output_file);
+		else if (suffix == ".dxf") ok = set_output_file(dxf_output_file, output_file);
+		else if (suffix == ".svg") ok = set_output_file(svg_output_file, output_file);
+		else if (suffix == ".csg") ok = set_output_file(csg_output_file, output_file);
+		else if (suffix == ".png") ok = set_output_file(png_output_file, output_file);
+		else if (suffix == ".ast") ok = set_output_file(ast_output_file, output_file);
+		else if (suffix == ".term") ok = set_output_file(term_output_file, output_file);
+		else if (suffix == ".echo") ok = set_output_file(echo_output_file, output_file);
+		else if (suffix == ".nefdbg") ok = set_output_file(nefdbg_output_file, output_file);
+		else if (suffix == ".nef3") ok = set_output_file(nef3_output_file, output_file);
+		else if (suffix == ".scadgeom") ok = set_output_file(scadgeom_output_file, output_file);
+		else if (suffix == ".shm") ok = set_output_file(shm_output_file, output_file);
+		else if (suffix == ".scadbundle") ok = set_output_file(bundle_output_file, output_file);
+		else {
+			PRINTB("Unknown suffix for output file %s\n", output_file);
+			ok = false;
+		}
+		if (!ok) return 1;
+	}
+	if (!arg_slices.empty() && !dxf_output_file && !svg_output_file) {
+		PRINT("--slices requires a dxf or svg output file\n");
+		return 1;
+	}
+	std::vector<PngView> png_views;
+	if (!arg_camera_file.empty()) {
+		if (!png_output_file) {
+			PRINT("--camera-file requires a png output file\n");
+			return 1;
+		}
+		if (!read_camera_file(arg_camera_file, camera, png_output_file, png_views)) return 1;
+	}
+	// Frames of an animation or turntable, each rendered with its own camera
+	const unsigned int frames = std::max(arg_animate, arg_turntable);
+	if (frames > 0) {
+		if (!png_output_file || !arg_camera_file.empty()) {
+			PRINT("--animate and --turntable require a png output file and can't be used with --camera-file\n");
+			return 1;
+		}
+		// Subtrees reused between frames would be removed
+		if (arg_animate && !arg_select.empty()) {
+			PRINT("--select can't be used with --animate\n");
+			return 1;
+		}
+		if (arg_animate && arg_turntable && arg_animate != arg_turntable) {
+			PRINT("--animate and --turntable need the same number of frames\n");
+			return 1;
+		}
+		for (unsigned int i = 0; i < frames; i++) {
+			PngView view;
+			view.camera = arg_turntable ? turntable_camera(camera, 360.0 * i / frames) : camera;
+			view.filename = numbered_file(png_output_file, str(boost::format("%05d") % i));
+			png_views.push_back(view);
+		}
+	}
+
+	// Files written from the evaluated geometry
+	const bool geometry_output = stl_output_file || off_output_file || amf_output_file ||
+		threemf_output_file || dxf_output_file || svg_output_file || nefdbg_output_file ||
+		nef3_output_file || scadgeom_output_file || shm_output_file || bundle_output_file;
+	// Only the messages or the AST are written, so the design's objects aren't made
+	const bool evaluation_only = (echo_output_file || ast_output_file) && !geometry_output &&
+		!png_output_file && !csg_output_file && !term_output_file && !deps_output_file;
+
 	// Top context - this context only holds builtins
 	ModuleContext top_ctx;
 	top_ctx.registerBuiltin();
+	top_ctx.setEvaluationOnly(evaluation_only);
 #ifdef DEBUG
 	PRINTDB("Top ModuleContext:\n%s",top_ctx.dump(NULL, NULL));
 #endif
@@ -383,112 +887,182 @@ int cmdline(const char *deps_output_file, const std::string &filename, Camera &c
 	AbstractNode *root_node;
 	AbstractNode *absolute_root_node;
 	shared_ptr<const Geometry> root_geom;
-
-	handle_dep(filename);
-
-	std::ifstream ifs(filename.c_str());
-	if (!ifs.is_open()) {
-		PRINTB("Can't open input file '%s'!\n", filename.c_str());
-		return 1;
+	// Subtrees which don't depend on $t are reused by the frames of an animation
+	InstantiationCache instcache;
+	// Dependencies are recorded while instantiating, so all subtrees are loaded for them
+	CSGLoader csgloader(!deps_output_file);
+	bool csgloaded = false;
+
+	// An input file of "-" is read from standard input, as if it were in the current directory
+	const bool from_stdin = filename == "-";
+	fs::path fpath = from_stdin ? fs::path(Session::currentDirectory()) / "stdin.scad" : fs::absolute(fs::path(filename));
+	fs::path fparent = fpath.parent_path();
+	if (!from_stdin) handle_dep(filename);
+
+	{
+		Timing::Phase phase("parse");
+		std::ifstream ifs;
+		if (!from_stdin) {
+			ifs.open(filename.c_str());
+			if (!ifs.is_open()) {
+				PRINTB("Can't open input file '%s'!\n", filename.c_str());
+				return 1;
+			}
+		}
+		std::istream &input = from_stdin ? std::cin : ifs;
+		std::string text((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+		// Exported .csg files are loaded without the parser, unless they need it
+		root_module = NULL;
+		if (fpath.extension() == ".csg" && Session::commandlineCommands().empty()) {
+			root_module = csgloader.load(text, fpath);
+			csgloaded = root_module != NULL;
+		}
+		if (!root_module) {
+			text += "\n" + Session::commandlineCommands();
+			root_module = parse(text.c_str(), fpath, false);
+		}
+		if (!root_module) {
+			PRINTB("Can't parse file '%s'!\n", filename.c_str());
+			return 1;
+		}
+		phase.count("bytes", text.size());
 	}
-	std::string text((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
-	text += "\n" + commandline_commands;
-	fs::path abspath = fs::absolute(filename);
-	root_module = parse(text.c_str(), abspath, false);
-	if (!root_module) {
-		PRINTB("Can't parse file '%s'!\n", filename.c_str());
-		return 1;
+	{
+		Timing::Phase phase("dependencies");
+		root_module->handleDependencies();
 	}
-	root_module->handleDependencies();
 
-	fs::path fpath = fs::absolute(fs::path(filename));
-	fs::path fparent = fpath.parent_path();
-	fs::current_path(fparent);
+	change_directory(fparent);
 	top_ctx.setDocumentPath(fparent.string());
 
-	AbstractNode::resetIndexCounter();
-	absolute_root_node = root_module->instantiate(&top_ctx, &root_inst, NULL);
+	{
+		Timing::Phase phase("instantiate");
+		AbstractNode::resetIndexCounter();
+		if (evaluation_only && !echo_output_file) {
+			// The AST is dumped from the parsed module, so the design isn't run
+			absolute_root_node = new GroupNode(&root_inst);
+		}
+		else if (arg_animate) {
+			top_ctx.set_variable("$t", ValuePtr(0.0));
+			absolute_root_node = root_module->instantiate(&top_ctx, &root_inst, instcache);
+		}
+		else {
+			absolute_root_node = root_module->instantiate(&top_ctx, &root_inst, NULL);
+		}
+		if (Timing::instance()->isEnabled()) phase.count("nodes", count_nodes(*absolute_root_node));
+	}
+
+	if (arg_deps_only) {
+		// Files read by import(), surface() and the like were recorded while instantiating
+		change_directory(original_path);
+		std::vector<std::string> targets;
+		for(const auto &file : output_files) {
+			if (file != "-" && (png_views.empty() || file != png_output_file)) targets.push_back(file);
+		}
+		for(const auto &view : png_views) targets.push_back(view.filename);
+		const bool ok = write_deps(deps_output_file, boost::algorithm::join(targets, " "));
+		delete absolute_root_node;
+		delete root_module;
+		if (!ok) {
+			PRINT("error writing deps");
+			return 1;
+		}
+		return 0;
+	}
 
 	// Do we have an explicit root node (! modifier)?
 	if (!(root_node = find_root_tag(absolute_root_node)))
 		root_node = absolute_root_node;
 
+	if (!arg_select.empty()) {
+		const size_t selected = select_subtrees(root_node, arg_select);
+		if (selected == 0) PRINTB("WARNING: No objects of the modules %s found", boost::algorithm::join(arg_select, ", "));
+		else PRINTB("Selected %d objects", selected);
+	}
+
 	tree.setRoot(root_node);
+	if (csgloaded) csgloader.applyIds(*root_node, tree);
 
 	if (csg_output_file) {
-		fs::current_path(original_path);
-		std::ofstream fstream(csg_output_file);
-		if (!fstream.is_open()) {
+		change_directory(original_path);
+		const bool tostdout = std::string(csg_output_file) == "-";
+		std::ofstream fstream;
+		if (!tostdout) fstream.open(csg_output_file);
+		std::ostream &output = tostdout ? std::cout : fstream;
+		if (!tostdout && !fstream.is_open()) {
 			PRINTB("Can't open file \"%s\" for export", csg_output_file);
 		}
 		else {
-			fs::current_path(fparent); // Force exported filenames to be relative to document path
-			fstream << tree.getString(*root_node) << "\n";
-			fstream.close();
+			change_directory(fparent); // Force exported filenames to be relative to document path
+			tree.dump(output, *root_node, arg_csg_ids);
+			output << "\n";
 		}
 	}
-	else if (ast_output_file) {
-		fs::current_path(original_path);
-		std::ofstream fstream(ast_output_file);
-		if (!fstream.is_open()) {
+	if (ast_output_file) {
+		change_directory(original_path);
+		const bool tostdout = std::string(ast_output_file) == "-";
+		std::ofstream fstream;
+		if (!tostdout) fstream.open(ast_output_file);
+		std::ostream &output = tostdout ? std::cout : fstream;
+		if (!tostdout && !fstream.is_open()) {
 			PRINTB("Can't open file \"%s\" for export", ast_output_file);
 		}
 		else {
-			fs::current_path(fparent); // Force exported filenames to be relative to document path
-			fstream << root_module->dump("", "") << "\n";
-			fstream.close();
+			change_directory(fparent); // Force exported filenames to be relative to document path
+			output << root_module->dump("", "") << "\n";
 		}
 	}
-	else if (term_output_file) {
+	if (term_output_file) {
+		Timing::Phase phase("csgtree");
 		CSGTreeEvaluator csgRenderer(tree);
 		shared_ptr<CSGNode> root_raw_term = csgRenderer.buildCSGTree(*root_node);
 
-		fs::current_path(original_path);
-		std::ofstream fstream(term_output_file);
-		if (!fstream.is_open()) {
+		change_directory(original_path);
+		const bool tostdout = std::string(term_output_file) == "-";
+		std::ofstream fstream;
+		if (!tostdout) fstream.open(term_output_file);
+		std::ostream &output = tostdout ? std::cout : fstream;
+		if (!tostdout && !fstream.is_open()) {
 			PRINTB("Can't open file \"%s\" for export", term_output_file);
 		}
 		else {
 			if (!root_raw_term)
-				fstream << "No top-level CSG object\n";
+				output << "No top-level CSG object\n";
 			else {
-				fstream << root_raw_term->dump() << "\n";
+				output << root_raw_term->dump() << "\n";
 			}
-			fstream.close();
 		}
 	}
-	else {
+	change_directory(fparent);
+
+	if (geometry_output || png_output_file || echo_output_file) {
 #ifdef ENABLE_CGAL
-		if ((echo_output_file || png_output_file) &&
-				(renderer==Render::OPENCSG || renderer==Render::THROWNTOGETHER)) {
+		if (evaluation_only || (!geometry_output && (echo_output_file || png_output_file) &&
+				(renderer==Render::OPENCSG || renderer==Render::THROWNTOGETHER))) {
 			// echo or OpenCSG png -> don't necessarily need geometry evaluation
 		} else {
-			// Force creation of CGAL objects (for testing)
-			root_geom = geomevaluator.evaluateGeometry(*tree.root(), true);
-			if (!root_geom) root_geom.reset(new CGAL_Nef_polyhedron());
-			if (renderer == Render::CGAL && root_geom->getDimension() == 3) {
-				const CGAL_Nef_polyhedron *N = dynamic_cast<const CGAL_Nef_polyhedron*>(root_geom.get());
-				if (!N) {
-					N = CGALUtils::createNefPolyhedronFromGeometry(*root_geom);
-					root_geom.reset(N);
-					PRINT("Converted to Nef polyhedron");
-				}
-			}
+			root_geom = evaluate_geometry(geomevaluator, tree, renderer);
 		}
 
-		fs::current_path(original_path);
+		change_directory(original_path);
 
 		if (deps_output_file) {
 			std::string deps_out( deps_output_file );
+			// All files made from the geometry are targets
 			std::string geom_out;
-			if ( stl_output_file ) geom_out = std::string(stl_output_file);
-			else if ( off_output_file ) geom_out = std::string(off_output_file);
-			else if ( amf_output_file ) geom_out = std::string(amf_output_file);
-			else if ( dxf_output_file ) geom_out = std::string(dxf_output_file);
-			else if ( svg_output_file ) geom_out = std::string(svg_output_file);
-			else if ( png_output_file ) geom_out = std::string(png_output_file);
-			else {
-				PRINTB("Output file:%s\n",output_file);
+			const char *targets[] = { stl_output_file, off_output_file, amf_output_file, threemf_output_file,
+																dxf_output_file, svg_output_file, png_output_file, scadgeom_output_file };
+			for(const auto &target : targets) {
+				if (!target || (target == png_output_file && !png_views.empty())) continue;
+				if (!geom_out.empty()) geom_out += " ";
+				geom_out += target;
+			}
+			for(const auto &view : png_views) {
+				if (!geom_out.empty()) geom_out += " ";
+				geom_out += view.filename;
+			}
+			if (geom_out.empty()) {
+				PRINTB("Output file:%s\n", boost::algorithm::join(output_files, " "));
 				PRINT("Sorry, don't know how to write deps for that file type. Exiting\n");
 				return 1;
 			}
@@ -499,45 +1073,87 @@ int cmdline(const char *deps_output_file, const std::string &filename, Camera &c
 			}
 		}
 
-		if (stl_output_file) {
-			if (!checkAndExport(root_geom, 3, OPENSCAD_STL, stl_output_file))
-				return 1;
+		if (arg_validate && geometry_output) {
+			Timing::Phase validatephase("validate");
+			if (!validate_geometry(root_geom)) return 1;
 		}
 
-		if (off_output_file) {
-			if (!checkAndExport(root_geom, 3, OPENSCAD_OFF, off_output_file))
-				return 1;
+		Timing::Phase exportphase("export");
+		if (!arg_slices.empty()) {
+			// The slices go to the 2D files instead of the object itself
+			std::vector<ExportLayer> layers;
+			if (!slice_layers(root_geom, arg_slices, layers)) return 1;
+			if (dxf_output_file) exportLayersByName(layers, OPENSCAD_DXF, dxf_output_file, dxf_output_file);
+			if (svg_output_file) exportLayersByName(layers, OPENSCAD_SVG, svg_output_file, svg_output_file);
+			dxf_output_file = svg_output_file = NULL;
 		}
+		if (!exportConcurrently(root_geom, stl_format, stl_output_file, off_output_file, threemf_output_file,
+														dxf_output_file, svg_output_file, scadgeom_output_file, shm_output_file))
+			return 1;
+		if (bundle_output_file && !write_bundle(tree, bundle_output_file)) return 1;
 
 		if (amf_output_file) {
 			if (!checkAndExport(root_geom, 3, OPENSCAD_AMF, amf_output_file))
 				return 1;
 		}
 
-		if (dxf_output_file) {
-			if (!checkAndExport(root_geom, 2, OPENSCAD_DXF, dxf_output_file))
-				return 1;
-		}
-		
-		if (svg_output_file) {
-			if (!checkAndExport(root_geom, 2, OPENSCAD_SVG, svg_output_file))
-				return 1;
+		if (!png_views.empty()) {
+			PngWriter writer;
+			// An animation is evaluated again for each frame, other views are rendered at once
+			const size_t count = arg_animate ? 1 : png_views.size();
+			for (size_t frame = 0; frame < png_views.size(); frame += count) {
+				if (frame > 0) {
+					top_ctx.set_variable("$t", ValuePtr(double(frame) / png_views.size()));
+					change_directory(fparent);
+					instcache.detach(*absolute_root_node);
+					delete absolute_root_node;
+					tree.setRoot(NULL);
+					AbstractNode::resetIndexCounter();
+					absolute_root_node = root_module->instantiate(&top_ctx, &root_inst, instcache);
+					if (!(root_node = find_root_tag(absolute_root_node)))
+						root_node = absolute_root_node;
+					tree.setRoot(root_node);
+					instcache.restoreIds(tree);
+					if (csgloaded) csgloader.applyIds(*root_node, tree);
+					if (renderer==Render::CGAL || renderer==Render::GEOMETRY) {
+						root_geom = evaluate_geometry(geomevaluator, tree, renderer);
+					}
+					change_directory(original_path);
+				}
+				std::vector<PngView> views(png_views.begin() + frame, png_views.begin() + frame + count);
+				bool ok;
+				if (renderer==Render::CGAL || renderer==Render::GEOMETRY) {
+					ok = export_png(root_geom, views, writer);
+				} else if (renderer==Render::THROWNTOGETHER) {
+					ok = export_png_with_throwntogether(tree, views, writer);
+				} else {
+					ok = export_png_with_opencsg(tree, views, writer);
+				}
+				if (!ok) return 1;
+				if (arg_animate) {
+					tree.getIdString(*root_node);
+					instcache.saveIds(tree);
+				}
+			}
+			if (!writer.wait()) return 1;
 		}
-
-		if (png_output_file) {
-			std::ofstream fstream(png_output_file,std::ios::out|std::ios::binary);
-			if (!fstream.is_open()) {
+		else if (png_output_file) {
+			const bool tostdout = std::string(png_output_file) == "-";
+			std::ofstream fstream;
+			if (!tostdout) fstream.open(png_output_file,std::ios::out|std::ios::binary);
+			std::ostream &output = tostdout ? std::cout : fstream;
+			if (!tostdout && !fstream.is_open()) {
 				PRINTB("Can't open file \"%s\" for export", png_output_file);
 			}
 			else {
 				if (renderer==Render::CGAL || renderer==Render::GEOMETRY) {
-					export_png(root_geom, camera, fstream);
+					export_png(root_geom, camera, output);
 				} else if (renderer==Render::THROWNTOGETHER) {
-					export_png_with_throwntogether(tree, camera, fstream);
+					export_png_with_throwntogether(tree, camera, output);
 				} else {
-					export_png_with_opencsg(tree, camera, fstream);
+					export_png_with_opencsg(tree, camera, output);
 				}
-				fstream.close();
+				output.flush();
 			}
 		}
 
@@ -550,15 +1166,520 @@ int cmdline(const char *deps_output_file, const std::string &filename, Camera &c
 			if (!checkAndExport(root_geom, 3, OPENSCAD_NEF3, nef3_output_file))
 				return 1;
 		}
+
 #else
 		PRINT("OpenSCAD has been compiled without CGAL support!\n");
 		return 1;
 #endif
 	}
-	delete root_node;
+	delete absolute_root_node;
+	delete root_module;
+	return 0;
+}
+
+/*!
+	Returns the table cell \a value as an OpenSCAD expression: numbers,
+	booleans, undef, vectors and quoted strings are used as they are, any
+	other text becomes a string.
+*/
+static std::string parameter_value(std::string value)
+{
+	boost::algorithm::trim(value);
+	if (value == "true" || value == "false" || value == "undef") return value;
+	if (!value.empty() && (value[0] == '[' || value[0] == '"')) return value;
+	if (!value.empty() && (isdigit(value[0]) || value[0] == '-' || value[0] == '+' || value[0] == '.')) {
+		char *end;
+		strtod(value.c_str(), &end);
+		if (*end == '\0') return value;
+	}
+	std::string result = "\"";
+	for(const auto c : value) {
+		if (c == '"' || c == '\\') result += '\\';
+		result += c;
+	}
+	return result + "\"";
+}
+
+/*!
+	Splits a line of a CSV file into its fields. Fields may be quoted with
+	double quotes, doubled within them.
+*/
+static std::vector<std::string> split_csv(const std::string &line)
+{
+	std::vector<std::string> fields(1);
+	bool quoted = false;
+	for (size_t i = 0; i < line.size(); i++) {
+		const char c = line[i];
+		if (c == '"') {
+			if (quoted && i + 1 < line.size() && line[i + 1] == '"') fields.back() += line[++i];
+			else quoted = !quoted;
+		}
+		else if (c == ',' && !quoted) fields.push_back("");
+		else fields.back() += c;
+	}
+	return fields;
+}
+
+static std::string json_parameter_value(const boost::property_tree::ptree &pt)
+{
+	if (pt.empty()) return pt.data() == "null" ? "undef" : parameter_value(pt.data());
+	std::vector<std::string> values;
+	for(const auto &v : pt) values.push_back(json_parameter_value(v.second));
+	return "[" + boost::algorithm::join(values, ", ") + "]";
+}
+
+/*!
+	Reads parameter sets for --warm-cache and --param-sets, one set of
+	assignments per line (e.g. "width=10; height=20"). Empty lines and lines
+	starting with '#' are ignored.
+
+	A file ending in .csv holds a table instead, with the variable names in
+	the first row and one set per row. A file ending in .json holds an array
+	of objects, one set each. Empty cells keep the value from the file.
+*/
+static bool read_parameter_sets(const std::string &filename, std::vector<std::string> &paramsets)
+{
+	std::string suffix = fs::path(filename).extension().generic_string();
+	boost::algorithm::to_lower(suffix);
+	if (suffix == ".json") {
+		boost::property_tree::ptree pt;
+		try {
+			boost::property_tree::read_json(filename, pt);
+		}
+		catch (const boost::property_tree::json_parser_error &e) {
+			PRINTB("Can't read parameter file '%s': %s\n", filename % e.what());
+			return false;
+		}
+		for(const auto &set : pt) {
+			std::vector<std::string> assignments;
+			for(const auto &v : set.second) {
+				const std::string value = json_parameter_value(v.second);
+				if (value != "\"\"") assignments.push_back(v.first + "=" + value);
+			}
+			paramsets.push_back(boost::algorithm::join(assignments, "; "));
+		}
+		return true;
+	}
+
+	std::ifstream ifs(filename.c_str());
+	if (!ifs.is_open()) {
+		PRINTB("Can't open parameter file '%s'!\n", filename);
+		return false;
+	}
+	std::vector<std::string> names;
+	std::string line;
+	while (std::getline(ifs, line)) {
+		boost::algorithm::trim(line);
+		if (line.empty() || line[0] == '#') continue;
+		if (suffix != ".csv") {
+			paramsets.push_back(line);
+			continue;
+		}
+		const std::vector<std::string> fields = split_csv(line);
+		if (names.empty()) {
+			for(auto name : fields) names.push_back(boost::algorithm::trim_copy(name));
+			continue;
+		}
+		if (fields.size() > names.size()) {
+			PRINTB("Parameter file '%s' has more values than names in: %s\n", filename % line);
+			return false;
+		}
+		std::vector<std::string> assignments;
+		for (size_t i = 0; i < fields.size(); i++) {
+			if (boost::algorithm::trim_copy(fields[i]).empty()) continue;
+			assignments.push_back(names[i] + "=" + parameter_value(fields[i]));
+		}
+		paramsets.push_back(boost::algorithm::join(assignments, "; "));
+	}
+	return true;
+}
+
+/*!
+	Evaluates the geometry of \a filename once per parameter set, without
+	exporting anything, to populate the geometry caches. Combined with
+	--cache-dir, this prepares a persistent cache for later runs.
+*/
+int warmcache(const std::string &filename, const std::vector<std::string> &paramsets, int argc, char **argv)
+{
+#ifdef ENABLE_CGAL
+#ifdef OPENSCAD_QTGUI
+	QCoreApplication app(argc, argv);
+	const std::string application_path = QCoreApplication::instance()->applicationDirPath().toLocal8Bit().constData();
+#else
+	const std::string application_path = fs::absolute(boost::filesystem::path(argv[0]).parent_path()).generic_string();
+#endif	
+	PlatformUtils::registerApplicationPath(application_path);
+	parser_init();
+	localization_init();
+
+	if (!PersistentCache::instance()->isEnabled()) {
+		PRINT("WARNING: No --cache-dir given, the warmed cache will be discarded on exit");
+	}
+
+	std::ifstream ifs(filename.c_str());
+	if (!ifs.is_open()) {
+		PRINTB("Can't open input file '%s'!\n", filename.c_str());
+		return 1;
+	}
+	const std::string text((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+	const fs::path abspath = fs::absolute(filename);
+	const std::string base_commands = commandline_commands;
+
+	int rc = 0;
+	for (size_t i=0;i<paramsets.size();i++) {
+		if (!paramsets[i].empty()) PRINTB("Warming cache for parameter set %d/%d: %s", (i+1) % paramsets.size() % paramsets[i]);
+
+		// Libraries are compiled with the command line assignments too
+		commandline_commands = base_commands + paramsets[i] + (paramsets[i].empty() ? "" : ";\n");
+		if (i > 0) ModuleCache::instance()->clear();
+
+		FileModule *root_module = parse((text + "\n" + commandline_commands).c_str(), abspath, false);
+		if (!root_module) {
+			PRINTB("Can't parse file '%s'!\n", filename.c_str());
+			rc = 1;
+			continue;
+		}
+		root_module->handleDependencies();
+		fs::current_path(abspath.parent_path());
+
+		ModuleContext top_ctx;
+		top_ctx.registerBuiltin();
+		top_ctx.setDocumentPath(abspath.parent_path().string());
+		ModuleInstantiation root_inst("group");
+		AbstractNode::resetIndexCounter();
+		AbstractNode *absolute_root_node = root_module->instantiate(&top_ctx, &root_inst, NULL);
+		AbstractNode *root_node = find_root_tag(absolute_root_node);
+		if (!root_node) root_node = absolute_root_node;
+
+		Tree tree(root_node);
+		GeometryEvaluator geomevaluator(tree);
+		geomevaluator.evaluateGeometry(*root_node, true);
+
+		delete absolute_root_node;
+		delete root_module;
+	}
+	commandline_commands = base_commands;
+
+	GeometryCache::instance()->print();
+	PersistentCache::instance()->print();
+	return rc;
+#else
+	PRINT("OpenSCAD has been compiled without CGAL support!\n");
+	return 1;
+#endif
+}
+
+/*!
+	Renders \a filename once per parameter set, writing the output files
+	with "-n" added to their names for the n-th set. The variants are
+	evaluated one after another in the same process, so subtrees which
+	don't depend on the changed parameters are taken from the geometry
+	cache. The time limits apply to each variant, without the watchdog.
+*/
+static int sweep(const std::string &filename, const std::vector<std::string> &paramsets, const Camera &camera,
+								 const std::vector<std::string> &output_files, const fs::path &original_path, Render::type renderer, int argc, char **argv)
+{
+#ifdef OPENSCAD_QTGUI
+	QCoreApplication app(argc, argv);
+#endif
+	const std::string base_commands = commandline_commands;
+	int failed = 0;
+	for (size_t i=0;i<paramsets.size();i++) {
+		PRINTB("Variant %d/%d: %s", (i+1) % paramsets.size() % paramsets[i]);
+		// Libraries are compiled with the command line assignments too
+		commandline_commands = base_commands + paramsets[i] + (paramsets[i].empty() ? "" : ";\n");
+		if (i > 0) ModuleCache::instance()->clear();
+		std::vector<std::string> outputs;
+		for(const auto &file : output_files) outputs.push_back(numbered_file(file, str(boost::format("-%d") % (i+1))));
+
+		const EvaluationBudget::Clock::time_point start = EvaluationBudget::Clock::now();
+		Camera variant_camera = camera;
+		int rc;
+		EvaluationBudget::instance()->start();
+		try {
+			rc = cmdline(NULL, filename, variant_camera, outputs, original_path, renderer, argc, argv);
+		}
+		catch (const ProgressCancelException &e) {
+			rc = 1;
+		}
+		fs::current_path(original_path);
+		if (rc != 0) failed++;
+		const double seconds = std::chrono::duration<double>(EvaluationBudget::Clock::now() - start).count();
+		PRINTB("Variant %d/%d %s in %.3f s", (i+1) % paramsets.size() % (rc == 0 ? "done" : "failed") % seconds);
+	}
+	commandline_commands = base_commands;
+
+	if (failed) PRINTB("%d of %d variants failed", failed % paramsets.size());
+	GeometryCache::instance()->print();
+	return failed ? 1 : 0;
+}
+
+static std::string json_string(const std::string &s)
+{
+	std::string result = "\"";
+	for(const auto c : s) {
+		if (c == '"' || c == '\\') result += std::string("\\") + c;
+		else if (c == '\n') result += "\\n";
+		else if (c == '\t') result += "\\t";
+		else if ((unsigned char)c < 0x20) result += str(boost::format("\\u%04x") % int(c));
+		else result += c;
+	}
+	return result + "\"";
+}
+
+static void collect_message(const std::string &msg, void *userdata)
+{
+	static_cast<std::vector<std::string> *>(userdata)->push_back(msg);
+}
+
+/*!
+	Serves render jobs read from standard input until it ends or a line
+	"quit" is read, keeping the module, geometry and font caches warm
+	between jobs.
+
+	Each job is a line of arguments as on the command line, quoted like in
+	a shell: output files given with -o, -D assignments, --export-format
+	and the input file. An input file of "-" reads the source text from the
+	following lines, up to a line holding a single ".", with a leading "."
+	of other lines doubled. Each job is answered with a line of JSON on
+	standard output, holding its status, time and printed messages.
+	Output files with the suffix .shm are meshes in shared memory, laid
+	out as described in SharedMesh.h, which are complete once the job is
+	answered.
+
+	The other options given with --server apply to all jobs. The time
+	limits apply to each job, without the watchdog.
+*/
+static int server(Camera &camera, const fs::path &original_path, Render::type renderer, int argc, char **argv)
+{
+#ifdef OPENSCAD_QTGUI
+	QCoreApplication app(argc, argv);
+#endif
+	po::options_description desc;
+	desc.add_options()
+		("o,o", po::value<vector<string>>())
+		("D,D", po::value<vector<string>>())
+		("export-format", po::value<string>())
+		("input-file", po::value<string>());
+	po::positional_options_description p;
+	p.add("input-file", 1);
+
+	const std::string base_commands = commandline_commands;
+	const std::string base_format = arg_export_format;
+	std::string last_commands = base_commands;
+	int jobs = 0;
+	std::string line;
+	while (std::getline(std::cin, line)) {
+		boost::algorithm::trim(line);
+		if (line.empty() || line[0] == '#') continue;
+		if (line == "quit") break;
+		jobs++;
+
+		const EvaluationBudget::Clock::time_point start = EvaluationBudget::Clock::now();
+		std::vector<std::string> messages;
+		int rc = 0;
+		fs::path sourcefile;
+		try {
+			po::variables_map vm;
+			po::store(po::command_line_parser(po::split_unix(line)).options(desc).positional(p).run(), vm);
+			po::notify(vm);
+			if (!vm.count("input-file") || !vm.count("o")) throw std::runtime_error("A job needs an input file and at least one -o");
+
+			std::string inputfile = vm["input-file"].as<string>();
+			if (inputfile == "-") {
+				sourcefile = fs::temp_directory_path() / fs::unique_path("openscad-server-%%%%-%%%%-%%%%.scad");
+				std::ofstream fstream(sourcefile.string().c_str());
+				std::string source;
+				while (std::getline(std::cin, source) && source != ".") {
+					if (boost::starts_with(source, "..")) source.erase(0, 1);
+					fstream << source << "\n";
+				}
+				if (!fstream) throw std::runtime_error("Can't write " + sourcefile.string());
+				inputfile = sourcefile.string();
+			}
+
+			commandline_commands = base_commands;
+			if (vm.count("D")) {
+				for(const auto &cmd : vm["D"].as<vector<string>>()) commandline_commands += cmd + ";\n";
+			}
+			// Libraries are compiled with the command line assignments too
+			if (commandline_commands != last_commands) ModuleCache::instance()->clear();
+			last_commands = commandline_commands;
+			arg_export_format = vm.count("export-format") ? vm["export-format"].as<string>() : base_format;
+
+			set_output_handler(collect_message, &messages);
+			EvaluationBudget::instance()->start();
+			try {
+				rc = cmdline(NULL, inputfile, camera, vm["o"].as<vector<string>>(), original_path, renderer, argc, argv);
+			}
+			catch (const ProgressCancelException &e) {
+				rc = 1;
+			}
+			set_output_handler(NULL, NULL);
+		}
+		catch (const std::exception &e) {
+			set_output_handler(NULL, NULL);
+			messages.push_back(std::string("ERROR: ") + e.what());
+			rc = 2;
+		}
+		if (!sourcefile.empty()) fs::remove(sourcefile);
+		fs::current_path(original_path);
+
+		const double seconds = std::chrono::duration<double>(EvaluationBudget::Clock::now() - start).count();
+		std::cout << boost::format("{\"job\": %d, \"status\": %d, \"seconds\": %.3f, \"messages\": [") % jobs % rc % seconds;
+		for (size_t i = 0; i < messages.size(); i++) std::cout << (i > 0 ? ", " : "") << json_string(messages[i]);
+		std::cout << "]}" << std::endl;
+	}
+	commandline_commands = base_commands;
+	arg_export_format = base_format;
 	return 0;
 }
 
+/*!
+	A job of --batch: a document and the files exported from it.
+*/
+struct BatchJob
+{
+	std::string line;
+	std::string input;
+	std::vector<std::string> outputs;
+	std::string commands;
+	Camera camera;
+	Render::type renderer;
+	std::string error; // of the job line
+};
+
+/*!
+	Evaluates the jobs in \a jobsfile ("-" for stdin), one command line
+	per line, on several threads within this process. Each job is evaluated
+	in its own Session, with its own libraries, assignments and working
+	directory, while the geometry caches are shared.
+*/
+static int batch(const std::string &jobsfile, const Camera &camera, const fs::path &original_path, Render::type renderer, int argc, char **argv)
+{
+#ifdef OPENSCAD_QTGUI
+	QCoreApplication app(argc, argv);
+#endif
+	po::options_description desc;
+	desc.add_options()
+		("o,o", po::value<vector<string>>())
+		("D,D", po::value<vector<string>>())
+		("render", po::value<string>()->implicit_value(""))
+		("preview", po::value<string>()->implicit_value(""))
+		("camera", po::value<string>())
+		("autocenter", "")
+		("viewall", "")
+		("imgsize", po::value<string>())
+		("projection", po::value<string>())
+		("input-file", po::value<string>());
+	po::positional_options_description p;
+	p.add("input-file", 1);
+
+	std::ifstream ifs;
+	if (jobsfile != "-") {
+		ifs.open(jobsfile.c_str());
+		if (!ifs.is_open()) {
+			PRINTB("Can't open batch file '%s'", jobsfile);
+			return 1;
+		}
+	}
+	std::istream &input = jobsfile == "-" ? std::cin : ifs;
+
+	std::vector<BatchJob> jobs;
+	std::string line;
+	while (std::getline(input, line)) {
+		boost::algorithm::trim(line);
+		if (line.empty() || line[0] == '#') continue;
+		BatchJob job;
+		job.line = line;
+		job.camera = camera;
+		job.renderer = renderer;
+		try {
+			po::variables_map vm;
+			po::store(po::command_line_parser(po::split_unix(line)).options(desc).positional(p).run(), vm);
+			po::notify(vm);
+			if (!vm.count("input-file") || !vm.count("o")) throw std::runtime_error("A job needs an input file and at least one -o");
+			// The jobs don't share the working directory, so paths are made absolute here
+			job.input = vm["input-file"].as<string>();
+			job.outputs = vm["o"].as<vector<string>>();
+			if (job.input == "-" || std::find(job.outputs.begin(), job.outputs.end(), "-") != job.outputs.end()) {
+				throw std::runtime_error("Jobs can't use standard input or output");
+			}
+			job.input = fs::absolute(job.input, original_path).string();
+			for(auto &output : job.outputs) {
+				if (output != "null") output = fs::absolute(output, original_path).string();
+			}
+			if (vm.count("D")) {
+				for(const auto &cmd : vm["D"].as<vector<string>>()) job.commands += cmd + ";\n";
+			}
+			if (vm.count("camera") || vm.count("autocenter") || vm.count("viewall") || vm.count("imgsize") || vm.count("projection")) {
+				job.camera = get_camera(vm);
+			}
+			if (vm.count("preview")) {
+				job.renderer = vm["preview"].as<string>() == "throwntogether" ? Render::THROWNTOGETHER : Render::OPENCSG;
+			}
+			else if (vm.count("render")) {
+				job.renderer = vm["render"].as<string>() == "cgal" ? Render::CGAL : Render::GEOMETRY;
+			}
+		}
+		catch (const std::exception &e) {
+			job.error = e.what();
+		}
+		jobs.push_back(job);
+	}
+
+	// Progress is estimated for one document at a time
+	arg_progress = false;
+	const std::string base_commands = commandline_commands;
+	std::atomic<size_t> next(0);
+	std::mutex resultmutex;
+	int failed = 0;
+	auto work = [&]() {
+		for (size_t i; (i = next++) < jobs.size(); ) {
+			BatchJob &job = jobs[i];
+			const EvaluationBudget::Clock::time_point start = EvaluationBudget::Clock::now();
+			std::vector<std::string> messages;
+			int rc = 2;
+			if (!job.error.empty()) {
+				messages.push_back("ERROR: " + job.error);
+			}
+			else {
+				Session session(collect_message, &messages);
+				session.setCommands(base_commands + job.commands);
+				session.setDirectory(original_path.string());
+				Session::Scope scope(&session);
+				try {
+					rc = cmdline(NULL, job.input, job.camera, job.outputs, original_path, job.renderer, argc, argv);
+				}
+				catch (const ProgressCancelException &e) {
+					rc = 1;
+				}
+				catch (const std::exception &e) {
+					PRINTB("ERROR: %s", e.what());
+				}
+			}
+			const double seconds = std::chrono::duration<double>(EvaluationBudget::Clock::now() - start).count();
+
+			std::lock_guard<std::mutex> lock(resultmutex);
+			if (rc != 0) failed++;
+			std::cout << boost::format("{\"job\": %d, \"line\": %s, \"status\": %d, \"seconds\": %.3f, \"messages\": [") %
+				(i + 1) % json_string(job.line) % rc % seconds;
+			for (size_t j = 0; j < messages.size(); j++) std::cout << (j > 0 ? ", " : "") << json_string(messages[j]);
+			std::cout << "]}" << std::endl;
+		}
+	};
+
+	// The jobs wait for geometry tasks on the shared ThreadPool, so they get
+	// threads of their own, as many as the pool has
+	const size_t numthreads = std::min<size_t>(ThreadPool::instance()->size(), jobs.size());
+	std::vector<std::thread> workers;
+	for (size_t i = 0; i < numthreads; i++) workers.push_back(std::thread(work));
+	for(auto &worker : workers) worker.join();
+
+	if (failed > 0) PRINTB("%d of %d jobs failed", failed % jobs.size());
+	return failed > 0 ? 1 : 0;
+}
+
 #ifdef OPENSCAD_QTGUI
 #include <QtPlugin>
 #if defined(__MINGW64__) || defined(__MINGW32__) || defined(_MSCVER)
@@ -675,6 +1796,9 @@ int gui(vector<string> &inputFiles, const fs::path &original_path, int argc, cha
 	if (settings.value("advanced/localization", true).toBool()) {
 	        localization_init();
 	}
+	if (!arg_threads) {
+		ThreadPool::setDefaultSize(settings.value("advanced/threads", 0).toUInt());
+	}
 
 #ifdef Q_OS_MAC
 	installAppleEventHandlers();
@@ -779,12 +1903,14 @@ int main(int argc, char **argv)
 	// Causes CGAL errors to abort directly instead of throwing exceptions
 	// (which we don't catch). This gives us stack traces without rerunning in gdb.
 	CGAL::set_error_behaviour(CGAL::ABORT);
+	// Track GMP heap usage so cache memory estimates can be compared to reality
+	CGALUtils::enableGmpMemoryTracking();
 #endif
 	Builtins::instance()->initialize();
 
 	fs::path original_path = fs::current_path();
 
-	const char *output_file = NULL;
+	std::vector<std::string> output_files;
 	const char *deps_output_file = NULL;
 
 	po::options_description desc("Allowed options");
@@ -796,14 +1922,46 @@ int main(int argc, char **argv)
 		("preview", po::value<string>()->implicit_value(""), "if exporting a png image, do an OpenCSG(default) or ThrownTogether preview")
 		("csglimit", po::value<unsigned int>(), "if exporting a png image, stop rendering at the given number of CSG elements")
 		("camera", po::value<string>(), "parameters for camera when exporting png")
+		("deps-only", "with -d, only parse and instantiate the design to write the dependencies, without evaluating or exporting anything")
+		("select", po::value<string>(), "=module[,module...] only evaluate and export the objects instantiated from the given modules, in their place")
+		("camera-file", po::value<string>(), "file with one camera per line, optionally followed by the png file, to render many views at once")
+		("animate", po::value<unsigned int>(), "=frames, export numbered png files of an animation, with $t going from 0 to 1")
+		("turntable", po::value<unsigned int>(), "=frames, export numbered png files of the design turning around the z axis")
+		("slices", po::value<string>(), "=from:step:to or a list of heights, export the sections of the 3D design at the given heights as the layers of the dxf or svg file")
 		("autocenter", "adjust camera to look at object center")
 		("viewall", "adjust camera to fit object")
 		("imgsize", po::value<string>(), "=width,height for exporting png")
 		("projection", po::value<string>(), "(o)rtho or (p)erspective when exporting png")
 		("colorscheme", po::value<string>(), "colorscheme")
+		("png-compression", po::value<int>(), "compression level of exported png files, 0 (none) to 9 (smallest), default 6; 1 is fastest")
+		("png-filter", po::value<string>(), "row filter of exported png files: none (fastest), sub, up, average, paeth or adaptive (default)")
+		("cache-dir", po::value<string>(), "directory of a persistent geometry cache shared between runs")
+		("cache-url", po::value<string>(), "http:// URL of a geometry cache shared between machines, storing objects with PUT and GET")
+		("threads", po::value<unsigned int>(), "number of threads for parallel work, 0 for one per core the process may use (default)")
+		("cache-size", po::value<unsigned int>(), "size limit in MB of the persistent geometry cache")
+		("cache-stats", po::value<string>(), "write cache statistics as JSON to the given file ('-' for stdout) on exit")
+		("csg-ids", "write the id of each object into .csg output files, so they load with the cached geometry of their objects")
+		("cache-grid", po::value<double>(), "snap Nef polyhedra to a grid of the given size in mm when caching them, keeping their exact numbers small")
+		("simplify-imports", po::value<string>(), "=error[,faces] simplify imported meshes of more than faces (default 100000) triangles, moving their surface at most about error mm")
+		("server", "read render jobs from stdin, one command line per line, keeping the caches warm between jobs")
+		("batch", po::value<string>(), "evaluate the jobs in the given file ('-' for stdin), one command line per line, concurrently in this process")
+		("warm-cache", "only evaluate geometry to populate the caches, without exporting")
+		("param-sets", po::value<string>(), "file with one set of -D style assignments per line, or a .csv or .json table of them, to warm the cache with or to export each variant to the output files numbered -1, -2, ...")
+		("time-limit", po::value<double>(), "abort if evaluation takes longer than the given number of seconds")
+		("node-time-limit", po::value<double>(), "abort if a single object takes longer than the given number of seconds")
+		("memory-limit", po::value<unsigned int>(), "abort if the process uses more than the given number of MB")
+		("memory-high-water", po::value<unsigned int>(), "move cached geometry to disk while the process uses more than the given number of MB")
+		("spill-dir", po::value<string>(), "directory for geometry moved to disk by --memory-high-water, if there is no --cache-dir")
+		("fallback-time", po::value<double>(), "approximate Boolean operations not done after the given number of seconds, finishing them in the background for the cache")
+		("profile", po::value<string>(), "write the time spent in modules, functions and objects to the given file ('-' for stdout) in flamegraph folded format")
+		("validate", "check that 3D objects are closed, consistently oriented 2-manifolds without intersecting faces before exporting them, failing with the positions of any problems")
+		("progress", "write the progress of the geometry evaluation, with the estimated time left, as JSON lines to stderr")
+		("timing", po::value<string>()->implicit_value(""), "print the time, CPU time and peak memory of each phase and the slowest objects, or write them as JSON to the given file ('-' for stdout)")
+		("trace", po::value<string>(), "write a trace of the evaluation of each object, in the trace event format of chrome://tracing, to the given file ('-' for stdout)")
 		("debug", po::value<string>(), "special debug info")
 		("quiet,q", "quiet mode (don't print anything *except* errors)")
-		("o,o", po::value<string>(), "out-file")
+		("o,o", po::value<vector<string>>(), "out-file, may be given several times to export several formats from one evaluation")
+		("export-format", po::value<string>(), "overrides the format given by the out-file suffix: binstl, asciistl, off, amf, ...")
 		("s,s", po::value<string>(), "stl-file")
 		("x,x", po::value<string>(), "dxf-file")
 		("d,d", po::value<string>(), "deps-file")
@@ -859,20 +2017,83 @@ int main(int argc, char **argv)
 		RenderSettings::inst()->openCSGTermLimit = vm["csglimit"].as<unsigned int>();
 	}
 
+	if (vm.count("threads")) {
+		ThreadPool::setDefaultSize(vm["threads"].as<unsigned int>());
+		arg_threads = true;
+	}
+
+	if (vm.count("cache-size")) {
+		PersistentCache::instance()->setMaxSize(size_t(vm["cache-size"].as<unsigned int>())*1024*1024);
+	}
+	if (vm.count("cache-dir")) {
+		PersistentCache::instance()->setDirectory(vm["cache-dir"].as<string>());
+	}
+	if (vm.count("cache-url")) {
+		if (!PersistentCache::instance()->setRemote(vm["cache-url"].as<string>())) return 1;
+	}
+	if (vm.count("cache-grid")) {
+		GeometryCache::instance()->setNefGrid(vm["cache-grid"].as<double>());
+	}
+	if (vm.count("simplify-imports")) {
+		std::vector<std::string> strs;
+		boost::split(strs, vm["simplify-imports"].as<string>(), boost::is_any_of(","));
+		try {
+			if (strs.size() > 2) throw bad_lexical_cast();
+			ImportNode::defaultsimplifyerror = lexical_cast<double>(boost::algorithm::trim_copy(strs[0]));
+			if (strs.size() == 2) ImportNode::defaultsimplifyfaces = lexical_cast<size_t>(boost::algorithm::trim_copy(strs[1]));
+		}
+		catch (bad_lexical_cast &) {
+			PRINT("--simplify-imports needs a maximum error and optionally a number of faces: error[,faces]\n");
+			return 1;
+		}
+	}
+
+	EvaluationBudget *budget = EvaluationBudget::instance();
+	const double timelimit = vm.count("time-limit") ? vm["time-limit"].as<double>() : 0;
+	budget->setTimeLimit(timelimit);
+	if (vm.count("node-time-limit")) budget->setNodeTimeLimit(vm["node-time-limit"].as<double>());
+	if (vm.count("memory-limit")) budget->setMemoryLimit(size_t(vm["memory-limit"].as<unsigned int>())*1024*1024);
+	if (vm.count("fallback-time")) {
+		arg_fallback_time = vm["fallback-time"].as<double>();
+		budget->setFallbackTime(arg_fallback_time);
+	}
+	// Spilled geometry goes to the persistent cache if there is one, else to
+	// a directory of its own, which is removed on return
+	struct SpillDirectory {
+		fs::path path;
+		~SpillDirectory() {
+			boost::system::error_code ec;
+			if (!this->path.empty()) fs::remove_all(this->path, ec);
+		}
+	} spilldir;
+	if (vm.count("memory-high-water")) {
+		budget->setHighWaterMark(size_t(vm["memory-high-water"].as<unsigned int>())*1024*1024);
+		if (!PersistentCache::instance()->isEnabled()) {
+			const fs::path parent = vm.count("spill-dir") ? fs::path(vm["spill-dir"].as<string>()) : fs::temp_directory_path();
+			spilldir.path = parent / fs::unique_path("openscad-spill-%%%%-%%%%-%%%%");
+			GeometryCache::instance()->setSpillDirectory(spilldir.path.string());
+		}
+	}
+
+	if (vm.count("profile")) Profiler::instance()->enable(true);
+	if (vm.count("timing")) Timing::instance()->enable(true);
+	if (vm.count("progress")) arg_progress = true;
+	if (vm.count("csg-ids")) arg_csg_ids = true;
+	if (vm.count("validate")) arg_validate = true;
+	if (vm.count("trace")) EvaluationTrace::instance()->enable(true);
+
 	if (vm.count("o")) {
-		// FIXME: Allow for multiple output files?
-		if (output_file) help(argv[0], true);
-		output_file = vm["o"].as<string>().c_str();
+		output_files = vm["o"].as<vector<string>>();
 	}
 	if (vm.count("s")) {
 		printDeprecation("The -s option is deprecated. Use -o instead.\n");
-		if (output_file) help(argv[0], true);
-		output_file = vm["s"].as<string>().c_str();
+		if (!output_files.empty()) help(argv[0], true);
+		output_files.push_back(vm["s"].as<string>());
 	}
 	if (vm.count("x")) { 
 		printDeprecation("The -x option is deprecated. Use -o instead.\n");
-		if (output_file) help(argv[0], true);
-		output_file = vm["x"].as<string>().c_str();
+		if (!output_files.empty()) help(argv[0], true);
+		output_files.push_back(vm["x"].as<string>());
 	}
 	if (vm.count("d")) {
 		if (deps_output_file) help(argv[0], true);
@@ -904,6 +2125,44 @@ int main(int argc, char **argv)
 	if (vm.count("colorscheme")) {
 		arg_colorscheme = vm["colorscheme"].as<string>();
 	}
+	if (vm.count("deps-only")) {
+		arg_deps_only = true;
+	}
+	if (vm.count("png-compression")) {
+		const int level = vm["png-compression"].as<int>();
+		if (level < 0 || level > 9) {
+			PRINT("ERROR: --png-compression must be between 0 and 9");
+			return 1;
+		}
+		PngOptions::defaults().level = level;
+	}
+	if (vm.count("png-filter") && !PngOptions::parseFilter(vm["png-filter"].as<string>(), PngOptions::defaults().filter)) {
+		PRINTB("ERROR: Unknown --png-filter \"%s\"", vm["png-filter"].as<string>());
+		return 1;
+	}
+	if (vm.count("select")) {
+		boost::split(arg_select, vm["select"].as<string>(), boost::is_any_of(","));
+		for(auto &name : arg_select) boost::algorithm::trim(name);
+	}
+	if (vm.count("camera-file")) {
+		arg_camera_file = vm["camera-file"].as<string>();
+	}
+	if (vm.count("animate")) {
+		arg_animate = vm["animate"].as<unsigned int>();
+	}
+	if (vm.count("turntable")) {
+		arg_turntable = vm["turntable"].as<unsigned int>();
+	}
+	if (vm.count("slices")) {
+		if (!parse_slices(vm["slices"].as<string>(), arg_slices)) {
+			PRINTB("Invalid --slices '%s', expected from:step:to or a list of heights", vm["slices"].as<string>());
+			return 1;
+		}
+	}
+	if (vm.count("export-format")) {
+		arg_export_format = vm["export-format"].as<string>();
+		boost::algorithm::to_lower(arg_export_format);
+	}
 
 	currentdir = fs::current_path().generic_string();
 
@@ -914,14 +2173,57 @@ int main(int argc, char **argv)
 	NodeDumper dumper(nodecache);
 
 	bool cmdlinemode = false;
-	if (output_file) { // cmd-line mode
+	if (!output_files.empty()) { // cmd-line mode
 		cmdlinemode = true;
 		if (!inputFiles.size()) help(argv[0], true);
 	}
 
-	if (arg_info || cmdlinemode) {
+	if (vm.count("server")) {
+		if (!inputFiles.empty() || !output_files.empty()) help(argv[0], true);
+		rc = server(camera, original_path, renderer, argc, argv);
+	}
+	else if (vm.count("batch")) {
+		if (!inputFiles.empty() || !output_files.empty() || deps_output_file) help(argv[0], true);
+		// The limits apply to the whole batch
+		budget->start();
+		budget->startWatchdog(std::max(10.0, 0.1 * timelimit));
+		rc = batch(vm["batch"].as<string>(), camera, original_path, renderer, argc, argv);
+	}
+	else if (vm.count("warm-cache")) {
+		if (inputFiles.size() != 1 || !output_files.empty()) help(argv[0], true);
+		std::vector<std::string> paramsets;
+		if (vm.count("param-sets")) {
+			if (!read_parameter_sets(vm["param-sets"].as<string>(), paramsets)) return 1;
+		}
+		if (paramsets.empty()) paramsets.push_back("");
+		budget->start();
+		// A CGAL operation may not return in time; allow 10% but at least 10 seconds
+		budget->startWatchdog(std::max(10.0, 0.1 * timelimit));
+		try {
+			rc = warmcache(inputFiles[0], paramsets, argc, argv);
+		}
+		catch (const ProgressCancelException &e) {
+			rc = 1;
+		}
+	}
+	else if (cmdlinemode && vm.count("param-sets")) {
+		// Each variant reads the input and writes its own files
+		if (inputFiles.size() != 1 || deps_output_file || inputFiles[0] == "-" ||
+				std::find(output_files.begin(), output_files.end(), "-") != output_files.end()) help(argv[0], true);
+		std::vector<std::string> paramsets;
+		if (!read_parameter_sets(vm["param-sets"].as<string>(), paramsets)) return 1;
+		rc = sweep(inputFiles[0], paramsets, camera, output_files, original_path, renderer, argc, argv);
+	}
+	else if (arg_info || cmdlinemode) {
 		if (inputFiles.size() > 1) help(argv[0], true);
-		rc = cmdline(deps_output_file, inputFiles[0], camera, output_file, original_path, renderer, argc, argv);
+		budget->start();
+		budget->startWatchdog(std::max(10.0, 0.1 * timelimit));
+		try {
+			rc = cmdline(deps_output_file, inputFiles[0], camera, output_files, original_path, renderer, argc, argv);
+		}
+		catch (const ProgressCancelException &e) {
+			rc = 1;
+		}
 	}
 	else if (QtUseGUI()) {
 		rc = gui(inputFiles, original_path, argc, argv);
@@ -931,6 +2233,66 @@ int main(int argc, char **argv)
 		help(argv[0], true);
 	}
 
+#ifdef ENABLE_CGAL
+	// Exact results of approximated operations are kept for later runs
+	if (PersistentCache::instance()->isEnabled()) GeometryEvaluator::finishBackgroundTasks();
+#endif
+
+	if (vm.count("cache-stats")) {
+		const std::string statsfile = vm["cache-stats"].as<string>();
+		if (statsfile == "-") {
+			write_cache_stats(std::cout);
+		}
+		else {
+			std::ofstream fstream(statsfile.c_str());
+			if (!fstream.is_open()) PRINTB("Can't open file \"%s\" for cache statistics", statsfile);
+			else write_cache_stats(fstream);
+		}
+	}
+
+	if (vm.count("profile")) {
+		const Profiler *profiler = Profiler::instance();
+		profiler->print();
+		const std::string profilefile = vm["profile"].as<string>();
+		if (profilefile == "-") {
+			profiler->write(std::cout);
+		}
+		else {
+			std::ofstream fstream(profilefile.c_str());
+			if (!fstream.is_open()) PRINTB("Can't open file \"%s\" for the profile", profilefile);
+			else profiler->write(fstream);
+		}
+	}
+
+	if (vm.count("timing")) {
+		const Timing *timing = Timing::instance();
+		const std::string timingfile = vm["timing"].as<string>();
+		if (timingfile.empty()) {
+			timing->print();
+		}
+		else if (timingfile == "-") {
+			timing->writeJSON(std::cout);
+		}
+		else {
+			std::ofstream fstream(timingfile.c_str());
+			if (!fstream.is_open()) PRINTB("Can't open file \"%s\" for the timing", timingfile);
+			else timing->writeJSON(fstream);
+		}
+	}
+
+	if (vm.count("trace")) {
+		const EvaluationTrace *trace = EvaluationTrace::instance();
+		const std::string tracefile = vm["trace"].as<string>();
+		if (tracefile == "-") {
+			trace->write(std::cout);
+		}
+		else {
+			std::ofstream fstream(tracefile.c_str());
+			if (!fstream.is_open()) PRINTB("Can't open file \"%s\" for the trace", tracefile);
+			else trace->write(fstream);
+		}
+	}
+
 	Builtins::instance(true);
 
 	return rc;
@@ -43,7 +43,9 @@
 #include "function.h"
 #include "printutils.h"
 #include "memory.h"
+#include "MemoryAccounting.h"
 #include <sstream>
+#include <mutex>
 #include <boost/filesystem.hpp>
 
 namespace fs = boost::filesystem;
@@ -343,11 +345,11 @@ expr:
             }
         | '[' expr ':' expr ']'
             {
-              $$ = new Range($2, $4, LOC(@$));
+              $$ = Expression::fold(new Range($2, $4, LOC(@$)));
             }
         | '[' expr ':' expr ':' expr ']'
             {
-              $$ = new Range($2, $4, $6, LOC(@$));
+              $$ = Expression::fold(new Range($2, $4, $6, LOC(@$)));
             }
         | '[' optional_commas ']'
             {
@@ -355,59 +357,59 @@ expr:
             }
         | '[' vector_expr optional_commas ']'
             {
-              $$ = $2;
+              $$ = Expression::fold($2);
             }
         | expr '*' expr
             {
-              $$ = new BinaryOp($1, BinaryOp::Op::Multiply, $3, LOC(@$));
+              $$ = Expression::fold(new BinaryOp($1, BinaryOp::Op::Multiply, $3, LOC(@$)));
             }
         | expr '/' expr
             {
-              $$ = new BinaryOp($1, BinaryOp::Op::Divide, $3, LOC(@$));
+              $$ = Expression::fold(new BinaryOp($1, BinaryOp::Op::Divide, $3, LOC(@$)));
             }
         | expr '%' expr
             {
-              $$ = new BinaryOp($1, BinaryOp::Op::Modulo, $3, LOC(@$));
+              $$ = Expression::fold(new BinaryOp($1, BinaryOp::Op::Modulo, $3, LOC(@$)));
             }
         | expr '+' expr
             {
-              $$ = new BinaryOp($1, BinaryOp::Op::Plus, $3, LOC(@$));
+              $$ = Expression::fold(new BinaryOp($1, BinaryOp::Op::Plus, $3, LOC(@$)));
             }
         | expr '-' expr
             {
-              $$ = new BinaryOp($1, BinaryOp::Op::Minus, $3, LOC(@$));
+              $$ = Expression::fold(new BinaryOp($1, BinaryOp::Op::Minus, $3, LOC(@$)));
             }
         | expr '<' expr
             {
-              $$ = new BinaryOp($1, BinaryOp::Op::Less, $3, LOC(@$));
+              $$ = Expression::fold(new BinaryOp($1, BinaryOp::Op::Less, $3, LOC(@$)));
             }
         | expr LE expr
             {
-              $$ = new BinaryOp($1, BinaryOp::Op::LessEqual, $3, LOC(@$));
+              $$ = Expression::fold(new BinaryOp($1, BinaryOp::Op::LessEqual, $3, LOC(@$)));
             }
         | expr EQ expr
             {
-              $$ = new BinaryOp($1, BinaryOp::Op::Equal, $3, LOC(@$));
+              $$ = Expression::fold(new BinaryOp($1, BinaryOp::Op::Equal, $3, LOC(@$)));
             }
         | expr NE expr
             {
-              $$ = new BinaryOp($1, BinaryOp::Op::NotEqual, $3, LOC(@$));
+              $$ = Expression::fold(new BinaryOp($1, BinaryOp::Op::NotEqual, $3, LOC(@$)));
             }
         | expr GE expr
             {
-              $$ = new BinaryOp($1, BinaryOp::Op::GreaterEqual, $3, LOC(@$));
+              $$ = Expression::fold(new BinaryOp($1, BinaryOp::Op::GreaterEqual, $3, LOC(@$)));
             }
         | expr '>' expr
             {
-              $$ = new BinaryOp($1, BinaryOp::Op::Greater, $3, LOC(@$));
+              $$ = Expression::fold(new BinaryOp($1, BinaryOp::Op::Greater, $3, LOC(@$)));
             }
         | expr AND expr
             {
-              $$ = new BinaryOp($1, BinaryOp::Op::LogicalAnd, $3, LOC(@$));
+              $$ = Expression::fold(new BinaryOp($1, BinaryOp::Op::LogicalAnd, $3, LOC(@$)));
             }
         | expr OR expr
             {
-              $$ = new BinaryOp($1, BinaryOp::Op::LogicalOr, $3, LOC(@$));
+              $$ = Expression::fold(new BinaryOp($1, BinaryOp::Op::LogicalOr, $3, LOC(@$)));
             }
         | '+' expr
             {
@@ -415,11 +417,11 @@ expr:
             }
         | '-' expr
             {
-              $$ = new UnaryOp(UnaryOp::Op::Negate, $2, LOC(@$));
+              $$ = Expression::fold(new UnaryOp(UnaryOp::Op::Negate, $2, LOC(@$)));
             }
         | '!' expr
             {
-              $$ = new UnaryOp(UnaryOp::Op::Not, $2, LOC(@$));
+              $$ = Expression::fold(new UnaryOp(UnaryOp::Op::Not, $2, LOC(@$)));
             }
         | '(' expr ')'
             {
@@ -427,7 +429,7 @@ expr:
             }
         | expr '?' expr ':' expr
             {
-              $$ = new TernaryOp($1, $3, $5, LOC(@$));
+              $$ = Expression::fold(new TernaryOp($1, $3, $5, LOC(@$)));
             }
         | expr '[' expr ']'
             {
@@ -598,6 +600,11 @@ void yyerror (char const *s)
 
 FileModule *parse(const char *text, const fs::path &filename, int debug)
 {
+  // The lexer and parser state is global
+  static std::mutex parser_mutex;
+  std::lock_guard<std::mutex> lock(parser_mutex);
+  MemoryAccounting::Scope memoryscope(MemoryAccounting::PARSER);
+
   lexerin = NULL;
   parser_error_pos = -1;
   parser_input_buffer = text;
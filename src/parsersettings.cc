@@ -90,6 +90,11 @@ fs::path find_valid_path(const fs::path &sourcepath,
 
 void parser_init()
 {
+	// Only once per process, e.g. for the jobs of --server
+	static bool initialized = false;
+	if (initialized) return;
+	initialized = true;
+
 	// Add paths from OPENSCADPATH before adding built-in paths
 	const char *openscadpaths = getenv("OPENSCADPATH");
 	if (openscadpaths) {
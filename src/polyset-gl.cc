@@ -4,50 +4,50 @@
 #include "printutils.h"
 #include "grid.h"
 #include <Eigen/LU>
+#include <mutex>
 // all GL functions grouped together here
 
+#ifndef NULLGL
+// Layout of a vertex in the buffers of render_surface(): the position and
+// normal, followed by the edge shader attributes when drawing with it
+enum {
+	VERTEX_POSITION = 0,
+	VERTEX_NORMAL = 3,
+	VERTEX_TRIG = 6,
+	VERTEX_POS_B = 9,
+	VERTEX_POS_C = 12,
+	VERTEX_MASK = 15,
+	VERTEX_SIZE = 6,
+	VERTEX_SIZE_SHADER = 18
+};
 
-#ifdef ENABLE_OPENCSG
-static void draw_triangle(GLint *shaderinfo, const Vector3d &p0, const Vector3d &p1, const Vector3d &p2,
-													double e0f, double e1f, double e2f, double z, bool mirror)
-{  
-	glVertexAttrib3d(shaderinfo[3], e0f, e1f, e2f);
-	glVertexAttrib3d(shaderinfo[4], p1[0], p1[1], p1[2] + z);
-	glVertexAttrib3d(shaderinfo[5], p2[0], p2[1], p2[2] + z);
-	glVertexAttrib3d(shaderinfo[6], 0.0, 1.0, 0.0);
-	glVertex3d(p0[0], p0[1], p0[2] + z); 
-	if (!mirror) {
-		glVertexAttrib3d(shaderinfo[3], e0f, e1f, e2f);
-		glVertexAttrib3d(shaderinfo[4], p0[0], p0[1], p0[2] + z);
-		glVertexAttrib3d(shaderinfo[5], p2[0], p2[1], p2[2] + z);
-		glVertexAttrib3d(shaderinfo[6], 0.0, 0.0, 1.0);
-		glVertex3d(p1[0], p1[1], p1[2] + z); 
-	}
-	glVertexAttrib3d(shaderinfo[3], e0f, e1f, e2f);
-	glVertexAttrib3d(shaderinfo[4], p0[0], p0[1], p0[2] + z);
-	glVertexAttrib3d(shaderinfo[5], p1[0], p1[1], p1[2] + z);
-	glVertexAttrib3d(shaderinfo[6], 1.0, 0.0, 0.0);
-	glVertex3d(p2[0], p2[1], p2[2] + z);
-	if (mirror) {
-		glVertexAttrib3d(shaderinfo[3], e0f, e1f, e2f);
-		glVertexAttrib3d(shaderinfo[4], p0[0], p0[1], p0[2] + z);
-		glVertexAttrib3d(shaderinfo[5], p2[0], p2[1], p2[2] + z);
-		glVertexAttrib3d(shaderinfo[6], 0.0, 0.0, 1.0);
-		glVertex3d(p1[0], p1[1], p1[2] + z);
-	}
+static void add_vector(std::vector<float> &data, double x, double y, double z)
+{
+	data.push_back(float(x));
+	data.push_back(float(y));
+	data.push_back(float(z));
 }
-#endif
 
-static void draw_tri(const Vector3d &p0, const Vector3d &p1, const Vector3d &p2, double z, bool mirror)
+/*!
+	Appends vertex \a p of a triangle with the given normal. With \a shader,
+	the edge flags \a e, the other two vertices and the barycentric \a mask
+	for the edge shader follow.
+*/
+static void add_vertex(std::vector<float> &data, bool shader, const Vector3d &p, const Vector3d &normal,
+											 const Vector3d &e, const Vector3d &b, const Vector3d &c, const Vector3d &mask, double z)
 {
-	glVertex3d(p0[0], p0[1], p0[2] + z);
-	if (!mirror) glVertex3d(p1[0], p1[1], p1[2] + z);
-	glVertex3d(p2[0], p2[1], p2[2] + z);
-	if (mirror) glVertex3d(p1[0], p1[1], p1[2] + z); 
+	add_vector(data, p[0], p[1], p[2] + z);
+	add_vector(data, normal[0], normal[1], normal[2]);
+	if (shader) {
+		add_vector(data, e[0], e[1], e[2]);
+		add_vector(data, b[0], b[1], b[2] + z);
+		add_vector(data, c[0], c[1], c[2] + z);
+		add_vector(data, mask[0], mask[1], mask[2]);
+	}
 }
 
-#ifndef NULLGL
-static void gl_draw_triangle(GLint *shaderinfo, const Vector3d &p0, const Vector3d &p1, const Vector3d &p2, bool e0, bool e1, bool e2, double z, bool mirrored)
+static void add_triangle(std::vector<float> &data, bool shader, const Vector3d &p0, const Vector3d &p1, const Vector3d &p2,
+												 bool e0, bool e1, bool e2, double z, bool mirrored)
 {
 	double ax = p1[0] - p0[0], bx = p1[0] - p2[0];
 	double ay = p1[1] - p0[1], by = p1[1] - p2[1];
@@ -56,70 +56,79 @@ static void gl_draw_triangle(GLint *shaderinfo, const Vector3d &p0, const Vector
 	double ny = az*bx - ax*bz;
 	double nz = ax*by - ay*bx;
 	double nl = sqrt(nx*nx + ny*ny + nz*nz);
-	glNormal3d(nx / nl, ny / nl, nz / nl);
-#ifdef ENABLE_OPENCSG
-	if (shaderinfo) {
-		double e0f = e0 ? 2.0 : -1.0;
-		double e1f = e1 ? 2.0 : -1.0;
-		double e2f = e2 ? 2.0 : -1.0;
-		draw_triangle(shaderinfo, p0, p1, p2, e0f, e1f, e2f, z, mirrored);
-	}
-	else
-#endif
-	{
-		draw_tri(p0, p1, p2, z, mirrored);
-	}
+	const Vector3d normal(nx / nl, ny / nl, nz / nl);
+	const Vector3d e(e0 ? 2.0 : -1.0, e1 ? 2.0 : -1.0, e2 ? 2.0 : -1.0);
+
+	add_vertex(data, shader, p0, normal, e, p1, p2, Vector3d(0, 1, 0), z);
+	if (!mirrored) add_vertex(data, shader, p1, normal, e, p0, p2, Vector3d(0, 0, 1), z);
+	add_vertex(data, shader, p2, normal, e, p0, p1, Vector3d(1, 0, 0), z);
+	if (mirrored) add_vertex(data, shader, p1, normal, e, p0, p2, Vector3d(0, 0, 1), z);
 }
 
-void PolySet::render_surface(Renderer::csgmode_e csgmode, const Transform3d &m, GLint *shaderinfo) const
+// Buffers released by RenderCache, deleted on the next draw from the GL thread
+static std::mutex released_mutex;
+static std::vector<GLuint> released_buffers;
+
+void PolySet::RenderCache::release()
 {
-	PRINTD("Polyset render");
-	bool mirrored = m.matrix().determinant() < 0;
-#ifdef ENABLE_OPENCSG
-	if (shaderinfo) {
-		glUniform1f(shaderinfo[7], shaderinfo[9]);
-		glUniform1f(shaderinfo[8], shaderinfo[10]);
+	std::lock_guard<std::mutex> lock(released_mutex);
+	for(const auto &b : this->buffers) {
+		if (b.second.vbo) released_buffers.push_back(b.second.vbo);
 	}
-#endif /* ENABLE_OPENCSG */
+	this->buffers.clear();
+}
+
+static void delete_released_buffers()
+{
+	std::lock_guard<std::mutex> lock(released_mutex);
+	if (released_buffers.empty()) return;
+	glDeleteBuffers(released_buffers.size(), &released_buffers[0]);
+	released_buffers.clear();
+}
+
+/*!
+	Builds the triangles drawn by render_surface() in the layout above.
+*/
+void PolySet::build_surface(Renderer::csgmode_e csgmode, bool mirrored, bool shader, std::vector<float> &data) const
+{
 	if (this->dim == 2) {
 		// Render 2D objects 1mm thick, but differences slightly larger
 		double zbase = 1 + ((csgmode & CSGMODE_DIFFERENCE_FLAG) ? 0.1 : 0);
-		glBegin(GL_TRIANGLES);
 
 		// Render top+bottom
 		for (double z = -zbase/2; z < zbase; z += zbase) {
-			for (size_t i = 0; i < polygons.size(); i++) {
-				const Polygon *poly = &polygons[i];
-				if (poly->size() == 3) {
+			for (size_t i = 0; i < numPolygons(); i++) {
+				const Face poly = face(i);
+				if (poly.size() == 3) {
 					if (z < 0) {
-						gl_draw_triangle(shaderinfo, poly->at(0), poly->at(2), poly->at(1), true, true, true, z, mirrored);
+						add_triangle(data, shader, poly.at(0), poly.at(2), poly.at(1), true, true, true, z, mirrored);
 					} else {
-						gl_draw_triangle(shaderinfo, poly->at(0), poly->at(1), poly->at(2), true, true, true, z, mirrored);
+						add_triangle(data, shader, poly.at(0), poly.at(1), poly.at(2), true, true, true, z, mirrored);
 					}
 				}
-				else if (poly->size() == 4) {
+				else if (poly.size() == 4) {
 					if (z < 0) {
-						gl_draw_triangle(shaderinfo, poly->at(0), poly->at(3), poly->at(1), true, false, true, z, mirrored);
-						gl_draw_triangle(shaderinfo, poly->at(2), poly->at(1), poly->at(3), true, false, true, z, mirrored);
+						add_triangle(data, shader, poly.at(0), poly.at(3), poly.at(1), true, false, true, z, mirrored);
+						add_triangle(data, shader, poly.at(2), poly.at(1), poly.at(3), true, false, true, z, mirrored);
 					} else {
-						gl_draw_triangle(shaderinfo, poly->at(0), poly->at(1), poly->at(3), true, false, true, z, mirrored);
-						gl_draw_triangle(shaderinfo, poly->at(2), poly->at(3), poly->at(1), true, false, true, z, mirrored);
+						add_triangle(data, shader, poly.at(0), poly.at(1), poly.at(3), true, false, true, z, mirrored);
+						add_triangle(data, shader, poly.at(2), poly.at(3), poly.at(1), true, false, true, z, mirrored);
 					}
 				}
 				else {
 					Vector3d center = Vector3d::Zero();
-					for (size_t j = 0; j < poly->size(); j++) {
-						center[0] += poly->at(j)[0];
-						center[1] += poly->at(j)[1];
+					for (size_t j = 0; j < poly.size(); j++) {
+						center[0] += poly.at(j)[0];
+						center[1] += poly.at(j)[1];
 					}
-					center[0] /= poly->size();
-					center[1] /= poly->size();
-					for (size_t j = 1; j <= poly->size(); j++) {
+					center[0] /= poly.size();
+					center[1] /= poly.size();
+					for (size_t j = 1; j <= poly.size(); j++) {
 						if (z < 0) {
-							gl_draw_triangle(shaderinfo, center, poly->at(j % poly->size()), poly->at(j - 1),
+							add_triangle(data, shader, center, poly.at(j % poly.size()), poly.at(j - 1),
 									false, true, false, z, mirrored);
 						} else {
-							gl_draw_triangle(shaderinfo, center, poly->at(j - 1), poly->at(j % poly->size()),
+							add_triangle(data, shader, center, poly.at(j - 1), poly.at(j % poly.size()),
 									false, true, false, z, mirrored);
 						}
 					}
@@ -135,54 +144,50 @@ void PolySet::render_surface(Renderer::csgmode_e csgmode, const Transform3d &m,
 					Vector3d p2(o.vertices[j-1][0], o.vertices[j-1][1], zbase/2);
 					Vector3d p3(o.vertices[j % o.vertices.size()][0], o.vertices[j % o.vertices.size()][1], -zbase/2);
 					Vector3d p4(o.vertices[j % o.vertices.size()][0], o.vertices[j % o.vertices.size()][1], zbase/2);
-					gl_draw_triangle(shaderinfo, p2, p1, p3, true, true, false, 0, mirrored);
-					gl_draw_triangle(shaderinfo, p2, p3, p4, false, true, true, 0, mirrored);
+					add_triangle(data, shader, p2, p1, p3, true, true, false, 0, mirrored);
+					add_triangle(data, shader, p2, p3, p4, false, true, true, 0, mirrored);
 				}
 			}
 		}
 		else {
 			// If we don't have borders, use the polygons as borders.
 			// FIXME: When is this used?
-			const Polygons *borders_p = &polygons;
-			for (size_t i = 0; i < borders_p->size(); i++) {
-				const Polygon *poly = &borders_p->at(i);
-				for (size_t j = 1; j <= poly->size(); j++) {
-					Vector3d p1 = poly->at(j - 1), p2 = poly->at(j - 1);
-					Vector3d p3 = poly->at(j % poly->size()), p4 = poly->at(j % poly->size());
+			for (size_t i = 0; i < numPolygons(); i++) {
+				const Face poly = face(i);
+				for (size_t j = 1; j <= poly.size(); j++) {
+					Vector3d p1 = poly.at(j - 1), p2 = poly.at(j - 1);
+					Vector3d p3 = poly.at(j % poly.size()), p4 = poly.at(j % poly.size());
 					p1[2] -= zbase/2, p2[2] += zbase/2;
 					p3[2] -= zbase/2, p4[2] += zbase/2;
-					gl_draw_triangle(shaderinfo, p2, p1, p3, true, true, false, 0, mirrored);
-					gl_draw_triangle(shaderinfo, p2, p3, p4, false, true, true, 0, mirrored);
+					add_triangle(data, shader, p2, p1, p3, true, true, false, 0, mirrored);
+					add_triangle(data, shader, p2, p3, p4, false, true, true, 0, mirrored);
 				}
 			}
 		}
-		glEnd();
 	} else if (this->dim == 3) {
-		for (size_t i = 0; i < polygons.size(); i++) {
-			const Polygon *poly = &polygons[i];
-			glBegin(GL_TRIANGLES);
-			if (poly->size() == 3) {
-				gl_draw_triangle(shaderinfo, poly->at(0), poly->at(1), poly->at(2), true, true, true, 0, mirrored);
+		for (size_t i = 0; i < numPolygons(); i++) {
+			const Face poly = face(i);
+			if (poly.size() == 3) {
+				add_triangle(data, shader, poly.at(0), poly.at(1), poly.at(2), true, true, true, 0, mirrored);
 			}
-			else if (poly->size() == 4) {
-				gl_draw_triangle(shaderinfo, poly->at(0), poly->at(1), poly->at(3), true, false, true, 0, mirrored);
-				gl_draw_triangle(shaderinfo, poly->at(2), poly->at(3), poly->at(1), true, false, true, 0, mirrored);
+			else if (poly.size() == 4) {
+				add_triangle(data, shader, poly.at(0), poly.at(1), poly.at(3), true, false, true, 0, mirrored);
+				add_triangle(data, shader, poly.at(2), poly.at(3), poly.at(1), true, false, true, 0, mirrored);
 			}
 			else {
 				Vector3d center = Vector3d::Zero();
-				for (size_t j = 0; j < poly->size(); j++) {
-					center[0] += poly->at(j)[0];
-					center[1] += poly->at(j)[1];
-					center[2] += poly->at(j)[2];
+				for (size_t j = 0; j < poly.size(); j++) {
+					center[0] += poly.at(j)[0];
+					center[1] += poly.at(j)[1];
+					center[2] += poly.at(j)[2];
 				}
-				center[0] /= poly->size();
-				center[1] /= poly->size();
-				center[2] /= poly->size();
-				for (size_t j = 1; j <= poly->size(); j++) {
-					gl_draw_triangle(shaderinfo, center, poly->at(j - 1), poly->at(j % poly->size()), false, true, false, 0, mirrored);
+				center[0] /= poly.size();
+				center[1] /= poly.size();
+				center[2] /= poly.size();
+				for (size_t j = 1; j <= poly.size(); j++) {
+					add_triangle(data, shader, center, poly.at(j - 1), poly.at(j % poly.size()), false, true, false, 0, mirrored);
 				}
 			}
-			glEnd();
 		}
 	}
 	else {
@@ -190,6 +195,135 @@ void PolySet::render_surface(Renderer::csgmode_e csgmode, const Transform3d &m,
 	}
 }
 
+/*!
+	Returns the triangles of the PolySet for the given drawing mode. They
+	are built and uploaded once for each combination of mirroring, edge
+	shader and 2D difference thickness.
+*/
+const PolySet::RenderCache::Buffer &PolySet::surface_buffer(Renderer::csgmode_e csgmode, bool mirrored, bool shader) const
+{
+	const bool difference = this->dim == 2 && (csgmode & CSGMODE_DIFFERENCE_FLAG);
+	const int key = (mirrored ? 1 : 0) | (shader ? 2 : 0) | (difference ? 4 : 0);
+	auto it = this->rendercache.buffers.find(key);
+	if (it == this->rendercache.buffers.end()) {
+		RenderCache::Buffer buffer;
+		buffer.vbo = 0;
+		build_surface(csgmode, mirrored, shader, buffer.data);
+		buffer.count = buffer.data.size() / (shader ? VERTEX_SIZE_SHADER : VERTEX_SIZE);
+		if (GLEW_VERSION_1_5 && !buffer.data.empty()) {
+			glGenBuffers(1, &buffer.vbo);
+			glBindBuffer(GL_ARRAY_BUFFER, buffer.vbo);
+			glBufferData(GL_ARRAY_BUFFER, buffer.data.size() * sizeof(float), &buffer.data[0], GL_STATIC_DRAW);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			std::vector<float>().swap(buffer.data);
+		}
+		it = this->rendercache.buffers.emplace(key, std::move(buffer)).first;
+	}
+	return it->second;
+}
+
+/*!
+	Draws \a buffer once for each of \a matrices, or once with the
+	current matrix if \a matrices is NULL. The vertex arrays are only set
+	up once.
+*/
+static void draw_buffer(const PolySet::RenderCache::Buffer &buffer, bool shader, GLint *shaderinfo,
+												const std::vector<const Transform3d *> *matrices)
+{
+	if (buffer.count == 0) return;
+
+	// With a buffer bound, the pointers are offsets into it
+	const float *base = NULL;
+	if (buffer.vbo) glBindBuffer(GL_ARRAY_BUFFER, buffer.vbo);
+	else base = &buffer.data[0];
+	const GLsizei stride = (shader ? VERTEX_SIZE_SHADER : VERTEX_SIZE) * sizeof(float);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glVertexPointer(3, GL_FLOAT, stride, base + VERTEX_POSITION);
+	glNormalPointer(GL_FLOAT, stride, base + VERTEX_NORMAL);
+#ifdef ENABLE_OPENCSG
+	const int attributes[] = { VERTEX_TRIG, VERTEX_POS_B, VERTEX_POS_C, VERTEX_MASK };
+	if (shader) {
+		for (int i = 0; i < 4; i++) {
+			glEnableVertexAttribArray(shaderinfo[3 + i]);
+			glVertexAttribPointer(shaderinfo[3 + i], 3, GL_FLOAT, GL_FALSE, stride, base + attributes[i]);
+		}
+	}
+#endif
+	if (matrices) {
+		for(const auto &m : *matrices) {
+			glPushMatrix();
+			glMultMatrixd(m->data());
+			glDrawArrays(GL_TRIANGLES, 0, buffer.count);
+			glPopMatrix();
+		}
+	}
+	else {
+		glDrawArrays(GL_TRIANGLES, 0, buffer.count);
+	}
+#ifdef ENABLE_OPENCSG
+	if (shader) {
+		for (int i = 0; i < 4; i++) glDisableVertexAttribArray(shaderinfo[3 + i]);
+	}
+#endif
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	if (buffer.vbo) glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Sets the edge shader uniforms and returns true if drawing with it
+static bool use_shader(GLint *shaderinfo)
+{
+#ifdef ENABLE_OPENCSG
+	if (shaderinfo) {
+		glUniform1f(shaderinfo[7], shaderinfo[9]);
+		glUniform1f(shaderinfo[8], shaderinfo[10]);
+		return true;
+	}
+#endif /* ENABLE_OPENCSG */
+	return false;
+}
+
+/*!
+	Draws the triangles of the PolySet with the current matrix, where
+	\a m is only used to find out whether it's mirrored.
+*/
+void PolySet::render_surface(Renderer::csgmode_e csgmode, const Transform3d &m, GLint *shaderinfo) const
+{
+	PRINTD("Polyset render");
+	bool mirrored = m.matrix().determinant() < 0;
+	const bool shader = use_shader(shaderinfo);
+	if (this->dim != 2 && this->dim != 3) {
+		assert(false && "Cannot render object with no dimension");
+		return;
+	}
+	delete_released_buffers();
+	draw_buffer(surface_buffer(csgmode, mirrored, shader), shader, shaderinfo, NULL);
+}
+
+/*!
+	Draws the PolySet once for each of \a matrices, which are multiplied
+	with the current matrix. Placing many copies of the same geometry
+	this way binds its buffer once for the normal and once for the
+	mirrored copies, instead of once per copy.
+*/
+void PolySet::render_surface(Renderer::csgmode_e csgmode, const std::vector<const Transform3d *> &matrices, GLint *shaderinfo) const
+{
+	PRINTD("Polyset render instances");
+	const bool shader = use_shader(shaderinfo);
+	if (this->dim != 2 && this->dim != 3) {
+		assert(false && "Cannot render object with no dimension");
+		return;
+	}
+	delete_released_buffers();
+	std::vector<const Transform3d *> instances[2];
+	for(const auto &m : matrices) instances[m->matrix().determinant() < 0].push_back(m);
+	for (int mirrored = 0; mirrored < 2; mirrored++) {
+		if (instances[mirrored].empty()) continue;
+		draw_buffer(surface_buffer(csgmode, mirrored, shader), shader, shaderinfo, &instances[mirrored]);
+	}
+}
+
 /*! This is used in throwntogether and CGAL mode
 
 	csgmode is set to CSGMODE_NONE in CGAL mode. In this mode a pure 2D rendering is performed.
@@ -233,11 +367,11 @@ void PolySet::render_edges(Renderer::csgmode_e csgmode) const
 			}
 		}
 	} else if (dim == 3) {
-		for (size_t i = 0; i < polygons.size(); i++) {
-			const Polygon *poly = &polygons[i];
+		for (size_t i = 0; i < numPolygons(); i++) {
+			const Face poly = face(i);
 			glBegin(GL_LINE_LOOP);
-			for (size_t j = 0; j < poly->size(); j++) {
-				const Vector3d &p = poly->at(j);
+			for (size_t j = 0; j < poly.size(); j++) {
+				const Vector3d &p = poly.at(j);
 				glVertex3d(p[0], p[1], p[2]);
 			}
 			glEnd();
@@ -251,8 +385,10 @@ void PolySet::render_edges(Renderer::csgmode_e csgmode) const
 
 
 #else //NULLGL
-static void gl_draw_triangle(GLint *shaderinfo, const Vector3d &p0, const Vector3d &p1, const Vector3d &p2, bool e0, bool e1, bool e2, double z, bool mirrored) {}
+void PolySet::RenderCache::release() { this->buffers.clear(); }
+void PolySet::build_surface(Renderer::csgmode_e csgmode, bool mirrored, bool shader, std::vector<float> &data) const {}
 void PolySet::render_surface(Renderer::csgmode_e csgmode, const Transform3d &m, GLint *shaderinfo) const {}
+void PolySet::render_surface(Renderer::csgmode_e csgmode, const std::vector<const Transform3d *> &matrices, GLint *shaderinfo) const {}
 void PolySet::render_edges(Renderer::csgmode_e csgmode) const {}
 #endif //NULLGL
 
@@ -53,7 +53,7 @@ namespace PolysetUtils {
 	Polygon2d *project(const PolySet &ps) {
 		Polygon2d *poly = new Polygon2d;
 
-		for(const auto &p : ps.polygons) {
+		for(const auto &p : ps.faces()) {
 			Outline2d outline;
 			for(const auto &v : p) {
 				outline.vertices.push_back(Vector2d(v[0], v[1]));
@@ -214,8 +214,8 @@ namespace PolysetUtils {
 	 duplicate points, and proper orientation. */
 	void tessellate_faces(const PolySet &inps, PolySet &outps) {
 		int degeneratePolygons = 0;
-		for (size_t i = 0; i < inps.polygons.size(); i++) {
-			const PolySet::Polygon pgon = inps.polygons[i];
+		for (size_t i = 0; i < inps.numPolygons(); i++) {
+			const PolySet::Polygon pgon = inps.face(i);
 			if (pgon.size() < 3) {
 				degeneratePolygons++;
 				continue;
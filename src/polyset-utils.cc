@@ -5,6 +5,19 @@
 #include "GeometryUtils.h"
 #include "Reindexer.h"
 #include "grid.h"
+#include "feature.h"
+#include "ThreadPool.h"
+#include "PerfCounters.h"
+#include "OperationCounters.h"
+#include "PolySetBVH.h"
+#include <algorithm>
+#include <array>
+#include <iterator>
+#include <queue>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+#include <cmath>
 #ifdef ENABLE_CGAL
 #include "cgalutils.h"
 #endif
@@ -17,7 +30,7 @@ namespace PolysetUtils {
 	Polygon2d *project(const PolySet &ps) {
 		Polygon2d *poly = new Polygon2d;
 
-		for(const auto &p : ps.polygons) {
+		for(const auto &p : ps.faces()) {
 			Outline2d outline;
 			for(const auto &v : p) {
 				outline.vertices.push_back(Vector2d(v[0], v[1]));
@@ -49,56 +62,110 @@ namespace PolysetUtils {
 */
 	void tessellate_faces(const PolySet &inps, PolySet &outps)
 	{
+		tessellate_faces(inps, [&outps](const Vector3d &v0, const Vector3d &v1, const Vector3d &v2) {
+				outps.append_poly();
+				outps.append_vertex(v0);
+				outps.append_vertex(v1);
+				outps.append_vertex(v2);
+			});
+	}
+
+/*!
+	Tessellates face \a f of \a ps, which has more than 3 vertices, and
+	appends the vertices of the resulting triangles to \a triangles.
+*/
+	static void tessellate_face(const PolySet &ps, size_t f, std::vector<Vector3f> &triangles)
+	{
+		const PolySet::Face pgon = ps.face(f);
+		// Build an indexed face of the float vertices, like the whole
+		// mesh would index them
+		Reindexer<Vector3f> faceVertices;
+		std::vector<IndexedFace> faces(1);
+		IndexedFace &currface = faces.back();
+		for (size_t i=0;i<pgon.size();i++) {
+			// Create vertex indices and remove consecutive duplicate vertices
+			int idx = faceVertices.lookup(pgon[i].cast<float>());
+			if (currface.empty() || idx != currface.back()) currface.push_back(idx);
+		}
+		if (currface.front() == currface.back()) currface.pop_back();
+		if (currface.size() < 3) return; // Cull empty triangles
+
+		const Vector3f *verts = faceVertices.getArray();
+		// Convex faces, e.g. quads, are fan-triangulated without the tessellator
+		if (GeometryUtils::isStrictlyConvex(verts, currface)) {
+			for (size_t i=1;i+1<currface.size();i++) {
+				triangles.push_back(verts[currface[0]]);
+				triangles.push_back(verts[currface[i]]);
+				triangles.push_back(verts[currface[i+1]]);
+			}
+			return;
+		}
+		std::vector<IndexedTriangle> indexedtriangles;
+		bool err = GeometryUtils::tessellatePolygonWithHoles(verts, faces, indexedtriangles, NULL);
+		if (!err) {
+			for(const auto &t : indexedtriangles) {
+				triangles.push_back(verts[t[0]]);
+				triangles.push_back(verts[t[1]]);
+				triangles.push_back(verts[t[2]]);
+			}
+		}
+	}
+
+/*!
+	Tessellates the faces like above, but passes each triangle to \a sink
+	instead of building a PolySet. Triangles are passed first, then the
+	tessellated faces, in the order used by the PolySet version.
+
+	With parallel evaluation enabled, faces are tessellated in batches on
+	the thread pool. Only a limited number of batches is kept at a time, so
+	exporters can still write large meshes with little extra memory.
+*/
+	void tessellate_faces(const PolySet &inps, const TriangleSink &sink)
+	{
+		PERF_PROBE("tessellate");
+		OperationCounters::count(OperationCounters::TESSELLATIONS);
 		int degeneratePolygons = 0;
+		std::vector<size_t> polygons; // Faces to tessellate
+		for (size_t f=0;f<inps.numPolygons();f++) {
+			const PolySet::Face pgon = inps.face(f);
+			if (pgon.size() < 3) degeneratePolygons++;
+			else if (pgon.size() == 3) sink(pgon[0], pgon[1], pgon[2]); // Short-circuit
+			else polygons.push_back(f);
+		}
 
-		// Build Indexed PolyMesh
-		Reindexer<Vector3f> allVertices;
-		std::vector<std::vector<IndexedFace>> polygons;
-
-		for(const auto &pgon : inps.polygons) {
-			if (pgon.size() < 3) {
-				degeneratePolygons++;
-				continue;
-			}
-			if (pgon.size() == 3) { // Short-circuit
-				outps.append_poly(pgon);
-				continue;
-			}
-			
-			polygons.push_back(std::vector<IndexedFace>());
-			std::vector<IndexedFace> &faces = polygons.back();
-			faces.push_back(IndexedFace());
-			IndexedFace &currface = faces.back();
-			for(const auto &v : pgon) {
-				// Create vertex indices and remove consecutive duplicate vertices
-				int idx = allVertices.lookup(v.cast<float>());
-				if (currface.empty() || idx != currface.back()) currface.push_back(idx);
-			}
-			if (currface.front() == currface.back()) currface.pop_back();
-                    if (currface.size() < 3) {
-                        faces.pop_back(); // Cull empty triangles
-                        if (faces.empty()) polygons.pop_back(); // All faces were culled
-                    }
-		}
-
-		// Tessellate indexed mesh
-		const Vector3f *verts = allVertices.getArray();
-		std::vector<IndexedTriangle> allTriangles;
-		for(const auto &faces : polygons) {
-			std::vector<IndexedTriangle> triangles;
-			if (faces[0].size() == 3) {
-				triangles.push_back(IndexedTriangle(faces[0][0], faces[0][1], faces[0][2]));
-			}
-			else {
-				bool err = GeometryUtils::tessellatePolygonWithHoles(verts, faces, triangles, NULL);
-				if (!err) {
-					for(const auto &t : triangles) {
-						outps.append_poly();
-						outps.append_vertex(verts[t[0]]);
-						outps.append_vertex(verts[t[1]]);
-						outps.append_vertex(verts[t[2]]);
-					}
+		auto emit = [&sink](const std::vector<Vector3f> &triangles) {
+			for (size_t i=0;i<triangles.size();i+=3) {
+				sink(triangles[i].cast<double>(), triangles[i+1].cast<double>(), triangles[i+2].cast<double>());
+			}
+		};
+
+		const size_t batchsize = 500;
+		if (polygons.size() > batchsize && Feature::ExperimentalParallelEvaluation.is_enabled()) {
+			ThreadPool *pool = ThreadPool::instance();
+			const size_t maxbatches = 4 * std::max(1u, pool->size());
+			std::vector<std::vector<Vector3f>> results;
+			for (size_t start=0;start<polygons.size();start+=maxbatches*batchsize) {
+				const size_t end = std::min(polygons.size(), start + maxbatches*batchsize);
+				results.resize((end - start + batchsize - 1) / batchsize);
+				ThreadPool::TaskGroup group;
+				for (size_t b=0;b<results.size();b++) {
+					pool->run(group, [&inps, &polygons, &results, start, end, b]() {
+							std::vector<Vector3f> &triangles = results[b];
+							triangles.clear();
+							const size_t last = std::min(end, start + (b+1)*batchsize);
+							for (size_t i=start+b*batchsize;i<last;i++) tessellate_face(inps, polygons[i], triangles);
+						});
 				}
+				pool->wait(group);
+				for(const auto &triangles : results) emit(triangles);
+			}
+		}
+		else {
+			std::vector<Vector3f> triangles;
+			for(const auto &f : polygons) {
+				triangles.clear();
+				tessellate_face(inps, f, triangles);
+				emit(triangles);
 			}
 		}
 		if (degeneratePolygons > 0) PRINT("WARNING: PolySet has degenerate polygons");
@@ -112,4 +179,487 @@ namespace PolysetUtils {
 #endif
 	}
 
+
+	/*!
+		Adds the outlines where \a polygons of \a ps cross the plane at
+		height \a z. Vertices on the plane count as below it if \a onbelow,
+		otherwise as above it.
+
+		Each polygon adds segments from the edges where it rises above the
+		plane to the edges where it drops below it, which are joined into
+		loops at the shared edges. For non-convex polygons these may not be
+		the pieces of the polygon on the plane, but they add up to the same
+		winding numbers. Returns false if the segments don't form closed
+		loops, as for open, non-manifold or inconsistently oriented meshes.
+	*/
+	static bool slice(const PolySet &ps, const std::vector<size_t> &polygons, double z, bool onbelow,
+										std::vector<Outline2d> &outlines)
+	{
+		const std::vector<Vector3d> &vertices = ps.getVertices();
+		auto below = [&vertices, z, onbelow](int i) {
+			return onbelow ? vertices[i][2] <= z : vertices[i][2] < z;
+		};
+		// Edges by their vertex indices
+		auto edge = [](int a, int b) {
+			if (a > b) std::swap(a, b);
+			return (uint64_t(uint32_t(a)) << 32) | uint32_t(b);
+		};
+
+		std::unordered_map<uint64_t, uint64_t> next;
+		std::unordered_map<uint64_t, Vector2d> points;
+		std::vector<std::pair<uint64_t, bool>> crossings; // Edge, and whether it rises
+		for(const auto f : polygons) {
+			const PolySet::Face face = ps.face(f);
+			crossings.clear();
+			for (size_t i=0;i<face.size();i++) {
+				int a = face.index(i), b = face.index((i+1) % face.size());
+				const bool rising = below(a);
+				if (rising == below(b)) continue;
+				const uint64_t key = edge(a, b);
+				crossings.push_back(std::make_pair(key, rising));
+				if (points.count(key)) continue;
+				// Interpolate from the lower index, so both polygons at an edge get the same point
+				if (a > b) std::swap(a, b);
+				const Vector3d &va = vertices[a], &vb = vertices[b];
+				const Vector3d p = va + (vb - va) * ((va[2] - z) / (va[2] - vb[2]));
+				points[key] = Vector2d(p[0], p[1]);
+			}
+			// Crossings alternate between rising and falling
+			size_t start = 0;
+			while (start < crossings.size() && !crossings[start].second) start++;
+			for (size_t i=0;i<crossings.size();i+=2) {
+				const uint64_t from = crossings[(start + i) % crossings.size()].first;
+				const uint64_t to = crossings[(start + i + 1) % crossings.size()].first;
+				if (!next.emplace(from, to).second) return false;
+			}
+		}
+
+		while (!next.empty()) {
+			const uint64_t first = next.begin()->first;
+			Outline2d outline;
+			uint64_t key = first;
+			do {
+				auto it = next.find(key);
+				if (it == next.end()) return false;
+				outline.vertices.push_back(points[key]);
+				key = it->second;
+				next.erase(it);
+			} while (key != first);
+			outlines.push_back(outline);
+		}
+		return true;
+	}
+
+	static double signed_area(const Outline2d &outline)
+	{
+		double area = 0;
+		const std::vector<Vector2d> &v = outline.vertices;
+		for (size_t i=0;i<v.size();i++) {
+			const Vector2d &a = v[i], &b = v[(i+1) % v.size()];
+			area += a[0] * b[1] - b[0] * a[1];
+		}
+		return area / 2;
+	}
+
+	/*!
+		Slices \a polygons of the closed mesh \a ps at height \a z, adding
+		outlines oriented so that the section is their union by the non-zero
+		rule.
+
+		The section of a solid is closed, so faces on the plane belong to it.
+		Vertices on the plane are therefore taken as below and then as above
+		the plane, covering the solid on either side.
+	*/
+	static bool slice(const PolySet &ps, const std::vector<size_t> &polygons, double z, std::vector<Outline2d> &outlines)
+	{
+		bool onplane = false;
+		for (size_t i=0;i<polygons.size() && !onplane;i++) {
+			for(const auto &v : ps.face(polygons[i])) {
+				if (v[2] == z) onplane = true;
+			}
+		}
+
+		std::vector<Outline2d> result;
+		if (!slice(ps, polygons, z, true, result)) return false;
+		if (onplane && !slice(ps, polygons, z, false, result)) return false;
+		double area = 0;
+		for(const auto &o : result) area += signed_area(o);
+		if (area < 0) {
+			for(auto &o : result) std::reverse(o.vertices.begin(), o.vertices.end());
+		}
+		outlines.insert(outlines.end(), result.begin(), result.end());
+		return true;
+	}
+
+	/*!
+		Slices the closed 3D mesh \a ps with the plane z=0, like
+		projection(cut=true), and adds the cross section to \a outlines,
+		to be filled by the non-zero rule. Returns false if the mesh can't be
+		sliced, as it isn't closed and consistently oriented at the plane.
+	*/
+	bool slice(const PolySet &ps, std::vector<Outline2d> &outlines)
+	{
+		const double inf = std::numeric_limits<double>::infinity();
+		const BoundingBox plane(Vector3d(-inf, -inf, 0), Vector3d(inf, inf, 0));
+		return slice(ps, ps.getBVH()->overlapping(plane), 0, outlines);
+	}
+
+	/*!
+		Slices the closed 3D mesh \a ps at each of \a heights, in any order,
+		setting \a layers to the outlines of each section like slice().
+
+		The heights are swept upwards once, keeping the polygons which reach
+		the current height, so each polygon is only looked at for the
+		heights it spans.
+	*/
+	bool sliceLayers(const PolySet &ps, const std::vector<double> &heights, std::vector<std::vector<Outline2d>> &layers)
+	{
+		const size_t n = ps.numPolygons();
+		std::vector<double> zmin(n), zmax(n);
+		for (size_t i=0;i<n;i++) {
+			zmin[i] = std::numeric_limits<double>::infinity();
+			zmax[i] = -zmin[i];
+			for(const auto &v : ps.face(i)) {
+				zmin[i] = std::min(zmin[i], v[2]);
+				zmax[i] = std::max(zmax[i], v[2]);
+			}
+		}
+		std::vector<size_t> polygons(n), order(heights.size());
+		for (size_t i=0;i<n;i++) polygons[i] = i;
+		for (size_t i=0;i<order.size();i++) order[i] = i;
+		std::sort(polygons.begin(), polygons.end(), [&zmin](size_t a, size_t b) { return zmin[a] < zmin[b]; });
+		std::sort(order.begin(), order.end(), [&heights](size_t a, size_t b) { return heights[a] < heights[b]; });
+
+		layers.assign(heights.size(), std::vector<Outline2d>());
+		std::vector<size_t> active;
+		size_t next = 0;
+		for(const auto i : order) {
+			const double z = heights[i];
+			while (next < n && zmin[polygons[next]] <= z) active.push_back(polygons[next++]);
+			active.erase(std::remove_if(active.begin(), active.end(), [&zmax, z](size_t f) { return zmax[f] < z; }),
+									 active.end());
+			if (!slice(ps, active, z, layers[i])) return false;
+		}
+		return true;
+	}
+
+	/*!
+		Returns a coarse approximation of \a ps with at most \a maxfaces
+		triangles, e.g. to draw while the view moves. The vertices in each
+		cell of a grid are merged into their mean, and triangles which
+		collapse or become duplicates are dropped. The grid gets coarser
+		until few enough triangles are left. Returns NULL if \a cancel is
+		set meanwhile.
+	*/
+	PolySet *decimate(const PolySet &ps, size_t maxfaces, const std::atomic<bool> *cancel)
+	{
+		const std::vector<Vector3d> &vertices = ps.getVertices();
+		BoundingBox bbox;
+		for(const auto &v : vertices) bbox.extend(v);
+		const double extent = vertices.empty() ? 0 : bbox.sizes().maxCoeff();
+		// Cell coordinates are packed into 21 bits each
+		const double maxcells = (1 << 21) - 1;
+
+		for (double cells = std::min(std::sqrt(double(maxfaces)), maxcells); cells >= 1; cells *= 0.7) {
+			const double cellsize = extent > 0 ? extent / cells : 1;
+			std::unordered_map<uint64_t, int> cellindex;
+			std::vector<int> cluster(vertices.size());
+			std::vector<Vector3d> sums;
+			std::vector<int> counts;
+			for (size_t i = 0; i < vertices.size(); i++) {
+				if (cancel && (i & 0xffff) == 0 && *cancel) return NULL;
+				uint64_t key = 0;
+				for (int k = 0; k < 3; k++) {
+					key = (key << 21) | uint64_t(std::min(std::floor((vertices[i][k] - bbox.min()[k]) / cellsize), maxcells));
+				}
+				const auto it = cellindex.emplace(key, int(sums.size()));
+				if (it.second) {
+					sums.push_back(Vector3d::Zero());
+					counts.push_back(0);
+				}
+				cluster[i] = it.first->second;
+				sums[cluster[i]] += vertices[i];
+				counts[cluster[i]]++;
+			}
+
+			std::vector<int> indices;
+			std::vector<size_t> offsets;
+			// Duplicates are only dropped while their ids can be packed
+			const bool dedupe = sums.size() <= (1 << 21);
+			std::unordered_set<uint64_t> triangles;
+			for (size_t f = 0; f < ps.numPolygons() && offsets.size() <= maxfaces; f++) {
+				if (cancel && (f & 0xffff) == 0 && *cancel) return NULL;
+				const PolySet::Face face = ps.face(f);
+				// Faces are fanned into triangles
+				for (size_t j = 1; j + 1 < face.size(); j++) {
+					const int t[3] = { cluster[face.index(0)], cluster[face.index(j)], cluster[face.index(j + 1)] };
+					if (t[0] == t[1] || t[1] == t[2] || t[2] == t[0]) continue;
+					// The same triangle in either orientation
+					int sorted[3] = { t[0], t[1], t[2] };
+					std::sort(sorted, sorted + 3);
+					const uint64_t key = (uint64_t(sorted[0]) << 42) | (uint64_t(sorted[1]) << 21) | uint64_t(sorted[2]);
+					if (dedupe && !triangles.insert(key).second) continue;
+					offsets.push_back(indices.size());
+					indices.insert(indices.end(), t, t + 3);
+				}
+			}
+			if (offsets.size() > maxfaces && cells > 1) continue;
+
+			for (size_t i = 0; i < sums.size(); i++) sums[i] /= counts[i];
+			PolySet *result = new PolySet(3);
+			result->append(sums, indices, offsets);
+			return result;
+		}
+		return new PolySet(3);
+	}
+
+	namespace {
+		// Symmetric 4x4 matrix of the sum of squared distances to a set of planes
+		struct Quadric {
+			Quadric() { std::fill(this->q, this->q + 10, 0.0); }
+			Quadric(const Vector3d &n, double d, double weight) {
+				const double p[4] = { n[0], n[1], n[2], d };
+				for (int i = 0, k = 0; i < 4; i++) {
+					for (int j = i; j < 4; j++) this->q[k++] = weight * p[i] * p[j];
+				}
+			}
+			Quadric &operator+=(const Quadric &other) {
+				for (int k = 0; k < 10; k++) this->q[k] += other.q[k];
+				return *this;
+			}
+			double error(const Vector3d &v) const {
+				const double x = v[0], y = v[1], z = v[2];
+				return std::max(0.0,
+												q[0]*x*x + 2*q[1]*x*y + 2*q[2]*x*z + 2*q[3]*x +
+												q[4]*y*y + 2*q[5]*y*z + 2*q[6]*y +
+												q[7]*z*z + 2*q[8]*z + q[9]);
+			}
+			// The point of least error, if there is just one
+			bool optimum(Vector3d &v) const {
+				Eigen::Matrix3d A;
+				A << q[0], q[1], q[2], q[1], q[4], q[5], q[2], q[5], q[7];
+				const double scale = A.cwiseAbs().maxCoeff();
+				if (scale == 0 || std::abs(A.determinant()) < 1e-9 * scale * scale * scale) return false;
+				v = A.inverse() * Vector3d(-q[3], -q[6], -q[8]);
+				return true;
+			}
+
+			double q[10]; // xx, xy, xz, x, yy, yz, y, zz, z, 1
+		};
+
+		struct Collapse {
+			double cost;
+			int a, b;
+			unsigned int versiona, versionb; // Of the vertices when the cost was computed
+			Vector3d target;
+			// The cheapest collapse is on top of the queue
+			bool operator<(const Collapse &other) const { return this->cost > other.cost; }
+		};
+
+		Vector3d face_normal(const Vector3d &v0, const Vector3d &v1, const Vector3d &v2) {
+			return (v1 - v0).cross(v2 - v0);
+		}
+	}
+
+	/*!
+		Returns a simplification of \a ps made by collapsing edges in the
+		order of their quadric error (Garland and Heckbert), while the error
+		stays below \a maxerror and more than \a minfaces triangles are left.
+		The error is measured as the distance of the vertices to the planes
+		of the triangles they replace.
+
+		Collapses which would flip triangles or make the mesh non-manifold
+		are skipped, and borders of open meshes are kept in place. Returns
+		NULL if \a cancel is set meanwhile.
+	*/
+	PolySet *simplify(const PolySet &ps, double maxerror, size_t minfaces, const std::atomic<bool> *cancel)
+	{
+		PolySet tri(3);
+		tessellate_faces(ps, tri);
+		std::vector<Vector3d> vertices = tri.getVertices();
+		std::vector<std::array<int, 3>> faces;
+		faces.reserve(tri.numPolygons());
+		for(const auto &face : tri.faces()) {
+			if (face.size() == 3) faces.push_back({{ face.index(0), face.index(1), face.index(2) }});
+		}
+
+		const size_t n = vertices.size();
+		std::vector<Quadric> quadrics(n);
+		std::vector<std::vector<int>> vertexfaces(n);
+		std::unordered_map<uint64_t, int> edgecount;
+		auto edgekey = [](int a, int b) { return (uint64_t(std::min(a, b)) << 32) | uint64_t(std::max(a, b)); };
+		for (size_t f = 0; f < faces.size(); f++) {
+			const std::array<int, 3> &t = faces[f];
+			Vector3d normal = face_normal(vertices[t[0]], vertices[t[1]], vertices[t[2]]);
+			const double len = normal.norm();
+			if (len > 0) {
+				normal /= len;
+				const Quadric plane(normal, -normal.dot(vertices[t[0]]), 1);
+				for (int i = 0; i < 3; i++) quadrics[t[i]] += plane;
+			}
+			for (int i = 0; i < 3; i++) {
+				vertexfaces[t[i]].push_back(int(f));
+				edgecount[edgekey(t[i], t[(i + 1) % 3])]++;
+			}
+		}
+
+		// Borders are held by steep planes through them, and vertices of
+		// non-manifold edges aren't moved at all
+		const double BORDER_WEIGHT = 1000;
+		std::vector<bool> locked(n, false);
+		for (size_t f = 0; f < faces.size(); f++) {
+			const std::array<int, 3> &t = faces[f];
+			const Vector3d normal = face_normal(vertices[t[0]], vertices[t[1]], vertices[t[2]]);
+			for (int i = 0; i < 3; i++) {
+				const int a = t[i], b = t[(i + 1) % 3];
+				const int count = edgecount[edgekey(a, b)];
+				if (count > 2) {
+					locked[a] = locked[b] = true;
+				}
+				else if (count == 1) {
+					Vector3d border = (vertices[b] - vertices[a]).cross(normal);
+					const double len = border.norm();
+					if (len == 0) continue;
+					border /= len;
+					const Quadric plane(border, -border.dot(vertices[a]), BORDER_WEIGHT);
+					quadrics[a] += plane;
+					quadrics[b] += plane;
+				}
+			}
+		}
+
+		std::vector<unsigned int> versions(n, 0);
+		std::vector<bool> removed(n, false), deadfaces(faces.size(), false);
+		const double maxcost = maxerror * maxerror;
+		auto collapse = [&](int a, int b) {
+			Collapse c;
+			c.a = a;
+			c.b = b;
+			c.versiona = versions[a];
+			c.versionb = versions[b];
+			Quadric q = quadrics[a];
+			q += quadrics[b];
+			const Vector3d candidates[3] = { vertices[a], vertices[b], (vertices[a] + vertices[b]) / 2 };
+			c.cost = std::numeric_limits<double>::infinity();
+			if (q.optimum(c.target)) c.cost = q.error(c.target);
+			for(const auto &candidate : candidates) {
+				const double cost = q.error(candidate);
+				if (cost < c.cost) {
+					c.cost = cost;
+					c.target = candidate;
+				}
+			}
+			return c;
+		};
+		// The vertices sharing a live face with v, dropping dead faces of v
+		auto neighbors = [&](int v, std::vector<int> &result) {
+			std::vector<int> &vf = vertexfaces[v];
+			vf.erase(std::remove_if(vf.begin(), vf.end(), [&deadfaces](int f) { return deadfaces[f]; }), vf.end());
+			result.clear();
+			for(const auto f : vf) {
+				for(const auto w : faces[f]) if (w != v) result.push_back(w);
+			}
+			std::sort(result.begin(), result.end());
+			result.erase(std::unique(result.begin(), result.end()), result.end());
+		};
+
+		std::priority_queue<Collapse> queue;
+		std::vector<int> na, nb, common, opposite;
+		for(const auto &edge : edgecount) {
+			const int a = int(edge.first >> 32), b = int(edge.first & 0xffffffff);
+			if (locked[a] || locked[b]) continue;
+			const Collapse c = collapse(a, b);
+			if (c.cost <= maxcost) queue.push(c);
+		}
+
+		size_t livefaces = faces.size();
+		for (size_t iteration = 0; !queue.empty() && livefaces > minfaces; iteration++) {
+			if (cancel && (iteration & 0xfff) == 0 && *cancel) return NULL;
+			const Collapse c = queue.top();
+			queue.pop();
+			if (c.cost > maxcost) break;
+			const int a = c.a, b = c.b;
+			if (removed[a] || removed[b] || versions[a] != c.versiona || versions[b] != c.versionb) continue;
+
+			// The link condition: a and b only share the vertices opposite to their edge
+			neighbors(a, na);
+			neighbors(b, nb);
+			common.clear();
+			std::set_intersection(na.begin(), na.end(), nb.begin(), nb.end(), std::back_inserter(common));
+			opposite.clear();
+			for(const auto f : vertexfaces[a]) {
+				const std::array<int, 3> &t = faces[f];
+				if (t[0] != b && t[1] != b && t[2] != b) continue;
+				for(const auto w : t) if (w != a && w != b) opposite.push_back(w);
+			}
+			std::sort(opposite.begin(), opposite.end());
+			if (opposite.empty() || common != opposite) continue;
+
+			// No remaining triangle may flip or collapse
+			bool flips = false;
+			for (int k = 0; k < 2 && !flips; k++) {
+				const int v = k == 0 ? a : b;
+				for(const auto f : vertexfaces[v]) {
+					std::array<int, 3> t = faces[f];
+					if (std::count(t.begin(), t.end(), a) && std::count(t.begin(), t.end(), b)) continue;
+					const Vector3d before = face_normal(vertices[t[0]], vertices[t[1]], vertices[t[2]]);
+					Vector3d p[3] = { vertices[t[0]], vertices[t[1]], vertices[t[2]] };
+					for (int i = 0; i < 3; i++) if (t[i] == v) p[i] = c.target;
+					const Vector3d after = face_normal(p[0], p[1], p[2]);
+					if (after.dot(before) <= 1e-6 * before.squaredNorm()) {
+						flips = true;
+						break;
+					}
+				}
+			}
+			if (flips) continue;
+
+			vertices[a] = c.target;
+			quadrics[a] += quadrics[b];
+			removed[b] = true;
+			versions[a]++;
+			versions[b]++;
+			for(const auto f : vertexfaces[b]) {
+				std::array<int, 3> &t = faces[f];
+				if (std::count(t.begin(), t.end(), a)) {
+					deadfaces[f] = true;
+					livefaces--;
+				}
+				else {
+					std::replace(t.begin(), t.end(), b, a);
+					vertexfaces[a].push_back(f);
+				}
+			}
+			vertexfaces[b].clear();
+
+			neighbors(a, na);
+			for(const auto w : na) {
+				if (locked[w]) continue;
+				const Collapse next = collapse(a, w);
+				if (next.cost <= maxcost) queue.push(next);
+			}
+		}
+
+		std::vector<int> remap(n, -1);
+		std::vector<Vector3d> resultvertices;
+		std::vector<IndexedTriangle> triangles;
+		for (size_t f = 0; f < faces.size(); f++) {
+			if (deadfaces[f]) continue;
+			IndexedTriangle t;
+			for (int i = 0; i < 3; i++) {
+				const int v = faces[f][i];
+				if (remap[v] < 0) {
+					remap[v] = int(resultvertices.size());
+					resultvertices.push_back(vertices[v]);
+				}
+				t[i] = remap[v];
+			}
+			triangles.push_back(t);
+		}
+		PolySet *result = new PolySet(3);
+		result->append(resultvertices, triangles);
+		result->setConvexity(ps.getConvexity());
+		return result;
+	}
+
 }
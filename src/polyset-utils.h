@@ -1,12 +1,21 @@
 #pragma once
 
+#include "GeometryUtils.h"
+#include <atomic>
+
 class Polygon2d;
 class PolySet;
+struct Outline2d;
 
 namespace PolysetUtils {
 
 	Polygon2d *project(const PolySet &ps);
 	void tessellate_faces(const PolySet &inps, PolySet &outps);
+	void tessellate_faces(const PolySet &inps, const TriangleSink &sink);
 	bool is_approximately_convex(const PolySet &ps);
+	bool slice(const PolySet &ps, std::vector<Outline2d> &outlines);
+	bool sliceLayers(const PolySet &ps, const std::vector<double> &heights, std::vector<std::vector<Outline2d>> &layers);
+	PolySet *decimate(const PolySet &ps, size_t maxfaces, const std::atomic<bool> *cancel = NULL);
+	PolySet *simplify(const PolySet &ps, double maxerror, size_t minfaces = 0, const std::atomic<bool> *cancel = NULL);
 
 };
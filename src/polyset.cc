@@ -29,6 +29,7 @@
 #include "linalg.h"
 #include "printutils.h"
 #include "grid.h"
+#include "PolySetBVH.h"
 #include <Eigen/LU>
 
 /*! /class PolySet
@@ -63,14 +64,12 @@ std::string PolySet::dump() const
 	out << "PolySet:"
 	  << "\n dimensions:" << this->dim
 	  << "\n convexity:" << this->convexity
-	  << "\n num polygons: " << polygons.size()
+	  << "\n num polygons: " << numPolygons()
 			<< "\n num outlines: " << polygon.outlines().size()
 	  << "\n polygons data:";
-	for (size_t i = 0; i < polygons.size(); i++) {
+	for(const auto &poly : faces()) {
 		out << "\n  polygon begin:";
-		const Polygon *poly = &polygons[i];
-		for (size_t j = 0; j < poly->size(); j++) {
-			Vector3d v = poly->at(j);
+		for(const auto &v : poly) {
 			out << "\n   vertex:" << v.transpose();
 		}
 	}
@@ -82,13 +81,13 @@ std::string PolySet::dump() const
 
 void PolySet::append_poly()
 {
-	polygons.push_back(Polygon());
+	this->offsets.push_back(this->indices.size());
 }
 
 void PolySet::append_poly(const Polygon &poly)
 {
-	polygons.push_back(poly);
-	this->dirty = true;
+	append_poly();
+	for(const auto &v : poly) append_vertex(v);
 }
 
 void PolySet::append_vertex(double x, double y, double z)
@@ -98,7 +97,7 @@ void PolySet::append_vertex(double x, double y, double z)
 
 void PolySet::append_vertex(const Vector3d &v)
 {
-	polygons.back().push_back(v);
+	this->indices.push_back(lookupVertex(v));
 	this->dirty = true;
 }
 
@@ -107,6 +106,27 @@ void PolySet::append_vertex(const Vector3f &v)
 	append_vertex((const Vector3d &)v.cast<double>());
 }
 
+/*!
+	Adds a vertex without looking it up, and returns its index. Only for
+	vertices known to differ from all others, e.g. points on a grid. Use
+	append_index() to add it to polygons.
+*/
+int PolySet::append_unique_vertex(const Vector3d &v)
+{
+	if (!this->vertexmap.empty()) this->vertexmap.emplace(v, int(this->vertices.size()));
+	this->vertices.push_back(v);
+	return int(this->vertices.size()) - 1;
+}
+
+/*!
+	Adds an existing vertex to the current polygon.
+*/
+void PolySet::append_index(int index)
+{
+	this->indices.push_back(index);
+	this->dirty = true;
+}
+
 void PolySet::insert_vertex(double x, double y, double z)
 {
 	insert_vertex(Vector3d(x, y, z));
@@ -114,10 +134,25 @@ void PolySet::insert_vertex(double x, double y, double z)
 
 void PolySet::insert_vertex(const Vector3d &v)
 {
-	polygons.back().insert(polygons.back().begin(), v);
+	const int idx = lookupVertex(v);
+	this->indices.insert(this->indices.begin() + this->offsets.back(), idx);
 	this->dirty = true;
 }
 
+/*!
+	Returns the index of \a v in the vertex buffer, adding it if necessary.
+*/
+int PolySet::lookupVertex(const Vector3d &v)
+{
+	if (this->vertexmap.empty() && !this->vertices.empty()) {
+		this->vertexmap.clear();
+		for (size_t i=0;i<this->vertices.size();i++) this->vertexmap.emplace(this->vertices[i], int(i));
+	}
+	auto result = this->vertexmap.emplace(v, int(this->vertices.size()));
+	if (result.second) this->vertices.push_back(v);
+	return result.first->second;
+}
+
 void PolySet::insert_vertex(const Vector3f &v)
 {
 	insert_vertex((const Vector3d &)v.cast<double>());
@@ -127,10 +162,8 @@ BoundingBox PolySet::getBoundingBox() const
 {
 	if (this->dirty) {
 		this->bbox.setNull();
-		for(const auto &poly : polygons) {
-			for(const auto &p : poly) {
-				this->bbox.extend(p);
-			}
+		for(const auto &v : this->vertices) {
+			this->bbox.extend(v);
 		}
 		this->dirty = false;
 	}
@@ -140,38 +173,180 @@ BoundingBox PolySet::getBoundingBox() const
 size_t PolySet::memsize() const
 {
 	size_t mem = 0;
-	for(const auto &p : this->polygons) mem += p.size() * sizeof(Vector3d);
+	mem += this->vertices.capacity() * sizeof(Vector3d);
+	mem += this->indices.capacity() * sizeof(int);
+	mem += this->offsets.capacity() * sizeof(size_t);
+	// Rough estimate of the node and bucket overhead of the map
+	mem += this->vertexmap.size() * (sizeof(Vector3d) + sizeof(int) + 2 * sizeof(void *));
 	mem += this->polygon.memsize() - sizeof(this->polygon);
 	mem += sizeof(PolySet);
+	if (this->bvhcache.bvh) mem += this->bvhcache.bvh->memsize();
 	return mem;
 }
 
+/*!
+	Returns the bounding volume hierarchy of the polygons, building it on
+	first use.
+*/
+shared_ptr<const PolySetBVH> PolySet::getBVH() const
+{
+	std::lock_guard<std::mutex> lock(this->bvhcache.mutex);
+	if (!this->bvhcache.bvh) this->bvhcache.bvh.reset(new PolySetBVH(*this));
+	return this->bvhcache.bvh;
+}
+
 void PolySet::append(const PolySet &ps)
 {
-	this->polygons.insert(this->polygons.end(), ps.polygons.begin(), ps.polygons.end());
+	this->rendercache.clear();
+	this->bvhcache.clear();
+	std::vector<int> remap(ps.vertices.size());
+	for (size_t i=0;i<ps.vertices.size();i++) remap[i] = lookupVertex(ps.vertices[i]);
+	const size_t base = this->indices.size();
+	this->offsets.reserve(this->offsets.size() + ps.offsets.size());
+	for(const auto &o : ps.offsets) this->offsets.push_back(base + o);
+	this->indices.reserve(base + ps.indices.size());
+	for(const auto &i : ps.indices) this->indices.push_back(remap[i]);
 	if (!dirty && !this->bbox.isNull()) {
 		this->bbox.extend(ps.getBoundingBox());
 	}
 }
 
+/*!
+	Appends an indexed mesh. Each vertex is looked up once,
+	rather than once per triangle using it.
+*/
+void PolySet::append(const std::vector<Vector3d> &vertices, const std::vector<IndexedTriangle> &triangles)
+{
+	this->rendercache.clear();
+	this->bvhcache.clear();
+	std::vector<int> remap(vertices.size());
+	for (size_t i=0;i<vertices.size();i++) remap[i] = lookupVertex(vertices[i]);
+	this->offsets.reserve(this->offsets.size() + triangles.size());
+	this->indices.reserve(this->indices.size() + 3*triangles.size());
+	for(const auto &t : triangles) {
+		this->offsets.push_back(this->indices.size());
+		for (int i=0;i<3;i++) this->indices.push_back(remap[t[i]]);
+	}
+	this->dirty = true;
+}
+
+void PolySet::append(const std::vector<Vector3d> &vertices, const std::vector<IndexedFace> &faces)
+{
+	this->rendercache.clear();
+	this->bvhcache.clear();
+	std::vector<int> remap(vertices.size());
+	for (size_t i=0;i<vertices.size();i++) remap[i] = lookupVertex(vertices[i]);
+	this->offsets.reserve(this->offsets.size() + faces.size());
+	for(const auto &f : faces) {
+		this->offsets.push_back(this->indices.size());
+		for(const auto &i : f) this->indices.push_back(remap[i]);
+	}
+	this->dirty = true;
+}
+
+/*!
+	Appends an indexed mesh with its faces stored back to back: face i
+	consists of the indices from offsets[i] up to the next offset.
+*/
+void PolySet::append(const std::vector<Vector3d> &vertices, const std::vector<int> &indices, const std::vector<size_t> &offsets)
+{
+	this->rendercache.clear();
+	this->bvhcache.clear();
+	std::vector<int> remap(vertices.size());
+	for (size_t i=0;i<vertices.size();i++) remap[i] = lookupVertex(vertices[i]);
+	const size_t base = this->indices.size();
+	this->offsets.reserve(this->offsets.size() + offsets.size());
+	for(const auto &o : offsets) this->offsets.push_back(base + o);
+	this->indices.reserve(base + indices.size());
+	for(const auto &i : indices) this->indices.push_back(remap[i]);
+	this->dirty = true;
+}
+
 void PolySet::transform(const Transform3d &mat)
 {
+	this->rendercache.clear();
+	this->bvhcache.clear();
 	// If mirroring transform, flip faces to avoid the object to end up being inside-out
 	bool mirrored = mat.matrix().determinant() < 0;
 
-	for(auto &p : this->polygons){
-		for(auto &v : p) {
-			v = mat * v;
+	for(auto &v : this->vertices) v = mat * v;
+	if (mirrored) flipFaces();
+	// A singular transform will collapse vertices. Otherwise, they stay unique.
+	if (mat.matrix().determinant() == 0) mergeVertices();
+	else this->vertexmap.clear();
+	this->dirty = true;
+}
+
+/*!
+	Reverses the vertex order of all polygons.
+*/
+void PolySet::flipFaces()
+{
+	this->rendercache.clear();
+	this->bvhcache.clear();
+	for (size_t i=0;i<this->offsets.size();i++) {
+		const size_t last = i+1 < this->offsets.size() ? this->offsets[i+1] : this->indices.size();
+		std::reverse(this->indices.begin() + this->offsets[i], this->indices.begin() + last);
+	}
+}
+
+/*!
+	Merges vertices with identical coordinates.
+*/
+void PolySet::mergeVertices()
+{
+	this->vertexmap.clear();
+	std::vector<int> remap(this->vertices.size());
+	std::vector<Vector3d> merged;
+	for (size_t i=0;i<this->vertices.size();i++) {
+		auto result = this->vertexmap.emplace(this->vertices[i], int(merged.size()));
+		if (result.second) merged.push_back(this->vertices[i]);
+		remap[i] = result.first->second;
+	}
+	if (merged.size() != this->vertices.size()) {
+		for(auto &i : this->indices) i = remap[i];
+		this->vertices.swap(merged);
+	}
+	this->vertexmap.clear();
+}
+
+/*!
+	Removes vertices not referenced by any polygon.
+*/
+void PolySet::removeUnusedVertices()
+{
+	std::vector<int> remap(this->vertices.size(), -1);
+	std::vector<Vector3d> used;
+	for(auto &i : this->indices) {
+		if (remap[i] < 0) {
+			remap[i] = int(used.size());
+			used.push_back(this->vertices[i]);
 		}
-		if (mirrored) std::reverse(p.begin(), p.end());
+		i = remap[i];
 	}
-	this->dirty = true;
+	this->vertices.swap(used);
+	this->vertexmap.clear();
 }
 
+/*!
+	Returns true if the PolySet is convex. The result is remembered, so the
+	check is only done once per mesh, and survives copies and
+	affine transforms.
+*/
 bool PolySet::is_convex() const {
 	if (convex || this->isEmpty()) return true;
 	if (!convex) return false;
-	return PolysetUtils::is_approximately_convex(*this);
+	// is_approximately_convex() doesn't work well with non-planar faces,
+	// so check a tessellated copy
+	if (this->dim == 3) {
+		PolySet tessellated(3);
+		PolysetUtils::tessellate_faces(*this, tessellated);
+		this->convex = PolysetUtils::is_approximately_convex(tessellated);
+	}
+	else {
+		this->convex = PolysetUtils::is_approximately_convex(*this);
+	}
+	return bool(this->convex);
 }
 
 void PolySet::resize(const Vector3d &newsize, const Eigen::Matrix<bool,3,1> &autosize)
@@ -208,29 +383,42 @@ void PolySet::resize(const Vector3d &newsize, const Eigen::Matrix<bool,3,1> &aut
 */
 void PolySet::quantizeVertices()
 {
-	Grid3d<int> grid(GRID_FINE);
-	int numverts = 0;
-	std::vector<int> indices; // Vertex indices in one polygon
-	for (std::vector<Polygon>::iterator iter = this->polygons.begin(); iter != this->polygons.end();) {
-		Polygon &p = *iter;
-		indices.resize(p.size());
-		// Quantize all vertices. Build index list
-		for (int i=0;i<p.size();i++) indices[i] = grid.align(p[i]);
+	this->rendercache.clear();
+	this->bvhcache.clear();
+	// Quantize each unique vertex once. Grid indices become the new vertex indices.
+	VertexWelder welder(GRID_FINE, this->vertices.size());
+	const std::vector<int> gridindex = welder.weld(this->vertices);
+	std::vector<Vector3d> aligned = welder.vertices();
+
+	std::vector<int> newindices;
+	std::vector<size_t> newoffsets;
+	newindices.reserve(this->indices.size());
+	newoffsets.reserve(this->offsets.size());
+	bool removed = false;
+	for (size_t f=0;f<this->offsets.size();f++) {
+		const size_t first = this->offsets[f];
+		const size_t last = f+1 < this->offsets.size() ? this->offsets[f+1] : this->indices.size();
+		const size_t start = newindices.size();
 		// Remove consequtive duplicate vertices
-		Polygon::iterator currp = p.begin();
-		for (int i=0;i<indices.size();i++) {
-			if (indices[i] != indices[(i+1)%indices.size()]) {
-				(*currp++) = p[i];
+		for (size_t i=first;i<last;i++) {
+			const size_t next = i+1 < last ? i+1 : first;
+			if (gridindex[this->indices[i]] != gridindex[this->indices[next]]) {
+				newindices.push_back(gridindex[this->indices[i]]);
 			}
 		}
-		p.erase(currp, p.end());
-		if (p.size() < 3) {
+		if (newindices.size() - start < 3) {
 			PRINTD("Removing collapsed polygon due to quantizing");
-			this->polygons.erase(iter);
+			newindices.resize(start);
+			removed = true;
 		}
 		else {
-			iter++;
+			newoffsets.push_back(start);
 		}
 	}
+	this->vertices.swap(aligned);
+	this->indices.swap(newindices);
+	this->offsets.swap(newoffsets);
+	this->vertexmap.clear();
+	if (removed) removeUnusedVertices();
+	this->dirty = true;
 }
-
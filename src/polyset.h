@@ -8,14 +8,65 @@
 #include "Polygon2d.h"
 #include <vector>
 #include <string>
+#include <map>
+#include <unordered_map>
+#include "hash.h"
+#include <mutex>
+
+#include <boost/iterator/permutation_iterator.hpp>
 
 #include <boost/logic/tribool.hpp>
 BOOST_TRIBOOL_THIRD_STATE(unknown)
 
+class PolySetBVH;
+
 class PolySet : public Geometry
 {
 public:
-	Polygons polygons;
+	/*!
+		A polygon of a PolySet. Refers to the shared vertex buffer of the
+		PolySet and is invalidated by any modification of it.
+	*/
+	class Face
+	{
+	public:
+		typedef boost::permutation_iterator<std::vector<Vector3d>::const_iterator,
+																				std::vector<int>::const_iterator> const_iterator;
+
+		Face(const PolySet &ps, size_t first, size_t last) : ps(&ps), first(first), last(last) {}
+
+		size_t size() const { return this->last - this->first; }
+		const Vector3d &operator[](size_t i) const { return this->ps->vertices[index(i)]; }
+		const Vector3d &at(size_t i) const { return (*this)[i]; }
+		int index(size_t i) const { return this->ps->indices[this->first + i]; }
+		const_iterator begin() const { return const_iterator(this->ps->vertices.begin(), this->ps->indices.begin() + this->first); }
+		const_iterator end() const { return const_iterator(this->ps->vertices.begin(), this->ps->indices.begin() + this->last); }
+		operator Polygon() const { return Polygon(begin(), end()); }
+
+	private:
+		const PolySet *ps;
+		size_t first, last;
+	};
+
+	class FaceIterator
+	{
+	public:
+		FaceIterator(const PolySet &ps, size_t idx) : ps(&ps), idx(idx) {}
+		Face operator*() const { return this->ps->face(this->idx); }
+		FaceIterator &operator++() { this->idx++; return *this; }
+		bool operator!=(const FaceIterator &other) const { return this->idx != other.idx; }
+		bool operator==(const FaceIterator &other) const { return this->idx == other.idx; }
+
+	private:
+		const PolySet *ps;
+		size_t idx;
+	};
+
+	struct FaceRange {
+		FaceIterator first, last;
+		FaceIterator begin() const { return first; }
+		FaceIterator end() const { return last; }
+	};
 
 	PolySet(unsigned int dim, boost::tribool convex = unknown);
 	PolySet(const Polygon2d &origin);
@@ -25,22 +76,36 @@ public:
 	virtual BoundingBox getBoundingBox() const;
 	virtual std::string dump() const;
 	virtual unsigned int getDimension() const { return this->dim; }
-	virtual bool isEmpty() const { return polygons.size() == 0; }
+	virtual bool isEmpty() const { return this->offsets.empty(); }
 	virtual Geometry *copy() const { return new PolySet(*this); }
 
 	void quantizeVertices();
-	size_t numPolygons() const { return polygons.size(); }
+	size_t numPolygons() const { return this->offsets.size(); }
+	size_t numVertices() const { return this->vertices.size(); }
+	Face face(size_t i) const {
+		return Face(*this, this->offsets[i], i+1 < this->offsets.size() ? this->offsets[i+1] : this->indices.size());
+	}
+	FaceRange faces() const { FaceRange r = { FaceIterator(*this, 0), FaceIterator(*this, numPolygons()) }; return r; }
+	const std::vector<Vector3d> &getVertices() const { return this->vertices; }
+	const std::vector<int> &getIndices() const { return this->indices; }
 	void append_poly();
 	void append_poly(const Polygon &poly);
 	void append_vertex(double x, double y, double z = 0.0);
 	void append_vertex(const Vector3d &v);
 	void append_vertex(const Vector3f &v);
+	int append_unique_vertex(const Vector3d &v);
+	void append_index(int index);
 	void insert_vertex(double x, double y, double z = 0.0);
 	void insert_vertex(const Vector3d &v);
 	void insert_vertex(const Vector3f &v);
 	void append(const PolySet &ps);
+	void append(const std::vector<Vector3d> &vertices, const std::vector<IndexedTriangle> &triangles);
+	void append(const std::vector<Vector3d> &vertices, const std::vector<IndexedFace> &faces);
+	void append(const std::vector<Vector3d> &vertices, const std::vector<int> &indices, const std::vector<size_t> &offsets);
+	void flipFaces();
 
 	void render_surface(Renderer::csgmode_e csgmode, const Transform3d &m, GLint *shaderinfo = NULL) const;
+	void render_surface(Renderer::csgmode_e csgmode, const std::vector<const Transform3d *> &matrices, GLint *shaderinfo = NULL) const;
 	void render_edges(Renderer::csgmode_e csgmode) const;
 
 	void transform(const Transform3d &mat);
@@ -48,11 +113,74 @@ public:
 
 	bool is_convex() const;
 	boost::tribool convexValue() const { return this->convex; }
+	void setConvexValue(boost::tribool convex) { this->convex = convex; }
+
+	/*!
+		The triangles drawn by render_surface(), uploaded once per drawing
+		mode. Copies start empty and changes to the whole mesh drop them;
+		PolySets are not drawn while being built. Buffers may be released
+		from any thread, since they are only deleted on the next draw.
+	*/
+	class RenderCache
+	{
+	public:
+		struct Buffer {
+			GLuint vbo;
+			std::vector<float> data; // Used if vertex buffers aren't supported
+			size_t count;
+		};
+
+		RenderCache() {}
+		RenderCache(const RenderCache &) {}
+		~RenderCache() { clear(); }
+		RenderCache &operator=(const RenderCache &) { clear(); return *this; }
+		void clear() { if (!this->buffers.empty()) release(); }
+
+		std::map<int, Buffer> buffers;
+
+	private:
+		void release();
+	};
+
+	/*!
+		The hierarchy returned by getBVH(). Copies start empty and changes
+		to the whole mesh drop it, like for the RenderCache.
+	*/
+	class BVHCache
+	{
+	public:
+		BVHCache() {}
+		BVHCache(const BVHCache &) {}
+		BVHCache &operator=(const BVHCache &) { clear(); return *this; }
+		// Changing the PolySet requires exclusive access, so no lock is needed
+		void clear() { this->bvh.reset(); }
+
+		shared_ptr<const PolySetBVH> bvh;
+		std::mutex mutex;
+	};
+
+	shared_ptr<const PolySetBVH> getBVH() const;
 
 private:
+	const RenderCache::Buffer &surface_buffer(Renderer::csgmode_e csgmode, bool mirrored, bool shader) const;
+	void build_surface(Renderer::csgmode_e csgmode, bool mirrored, bool shader, std::vector<float> &data) const;
+	int lookupVertex(const Vector3d &v);
+	void mergeVertices();
+	void removeUnusedVertices();
+
+	// Unique vertices, the vertex indices of all polygons, and the offset of
+	// each polygon into indices
+	std::vector<Vector3d> vertices;
+	std::vector<int> indices;
+	std::vector<size_t> offsets;
+	// Maps vertices to their index while building; rebuilt on demand
+	std::unordered_map<Vector3d, int> vertexmap;
+
 	Polygon2d polygon;
 	unsigned int dim;
 	mutable boost::tribool convex;
 	mutable BoundingBox bbox;
 	mutable bool dirty;
+	mutable RenderCache rendercache;
+	mutable BVHCache bvhcache;
 };
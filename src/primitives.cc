@@ -36,6 +36,8 @@
 #include <sstream>
 #include <assert.h>
 #include <cmath>
+#include <mutex>
+#include <unordered_map>
 #include <boost/assign/std/vector.hpp>
 using namespace boost::assign; // bring 'operator+=()' into scope
 
@@ -56,6 +58,7 @@ class PrimitiveModule : public AbstractModule
 public:
 	primitive_type_e type;
 	PrimitiveModule(primitive_type_e type) : type(type) { }
+	virtual bool is_leaf() const { return true; }
 	virtual AbstractNode *instantiate(const Context *ctx, const ModuleInstantiation *inst, EvalContext *evalctx) const;
 private:
 	Value lookup_radius(const Context &ctx, const std::string &radius_var, const std::string &diameter_var) const;
@@ -279,13 +282,108 @@ struct point2d {
 	double x, y;
 };
 
+typedef std::vector<point2d> UnitCircle;
+
+/*!
+	Returns the points of a unit circle with the given number of fragments.
+	The points are computed once per fragment count and shared by all
+	primitives.
+*/
+static shared_ptr<const UnitCircle> unit_circle(int fragments)
+{
+	static std::mutex mutex;
+	static std::unordered_map<int, shared_ptr<const UnitCircle>> circles;
+	std::lock_guard<std::mutex> lock(mutex);
+	shared_ptr<const UnitCircle> &circle = circles[fragments];
+	if (!circle) {
+		UnitCircle *points = new UnitCircle(fragments);
+		for (int i=0; i<fragments; i++) {
+			double phi = (M_PI*2*i) / fragments;
+			(*points)[i].x = cos(phi);
+			(*points)[i].y = sin(phi);
+		}
+		circle.reset(points);
+	}
+	return circle;
+}
+
 static void generate_circle(point2d *circle, double r, int fragments)
 {
+	const UnitCircle &unit = *unit_circle(fragments);
 	for (int i=0; i<fragments; i++) {
-		double phi = (M_PI*2*i) / fragments;
-		circle[i].x = r*cos(phi);
-		circle[i].y = r*sin(phi);
+		circle[i].x = r*unit[i].x;
+		circle[i].y = r*unit[i].y;
+	}
+}
+
+/*!
+	Everything about a sphere which only depends on its fragment count: the
+	ring angles, the ring points and the faces, as indices into a ring-major
+	vertex array.
+*/
+struct SphereTemplate {
+	int fragments, rings;
+	std::vector<double> ringsin, ringcos;
+	shared_ptr<const UnitCircle> circle;
+	std::vector<IndexedFace> faces;
+};
+
+static shared_ptr<const SphereTemplate> sphere_template(int fragments)
+{
+	static std::mutex mutex;
+	static std::unordered_map<int, shared_ptr<const SphereTemplate>> templates;
+	std::lock_guard<std::mutex> lock(mutex);
+	shared_ptr<const SphereTemplate> &cached = templates[fragments];
+	if (cached) return cached;
+
+	SphereTemplate *t = new SphereTemplate;
+	t->fragments = fragments;
+	int rings = t->rings = (fragments+1)/2;
+// Uncomment the following three lines to enable experimental sphere tesselation
+//		if (rings % 2 == 0) rings++; // To ensure that the middle ring is at phi == 0 degrees
+
+//		double offset = 0.5 * ((fragments / 2) % 2);
+	for (int i = 0; i < rings; i++) {
+//			double phi = (M_PI * (i + offset)) / (fragments/2);
+		double phi = (M_PI * (i + 0.5)) / rings;
+		t->ringsin.push_back(sin(phi));
+		t->ringcos.push_back(cos(phi));
+	}
+	t->circle = unit_circle(fragments);
+
+	t->faces.push_back(IndexedFace());
+	for (int i = 0; i < fragments; i++) t->faces.back().push_back(i);
+
+	for (int i = 0; i < rings-1; i++) {
+		const int r1 = i*fragments, r2 = (i+1)*fragments;
+		int r1i = 0, r2i = 0;
+		while (r1i < fragments || r2i < fragments)
+		{
+			if (r1i >= fragments)
+				goto sphere_next_r2;
+			if (r2i >= fragments)
+				goto sphere_next_r1;
+			if ((double)r1i / fragments <
+					(double)r2i / fragments)
+			{
+			sphere_next_r1:
+				int r1j = (r1i+1) % fragments;
+				t->faces.push_back({r2 + r2i % fragments, r1 + r1j, r1 + r1i});
+				r1i++;
+			} else {
+			sphere_next_r2:
+				int r2j = (r2i+1) % fragments;
+				t->faces.push_back({r2 + r2i, r2 + r2j, r1 + r1i % fragments});
+				r2i++;
+			}
+		}
 	}
+
+	t->faces.push_back(IndexedFace());
+	for (int i = fragments-1; i >= 0; i--) t->faces.back().push_back((rings-1)*fragments + i);
+
+	cached.reset(t);
+	return cached;
 }
 
 /*!
@@ -359,74 +457,20 @@ const Geometry *PrimitiveNode::createGeometry() const
 		PolySet *p = new PolySet(3,true);
 		g = p;
 		if (this->r1 > 0 && !std::isinf(this->r1)) {
-			struct ring_s {
-				point2d *points;
-				double z;
-			};
-
 			int fragments = Calc::get_fragments_from_r(r1, fn, fs, fa);
-			int rings = (fragments+1)/2;
-// Uncomment the following three lines to enable experimental sphere tesselation
-//		if (rings % 2 == 0) rings++; // To ensure that the middle ring is at phi == 0 degrees
-
-			ring_s *ring = new ring_s[rings];
-
-//		double offset = 0.5 * ((fragments / 2) % 2);
-			for (int i = 0; i < rings; i++) {
-//			double phi = (M_PI * (i + offset)) / (fragments/2);
-				double phi = (M_PI * (i + 0.5)) / rings;
-				double r = r1 * sin(phi);
-				ring[i].z = r1 * cos(phi);
-				ring[i].points = new point2d[fragments];
-				generate_circle(ring[i].points, r, fragments);
-			}
-
-			p->append_poly();
-			for (int i = 0; i < fragments; i++)
-				p->append_vertex(ring[0].points[i].x, ring[0].points[i].y, ring[0].z);
-
-			for (int i = 0; i < rings-1; i++) {
-				ring_s *r1 = &ring[i];
-				ring_s *r2 = &ring[i+1];
-				int r1i = 0, r2i = 0;
-				while (r1i < fragments || r2i < fragments)
-				{
-					if (r1i >= fragments)
-						goto sphere_next_r2;
-					if (r2i >= fragments)
-						goto sphere_next_r1;
-					if ((double)r1i / fragments <
-							(double)r2i / fragments)
-					{
-					sphere_next_r1:
-						p->append_poly();
-						int r1j = (r1i+1) % fragments;
-						p->insert_vertex(r1->points[r1i].x, r1->points[r1i].y, r1->z);
-						p->insert_vertex(r1->points[r1j].x, r1->points[r1j].y, r1->z);
-						p->insert_vertex(r2->points[r2i % fragments].x, r2->points[r2i % fragments].y, r2->z);
-						r1i++;
-					} else {
-					sphere_next_r2:
-						p->append_poly();
-						int r2j = (r2i+1) % fragments;
-						p->append_vertex(r2->points[r2i].x, r2->points[r2i].y, r2->z);
-						p->append_vertex(r2->points[r2j].x, r2->points[r2j].y, r2->z);
-						p->append_vertex(r1->points[r1i % fragments].x, r1->points[r1i % fragments].y, r1->z);
-						r2i++;
-					}
+			const SphereTemplate &t = *sphere_template(fragments);
+			const UnitCircle &circle = *t.circle;
+
+			std::vector<Vector3d> vertices;
+			vertices.reserve(t.rings * fragments);
+			for (int i = 0; i < t.rings; i++) {
+				double r = r1 * t.ringsin[i];
+				double z = r1 * t.ringcos[i];
+				for (int j = 0; j < fragments; j++) {
+					vertices.push_back(Vector3d(r*circle[j].x, r*circle[j].y, z));
 				}
 			}
-
-			p->append_poly();
-			for (int i = 0; i < fragments; i++)
-				p->insert_vertex(ring[rings-1].points[i].x, 
-												 ring[rings-1].points[i].y, 
-												 ring[rings-1].z);
-
-			for (int i = 0; i < rings; i++) {
-				delete[] ring[i].points;
-			}
-			delete[] ring;
+			p->append(vertices, t.faces);
 		}
 	}
 		break;
@@ -498,23 +542,39 @@ const Geometry *PrimitiveNode::createGeometry() const
 		PolySet *p = new PolySet(3);
 		g = p;
 		p->setConvexity(this->convexity);
-		for (size_t i=0; i<this->faces->toVector().size(); i++)
-		{
-			p->append_poly();
-			const Value::VectorType &vec = this->faces->toVector()[i]->toVector();
-			for (size_t j=0; j<vec.size(); j++) {
+		// Each point is converted once, when a face first refers to it, and
+		// the faces are collected as one flat index list
+		const Value::VectorType &points = this->points->toVector();
+		const Value::VectorType &faces = this->faces->toVector();
+		std::vector<int> remap(points.size(), -1);
+		std::vector<Vector3d> vertices;
+		std::vector<int> indices;
+		std::vector<size_t> offsets;
+		offsets.reserve(faces.size());
+		for (const auto &face : faces) {
+			offsets.push_back(indices.size());
+			const Value::VectorType &vec = face->toVector();
+			// Faces are given clockwise, polygons are counterclockwise
+			for (size_t j=vec.size(); j-- > 0; ) {
 				size_t pt = vec[j]->toDouble();
-				if (pt < this->points->toVector().size()) {
+				if (pt >= points.size()) continue;
+				if (remap[pt] < 0) {
 					double px, py, pz;
-					if (!this->points->toVector()[pt]->getVec3(px, py, pz) ||
+					if (!points[pt]->getVec3(px, py, pz) ||
 							std::isinf(px) || std::isinf(py) || std::isinf(pz)) {
-						PRINTB("ERROR: Unable to convert point at index %d to a vec3 of numbers", j);
+						PRINTB("ERROR: Unable to convert point at index %d to a vec3 of numbers", pt);
+						indices.resize(offsets.back());
+						offsets.pop_back();
+						p->append(vertices, indices, offsets);
 						return p;
 					}
-					p->insert_vertex(px, py, pz);
+					remap[pt] = vertices.size();
+					vertices.push_back(Vector3d(px, py, pz));
 				}
+				indices.push_back(remap[pt]);
 			}
 		}
+		p->append(vertices, indices, offsets);
 	}
 		break;
 	case SQUARE: {
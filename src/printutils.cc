@@ -1,13 +1,18 @@
 #include "printutils.h"
 #include <sstream>
 #include <stdio.h>
+#include <stdlib.h>
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/circular_buffer.hpp>
 #include <boost/filesystem.hpp>
+#include <mutex>
+#include <chrono>
 namespace fs = boost::filesystem;
 
-std::list<std::string> print_messages_stack;
+thread_local std::list<std::string> print_messages_stack;
+// Geometry may be evaluated by several threads at once
+static std::mutex print_mutex;
 OutputHandlerFunc *outputhandler = NULL;
 void *outputhandler_data = NULL;
 std::string OpenSCAD::debug("");
@@ -15,19 +20,63 @@ bool OpenSCAD::quiet = false;
 
 boost::circular_buffer<std::string> lastmessages(5);
 
+/*
+	Messages without an output handler are collected here and written to
+	stderr in one go, rather than with a system call for each message.
+	Warnings and errors are written at once, so they aren't lost if the
+	process dies.
+*/
+static std::string pending_output;
+static std::chrono::steady_clock::time_point last_output_flush;
+static const size_t MAX_PENDING_OUTPUT = 16384;
+static const std::chrono::milliseconds OUTPUT_FLUSH_INTERVAL(100);
+
+static void flush_pending_output()
+{
+	if (!pending_output.empty()) {
+		fwrite(pending_output.data(), 1, pending_output.size(), stderr);
+		fflush(stderr);
+		pending_output.clear();
+	}
+	last_output_flush = std::chrono::steady_clock::now();
+}
+
+/*!
+	Writes the messages which are collected for stderr. Called before
+	writing to stderr directly, to keep the order of the output.
+*/
+void flush_output()
+{
+	std::lock_guard<std::mutex> lock(print_mutex);
+	flush_pending_output();
+}
+
 void set_output_handler(OutputHandlerFunc *newhandler, void *userdata)
 {
+	std::lock_guard<std::mutex> lock(print_mutex);
+	flush_pending_output();
 	outputhandler = newhandler;
 	outputhandler_data = userdata;
 }
 
+static thread_local OutputHandlerFunc *thread_outputhandler = NULL;
+static thread_local void *thread_outputhandler_data = NULL;
+
+void set_thread_output_handler(OutputHandlerFunc *newhandler, void *userdata)
+{
+	thread_outputhandler = newhandler;
+	thread_outputhandler_data = userdata;
+}
+
 void print_messages_push()
 {
+	std::lock_guard<std::mutex> lock(print_mutex);
 	print_messages_stack.push_back(std::string());
 }
 
 void print_messages_pop()
 {
+	std::lock_guard<std::mutex> lock(print_mutex);
 	std::string msg = print_messages_stack.back();
 	print_messages_stack.pop_back();
 	if (print_messages_stack.size() > 0 && !msg.empty()) {
@@ -38,14 +87,43 @@ void print_messages_pop()
 	}
 }
 
+/*!
+	Returns the messages printed since the last print_messages_push().
+*/
+std::string print_messages_top()
+{
+	std::lock_guard<std::mutex> lock(print_mutex);
+	return print_messages_stack.empty() ? std::string() : print_messages_stack.back();
+}
+
+// Messages of the current thread are captured here if set, see PrintCapture
+static thread_local std::vector<std::string> *captured_messages = NULL;
+
+PrintCapture::PrintCapture(std::vector<std::string> &messages) : previous(captured_messages)
+{
+	captured_messages = &messages;
+}
+
+PrintCapture::~PrintCapture()
+{
+	captured_messages = this->previous;
+}
+
 void PRINT(const std::string &msg)
 {
 	if (msg.empty()) return;
-	if (print_messages_stack.size() > 0) {
-		if (!print_messages_stack.back().empty()) {
-			print_messages_stack.back() += "\n";
+	if (captured_messages) {
+		captured_messages->push_back(msg);
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(print_mutex);
+		if (print_messages_stack.size() > 0) {
+			if (!print_messages_stack.back().empty()) {
+				print_messages_stack.back() += "\n";
+			}
+			print_messages_stack.back() += msg;
 		}
-		print_messages_stack.back() += msg;
 	}
 	PRINT_NOCACHE(msg);
 }
@@ -53,6 +131,13 @@ void PRINT(const std::string &msg)
 void PRINT_NOCACHE(const std::string &msg)
 {
 	if (msg.empty()) return;
+	if (thread_outputhandler) {
+		if (!OpenSCAD::quiet || boost::starts_with(msg, "ERROR")) {
+			thread_outputhandler(msg, thread_outputhandler_data);
+		}
+		return;
+	}
+	std::lock_guard<std::mutex> lock(print_mutex);
 
 	if (boost::starts_with(msg, "WARNING") || boost::starts_with(msg, "ERROR")) {
 		size_t i;
@@ -65,7 +150,17 @@ void PRINT_NOCACHE(const std::string &msg)
 
 	if (!OpenSCAD::quiet || boost::starts_with(msg, "ERROR")) {
 		if (!outputhandler) {
-			fprintf(stderr, "%s\n", msg.c_str());
+			static bool flush_at_exit = false;
+			if (!flush_at_exit) {
+				flush_at_exit = true;
+				atexit(flush_output);
+			}
+			pending_output += msg;
+			pending_output += '\n';
+			if (pending_output.size() >= MAX_PENDING_OUTPUT || boost::starts_with(msg, "WARNING") || boost::starts_with(msg, "ERROR") ||
+					std::chrono::steady_clock::now() - last_output_flush >= OUTPUT_FLUSH_INTERVAL) {
+				flush_pending_output();
+			}
 		} else {
 			outputhandler(msg, outputhandler_data);
 		}
@@ -110,16 +205,20 @@ std::string two_digit_exp_format( double x )
 
 std::set<std::string> printedDeprecations;
 
+static std::mutex deprecation_mutex;
+
 void printDeprecation(const std::string &str)
 {
-	if (printedDeprecations.find(str) == printedDeprecations.end()) {
-		printedDeprecations.insert(str);
-		std::string msg = "DEPRECATED: " + str;
-		PRINT(msg);
+	{
+		std::lock_guard<std::mutex> lock(deprecation_mutex);
+		if (!printedDeprecations.insert(str).second) return;
 	}
+	std::string msg = "DEPRECATED: " + str;
+	PRINT(msg);
 }
 
 void resetPrintedDeprecations()
 {
+	std::lock_guard<std::mutex> lock(deprecation_mutex);
 	printedDeprecations.clear();
 }
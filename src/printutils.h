@@ -2,6 +2,7 @@
 
 #include <string>
 #include <list>
+#include <vector>
 #include <iostream>
 #include <boost/format.hpp>
 
@@ -18,10 +19,27 @@ namespace OpenSCAD {
 }
 
 void set_output_handler(OutputHandlerFunc *newhandler, void *userdata);
+// Overrides the output handler for the current thread, see Session
+void set_thread_output_handler(OutputHandlerFunc *newhandler, void *userdata);
 
-extern std::list<std::string> print_messages_stack;
+extern thread_local std::list<std::string> print_messages_stack;
 void print_messages_push();
 void print_messages_pop();
+std::string print_messages_top();
+
+/*!
+	While an instance exists, messages PRINTed by the current thread are
+	appended to \a messages instead of being output. Used to print the
+	messages of parallel evaluations in a deterministic order.
+*/
+class PrintCapture
+{
+public:
+	PrintCapture(std::vector<std::string> &messages);
+	~PrintCapture();
+private:
+	std::vector<std::string> *previous;
+};
 void printDeprecation(const std::string &str);
 void resetPrintedDeprecations();
 
@@ -33,6 +51,7 @@ void PRINT(const std::string &msg);
 #define PRINTB(_fmt, _arg) do { PRINT(str(boost::format(_fmt) % _arg)); } while (0)
 
 void PRINT_NOCACHE(const std::string &msg);
+void flush_output();
 #define PRINTB_NOCACHE(_fmt, _arg) do { PRINT_NOCACHE(str(boost::format(_fmt) % _arg)); } while (0)
 
 void PRINT_CONTEXT(const class Context *ctx, const class Module *mod, const class ModuleInstantiation *inst);
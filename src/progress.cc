@@ -1,16 +1,109 @@
 #include "progress.h"
 #include "node.h"
+#include "Tree.h"
+#include "GeometryCache.h"
+#include "EvaluationBudget.h"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 
 int progress_report_count;
 void (*progress_report_f)(const class AbstractNode*, void*, int);
 void *progress_report_userdata;
+// Serializes reports from parallel geometry evaluation
+static std::mutex progress_mutex;
+
+typedef std::chrono::steady_clock Clock;
+
+// Assumed cost of a node which was never evaluated before
+static const double DEFAULT_SECONDS = 0.001;
+// Bounds the evaluation times remembered for later estimates
+static const size_t MAX_HISTORY = 100000;
+
+struct NodeCost {
+	double estimate;    // seconds, the actual time once done
+	size_t inputfacets; // of the children done so far
+	int pendingchildren;
+	bool fromhistory;
+	bool done;
+};
+
+// Guards the estimates below, which are read from within progress_report_f
+static std::mutex state_mutex;
+static const Tree *progress_tree;
+static std::unordered_map<size_t, NodeCost> costs;
+static double total_seconds, done_seconds;
+static int done_nodes, last_mark;
+static Clock::time_point start_time;
+
+// Kept across evaluations: the exclusive time of each evaluated subtree id,
+// and the seconds and input facets of each operation
+static std::unordered_map<std::string, double> history;
+static std::unordered_map<std::string, std::pair<double, double>> rates;
+
+static void estimate_cost(const AbstractNode &node, const Tree &tree)
+{
+	NodeCost &cost = costs[node.index()];
+	cost.inputfacets = 0;
+	cost.pendingchildren = 0;
+	cost.fromhistory = false;
+	cost.done = false;
+	const std::string &key = tree.getIdString(node);
+	if (GeometryCache::instance()->get(key)) {
+		// Cached subtrees are not evaluated again
+		cost.estimate = 0;
+		return;
+	}
+	auto time = history.find(key);
+	cost.fromhistory = time != history.end();
+	cost.estimate = cost.fromhistory ? time->second : DEFAULT_SECONDS;
+	total_seconds += cost.estimate;
+	for(const auto &child : node.children) {
+		estimate_cost(*child, tree);
+		cost.pendingchildren++;
+	}
+}
+
+/*!
+	Drops the estimates of descendants which were evaluated as part of
+	their ancestor, e.g. by CGAL, and never reported on their own.
+*/
+static void skip_children(const AbstractNode &node)
+{
+	for(const auto &child : node.children) {
+		auto it = costs.find(child->index());
+		if (it == costs.end() || it->second.done) continue;
+		total_seconds -= it->second.estimate;
+		it->second.done = true;
+		done_nodes++;
+		skip_children(*child);
+	}
+}
 
-void progress_report_prep(AbstractNode *root, void (*f)(const class AbstractNode *node, void *userdata, int mark), void *userdata)
+/*!
+	Starts reporting progress of the evaluation of \a root to \a f. With a
+	\a tree, progress is weighted by the estimated cost of each node: the
+	time it took last time for subtrees evaluated before, nothing for cached
+	subtrees, and otherwise the time per input facet which the same
+	operation took so far, once its children are done.
+*/
+void progress_report_prep(const AbstractNode *root, void (*f)(const class AbstractNode *node, void *userdata, int mark), void *userdata, const Tree *tree)
 {
 	progress_report_count = 0;
 	progress_report_f = f;
 	progress_report_userdata = userdata;
 	root->progress_prepare();
+
+	std::lock_guard<std::mutex> lock(state_mutex);
+	costs.clear();
+	total_seconds = done_seconds = 0;
+	done_nodes = last_mark = 0;
+	progress_tree = tree;
+	if (tree) estimate_cost(*root, *tree);
+	start_time = Clock::now();
 }
 
 void progress_report_fin()
@@ -18,11 +111,94 @@ void progress_report_fin()
 	progress_report_count = 0;
 	progress_report_f = NULL;
 	progress_report_userdata = NULL;
+
+	std::lock_guard<std::mutex> lock(state_mutex);
+	progress_tree = NULL;
+	costs.clear();
 }
 
-void progress_update(const AbstractNode *node, int mark)
+static void report(const AbstractNode *node, int mark)
 {
-	if (progress_report_f)
+	if (progress_report_f) {
+		std::lock_guard<std::mutex> lock(progress_mutex);
 		progress_report_f(node, progress_report_userdata, mark);
+	}
+}
+
+void progress_update(const AbstractNode *node, int mark)
+{
+	EvaluationBudget::instance()->check(*node);
+	{
+		std::lock_guard<std::mutex> lock(state_mutex);
+		last_mark = std::max(last_mark, mark);
+	}
+	report(node, mark);
+}
+
+/*!
+	Reports that the geometry of \a node, a child of \a parent, with \a facets
+	facets was evaluated in \a seconds, not counting its children.
+*/
+void progress_evaluated(const AbstractNode &node, const AbstractNode *parent, double seconds, size_t facets)
+{
+	if (!progress_report_f) return;
+	{
+		std::lock_guard<std::mutex> lock(state_mutex);
+		last_mark = std::max(last_mark, node.progress_mark);
+		auto it = costs.find(node.index());
+		if (it != costs.end() && !it->second.done) {
+			NodeCost &cost = it->second;
+			skip_children(node);
+			total_seconds += seconds - cost.estimate;
+			done_seconds += seconds;
+			cost.estimate = seconds;
+			cost.done = true;
+			done_nodes++;
+			if (seconds > 0) {
+				if (history.size() >= MAX_HISTORY) history.clear();
+				history[progress_tree->getIdString(node)] = seconds;
+				if (cost.inputfacets > 0) {
+					std::pair<double, double> &rate = rates[node.name()];
+					rate.first += seconds;
+					rate.second += cost.inputfacets;
+				}
+			}
+			auto p = parent ? costs.find(parent->index()) : costs.end();
+			if (p != costs.end() && !p->second.done) {
+				NodeCost &parentcost = p->second;
+				parentcost.inputfacets += facets;
+				if (--parentcost.pendingchildren == 0 && !parentcost.fromhistory) {
+					auto rate = rates.find(parent->name());
+					if (rate != rates.end() && rate->second.second > 0) {
+						const double estimate = std::max(DEFAULT_SECONDS, parentcost.inputfacets * rate->second.first / rate->second.second);
+						total_seconds += estimate - parentcost.estimate;
+						parentcost.estimate = estimate;
+					}
+				}
+			}
+		}
+	}
+	report(&node, node.progress_mark);
 }
 
+ProgressStatus progress_status()
+{
+	std::lock_guard<std::mutex> lock(state_mutex);
+	ProgressStatus status;
+	status.elapsed = std::chrono::duration<double>(Clock::now() - start_time).count();
+	if (progress_tree) {
+		status.nodes = done_nodes;
+		status.total = int(costs.size());
+		status.fraction = total_seconds > 0 ? std::min(1.0, done_seconds / total_seconds) : 0;
+		// Evaluation times don't include overhead between nodes, and add up
+		// over threads, so the estimate is scaled to the elapsed time
+		status.remaining = done_seconds > 0 ? std::max(0.0, total_seconds - done_seconds) * status.elapsed / done_seconds : -1;
+	}
+	else {
+		status.nodes = last_mark;
+		status.total = progress_report_count;
+		status.fraction = status.total > 0 ? std::min(1.0, double(last_mark) / status.total) : 0;
+		status.remaining = status.fraction > 0 ? status.elapsed * (1 - status.fraction) / status.fraction : -1;
+	}
+	return status;
+}
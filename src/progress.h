@@ -1,13 +1,30 @@
 #pragma once
 
+#include <stddef.h>
+
 // Reset to 0 in _prep() and increased for each Node instance in progress_prepare()
 extern int progress_report_count;
 
 extern void (*progress_report_f)(const class AbstractNode*, void*, int);
 extern void *progress_report_userdata;
 
-void progress_report_prep(AbstractNode *root, void (*f)(const class AbstractNode *node, void *userdata, int mark), void *userdata);
+/*!
+	Progress of the current evaluation. If a tree was given to
+	progress_report_prep(), the fraction is weighted by the estimated cost of
+	the nodes, otherwise it is the share of reported nodes.
+*/
+struct ProgressStatus {
+	double fraction;  // 0 to 1
+	double elapsed;   // seconds since progress_report_prep()
+	double remaining; // estimated seconds left, negative if unknown
+	int nodes;        // nodes done
+	int total;
+};
+
+void progress_report_prep(const AbstractNode *root, void (*f)(const class AbstractNode *node, void *userdata, int mark), void *userdata, const class Tree *tree = NULL);
 void progress_report_fin();
 void progress_update(const AbstractNode *node, int mark);
+void progress_evaluated(const AbstractNode &node, const AbstractNode *parent, double seconds, size_t facets);
+ProgressStatus progress_status();
 
 class ProgressCancelException { };
@@ -0,0 +1,69 @@
+#include "reducednode.h"
+#include "ModuleInstantiation.h"
+#include "Geometry.h"
+#include "polyset.h"
+
+#include <sstream>
+
+ReducedNode::Evaluator ReducedNode::evaluator = NULL;
+
+std::string ReducedNode::toString() const
+{
+	std::stringstream stream;
+	stream << this->name() << "(id = \"" << this->id << "\")";
+	return stream.str();
+}
+
+const Geometry *ReducedNode::createGeometry() const
+{
+	// An empty intersection
+	if (!this->geom) return new PolySet(3);
+	return this->geom->copy();
+}
+
+// Whether a modifier is used in the subtree, which its geometry would lose
+static bool has_modifier(const AbstractNode &node)
+{
+	if (node.modinst && (node.modinst->isRoot() || node.modinst->isHighlight() || node.modinst->isBackground())) {
+		return true;
+	}
+	for(const auto &child : node.children) {
+		if (has_modifier(*child)) return true;
+	}
+	return false;
+}
+
+/*!
+	Replaces the children of \a node, a group or an intersection, by one
+	ReducedNode holding their union or intersection. Returns false and
+	leaves the children if geometry can't be evaluated here or a child uses
+	a modifier.
+*/
+bool ReducedNode::reduce(AbstractNode &node)
+{
+	if (!evaluator || node.children.empty()) return false;
+	for(const auto &child : node.children) {
+		if (has_modifier(*child)) return false;
+	}
+
+	const bool intersection = dynamic_cast<AbstractIntersectionNode *>(&node) != NULL;
+	AbstractNode *group = intersection ? static_cast<AbstractNode *>(new AbstractIntersectionNode(node.modinst)) :
+		new GroupNode(node.modinst);
+	group->children.swap(node.children);
+	std::string id;
+	shared_ptr<const Geometry> geom;
+	try {
+		geom = evaluator(*group, id);
+	}
+	catch (...) {
+		group->children.swap(node.children);
+		delete group;
+		throw;
+	}
+	delete group;
+
+	if (intersection || (geom && !geom->isEmpty())) {
+		node.children.push_back(new ReducedNode(node.modinst, geom, id));
+	}
+	return true;
+}
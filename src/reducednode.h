@@ -0,0 +1,33 @@
+#pragma once
+
+#include "node.h"
+#include "memory.h"
+#include <string>
+
+class Geometry;
+
+/*!
+	Stands for a group of nodes which has already been evaluated into
+	\a geom, e.g. the iterations of a large for loop reduced while it's
+	being instantiated. \a id identifies the nodes it was made from, so
+	its geometry is cached like theirs.
+*/
+class ReducedNode : public LeafNode
+{
+public:
+	VISITABLE();
+	ReducedNode(const ModuleInstantiation *mi, const shared_ptr<const Geometry> &geom, const std::string &id)
+		: LeafNode(mi), geom(geom), id(id) { }
+	virtual std::string toString() const;
+	virtual std::string name() const { return "reduced"; }
+	virtual const Geometry *createGeometry() const;
+
+	// Evaluates the geometry of a subtree and its id; set where geometry can be evaluated
+	typedef shared_ptr<const Geometry> (*Evaluator)(const AbstractNode &node, std::string &id);
+	static Evaluator evaluator;
+
+	static bool reduce(AbstractNode &node);
+
+	shared_ptr<const Geometry> geom;
+	std::string id;
+};
@@ -47,7 +47,7 @@ AbstractNode *RenderModule::instantiate(const Context *ctx, const ModuleInstanti
 	RenderNode *node = new RenderNode(inst);
 
 	AssignmentList args;
-	args += Assignment("convexity");
+	args += Assignment("convexity"), Assignment("pin");
 
 	Context c(ctx);
 	c.setVariables(args, evalctx);
@@ -56,6 +56,7 @@ AbstractNode *RenderModule::instantiate(const Context *ctx, const ModuleInstanti
 	ValuePtr v = c.lookup_variable("convexity");
 	if (v->type() == Value::NUMBER)
 		node->convexity = (int)v->toDouble();
+	node->pin = c.lookup_variable("pin", true)->toBool();
 
 	std::vector<AbstractNode *> instantiatednodes = inst->instantiateChildren(evalctx);
 	node->children.insert(node->children.end(), instantiatednodes.begin(), instantiatednodes.end());
@@ -67,7 +68,9 @@ std::string RenderNode::toString() const
 {
 	std::stringstream stream;
 
-	stream << this->name() << "(convexity = " << convexity << ")";
+	stream << this->name() << "(convexity = " << convexity;
+	if (this->pin) stream << ", pin = true";
+	stream << ")";
 
 	return stream.str();
 }
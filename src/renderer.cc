@@ -16,7 +16,7 @@ bool Renderer::getColor(Renderer::ColorMode colormode, Color4f &col) const
 	return false;
 }
 
-Renderer::Renderer() : colorscheme(NULL)
+Renderer::Renderer() : colorscheme(NULL), interactive(false)
 {
 	PRINTD("Renderer() start");
 	// Setup default colors
@@ -105,9 +105,70 @@ void Renderer::render_surface(shared_ptr<const Geometry> geom, csgmode_e csgmode
 	if (ps) ps->render_surface(csgmode, m, shaderinfo);
 }
 
+/*!
+	Draws \a geom once for each of \a matrices.
+*/
+void Renderer::render_surface(shared_ptr<const Geometry> geom, csgmode_e csgmode, const std::vector<const Transform3d *> &matrices, GLint *shaderinfo)
+{
+	shared_ptr<const PolySet> ps = dynamic_pointer_cast<const PolySet>(geom);
+	if (ps) ps->render_surface(csgmode, matrices, shaderinfo);
+}
+
 void Renderer::render_edges(shared_ptr<const Geometry> geom, csgmode_e csgmode)
 {
 	shared_ptr<const PolySet> ps = dynamic_pointer_cast<const PolySet>(geom);
 	if (ps) ps->render_edges(csgmode);
 }
 
+/*!
+	Returns the bounding box of \a geom as drawn with the matrix \a m, i.e.
+	including the thickness given to 2D geometry, or an empty box.
+*/
+BoundingBox Renderer::getRenderedBoundingBox(const shared_ptr<const Geometry> &geom, const Transform3d &m)
+{
+	if (!geom) return BoundingBox();
+	BoundingBox bbox = geom->getBoundingBox();
+	if (bbox.isEmpty()) return bbox;
+	if (geom->getDimension() == 2) {
+		// See PolySet::build_surface(); differences are slightly thicker
+		bbox.min()[2] = -0.55;
+		bbox.max()[2] = 0.55;
+	}
+	return m * bbox;
+}
+
+ViewFrustum::ViewFrustum() : valid(false)
+{
+#ifndef NULLGL
+	Eigen::Matrix4d modelview, projection;
+	glGetDoublev(GL_MODELVIEW_MATRIX, modelview.data());
+	glGetDoublev(GL_PROJECTION_MATRIX, projection.data());
+	this->clip = projection * modelview;
+	this->valid = true;
+#endif
+}
+
+/*!
+	Returns false if \a bbox is entirely outside the view, i.e. all its
+	corners are beyond the same clip plane. Empty boxes are not visible.
+*/
+bool ViewFrustum::isVisible(const BoundingBox &bbox) const
+{
+	if (bbox.isEmpty()) return false;
+	if (!this->valid) return true;
+
+	// Bit i is set while all corners are outside clip plane i so far
+	unsigned int outside = 0x3f;
+	for (int i = 0; i < 8 && outside; i++) {
+		const Eigen::Vector4d p = this->clip * Eigen::Vector4d(i & 1 ? bbox.max()[0] : bbox.min()[0],
+																													 i & 2 ? bbox.max()[1] : bbox.min()[1],
+																													 i & 4 ? bbox.max()[2] : bbox.min()[2], 1);
+		unsigned int corner = 0;
+		for (int j = 0; j < 3; j++) {
+			if (p[j] < -p[3]) corner |= 1 << (2 * j);
+			if (p[j] > p[3]) corner |= 2 << (2 * j);
+		}
+		outside &= corner;
+	}
+	return !outside;
+}
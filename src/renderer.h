@@ -46,11 +46,32 @@ public:
 	virtual void setColor(ColorMode colormode, GLint *shaderinfo = NULL) const;
 	virtual void setColor(ColorMode colormode, const float color[4], GLint *shaderinfo = NULL) const;
 	virtual void setColorScheme(const ColorScheme &cs);
+	// Set while the view moves, so detail may be traded for speed
+	void setInteractive(bool interactive) { this->interactive = interactive; }
 
 	static void render_surface(shared_ptr<const class Geometry> geom, csgmode_e csgmode, const Transform3d &m, GLint *shaderinfo = NULL);
+	static void render_surface(shared_ptr<const Geometry> geom, csgmode_e csgmode, const std::vector<const Transform3d *> &matrices, GLint *shaderinfo = NULL);
 	static void render_edges(shared_ptr<const Geometry> geom, csgmode_e csgmode);
+	static BoundingBox getRenderedBoundingBox(const shared_ptr<const Geometry> &geom, const Transform3d &m);
 
 protected:
 	std::map<ColorMode,Color4f> colormap;
 	const ColorScheme *colorscheme;
+	bool interactive;
+};
+
+/*!
+	The volume seen through the OpenGL modelview and projection matrices
+	in effect when constructed. Used to skip drawing objects which can't
+	be visible, e.g. most of a large assembly when zoomed in.
+*/
+class ViewFrustum
+{
+public:
+	ViewFrustum();
+	bool isVisible(const BoundingBox &bbox) const;
+
+private:
+	Eigen::Matrix4d clip;
+	bool valid;
 };
@@ -7,9 +7,10 @@ class RenderNode : public AbstractNode
 {
 public:
 	VISITABLE();
-	RenderNode(const ModuleInstantiation *mi) : AbstractNode(mi), convexity(1) { }
+	RenderNode(const ModuleInstantiation *mi) : AbstractNode(mi), convexity(1), pin(false) { }
 	virtual std::string toString() const;
 	virtual std::string name() const { return "render"; }
 
 	int convexity;
+	bool pin; // Keep the result cached for the session
 };
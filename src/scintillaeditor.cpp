@@ -147,6 +147,12 @@ ScintillaEditor::ScintillaEditor(QWidget *parent) : EditorInterface(parent)
 
 	lexer = new ScadLexer(this);
 	qsci->setLexer(lexer);
+#if QSCINTILLA_VERSION >= 0x020a00
+	// Scintilla lexes from the edit up to the visible lines. The lines
+	// below them are lexed while idle, so they aren't all lexed at once
+	// when e.g. folding or scrolling through a huge file needs them.
+	qsci->SendScintilla(QsciScintillaBase::SCI_SETIDLESTYLING, QsciScintillaBase::SC_IDLESTYLING_AFTERVISIBLE);
+#endif
 	initMargin();
 
 	connect(qsci, SIGNAL(textChanged()), this, SIGNAL(contentsChanged()));
@@ -1,8 +1,6 @@
 #include "settings.h"
 #include "printutils.h"
 
-#include <boost/assign/std/vector.hpp>
-using namespace boost::assign; // bring 'operator+=()' into scope
 
 namespace Settings {
 
@@ -44,26 +42,22 @@ bool SettingsEntry::is_default() const
 }
 
 static Value value(std::string s1, std::string s2) {
-	Value::VectorType v;
-	v += ValuePtr(s1), ValuePtr(s2);
+	Value::VectorType v{ValuePtr(s1), ValuePtr(s2)};
 	return v;
 }
 
 static Value values(std::string s1, std::string s1disp, std::string s2, std::string s2disp) {
-	Value::VectorType v;
-	v += ValuePtr(value(s1, s1disp)), ValuePtr(value(s2, s2disp));
+	Value::VectorType v{ValuePtr(value(s1, s1disp)), ValuePtr(value(s2, s2disp))};
 	return v;
 }
 
 static Value values(std::string s1, std::string s1disp, std::string s2, std::string s2disp, std::string s3, std::string s3disp) {
-	Value::VectorType v;
-	v += ValuePtr(value(s1, s1disp)), ValuePtr(value(s2, s2disp)), ValuePtr(value(s3, s3disp));
+	Value::VectorType v{ValuePtr(value(s1, s1disp)), ValuePtr(value(s2, s2disp)), ValuePtr(value(s3, s3disp))};
 	return v;
 }
 
 static Value values(std::string s1, std::string s1disp, std::string s2, std::string s2disp, std::string s3, std::string s3disp, std::string s4, std::string s4disp) {
-	Value::VectorType v;
-	v += ValuePtr(value(s1, s1disp)), ValuePtr(value(s2, s2disp)), ValuePtr(value(s3, s3disp)), ValuePtr(value(s4, s4disp));
+	Value::VectorType v{ValuePtr(value(s1, s1disp)), ValuePtr(value(s2, s2disp)), ValuePtr(value(s3, s3disp)), ValuePtr(value(s4, s4disp))};
 	return v;
 }
 
@@ -0,0 +1,57 @@
+#include "simplifynode.h"
+#include "module.h"
+#include "ModuleInstantiation.h"
+#include "evalcontext.h"
+#include "builtin.h"
+#include "printutils.h"
+
+#include <sstream>
+#include <boost/assign/std/vector.hpp>
+using namespace boost::assign; // bring 'operator+=()' into scope
+
+class SimplifyModule : public AbstractModule
+{
+public:
+	SimplifyModule() { }
+	virtual AbstractNode *instantiate(const Context *ctx, const ModuleInstantiation *inst, EvalContext *evalctx) const;
+};
+
+AbstractNode *SimplifyModule::instantiate(const Context *ctx, const ModuleInstantiation *inst, EvalContext *evalctx) const
+{
+	SimplifyNode *node = new SimplifyNode(inst);
+
+	AssignmentList args;
+	args += Assignment("error"), Assignment("faces");
+
+	Context c(ctx);
+	c.setVariables(args, evalctx);
+	inst->scope.apply(*evalctx);
+
+	ValuePtr error = c.lookup_variable("error", true);
+	if (error->type() == Value::NUMBER) {
+		node->error = error->toDouble();
+		if (node->error < 0) {
+			PRINTB("WARNING: simplify(error = %s) must not be negative, using 0", error->toString());
+			node->error = 0;
+		}
+	}
+	ValuePtr faces = c.lookup_variable("faces", true);
+	if (faces->type() == Value::NUMBER && faces->toDouble() > 0) node->faces = size_t(faces->toDouble());
+
+	std::vector<AbstractNode *> instantiatednodes = inst->instantiateChildren(evalctx);
+	node->children.insert(node->children.end(), instantiatednodes.begin(), instantiatednodes.end());
+
+	return node;
+}
+
+std::string SimplifyNode::toString() const
+{
+	std::stringstream stream;
+	stream << this->name() << "(error = " << this->error << ", faces = " << this->faces << ")";
+	return stream.str();
+}
+
+void register_builtin_simplify()
+{
+	Builtins::init("simplify", new SimplifyModule());
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "node.h"
+#include <string>
+
+/*!
+	Simplifies the mesh of its children, e.g. dense scans or high $fn
+	results, so the operations using it are faster. Edges are collapsed
+	while the surface moves at most about error, and more than faces
+	triangles are left.
+*/
+class SimplifyNode : public AbstractNode
+{
+public:
+	VISITABLE();
+	SimplifyNode(const ModuleInstantiation *mi) : AbstractNode(mi), error(0.01), faces(0) { }
+	virtual std::string toString() const;
+	virtual std::string name() const { return "simplify"; }
+
+	double error;
+	size_t faces;
+};
@@ -4,8 +4,9 @@
 #include "PlatformUtils.h"
 
 StackCheck * StackCheck::self = 0;
+thread_local unsigned char * StackCheck::ptr = 0;
 
-StackCheck::StackCheck() : ptr(0)
+StackCheck::StackCheck()
 {
 }
 
@@ -27,7 +28,7 @@ unsigned long StackCheck::size()
 
 bool StackCheck::check()
 {
-    return size() >= PlatformUtils::stackLimit();
+    return ptr && size() >= PlatformUtils::stackLimit();
 }
 
 StackCheck * StackCheck::inst()
@@ -13,7 +13,9 @@ public:
     unsigned long size();
     
 private:
-    unsigned char * ptr;
+    // Stack base of the thread which called init(). Other threads, such as
+    // thread pool workers, aren't checked.
+    static thread_local unsigned char * ptr;
     
     static StackCheck *self;
 };
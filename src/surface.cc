@@ -52,10 +52,23 @@ class SurfaceModule : public AbstractModule
 {
 public:
 	SurfaceModule() { }
+	virtual bool is_leaf() const { return true; }
 	virtual AbstractNode *instantiate(const Context *ctx, const ModuleInstantiation *inst, EvalContext *evalctx) const;
 };
 
-typedef std::unordered_map<std::pair<int,int>, double, boost::hash<std::pair<int,int>>> img_data_t;
+/*!
+	Heightmap values, stored row-major. min_val is one below the lowest
+	value read (but at most 0) and is used as the floor of the surface.
+*/
+struct img_data_t {
+	img_data_t() : lines(0), columns(0), min_val(0) {}
+	double operator()(int line, int column) const { return this->values[size_t(line) * this->columns + column]; }
+	void clear() { this->lines = this->columns = 0; this->values.clear(); this->min_val = 0; }
+
+	int lines, columns;
+	std::vector<double> values;
+	double min_val;
+};
 
 class SurfaceNode : public LeafNode
 {
@@ -93,6 +106,7 @@ AbstractNode *SurfaceModule::instantiate(const Context *ctx, const ModuleInstant
 
 	ValuePtr fileval = c.lookup_variable("file");
 	node->filename = lookup_file(fileval->isUndefined() ? "" : fileval->toString(), inst->path(), c.documentPath());
+	if (!node->filename.empty()) handle_dep(node->filename);
 
 	ValuePtr center = c.lookup_variable("center", true);
 	if (center->type() == Value::BOOL) {
@@ -114,12 +128,16 @@ AbstractNode *SurfaceModule::instantiate(const Context *ctx, const ModuleInstant
 
 void SurfaceNode::convert_image(img_data_t &data, std::vector<unsigned char> &img, unsigned int width, unsigned int height) const
 {
+	data.lines = height;
+	data.columns = width;
+	data.values.resize(size_t(width) * height);
 	for (unsigned int y = 0;y < height;y++) {
 		for (unsigned int x = 0;x < width;x++) {
 			long idx = 4 * (y * width + x);
 			double pixel = 0.2126 * img[idx] + 0.7152 * img[idx + 1] + 0.0722 * img[idx + 2];
 			double z = 100.0/255 * (invert ? 1 - pixel : pixel);
-			data[std::make_pair(height - 1 - y, x)] = z;
+			data.values[size_t(height - 1 - y) * width + x] = z;
+			data.min_val = std::min(z - 1, data.min_val);
 		}
 	}
 }
@@ -173,8 +191,9 @@ img_data_t SurfaceNode::read_dat(std::string filename) const
 		return data;
 	}
 
-	int lines = 0, columns = 0;
-	double min_val = 0;
+	// Rows may have different lengths; missing values are 0
+	std::vector<std::vector<double>> rows;
+	int columns = 0;
 
 	typedef boost::tokenizer<boost::char_separator<char>> tokenizer;
 	boost::char_separator<char> sep(" \t");
@@ -187,117 +206,133 @@ img_data_t SurfaceNode::read_dat(std::string filename) const
 		}
 		if (line.size() == 0 && stream.eof()) break;
 
-		int col = 0;
+		rows.push_back(std::vector<double>());
+		std::vector<double> &row = rows.back();
 		tokenizer tokens(line, sep);
 		try {
 			for(const auto &token : tokens) {
 				double v = boost::lexical_cast<double>(token);
-				data[std::make_pair(lines, col++)] = v;
-				if (col > columns) columns = col;
-				min_val = std::min(v-1, min_val);
+				row.push_back(v);
+				if (int(row.size()) > columns) columns = row.size();
+				data.min_val = std::min(v-1, data.min_val);
 			}
 		}
 		catch (const boost::bad_lexical_cast &blc) {
 			if (!stream.eof()) {
 				PRINTB("WARNING: Illegal value in '%s': %s", filename % blc.what());
 			}
+			if (row.empty()) rows.pop_back();
 			break;
   	}
-		lines++;
 	}
-	
+
+	data.lines = rows.size();
+	data.columns = columns;
+	data.values.resize(size_t(data.lines) * columns);
+	for (size_t i=0;i<rows.size();i++) {
+		std::copy(rows[i].begin(), rows[i].end(), data.values.begin() + i * columns);
+		std::vector<double>().swap(rows[i]);
+	}
 	return data;
 }
 
+/*!
+	Creates the surface mesh. Each grid point is a vertex, and each grid
+	cell is split into four triangles around a center vertex at its
+	average height. The sides and the bottom are closed at min_val.
+	All vertices are distinct, so they are added without lookups.
+*/
 const Geometry *SurfaceNode::createGeometry() const
 {
-	img_data_t data = read_png_or_dat(filename);
+	const img_data_t data = read_png_or_dat(filename);
 
 	PolySet *p = new PolySet(3);
 	p->setConvexity(convexity);
 	
-	int lines = 0;
-	int columns = 0;
-	double min_val = 0;
-	for (img_data_t::iterator it = data.begin();it != data.end();it++) {
-		lines = std::max(lines, (*it).first.first + 1);
-		columns = std::max(columns, (*it).first.second + 1);
-		min_val = std::min((*it).second - 1, min_val);
-	}
+	const int lines = data.lines;
+	const int columns = data.columns;
+	const double min_val = data.min_val;
 
 	double ox = center ? -(columns-1)/2.0 : 0;
 	double oy = center ? -(lines-1)/2.0 : 0;
 
-	for (int i = 1; i < lines; i++)
-	for (int j = 1; j < columns; j++)
-	{
-		double v1 = data[std::make_pair(i-1, j-1)];
-		double v2 = data[std::make_pair(i-1, j)];
-		double v3 = data[std::make_pair(i, j-1)];
-		double v4 = data[std::make_pair(i, j)];
-		double vx = (v1 + v2 + v3 + v4) / 4;
-
-		p->append_poly();
-		p->append_vertex(ox + j-1, oy + i-1, v1);
-		p->append_vertex(ox + j, oy + i-1, v2);
-		p->append_vertex(ox + j-0.5, oy + i-0.5, vx);
-
-		p->append_poly();
-		p->append_vertex(ox + j, oy + i-1, v2);
-		p->append_vertex(ox + j, oy + i, v4);
-		p->append_vertex(ox + j-0.5, oy + i-0.5, vx);
-
-		p->append_poly();
-		p->append_vertex(ox + j, oy + i, v4);
-		p->append_vertex(ox + j-1, oy + i, v3);
-		p->append_vertex(ox + j-0.5, oy + i-0.5, vx);
-
-		p->append_poly();
-		p->append_vertex(ox + j-1, oy + i, v3);
-		p->append_vertex(ox + j-1, oy + i-1, v1);
-		p->append_vertex(ox + j-0.5, oy + i-0.5, vx);
+	// Vertices are added row by row. Cells are added as soon as both of
+	// their rows exist, each with its center vertex.
+	std::vector<int> prevrow(columns), row(columns);
+	for (int i = 0; i < lines; i++) {
+		for (int j = 0; j < columns; j++) {
+			row[j] = p->append_unique_vertex(Vector3d(ox + j, oy + i, data(i, j)));
+		}
+		if (i > 0) {
+			for (int j = 1; j < columns; j++) {
+				double v1 = data(i-1, j-1);
+				double v2 = data(i-1, j);
+				double v3 = data(i, j-1);
+				double v4 = data(i, j);
+				double vx = (v1 + v2 + v3 + v4) / 4;
+				const int c = p->append_unique_vertex(Vector3d(ox + j-0.5, oy + i-0.5, vx));
+				const int quad[5] = { prevrow[j-1], prevrow[j], row[j], row[j-1], prevrow[j-1] };
+				for (int k = 0; k < 4; k++) {
+					p->append_poly();
+					p->append_index(quad[k]);
+					p->append_index(quad[k+1]);
+					p->append_index(c);
+				}
+			}
+		}
+		prevrow.swap(row);
 	}
 
+	// Grid vertices and the floor below the border, by line and column.
+	// Each line after the first is followed by the centers of its cells.
+	auto top = [columns](int i, int j) { return i == 0 ? j : columns + (i-1) * (2*columns-1) + j; };
+	std::unordered_map<std::pair<int,int>, int, boost::hash<std::pair<int,int>>> floor;
+	auto bottom = [p, &floor, ox, oy, min_val](int i, int j) {
+		auto result = floor.emplace(std::make_pair(i, j), 0);
+		if (result.second) result.first->second = p->append_unique_vertex(Vector3d(ox + j, oy + i, min_val));
+		return result.first->second;
+	};
+
 	for (int i = 1; i < lines; i++)
 	{
 		p->append_poly();
-		p->append_vertex(ox + 0, oy + i-1, min_val);
-		p->append_vertex(ox + 0, oy + i-1, data[std::make_pair(i-1, 0)]);
-		p->append_vertex(ox + 0, oy + i, data[std::make_pair(i, 0)]);
-		p->append_vertex(ox + 0, oy + i, min_val);
+		p->append_index(bottom(i-1, 0));
+		p->append_index(top(i-1, 0));
+		p->append_index(top(i, 0));
+		p->append_index(bottom(i, 0));
 
 		p->append_poly();
-		p->insert_vertex(ox + columns-1, oy + i-1, min_val);
-		p->insert_vertex(ox + columns-1, oy + i-1, data[std::make_pair(i-1, columns-1)]);
-		p->insert_vertex(ox + columns-1, oy + i, data[std::make_pair(i, columns-1)]);
-		p->insert_vertex(ox + columns-1, oy + i, min_val);
+		p->append_index(bottom(i, columns-1));
+		p->append_index(top(i, columns-1));
+		p->append_index(top(i-1, columns-1));
+		p->append_index(bottom(i-1, columns-1));
 	}
 
 	for (int i = 1; i < columns; i++)
 	{
 		p->append_poly();
-		p->insert_vertex(ox + i-1, oy + 0, min_val);
-		p->insert_vertex(ox + i-1, oy + 0, data[std::make_pair(0, i-1)]);
-		p->insert_vertex(ox + i, oy + 0, data[std::make_pair(0, i)]);
-		p->insert_vertex(ox + i, oy + 0, min_val);
+		p->append_index(bottom(0, i));
+		p->append_index(top(0, i));
+		p->append_index(top(0, i-1));
+		p->append_index(bottom(0, i-1));
 
 		p->append_poly();
-		p->append_vertex(ox + i-1, oy + lines-1, min_val);
-		p->append_vertex(ox + i-1, oy + lines-1, data[std::make_pair(lines-1, i-1)]);
-		p->append_vertex(ox + i, oy + lines-1, data[std::make_pair(lines-1, i)]);
-		p->append_vertex(ox + i, oy + lines-1, min_val);
+		p->append_index(bottom(lines-1, i-1));
+		p->append_index(top(lines-1, i-1));
+		p->append_index(top(lines-1, i));
+		p->append_index(bottom(lines-1, i));
 	}
 
 	if (columns > 1 && lines > 1) {
 		p->append_poly();
-		for (int i = 0; i < columns-1; i++)
-			p->insert_vertex(ox + i, oy + 0, min_val);
-		for (int i = 0; i < lines-1; i++)
-			p->insert_vertex(ox + columns-1, oy + i, min_val);
-		for (int i = columns-1; i > 0; i--)
-			p->insert_vertex(ox + i, oy + lines-1, min_val);
-		for (int i = lines-1; i > 0; i--)
-			p->insert_vertex(ox + 0, oy + i, min_val);
+		for (int i = 1; i < lines; i++)
+			p->append_index(bottom(i, 0));
+		for (int i = 1; i < columns; i++)
+			p->append_index(bottom(lines-1, i));
+		for (int i = lines-2; i >= 0; i--)
+			p->append_index(bottom(i, columns-1));
+		for (int i = columns-2; i >= 0; i--)
+			p->append_index(bottom(0, i));
 	}
 
 	return p;
@@ -41,6 +41,7 @@ class TextModule : public AbstractModule
 {
 public:
 	TextModule() : AbstractModule() { }
+	virtual bool is_leaf() const { return true; }
 	virtual AbstractNode *instantiate(const Context *ctx, const ModuleInstantiation *inst, EvalContext *evalctx) const;
 };
 
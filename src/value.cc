@@ -26,8 +26,14 @@
 
 #include "value.h"
 #include "printutils.h"
+#include "NumberFormat.h"
+#include "MemoryAccounting.h"
+#include "PerfCounters.h"
+#include "OperationCounters.h"
+#include "Session.h"
 #include <cmath>
 #include <assert.h>
+#include <Eigen/Core>
 #include <sstream>
 #include <boost/numeric/conversion/cast.hpp>
 #include <boost/variant/apply_visitor.hpp>
@@ -59,39 +65,186 @@ static uint32_t convert_to_uint32(const double d) {
 std::ostream &operator<<(std::ostream &stream, const Filename &filename)
 {
   fs::path fnpath = fs::path( (std::string)filename );
-  fs::path fpath = boostfs_uncomplete(fnpath, fs::current_path());
+  fs::path fpath = boostfs_uncomplete(fnpath, fs::path(Session::currentDirectory()));
   stream << QuotedString(fpath.generic_string());
   return stream;
 }
 
-// FIXME: This could probably be done more elegantly using boost::regex
-std::ostream &operator<<(std::ostream &stream, const QuotedString &s)
+static void write_quoted(std::ostream &stream, const std::string &s)
 {
   stream << '"';
-  for(char c : s) {
-    switch (c) {
-    case '\t':
-      stream << "\\t";
-      break;
-    case '\n':
-      stream << "\\n";
-      break;
-    case '\r':
-      stream << "\\r";
-      break;
-    case '"':
-    case '\\':
-      stream << '\\';
-      stream << c;
-      break;
-    default:
-      stream << c;
+  size_t start = 0;
+  for (size_t i = 0; i < s.size(); i++) {
+    const char *escape;
+    switch (s[i]) {
+    case '\t': escape = "\\t"; break;
+    case '\n': escape = "\\n"; break;
+    case '\r': escape = "\\r"; break;
+    case '"': escape = "\\\""; break;
+    case '\\': escape = "\\\\"; break;
+    default: continue;
     }
+    // Write unescaped runs in one go
+    stream.write(s.data() + start, i - start);
+    stream << escape;
+    start = i + 1;
   }
+  stream.write(s.data() + start, s.size() - start);
   stream << '"';
+}
+
+std::ostream &operator<<(std::ostream &stream, const QuotedString &s)
+{
+  write_quoted(stream, s);
   return stream;
 }
 
+ValueVector::ValueVector(std::vector<ValuePtr> &&v) : count(v.size())
+{
+	if (!v.empty()) this->first = make_shared<Segment>(std::move(v));
+}
+
+ValueVector::const_iterator::const_iterator(const ValueVector *vec, size_t segment)
+	: vec(vec), segment(0), p(nullptr), end(nullptr)
+{
+	next(segment);
+}
+
+// Moves to the first element of the first nonempty segment from \a segment on
+void ValueVector::const_iterator::next(size_t segment)
+{
+	for (;segment < this->vec->numSegments();segment++) {
+		const Segment *s = this->vec->segmentAt(segment);
+		if (!s->empty()) {
+			this->segment = segment;
+			this->p = s->data();
+			this->end = s->data() + s->size();
+			return;
+		}
+	}
+	this->p = this->end = nullptr;
+}
+
+const ValuePtr &ValueVector::at(size_t i) const
+{
+	for (size_t s = 0;s < numSegments();s++) {
+		const Segment &segment = *segmentAt(s);
+		if (i < segment.size()) return segment[i];
+		i -= segment.size();
+	}
+	assert(false && "ValueVector index out of range");
+	return ValuePtr::undefined;
+}
+
+/*!
+	Makes the elements a single segment of this vector's own, copying them
+	if they're shared, and returns it.
+*/
+ValueVector::Segment &ValueVector::flat()
+{
+	if (!this->first || !this->rest.empty() || this->first.use_count() > 1) {
+		shared_ptr<Segment> segment = make_shared<Segment>();
+		segment->reserve(this->count);
+		for (const auto &v : *this) segment->push_back(v);
+		this->first = segment;
+		this->rest.clear();
+	}
+	return *this->first;
+}
+
+// The last segment if no other vector shares it
+ValueVector::Segment *ValueVector::editableLast()
+{
+	const shared_ptr<Segment> &last = this->rest.empty() ? this->first : this->rest.back();
+	return last && last.use_count() == 1 ? last.get() : nullptr;
+}
+
+/*!
+	Merges the last segments until each one is at least twice as long as
+	the next one. Segments which aren't shared are appended to in place.
+*/
+void ValueVector::balance()
+{
+	while (!this->rest.empty()) {
+		const shared_ptr<Segment> &last = this->rest.back();
+		shared_ptr<Segment> &prev = this->rest.size() > 1 ? this->rest[this->rest.size() - 2] : this->first;
+		if (prev->size() >= 2 * last->size()) break;
+		if (prev.use_count() > 1) {
+			shared_ptr<Segment> merged = make_shared<Segment>();
+			merged->reserve(prev->size() + last->size());
+			merged->insert(merged->end(), prev->begin(), prev->end());
+			prev = merged;
+		}
+		prev->insert(prev->end(), last->begin(), last->end());
+		this->rest.pop_back();
+	}
+}
+
+// Appends a segment, sharing it
+void ValueVector::appendSegment(const shared_ptr<Segment> &segment)
+{
+	if (segment->empty()) return;
+	this->count += segment->size();
+	if (!this->first || this->first->empty()) this->first = segment;
+	else {
+		this->rest.push_back(segment);
+		balance();
+	}
+}
+
+void ValueVector::push_back(const ValuePtr &v)
+{
+	if (Segment *last = editableLast()) {
+		last->push_back(v);
+		this->count++;
+		balance();
+	}
+	else {
+		appendSegment(make_shared<Segment>(1, v));
+	}
+}
+
+void ValueVector::push_back(ValuePtr &&v)
+{
+	if (Segment *last = editableLast()) {
+		last->push_back(std::move(v));
+		this->count++;
+		balance();
+	}
+	else {
+		appendSegment(make_shared<Segment>(1, std::move(v)));
+	}
+}
+
+/*!
+	Appends the elements of \a other, sharing its segments.
+*/
+void ValueVector::append(const ValueVector &other)
+{
+	if (this->empty()) {
+		*this = other;
+		return;
+	}
+	for (size_t s = 0;s < other.numSegments();s++) {
+		appendSegment(s == 0 ? other.first : other.rest[s - 1]);
+	}
+}
+
+void ValueVector::resize(size_t n)
+{
+	flat().resize(n);
+	this->count = n;
+}
+
+bool ValueVector::operator==(const ValueVector &other) const
+{
+	if (this->count != other.count) return false;
+	for (const_iterator a = begin(), b = other.begin();a != end();++a, ++b) {
+		if (!(*a == *b)) return false;
+	}
+	return true;
+}
+
 Value::Value() : value(boost::blank())
 {
   //  std::cout << "creating undef\n";
@@ -132,6 +285,10 @@ Value::Value(const VectorType &v) : value(v)
   //  std::cout << "creating vector\n";
 }
 
+Value::Value(VectorType &&v) : value(std::move(v))
+{
+}
+
 Value::Value(const RangeType &v) : value(v)
 {
   //  std::cout << "creating range\n";
@@ -211,70 +368,101 @@ bool Value::getFiniteDouble(double &v) const
   return valid;
 }
 
-class tostring_visitor : public boost::static_visitor<std::string>
+// attempt to emulate Qt's QString.sprintf("%g"); from old OpenSCAD.
+// see https://github.com/openscad/openscad/issues/158
+static void write_number(std::ostream &stream, double v)
+{
+  if (v != v) { // Fix for avoiding nan vs. -nan across platforms
+    stream << "nan";
+    return;
+  }
+  if (v == 0) {
+    stream << '0'; // Don't return -0 (exactly -0 and 0 equal 0)
+    return;
+  }
+  stream << Number(v);
+}
+
+/*!
+	Writes values to a stream, without building intermediate strings for
+	nested vectors. Strings inside vectors are quoted, top level strings
+	only if \a quoted is set.
+*/
+class tostream_visitor : public boost::static_visitor<>
 {
 public:
-  template <typename T> std::string operator()(const T &op1) const {
-    //    std::cout << "[generic tostring_visitor]\n";
-    return boost::lexical_cast<std::string>(op1);	
+  tostream_visitor(std::ostream &stream, bool quoted) : stream(stream), quoted(quoted) {}
+
+  void operator()(const double &op1) const {
+    write_number(this->stream, op1);
   }
 
-  std::string operator()(const double &op1) const {
-    if (op1 != op1) { // Fix for avoiding nan vs. -nan across platforms
-      return "nan";
-    }
-    if (op1 == 0) {
-      return "0"; // Don't return -0 (exactly -0 and 0 equal 0)
-    }
-    // attempt to emulate Qt's QString.sprintf("%g"); from old OpenSCAD.
-    // see https://github.com/openscad/openscad/issues/158
-    std::stringstream tmp;
-    tmp.unsetf(std::ios::floatfield);
-    tmp << op1;
-    return tmp.str();
+  void operator()(const boost::blank &) const {
+    this->stream << "undef";
   }
 
-  std::string operator()(const boost::blank &) const {
-    return "undef";
+  void operator()(const bool &v) const {
+    this->stream << (v ? "true" : "false");
   }
 
-  std::string operator()(const bool &v) const {
-    return v ? "true" : "false";
+  void operator()(const std::string &v) const {
+    if (this->quoted) write_quoted(this->stream, v);
+    else this->stream << v;
   }
 
-  std::string operator()(const Value::VectorType &v) const {
-    std::stringstream stream;
-    stream << '[';
+  void operator()(const Value::VectorType &v) const {
+    const tostream_visitor element(this->stream, true);
+    this->stream << '[';
     for (size_t i = 0; i < v.size(); i++) {
-      if (i > 0) stream << ", ";
-      stream << *v[i];
+      if (i > 0) this->stream << ", ";
+      boost::apply_visitor(element, v[i]->value);
     }
-    stream << ']';
-    return stream.str();
+    this->stream << ']';
   }
 
-  std::string operator()(const RangeType &v) const {
-    return (boost::format("[%1% : %2% : %3%]") % v.begin_val % v.step_val % v.end_val).str();
+  void operator()(const RangeType &v) const {
+    this->stream << '[';
+    this->stream << Number(v.begin_val) << " : " << Number(v.step_val) << " : " << Number(v.end_val) << ']';
   }
 
-  std::string operator()(const ValuePtr &v) const {
-    return v->toString();
-  }
+private:
+  std::ostream &stream;
+  bool quoted;
 };
 
 std::string Value::toString() const
 {
-  return boost::apply_visitor(tostring_visitor(), this->value);
+  const std::string *s = boost::get<std::string>(&this->value);
+  if (s) return *s;
+  std::ostringstream stream;
+  toStream(stream);
+  return stream.str();
+}
+
+/*!
+	Writes the value as toString() would return it, or quoted and escaped
+	if it's a string and \a quoted is set.
+*/
+void Value::toStream(std::ostream &stream, bool quoted) const
+{
+  boost::apply_visitor(tostream_visitor(stream, quoted), this->value);
 }
 
-class chr_visitor : public boost::static_visitor<std::string> {
+std::ostream &operator<<(std::ostream &stream, const Value &value)
+{
+  value.toStream(stream, true);
+  return stream;
+}
+
+class chr_visitor : public boost::static_visitor<> {
 public:
-	template <typename S> std::string operator()(const S &) const
+	chr_visitor(std::string &result) : result(result) {}
+
+	template <typename S> void operator()(const S &) const
 	{
-		return "";
 	}
 
-	std::string operator()(const double &v) const
+	void operator()(const double &v) const
 	{
 		char buf[8];
 		memset(buf, 0, 8);
@@ -284,39 +472,46 @@ public:
 			    g_unichar_to_utf8(c, buf);
 			}
 		}
-		return std::string(buf);
+		this->result += buf;
 	}
 
-	std::string operator()(const Value::VectorType &v) const
+	void operator()(const Value::VectorType &v) const
 	{
-		std::stringstream stream;
 		for (size_t i = 0; i < v.size(); i++) {
-			stream << v[i]->chrString();
+			boost::apply_visitor(*this, v[i]->value);
 		}
-		return stream.str();
 	}
 
-	std::string operator()(const RangeType &v) const
+	void operator()(const RangeType &v) const
 	{
-		const uint32_t steps = v.numValues();
-		if (steps >= 10000) {
-			PRINTB("WARNING: Bad range parameter in for statement: too many elements (%lu).", steps);
-			return "";
+		if (v.isUnbounded()) {
+			PRINTB("WARNING: Bad range parameter in for statement: too many elements (%lu).", v.numValues());
+			return;
 		}
 
-		std::stringstream stream;
 		RangeType range = v;
 		for (RangeType::iterator it = range.begin();it != range.end();it++) {
-			const Value value(*it);
-			stream << value.chrString();
+			(*this)(*it);
 		}
-		return stream.str();
 	}
+
+private:
+	std::string &result;
 };
 
 std::string Value::chrString() const
 {
-  return boost::apply_visitor(chr_visitor(), this->value);
+  std::string result;
+  chrAppend(result);
+  return result;
+}
+
+/*!
+	Appends chrString() to \a result.
+*/
+void Value::chrAppend(std::string &result) const
+{
+  boost::apply_visitor(chr_visitor(result), this->value);
 }
 
 const Value::VectorType &Value::toVector() const
@@ -460,6 +655,60 @@ bool Value::operator<=(const Value &v) const
   return boost::apply_visitor(lessequal_visitor(), this->value, v.value);
 }
 
+/*
+  Numeric vectors and matrices are unboxed into dense Eigen buffers for
+  arithmetic, so only the results are boxed into new values.
+*/
+typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> DenseMatrix;
+typedef Eigen::Matrix<double, Eigen::Dynamic, 1> DenseVector;
+
+// Unboxes a vector of numbers, returns false if any element isn't a number
+static bool unbox_vector(const Value::VectorType &vec, DenseVector &out)
+{
+  out.resize(vec.size());
+  for (size_t i = 0; i < vec.size(); i++) {
+    if (vec[i]->type() != Value::NUMBER) return false;
+    out[i] = vec[i]->toDouble();
+  }
+  return true;
+}
+
+/*
+  Unboxes the first \a cols columns of a matrix of numbers. Returns false
+  unless all rows are vectors of \a cols numbers, or at least \a cols with
+  \a longer rows allowed.
+*/
+static bool unbox_matrix(const Value::VectorType &mat, size_t cols, DenseMatrix &out, bool longer = false)
+{
+  out.resize(mat.size(), cols);
+  for (size_t i = 0; i < mat.size(); i++) {
+    if (mat[i]->type() != Value::VECTOR) return false;
+    const Value::VectorType &row = mat[i]->toVector();
+    if (row.size() < cols || (row.size() > cols && !longer)) return false;
+    for (size_t j = 0; j < cols; j++) {
+      if (row[j]->type() != Value::NUMBER) return false;
+      out(i, j) = row[j]->toDouble();
+    }
+  }
+  return true;
+}
+
+static Value box_vector(const DenseVector &vec)
+{
+  Value::VectorType dstv;
+  dstv.reserve(vec.size());
+  for (Eigen::Index i = 0; i < vec.size(); i++) dstv.push_back(ValuePtr(vec(i)));
+  return Value(std::move(dstv));
+}
+
+static Value box_matrix(const DenseMatrix &mat)
+{
+  Value::VectorType dstv;
+  dstv.reserve(mat.rows());
+  for (Eigen::Index i = 0; i < mat.rows(); i++) dstv.push_back(ValuePtr(box_vector(mat.row(i).transpose())));
+  return Value(std::move(dstv));
+}
+
 class plus_visitor : public boost::static_visitor<Value>
 {
 public:
@@ -472,11 +721,16 @@ public:
   }
 
   Value operator()(const Value::VectorType &op1, const Value::VectorType &op2) const {
+    const size_t n = std::min(op1.size(), op2.size());
+    DenseVector v1, v2;
+    if (unbox_vector(op1, v1) && unbox_vector(op2, v2)) return box_vector(v1.head(n) + v2.head(n));
+
     Value::VectorType sum;
-    for (size_t i = 0; i < op1.size() && i < op2.size(); i++) {
+    sum.reserve(n);
+    for (size_t i = 0; i < n; i++) {
       sum.push_back(ValuePtr(*op1[i] + *op2[i]));
     }
-    return Value(sum);
+    return Value(std::move(sum));
   }
 };
 
@@ -497,11 +751,16 @@ public:
   }
 
   Value operator()(const Value::VectorType &op1, const Value::VectorType &op2) const {
+    const size_t n = std::min(op1.size(), op2.size());
+    DenseVector v1, v2;
+    if (unbox_vector(op1, v1) && unbox_vector(op2, v2)) return box_vector(v1.head(n) - v2.head(n));
+
     Value::VectorType sum;
-    for (size_t i = 0; i < op1.size() && i < op2.size(); i++) {
+    sum.reserve(n);
+    for (size_t i = 0; i < n; i++) {
       sum.push_back(ValuePtr(*op1[i] - *op2[i]));
     }
-    return Value(sum);
+    return Value(std::move(sum));
   }
 };
 
@@ -513,52 +772,38 @@ Value Value::operator-(const Value &v) const
 Value Value::multvecnum(const Value &vecval, const Value &numval)
 {
   // Vector * Number
+  const VectorType &vec = vecval.toVector();
+  DenseVector v;
+  if (unbox_vector(vec, v)) return box_vector(v * numval.toDouble());
+
   VectorType dstv;
-  for(const auto &val : vecval.toVector()) {
+  dstv.reserve(vec.size());
+  for(const auto &val : vec) {
     dstv.push_back(ValuePtr(*val * numval));
   }
-  return Value(dstv);
+  return Value(std::move(dstv));
 }
 
 Value Value::multmatvec(const VectorType &matrixvec, const VectorType &vectorvec)
 {
   // Matrix * Vector
-  VectorType dstv;
-  for (size_t i=0;i<matrixvec.size();i++) {
-    if (matrixvec[i]->type() != VECTOR || 
-        matrixvec[i]->toVector().size() != vectorvec.size()) {
-      return Value();
-    }
-    double r_e = 0.0;
-    for (size_t j=0;j<matrixvec[i]->toVector().size();j++) {
-      if (matrixvec[i]->toVector()[j]->type() != NUMBER || vectorvec[j]->type() != NUMBER) {
-        return Value();
-      }
-      r_e += matrixvec[i]->toVector()[j]->toDouble() * vectorvec[j]->toDouble();
-    }
-    dstv.push_back(ValuePtr(r_e));
-  }
-  return Value(dstv);
+  DenseMatrix m;
+  DenseVector v;
+  if (!unbox_matrix(matrixvec, vectorvec.size(), m) || !unbox_vector(vectorvec, v)) return Value();
+  return box_vector(m * v);
 }
 
 Value Value::multvecmat(const VectorType &vectorvec, const VectorType &matrixvec)
 {
   assert(vectorvec.size() == matrixvec.size());
   // Vector * Matrix
-  VectorType dstv;
-  for (size_t i=0;i<matrixvec[0]->toVector().size();i++) {
-    double r_e = 0.0;
-    for (size_t j=0;j<vectorvec.size();j++) {
-      if (matrixvec[j]->type() != VECTOR ||
-          matrixvec[j]->toVector()[i]->type() != NUMBER || 
-          vectorvec[j]->type() != NUMBER) {
-        return Value::undefined;
-      }
-      r_e += vectorvec[j]->toDouble() * matrixvec[j]->toVector()[i]->toDouble();
-    }
-    dstv.push_back(ValuePtr(r_e));
+  DenseVector v;
+  DenseMatrix m;
+  if (!unbox_vector(vectorvec, v) || matrixvec[0]->type() != VECTOR ||
+      !unbox_matrix(matrixvec, matrixvec[0]->toVector().size(), m, true)) {
+    return Value::undefined;
   }
-  return Value(dstv);
+  return box_vector(v.transpose() * m);
 }
 
 Value Value::operator*(const Value &v) const
@@ -580,14 +825,9 @@ Value Value::operator*(const Value &v) const
     if (vec1[0]->type() == NUMBER && vec2[0]->type() == NUMBER &&
         vec1.size() == vec2.size()) { 
         // Vector dot product.
-        double r = 0.0;
-        for (size_t i=0;i<vec1.size();i++) {
-          if (vec1[i]->type() != NUMBER || vec2[i]->type() != NUMBER) {
-            return Value::undefined;
-          }
-          r += (vec1[i]->toDouble() * vec2[i]->toDouble());
-        }
-        return Value(r);
+        DenseVector v1, v2;
+        if (!unbox_vector(vec1, v1) || !unbox_vector(vec2, v2)) return Value::undefined;
+        return Value(v1.dot(v2));
     } else if (vec1[0]->type() == VECTOR && vec2[0]->type() == NUMBER &&
                vec1[0]->toVector().size() == vec2.size()) {
       return multmatvec(vec1, vec2);
@@ -597,13 +837,20 @@ Value Value::operator*(const Value &v) const
     } else if (vec1[0]->type() == VECTOR && vec2[0]->type() == VECTOR &&
                vec1[0]->toVector().size() == vec2.size()) {
       // Matrix * Matrix
+      DenseMatrix m1, m2;
+      if (unbox_matrix(vec1, vec2.size(), m1) &&
+          unbox_matrix(vec2, vec2[0]->toVector().size(), m2, true)) {
+        return box_matrix(m1 * m2);
+      }
+      // Rows which aren't numeric give undefined rows
       VectorType dstv;
+      dstv.reserve(vec1.size());
       for(const auto &srcrow : vec1) {
           const VectorType &srcrowvec = srcrow->toVector();
           if (srcrowvec.size() != vec2.size()) return Value::undefined;
           dstv.push_back(ValuePtr(multvecmat(srcrowvec, vec2)));
       }
-      return Value(dstv);
+      return Value(std::move(dstv));
     }
   }
   return Value::undefined;
@@ -617,18 +864,20 @@ Value Value::operator/(const Value &v) const
   else if (this->type() == VECTOR && v.type() == NUMBER) {
     const VectorType &vec = this->toVector();
     VectorType dstv;
+    dstv.reserve(vec.size());
     for(const auto &vecval : vec) {
       dstv.push_back(ValuePtr(*vecval / v));
     }
-    return Value(dstv);
+    return Value(std::move(dstv));
   }
   else if (this->type() == NUMBER && v.type() == VECTOR) {
     const VectorType &vec = v.toVector();
     VectorType dstv;
+    dstv.reserve(vec.size());
     for(const auto &vecval : vec) {
       dstv.push_back(ValuePtr(*this / *vecval));
     }
-    return Value(dstv);
+    return Value(std::move(dstv));
   }
   return Value::undefined;
 }
@@ -649,10 +898,11 @@ Value Value::operator-() const
   else if (this->type() == VECTOR) {
     const VectorType &vec = this->toVector();
     VectorType dstv;
+    dstv.reserve(vec.size());
     for(const auto &vecval : vec) {
       dstv.push_back(ValuePtr(-*vecval));
     }
-    return Value(dstv);
+    return Value(std::move(dstv));
   }
   return Value::undefined;
 }
@@ -759,7 +1009,7 @@ uint32_t RangeType::numValues() const {
     numvals = (end_val - begin_val) / step_val + 1;
   }
   
-  return numvals;
+  return std::min(numvals, double(std::numeric_limits<uint32_t>::max()));
 }
 
 RangeType::iterator::iterator(RangeType &range, type_t type) : range(range), val(range.begin_val), type(type)
@@ -825,54 +1075,113 @@ bool RangeType::iterator::operator!=(const self_type &other) const
     return !(*this == other);
 }
 
+/*!
+	Values are immutable, so undef, booleans and small non-negative integers
+	are interned: constructing one shares a preallocated value instead of
+	allocating. These are by far the most common results of comparisons,
+	loop counters and indexing.
+*/
+namespace {
+	const int INTERNED_NUMBERS = 256;
+
+	const shared_ptr<const Value> &interned_undef() {
+		static const shared_ptr<const Value> undef = make_shared<const Value>();
+		return undef;
+	}
+
+	const shared_ptr<const Value> &interned_bool(bool v) {
+		static const shared_ptr<const Value> values[2] = {
+			make_shared<const Value>(false), make_shared<const Value>(true)
+		};
+		return values[v ? 1 : 0];
+	}
+
+	const shared_ptr<const Value> *interned_number(double v) {
+		// -0.0 is kept distinct since it's observable through division
+		if (!(v >= 0 && v < INTERNED_NUMBERS) || v != std::floor(v) || std::signbit(v)) return NULL;
+		static const std::vector<shared_ptr<const Value>> values = []() {
+			std::vector<shared_ptr<const Value>> values;
+			values.reserve(INTERNED_NUMBERS);
+			for (int i=0;i<INTERNED_NUMBERS;i++) values.push_back(make_shared<const Value>(double(i)));
+			return values;
+		}();
+		return &values[int(v)];
+	}
+}
+
+/*!
+	Allocates a Value, accounted as such with ENABLE_MEMORY_ACCOUNTING.
+*/
+template<typename T>
+static shared_ptr<const Value> make_value(T &&v)
+{
+	MemoryAccounting::Scope memoryscope(MemoryAccounting::VALUES);
+	OperationCounters::count(OperationCounters::VALUE_ALLOCATIONS);
+	return make_shared<const Value>(std::forward<T>(v));
+}
+
 ValuePtr::ValuePtr()
+	: shared_ptr<const Value>(interned_undef())
 {
-	this->reset(new Value());
 }
 
 ValuePtr::ValuePtr(const Value &v)
+	: shared_ptr<const Value>(make_value(v))
+{
+}
+
+ValuePtr::ValuePtr(Value &&v)
+	: shared_ptr<const Value>(make_value(std::move(v)))
 {
-	this->reset(new Value(v));
 }
 
 ValuePtr::ValuePtr(bool v)
+	: shared_ptr<const Value>(interned_bool(v))
 {
-	this->reset(new Value(v));
 }
 
 ValuePtr::ValuePtr(int v)
 {
-	this->reset(new Value(v));
+	const shared_ptr<const Value> *interned = interned_number(v);
+	if (interned) shared_ptr<const Value>::operator=(*interned);
+	else shared_ptr<const Value>::operator=(make_value(v));
 }
 
 ValuePtr::ValuePtr(double v)
 {
-	this->reset(new Value(v));
+	const shared_ptr<const Value> *interned = interned_number(v);
+	if (interned) shared_ptr<const Value>::operator=(*interned);
+	else shared_ptr<const Value>::operator=(make_value(v));
 }
 
 ValuePtr::ValuePtr(const std::string &v)
+	: shared_ptr<const Value>(make_value(v))
 {
-	this->reset(new Value(v));
 }
 
 ValuePtr::ValuePtr(const char *v)
+	: shared_ptr<const Value>(make_value(v))
 {
-	this->reset(new Value(v));
 }
 
 ValuePtr::ValuePtr(const char v)
+	: shared_ptr<const Value>(make_value(v))
 {
-	this->reset(new Value(v));
 }
 
 ValuePtr::ValuePtr(const Value::VectorType &v)
+	: shared_ptr<const Value>(make_value(v))
+{
+}
+
+ValuePtr::ValuePtr(Value::VectorType &&v)
+	: shared_ptr<const Value>(make_value(std::move(v)))
 {
-	this->reset(new Value(v));
 }
 
 ValuePtr::ValuePtr(const RangeType &v)
+	: shared_ptr<const Value>(make_value(v))
 {
-	this->reset(new Value(v));
 }
 
 bool ValuePtr::operator==(const ValuePtr &v) const
@@ -922,26 +1231,31 @@ ValuePtr ValuePtr::operator[](const ValuePtr &v) const
 
 ValuePtr ValuePtr::operator+(const ValuePtr &v) const
 {
+	PERF_PROBE("value-arithmetic");
 	return ValuePtr(**this + *v);
 }
 
 ValuePtr ValuePtr::operator-(const ValuePtr &v) const
 {
+	PERF_PROBE("value-arithmetic");
 	return ValuePtr(**this - *v);
 }
 
 ValuePtr ValuePtr::operator*(const ValuePtr &v) const
 {
+	PERF_PROBE("value-arithmetic");
 	return ValuePtr(**this * *v);
 }
 
 ValuePtr ValuePtr::operator/(const ValuePtr &v) const
 {
+	PERF_PROBE("value-arithmetic");
 	return ValuePtr(**this / *v);
 }
 
 ValuePtr ValuePtr::operator%(const ValuePtr &v) const
 {
+	PERF_PROBE("value-arithmetic");
 	return ValuePtr(**this % *v);
 }
 
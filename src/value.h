@@ -4,6 +4,8 @@
 #include <string>
 #include <algorithm>
 #include <limits>
+#include <initializer_list>
+#include <cstddef>
 
 // Workaround for https://bugreports.qt-project.org/browse/QTBUG-22829
 #ifndef Q_MOC_RUN
@@ -89,9 +91,11 @@ public:
 	
 	/// return number of values, max uint32_t value if step is 0 or range is infinite
 	uint32_t numValues() const;
+	/// true if the range can't be iterated to its end, i.e. numValues() is max uint32_t
+	bool isUnbounded() const { return numValues() == std::numeric_limits<uint32_t>::max(); }
   
 	friend class chr_visitor;
-	friend class tostring_visitor;
+	friend class tostream_visitor;
 	friend class bracket_visitor;
 };
 
@@ -102,13 +106,15 @@ public:
 
 	ValuePtr();
 	explicit ValuePtr(const Value &v);
+	explicit ValuePtr(Value &&v);
   ValuePtr(bool v);
   ValuePtr(int v);
   ValuePtr(double v);
   ValuePtr(const std::string &v);
   ValuePtr(const char *v);
   ValuePtr(const char v);
-  ValuePtr(const class std::vector<ValuePtr> &v);
+  ValuePtr(const class ValueVector &v);
+  ValuePtr(ValueVector &&v);
   ValuePtr(const class RangeType &v);
 
 	operator bool() const;
@@ -133,10 +139,96 @@ public:
 private:
 };
 
+/*!
+	The elements of a vector value. Copies and concatenations share the
+	storage of their elements, so building a list with concat(acc, [x]) or
+	[each acc, x] doesn't copy it at each step.
+
+	The elements are kept in segments, which are never modified once they
+	are shared. Each segment is at least twice as long as the next one, so
+	there are at most log2(n) of them: appending merges the last segments
+	until that holds again, which copies each element O(log n) times
+	while it is appended to. Vectors built with push_back() are a single
+	segment, which all non-const element access requires.
+*/
+class ValueVector
+{
+public:
+	typedef ValuePtr value_type;
+	typedef size_t size_type;
+	typedef const ValuePtr &const_reference;
+	typedef ValuePtr &reference;
+	typedef std::vector<ValuePtr> Segment;
+
+	class const_iterator {
+	public:
+		typedef const_iterator self_type;
+		typedef ValuePtr value_type;
+		typedef const ValuePtr &reference;
+		typedef const ValuePtr *pointer;
+		typedef std::forward_iterator_tag iterator_category;
+		typedef ptrdiff_t difference_type;
+		const_iterator() : vec(nullptr), segment(0), p(nullptr), end(nullptr) {}
+		const_iterator(const ValueVector *vec, size_t segment);
+		self_type &operator++() { if (++this->p == this->end) next(this->segment + 1); return *this; }
+		self_type operator++(int) { self_type it = *this; ++*this; return it; }
+		reference operator*() const { return *this->p; }
+		pointer operator->() const { return this->p; }
+		bool operator==(const self_type &other) const { return this->p == other.p; }
+		bool operator!=(const self_type &other) const { return this->p != other.p; }
+	private:
+		void next(size_t segment);
+		const ValueVector *vec;
+		size_t segment;
+		const ValuePtr *p, *end;
+	};
+	typedef const_iterator iterator;
+
+	ValueVector() : count(0) {}
+	explicit ValueVector(size_t n) : count(0) { resize(n); }
+	ValueVector(std::vector<ValuePtr> &&v);
+	ValueVector(std::initializer_list<ValuePtr> v) : ValueVector(std::vector<ValuePtr>(v)) {}
+
+	size_t size() const { return this->count; }
+	bool empty() const { return this->count == 0; }
+	const ValuePtr &operator[](size_t i) const {
+		return this->rest.empty() ? (*this->first)[i] : at(i);
+	}
+	ValuePtr &operator[](size_t i) { return flat()[i]; }
+	const ValuePtr &front() const { return (*this)[0]; }
+	const ValuePtr &back() const { return (*this)[this->count - 1]; }
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const { return const_iterator(); }
+
+	void push_back(const ValuePtr &v);
+	void push_back(ValuePtr &&v);
+	template<typename... Args> void emplace_back(Args&&... args) { push_back(ValuePtr(std::forward<Args>(args)...)); }
+	void append(const ValueVector &other);
+	void reserve(size_t n) { if (n > this->count) flat().reserve(n); }
+	void resize(size_t n);
+	void clear() { *this = ValueVector(); }
+
+	bool operator==(const ValueVector &other) const;
+	bool operator!=(const ValueVector &other) const { return !(*this == other); }
+
+private:
+	const ValuePtr &at(size_t i) const;
+	const Segment *segmentAt(size_t i) const { return i == 0 ? this->first.get() : this->rest[i - 1].get(); }
+	size_t numSegments() const { return this->first ? 1 + this->rest.size() : 0; }
+	Segment &flat();
+	Segment *editableLast();
+	void balance();
+	void appendSegment(const shared_ptr<Segment> &segment);
+
+	size_t count;
+	shared_ptr<Segment> first;
+	std::vector<shared_ptr<Segment>> rest; // Usually empty
+};
+
 class Value
 {
 public:
-	typedef std::vector<ValuePtr> VectorType;
+	typedef ValueVector VectorType;
 
   enum ValueType {
     UNDEFINED,
@@ -156,7 +248,10 @@ public:
   Value(const char *v);
   Value(const char v);
   Value(const VectorType &v);
+  Value(VectorType &&v);
   Value(const RangeType &v);
+  Value(const Value &v) = default;
+  Value(Value &&v) : value(std::move(v.value)) {}
   ~Value() {}
 
   ValueType type() const;
@@ -169,7 +264,9 @@ public:
   bool getFiniteDouble(double &v) const;
   bool toBool() const;
   std::string toString() const;
+  void toStream(std::ostream &stream, bool quoted = false) const;
   std::string chrString() const;
+  void chrAppend(std::string &result) const;
   const VectorType &toVector() const;
   bool getVec2(double &x, double &y, bool ignoreInfinite = false) const;
   bool getVec3(double &x, double &y, double &z, double defaultval = 0.0) const;
@@ -192,11 +289,7 @@ public:
   Value operator/(const Value &v) const;
   Value operator%(const Value &v) const;
 
-  friend std::ostream &operator<<(std::ostream &stream, const Value &value) {
-    if (value.type() == Value::STRING) stream << QuotedString(value.toString());
-    else stream << value.toString();
-    return stream;
-  }
+  friend std::ostream &operator<<(std::ostream &stream, const Value &value);
 
   typedef boost::variant< boost::blank, bool, double, std::string, VectorType, RangeType > Variant;
 
@@ -206,5 +299,8 @@ private:
   static Value multvecmat(const VectorType &vectorvec, const VectorType &matrixvec);
 
   Variant value;
+
+  friend class tostream_visitor;
+  friend class chr_visitor;
 };
 
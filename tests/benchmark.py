@@ -0,0 +1,196 @@
+#!/usr/bin/python
+#
+# Performance regression driver
+#
+# Usage: benchmark.py [<options>] <openscad> <file.scad>
+#
+# Runs the given design through the phases of a command-line export, each
+# in its own process:
+#
+#   parse        -o .ast
+#   instantiate  -o .csg
+#   csgtree      -o .term
+#   render       -o .scadgeom, evaluating the geometry
+#   export       imports the .scadgeom and exports it as .stl or .dxf
+#
+# For each phase the wall time (best of several runs) and the peak resident
+# memory are measured, and for the render phase the geometry cache
+# statistics are read from --cache-stats.
+#
+# The results are compared against <baselinedir>/<file>-expected.json. The
+# test fails if a phase is slower or uses more memory than the baseline
+# allows, or if the render phase has more cache misses. If there is no
+# baseline yet, or if the -g option is given or the TEST_GENERATE
+# environment variable is set to 1, the results are written as the baseline.
+#
+# Experimental features given with -e are enabled in all phases, and are part
+# of the baseline name, so each combination of features has its own baseline
+# for A/B comparisons. The features the render phase ran with, as reported in
+# its cache statistics, are kept in the results.
+#
+# Returns 0 on passed test
+#         1 on error or regression
+#         2 on invalid cmd-line options
+#
+
+import sys
+import os
+import getopt
+import json
+import shutil
+import struct
+import subprocess
+import tempfile
+import time
+
+PHASES = ["parse", "instantiate", "csgtree", "render", "export"]
+
+def error(msg):
+    sys.stderr.write(msg + "\n")
+
+def run(cmd):
+    """Runs cmd, returning (exit code, wall seconds, peak RSS in kB)."""
+    start = time.time()
+    proc = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+    output = proc.stdout.read()
+    pid, status, rusage = os.wait4(proc.pid, 0)
+    seconds = time.time() - start
+    proc.returncode = os.WEXITSTATUS(status) if os.WIFEXITED(status) else -1
+    if proc.returncode != 0:
+        error("Error running " + " ".join(cmd) + ":\n" + output.decode("utf-8", "replace"))
+    # ru_maxrss is in bytes on Mac OS X, in kilobytes elsewhere
+    rss = rusage.ru_maxrss
+    if sys.platform == "darwin": rss //= 1024
+    return proc.returncode, seconds, rss
+
+def measure(cmd, runs):
+    best = None
+    peak = 0
+    for i in range(runs):
+        retval, seconds, rss = run(cmd)
+        if retval != 0: return None
+        if best is None or seconds < best: best = seconds
+        peak = max(peak, rss)
+    return {"seconds": round(best, 3), "rss_kb": peak}
+
+def dimension(scadgeomfile):
+    """Returns 2 or 3 from the geometry type in a .scadgeom header."""
+    with open(scadgeomfile, "rb") as f:
+        header = f.read(16)
+    if len(header) < 16: return 3
+    return 2 if struct.unpack("<I", header[12:16])[0] == 2 else 3
+
+def run_benchmark(openscad, scadfile, workdir, runs, features):
+    name = os.path.splitext(os.path.basename(scadfile))[0]
+    out = os.path.join(workdir, name)
+    results = {}
+    phases = [("parse", [out + ".ast"]),
+              ("instantiate", [out + ".csg"]),
+              ("csgtree", [out + ".term"]),
+              ("render", [out + ".scadgeom", "--cache-stats=" + out + "-stats.json"])]
+    enable = ["--enable=" + f for f in features]
+    for phase, args in phases:
+        result = measure([openscad] + enable + ["-o"] + args + [scadfile], runs)
+        if result is None: return None
+        results[phase] = result
+
+    with open(out + "-stats.json") as f:
+        stats = json.load(f)
+    geometry = stats["geometry"]
+    results["render"]["cache"] = dict((k, geometry[k]) for k in ("hits", "misses", "entries", "bytes"))
+    results["features"] = sorted(k for k, v in stats.get("features", {}).items() if v)
+
+    importfile = os.path.join(workdir, name + "-import.scad")
+    with open(importfile, "w") as f:
+        f.write('import("%s");\n' % (out + ".scadgeom").replace("\\", "/"))
+    suffix = ".dxf" if dimension(out + ".scadgeom") == 2 else ".stl"
+    result = measure([openscad] + enable + ["-o", out + suffix, importfile], runs)
+    if result is None: return None
+    results["export"] = result
+    return results
+
+def compare(results, baseline, time_tolerance, memory_tolerance):
+    ok = True
+    for phase in PHASES:
+        if phase not in baseline: continue
+        actual, expected = results[phase], baseline[phase]
+        # Allows for the noise of timing short runs
+        maxseconds = expected["seconds"] * (1 + time_tolerance) + 0.05
+        maxrss = expected["rss_kb"] * (1 + memory_tolerance)
+        line = "%-12s %8.3f s (baseline %8.3f s) %10d kB (baseline %10d kB)" % (
+            phase, actual["seconds"], expected["seconds"], actual["rss_kb"], expected["rss_kb"])
+        if actual["seconds"] > maxseconds:
+            line += "  SLOWER"
+            ok = False
+        if actual["rss_kb"] > maxrss:
+            line += "  MORE MEMORY"
+            ok = False
+        if "cache" in expected and actual["cache"]["misses"] > expected["cache"]["misses"]:
+            line += "  MORE CACHE MISSES (%d, baseline %d)" % (actual["cache"]["misses"], expected["cache"]["misses"])
+            ok = False
+        print(line)
+    return ok
+
+def usage():
+    error("Usage: " + sys.argv[0] + " [<options>] <openscad> <file.scad>")
+    error("Options:")
+    error("  -g, --generate              Write the results as the new baseline")
+    error("  -b, --baseline-dir=<dir>    Directory of the baselines (default: regression/benchmark)")
+    error("  -r, --runs=<n>              Runs per phase, the fastest one counts (default: 3)")
+    error("  -t, --time-tolerance=<f>    Allowed relative slowdown (default: 0.25)")
+    error("  -m, --memory-tolerance=<f>  Allowed relative increase of peak memory (default: 0.1)")
+    error("  -e, --enable=<feature>      Enable an experimental feature, may be repeated")
+
+if __name__ == '__main__':
+    try:
+        opts, args = getopt.getopt(sys.argv[1:], "gb:r:t:m:e:", ["generate", "baseline-dir=", "runs=", "time-tolerance=", "memory-tolerance=", "enable="])
+    except getopt.GetoptError:
+        usage()
+        sys.exit(2)
+
+    generate = bool(os.getenv("TEST_GENERATE"))
+    baselinedir = os.path.join(os.path.split(sys.argv[0])[0], "regression", "benchmark")
+    runs = 3
+    time_tolerance = 0.25
+    memory_tolerance = 0.1
+    features = []
+    for o, a in opts:
+        if o in ("-g", "--generate"): generate = True
+        elif o in ("-b", "--baseline-dir"): baselinedir = a
+        elif o in ("-r", "--runs"): runs = int(a)
+        elif o in ("-t", "--time-tolerance"): time_tolerance = float(a)
+        elif o in ("-m", "--memory-tolerance"): memory_tolerance = float(a)
+        elif o in ("-e", "--enable"): features.append(a)
+
+    if len(args) != 2:
+        usage()
+        sys.exit(2)
+    openscad, scadfile = args
+
+    workdir = tempfile.mkdtemp(prefix="openscad-benchmark-")
+    try:
+        results = run_benchmark(openscad, os.path.abspath(scadfile), workdir, runs, features)
+    finally:
+        shutil.rmtree(workdir, True)
+    if results is None: sys.exit(1)
+    missing = set(features) - set(results["features"])
+    if missing:
+        error("Features not enabled by " + openscad + ": " + ", ".join(sorted(missing)))
+        sys.exit(1)
+
+    name = os.path.splitext(os.path.basename(scadfile))[0]
+    for feature in sorted(set(features)): name += "+" + feature
+    baselinefile = os.path.join(baselinedir, name + "-expected.json")
+    if generate or not os.path.isfile(baselinefile):
+        if not os.path.isdir(baselinedir): os.makedirs(baselinedir)
+        with open(baselinefile, "w") as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+            f.write("\n")
+        print("Wrote baseline " + baselinefile)
+        for phase in PHASES:
+            print("%-12s %8.3f s %10d kB" % (phase, results[phase]["seconds"], results[phase]["rss_kb"]))
+        sys.exit(0)
+
+    with open(baselinefile) as f:
+        baseline = json.load(f)
+    sys.exit(0 if compare(results, baseline, time_tolerance, memory_tolerance) else 1)
@@ -38,8 +38,8 @@
 #include "Tree.h"
 #include "CGAL_Nef_polyhedron.h"
 #include "GeometryEvaluator.h"
-#include "CGALCache.h"
 #include "stackcheck.h"
+#include "GeometryCache.h"
 
 #ifndef _MSC_VER
 #include <getopt.h>
@@ -65,7 +65,7 @@ po::variables_map parse_options(int argc, char *argv[])
 	po::options_description desc("Allowed options");
 	desc.add_options()
 		("help,h", "help message")
-		("cgalcachesize", po::value<size_t>(), "Set CGAL cache size in bytes");
+		("cgalcachesize", po::value<size_t>(), "Set geometry cache size in bytes");
 	
 	po::options_description hidden("Hidden options");
 	hidden.add_options()
@@ -112,7 +112,7 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-	CGALCache::instance()->setMaxSize(cgalcachesize);
+	GeometryCache::instance()->setMaxSize(cgalcachesize);
 	
 	Builtins::instance()->initialize();
 
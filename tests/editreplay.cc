@@ -0,0 +1,343 @@
+/*
+ *  OpenSCAD (www.openscad.org)
+ *  Copyright (C) 2009-2011 Clifford Wolf <clifford@clifford.at> and
+ *                          Marius Kintel <marius@kintel.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  As a special exception, you have permission to link this program
+ *  with the CGAL library and distribute executables, as long as you
+ *  follow the requirements of the GNU GPL in regard to all of the
+ *  software in the executable aside from CGAL.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+	Replays an edit session of a design, measuring the latency of each edit
+	and how well the caches did, to evaluate cache changes against
+	interactive workloads rather than cold renders.
+
+	The session is a sequence of unified diffs of the design, one per edit,
+	as appended by e.g. "diff -u old.scad new.scad >> session.diff" on each
+	save. The design is rendered first, then after each edit, the same way
+	as the GUI does on compile and render: the text is parsed, instantiated
+	reusing unchanged subtrees, and its geometry evaluated with the caches
+	kept from the previous edits.
+*/
+
+#include "tests-common.h"
+#include "openscad.h"
+#include "printutils.h"
+#include "parsersettings.h"
+#include "node.h"
+#include "module.h"
+#include "FileModule.h"
+#include "ModuleInstantiation.h"
+#include "InstantiationCache.h"
+#include "modcontext.h"
+#include "builtin.h"
+#include "Tree.h"
+#include "GeometryEvaluator.h"
+#include "GeometryCache.h"
+#include "stackcheck.h"
+#include "PlatformUtils.h"
+#include "progress.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+
+#include <boost/format.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/program_options.hpp>
+namespace po = boost::program_options;
+#include <boost/filesystem.hpp>
+namespace fs = boost::filesystem;
+
+std::string commandline_commands;
+std::string currentdir;
+
+using std::string;
+typedef std::vector<string> Lines;
+typedef std::chrono::steady_clock Clock;
+
+static Lines split_lines(std::istream &stream)
+{
+	Lines lines;
+	string line;
+	while (std::getline(stream, line)) lines.push_back(line);
+	return lines;
+}
+
+/*!
+	Splits the session into the lines of each diff.
+*/
+static std::vector<Lines> read_session(const string &filename)
+{
+	std::ifstream stream(filename.c_str());
+	if (!stream.is_open()) throw std::runtime_error("Can't open session " + filename);
+	std::vector<Lines> diffs;
+	for(const auto &line : split_lines(stream)) {
+		if (boost::starts_with(line, "--- ") || diffs.empty()) diffs.push_back(Lines());
+		diffs.back().push_back(line);
+	}
+	return diffs;
+}
+
+/*!
+	Applies the unified diff \a diff to \a text, checking its context.
+*/
+static void apply_diff(Lines &text, const Lines &diff)
+{
+	Lines result;
+	size_t pos = 0; // in text
+	for (size_t i = 0; i < diff.size(); i++) {
+		int oldstart, oldcount = 1, newstart, newcount = 1;
+		if (sscanf(diff[i].c_str(), "@@ -%d,%d +%d,%d @@", &oldstart, &oldcount, &newstart, &newcount) < 2 &&
+				sscanf(diff[i].c_str(), "@@ -%d +%d,%d @@", &oldstart, &newstart, &newcount) < 2) continue;
+		// An empty range starts after the given line
+		const size_t start = oldcount == 0 ? oldstart : oldstart - 1;
+		if (start < pos || start > text.size()) throw std::runtime_error("Hunk out of order: " + diff[i]);
+		result.insert(result.end(), text.begin() + pos, text.begin() + start);
+		pos = start;
+		for (i++; i < diff.size() && !boost::starts_with(diff[i], "@@"); i++) {
+			const string &line = diff[i];
+			if (line.empty()) continue;
+			const string content = line.substr(1);
+			if (line[0] == '+') {
+				result.push_back(content);
+			}
+			else if (line[0] == ' ' || line[0] == '-') {
+				if (pos >= text.size() || text[pos] != content) throw std::runtime_error("Context doesn't match: " + line);
+				if (line[0] == ' ') result.push_back(content);
+				pos++;
+			}
+		}
+		i--;
+	}
+	result.insert(result.end(), text.begin() + pos, text.end());
+	text.swap(result);
+}
+
+struct EditTime {
+	double parse;
+	double instantiate;
+	double geometry;
+	size_t reused;  // top-level subtrees kept from the previous edit
+	size_t nodes;
+	CacheStats cache;
+
+	double total() const { return this->parse + this->instantiate + this->geometry; }
+};
+
+static double seconds_since(const Clock::time_point &start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static size_t count_nodes(const AbstractNode &node)
+{
+	size_t count = 1;
+	for(const auto &child : node.children) count += count_nodes(*child);
+	return count;
+}
+
+/*!
+	The state of the design between edits, like that of the MainWindow.
+*/
+class Session
+{
+public:
+	Session(const fs::path &path, bool reuse) : path(path), reuse(reuse), root_module(NULL), absolute_root_node(NULL),
+																							root_node(NULL), root_inst("group") {
+		this->top_ctx.registerBuiltin();
+	}
+	~Session() {
+		if (this->absolute_root_node) this->instcache.detach(*this->absolute_root_node);
+		delete this->absolute_root_node;
+		delete this->root_module;
+	}
+
+	EditTime render(const Lines &text) {
+		EditTime t;
+		GeometryCache::instance()->resetStats();
+
+		// MainWindow::compileTopLevelDocument()
+		Clock::time_point start = Clock::now();
+		std::string fulltext;
+		for(const auto &line : text) fulltext += line + "\n";
+		fulltext += "\n" + commandline_commands;
+		delete this->root_module;
+		this->root_module = parse(fulltext.c_str(), this->path, false);
+		if (this->root_module) this->root_module->handleDependencies();
+		t.parse = seconds_since(start);
+
+		// MainWindow::instantiateRoot()
+		start = Clock::now();
+		if (this->absolute_root_node) this->instcache.detach(*this->absolute_root_node);
+		delete this->absolute_root_node;
+		this->absolute_root_node = this->root_node = NULL;
+		this->tree.setRoot(NULL);
+		if (!this->reuse) this->instcache.clear();
+		if (this->root_module) {
+			AbstractNode::resetIndexCounter();
+			this->absolute_root_node = this->root_module->instantiate(&this->top_ctx, &this->root_inst, this->instcache);
+		}
+		if (this->absolute_root_node) {
+			if (!(this->root_node = find_root_tag(this->absolute_root_node))) this->root_node = this->absolute_root_node;
+			this->tree.setRoot(this->root_node);
+			this->instcache.restoreIds(this->tree);
+			this->tree.getIdString(*this->root_node);
+			this->instcache.saveIds(this->tree);
+		}
+		t.instantiate = seconds_since(start);
+		t.reused = this->instcache.reusedCount();
+		t.nodes = this->root_node ? count_nodes(*this->root_node) : 0;
+
+		// CGALWorker::work()
+		start = Clock::now();
+		if (this->root_node) {
+			GeometryEvaluator evaluator(this->tree);
+			evaluator.evaluateGeometry(*this->root_node, true);
+		}
+		t.geometry = seconds_since(start);
+
+		t.cache = GeometryCache::instance()->stats();
+		return t;
+	}
+
+private:
+	fs::path path;
+	bool reuse;
+	FileModule *root_module;
+	AbstractNode *absolute_root_node;
+	AbstractNode *root_node;
+	ModuleInstantiation root_inst;
+	ModuleContext top_ctx;
+	InstantiationCache instcache;
+	Tree tree;
+};
+
+static double percentile(std::vector<double> values, double p)
+{
+	if (values.empty()) return 0;
+	std::sort(values.begin(), values.end());
+	return values[std::min(values.size() - 1, size_t(p * values.size()))];
+}
+
+po::variables_map parse_options(int argc, char *argv[])
+{
+	po::options_description desc("Allowed options");
+	desc.add_options()
+		("help,h", "help message")
+		("cache-size", po::value<size_t>(), "Geometry cache size in MB")
+		("no-reuse", "Instantiate the whole design on each edit")
+		("verbose,v", "Print the messages of the design");
+
+	po::options_description hidden("Hidden options");
+	hidden.add_options()
+		("input-file", po::value<string>(), "input file")
+		("session-file", po::value<string>(), "session file");
+
+	po::positional_options_description p;
+	p.add("input-file", 1).add("session-file", 1);
+
+	po::options_description all_options;
+	all_options.add(desc).add(hidden);
+
+	po::variables_map vm;
+	po::store(po::command_line_parser(argc, argv).options(all_options).positional(p).run(), vm);
+	po::notify(vm);
+	if (vm.count("help") || !vm.count("input-file") || !vm.count("session-file")) {
+		std::cout << "Usage: " << argv[0] << " [options] <file.scad> <session.diff>\n" << desc;
+		exit(vm.count("help") ? 0 : 1);
+	}
+	return vm;
+}
+
+int main(int argc, char **argv)
+{
+	po::variables_map vm;
+	try {
+		vm = parse_options(argc, argv);
+	} catch (const po::error &e) {
+		std::cerr << "error parsing options: " << e.what() << "\n";
+		exit(1);
+	}
+	StackCheck::inst()->init();
+	if (vm.count("cache-size")) GeometryCache::instance()->setMaxSize(vm["cache-size"].as<size_t>() * 1024 * 1024);
+	OpenSCAD::quiet = !vm.count("verbose");
+
+	Builtins::instance()->initialize();
+	PlatformUtils::registerApplicationPath(fs::path(argv[0]).branch_path().generic_string());
+	parser_init();
+
+	const fs::path path = fs::absolute(vm["input-file"].as<string>());
+	Lines text;
+	std::vector<Lines> diffs;
+	try {
+		std::ifstream stream(path.string().c_str());
+		if (!stream.is_open()) throw std::runtime_error("Can't open " + path.string());
+		text = split_lines(stream);
+		diffs = read_session(vm["session-file"].as<string>());
+	} catch (const std::exception &e) {
+		std::cerr << e.what() << "\n";
+		exit(1);
+	}
+	currentdir = path.parent_path().generic_string();
+	fs::current_path(path.parent_path());
+
+	Session session(path, !vm.count("no-reuse"));
+	std::vector<double> latencies;
+	size_t hits = 0, misses = 0;
+	std::cout << boost::format("%5s %9s %9s %9s %9s %7s %7s %7s %7s %8s\n") % "edit" % "parse/s" % "inst/s" %
+		"geom/s" % "total/s" % "nodes" % "reused" % "hits" % "misses" % "hitrate";
+	for (size_t edit = 0; edit <= diffs.size(); edit++) {
+		try {
+			if (edit > 0) apply_diff(text, diffs[edit - 1]);
+			const EditTime t = session.render(text);
+			const size_t edithits = t.cache.hits;
+			const size_t editmisses = t.cache.misses;
+			std::cout << boost::format("%5d %9.3f %9.3f %9.3f %9.3f %7d %7d %7d %7d %7.1f%%\n") % edit % t.parse %
+				t.instantiate % t.geometry % t.total() % t.nodes % t.reused % edithits % editmisses %
+				(edithits + editmisses ? 100.0 * edithits / (edithits + editmisses) : 0);
+			// The first render is cold, so it isn't counted
+			if (edit > 0) {
+				latencies.push_back(t.total());
+				hits += edithits;
+				misses += editmisses;
+			}
+		} catch (const ProgressCancelException &) {
+			std::cout << boost::format("%5d cancelled\n") % edit;
+		} catch (const std::exception &e) {
+			std::cerr << boost::format("Edit %d: %s\n") % edit % e.what();
+			exit(1);
+		}
+	}
+
+	if (!latencies.empty()) {
+		double sum = 0;
+		for(const auto &l : latencies) sum += l;
+		std::cout << boost::format("\n%d edits: mean %.3f s, median %.3f s, 90th percentile %.3f s, max %.3f s, cache hit rate %.1f%%\n") %
+			latencies.size() % (sum / latencies.size()) % percentile(latencies, 0.5) % percentile(latencies, 0.9) %
+			percentile(latencies, 1) % (hits + misses ? 100.0 * hits / (hits + misses) : 0);
+	}
+
+	Builtins::instance(true);
+	return 0;
+}
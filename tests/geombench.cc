@@ -0,0 +1,275 @@
+/*
+ *  OpenSCAD (www.openscad.org)
+ *  Copyright (C) 2009-2011 Clifford Wolf <clifford@clifford.at> and
+ *                          Marius Kintel <marius@kintel.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  As a special exception, you have permission to link this program
+ *  with the CGAL library and distribute executables, as long as you
+ *  follow the requirements of the GNU GPL in regard to all of the
+ *  software in the executable aside from CGAL.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+	Micro-benchmarks of the geometry kernels. Each kernel is run on
+	synthetic inputs of doubling size, and the time is printed together with
+	the exponent of the growth from the previous size, i.e. about 1 for
+	linear and 2 for quadratic scaling.
+*/
+
+#include "tests-common.h"
+#include "printutils.h"
+#include "export.h"
+#include "cgal.h"
+#include "cgalutils.h"
+#include "clipper-utils.h"
+#include "polyset-utils.h"
+#include "polyset.h"
+#include "Polygon2d.h"
+#include "PlatformUtils.h"
+
+#include <iostream>
+#include <sstream>
+#include <cmath>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+
+#include <boost/format.hpp>
+#include <boost/program_options.hpp>
+namespace po = boost::program_options;
+#include <boost/filesystem.hpp>
+namespace fs = boost::filesystem;
+
+std::string commandline_commands;
+std::string currentdir;
+
+using std::string;
+
+/*!
+	A closed cylinder with \a fragments sides, laid out like the one built
+	by cylinder(), so the caps are polygons with \a fragments vertices.
+*/
+static shared_ptr<const PolySet> make_cylinder(int fragments, double r, double x = 0)
+{
+	PolySet *p = new PolySet(3, true);
+	std::vector<Vector2d> circle(fragments);
+	for (int i = 0; i < fragments; i++) {
+		const double phi = 2 * M_PI * i / fragments;
+		circle[i] = Vector2d(x + r * cos(phi), r * sin(phi));
+	}
+	const double z1 = -r, z2 = r;
+	for (int i = 0; i < fragments; i++) {
+		const int j = (i + 1) % fragments;
+		p->append_poly();
+		p->insert_vertex(circle[i][0], circle[i][1], z1);
+		p->insert_vertex(circle[i][0], circle[i][1], z2);
+		p->insert_vertex(circle[j][0], circle[j][1], z2);
+		p->insert_vertex(circle[j][0], circle[j][1], z1);
+	}
+	p->append_poly();
+	for (int i = 0; i < fragments; i++) p->insert_vertex(circle[i][0], circle[i][1], z1);
+	p->append_poly();
+	for (int i = 0; i < fragments; i++) p->append_vertex(circle[i][0], circle[i][1], z2);
+	return shared_ptr<const PolySet>(p);
+}
+
+static shared_ptr<const Polygon2d> make_circle(int fragments, double r, double x = 0)
+{
+	Polygon2d *poly = new Polygon2d;
+	Outline2d o;
+	o.vertices.resize(fragments);
+	for (int i = 0; i < fragments; i++) {
+		const double phi = 2 * M_PI * i / fragments;
+		o.vertices[i] = Vector2d(x + r * cos(phi), r * sin(phi));
+	}
+	poly->addOutline(o);
+	return shared_ptr<const Polygon2d>(poly);
+}
+
+/*!
+	Two overlapping cylinders as operands of a CSG operation.
+*/
+static Geometry::Geometries make_operands(int fragments)
+{
+	Geometry::Geometries children;
+	children.push_back(std::make_pair((const AbstractNode *)NULL, make_cylinder(fragments, 10)));
+	children.push_back(std::make_pair((const AbstractNode *)NULL, make_cylinder(fragments, 10, 5)));
+	return children;
+}
+
+/*!
+	A kernel prepares its input of the given size and returns the function
+	which is timed.
+*/
+struct Kernel {
+	const char *name;
+	int minsize, maxsize;
+	std::function<std::function<void()>(int)> prepare;
+};
+
+static std::function<void()> operator_kernel(int size, OpenSCADOperator op)
+{
+	const Geometry::Geometries children = make_operands(size);
+	return [children, op]() { delete CGALUtils::applyOperator(children, op); };
+}
+
+static std::function<void()> export_kernel(int size, void (*exporter)(const shared_ptr<const Geometry> &, std::ostream &))
+{
+	const shared_ptr<const Geometry> geom = make_cylinder(size, 10);
+	return [geom, exporter]() {
+		std::ostringstream out;
+		exporter(geom, out);
+	};
+}
+
+static std::vector<Kernel> kernels()
+{
+	std::vector<Kernel> k;
+	k.push_back({"union", 8, 256, [](int size) { return operator_kernel(size, OPENSCAD_UNION); }});
+	k.push_back({"difference", 8, 256, [](int size) { return operator_kernel(size, OPENSCAD_DIFFERENCE); }});
+	k.push_back({"intersection", 8, 256, [](int size) { return operator_kernel(size, OPENSCAD_INTERSECTION); }});
+	k.push_back({"hull", 64, 65536, [](int size) -> std::function<void()> {
+				const Geometry::Geometries children = make_operands(size);
+				return [children]() {
+					PolySet P(3);
+					CGALUtils::applyHull(children, P);
+				};
+			}});
+	k.push_back({"minkowski", 8, 128, [](int size) -> std::function<void()> {
+				Geometry::Geometries children;
+				children.push_back(std::make_pair((const AbstractNode *)NULL, make_cylinder(size, 10)));
+				children.push_back(std::make_pair((const AbstractNode *)NULL, make_cylinder(8, 1)));
+				return [children]() { delete CGALUtils::applyMinkowski(children); };
+			}});
+	k.push_back({"nef-conversion", 8, 512, [](int size) -> std::function<void()> {
+				const shared_ptr<const PolySet> ps = make_cylinder(size, 10);
+				return [ps]() { delete CGALUtils::createNefPolyhedronFromGeometry(*ps); };
+			}});
+	k.push_back({"tessellate-faces", 64, 65536, [](int size) -> std::function<void()> {
+				const shared_ptr<const PolySet> ps = make_cylinder(size, 10);
+				return [ps]() {
+					PolySet out(3);
+					PolysetUtils::tessellate_faces(*ps, out);
+				};
+			}});
+	k.push_back({"clipper-union", 64, 65536, [](int size) -> std::function<void()> {
+				const shared_ptr<const Polygon2d> a = make_circle(size, 10), b = make_circle(size, 10, 5);
+				return [a, b]() {
+					std::vector<const Polygon2d *> polygons;
+					polygons.push_back(a.get());
+					polygons.push_back(b.get());
+					delete ClipperUtils::apply(polygons, ClipperLib::ctUnion);
+				};
+			}});
+	k.push_back({"offset", 64, 65536, [](int size) -> std::function<void()> {
+				const shared_ptr<const Polygon2d> poly = make_circle(size, 10);
+				return [poly]() { delete ClipperUtils::applyOffset(*poly, 1, ClipperLib::jtRound, 2, 0.01); };
+			}});
+	k.push_back({"export-stl", 64, 65536, [](int size) { return export_kernel(size, export_stl); }});
+	k.push_back({"export-off", 64, 65536, [](int size) { return export_kernel(size, export_off); }});
+	k.push_back({"export-amf", 64, 65536, [](int size) { return export_kernel(size, export_amf); }});
+	return k;
+}
+
+/*!
+	Returns the best time of \a repeat runs of \a f, in seconds.
+*/
+static double measure(const std::function<void()> &f, int repeat)
+{
+	double best = 0;
+	for (int i = 0; i < repeat; i++) {
+		const auto start = std::chrono::steady_clock::now();
+		f();
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		if (i == 0 || elapsed.count() < best) best = elapsed.count();
+	}
+	return best;
+}
+
+po::variables_map parse_options(int argc, char *argv[])
+{
+	po::options_description desc("Allowed options");
+	desc.add_options()
+		("help,h", "help message")
+		("kernel,k", po::value<std::vector<string>>(), "Only run the given kernel, may be repeated")
+		("list,l", "List the kernels")
+		("max-size,m", po::value<int>(), "Largest input size, overriding the default of each kernel")
+		("repeat,r", po::value<int>()->default_value(3), "Runs per size, the fastest one counts");
+
+	po::variables_map vm;
+	po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+	po::notify(vm);
+	if (vm.count("help")) {
+		std::cout << "Usage: " << argv[0] << " [options]\n" << desc;
+		exit(0);
+	}
+	return vm;
+}
+
+int main(int argc, char **argv)
+{
+	po::variables_map vm;
+	try {
+		vm = parse_options(argc, argv);
+	} catch (const po::error &e) {
+		std::cerr << "error parsing options: " << e.what() << "\n";
+		exit(1);
+	}
+
+	PlatformUtils::registerApplicationPath(fs::path(argv[0]).branch_path().generic_string());
+
+	const std::vector<Kernel> all = kernels();
+	if (vm.count("list")) {
+		for(const auto &kernel : all) std::cout << kernel.name << "\n";
+		return 0;
+	}
+	std::vector<string> selected;
+	if (vm.count("kernel")) selected = vm["kernel"].as<std::vector<string>>();
+	const int repeat = std::max(1, vm["repeat"].as<int>());
+
+	std::cout << boost::format("%-18s %8s %12s %9s\n") % "kernel" % "size" % "seconds" % "exponent";
+	bool found = selected.empty();
+	for(const auto &kernel : all) {
+		if (!selected.empty() && std::find(selected.begin(), selected.end(), kernel.name) == selected.end()) continue;
+		found = true;
+		const int maxsize = vm.count("max-size") ? vm["max-size"].as<int>() : kernel.maxsize;
+		double previous = 0;
+		for (int size = kernel.minsize; size <= maxsize; size *= 2) {
+			double seconds;
+			try {
+				seconds = measure(kernel.prepare(size), repeat);
+			} catch (const CGAL::Failure_exception &e) {
+				std::cout << boost::format("%-18s %8d failed: %s\n") % kernel.name % size % e.what();
+				break;
+			}
+			// The growth from the previous size, which has half the size
+			if (size > kernel.minsize && previous > 0 && seconds > 0) {
+				std::cout << boost::format("%-18s %8d %12.6f %9.2f\n") % kernel.name % size % seconds % (std::log(seconds / previous) / std::log(2.0));
+			}
+			else {
+				std::cout << boost::format("%-18s %8d %12.6f %9s\n") % kernel.name % size % seconds % "-";
+			}
+			previous = seconds;
+		}
+	}
+	if (!found) {
+		std::cerr << "Unknown kernel, use --list to show the kernels\n";
+		return 1;
+	}
+	return 0;
+}
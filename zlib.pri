@@ -0,0 +1,26 @@
+# Detect zlib, used to compress 3MF exports, then use this priority list
+# to determine which library to use:
+#
+# Priority
+# 1. ZLIB_INCLUDEPATH / ZLIB_LIBPATH (qmake parameter, not checked it given on commandline)
+# 2. OPENSCAD_LIBRARIES (environment variable)
+# 3. system's standard include paths
+
+zlib {
+
+# read environment variables
+OPENSCAD_LIBRARIES_DIR = $$(OPENSCAD_LIBRARIES)
+
+isEmpty(ZLIB_INCLUDEPATH) {
+  !isEmpty(OPENSCAD_LIBRARIES_DIR) {
+    exists($$OPENSCAD_LIBRARIES_DIR/include/zlib.h) {
+      ZLIB_INCLUDEPATH = $$OPENSCAD_LIBRARIES_DIR/include
+      ZLIB_LIBPATH = $$OPENSCAD_LIBRARIES_DIR/lib
+    }
+  }
+}
+
+!isEmpty(ZLIB_INCLUDEPATH): QMAKE_CXXFLAGS += -I$$ZLIB_INCLUDEPATH
+!isEmpty(ZLIB_LIBPATH): LIBS += -L$$ZLIB_LIBPATH
+LIBS += -lz
+}